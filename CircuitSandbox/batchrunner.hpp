@@ -0,0 +1,308 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Runs a save file without the window (and without initializing SDL), so that circuits can be simulated by scripts, e.g. for regression tests.
+ * The File Input and File Output Communicators are bound to the given files in reading order (top to bottom, then left to right), and the circuit is run as fast as possible.
+ *
+ * Usage: CircuitSandbox --batch [-n steps] [-e] [-s steps] [-t threads] [-b bytes] [-y] [-i file]... [-o file]... [-w log | -l log] [-x netlist] [-d host:port]... [-m partition] savefile
+ *   -n  stop after the given number of steps
+ *   -e  stop once the circuit has received the whole of every input file (and then run the steps given by -s, so that it can finish with the last byte)
+ *   -s  number of steps to run after the end of the input (default 65536)
+ *   -t  number of threads used to calculate each step (default 1, since batch jobs usually run side by side)
+ *   -b  size of the blocks in which the output files are written (default 1 MiB, since batch outputs are often large)
+ *   -y  flush the output files to the disk before exiting
+ *   -i  binds the next File Input Communicator to the given file
+ *   -o  binds the next File Output Communicator to the given file
+ *   -w  records the levels received by all the communicators to the given input log (see InputLog)
+ *   -l  replays the given input log (recorded by -w from the same save file) instead of listening to the communicators, so that the run is repeated exactly; -e then also waits for the end of the log
+ *   -x  writes the compiled circuit to the given netlist file (see Netlist::write()) before running it
+ *   -d  adds the node at the given address to a distributed run (see simulationcluster.hpp), which evaluates part of the gates and relays; the nodes are numbered from 1 in the order given
+ *   -m  splits the gates and relays between this process (node 0) and the nodes given by -d as the given partition file says (see Netlist::readAssignment()),
+ *       instead of in ranges of about the same size (see Netlist::balancedAssignment())
+ * At least one of -n and -e must be given, unless there is -x (then the circuit is only written, not run).  If both are, the run stops at whichever comes first.
+ * When done, prints the number of steps run, and the memory used by the canvas, the simulator and the communicators (see MemoryUsage).
+ * Exits with 0 once all the output files are written, 1 if a file cannot be read or written or a node of a distributed run cannot be reached, and 2 if the arguments are wrong.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <variant>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <cstdint>
+
+#include "canvasstate.hpp"
+#include "simulator.hpp"
+#include "elements.hpp"
+#include "fileinputcommunicator.hpp"
+#include "fileoutputcommunicator.hpp"
+#include "fileutils.hpp"
+#include "memoryusage.hpp"
+#include "inputlog.hpp"
+#include "simulationcluster.hpp"
+#include "netlist.hpp"
+
+class BatchRunner {
+private:
+    // number of steps fast-forwarded between checks for the end of the input
+    constexpr static uint64_t chunkSteps = 65536;
+
+    uint64_t maxSteps = 0; // zero if there is no limit
+    bool untilInputEnded = false;
+    uint64_t tailSteps = 65536;
+    size_t threads = 1;
+    FileOutputCommunicator::WritePolicy writePolicy{ size_t{ 1 } << 20, std::chrono::milliseconds(100), FileOutputCommunicator::SyncPolicy::NONE };
+    std::vector<std::string> inputPaths;
+    std::vector<std::string> outputPaths;
+    std::string recordPath;
+    std::string replayPath;
+    std::string netlistPath;
+    std::vector<std::string> nodeAddresses;
+    std::string partitionPath;
+    std::string savePath;
+
+    CanvasState state;
+    Simulator simulator;
+    ClusterCoordinator cluster;
+    std::vector<FileInputCommunicator*> inputs;
+    std::vector<FileOutputCommunicator*> outputs;
+
+    bool parseArguments(int argc, char* argv[]) {
+        for (int i = 0; i != argc; ++i) {
+            const std::string arg = argv[i];
+            if ((arg == "-n" || arg == "-s" || arg == "-t" || arg == "-b") && i + 1 != argc) {
+                char* end;
+                const unsigned long long value = std::strtoull(argv[++i], &end, 10);
+                if (*end != '\0') return false;
+                if (arg == "-n") {
+                    if (value == 0) return false;
+                    maxSteps = value;
+                }
+                else if (arg == "-s") tailSteps = value;
+                else if (arg == "-b") {
+                    if (value == 0) return false;
+                    writePolicy.blockSize = static_cast<size_t>(value);
+                }
+                else threads = static_cast<size_t>(value);
+            }
+            else if (arg == "-e") {
+                untilInputEnded = true;
+            }
+            else if (arg == "-y") {
+                writePolicy.sync = FileOutputCommunicator::SyncPolicy::ON_CLOSE;
+            }
+            else if (arg == "-i" && i + 1 != argc) {
+                inputPaths.emplace_back(argv[++i]);
+            }
+            else if (arg == "-o" && i + 1 != argc) {
+                outputPaths.emplace_back(argv[++i]);
+            }
+            else if (arg == "-w" && i + 1 != argc) {
+                recordPath = argv[++i];
+            }
+            else if (arg == "-l" && i + 1 != argc) {
+                replayPath = argv[++i];
+            }
+            else if (arg == "-x" && i + 1 != argc) {
+                netlistPath = argv[++i];
+            }
+            else if (arg == "-d" && i + 1 != argc) {
+                nodeAddresses.emplace_back(argv[++i]);
+            }
+            else if (arg == "-m" && i + 1 != argc) {
+                partitionPath = argv[++i];
+            }
+            else if (!arg.empty() && arg.front() != '-' && savePath.empty()) {
+                savePath = arg;
+            }
+            else {
+                return false;
+            }
+        }
+        return !savePath.empty() && (maxSteps != 0 || untilInputEnded || !netlistPath.empty()) && (recordPath.empty() || replayPath.empty()) && (partitionPath.empty() || !nodeAddresses.empty());
+    }
+
+    // collects the file communicators in reading order (a communicator that spans several pixels is only taken once)
+    void findCommunicators() {
+        for (int32_t y = 0; y != state.height(); ++y) {
+            for (int32_t x = 0; x != state.width(); ++x) {
+                std::visit([&](const auto& element) {
+                    using ElementType = std::decay_t<decltype(element)>;
+                    if constexpr (std::is_same_v<FileInputCommunicatorElement, ElementType>) {
+                        FileInputCommunicator* comm = state.communicatorOf(element);
+                        if (comm && std::find(inputs.begin(), inputs.end(), comm) == inputs.end()) inputs.push_back(comm);
+                    }
+                    else if constexpr (std::is_same_v<FileOutputCommunicatorElement, ElementType>) {
+                        FileOutputCommunicator* comm = state.communicatorOf(element);
+                        if (comm && std::find(outputs.begin(), outputs.end(), comm) == outputs.end()) outputs.push_back(comm);
+                    }
+                }, std::as_const(state)[ext::point{ x, y }]);
+            }
+        }
+    }
+
+    // runs the given number of steps at the fastest speed, and returns when they are done
+    void runSteps(uint64_t steps) {
+        simulator.startFastForward(steps);
+        while (!simulator.fastForwardFinished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        simulator.stop();
+    }
+
+    bool inputEnded() const {
+        return simulator.inputReplayFinished() && std::all_of(inputs.begin(), inputs.end(), [](const FileInputCommunicator* comm) {
+            return comm->inputEnded();
+        });
+    }
+
+    // returns the exit code
+    int execute() {
+        {
+            std::ifstream saveFile(savePath, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile) != CanvasState::ReadResult::OK) {
+                std::cerr << savePath << ": cannot be loaded" << std::endl;
+                return 1;
+            }
+        }
+
+        simulator.setWorkerThreads(threads);
+        simulator.setPeriod(Simulator::period_t::zero());
+        simulator.compile(state);
+
+        if (!netlistPath.empty()) {
+            std::ofstream netlistFile(netlistPath, std::ios::binary);
+            Netlist::write(simulator, netlistFile);
+            if (!netlistFile.flush()) {
+                std::cerr << netlistPath << ": cannot be written" << std::endl;
+                return 1;
+            }
+            if (maxSteps == 0 && !untilInputEnded) return 0;
+        }
+
+        if (!nodeAddresses.empty()) {
+            const uint32_t numNodes = static_cast<uint32_t>(nodeAddresses.size() + 1);
+            Simulator::NodeAssignment assignment;
+            if (partitionPath.empty()) {
+                assignment = Netlist::balancedAssignment(simulator, numNodes);
+            }
+            else {
+                std::ifstream partitionFile(partitionPath);
+                if (!partitionFile.is_open() || !Netlist::readAssignment(simulator, partitionFile, numNodes, assignment)) {
+                    std::cerr << partitionPath << ": is not a partition of the circuit into " << numNodes << " nodes" << std::endl;
+                    return 1;
+                }
+            }
+            if (!cluster.connect(simulator, nodeAddresses, assignment)) {
+                std::cerr << cluster.error() << std::endl;
+                return 1;
+            }
+        }
+
+        findCommunicators();
+        if (inputPaths.size() > inputs.size() || outputPaths.size() > outputs.size()) {
+            std::cerr << savePath << ": has " << inputs.size() << " file input and " << outputs.size() << " file output communicator(s), but " << inputPaths.size() << " input and " << outputPaths.size() << " output file(s) were given" << std::endl;
+            return 2;
+        }
+        for (size_t i = 0; i != inputPaths.size(); ++i) {
+            inputs[i]->setFile(inputPaths[i].c_str());
+        }
+        for (size_t i = 0; i != outputPaths.size(); ++i) {
+            outputs[i]->setWritePolicy(writePolicy);
+            outputs[i]->setFile(outputPaths[i].c_str());
+        }
+        // only the communicators that were bound are waited for and drained
+        inputs.resize(inputPaths.size());
+        outputs.resize(outputPaths.size());
+
+        if (!replayPath.empty()) {
+            InputLog log;
+            std::ifstream logFile(replayPath, std::ios::binary);
+            if (!logFile.is_open() || !log.read(logFile)) {
+                std::cerr << replayPath << ": cannot be read" << std::endl;
+                return 1;
+            }
+            if (!simulator.startReplayingInputs(std::move(log))) {
+                std::cerr << replayPath << ": was recorded from a circuit with a different number of communicators" << std::endl;
+                return 1;
+            }
+        }
+        if (!recordPath.empty()) simulator.startRecordingInputs();
+
+        uint64_t stepsDone = 0;
+        const auto remaining = [&]() {
+            return maxSteps != 0 ? maxSteps - stepsDone : UINT64_MAX;
+        };
+        while (remaining() != 0 && !(untilInputEnded && inputEnded()) && !cluster.failed()) {
+            const uint64_t steps = std::min(chunkSteps, remaining());
+            runSteps(steps);
+            stepsDone += steps;
+        }
+        if (untilInputEnded && remaining() != 0 && tailSteps != 0 && !cluster.failed()) {
+            const uint64_t steps = std::min(tailSteps, remaining());
+            runSteps(steps);
+            stepsDone += steps;
+        }
+
+        bool written = true;
+        if (cluster.failed()) {
+            std::cerr << cluster.error() << std::endl;
+            written = false;
+        }
+        cluster.close();
+        for (size_t i = 0; i != outputs.size(); ++i) {
+            if (!outputs[i]->drain()) {
+                std::cerr << outputPaths[i] << ": cannot be written" << std::endl;
+                written = false;
+            }
+        }
+        if (!recordPath.empty()) {
+            const InputLog log = simulator.takeRecordedInputs();
+            std::ofstream logFile(recordPath, std::ios::binary);
+            log.write(logFile);
+            if (!logFile.flush()) {
+                std::cerr << recordPath << ": cannot be written" << std::endl;
+                written = false;
+            }
+            else {
+                std::cout << recordPath << ": " << log.entries.size() << " input changes" << std::endl;
+            }
+        }
+        std::cout << savePath << ": " << stepsDone << " steps" << std::endl;
+        MemoryUsage memoryUsage;
+        memoryUsage.canvas = state.memoryUsage();
+        memoryUsage.staticData = simulator.getStaticDataMemoryUsage();
+        memoryUsage.dynamicData = simulator.getDynamicDataMemoryUsage();
+        memoryUsage.communicators = state.communicatorMemoryUsage();
+        std::cout << savePath << ": memory: " << memoryUsage << std::endl;
+        return written ? 0 : 1;
+    }
+
+public:
+    /**
+     * Runs the batch given by the arguments after CCSB_BATCH_ARGUMENT, and returns the exit code of the process.
+     */
+    static int run(int argc, char* argv[], const char* processName) {
+        BatchRunner runner;
+        if (!runner.parseArguments(argc, argv)) {
+            std::cerr << "Usage: " << processName << " " CCSB_BATCH_ARGUMENT " [-n steps] [-e] [-s steps] [-t threads] [-b bytes] [-y] [-i file]... [-o file]... [-w log | -l log] [-x netlist] [-d host:port]... [-m partition] savefile" << std::endl;
+            return 2;
+        }
+        return runner.execute();
+    }
+};
@@ -0,0 +1,469 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Headless benchmark of the simulator, so that changes to the engine can be compared without the window.
+ * It loads each given save file (or each save file in the given directories), compiles it, and runs it as fast as possible for a fixed number of steps.
+ * The times are taken from the simulator's own step statistics, so the time spent waiting for the steps to finish doesn't skew them.
+ *
+ * Usage: CircuitSandboxBenchmark [-n steps] [-t threads] [-k interval] [-e] [-f] [-r] [-x] [-a core] [-p] [-l] [-o] [-v] [-c csvfile] [files or directories...]
+ *   -n  number of steps to run each circuit for (default 100000)
+ *   -t  number of threads used to calculate each step (default 1)
+ *   -k  time only one in every interval steps (default 1), see Simulator::setStatisticsSampleInterval()
+ *   -e  use the event-driven simulation engine
+ *   -f  use the parallel flood fill engine
+ *   -r  use the grouped flood fill engine
+ *   -x  build the native step of each circuit with the C++ compiler of the machine, and use it instead of interpreting the sources, gates and relays (see NativeStepLibrary)
+ *   -a  pin the simulator thread to the given core, see Simulator::setSimThreadScheduling()
+ *   -p  raise the OS priority of the simulator thread
+ *   -l  run Simulator::laneCount instances at once in multi-instance mode (see Simulator::calculateLanes()), on the calling thread and without communicators
+ *   -o  time the opening of each circuit instead of running it: decoding the save file, compiling it, and compiling it from the cache written by the compile
+ *       (the window overlaps the decoding with its own construction, see FileOpenAction::startReading(), so only the cached compile is left after it)
+ *   -v  check the engines given by -t, -e, -f, -r and -x against the reference engines instead, by running both in lockstep and comparing their states after every step
+ *       (see EngineValidator::crossValidate()), or the instances of -l (see EngineValidator::crossValidateLanes()); prints the first difference of each circuit with its canvas position, and how fast each side ran
+ *   -c  also write the full step statistics of each circuit (per phase, and per fan-in of the gates) to the given CSV file
+ * If no files are given, the circuits in ../samples are used.
+ *
+ * Usage: CircuitSandboxBenchmark -g structure count size file
+ *   Writes a synthetic circuit (see circuitgenerator.hpp) to the given save file instead, so that it can be benchmarked at sizes the samples don't reach.
+ *   The structure is one of:
+ *     adder      count ripple carry adders of size bits each
+ *     crossbar   a relay crossbar with count rows and size columns
+ *     mesh       a woven wire mesh with count horizontal and size vertical wires
+ *     clocktree  count binary buffer trees of depth size
+ *     ram        a memory array of count words of size bits each
+ *
+ * Usage: CircuitSandboxBenchmark -q [elements]
+ *   Runs the micro-benchmarks of the ext:: queues instead (see queuebenchmark.hpp), passing the given number of elements through each queue (default 1000000).
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "canvasstate.hpp"
+#include "simulator.hpp"
+#include "enginevalidator.hpp"
+#include "nativestep.hpp"
+#include "fileutils.hpp"
+#include "circuitgenerator.hpp"
+#include "queuebenchmark.hpp"
+#include "tracing.hpp"
+
+using namespace std::literals::string_literals; // gives the 's' suffix for strings
+
+namespace {
+    struct Options {
+        uint64_t steps = 100000;
+        size_t threads = 1;
+        uint32_t sampleInterval = 1;
+        Simulator::SimulationEngine simulationEngine = Simulator::SimulationEngine::FULL;
+        Simulator::FloodFillEngine floodFillEngine = Simulator::FloodFillEngine::DEPTH_FIRST;
+        bool nativeStep = false;
+        int32_t simThreadCore = -1;
+        bool simThreadHighPriority = false;
+        bool lanes = false;
+        bool startup = false;
+        bool verify = false;
+        std::vector<std::filesystem::path> files;
+        std::filesystem::path csvFile; // empty if there is none
+    };
+
+    bool parseOptions(int argc, char* argv[], Options& options) {
+        std::vector<std::filesystem::path> paths;
+        for (int i = 1; i != argc; ++i) {
+            const std::string arg = argv[i];
+            if ((arg == "-n" || arg == "-t" || arg == "-k") && i + 1 != argc) {
+                char* end;
+                unsigned long long value = std::strtoull(argv[++i], &end, 10);
+                if (*end != '\0' || value == 0) return false;
+                if (arg == "-n") options.steps = value;
+                else if (arg == "-t") options.threads = static_cast<size_t>(value);
+                else if (value <= UINT32_MAX) options.sampleInterval = static_cast<uint32_t>(value);
+                else return false;
+            }
+            else if (arg == "-a" && i + 1 != argc) {
+                char* end;
+                unsigned long value = std::strtoul(argv[++i], &end, 10);
+                if (*end != '\0' || value > static_cast<unsigned long>(INT32_MAX)) return false;
+                options.simThreadCore = static_cast<int32_t>(value);
+            }
+            else if (arg == "-p") {
+                options.simThreadHighPriority = true;
+            }
+            else if (arg == "-l") {
+                options.lanes = true;
+            }
+            else if (arg == "-o") {
+                options.startup = true;
+            }
+            else if (arg == "-v") {
+                options.verify = true;
+            }
+            else if (arg == "-c" && i + 1 != argc) {
+                options.csvFile = argv[++i];
+            }
+            else if (arg == "-e") {
+                options.simulationEngine = Simulator::SimulationEngine::EVENT_DRIVEN;
+            }
+            else if (arg == "-f") {
+                options.floodFillEngine = Simulator::FloodFillEngine::PARALLEL;
+            }
+            else if (arg == "-r") {
+                options.floodFillEngine = Simulator::FloodFillEngine::GROUPED;
+            }
+            else if (arg == "-x") {
+                options.nativeStep = true;
+            }
+            else if (!arg.empty() && arg.front() == '-') {
+                return false;
+            }
+            else {
+                paths.emplace_back(arg);
+            }
+        }
+        // opening a circuit runs no steps to check, and the native step only does the work of the normal steps
+        if (options.verify && options.startup) return false;
+        if (options.nativeStep && (options.lanes || options.startup)) return false;
+        if (paths.empty()) paths.emplace_back("../samples");
+
+        // directories are replaced by the save files in them, in name order so that the results are easy to compare
+        for (const std::filesystem::path& path : paths) {
+            std::error_code ec;
+            if (std::filesystem::is_directory(path, ec)) {
+                std::vector<std::filesystem::path> dirFiles;
+                for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(path, ec)) {
+                    if (entry.path().extension() == "." CCSB_FILE_EXTENSION) dirFiles.push_back(entry.path());
+                }
+                std::sort(dirFiles.begin(), dirFiles.end());
+                options.files.insert(options.files.end(), dirFiles.begin(), dirFiles.end());
+            }
+            else {
+                options.files.push_back(path);
+            }
+        }
+        return true;
+    }
+
+    // returns false if the file can't be loaded
+    bool benchmarkFile(const std::filesystem::path& path, const Options& options, std::ostream* csv) {
+        using namespace std::chrono;
+
+        CanvasState state;
+        {
+            std::ifstream saveFile(path, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile) != CanvasState::ReadResult::OK) {
+                std::cerr << path.string() << ": cannot be loaded" << std::endl;
+                return false;
+            }
+        }
+
+        // the library outlives the simulator that uses it
+        NativeStepLibrary nativeStep;
+        Simulator simulator;
+        simulator.setWorkerThreads(options.threads);
+        simulator.setSimulationEngine(options.simulationEngine);
+        simulator.setFloodFillEngine(options.floodFillEngine);
+        simulator.setSimThreadScheduling(options.simThreadCore, options.simThreadHighPriority);
+        simulator.setPeriod(Simulator::period_t::zero());
+
+        const auto compileStart = steady_clock::now();
+        simulator.compile(state);
+        // building the native step counts as compiling
+        if (std::string error; options.nativeStep && !nativeStep.build(simulator, error)) {
+            std::cerr << path.string() << ": " << error << std::endl;
+            return false;
+        }
+        const duration<double> compileTime = steady_clock::now() - compileStart;
+
+        Simulator::StepStatistics statistics;
+        if (options.lanes) {
+            // every step calculates Simulator::laneCount instances, so each of them counts as a step
+            Simulator::LaneState oldState = simulator.makeLaneState();
+            Simulator::LaneState newState = simulator.makeLaneState();
+            const auto lanesStart = steady_clock::now();
+            for (uint64_t i = 0; i != options.steps; ++i) {
+                simulator.calculateLanes(oldState, newState, {});
+                std::swap(oldState, newState);
+            }
+            statistics.steps = statistics.sampledSteps = options.steps * Simulator::laneCount;
+            statistics.stepTime = duration_cast<Simulator::period_t>(steady_clock::now() - lanesStart);
+        }
+        else {
+            simulator.setCollectStatistics(true);
+            simulator.setStatisticsSampleInterval(options.sampleInterval);
+            simulator.startFastForward(options.steps);
+            while (!simulator.fastForwardFinished()) {
+                std::this_thread::sleep_for(milliseconds(1));
+            }
+            simulator.stop();
+
+            // the rates are computed from the time spent in the steps themselves, so that polling for the end doesn't skew them
+            statistics = simulator.takeStepStatistics();
+        }
+        const size_t gates = simulator.getGateCount();
+        const double stepNanos = duration<double, std::nano>(statistics.stepTime).count() / std::max<uint64_t>(statistics.sampledSteps, 1);
+        const double floodFillShare = statistics.stepTime.count() != 0 ? static_cast<double>(statistics.floodFillTime.count()) / statistics.stepTime.count() : 0.0;
+
+        std::cout << std::left << std::setw(32) << path.filename().string() << std::right
+            << std::setw(10) << gates
+            << std::setw(14) << std::fixed << std::setprecision(0) << (stepNanos != 0 ? 1e9 / stepNanos : 0.0)
+            << std::setw(12) << std::setprecision(2) << (gates != 0 ? stepNanos / gates : 0.0)
+            << std::setw(12) << std::setprecision(1) << floodFillShare * 100 << '%'
+            << std::setw(13) << std::setprecision(2) << compileTime.count() * 1000 << std::endl;
+
+        if (csv) {
+            // quote the name, since it may contain commas
+            *csv << '"' << path.filename().string() << "\"," << gates << ',';
+            statistics.writeCsvRow(*csv);
+            *csv << '\n';
+        }
+        return true;
+    }
+
+    // returns false if the file can't be loaded
+    bool benchmarkStartup(const std::filesystem::path& path, const Options& options) {
+        using namespace std::chrono;
+
+        CanvasState state;
+        const auto decodeStart = steady_clock::now();
+        {
+            std::ifstream saveFile(path, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile) != CanvasState::ReadResult::OK) {
+                std::cerr << path.string() << ": cannot be loaded" << std::endl;
+                return false;
+            }
+        }
+        const duration<double> decodeTime = steady_clock::now() - decodeStart;
+
+        std::stringstream cache;
+        Simulator simulator;
+        simulator.setWorkerThreads(options.threads);
+        const auto compileStart = steady_clock::now();
+        simulator.compile(state, &cache);
+        const duration<double> compileTime = steady_clock::now() - compileStart;
+
+        // a fresh copy of the canvas and a fresh simulator, as when the file is opened again (compiling has given the canvas its communicators)
+        CanvasState cachedState;
+        {
+            std::ifstream saveFile(path, std::ios::binary);
+            cachedState.loadSave(saveFile);
+        }
+        Simulator cachedSimulator;
+        cachedSimulator.setWorkerThreads(options.threads);
+        const auto cachedStart = steady_clock::now();
+        const bool cacheUsed = cachedSimulator.compileFromCache(cachedState, cache);
+        const duration<double> cachedTime = steady_clock::now() - cachedStart;
+
+        std::cout << std::left << std::setw(32) << path.filename().string() << std::right
+            << std::setw(10) << simulator.getGateCount()
+            << std::setw(13) << std::fixed << std::setprecision(2) << decodeTime.count() * 1000
+            << std::setw(13) << compileTime.count() * 1000
+            << std::setw(13) << cachedTime.count() * 1000 << (cacheUsed ? "" : " (not used)") << std::endl;
+        return true;
+    }
+
+    // e.g. "100000 steps, 1 thread(s), full engine, depth-first flood fill"
+    std::string engineDescription(const Options& options) {
+        return std::to_string(options.steps) + " steps, " + std::to_string(options.threads) + " thread(s), "
+            + (options.simulationEngine == Simulator::SimulationEngine::EVENT_DRIVEN ? "event-driven"s : "full"s) + " engine, "
+            + (options.floodFillEngine == Simulator::FloodFillEngine::PARALLEL ? "parallel"s : options.floodFillEngine == Simulator::FloodFillEngine::GROUPED ? "grouped"s : "depth-first"s) + " flood fill"
+            + (options.nativeStep ? ", native step"s : ""s);
+    }
+
+    const char* divergenceKindName(EngineValidator::Divergence::Kind kind) {
+        switch (kind) {
+        case EngineValidator::Divergence::Kind::COMPONENT_LEVEL: return "component";
+        case EngineValidator::Divergence::Kind::RELAY_PIXEL_LEVEL: return "relay pixel";
+        case EngineValidator::Divergence::Kind::RELAY_PIXEL_CONDUCTIVE: return "relay pixel conductivity";
+        case EngineValidator::Divergence::Kind::COMMUNICATOR_TRANSMIT: return "communicator transmit state";
+        }
+        return "";
+    }
+
+    // returns false if the file can't be loaded or the engines diverge
+    bool crossValidateFile(const std::filesystem::path& path, const Options& options) {
+        using namespace std::chrono;
+
+        CanvasState state;
+        {
+            std::ifstream saveFile(path, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile) != CanvasState::ReadResult::OK) {
+                std::cerr << path.string() << ": cannot be loaded" << std::endl;
+                return false;
+            }
+        }
+
+        // the library outlives the simulator that uses it
+        NativeStepLibrary nativeStep;
+        Simulator simulator;
+        simulator.setWorkerThreads(options.threads);
+        simulator.setSimulationEngine(options.simulationEngine);
+        simulator.setFloodFillEngine(options.floodFillEngine);
+        simulator.compile(state);
+        if (std::string error; options.nativeStep && !nativeStep.build(simulator, error)) {
+            std::cerr << path.string() << ": " << error << std::endl;
+            return false;
+        }
+
+        EngineValidator validator(simulator);
+        const EngineValidator::CrossValidation result = options.lanes ? validator.crossValidateLanes(options.steps, 0) : validator.crossValidate(options.steps);
+        const auto rate = [&](Simulator::period_t time) {
+            return time.count() != 0 ? result.steps / duration<double>(time).count() : 0.0;
+        };
+        const double candidateRate = rate(result.candidateTime);
+        const double referenceRate = rate(result.referenceTime);
+
+        std::cout << std::left << std::setw(32) << path.filename().string() << std::right
+            << std::setw(10) << simulator.getGateCount()
+            << std::setw(14) << std::fixed << std::setprecision(0) << candidateRate
+            << std::setw(14) << referenceRate
+            << std::setw(9) << std::setprecision(2) << (referenceRate != 0 ? candidateRate / referenceRate : 0.0) << 'x'
+            << "  " << (result.divergence ? "diverged" : "same") << std::endl;
+        if (const auto& divergence = result.divergence) {
+            std::cout << "  at step " << divergence->step;
+            if (options.lanes) std::cout << " of instance " << divergence->lane;
+            std::cout << ": " << divergenceKindName(divergence->kind) << " " << divergence->index
+                << " is " << (divergence->referenceLevel ? "HIGH" : "LOW") << " in the reference state";
+            if (divergence->point) std::cout << ", at (" << divergence->point->x << ", " << divergence->point->y << ")";
+            std::cout << std::endl;
+        }
+        return !result.divergence;
+    }
+
+    // returns the exit code
+    int generateFile(int argc, char* argv[]) {
+        static constexpr std::pair<const char*, CircuitGenerator::Structure> structures[] = {
+            { "adder", CircuitGenerator::Structure::RIPPLE_ADDER },
+            { "crossbar", CircuitGenerator::Structure::RELAY_CROSSBAR },
+            { "mesh", CircuitGenerator::Structure::WIRE_MESH },
+            { "clocktree", CircuitGenerator::Structure::CLOCK_TREE },
+            { "ram", CircuitGenerator::Structure::RAM_ARRAY }
+        };
+
+        auto structureIt = argc == 6 ? std::find_if(std::begin(structures), std::end(structures), [&](const auto& structure) {
+            return std::string(argv[2]) == structure.first;
+        }) : std::end(structures);
+        char* countEnd = nullptr;
+        char* sizeEnd = nullptr;
+        const long count = argc == 6 ? std::strtol(argv[3], &countEnd, 10) : 0;
+        const long size = argc == 6 ? std::strtol(argv[4], &sizeEnd, 10) : 0;
+        // the limits keep every coordinate within int32_t
+        const long maxSize = structureIt != std::end(structures) && structureIt->second == CircuitGenerator::Structure::CLOCK_TREE ? 24 : 1000000;
+        if (structureIt == std::end(structures) || *countEnd != '\0' || *sizeEnd != '\0' || count < 1 || count > 1000000 || size < 1 || size > maxSize) {
+            std::cerr << "Usage: " << argv[0] << " -g adder|crossbar|mesh|clocktree|ram count size file" << std::endl;
+            return 2;
+        }
+
+        const CanvasState state = CircuitGenerator::generate(structureIt->second, static_cast<int32_t>(count), static_cast<int32_t>(size));
+        std::ofstream saveFile(argv[5], std::ios::binary);
+        if (!saveFile.is_open() || state.writeSave(saveFile) != CanvasState::WriteResult::OK || !saveFile.flush()) {
+            std::cerr << argv[5] << ": cannot be written" << std::endl;
+            return 1;
+        }
+        std::cout << argv[5] << ": " << state.width() << "x" << state.height() << " (" << static_cast<int64_t>(state.width()) * state.height() << " pixels)" << std::endl;
+        return 0;
+    }
+
+    // returns the exit code
+    int benchmarkQueues(int argc, char* argv[]) {
+        char* end = nullptr;
+        const unsigned long long count = argc == 3 ? std::strtoull(argv[2], &end, 10) : 1000000;
+        if (argc > 3 || (end && *end != '\0') || count == 0) {
+            std::cerr << "Usage: " << argv[0] << " -q [elements]" << std::endl;
+            return 2;
+        }
+        return QueueBenchmark::run(std::cout, count) ? 0 : 1;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "-g") {
+        return generateFile(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "-q") {
+        return benchmarkQueues(argc, argv);
+    }
+
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [-n steps] [-t threads] [-k interval] [-e] [-f] [-r] [-x] [-a core] [-p] [-l] [-o] [-v] [-c csvfile] [files or directories...]" << std::endl;
+        return 2;
+    }
+
+    if (options.startup) {
+        std::cout << options.threads << " thread(s)" << std::endl;
+        std::cout << std::left << std::setw(32) << "circuit" << std::right
+            << std::setw(10) << "gates"
+            << std::setw(13) << "decode ms"
+            << std::setw(13) << "compile ms"
+            << std::setw(13) << "cached ms" << std::endl;
+        CIRCUIT_SANDBOX_TRACE_THREAD("main");
+        bool allLoaded = true;
+        for (const std::filesystem::path& path : options.files) {
+            if (!benchmarkStartup(path, options)) allLoaded = false;
+        }
+        CIRCUIT_SANDBOX_TRACE_WRITE();
+        return allLoaded ? 0 : 1;
+    }
+
+    if (options.verify) {
+        std::cout << engineDescription(options)
+            << (options.lanes ? ", "s + std::to_string(Simulator::laneCount) + " instances per step" : ""s) << ", against the reference" << std::endl;
+        std::cout << std::left << std::setw(32) << "circuit" << std::right
+            << std::setw(10) << "gates"
+            << std::setw(14) << "steps/s"
+            << std::setw(14) << "reference"
+            << std::setw(10) << "speedup" << std::endl;
+        bool allSame = true;
+        for (const std::filesystem::path& path : options.files) {
+            if (!crossValidateFile(path, options)) allSame = false;
+        }
+        return allSame ? 0 : 1;
+    }
+
+    std::cout << engineDescription(options)
+        << (options.lanes ? ", "s + std::to_string(Simulator::laneCount) + " instances per step" : ""s) << std::endl;
+    std::cout << std::left << std::setw(32) << "circuit" << std::right
+        << std::setw(10) << "gates"
+        << std::setw(14) << "steps/s"
+        << std::setw(12) << "ns/gate"
+        << std::setw(13) << "flood fill"
+        << std::setw(13) << "compile ms" << std::endl;
+
+    std::ofstream csv;
+    if (!options.csvFile.empty()) {
+        csv.open(options.csvFile);
+        if (!csv.is_open()) {
+            std::cerr << options.csvFile.string() << ": cannot be written" << std::endl;
+            return 1;
+        }
+        csv << "circuit,gates,";
+        Simulator::StepStatistics::writeCsvHeader(csv);
+        csv << '\n';
+    }
+
+    CIRCUIT_SANDBOX_TRACE_THREAD("main");
+    bool allLoaded = true;
+    for (const std::filesystem::path& path : options.files) {
+        if (!benchmarkFile(path, options, csv.is_open() ? &csv : nullptr)) allLoaded = false;
+    }
+    CIRCUIT_SANDBOX_TRACE_WRITE();
+    return allLoaded ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * Helpers to write trivially copyable values, arrays and strings to a binary stream in the native byte order and layout, and to read them back.
+ * Only suitable for files that are read on the machine that wrote them (e.g. caches and simulation checkpoints), not for save files.
+ * The read functions return false if the stream ends early, or if an array is longer than the given maximum (so that a malformed file can't make us allocate too much).
+ */
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+namespace ext {
+
+    // written in the native byte order near the start of such files, so that one from a machine with the other byte order is rejected
+    constexpr uint32_t byte_order_mark = 0x01020304;
+
+    template <typename T>
+    inline void write_binary(std::ostream& out, const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+
+    template <typename T>
+    inline bool read_binary(std::istream& in, T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof value));
+    }
+
+    /**
+     * Writes the size of the array followed by its elements.
+     */
+    template <typename T>
+    inline void write_binary_array(std::ostream& out, const T* data, size_t size) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        write_binary(out, static_cast<uint64_t>(size));
+        if (size > 0) out.write(reinterpret_cast<const char*>(data), size * sizeof(T));
+    }
+
+    /**
+     * Reads an array written by write_binary_array() into any contiguous container with resize().
+     */
+    template <typename Array>
+    inline bool read_binary_array(std::istream& in, Array& array, size_t max_size) {
+        uint64_t size;
+        if (!read_binary(in, size) || size > max_size) return false;
+        array.resize(static_cast<size_t>(size));
+        using T = std::decay_t<decltype(*std::begin(array))>;
+        static_assert(std::is_trivially_copyable_v<T>);
+        return size == 0 || static_cast<bool>(in.read(reinterpret_cast<char*>(&*std::begin(array)), size * sizeof(T)));
+    }
+
+    inline void write_binary_string(std::ostream& out, const std::string& str) {
+        write_binary_array(out, str.data(), str.size());
+    }
+
+    inline bool read_binary_string(std::istream& in, std::string& str, size_t max_size) {
+        return read_binary_array(in, str, max_size);
+    }
+}
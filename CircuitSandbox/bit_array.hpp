@@ -0,0 +1,361 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+ * Fixed-size arrays of logic levels used by the simulator.
+ * ext::bit_array packs 64 values into each word; ext::bool_array stores one bool per byte.
+ * Both have the same interface, so the simulator can be built with either representation.
+ */
+
+namespace ext {
+
+    /**
+     * Returns the index of the lowest set bit.
+     * @pre word != 0
+     */
+    inline unsigned count_trailing_zeros(uint64_t word) noexcept {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, word);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctzll(word));
+#endif
+    }
+
+    /**
+     * Returns the number of set bits.
+     */
+    inline unsigned popcount(uint64_t word) noexcept {
+#if defined(_MSC_VER)
+        return static_cast<unsigned>(__popcnt64(word));
+#else
+        return static_cast<unsigned>(__builtin_popcountll(word));
+#endif
+    }
+
+    class bit_array {
+    public:
+        using word_t = uint64_t;
+        constexpr static size_t word_bits = 64;
+
+    private:
+        std::unique_ptr<word_t[]> buffer;
+        size_t _size; // number of bits
+
+    public:
+        constexpr static size_t num_words(size_t bits) noexcept {
+            return (bits + word_bits - 1) / word_bits;
+        }
+
+        bit_array() noexcept : _size(0) {}
+
+        /**
+         * Creates an array of the given number of bits, all of which are initially false.
+         */
+        explicit bit_array(size_t size) : buffer(std::make_unique<word_t[]>(num_words(size))), _size(size) {}
+
+        bit_array(bit_array&&) noexcept = default;
+        bit_array& operator=(bit_array&&) noexcept = default;
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        size_t words() const noexcept {
+            return num_words(_size);
+        }
+
+        size_t bytes() const noexcept {
+            return words() * sizeof(word_t);
+        }
+
+        word_t* data() noexcept {
+            return buffer.get();
+        }
+
+        const word_t* data() const noexcept {
+            return buffer.get();
+        }
+
+        bool operator[](size_t index) const noexcept {
+            return (buffer[index / word_bits] >> (index % word_bits)) & 1;
+        }
+
+        void set(size_t index) noexcept {
+            buffer[index / word_bits] |= word_t{ 1 } << (index % word_bits);
+        }
+
+        void reset(size_t index) noexcept {
+            buffer[index / word_bits] &= ~(word_t{ 1 } << (index % word_bits));
+        }
+
+        /**
+         * ORs the given value into the bit at the given index (without branching).
+         */
+        void set_if(size_t index, bool value) noexcept {
+            buffer[index / word_bits] |= static_cast<word_t>(value) << (index % word_bits);
+        }
+
+        /**
+         * Reads the bit at the given index while other threads might be setting bits of the same word with test_and_set_atomic().
+         */
+        bool get_atomic(size_t index) const noexcept {
+#if defined(_MSC_VER)
+            const word_t word = static_cast<word_t>(__iso_volatile_load64(reinterpret_cast<const volatile __int64*>(buffer.get() + index / word_bits)));
+#else
+            const word_t word = __atomic_load_n(buffer.get() + index / word_bits, __ATOMIC_RELAXED);
+#endif
+            return (word >> (index % word_bits)) & 1;
+        }
+
+        /**
+         * Sets the bit at the given index, and returns whether it was already set, atomically with respect to other threads doing the same on the same word.
+         */
+        bool test_and_set_atomic(size_t index) noexcept {
+            const word_t mask = word_t{ 1 } << (index % word_bits);
+#if defined(_MSC_VER)
+            const word_t word = static_cast<word_t>(_InterlockedOr64(reinterpret_cast<volatile __int64*>(buffer.get() + index / word_bits), static_cast<__int64>(mask)));
+#else
+            const word_t word = __atomic_fetch_or(buffer.get() + index / word_bits, mask, __ATOMIC_RELAXED);
+#endif
+            return (word & mask) != 0;
+        }
+
+        /**
+         * Sets all bits to false.
+         */
+        void clear() noexcept {
+            std::fill_n(buffer.get(), words(), word_t{ 0 });
+        }
+
+        /**
+         * Copies all the bits from another array of the same size.
+         */
+        void assign(const bit_array& other) noexcept {
+            std::copy_n(other.buffer.get(), words(), buffer.get());
+        }
+
+        /**
+         * Calls callback(index) for each bit that is set, in increasing order of index.
+         * Zero words are skipped entirely, so this is fast for sparse arrays.
+         */
+        template <typename Callback>
+        void for_each_set(Callback callback) const {
+            const size_t numWords = words();
+            for (size_t i = 0; i != numWords; ++i) {
+                word_t word = buffer[i];
+                while (word != 0) {
+                    callback(i * word_bits + count_trailing_zeros(word));
+                    word &= word - 1; // remove the lowest set bit
+                }
+            }
+        }
+
+        /**
+         * Calls callback(index) for each bit in [begin, end) that is set, in increasing order of index.
+         */
+        template <typename Callback>
+        void for_each_set(size_t begin, size_t end, Callback callback) const {
+            if (begin >= end) return;
+            const size_t lastWord = (end - 1) / word_bits;
+            for (size_t i = begin / word_bits; i <= lastWord; ++i) {
+                word_t word = buffer[i];
+                if (i == begin / word_bits) word &= ~word_t{ 0 } << (begin % word_bits);
+                if (i == lastWord && end % word_bits != 0) word &= ~(~word_t{ 0 } << (end % word_bits));
+                while (word != 0) {
+                    callback(i * word_bits + count_trailing_zeros(word));
+                    word &= word - 1; // remove the lowest set bit
+                }
+            }
+        }
+
+        /**
+         * Calls callback(index) for each bit that differs from the same bit of another array of the same size, in increasing order of index.
+         */
+        template <typename Callback>
+        void for_each_difference(const bit_array& other, Callback callback) const {
+            const size_t numWords = words();
+            for (size_t i = 0; i != numWords; ++i) {
+                word_t word = buffer[i] ^ other.buffer[i];
+                while (word != 0) {
+                    callback(i * word_bits + count_trailing_zeros(word));
+                    word &= word - 1; // remove the lowest set bit
+                }
+            }
+        }
+
+        /**
+         * Calls callback(index) for each bit in [begin, end) that differs from the same bit of another array of the same size, in increasing order of index.
+         */
+        template <typename Callback>
+        void for_each_difference(const bit_array& other, size_t begin, size_t end, Callback callback) const {
+            if (begin >= end) return;
+            const size_t lastWord = (end - 1) / word_bits;
+            for (size_t i = begin / word_bits; i <= lastWord; ++i) {
+                word_t word = buffer[i] ^ other.buffer[i];
+                if (i == begin / word_bits) word &= ~word_t{ 0 } << (begin % word_bits);
+                if (i == lastWord && end % word_bits != 0) word &= ~(~word_t{ 0 } << (end % word_bits));
+                while (word != 0) {
+                    callback(i * word_bits + count_trailing_zeros(word));
+                    word &= word - 1; // remove the lowest set bit
+                }
+            }
+        }
+
+        /**
+         * Returns the number of bits that differ from the same bit of another array of the same size.
+         */
+        size_t count_differences(const bit_array& other) const noexcept {
+            const size_t numWords = words();
+            size_t count = 0;
+            for (size_t i = 0; i != numWords; ++i) {
+                count += popcount(buffer[i] ^ other.buffer[i]);
+            }
+            return count;
+        }
+
+        friend bool operator==(const bit_array& a, const bit_array& b) noexcept {
+            return a._size == b._size && std::equal(a.buffer.get(), a.buffer.get() + a.words(), b.buffer.get());
+        }
+
+        friend bool operator!=(const bit_array& a, const bit_array& b) noexcept {
+            return !(a == b);
+        }
+    };
+
+    class bool_array {
+    private:
+        std::unique_ptr<bool[]> buffer;
+        size_t _size;
+
+    public:
+        bool_array() noexcept : _size(0) {}
+
+        /**
+         * Creates an array of the given number of bools, all of which are initially false.
+         */
+        explicit bool_array(size_t size) : buffer(std::make_unique<bool[]>(size)), _size(size) {}
+
+        bool_array(bool_array&&) noexcept = default;
+        bool_array& operator=(bool_array&&) noexcept = default;
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        size_t bytes() const noexcept {
+            return _size * sizeof(bool);
+        }
+
+        bool* data() noexcept {
+            return buffer.get();
+        }
+
+        const bool* data() const noexcept {
+            return buffer.get();
+        }
+
+        bool operator[](size_t index) const noexcept {
+            return buffer[index];
+        }
+
+        void set(size_t index) noexcept {
+            buffer[index] = true;
+        }
+
+        void reset(size_t index) noexcept {
+            buffer[index] = false;
+        }
+
+        void set_if(size_t index, bool value) noexcept {
+            buffer[index] |= value;
+        }
+
+        bool get_atomic(size_t index) const noexcept {
+#if defined(_MSC_VER)
+            return __iso_volatile_load8(reinterpret_cast<const volatile char*>(buffer.get() + index)) != 0;
+#else
+            return __atomic_load_n(buffer.get() + index, __ATOMIC_RELAXED);
+#endif
+        }
+
+        bool test_and_set_atomic(size_t index) noexcept {
+#if defined(_MSC_VER)
+            return _InterlockedExchange8(reinterpret_cast<volatile char*>(buffer.get() + index), 1) != 0;
+#else
+            return __atomic_exchange_n(buffer.get() + index, true, __ATOMIC_RELAXED);
+#endif
+        }
+
+        void clear() noexcept {
+            std::fill_n(buffer.get(), _size, false);
+        }
+
+        void assign(const bool_array& other) noexcept {
+            std::copy_n(other.buffer.get(), _size, buffer.get());
+        }
+
+        template <typename Callback>
+        void for_each_set(Callback callback) const {
+            for (size_t i = 0; i != _size; ++i) {
+                if (buffer[i]) callback(i);
+            }
+        }
+
+        template <typename Callback>
+        void for_each_set(size_t begin, size_t end, Callback callback) const {
+            for (size_t i = begin; i < end; ++i) {
+                if (buffer[i]) callback(i);
+            }
+        }
+
+        template <typename Callback>
+        void for_each_difference(const bool_array& other, Callback callback) const {
+            for (size_t i = 0; i != _size; ++i) {
+                if (buffer[i] != other.buffer[i]) callback(i);
+            }
+        }
+
+        template <typename Callback>
+        void for_each_difference(const bool_array& other, size_t begin, size_t end, Callback callback) const {
+            for (size_t i = begin; i < end; ++i) {
+                if (buffer[i] != other.buffer[i]) callback(i);
+            }
+        }
+
+        size_t count_differences(const bool_array& other) const noexcept {
+            size_t count = 0;
+            for (size_t i = 0; i != _size; ++i) {
+                count += buffer[i] != other.buffer[i];
+            }
+            return count;
+        }
+
+        friend bool operator==(const bool_array& a, const bool_array& b) noexcept {
+            return a._size == b._size && std::equal(a.buffer.get(), a.buffer.get() + a._size, b.buffer.get());
+        }
+
+        friend bool operator!=(const bool_array& a, const bool_array& b) noexcept {
+            return !(a == b);
+        }
+    };
+}
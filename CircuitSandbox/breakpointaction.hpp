@@ -0,0 +1,99 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Action that asks the user for the condition of the breakpoint on an element.
+ */
+
+#include <string>
+#include <sstream>
+#include <optional>
+#include <array>
+#include <utility>
+#include <SDL.h>
+#include "textdialogaction.hpp"
+#include "simulator.hpp"
+#include "point.hpp"
+
+class BreakpointAction final : public TextDialogAction<BreakpointAction> {
+private:
+    ext::point canvasPoint;
+
+    using Condition = Simulator::Breakpoint::Condition;
+    constexpr static std::array<std::pair<Condition, const char*>, 5> conditionNames{ {
+        { Condition::RISING, "rise" },
+        { Condition::FALLING, "fall" },
+        { Condition::CHANGE, "change" },
+        { Condition::HIGH, "high" },
+        { Condition::LOW, "low" }
+    } };
+
+    static inline std::string initialText(const std::optional<Simulator::Breakpoint>& breakpoint) {
+        if (!breakpoint) return "rise 1";
+        for (const auto& [condition, name] : conditionNames) {
+            if (condition == breakpoint->condition) return name + (" " + std::to_string(breakpoint->count));
+        }
+        return "rise 1";
+    }
+
+    // parses "<condition> [count]", where the count defaults to 1
+    static inline std::optional<Simulator::Breakpoint> parse(const std::string& text) {
+        std::istringstream stream(text);
+        std::string name;
+        stream >> name;
+        Simulator::Breakpoint breakpoint;
+        bool found = false;
+        for (const auto& [condition, conditionName] : conditionNames) {
+            if (name == conditionName) {
+                breakpoint.condition = condition;
+                found = true;
+            }
+        }
+        if (!found) return std::nullopt;
+        if (stream >> std::ws; !stream.eof()) {
+            if (!(stream >> breakpoint.count) || breakpoint.count == 0) return std::nullopt;
+            if (stream >> std::ws; !stream.eof()) return std::nullopt;
+        }
+        return breakpoint;
+    }
+
+public:
+    BreakpointAction(MainWindow& mainWindow, SDL_Renderer* renderer, ext::point canvasPoint) : TextDialogAction<BreakpointAction>(mainWindow, renderer, initialText(mainWindow.stateManager.getSimulatorBreakpoint(canvasPoint)), "Enter breakpoint condition:", "(rise/fall/change/high/low [count], empty to remove)"), canvasPoint(canvasPoint) {}
+
+    // keep only the lowercase letters, digits and spaces
+    static inline char filterCharacter(char ch) noexcept {
+        if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch == ' ') return ch;
+        if (ch >= 'A' && ch <= 'Z') return ch - 'A' + 'a';
+        return 0;
+    }
+
+    inline ActionEventResult commit() {
+        const std::string pointText = "(" + std::to_string(canvasPoint.x) + ", " + std::to_string(canvasPoint.y) + ")";
+        if (text.find_first_not_of(' ') == std::string::npos) {
+            stateManager().setSimulatorBreakpoint(canvasPoint, std::nullopt);
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Breakpoint removed ", NotificationDisplay::TEXT_COLOR_ACTION }, { "at " + pointText, NotificationDisplay::TEXT_COLOR } });
+        }
+        else if (const std::optional<Simulator::Breakpoint> breakpoint = parse(text)) {
+            stateManager().setSimulatorBreakpoint(canvasPoint, breakpoint);
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Breakpoint set ", NotificationDisplay::TEXT_COLOR_ACTION }, { "at " + pointText + ": ", NotificationDisplay::TEXT_COLOR }, { initialText(breakpoint), NotificationDisplay::TEXT_COLOR_KEY } });
+        }
+        else {
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Invalid input: Expected rise, fall, change, high or low, optionally followed by a positive count", NotificationDisplay::TEXT_COLOR_ERROR } });
+            return ActionEventResult::CANCELLED;
+        }
+        return ActionEventResult::COMPLETED;
+    }
+
+    static inline void start(MainWindow& mainWindow, SDL_Renderer* renderer, ext::point canvasPoint, const ActionStarter& starter) {
+        starter.start<BreakpointAction>(mainWindow, renderer, canvasPoint);
+    }
+};
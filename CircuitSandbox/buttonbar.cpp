@@ -24,8 +24,8 @@
 #include "historyaction.hpp"
 #include "changesimulationspeedaction.hpp"
 
-SDL_Renderer* ButtonBar::getRenderer() {
-    return mainWindow.renderer;
+TextCache& ButtonBar::getTextCache() {
+    return mainWindow.textCache;
 }
 
 Font& ButtonBar::getInterfaceFont() {
@@ -50,9 +50,10 @@ void ButtonBar::render(SDL_Renderer* renderer) const {
         item->render(renderer, *this, { x, renderArea.y }, clickedItem == item.get() ? RenderStyle::CLICK : hoveredItem == item.get() ? RenderStyle::HOVER : RenderStyle::DEFAULT);
         x += item->width();
     }
-    if (descriptionTexture) {
+    if (descriptionText) {
+        const ext::point descriptionSize = descriptionText->size();
         SDL_Rect target{ descriptionOffset + mainWindow.logicalToPhysicalSize(20), renderArea.y + (mainWindow.BUTTONBAR_HEIGHT - descriptionSize.y) / 2, descriptionSize.x, descriptionSize.y };
-        SDL_RenderCopy(renderer, descriptionTexture.get(), nullptr, &target);
+        SDL_RenderCopy(renderer, descriptionText->getTexture(renderer), nullptr, &target);
     }
 }
 
@@ -146,7 +147,7 @@ void IconButton<CodePoint>::click(ButtonBar& buttonBar) {
         FileNewAction::start(buttonBar.mainWindow, buttonBar.mainWindow.currentAction.getStarter());
     }
     else if constexpr (CodePoint == IconCodePoints::OPEN) {
-        FileOpenAction::start(buttonBar.mainWindow, buttonBar.playArea, buttonBar.mainWindow.currentAction.getStarter());
+        FileOpenAction::start(buttonBar.mainWindow, buttonBar.playArea, SDL_GetModState(), buttonBar.mainWindow.currentAction.getStarter());
     }
     else if constexpr (CodePoint == IconCodePoints::SAVE) {
         FileSaveAction::start(buttonBar.mainWindow, SDL_GetModState(), buttonBar.mainWindow.currentAction.getStarter());
@@ -177,7 +178,7 @@ const char* IconButton<CodePoint>::description(const ButtonBar& buttonBar) const
         return "Start a new instance (Ctrl-N)";
     }
     else if constexpr (CodePoint == IconCodePoints::OPEN) {
-        return "Open an existing file (Ctrl-O)";
+        return "Open an existing file (Ctrl-O); hold Shift key to only view it, loading just the part in view";
     }
     else if constexpr (CodePoint == IconCodePoints::SAVE) {
         return "Save to file (Ctrl-S); hold Shift key for \"Save As\" dialog";
@@ -222,6 +223,38 @@ const char* StepButton::description(const ButtonBar& buttonBar) const {
 }
 
 
+void FastForwardButton::render(SDL_Renderer* renderer, const ButtonBar& buttonBar, const ext::point& offset, RenderStyle style) const {
+    // hidden while the simulation is running normally, but shown while fast-forwarding so that it can be cancelled
+    if (!buttonBar.mainWindow.stateManager.simulatorRunning() || buttonBar.mainWindow.stateManager.simulatorFastForwarding()) {
+        IconButton::render(renderer, buttonBar, offset, style);
+        IconButton::render(renderer, buttonBar, { offset.x + IconButton::width() / 2, offset.y }, style);
+    }
+}
+
+void FastForwardButton::click(ButtonBar& buttonBar) {
+    if (buttonBar.mainWindow.stateManager.simulatorFastForwarding()) {
+        buttonBar.mainWindow.currentAction.reset();
+        buttonBar.mainWindow.stateManager.startOrStopSimulator(buttonBar.mainWindow);
+    }
+    else if (!buttonBar.mainWindow.stateManager.simulatorRunning()) {
+        buttonBar.mainWindow.currentAction.reset();
+        buttonBar.mainWindow.stateManager.fastForwardSimulator(buttonBar.mainWindow, StateManager::DEFAULT_FAST_FORWARD_STEPS);
+    }
+}
+
+const char* FastForwardButton::description(const ButtonBar& buttonBar) const {
+    if (buttonBar.mainWindow.stateManager.simulatorFastForwarding()) {
+        return "Cancel fast-forward";
+    }
+    else if (!buttonBar.mainWindow.stateManager.simulatorRunning()) {
+        return "Fast-forward 1000000 steps as fast as possible (Shift-Right arrow)";
+    }
+    else {
+        return nullptr;
+    }
+}
+
+
 void UndoButton::render(SDL_Renderer* renderer, const ButtonBar& buttonBar, const ext::point& offset, RenderStyle style) const {
     if (buttonBar.mainWindow.stateManager.historyManager.canUndo()) {
         IconButton::render(renderer, buttonBar, offset, style);
@@ -19,6 +19,7 @@
 #include "declarations.hpp"
 #include "control.hpp"
 #include "font.hpp"
+#include "textcache.hpp"
 #include "buttonbaritems.hpp"
 #include "iconcodepoints.hpp"
 
@@ -39,16 +40,15 @@ private:
     // icon font
     Font iconFont;
 
-    // description texture
-    UniqueTexture descriptionTexture;
-    ext::point descriptionSize;
+    // description text (the texture is made when it is first rendered)
+    TextCache::TextHandle descriptionText;
     int32_t descriptionOffset; // in physical pixels, from left of screen
 
     constexpr static SDL_Color backgroundColor = DARK_GREY;
     constexpr static SDL_Color foregroundColor = WHITE;
     constexpr static SDL_Color hoverColor{ 0x44, 0x44, 0x44, 0xFF };
 
-    const std::array<std::unique_ptr<ButtonBarItem>, 12> items{
+    const std::array<std::unique_ptr<ButtonBarItem>, 13> items{
         std::make_unique<IconButton<IconCodePoints::NEW>>(),
         std::make_unique<IconButton<IconCodePoints::OPEN>>(),
         std::make_unique<IconButton<IconCodePoints::SAVE>>(),
@@ -56,6 +56,7 @@ private:
         std::make_unique<PlayPauseButton>(),
         std::make_unique<IconButton<IconCodePoints::RESET>>(),
         std::make_unique<StepButton>(),
+        std::make_unique<FastForwardButton>(),
         std::make_unique<ButtonBarSpace>(),
         std::make_unique<IconButton<IconCodePoints::SPEED>>(),
         std::make_unique<ButtonBarSpace>(),
@@ -69,18 +70,19 @@ private:
     template <uint16_t>
     friend class IconButton;
     friend class StepButton;
+    friend class FastForwardButton;
     friend class UndoButton;
     friend class RedoButton;
     friend class PlayPauseButton;
 
-    SDL_Renderer* getRenderer();
     Font& getInterfaceFont();
+    TextCache& getTextCache();
 
     template <size_t Index, typename Tuple>
     inline void _setDescriptionSize(ext::point& size, Tuple& arr) {
         if (std::get<Index>(arr) != nullptr) {
-            size.x += std::get<Index>(arr)->w;
-            size.y = std::max(size.y, std::get<Index>(arr)->h);
+            size.x += std::get<Index>(arr)->size().x;
+            size.y = std::max(size.y, std::get<Index>(arr)->size().y);
         }
         if constexpr (Index + 1 < std::tuple_size_v<Tuple>) {
             _setDescriptionSize<Index + 1>(size, arr);
@@ -88,7 +90,7 @@ private:
     }
     template <size_t Index, typename Tuple, typename... Args>
     inline void _setDescriptionSurface(Tuple& arr, const char* description, SDL_Color color, Args&&... args) {
-        std::get<Index>(arr) = TTF_RenderText_Shaded(getInterfaceFont(), description, color, ButtonBar::backgroundColor);
+        std::get<Index>(arr) = getTextCache().renderShaded(getInterfaceFont(), description, color, ButtonBar::backgroundColor);
         if constexpr(sizeof...(Args) > 0) {
             _setDescriptionSurface<Index + 1>(arr, std::forward<Args>(args)...);
         }
@@ -98,15 +100,14 @@ private:
         _setDescriptionSurface(arr, description, ButtonBar::foregroundColor);
     }
     template <size_t Index, typename Tuple>
-    inline void _setDescriptionCopyAndFree(SDL_Surface* surface, Tuple& arr, int32_t offsetWidth) {
+    inline void _setDescriptionCopy(SDL_Surface* surface, Tuple& arr, int32_t offsetWidth) {
         if (std::get<Index>(arr) != nullptr) {
-            SDL_Rect target{ offsetWidth, 0, std::get<Index>(arr)->w, std::get<Index>(arr)->h };
-            SDL_BlitSurface(std::get<Index>(arr), nullptr, surface, &target);
-            offsetWidth += std::get<Index>(arr)->w;
-            SDL_FreeSurface(std::get<Index>(arr));
+            SDL_Rect target{ offsetWidth, 0, std::get<Index>(arr)->size().x, std::get<Index>(arr)->size().y };
+            SDL_BlitSurface(std::get<Index>(arr)->getSurface(), nullptr, surface, &target);
+            offsetWidth += std::get<Index>(arr)->size().x;
         }
         if constexpr (Index + 1 < std::tuple_size_v<Tuple>) {
-            _setDescriptionCopyAndFree<Index + 1>(surface, arr, offsetWidth);
+            _setDescriptionCopy<Index + 1>(surface, arr, offsetWidth);
         }
     }
 
@@ -136,25 +137,21 @@ public:
     void setDescription(const char* description, SDL_Color color, Args&&... args) {
         assert(description);
         if constexpr (sizeof...(args) > 0) {
-            std::array<SDL_Surface*, (sizeof...(args) + 3) / 2> surfaces;
+            std::array<TextCache::TextHandle, (sizeof...(args) + 3) / 2> surfaces;
             _setDescriptionSurface<0>(surfaces, description, color, std::forward<Args>(args)...);
-            descriptionSize = ext::point::zero();
+            ext::point descriptionSize = ext::point::zero();
             _setDescriptionSize<0>(descriptionSize, surfaces);
             if (descriptionSize.x != 0) {
+                // the pieces come from the cache, but the combination is specific to this element so it is not cached
                 SDL_Surface* surface = SDL_CreateRGBSurface(0, descriptionSize.x, descriptionSize.y, 32, 0, 0, 0, 0);
-                _setDescriptionCopyAndFree<0>(surface, surfaces, 0);
-                descriptionTexture.reset(nullptr);
-                descriptionTexture.reset(SDL_CreateTextureFromSurface(getRenderer(), surface));
-                SDL_FreeSurface(surface);
+                _setDescriptionCopy<0>(surface, surfaces, 0);
+                descriptionText = std::make_shared<const TextCache::Text>(surface);
             }
         }
         else {
-            SDL_Surface* surface = TTF_RenderText_Shaded(getInterfaceFont(), description, color, ButtonBar::backgroundColor);
-            if (surface) { // if there is text to show
-                descriptionTexture.reset(nullptr);
-                descriptionTexture.reset(SDL_CreateTextureFromSurface(getRenderer(), surface));
-                descriptionSize = { surface->w, surface->h };
-                SDL_FreeSurface(surface);
+            TextCache::TextHandle text = getTextCache().renderShaded(getInterfaceFont(), description, color, ButtonBar::backgroundColor);
+            if (text) { // if there is text to show
+                descriptionText = std::move(text);
             }
         }
     }
@@ -163,7 +160,7 @@ public:
         setDescription(description, ButtonBar::foregroundColor);
     }
     void clearDescription() {
-        descriptionTexture = nullptr;
+        descriptionText = nullptr;
     }
 
     /**
@@ -55,6 +55,16 @@ class StepButton final : public IconButton<IconCodePoints::STEP> {
     const char* description(const ButtonBar& buttonBar) const override;
 };
 
+// uses two overlapping step icons, since there is no fast-forward glyph in the icon font
+class FastForwardButton final : public IconButton<IconCodePoints::STEP> {
+    int32_t width() const override {
+        return IconButton::width() * 3 / 2;
+    }
+    void click(ButtonBar& buttonBar) override;
+    void render(SDL_Renderer* renderer, const ButtonBar& buttonBar, const ext::point& offset, RenderStyle style) const override;
+    const char* description(const ButtonBar& buttonBar) const override;
+};
+
 class UndoButton final : public IconButton<IconCodePoints::UNDO> {
     void click(ButtonBar& buttonBar) override;
     void render(SDL_Renderer* renderer, const ButtonBar& buttonBar, const ext::point& offset, RenderStyle style) const override;
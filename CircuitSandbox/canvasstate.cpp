@@ -1,3 +1,8 @@
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
 #include "canvasstate.hpp"
 
 using ReadResult = CanvasState::ReadResult;
@@ -9,41 +14,52 @@ static ReadResult resolveLoadError(std::istream& saveFile) {
     return saveFile.eof() ? ReadResult::CORRUPTED : ReadResult::IO_ERROR;
 }
 
-ReadResult CanvasState::loadSave(std::istream& saveFile) {
-    // read the magic sequence
-    char data[4];
-    if (!saveFile.read(data, 4)) return resolveLoadError(saveFile);
-    if (!std::equal(data, data + 4, CCSB_FILE_MAGIC)) return ReadResult::CORRUPTED;
+// the pixels are read and written in blocks of about this many bytes, instead of one stream operation per pixel
+constexpr size_t SAVE_BLOCK_SIZE = static_cast<size_t>(1) << 16;
 
-    // read the version number
-    int32_t version;
-    if (!saveFile.read(reinterpret_cast<char*>(&version), sizeof version)) return resolveLoadError(saveFile);
-    boost::endian::little_to_native_inplace(version);
-    if (version != 0) return ReadResult::OUTDATED;
+// large reads and writes are split into chunks of this many bytes, so that the progress can be reported in between
+constexpr size_t PROGRESS_CHUNK_SIZE = static_cast<size_t>(1) << 20;
 
-    // read the width and height
-    int32_t matrixWidth, matrixHeight;
-    saveFile.read(reinterpret_cast<char*>(&matrixWidth), sizeof matrixWidth);
-    saveFile.read(reinterpret_cast<char*>(&matrixHeight), sizeof matrixHeight);
-    if (!saveFile) return resolveLoadError(saveFile);
-    boost::endian::little_to_native_inplace(matrixWidth);
-    boost::endian::little_to_native_inplace(matrixHeight);
-    if (matrixWidth < 0 || matrixHeight < 0 || static_cast<int64_t>(matrixWidth) * matrixHeight > std::numeric_limits<int32_t>::max()) return ReadResult::CORRUPTED;
+static void setProgress(std::atomic<float>* progress, float value) noexcept {
+    if (progress) progress->store(value, std::memory_order_relaxed);
+}
 
-    // create the matrix
-    CanvasState::matrix_t canvasData(matrixWidth, matrixHeight);
+// reads size bytes in chunks, moving the progress from progressBegin to progressEnd
+static bool readWithProgress(std::istream& in, char* data, size_t size, std::atomic<float>* progress, float progressBegin, float progressEnd) {
+    for (size_t done = 0; done != size;) {
+        const size_t chunk = std::min(size - done, PROGRESS_CHUNK_SIZE);
+        if (!in.read(data + done, chunk)) return false;
+        done += chunk;
+        setProgress(progress, progressBegin + (progressEnd - progressBegin) * static_cast<float>(done) / static_cast<float>(size));
+    }
+    setProgress(progress, progressEnd);
+    return true;
+}
 
-    for (int32_t y = 0; y != canvasData.height(); ++y) {
-        for (int32_t x = 0; x != canvasData.width(); ++x) {
-            uint8_t elementData;
-            static_assert(sizeof elementData == 1);
-            if (!saveFile.read(reinterpret_cast<char*>(&elementData), 1)) return resolveLoadError(saveFile);
+// writes size bytes in chunks, moving the progress from progressBegin to progressEnd
+static void writeWithProgress(std::ostream& out, const char* data, size_t size, std::atomic<float>* progress, float progressBegin, float progressEnd) {
+    for (size_t done = 0; done != size;) {
+        const size_t chunk = std::min(size - done, PROGRESS_CHUNK_SIZE);
+        if (!out.write(data + done, chunk)) return;
+        done += chunk;
+        setProgress(progress, progressBegin + (progressEnd - progressBegin) * static_cast<float>(done) / static_cast<float>(size));
+    }
+    setProgress(progress, progressEnd);
+}
+
+// the element (and whether it is valid) for every byte in the save file
+// each byte is (element index << 2) | (logic level << 1) | (default logic level)
+static const std::array<std::pair<bool, CanvasState::element_variant_t>, 256>& elementDecodeTable() {
+    static const std::array<std::pair<bool, CanvasState::element_variant_t>, 256> table = []() {
+        std::array<std::pair<bool, CanvasState::element_variant_t>, 256> table{};
+        for (size_t elementData = 0; elementData != table.size(); ++elementData) {
             size_t element_index = elementData >> 2;
             bool logicLevel = elementData & 0b10;
             bool defaultLogicLevel = elementData & 0b01;
 
-            CanvasState::element_variant_t& element = canvasData[{x, y}];
-            if (!CanvasState::element_tags_t::get(element_index, [&](const auto element_tag) {
+            CanvasState::element_variant_t& element = table[elementData].second;
+            // unknown element indices stay invalid (maybe the new save format contains more elements?)
+            table[elementData].first = CanvasState::element_tags_t::get(element_index, [&](const auto element_tag) {
                 using ElementType = typename decltype(element_tag)::type;
                 if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
                     // TODO: store communicator transmit states in the save file?
@@ -60,24 +76,369 @@ ReadResult CanvasState::loadSave(std::istream& saveFile) {
                     element.emplace<ElementType>();
                 }
                 return true;
-            }, false)) {
-                return ReadResult::OUTDATED; // maybe the new save format contains more elements?
-            }
+            }, false);
+        }
+        return table;
+    }();
+    return table;
+}
+
+// the byte in the save file that represents the given element
+static uint8_t encodeElement(const CanvasState::element_variant_t& element) noexcept {
+    size_t element_index = element.index();
+    bool logicLevel = false;
+    bool defaultLogicLevel = false;
+
+    std::visit([&](const auto& element) {
+        using ElementType = typename std::decay_t<decltype(element)>;
+        if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+            // TODO: store communicator transmit states in the save file?
+            logicLevel = element.logicLevel;
+            defaultLogicLevel = element.startingLogicLevel;
+        }
+        else if constexpr (std::is_base_of_v<Relay, ElementType>) {
+            // TODO: store relay states in the save file!
+            logicLevel = element.conductiveState;
+            defaultLogicLevel = element.startingConductiveState;
+        }
+        else if constexpr (std::is_base_of_v<RenderLogicLevelElement, ElementType>) {
+            // even though ElementType might not be a LogicLevelElement (i.e. with useful logic levels), we save the logic level for compatibility with saves in the v0.2 format.
+            // but when loaded, those non-useful logic levels will be ignored.
+            logicLevel = element.logicLevel;
+            defaultLogicLevel = element.startingLogicLevel;
+        }
+    }, element);
+
+    return static_cast<uint8_t>((element_index << 2) | (logicLevel << 1) | defaultLogicLevel);
+}
+
+/*
+ * Save file format (all integers are little endian):
+ * - the magic sequence CCSB_FILE_MAGIC
+ * - int32 version
+ * - int32 width, int32 height
+ * - the pixel data, where each pixel is the byte given by encodeElement():
+ *   - version 0: width * height raw bytes in row-major order
+ *   - version 1: int32 tile size, then a uint32 byte count for each tile (tiles in row-major order, the ones at the right and bottom edges are clipped to the canvas),
+ *     then the pixels of each tile (in row-major order within the tile) compressed with PackBits; a tile with a byte count of 0 is empty.
+ *     The byte counts allow each tile to be decoded independently, and to be read on its own (see CanvasState::TileLoader).
+ */
+
+constexpr int32_t LATEST_SAVE_VERSION = 1;
+
+// PackBits: a header byte n < 128 is followed by n+1 literal bytes, and a header byte n >= 128 is followed by one byte that is repeated n-125 times
+constexpr size_t PACKBITS_MAX_LITERAL = 128;
+constexpr size_t PACKBITS_MIN_RUN = 3;
+constexpr size_t PACKBITS_MAX_RUN = 255 - 128 + PACKBITS_MIN_RUN;
+
+// the maximum size of the PackBits encoding of the given number of bytes
+static size_t packBitsBound(size_t size) noexcept {
+    return size + (size + PACKBITS_MAX_LITERAL - 1) / PACKBITS_MAX_LITERAL;
+}
+
+// appends the PackBits encoding of [data, data + size) to out
+static void packBits(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    size_t i = 0;
+    while (i != size) {
+        size_t run = 1;
+        while (i + run != size && run != PACKBITS_MAX_RUN && data[i + run] == data[i]) ++run;
+        if (run >= PACKBITS_MIN_RUN) {
+            out.push_back(static_cast<uint8_t>(128 + (run - PACKBITS_MIN_RUN)));
+            out.push_back(data[i]);
+            i += run;
+            continue;
+        }
+        // literal bytes, up to the next run that is long enough to be worth encoding
+        size_t literalEnd = i;
+        do {
+            ++literalEnd;
+        } while (literalEnd != size && literalEnd - i != PACKBITS_MAX_LITERAL && !(literalEnd + 2 < size && data[literalEnd] == data[literalEnd + 1] && data[literalEnd] == data[literalEnd + 2]));
+        out.push_back(static_cast<uint8_t>(literalEnd - i - 1));
+        out.insert(out.end(), data + i, data + literalEnd);
+        i = literalEnd;
+    }
+}
+
+// decodes PackBits data into exactly `size` bytes at out, returns false if the data is malformed
+static bool unpackBits(const uint8_t* data, size_t dataSize, uint8_t* out, size_t size) noexcept {
+    const uint8_t* const dataEnd = data + dataSize;
+    uint8_t* const outEnd = out + size;
+    while (data != dataEnd) {
+        const uint8_t header = *data++;
+        if (header < 128) {
+            const size_t length = static_cast<size_t>(header) + 1;
+            if (static_cast<size_t>(dataEnd - data) < length || static_cast<size_t>(outEnd - out) < length) return false;
+            out = std::copy_n(data, length, out);
+            data += length;
+        }
+        else {
+            const size_t length = static_cast<size_t>(header) - 128 + PACKBITS_MIN_RUN;
+            if (data == dataEnd || static_cast<size_t>(outEnd - out) < length) return false;
+            out = std::fill_n(out, length, *data++);
         }
     }
+    return out == outEnd;
+}
+
+// reads the magic sequence, the version number, and the width and height at the start of a save file
+static ReadResult readSaveHeader(std::istream& saveFile, int32_t& version, int32_t& matrixWidth, int32_t& matrixHeight) {
+    // read the magic sequence
+    char data[4];
+    if (!saveFile.read(data, 4)) return resolveLoadError(saveFile);
+    if (!std::equal(data, data + 4, CCSB_FILE_MAGIC)) return ReadResult::CORRUPTED;
+
+    // read the version number
+    if (!saveFile.read(reinterpret_cast<char*>(&version), sizeof version)) return resolveLoadError(saveFile);
+    boost::endian::little_to_native_inplace(version);
+    if (version < 0 || version > LATEST_SAVE_VERSION) return ReadResult::OUTDATED;
+
+    // read the width and height
+    saveFile.read(reinterpret_cast<char*>(&matrixWidth), sizeof matrixWidth);
+    saveFile.read(reinterpret_cast<char*>(&matrixHeight), sizeof matrixHeight);
+    if (!saveFile) return resolveLoadError(saveFile);
+    boost::endian::little_to_native_inplace(matrixWidth);
+    boost::endian::little_to_native_inplace(matrixHeight);
+    if (matrixWidth < 0 || matrixHeight < 0 || static_cast<int64_t>(matrixWidth) * matrixHeight > std::numeric_limits<int32_t>::max()) return ReadResult::CORRUPTED;
+    return ReadResult::OK;
+}
+
+// the tiles of a version 1 file
+struct SaveTileGrid {
+    ext::point canvasSize;
+    int32_t tileSize;
+    int32_t numTilesX, numTilesY;
+
+    SaveTileGrid(const ext::point& canvasSize, int32_t tileSize) : canvasSize(canvasSize), tileSize(tileSize),
+        numTilesX(static_cast<int32_t>((static_cast<int64_t>(canvasSize.x) + tileSize - 1) / tileSize)),
+        numTilesY(static_cast<int32_t>((static_cast<int64_t>(canvasSize.y) + tileSize - 1) / tileSize)) {}
+
+    size_t numTiles() const noexcept {
+        return static_cast<size_t>(numTilesX) * numTilesY;
+    }
+    ext::point topLeft(size_t tile) const noexcept {
+        return ext::point{ static_cast<int32_t>(tile % numTilesX) * tileSize, static_cast<int32_t>(tile / numTilesX) * tileSize };
+    }
+    ext::point bottomRight(size_t tile) const noexcept {
+        return ext::min(topLeft(tile) + ext::point{ tileSize, tileSize }, canvasSize);
+    }
+};
+
+// reads the tile size and the tile index of a version 1 file, and checks that no tile is larger than its worst-case encoding (so that a corrupted index can't make us allocate too much)
+static ReadResult readTileIndex(std::istream& saveFile, const ext::point& canvasSize, int32_t& tileSize, std::vector<uint32_t>& tileBytes) {
+    if (!saveFile.read(reinterpret_cast<char*>(&tileSize), sizeof tileSize)) return resolveLoadError(saveFile);
+    boost::endian::little_to_native_inplace(tileSize);
+    if (tileSize <= 0 || tileSize > (1 << 15)) return ReadResult::CORRUPTED;
+
+    const SaveTileGrid grid(canvasSize, tileSize);
+    tileBytes.resize(grid.numTiles());
+    if (!saveFile.read(reinterpret_cast<char*>(tileBytes.data()), tileBytes.size() * sizeof(uint32_t))) return resolveLoadError(saveFile);
+    for (size_t tile = 0; tile != tileBytes.size(); ++tile) {
+        boost::endian::little_to_native_inplace(tileBytes[tile]);
+        const ext::point tileArea = grid.bottomRight(tile) - grid.topLeft(tile);
+        if (tileBytes[tile] > packBitsBound(static_cast<size_t>(tileArea.x) * tileArea.y)) return ReadResult::CORRUPTED;
+    }
+    return ReadResult::OK;
+}
+
+ReadResult CanvasState::loadSave(std::istream& saveFile, ext::thread_pool* pool, std::atomic<float>* progress) {
+    int32_t version, matrixWidth, matrixHeight;
+    if (const ReadResult result = readSaveHeader(saveFile, version, matrixWidth, matrixHeight); result != ReadResult::OK) return result;
+
+    // create the matrix
+    CanvasState::matrix_t canvasData(matrixWidth, matrixHeight);
+
+    const ReadResult result = version == 0 ? loadPixelsV0(saveFile, canvasData, progress) : loadPixelsV1(saveFile, canvasData, pool, progress);
+    if (result != ReadResult::OK) return result;
 
     // only overwriting state.dataMatrix here ensures it is only modified if we return ReadResult::OK.
     dataMatrix = std::move(canvasData);
+    communicators.clear();
+    setProgress(progress, 1.0f);
     return ReadResult::OK;
 }
 
-WriteResult CanvasState::writeSave(std::ostream& saveFile) const {
+ReadResult CanvasState::loadPixelsV0(std::istream& saveFile, matrix_t& canvasData, std::atomic<float>* progress) {
+    if (canvasData.empty()) return ReadResult::OK;
+
+    const auto& decodeTable = elementDecodeTable();
+
+    // read whole rows at a time
+    const int32_t rowsPerBlock = static_cast<int32_t>(std::clamp<size_t>(SAVE_BLOCK_SIZE / static_cast<size_t>(canvasData.width()), 1, static_cast<size_t>(canvasData.height())));
+    std::vector<uint8_t> buffer(static_cast<size_t>(rowsPerBlock) * canvasData.width());
+
+    for (int32_t blockY = 0; blockY < canvasData.height(); blockY += rowsPerBlock) {
+        const int32_t blockRows = std::min(rowsPerBlock, canvasData.height() - blockY);
+        const size_t blockSize = static_cast<size_t>(blockRows) * canvasData.width();
+        saveFile.read(reinterpret_cast<char*>(buffer.data()), blockSize);
+        // decode whatever was read even if the file ended early, so that unknown elements are reported the same way as before
+        const size_t bytesRead = static_cast<size_t>(saveFile.gcount());
+
+        for (size_t i = 0; i != bytesRead; ++i) {
+            static_assert(sizeof(buffer[i]) == 1);
+            // the matrix starts out empty, so no tile has to be allocated for empty pixels
+            if (buffer[i] == 0) continue;
+
+            const auto& [valid, element] = decodeTable[buffer[i]];
+            if (!valid) return ReadResult::OUTDATED; // maybe the new save format contains more elements?
+            const ext::point pt{ static_cast<int32_t>(i % canvasData.width()), blockY + static_cast<int32_t>(i / canvasData.width()) };
+            canvasData[pt] = element;
+        }
+
+        if (bytesRead != blockSize) return resolveLoadError(saveFile);
+        setProgress(progress, static_cast<float>(blockY + blockRows) / static_cast<float>(canvasData.height()));
+    }
+    return ReadResult::OK;
+}
+
+ReadResult CanvasState::loadPixelsV1(std::istream& saveFile, matrix_t& canvasData, ext::thread_pool* pool, std::atomic<float>* progress) {
+    int32_t tileSize;
+    std::vector<uint32_t> tileBytes;
+    if (const ReadResult result = readTileIndex(saveFile, canvasData.size(), tileSize, tileBytes); result != ReadResult::OK) return result;
+    const SaveTileGrid grid(canvasData.size(), tileSize);
+    const size_t numTiles = grid.numTiles();
+    std::vector<size_t> tileOffsets(numTiles + 1, 0);
+    for (size_t tile = 0; tile != numTiles; ++tile) {
+        tileOffsets[tile + 1] = tileOffsets[tile] + tileBytes[tile];
+    }
+
+    // read the data of all the tiles at once (reading is the first half of the progress, and decoding is the second half)
+    std::vector<uint8_t> tileData(tileOffsets.back());
+    if (!readWithProgress(saveFile, reinterpret_cast<char*>(tileData.data()), tileData.size(), progress, 0.0f, 0.5f)) return resolveLoadError(saveFile);
+
+    std::vector<ReadResult> tileResults(numTiles, ReadResult::OK);
+    std::atomic<size_t> tilesDecoded = 0;
+    const auto decodeTile = [&](size_t tile) {
+        if (progress) setProgress(progress, 0.5f + 0.5f * static_cast<float>(++tilesDecoded) / static_cast<float>(numTiles));
+        if (tileBytes[tile] == 0) return; // empty tile
+        tileResults[tile] = decodeTileV1(tileData.data() + tileOffsets[tile], tileBytes[tile], canvasData, grid.topLeft(tile), grid.bottomRight(tile));
+    };
+
+    // the tiles can only be decoded in parallel if each of them is exactly one tile of the canvas, since writing allocates the tiles of the canvas
+    if (pool && tileSize == matrix_t::tile_size) {
+        pool->parallel_for(numTiles, decodeTile);
+    }
+    else {
+        for (size_t tile = 0; tile != numTiles; ++tile) decodeTile(tile);
+    }
+    canvasData.mark_written();
+
+    // report the error from the first tile that failed
+    for (ReadResult tileResult : tileResults) {
+        if (tileResult != ReadResult::OK) return tileResult;
+    }
+    return ReadResult::OK;
+}
+
+ReadResult CanvasState::decodeTileV1(const uint8_t* data, size_t size, matrix_t& canvasData, const ext::point& topLeft, const ext::point& bottomRight) {
+    const auto& decodeTable = elementDecodeTable();
+    const int32_t tileWidth = bottomRight.x - topLeft.x;
+    std::vector<uint8_t> pixels(static_cast<size_t>(tileWidth) * (bottomRight.y - topLeft.y));
+    if (!unpackBits(data, size, pixels.data(), pixels.size())) return ReadResult::CORRUPTED;
+    matrix_t::tile_writer canvasTile;
+    for (size_t i = 0; i != pixels.size(); ++i) {
+        // the matrix starts out empty, so no tile has to be allocated for empty pixels
+        if (pixels[i] == 0) continue;
+
+        const auto& [valid, element] = decodeTable[pixels[i]];
+        if (!valid) return ReadResult::OUTDATED; // maybe the new save format contains more elements?
+        const ext::point pt = topLeft + ext::point{ static_cast<int32_t>(i % tileWidth), static_cast<int32_t>(i / tileWidth) };
+        if (!canvasTile.contains(pt)) canvasTile = canvasData.write_tile(pt);
+        canvasTile[pt] = element;
+    }
+    return ReadResult::OK;
+}
+
+ReadResult CanvasState::TileLoader::open(std::unique_ptr<std::istream> file, CanvasState& state) {
+    int32_t version, matrixWidth, matrixHeight;
+    if (const ReadResult result = readSaveHeader(*file, version, matrixWidth, matrixHeight); result != ReadResult::OK) return result;
+    if (version == 0) return ReadResult::UNSUPPORTED;
+
+    // each tile of the file has to be exactly one tile of the canvas, so that a tile can be released without touching the others
+    const ext::point newCanvasSize{ matrixWidth, matrixHeight };
+    int32_t tileSize;
+    std::vector<uint32_t> newTileBytes;
+    if (const ReadResult result = readTileIndex(*file, newCanvasSize, tileSize, newTileBytes); result != ReadResult::OK) return result;
+    if (tileSize != matrix_t::tile_size) return ReadResult::UNSUPPORTED;
+
+    // the tiles are stored right after the index
+    const std::streamoff dataStart = file->tellg();
+    if (dataStart < 0) return ReadResult::IO_ERROR;
+    tileOffsets.resize(newTileBytes.size());
+    uint64_t offset = static_cast<uint64_t>(dataStart);
+    for (size_t tile = 0; tile != newTileBytes.size(); ++tile) {
+        tileOffsets[tile] = offset;
+        offset += newTileBytes[tile];
+    }
+
+    saveFile = std::move(file);
+    canvasSize = newCanvasSize;
+    numTilesX = SaveTileGrid(canvasSize, tileSize).numTilesX;
+    tileBytes = std::move(newTileBytes);
+    tileLoaded.assign(tileBytes.size(), false);
+    loadedTiles.clear();
+
+    state.dataMatrix = matrix_t(matrixWidth, matrixHeight);
+    state.communicators.clear();
+    return ReadResult::OK;
+}
+
+ReadResult CanvasState::TileLoader::loadTiles(CanvasState& state, const ext::point& topLeft, const ext::point& bottomRight, bool& changed) {
+    const SaveTileGrid grid(canvasSize, matrix_t::tile_size);
+    changed = false;
+
+    // release the tiles that are more than a tile away, so that panning back and forth across a tile boundary doesn't keep reloading the same tiles
+    const ext::point keepTopLeft = topLeft - ext::point{ grid.tileSize, grid.tileSize };
+    const ext::point keepBottomRight = bottomRight + ext::point{ grid.tileSize, grid.tileSize };
+    loadedTiles.erase(std::remove_if(loadedTiles.begin(), loadedTiles.end(), [&](size_t tile) {
+        const ext::point tileTopLeft = grid.topLeft(tile);
+        const ext::point tileBottomRight = grid.bottomRight(tile);
+        if (tileTopLeft.x < keepBottomRight.x && tileTopLeft.y < keepBottomRight.y && tileBottomRight.x > keepTopLeft.x && tileBottomRight.y > keepTopLeft.y) return false;
+        state.dataMatrix.release_tile(tileTopLeft);
+        tileLoaded[tile] = false;
+        return true;
+    }), loadedTiles.end());
+
+    const ext::point loadTopLeft = ext::max(topLeft, ext::point{ 0, 0 });
+    const ext::point loadBottomRight = ext::min(bottomRight, canvasSize);
+    if (loadTopLeft.x >= loadBottomRight.x || loadTopLeft.y >= loadBottomRight.y) return ReadResult::OK;
+
+    ReadResult result = ReadResult::OK;
+    for (int32_t tileY = loadTopLeft.y / grid.tileSize; tileY <= (loadBottomRight.y - 1) / grid.tileSize; ++tileY) {
+        for (int32_t tileX = loadTopLeft.x / grid.tileSize; tileX <= (loadBottomRight.x - 1) / grid.tileSize; ++tileX) {
+            const size_t tile = static_cast<size_t>(tileY) * numTilesX + tileX;
+            if (tileLoaded[tile]) continue;
+            tileLoaded[tile] = true;
+            loadedTiles.push_back(tile);
+            if (tileBytes[tile] == 0) continue; // empty tile
+
+            // a tile that fails to load is still marked as loaded, so that it isn't read again at every frame
+            changed = true;
+            ReadResult tileResult;
+            tileData.resize(tileBytes[tile]);
+            saveFile->clear();
+            if (!saveFile->seekg(static_cast<std::streamoff>(tileOffsets[tile]))) {
+                tileResult = ReadResult::IO_ERROR;
+            }
+            else if (!saveFile->read(reinterpret_cast<char*>(tileData.data()), tileData.size())) {
+                tileResult = resolveLoadError(*saveFile);
+            }
+            else {
+                tileResult = decodeTileV1(tileData.data(), tileData.size(), state.dataMatrix, grid.topLeft(tile), grid.bottomRight(tile));
+                state.dataMatrix.mark_written();
+            }
+            if (result == ReadResult::OK) result = tileResult;
+        }
+    }
+    return result;
+}
+
+WriteResult CanvasState::writeSave(std::ostream& saveFile, std::atomic<float>* progress) const {
 
     // write the magic sequence
     saveFile.write(CCSB_FILE_MAGIC, 4);
 
     // write the version number
-    int32_t version = 0;
+    int32_t version = LATEST_SAVE_VERSION;
     boost::endian::native_to_little_inplace(version);
     saveFile.write(reinterpret_cast<char*>(&version), sizeof version);
 
@@ -89,40 +450,106 @@ WriteResult CanvasState::writeSave(std::ostream& saveFile) const {
     saveFile.write(reinterpret_cast<char*>(&matrixWidth), sizeof matrixWidth);
     saveFile.write(reinterpret_cast<char*>(&matrixHeight), sizeof matrixHeight);
 
-    // write the matrix
-    for (int32_t y = 0; y != height(); ++y) {
-        for (int32_t x = 0; x != width(); ++x) {
-            CanvasState::element_variant_t element = dataMatrix[{x, y}];
-            size_t element_index = element.index();
-            bool logicLevel = false;
-            bool defaultLogicLevel = false;
+    writePixelsV1(saveFile, progress);
 
-            std::visit([&](const auto& element) {
-                using ElementType = typename std::decay_t<decltype(element)>;
-                if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
-                    // TODO: store communicator transmit states in the save file?
-                    logicLevel = element.logicLevel;
-                    defaultLogicLevel = element.startingLogicLevel;
-                }
-                else if constexpr (std::is_base_of_v<Relay, ElementType>) {
-                    // TODO: store relay states in the save file!
-                    logicLevel = element.conductiveState;
-                    defaultLogicLevel = element.startingConductiveState;
-                }
-                else if constexpr (std::is_base_of_v<RenderLogicLevelElement, ElementType>) {
-                    // even though ElementType might not be a LogicLevelElement (i.e. with useful logic levels), we save the logic level for compatibility with saves in the v0.2 format.
-                    // but when loaded, those non-useful logic levels will be ignored.
-                    logicLevel = element.logicLevel;
-                    defaultLogicLevel = element.startingLogicLevel;
-                }
-            }, element);
+    // flush the stream, so failbit will be set if the stream cannot be written to.
+    saveFile.flush();
+    return saveFile ? WriteResult::OK : WriteResult::IO_ERROR;
+}
+
+void CanvasState::writePixelsV1(std::ostream& saveFile, std::atomic<float>* progress) const {
+    // the same as the tiles of the canvas, so that the tiles can be decoded in parallel when loading
+    constexpr int32_t SAVE_TILE_SIZE = matrix_t::tile_size;
+
+    int32_t tileSize = SAVE_TILE_SIZE;
+    boost::endian::native_to_little_inplace(tileSize);
+    saveFile.write(reinterpret_cast<char*>(&tileSize), sizeof tileSize);
+
+    const int32_t numTilesX = (width() + SAVE_TILE_SIZE - 1) / SAVE_TILE_SIZE;
+    const int32_t numTilesY = (height() + SAVE_TILE_SIZE - 1) / SAVE_TILE_SIZE;
+    std::vector<uint32_t> tileBytes;
+    tileBytes.reserve(static_cast<size_t>(numTilesX) * numTilesY);
+    std::vector<uint8_t> tileData;
+    std::vector<uint8_t> pixels;
+
+    for (int32_t tileY = 0; tileY != numTilesY; ++tileY) {
+        for (int32_t tileX = 0; tileX != numTilesX; ++tileX) {
+            const ext::point topLeft{ tileX * SAVE_TILE_SIZE, tileY * SAVE_TILE_SIZE };
+            const ext::point bottomRight = ext::min(topLeft + ext::point{ SAVE_TILE_SIZE, SAVE_TILE_SIZE }, size());
+            const int32_t tileWidth = bottomRight.x - topLeft.x;
+
+            // empty pixels are 0, so only the allocated tiles have to be encoded
+            pixels.assign(static_cast<size_t>(tileWidth) * (bottomRight.y - topLeft.y), 0);
+            bool tileEmpty = true;
+            dataMatrix.for_each(topLeft, bottomRight, [&](const ext::point& pt, const element_variant_t& element) {
+                const uint8_t elementData = encodeElement(element);
+                pixels[static_cast<size_t>(pt.y - topLeft.y) * tileWidth + (pt.x - topLeft.x)] = elementData;
+                if (elementData != 0) tileEmpty = false;
+            });
 
-            uint8_t elementData = static_cast<uint8_t>((element_index << 2) | (logicLevel << 1) | defaultLogicLevel);
-            saveFile.write(reinterpret_cast<char*>(&elementData), 1);
+            const size_t oldSize = tileData.size();
+            if (!tileEmpty) packBits(pixels.data(), pixels.size(), tileData);
+            uint32_t numBytes = static_cast<uint32_t>(tileData.size() - oldSize);
+            boost::endian::native_to_little_inplace(numBytes);
+            tileBytes.push_back(numBytes);
         }
+        // encoding is the first half of the progress, and writing is the second half
+        setProgress(progress, 0.5f * static_cast<float>(tileY + 1) / static_cast<float>(numTilesY));
     }
 
-    // flush the stream, so failbit will be set if the stream cannot be written to.
-    saveFile.flush();
-    return saveFile ? WriteResult::OK : WriteResult::IO_ERROR;
+    saveFile.write(reinterpret_cast<const char*>(tileBytes.data()), tileBytes.size() * sizeof(uint32_t));
+    writeWithProgress(saveFile, reinterpret_cast<const char*>(tileData.data()), tileData.size(), progress, 0.5f, 1.0f);
+}
+
+void CanvasState::writePixelBytes(uint8_t* out) const {
+    // empty pixels are 0, so only the allocated tiles have to be encoded
+    std::fill_n(out, static_cast<size_t>(width()) * height(), static_cast<uint8_t>(0));
+    dataMatrix.for_each({ 0, 0 }, size(), [&](const ext::point& pt, const element_variant_t& element) {
+        out[static_cast<size_t>(pt.y) * width() + pt.x] = encodeElement(element);
+    });
+}
+
+ReadResult CanvasState::loadPixelBytes(const uint8_t* data, int32_t matrixWidth, int32_t matrixHeight) {
+    if (matrixWidth < 0 || matrixHeight < 0 || static_cast<int64_t>(matrixWidth) * matrixHeight > std::numeric_limits<int32_t>::max()) return ReadResult::CORRUPTED;
+
+    const auto& decodeTable = elementDecodeTable();
+    CanvasState::matrix_t canvasData(matrixWidth, matrixHeight);
+    const size_t count = static_cast<size_t>(matrixWidth) * matrixHeight;
+    for (size_t i = 0; i != count; ++i) {
+        // the matrix starts out empty, so no tile has to be allocated for empty pixels
+        if (data[i] == 0) continue;
+
+        const auto& [valid, element] = decodeTable[data[i]];
+        if (!valid) return ReadResult::OUTDATED; // maybe it was written by a newer version with more elements?
+        canvasData[ext::point{ static_cast<int32_t>(i % matrixWidth), static_cast<int32_t>(i / matrixWidth) }] = element;
+    }
+
+    // only overwriting state.dataMatrix here ensures it is only modified if we return ReadResult::OK.
+    dataMatrix = std::move(canvasData);
+    communicators.clear();
+    return ReadResult::OK;
+}
+
+void CanvasState::fillSurfaceFromPixelBytes(const uint8_t* data, size_t count, uint32_t* pixelBuffer) {
+    // there are only 256 different bytes, so each colour is computed once
+    static const std::array<uint32_t, 256> colorTable = []() {
+        std::array<uint32_t, 256> colorTable{};
+        const auto& decodeTable = elementDecodeTable();
+        for (size_t elementData = 0; elementData != colorTable.size(); ++elementData) {
+            const auto& [valid, element] = decodeTable[elementData];
+            if (!valid) continue;
+            SDL_Color computedColor{ 0, 0, 0, 0 };
+            std::visit(visitor{
+                [](std::monostate) {},
+                [&computedColor](const auto& element) {
+                    computedColor = element.template computeDisplayColor<false>();
+                },
+            }, element);
+            colorTable[elementData] = computedColor.r | (computedColor.g << 8) | (computedColor.b << 16);
+        }
+        return colorTable;
+    }();
+    std::transform(data, data + count, pixelBuffer, [](uint8_t elementData) {
+        return colorTable[elementData];
+    });
 }
@@ -23,35 +23,49 @@
 #include <algorithm> // for std::min and std::max
 #include <cstdint> // for int32_t and uint32_t
 #include <limits>
+#include <memory>
+#include <vector>
+#include <unordered_map>
 #include <istream>
 #include <ostream>
+#include <atomic>
 #include <boost/endian/conversion.hpp>
 #include <cassert>
 
-#include "heap_matrix.hpp"
+#include "tiled_matrix.hpp"
 #include "elements.hpp"
 #include "point.hpp"
 #include "visitor.hpp"
 #include "tag_tuple.hpp"
 #include "expandable_matrix.hpp"
+#include "communicator.hpp"
+#include "thread_pool.hpp"
 
 class CanvasState {
 
 public:
     // the possible elements that a pixel can represent
     // std::monostate is a 'default' state, which represents an empty pixel
-    using element_tags_t = ext::tag_tuple<std::monostate, ConductiveWire, InsulatedWire, Signal, Source, PositiveRelay, NegativeRelay, AndGate, OrGate, NandGate, NorGate, ScreenCommunicatorElement, FileInputCommunicatorElement, FileOutputCommunicatorElement>;
+    using element_tags_t = ext::tag_tuple<std::monostate, ConductiveWire, InsulatedWire, Signal, Source, PositiveRelay, NegativeRelay, AndGate, OrGate, NandGate, NorGate, ScreenCommunicatorElement, FileInputCommunicatorElement, FileOutputCommunicatorElement, StreamInputCommunicatorElement>;
     static_assert(element_tags_t::size <= (static_cast<size_t>(1) << (std::numeric_limits<uint8_t>::digits - 2)), "Number of elements cannot exceed number of available bits in file format.");
 
     using element_variant_t = element_tags_t::instantiate<std::variant>;
+    // the communicators live in a side table, so that copying and moving elements is just copying bytes
+    static_assert(std::is_trivially_copyable_v<element_variant_t>, "Elements should not own any resources.");
 
 private:
-    using matrix_t = ext::heap_matrix<element_variant_t>;
+    // the canvas is stored in tiles, so that empty areas (only std::monostate) take no memory
+    using matrix_t = ext::tiled_matrix<element_variant_t>;
 
     matrix_t dataMatrix;
 
+    // the shared communicator instances, indexed by the communicatorId of the communicator elements
+    // entries might be null or not referred to by any element; Simulator::compile() rebuilds the table with only the communicators in use
+    std::vector<std::shared_ptr<Communicator>> communicators;
+
     friend class StateManager;
     friend class Simulator;
+    friend class StaticDataCache;
     friend class HistoryCanvasState;
     friend class SelectionAction;
 
@@ -70,17 +84,7 @@ private:
             return { 0, 0 }; // no preparation or translation needed
         }
 
-        ext::point min_pt = ext::min(pt, { 0, 0 });
-        ext::point max_pt = ext::min(pt + ext::point{ 1, 1 }, dataMatrix.size());
-        ext::point translation = -min_pt;
-        ext::point new_size = max_pt + translation;
-
-        matrix_t new_matrix(new_size);
-        ext::move_range(dataMatrix, new_matrix, 0, 0, translation.x, translation.y, dataMatrix.width(), dataMatrix.height());
-
-        dataMatrix = std::move(new_matrix);
-
-        return translation;
+        return extend(pt, pt + ext::point{ 1, 1 });
     }
 
     /**
@@ -101,33 +105,20 @@ public:
 
     /**
      * Shrink with no optimization.
+     * Only the tiles near the edges of the canvas are read, and the tiles are moved instead of the elements, so this doesn't depend on the area of the canvas.
+     * If a thread pool is given, the tiles along each edge are read in parallel.
      */
-    ext::point shrinkDataMatrix() {
-
-        // we simply iterate the whole matrix to get the min and max values
-        int32_t x_min = std::numeric_limits<int32_t>::max();
-        int32_t x_max = std::numeric_limits<int32_t>::min();
-        int32_t y_min = std::numeric_limits<int32_t>::max();
-        int32_t y_max = std::numeric_limits<int32_t>::min();
-
-        // iterate height before width for cache-friendliness
-        for (int32_t i = 0; i != dataMatrix.height(); ++i) {
-            for (int32_t j = 0; j != dataMatrix.width(); ++j) {
-                if (!std::holds_alternative<std::monostate>(dataMatrix[{j, i}])) {
-                    x_min = std::min(x_min, j);
-                    x_max = std::max(x_max, j);
-                    y_min = std::min(y_min, i);
-                    y_max = std::max(y_max, i);
-                }
-            }
-        }
+    ext::point shrinkDataMatrix(ext::thread_pool* pool = nullptr) {
+        const auto [topLeft, bottomRight] = dataMatrix.occupied_bounds([](const element_variant_t& element) {
+            return std::holds_alternative<std::monostate>(element);
+        }, pool);
 
-        if (x_min == 0 && x_max + 1 == dataMatrix.width() && y_min == 0 && y_max + 1 == dataMatrix.height()) {
+        if (topLeft == ext::point{ 0, 0 } && bottomRight == dataMatrix.size()) {
             // no resizing needed
             return { 0, 0 };
         }
 
-        if (x_min > x_max) {
+        if (topLeft.x >= bottomRight.x) {
             // if this happens, it means the game state is totally empty
             dataMatrix = matrix_t();
 
@@ -136,15 +127,20 @@ public:
             return { 0, 0 };
         }
 
-        int32_t new_width = x_max + 1 - x_min;
-        int32_t new_height = y_max + 1 - y_min;
-
-        matrix_t new_matrix(new_width, new_height);
-        ext::move_range(dataMatrix, new_matrix, x_min, y_min, 0, 0, new_width, new_height);
+        dataMatrix.resize(topLeft, bottomRight);
 
-        dataMatrix = std::move(new_matrix);
+        return -topLeft;
+    }
 
-        return { -x_min, -y_min };
+    /**
+     * Shrink with no optimization, after freeing the tiles in [editedTopLeft, editedBottomRight) that were erased, so that they don't have to be visited.
+     * The rest of the canvas is assumed to have no empty tiles (or to be not worth checking).
+     */
+    ext::point shrinkDataMatrix(const ext::point& editedTopLeft, const ext::point& editedBottomRight, ext::thread_pool* pool = nullptr) {
+        dataMatrix.release_empty_tiles(editedTopLeft, editedBottomRight, [](const element_variant_t& element) {
+            return std::holds_alternative<std::monostate>(element);
+        });
+        return shrinkDataMatrix(pool);
     }
 
     /**
@@ -157,7 +153,7 @@ public:
         // note that this function performs linearly to the size of the matrix.  But since this is limited by how fast the user can click, it should be good enough
 
         if constexpr (std::is_same_v<std::monostate, Element>) {
-            if (dataMatrix.contains(pt) && !std::holds_alternative<Element>(dataMatrix[pt])) {
+            if (dataMatrix.contains(pt) && !std::holds_alternative<Element>(std::as_const(dataMatrix)[pt])) {
                 dataMatrix[pt] = Element{};
 
                 // Element is std::monostate, so we have to see if we can shrink the matrix size
@@ -174,7 +170,7 @@ public:
             ext::point translation = prepareDataMatrixForAddition(pt);
             pt += translation;
 
-            if (!std::holds_alternative<Element>(dataMatrix[pt])) {
+            if (!std::holds_alternative<Element>(std::as_const(dataMatrix)[pt])) {
                 dataMatrix[pt] = Element{};
                 return { true, translation };
             }
@@ -203,6 +199,15 @@ public:
         return dataMatrix[indices];
     }
 
+    /**
+     * Returns the communicator instance of the given communicator element (which should be in this canvas state), or nullptr if it does not have one yet.
+     */
+    template <typename ElementType>
+    typename ElementType::communicator_t* communicatorOf(const ElementType& element) const noexcept {
+        if (element.communicatorId < 0 || element.communicatorId >= static_cast<int32_t>(communicators.size())) return nullptr;
+        return static_cast<typename ElementType::communicator_t*>(communicators[element.communicatorId].get());
+    }
+
 
     /**
      * returns true if the matrix is empty (i.e. has no width and height)
@@ -232,6 +237,31 @@ public:
         return dataMatrix.size();
     }
 
+    /**
+     * returns the version of the elements, which stays the same as long as the canvas is not written to (see ext::tiled_matrix::version())
+     */
+    std::pair<uint64_t, uint64_t> version() const noexcept {
+        return dataMatrix.version();
+    }
+
+    /**
+     * returns the number of bytes used by the elements and the communicator table (tiles shared with other canvases, e.g. in the history, are counted in full)
+     */
+    size_t memoryUsage() const noexcept {
+        return sizeof(CanvasState) + dataMatrix.bytes() + communicators.capacity() * sizeof(std::shared_ptr<Communicator>);
+    }
+
+    /**
+     * returns the number of bytes used by the communicators of the canvas, including their buffers (see Communicator::memoryUsage())
+     */
+    size_t communicatorMemoryUsage() const noexcept {
+        size_t bytes = 0;
+        for (const std::shared_ptr<Communicator>& communicator : communicators) {
+            if (communicator) bytes += communicator->memoryUsage();
+        }
+        return bytes;
+    }
+
     /**
      * returns true if the point is within the bounds of the matrix
      */
@@ -241,6 +271,7 @@ public:
 
     /**
      * grow the underlying matrix to a larger size
+     * (only the tiles are moved, so this doesn't depend on the area of the canvas)
      */
     ext::point extend(const ext::point& topLeft, const ext::point& bottomRight) {
         ext::point newTopLeft = empty() ? topLeft : min(topLeft, { 0, 0 });
@@ -250,10 +281,7 @@ public:
             return { 0, 0 };
         }
         else {
-            ext::point newSize = newBottomRight - newTopLeft;
-            matrix_t newMatrix(newSize);
-            if (!empty()) ext::move_range(dataMatrix, newMatrix, 0, 0, -newTopLeft.x, -newTopLeft.y, width(), height());
-            dataMatrix = std::move(newMatrix);
+            dataMatrix.resize(newTopLeft, newBottomRight);
             return -newTopLeft;
         }
     }
@@ -268,6 +296,7 @@ public:
         CanvasState newState;
         newState.dataMatrix = matrix_t(width, height);
         ext::swap_range(dataMatrix, newState.dataMatrix, x, y, 0, 0, width, height);
+        newState.communicators = communicators;
         return newState;
     }
 
@@ -283,11 +312,13 @@ public:
         for (int32_t y = 0; y < mask.height(); ++y) {
             for (int32_t x = 0; x < mask.width(); ++x) {
                 ext::point pt = offset + ext::point{ x, y };
-                if (mask[pt]) {
+                // empty elements are skipped, so that no tiles are allocated for them
+                if (mask[pt] && !std::holds_alternative<std::monostate>(std::as_const(dataMatrix)[pt])) {
                     std::swap(dataMatrix[pt], newState.dataMatrix[pt]);
                 }
             }
         }
+        newState.communicators = communicators;
         return newState;
     }
 
@@ -300,64 +331,103 @@ public:
     }
 
     void rotateClockwise() {
-        matrix_t newDataMatrix = matrix_t(dataMatrix.height(), dataMatrix.width());
-        for (int32_t x = 0; x != dataMatrix.width(); ++x) {
-            for (int32_t y = 0; y != dataMatrix.height(); ++y) {
-                newDataMatrix[{dataMatrix.height()-y-1, x}] = dataMatrix[{x, y}];
-            }
-        }
-        dataMatrix = std::move(newDataMatrix);
+        dataMatrix.rotateClockwise();
     }
 
     void rotateCounterClockwise() {
-        matrix_t newDataMatrix = matrix_t(dataMatrix.height(), dataMatrix.width());
-        for (int32_t x = 0; x != dataMatrix.width(); ++x) {
-            for (int32_t y = 0; y != dataMatrix.height(); ++y) {
-                newDataMatrix[{y, dataMatrix.width()-x-1}] = dataMatrix[{x, y}];
-            }
-        }
-        dataMatrix = std::move(newDataMatrix);
+        dataMatrix.rotateCounterClockwise();
     }
 
     /**
      * Merges a CanvasState with another, potentially modifying both of them.
      * Elements from the second CanvasState will be written over those from the first in the output.
      * Returns a matrix (not shrinked) and the translation required.
-     * If first contains second totally, the implementation will not construct an additional CanvasState.
+     * The output reuses the matrix of whichever CanvasState already covers both of them (or the larger one, grown to cover both),
+     * so that merging a small selection into a large canvas only touches the elements of the selection.
+     * If a thread pool is given, the elements are copied in parallel.
      * @pre Assumes that the parameters are within the bounds of this canvas state
      */
-    static std::pair<CanvasState, ext::point> merge(CanvasState&& first, const ext::point& firstTrans, CanvasState&& second, const ext::point& secondTrans) {
+    static std::pair<CanvasState, ext::point> merge(CanvasState&& first, const ext::point& firstTrans, CanvasState&& second, const ext::point& secondTrans, ext::thread_pool* pool = nullptr) {
         // special cases if we are merging with something empty
         if (first.empty()) return { std::move(second), -secondTrans };
         if (second.empty()) return { std::move(first), -firstTrans };
 
-        ext::point newMin = min(secondTrans, firstTrans);
-        ext::point newMax = max(secondTrans + second.size(), firstTrans + first.size());
+        const ext::point newMin = min(secondTrans, firstTrans);
+        const ext::point newMax = max(secondTrans + second.size(), firstTrans + first.size());
+        const auto covers = [&](const CanvasState& state, const ext::point& trans) {
+            return trans == newMin && trans + state.size() == newMax;
+        };
+        const auto area = [](const CanvasState& state) {
+            return static_cast<int64_t>(state.width()) * state.height();
+        };
+
+        // second is written into first if first covers both (or neither covers both and first is larger), otherwise first is written under second
+        const bool intoFirst = covers(first, firstTrans) || (!covers(second, secondTrans) && area(first) >= area(second));
+        CanvasState& dest = intoFirst ? first : second;
+        CanvasState& src = intoFirst ? second : first;
+        const ext::point& destTrans = intoFirst ? firstTrans : secondTrans;
+        const ext::point& srcTrans = intoFirst ? secondTrans : firstTrans;
+
+        // grows dest only if it doesn't already cover both
+        const ext::point destOffset = dest.extend(newMin - destTrans, newMax - destTrans);
+        blit(dest, src, srcTrans - destTrans + destOffset, intoFirst, pool);
+
+        return { std::move(dest), -newMin };
+    }
 
-        CanvasState newState;
-        if (firstTrans == newMin && firstTrans + first.size() == newMax) {
-            // optimization when `first` totally contains `second`; we can use the old matrix
-            newState.dataMatrix = std::move(first.dataMatrix);
-        }
-        else {
-            // create a new matrix
-            newState.dataMatrix = matrix_t(newMax - newMin);
-            // move first to newstate
-            ext::move_range(first.dataMatrix, newState.dataMatrix, 0, 0, firstTrans.x - newMin.x, firstTrans.y - newMin.y, first.width(), first.height());
+private:
+    /**
+     * Writes the non-empty elements of src into dest, with src translated by offset, giving the communicators of src ids in the table of dest.
+     * If overwrite is false, only the empty elements of dest are written to.
+     * Only the tiles of src are visited (in parallel, if a thread pool is given).
+     * @pre the translated src lies within the bounds of dest
+     */
+    static void blit(CanvasState& dest, const CanvasState& src, const ext::point& offset, bool overwrite, ext::thread_pool* pool) {
+        // the communicators of src are given ids in the table of dest (reusing the existing entry if the communicator is already there)
+        std::unordered_map<const Communicator*, int32_t> destIds;
+        for (int32_t id = 0; id != static_cast<int32_t>(dest.communicators.size()); ++id) {
+            if (dest.communicators[id]) destIds.emplace(dest.communicators[id].get(), id);
         }
-        // move non-monostate elements from second to newstate
-        for (int32_t y = 0; y < second.height(); ++y) {
-            for (int32_t x = 0; x < second.width(); ++x) {
-                ext::point pt{ x, y };
-                if (!std::holds_alternative<std::monostate>(second.dataMatrix[pt])) {
-                    newState[pt + secondTrans - newMin] = std::move(second[pt]);
-                }
-            }
+        std::vector<int32_t> srcToDestIds(src.communicators.size(), -1);
+        for (int32_t id = 0; id != static_cast<int32_t>(src.communicators.size()); ++id) {
+            if (!src.communicators[id]) continue;
+            auto [it, inserted] = destIds.emplace(src.communicators[id].get(), static_cast<int32_t>(dest.communicators.size()));
+            if (inserted) dest.communicators.push_back(src.communicators[id]);
+            srcToDestIds[id] = it->second;
         }
 
-        return { std::move(newState), -newMin };
+        // a whole tile of src that lands on an empty tile of dest is shared instead of copied, if its communicators keep their ids
+        // (so pasting a block repeatedly at tile-aligned positions stores it once, until one of the copies is edited)
+        const auto canShare = [&](const element_variant_t* elements, size_t count) {
+            return std::all_of(elements, elements + count, [&](const element_variant_t& element) {
+                return std::visit([&](const auto& element) {
+                    if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                        return element.communicatorId < 0 || srcToDestIds[element.communicatorId] == element.communicatorId;
+                    }
+                    else {
+                        return true;
+                    }
+                }, element);
+            });
+        };
+        // src is read through a const reference so that its tiles are not unshared
+        const auto isEmpty = [](const element_variant_t& element) {
+            return std::holds_alternative<std::monostate>(element);
+        };
+        dest.dataMatrix.share_or_merge(src.dataMatrix, offset, canShare, isEmpty, [&](const element_variant_t& element, const element_variant_t& destElement, element_variant_t& newElement) {
+            if (!overwrite && !std::holds_alternative<std::monostate>(destElement)) return false;
+            newElement = element;
+            std::visit([&](auto& newElement) {
+                if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(newElement)>>) {
+                    if (newElement.communicatorId >= 0) newElement.communicatorId = srcToDestIds[newElement.communicatorId];
+                }
+            }, newElement);
+            return true;
+        }, pool);
     }
 
+public:
+
     /**
      * Draw all elements onto a pixel buffer.
      * @pre Assumes that the pixel buffer has the same size as the datamatrix
@@ -371,7 +441,7 @@ public:
                     [&computedColor](const auto& element) {
                         computedColor = element.template computeDisplayColor<false>();
                     },
-                }, dataMatrix[{x, y}]);
+                }, std::as_const(dataMatrix)[{x, y}]);
                 *pixelBuffer++ = computedColor.r | (computedColor.g << 8) | (computedColor.b << 16);
             }
         }
@@ -384,7 +454,8 @@ public:
         OK,
         OUTDATED, // file is saved in a newer format
         CORRUPTED, // file is corrupted
-        IO_ERROR // file cannot be opened or read
+        IO_ERROR, // file cannot be opened or read
+        UNSUPPORTED // file is valid, but cannot be loaded in the requested way (e.g. a version 0 file cannot be loaded tile by tile)
     };
 
     enum class WriteResult : char {
@@ -392,6 +463,78 @@ public:
         IO_ERROR // file cannot be opened or written to
     };
 
-    ReadResult loadSave(std::istream& saveFile);
-    WriteResult writeSave(std::ostream& saveFile) const;
+    /**
+     * Loads a save file in any version of the format (see canvasstate.cpp).
+     * If a thread pool is given, the tiles of a version 1 file are decoded in parallel.
+     * If progress is given, the fraction of the file that has been loaded (from 0 to 1) is stored into it from time to time, so that another thread can display it.
+     * The canvas state is only modified if ReadResult::OK is returned.
+     */
+    ReadResult loadSave(std::istream& saveFile, ext::thread_pool* pool = nullptr, std::atomic<float>* progress = nullptr);
+
+    /**
+     * Writes a save file in the latest version of the format.
+     * If progress is given, the fraction of the file that has been written (from 0 to 1) is stored into it from time to time.
+     */
+    WriteResult writeSave(std::ostream& saveFile, std::atomic<float>* progress = nullptr) const;
+
+    /**
+     * Writes the byte of each pixel (the same bytes as in a save file) to out, in row-major order and without compression.
+     * This is the format of the clipboards in shared memory, so that they can be decoded straight from the mapped memory without a stream.
+     * @pre out has space for width() * height() bytes
+     */
+    void writePixelBytes(uint8_t* out) const;
+
+    /**
+     * Loads a canvas of the given size from the bytes written by writePixelBytes().
+     * The canvas state is only modified if ReadResult::OK is returned.
+     */
+    ReadResult loadPixelBytes(const uint8_t* data, int32_t matrixWidth, int32_t matrixHeight);
+
+    /**
+     * Draws the given pixel bytes onto a pixel buffer, in the same colours as fillSurface(), without building a canvas from them.
+     * Unknown bytes are drawn as empty pixels.
+     */
+    static void fillSurfaceFromPixelBytes(const uint8_t* data, size_t count, uint32_t* pixelBuffer);
+
+    /**
+     * Loads the tiles of a version 1 save file on demand, using the tile index at the start of the file, so that a part of a huge circuit can be viewed without reading all of it.
+     * The canvas is given the size of the whole circuit, but only the tiles around the rectangle given to loadTiles() are filled in, so its memory use depends on the size of that rectangle instead of the size of the file.
+     */
+    class TileLoader {
+    private:
+        std::unique_ptr<std::istream> saveFile;
+        ext::point canvasSize{ 0, 0 };
+        int32_t numTilesX = 0;
+        std::vector<uint32_t> tileBytes; // the number of bytes of each tile in the file
+        std::vector<uint64_t> tileOffsets; // the position of each tile in the file
+        std::vector<bool> tileLoaded; // whether each tile has been loaded into the canvas (or has failed to load)
+        std::vector<size_t> loadedTiles; // the tiles for which tileLoaded is true
+        std::vector<uint8_t> tileData; // scratch space for loadTiles()
+
+    public:
+        /**
+         * Reads the header and the tile index of the save file, and replaces the canvas with an empty canvas of the size of the circuit.
+         * Returns ReadResult::UNSUPPORTED if the file is valid but can't be loaded tile by tile (i.e. it is a version 0 file, or its tiles are not the tiles of the canvas).
+         * The canvas state is only modified if ReadResult::OK is returned.
+         */
+        ReadResult open(std::unique_ptr<std::istream> file, CanvasState& state);
+
+        /**
+         * Loads the tiles that intersect [topLeft, bottomRight) into the canvas, and releases the loaded tiles that are more than a tile away from it.
+         * changed is set to whether any element of the canvas was loaded.
+         * A tile that can't be read stays empty (and is not retried), and the error of the first such tile is returned.
+         * @pre open() returned ReadResult::OK with the same canvas state, which has not been modified apart from by this function
+         */
+        ReadResult loadTiles(CanvasState& state, const ext::point& topLeft, const ext::point& bottomRight, bool& changed);
+    };
+
+private:
+    // the pixel data of each version of the save format
+    static ReadResult loadPixelsV0(std::istream& saveFile, matrix_t& canvasData, std::atomic<float>* progress);
+    static ReadResult loadPixelsV1(std::istream& saveFile, matrix_t& canvasData, ext::thread_pool* pool, std::atomic<float>* progress);
+    void writePixelsV1(std::ostream& saveFile, std::atomic<float>* progress) const;
+
+    // decodes the packed pixels of the tile [topLeft, bottomRight) of a version 1 file into canvasData
+    // it writes through ext::tiled_matrix::write_tile(), so tiles that lie in different tiles of canvasData can be decoded in parallel, and the caller has to call canvasData.mark_written() afterwards
+    static ReadResult decodeTileV1(const uint8_t* data, size_t size, matrix_t& canvasData, const ext::point& topLeft, const ext::point& bottomRight);
 };
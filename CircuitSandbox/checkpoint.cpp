@@ -0,0 +1,211 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <variant>
+#include <type_traits>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+
+#include "checkpoint.hpp"
+#include "elements.hpp"
+#include "screencommunicator.hpp"
+#include "fileinputcommunicator.hpp"
+#include "fileoutputcommunicator.hpp"
+#include "streaminputcommunicator.hpp"
+#include "binary_io.hpp"
+
+// identifies a simulation checkpoint, and its version
+constexpr char CHECKPOINT_MAGIC[4] = { 'C', 'C', 'S', 'T' };
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+// bits of the state of each non-empty pixel in a checkpoint
+constexpr uint8_t CHECKPOINT_LEVEL_BIT = 0b001; // the level of index[0] (the logic level of a relay pixel)
+constexpr uint8_t CHECKPOINT_SECOND_LEVEL_BIT = 0b010; // the level of index[1] (whether a relay pixel is conductive)
+constexpr uint8_t CHECKPOINT_TRANSMIT_BIT = 0b100; // the transmit state of a communicator
+
+
+bool Checkpoint::write(const Simulator& simulator, const CanvasState& gameState, std::ostream& checkpoint) {
+    using StaticData = Simulator::StaticData;
+    using DynamicData = Simulator::DynamicData;
+    using PixelType = StaticData::DisplayedPixel::PixelType;
+    const StaticData& staticData = simulator.staticData;
+
+    if (!simulator.holdsSimulation() || simulator.backgroundCompilation) return false;
+    const std::shared_ptr<DynamicData> dynamicDataPtr = simulator.publishedState.read();
+    const DynamicData& dynamicData = *dynamicDataPtr;
+
+    checkpoint.write(CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC);
+    ext::write_binary(checkpoint, CHECKPOINT_VERSION);
+    ext::write_binary(checkpoint, ext::byte_order_mark);
+    ext::write_binary(checkpoint, Simulator::compileHash(gameState));
+    ext::write_binary(checkpoint, gameState.width());
+    ext::write_binary(checkpoint, gameState.height());
+
+    // the state of each non-empty pixel (in raster order), and the communicators in the order of their first pixel
+    std::vector<uint8_t> pixelStates;
+    std::vector<std::pair<uint8_t, Communicator*>> communicators;
+    std::vector<bool> communicatorSeen(staticData.communicators.size, false);
+    for (int32_t y = 0; y != gameState.height(); ++y) {
+        for (int32_t x = 0; x != gameState.width(); ++x) {
+            const ext::point pt{ x, y };
+            const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+            uint8_t state = 0;
+            switch (pixel.type) {
+            case PixelType::EMPTY:
+                continue;
+            case PixelType::RELAY:
+                if (dynamicData.relayPixelLogicLevels[pixel.index[0]]) state |= CHECKPOINT_LEVEL_BIT;
+                if (dynamicData.relayPixelIsConductive[pixel.index[0]]) state |= CHECKPOINT_SECOND_LEVEL_BIT;
+                break;
+            case PixelType::COMMUNICATOR:
+                std::visit([&](const auto& element) {
+                    if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                        auto* communicator = gameState.communicatorOf(element);
+                        if (dynamicData.communicatorTransmitStates[communicator->communicatorIndex]) state |= CHECKPOINT_TRANSMIT_BIT;
+                        if (!communicatorSeen[communicator->communicatorIndex]) {
+                            communicatorSeen[communicator->communicatorIndex] = true;
+                            communicators.emplace_back(static_cast<uint8_t>(pixel.elementIndex), communicator);
+                        }
+                    }
+                }, gameState[pt]);
+                [[fallthrough]];
+            case PixelType::COMPONENT:
+                if (pixel.index[0] != -1 && dynamicData.componentLogicLevels[pixel.index[0]]) state |= CHECKPOINT_LEVEL_BIT;
+                if (pixel.index[1] != -1 && dynamicData.componentLogicLevels[pixel.index[1]]) state |= CHECKPOINT_SECOND_LEVEL_BIT;
+                break;
+            }
+            pixelStates.push_back(state);
+        }
+    }
+    ext::write_binary_array(checkpoint, pixelStates.data(), pixelStates.size());
+
+    // the state of each communicator is prefixed by its element type and its size, so that the whole checkpoint can be checked before anything is restored
+    ext::write_binary(checkpoint, static_cast<uint64_t>(communicators.size()));
+    for (const auto& [elementIndex, communicator] : communicators) {
+        std::ostringstream communicatorState;
+        communicator->writeCheckpoint(communicatorState);
+        ext::write_binary(checkpoint, elementIndex);
+        ext::write_binary_string(checkpoint, communicatorState.str());
+    }
+
+    return static_cast<bool>(checkpoint);
+}
+
+
+bool Checkpoint::read(Simulator& simulator, CanvasState& gameState, std::istream& checkpoint) {
+    using StaticData = Simulator::StaticData;
+    using DynamicData = Simulator::DynamicData;
+    using PixelType = StaticData::DisplayedPixel::PixelType;
+    const StaticData& staticData = simulator.staticData;
+
+    if (!simulator.holdsSimulation() || simulator.backgroundCompilation) return false;
+
+    // check that the checkpoint is of this canvas
+    char magic[sizeof CHECKPOINT_MAGIC];
+    uint32_t version, byteOrder;
+    uint64_t hash;
+    int32_t width, height;
+    if (!checkpoint.read(magic, sizeof magic) || !std::equal(magic, magic + sizeof magic, CHECKPOINT_MAGIC)) return false;
+    if (!ext::read_binary(checkpoint, version) || version != CHECKPOINT_VERSION) return false;
+    if (!ext::read_binary(checkpoint, byteOrder) || byteOrder != ext::byte_order_mark) return false;
+    if (!ext::read_binary(checkpoint, hash) || !ext::read_binary(checkpoint, width) || !ext::read_binary(checkpoint, height)) return false;
+    if (width != gameState.width() || height != gameState.height() || hash != Simulator::compileHash(gameState)) return false;
+
+    const size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<uint8_t> pixelStates;
+    if (!ext::read_binary_array(checkpoint, pixelStates, numPixels)) return false;
+
+    // the communicators, in the order of their first pixel
+    std::vector<Communicator*> communicators;
+    std::vector<bool> communicatorSeen(staticData.communicators.size, false);
+    std::vector<uint8_t> communicatorElementIndices;
+    size_t numNonEmptyPixels = 0;
+    for (int32_t y = 0; y != height; ++y) {
+        for (int32_t x = 0; x != width; ++x) {
+            const ext::point pt{ x, y };
+            const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+            if (pixel.type == PixelType::EMPTY) continue;
+            ++numNonEmptyPixels;
+            if (pixel.type != PixelType::COMMUNICATOR) continue;
+            std::visit([&](const auto& element) {
+                if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                    auto* communicator = gameState.communicatorOf(element);
+                    if (!communicatorSeen[communicator->communicatorIndex]) {
+                        communicatorSeen[communicator->communicatorIndex] = true;
+                        communicators.push_back(communicator);
+                        communicatorElementIndices.push_back(pixel.elementIndex);
+                    }
+                }
+            }, std::as_const(gameState)[pt]);
+        }
+    }
+    if (pixelStates.size() != numNonEmptyPixels) return false;
+
+    uint64_t numCommunicators;
+    if (!ext::read_binary(checkpoint, numCommunicators) || numCommunicators != communicators.size()) return false;
+    std::vector<std::string> communicatorStates(communicators.size());
+    for (size_t i = 0; i != communicators.size(); ++i) {
+        uint8_t elementIndex;
+        if (!ext::read_binary(checkpoint, elementIndex) || elementIndex != communicatorElementIndices[i]) return false;
+        if (!ext::read_binary_string(checkpoint, communicatorStates[i], std::numeric_limits<uint32_t>::max())) return false;
+    }
+
+    // restore the communicators
+    for (size_t i = 0; i != communicators.size(); ++i) {
+        std::istringstream communicatorState(communicatorStates[i]);
+        if (!communicators[i]->readCheckpoint(communicatorState)) return false;
+    }
+
+    // the constants were folded from the old state, so they have to be folded again from the restored one
+    simulator.unfoldConstants();
+
+    const std::shared_ptr<DynamicData>& dynamicDataPtr = simulator.acquireDynamicData();
+    DynamicData& dynamicData = *dynamicDataPtr;
+    auto pixelState = pixelStates.begin();
+    for (int32_t y = 0; y != height; ++y) {
+        for (int32_t x = 0; x != width; ++x) {
+            const ext::point pt{ x, y };
+            const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+            if (pixel.type == PixelType::EMPTY) continue;
+            const uint8_t state = *pixelState++;
+            switch (pixel.type) {
+            case PixelType::RELAY:
+                if (state & CHECKPOINT_LEVEL_BIT) dynamicData.relayPixelLogicLevels.set(pixel.index[0]);
+                if (state & CHECKPOINT_SECOND_LEVEL_BIT) dynamicData.relayPixelIsConductive.set(pixel.index[0]);
+                break;
+            case PixelType::COMMUNICATOR:
+                if (state & CHECKPOINT_TRANSMIT_BIT) {
+                    std::visit([&](const auto& element) {
+                        if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                            dynamicData.communicatorTransmitStates.set(gameState.communicatorOf(element)->communicatorIndex);
+                        }
+                    }, std::as_const(gameState)[pt]);
+                }
+                [[fallthrough]];
+            case PixelType::COMPONENT:
+                if (pixel.index[0] != -1 && (state & CHECKPOINT_LEVEL_BIT)) dynamicData.componentLogicLevels.set(pixel.index[0]);
+                if (pixel.index[1] != -1 && (state & CHECKPOINT_SECOND_LEVEL_BIT)) dynamicData.componentLogicLevels.set(pixel.index[1]);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    simulator.installRestoredState(dynamicDataPtr, gameState);
+    return true;
+}
@@ -0,0 +1,38 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+#include "simulator.hpp"
+#include "canvasstate.hpp"
+
+/**
+ * The file format of simulation checkpoints, which hold the state of a simulation (the logic levels, the relay states, and the state of the communicators) so that it can be resumed later.
+ * The levels are written for each pixel, so a checkpoint does not depend on how the canvas was compiled.
+ */
+class Checkpoint {
+public:
+    /**
+     * Writes the current state of the simulation to a checkpoint that read() can resume the simulation from.
+     * Returns false (without writing anything) if there is no compiled simulation of gameState, e.g. a background compilation is pending.
+     * @pre simulation is currently stopped, and gameState is the canvas that was last compiled.
+     */
+    static bool write(const Simulator& simulator, const CanvasState& gameState, std::ostream& checkpoint);
+
+    /**
+     * Replaces the current state of the simulation with one written by write() for a canvas with the same elements, and updates gameState like Simulator::compile() does.
+     * Returns false if the checkpoint is of a canvas with different elements, or is malformed.  The state of the simulation is then unchanged, but if the data of a communicator is malformed, the communicators before it have already been restored.
+     * @pre simulation is currently stopped, and gameState is the canvas that was last compiled.
+     */
+    static bool read(Simulator& simulator, CanvasState& gameState, std::istream& checkpoint);
+};
@@ -0,0 +1,422 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Generates large synthetic circuits with a regular structure, so that the compiler, simulator and renderer can be measured at sizes that the samples don't reach.
+ * Each structure takes two size parameters, and is driven by NOR gate oscillators (a NOR gate whose input is its own output, so it toggles every step) so that it stays busy.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "canvasstate.hpp"
+#include "elements.hpp"
+#include "point.hpp"
+
+class CircuitGenerator {
+public:
+    enum class Structure : char {
+        RIPPLE_ADDER, // count = number of adders, size = bits per adder
+        RELAY_CROSSBAR, // count = number of rows, size = number of columns
+        WIRE_MESH, // count = number of horizontal wires, size = number of vertical wires
+        CLOCK_TREE, // count = number of trees, size = depth of each tree
+        RAM_ARRAY // count = number of words, size = bits per word
+    };
+
+    /**
+     * Returns a new canvas state containing the given structure.
+     */
+    static CanvasState generate(Structure structure, int32_t count, int32_t size) {
+        switch (structure) {
+        case Structure::RIPPLE_ADDER:
+            return rippleAdders(count, size);
+        case Structure::RELAY_CROSSBAR:
+            return relayCrossbar(count, size);
+        case Structure::WIRE_MESH:
+            return wireMesh(count, size);
+        case Structure::CLOCK_TREE:
+            return clockTrees(count, size);
+        case Structure::RAM_ARRAY:
+            return ramArray(count, size);
+        }
+        return CanvasState();
+    }
+
+private:
+    CanvasState state;
+
+    CircuitGenerator(int32_t width, int32_t height) {
+        state.extend({ 0, 0 }, { width, height });
+    }
+
+    template <typename Element>
+    void place(int32_t x, int32_t y) {
+        state[{ x, y }] = Element{};
+    }
+
+    template <typename Element>
+    bool holds(int32_t x, int32_t y) const {
+        return std::holds_alternative<Element>(state[{ x, y }]);
+    }
+
+    void horizontalWire(int32_t x1, int32_t x2, int32_t y) {
+        for (int32_t x = x1; x <= x2; ++x) place<ConductiveWire>(x, y);
+    }
+
+    void verticalWire(int32_t x, int32_t y1, int32_t y2) {
+        for (int32_t y = y1; y <= y2; ++y) place<ConductiveWire>(x, y);
+    }
+
+    /**
+     * Draws a vertical wire that crosses any horizontal wires in its way with insulated wire.
+     */
+    void verticalCrossingWire(int32_t x, int32_t y1, int32_t y2) {
+        for (int32_t y = y1; y <= y2; ++y) {
+            if (holds<ConductiveWire>(x, y)) place<InsulatedWire>(x, y);
+            else place<ConductiveWire>(x, y);
+        }
+    }
+
+    /**
+     * Draws an oscillator whose output leaves to the right of (x + 2, y).
+     * It occupies the 3x2 rectangle at (x, y); the pixels around it (other than the output) should be empty.
+     */
+    void oscillator(int32_t x, int32_t y) {
+        place<NorGate>(x, y);
+        place<ConductiveWire>(x + 1, y);
+        place<ConductiveWire>(x + 1, y + 1);
+        place<Signal>(x, y + 1);
+        place<ConductiveWire>(x + 2, y);
+    }
+
+
+    /**
+     * Lays out a netlist of gates with at most two inputs in a horizontal strip, like a channel router.
+     * Each gate takes a slot 6 pixels wide below the channel, and each net is a horizontal wire in the channel, spanning the columns that use it.
+     * Nets whose spans don't overlap share a row of the channel, so the height of the strip only depends on how many nets are live at the same place.
+     */
+    struct Strip {
+        enum class Kind : char { OR, NOR, AND, NAND, SOURCE };
+        struct Gate {
+            Kind kind;
+            int32_t inputs[2];
+            int32_t output;
+        };
+
+        std::vector<Gate> gates;
+        int32_t numNets = 0;
+
+        int32_t addNet() {
+            return numNets++;
+        }
+
+        int32_t addGate(Kind kind, int32_t input1, int32_t input2, int32_t output = -1) {
+            if (output == -1) output = addNet();
+            gates.push_back(Gate{ kind, { input1, input2 }, output });
+            return output;
+        }
+
+        // columns of each gate slot, relative to the slot
+        static constexpr int32_t INPUT_COLUMNS[2] = { 0, 2 };
+        static constexpr int32_t GATE_COLUMN = 1;
+        static constexpr int32_t OUTPUT_COLUMN = 4;
+        static constexpr int32_t SLOT_WIDTH = 6;
+
+        int32_t width() const noexcept {
+            return static_cast<int32_t>(gates.size()) * SLOT_WIDTH;
+        }
+
+        /**
+         * Assigns each net to a row of the channel, and returns the number of rows.
+         * Every column used by a net is at an even x-coordinate, so nets in the same row are separated by at least one empty pixel.
+         */
+        int32_t assignRows(std::vector<int32_t>& netRows, std::vector<std::pair<int32_t, int32_t>>& netSpans) const {
+            netSpans.assign(numNets, { INT32_MAX, INT32_MIN });
+            auto use = [&](int32_t net, int32_t x) {
+                netSpans[net].first = std::min(netSpans[net].first, x);
+                netSpans[net].second = std::max(netSpans[net].second, x);
+            };
+            for (size_t i = 0; i != gates.size(); ++i) {
+                const int32_t slotX = static_cast<int32_t>(i) * SLOT_WIDTH;
+                for (int32_t j = 0; j != 2; ++j) {
+                    if (gates[i].inputs[j] != -1) use(gates[i].inputs[j], slotX + INPUT_COLUMNS[j]);
+                }
+                use(gates[i].output, slotX + OUTPUT_COLUMN);
+            }
+
+            // left edge algorithm: take the nets from left to right, putting each in the first row that is free at its start
+            std::vector<int32_t> order(numNets);
+            for (int32_t net = 0; net != numNets; ++net) order[net] = net;
+            std::sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+                return netSpans[a].first < netSpans[b].first;
+            });
+            netRows.assign(numNets, -1);
+            std::vector<int32_t> rowEnds;
+            for (int32_t net : order) {
+                if (netSpans[net].first > netSpans[net].second) continue; // unused net
+                auto it = std::find_if(rowEnds.begin(), rowEnds.end(), [&](int32_t rowEnd) {
+                    return rowEnd < netSpans[net].first;
+                });
+                if (it == rowEnds.end()) it = rowEnds.insert(rowEnds.end(), INT32_MIN);
+                *it = netSpans[net].second;
+                netRows[net] = static_cast<int32_t>(it - rowEnds.begin());
+            }
+            return static_cast<int32_t>(rowEnds.size());
+        }
+
+        /**
+         * Height of the strip with the given number of channel rows.
+         */
+        static constexpr int32_t height(int32_t rows) noexcept {
+            return 2 * rows + 4;
+        }
+    };
+
+    void drawStrip(const Strip& strip, int32_t left, int32_t top) {
+        std::vector<int32_t> netRows;
+        std::vector<std::pair<int32_t, int32_t>> netSpans;
+        const int32_t rows = strip.assignRows(netRows, netSpans);
+        const int32_t gateY = top + 2 * rows + 1;
+        auto netY = [&](int32_t net) {
+            return top + 2 * netRows[net];
+        };
+
+        for (int32_t net = 0; net != strip.numNets; ++net) {
+            if (netRows[net] != -1) horizontalWire(left + netSpans[net].first, left + netSpans[net].second, netY(net));
+        }
+
+        for (size_t i = 0; i != strip.gates.size(); ++i) {
+            const Strip::Gate& gate = strip.gates[i];
+            const int32_t slotX = left + static_cast<int32_t>(i) * Strip::SLOT_WIDTH;
+            const int32_t gateX = slotX + Strip::GATE_COLUMN;
+            const int32_t outputX = slotX + Strip::OUTPUT_COLUMN;
+
+            // the inputs come down from the channel to signals beside the gate
+            for (int32_t j = 0; j != 2; ++j) {
+                if (gate.inputs[j] == -1) continue;
+                const int32_t inputX = slotX + Strip::INPUT_COLUMNS[j];
+                verticalCrossingWire(inputX, netY(gate.inputs[j]) + 1, gateY - 1);
+                place<Signal>(inputX, gateY);
+            }
+
+            switch (gate.kind) {
+            case Strip::Kind::OR: place<OrGate>(gateX, gateY); break;
+            case Strip::Kind::NOR: place<NorGate>(gateX, gateY); break;
+            case Strip::Kind::AND: place<AndGate>(gateX, gateY); break;
+            case Strip::Kind::NAND: place<NandGate>(gateX, gateY); break;
+            case Strip::Kind::SOURCE: place<Source>(gateX, gateY); break;
+            }
+
+            // the output goes down, right, and back up to the channel
+            place<ConductiveWire>(gateX, gateY + 1);
+            horizontalWire(gateX, outputX, gateY + 2);
+            place<ConductiveWire>(outputX, gateY + 1);
+            verticalCrossingWire(outputX, netY(gate.output) + 1, gateY);
+        }
+    }
+
+    /**
+     * Ripple carry adders, one above the other, each adding the oscillator to all ones, so that the carry ripples through every bit whenever the oscillator goes high.
+     */
+    static CanvasState rippleAdders(int32_t count, int32_t bits) {
+        using Kind = Strip::Kind;
+        Strip strip;
+        const int32_t clock = strip.addNet();
+        strip.addGate(Kind::NOR, clock, -1, clock);
+        const int32_t one = strip.addGate(Kind::SOURCE, -1, -1);
+        int32_t carry = strip.addNet(); // the carry into the first bit is never driven
+        for (int32_t i = 0; i != bits; ++i) {
+            // full adder made of 7 gates
+            const int32_t or1 = strip.addGate(Kind::OR, clock, one);
+            const int32_t nand1 = strip.addGate(Kind::NAND, clock, one);
+            const int32_t xor1 = strip.addGate(Kind::AND, or1, nand1);
+            const int32_t or2 = strip.addGate(Kind::OR, xor1, carry);
+            const int32_t nand2 = strip.addGate(Kind::NAND, xor1, carry);
+            strip.addGate(Kind::AND, or2, nand2); // sum
+            carry = strip.addGate(Kind::NAND, nand1, nand2);
+        }
+
+        std::vector<int32_t> netRows;
+        std::vector<std::pair<int32_t, int32_t>> netSpans;
+        const int32_t pitch = Strip::height(strip.assignRows(netRows, netSpans)) + 1;
+        CircuitGenerator generator(strip.width(), count * pitch - 1);
+        for (int32_t i = 0; i != count; ++i) {
+            generator.drawStrip(strip, 0, i * pitch);
+        }
+        return std::move(generator.state);
+    }
+
+    /**
+     * A grid of horizontal and vertical wires, with a relay at each crossing that connects the two wires.
+     * The relays alternate between positive and negative, and between being controlled by their row and their column.
+     * Every other row is driven by an oscillator.
+     */
+    static CanvasState relayCrossbar(int32_t rows, int32_t columns) {
+        constexpr int32_t left = 3;
+        CircuitGenerator generator(left + 4 * columns, 4 * rows);
+        for (int32_t i = 0; i != rows; ++i) {
+            generator.horizontalWire(left, left + 4 * columns - 1, 4 * i);
+            if (i % 2 == 0) generator.oscillator(0, 4 * i);
+        }
+        for (int32_t j = 0; j != columns; ++j) {
+            generator.verticalCrossingWire(left + 4 * j, 0, 4 * rows - 1);
+        }
+        for (int32_t i = 0; i != rows; ++i) {
+            for (int32_t j = 0; j != columns; ++j) {
+                const int32_t x = left + 4 * j + 1;
+                const int32_t y = 4 * i + 1;
+                if ((i + j) % 2 == 0) generator.place<PositiveRelay>(x, y);
+                else generator.place<NegativeRelay>(x, y);
+                if (j % 2 == 0) generator.place<Signal>(x + 1, y); // touches the row above
+                else generator.place<Signal>(x, y + 1); // touches the column to the left
+            }
+        }
+        return std::move(generator.state);
+    }
+
+    /**
+     * A woven mesh of long wires, where one in eight crossings connects the two wires and the rest are insulated.
+     * Every other horizontal wire is driven by an oscillator.
+     */
+    static CanvasState wireMesh(int32_t rows, int32_t columns) {
+        constexpr int32_t left = 4;
+        CircuitGenerator generator(left + 2 * columns - 1, 2 * rows);
+        for (int32_t i = 0; i != rows; ++i) {
+            if (i % 2 == 0) {
+                generator.oscillator(0, 2 * i);
+                generator.horizontalWire(left - 1, left + 2 * columns - 2, 2 * i);
+            }
+            else {
+                generator.horizontalWire(left, left + 2 * columns - 2, 2 * i);
+            }
+        }
+        for (int32_t j = 0; j != columns; ++j) {
+            generator.verticalCrossingWire(left + 2 * j, 0, 2 * rows - 2);
+        }
+        for (int32_t i = 0; i != rows; ++i) {
+            for (int32_t j = 0; j != columns; ++j) {
+                // cheap integer hash, so that the connections are scattered but the same every time
+                uint32_t hash = static_cast<uint32_t>(i) * 0x9E3779B1u ^ static_cast<uint32_t>(j) * 0x85EBCA77u;
+                hash ^= hash >> 15;
+                hash *= 0xC2B2AE3Du;
+                hash ^= hash >> 13;
+                if (hash % 8 == 0) generator.place<ConductiveWire>(left + 2 * j, 2 * i);
+            }
+        }
+        return std::move(generator.state);
+    }
+
+    /**
+     * Binary trees of buffers (single-input OR gates), side by side, each with 2^depth leaves and driven by an oscillator at its root.
+     */
+    static CanvasState clockTrees(int32_t count, int32_t depth) {
+        const int32_t treeWidth = 6 * depth + 6;
+        const int32_t pitch = treeWidth + 2;
+        CircuitGenerator generator(count * pitch - 2, int32_t{ 2 } << depth);
+        for (int32_t t = 0; t != count; ++t) {
+            const int32_t left = t * pitch;
+            const int32_t rootY = (int32_t{ 1 } << depth) - 1;
+            generator.oscillator(left, rootY);
+            for (int32_t d = 0; d <= depth; ++d) {
+                const int32_t gateX = left + 4 + 6 * d;
+                const int32_t spacing = int32_t{ 2 } << (depth - d);
+                for (int32_t k = 0; k != (int32_t{ 1 } << d); ++k) {
+                    const int32_t y = (2 * k + 1) * (spacing / 2) - 1;
+                    generator.place<Signal>(gateX - 1, y);
+                    generator.place<OrGate>(gateX, y);
+                    generator.place<ConductiveWire>(gateX + 1, y);
+                    if (d != depth) {
+                        // branch to the two children, which are above and below
+                        const int32_t h = spacing / 4;
+                        generator.verticalWire(gateX + 2, y - h, y + h);
+                        generator.horizontalWire(gateX + 3, gateX + 4, y - h);
+                        generator.horizontalWire(gateX + 3, gateX + 4, y + h);
+                    }
+                }
+            }
+        }
+        return std::move(generator.state);
+    }
+
+    /**
+     * An array of memory cells, each being a NOR latch that is written from its bit lines through two relays when its word line is high.
+     * The word lines are driven by oscillators or sources, and the bit lines by oscillators or sources (with an inverter for the complementary bit line).
+     */
+    static CanvasState ramArray(int32_t words, int32_t bits) {
+        constexpr int32_t left = 4;
+        constexpr int32_t top = 4;
+        constexpr int32_t cellWidth = 12;
+        constexpr int32_t cellHeight = 11;
+        CircuitGenerator generator(left + cellWidth * bits, top + cellHeight * words);
+
+        // word lines
+        for (int32_t r = 0; r != words; ++r) {
+            const int32_t y = top + cellHeight * r;
+            generator.horizontalWire(left - 1, left + cellWidth * bits - 1, y);
+            if (r % 2 == 0) generator.oscillator(0, y);
+            else generator.place<Source>(left - 1, y);
+        }
+
+        // bit lines (x) and complementary bit lines (x + 10)
+        for (int32_t c = 0; c != bits; ++c) {
+            const int32_t x = left + cellWidth * c;
+            if (c % 2 == 0) {
+                generator.place<NorGate>(x, 0);
+                generator.place<ConductiveWire>(x + 1, 0);
+                generator.place<ConductiveWire>(x + 1, 1);
+                generator.place<Signal>(x, 1);
+                generator.horizontalWire(x + 2, x + 8, 0);
+                generator.verticalCrossingWire(x, 2, top + cellHeight * words - 1);
+            }
+            else {
+                generator.place<Source>(x, 0);
+                generator.horizontalWire(x + 1, x + 8, 0);
+                generator.verticalCrossingWire(x, 1, top + cellHeight * words - 1);
+            }
+            generator.place<Signal>(x + 9, 0);
+            generator.place<NorGate>(x + 10, 0);
+            generator.verticalCrossingWire(x + 10, 1, top + cellHeight * words - 1);
+        }
+
+        for (int32_t r = 0; r != words; ++r) {
+            for (int32_t c = 0; c != bits; ++c) {
+                const int32_t x = left + cellWidth * c;
+                const int32_t y = top + cellHeight * r;
+                // set and reset inputs, connected to the bit lines while the word line is high
+                generator.place<Signal>(x + 2, y + 1);
+                generator.place<PositiveRelay>(x + 2, y + 2);
+                generator.place<ConductiveWire>(x + 1, y + 2);
+                generator.verticalWire(x + 3, y + 2, y + 3);
+                generator.place<Signal>(x + 3, y + 4);
+                generator.place<Signal>(x + 8, y + 1);
+                generator.place<PositiveRelay>(x + 8, y + 2);
+                generator.place<ConductiveWire>(x + 9, y + 2);
+                generator.verticalWire(x + 7, y + 2, y + 3);
+                generator.place<Signal>(x + 7, y + 4);
+
+                // the two NOR gates of the latch, each with the other's output as an input
+                generator.place<NorGate>(x + 3, y + 5);
+                generator.place<NorGate>(x + 7, y + 5);
+                generator.verticalWire(x + 2, y + 5, y + 7);
+                generator.horizontalWire(x + 3, x + 6, y + 7);
+                generator.place<ConductiveWire>(x + 6, y + 6);
+                generator.place<Signal>(x + 6, y + 5);
+                generator.verticalWire(x + 8, y + 5, y + 9);
+                generator.horizontalWire(x + 4, x + 7, y + 9);
+                generator.verticalCrossingWire(x + 4, y + 6, y + 8);
+                generator.place<Signal>(x + 4, y + 5);
+            }
+        }
+        return std::move(generator.state);
+    }
+};
@@ -97,19 +97,17 @@ void ClipboardAction::layoutComponents(SDL_Renderer* renderer) {
             text = ""; // shouldn't happen
             break;
     }
-    SDL_Surface* surface1 = TTF_RenderText_Shaded(mainWindow.interfaceFont, text, foregroundColor, backgroundColor);
-    SDL_Texture* texture1 = SDL_CreateTextureFromSurface(renderer, surface1);
+    const TextCache::TextHandle text1 = mainWindow.textCache.renderShaded(mainWindow.interfaceFont, text, foregroundColor, backgroundColor);
+    const ext::point textSize1 = text1->size();
     SDL_Rect target{
         POPUP_PADDING.x,
-        POPUP_PADDING.y + HEADER_HEIGHT / 2 - surface1->h / 2,
-        surface1->w,
-        surface1->h
+        POPUP_PADDING.y + HEADER_HEIGHT / 2 - textSize1.y / 2,
+        textSize1.x,
+        textSize1.y
     };
-    SDL_RenderCopy(renderer, texture1, nullptr, &target);
+    SDL_RenderCopy(renderer, text1->getTexture(renderer), nullptr, &target);
 
     SDL_SetRenderTarget(renderer, nullptr);
-    SDL_DestroyTexture(texture1);
-    SDL_FreeSurface(surface1);
 
     // set clipboard button renderareas
     for (int32_t i = 0; i < NUM_CLIPBOARDS; ++i) {
@@ -26,6 +26,7 @@
 #include "eventhook.hpp"
 #include "simulator.hpp"
 #include "sdl_automatic.hpp"
+#include "textcache.hpp"
 #include "sdl_fast_maprgb.hpp"
 #include "renderable.hpp"
 #include "declarations.hpp"
@@ -62,8 +63,9 @@ private:
         inline void prepareTexture(SDL_Renderer* renderer, UniqueTexture& textureStore, const SDL_Color& textColor, const SDL_Color& backColor) {
             textureStore.reset(nullptr);
             SDL_Texture* texture = create_fast_alpha_texture(renderer, SDL_TEXTUREACCESS_TARGET, { renderArea.w, renderArea.h });
-            SDL_Surface* surface = TTF_RenderText_Blended(owner.mainWindow.interfaceFont, std::to_string(index).c_str(), textColor);
-            SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, surface);
+            const TextCache::TextHandle text = owner.mainWindow.textCache.renderBlended(owner.mainWindow.interfaceFont, std::to_string(index), textColor);
+            const ext::point textSize = text->size();
+            SDL_Texture* textTexture = text->getTexture(renderer);
             SDL_SetRenderTarget(renderer, texture);
 
             SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0); // transparent
@@ -78,7 +80,7 @@ private:
             // text
             {
                 SDL_SetTextureBlendMode(textTexture, SDL_BLENDMODE_BLEND);
-                const SDL_Rect targetRect{ renderArea.w / 2 - surface->w / 2, renderArea.h / 2 - surface->h / 2, surface->w, surface->h };
+                const SDL_Rect targetRect{ renderArea.w / 2 - textSize.x / 2, renderArea.h / 2 - textSize.y / 2, textSize.x, textSize.y };
                 SDL_RenderCopy(renderer, textTexture, nullptr, &targetRect);
             }
             // border
@@ -89,8 +91,6 @@ private:
             }
 
             SDL_SetRenderTarget(renderer, nullptr);
-            SDL_FreeSurface(surface);
-            SDL_DestroyTexture(textTexture);
             SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_ADD);
             textureStore.reset(texture);
         }
@@ -141,20 +141,19 @@ private:
         inline void prepareTexture(SDL_Renderer* renderer, UniqueTexture& textureStore, const SDL_Color& textColor, const SDL_Color& backColor) {
             textureStore.reset(nullptr);
             SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_UNKNOWN, SDL_TEXTUREACCESS_TARGET, renderArea.w, renderArea.h);
-            SDL_Surface* surface = TTF_RenderText_Shaded(owner.mainWindow.interfaceFont, Next ? ">" : "<", textColor, backColor);
-            SDL_Texture* textTexture = SDL_CreateTextureFromSurface(renderer, surface);
+            const TextCache::TextHandle text = owner.mainWindow.textCache.renderShaded(owner.mainWindow.interfaceFont, Next ? ">" : "<", textColor, backColor);
+            const ext::point textSize = text->size();
+            SDL_Texture* textTexture = text->getTexture(renderer);
             SDL_SetRenderTarget(renderer, texture);
             {
                 SDL_SetRenderDrawColor(renderer, backColor.r, backColor.g, backColor.b, backColor.a);
                 SDL_RenderClear(renderer);
             }
             {
-                const SDL_Rect targetRect{ renderArea.w / 2 - surface->w / 2, renderArea.h / 2 - surface->h / 2, surface->w, surface->h };
+                const SDL_Rect targetRect{ renderArea.w / 2 - textSize.x / 2, renderArea.h / 2 - textSize.y / 2, textSize.x, textSize.y };
                 SDL_RenderCopy(renderer, textTexture, nullptr, &targetRect);
             }
             SDL_SetRenderTarget(renderer, nullptr);
-            SDL_FreeSurface(surface);
-            SDL_DestroyTexture(textTexture);
             textureStore.reset(texture);
         }
 
@@ -245,6 +244,7 @@ public:
     }
 
     static inline void startPasteDialog(MainWindow& mainWindow, SDL_Renderer* renderer, const ActionStarter& starter) {
+        if (mainWindow.stateManager.rejectIfViewOnly(mainWindow)) return;
         starter.start<ClipboardAction>(mainWindow, renderer, Mode::PASTE);
     }
 };
@@ -54,5 +54,12 @@ public:
 
     SDL_Texture* getThumbnail(int32_t index);
 
+    /**
+     * Returns the number of bytes of the clipboards held by this process (see ClipboardStore::memoryUsage()).
+     */
+    size_t memoryUsage() const noexcept {
+        return storage.memoryUsage();
+    }
+
     void setRenderer(SDL_Renderer* renderer);
 };
@@ -12,10 +12,13 @@
 
 #include <atomic>
 #include <array>
+#include <algorithm>
 #include <optional>
 #include <string>
-#include <sstream>
+#include <vector>
 #include <iostream>
+#include <thread>
+#include <cstring>
 #include <cassert>
 #include <SDL.h>
 #include "canvasstate.hpp"
@@ -26,6 +29,9 @@
 
 /**
  * Manages storage of clipboards in a interprocess-shareable manner.
+ * Each clipboard is a ready flag, a ClipboardHeader, the pixel bytes of the canvas (see CanvasState::writePixelBytes()), and a downscaled thumbnail,
+ * so that it can be written straight into the shared memory and decoded straight from the mapped memory.
+ * The thumbnail is drawn on a background thread by the process that wrote the clipboard, which sets the ready flag when it is done, so other processes never have to draw it.
  */
 
 namespace {
@@ -77,19 +83,109 @@ namespace {
 template <uint32_t NumClipboards>
 class ClipboardStore {
 private:
-    constexpr inline static const char* memoryName = "CircuitSandbox_Clipboardv1";
+    // each change to the format of a clipboard changes the name, to keep older versions from reading the new format
+    constexpr inline static const char* memoryName = "CircuitSandbox_Clipboardv3";
+
+    // the largest width or height of a thumbnail, larger clipboards are scaled down to fit
+    constexpr inline static int32_t thumbnailMaxSize = 256;
+
+    using ready_flag_t = std::atomic<uint32_t>; // nonzero once the thumbnail has been drawn
+    static_assert(ready_flag_t::is_always_lock_free, "Need always lock-free atomics!");
+
+    struct ClipboardHeader {
+        int32_t width;
+        int32_t height;
+        int32_t thumbnailWidth;
+        int32_t thumbnailHeight;
+
+        ClipboardHeader() noexcept {}
+        ClipboardHeader(int32_t width, int32_t height) noexcept : width(width), height(height) {
+            const int32_t largerSide = std::max(width, height);
+            if (largerSide <= thumbnailMaxSize) {
+                thumbnailWidth = width;
+                thumbnailHeight = height;
+            }
+            else {
+                thumbnailWidth = std::max(static_cast<int32_t>(static_cast<int64_t>(width) * thumbnailMaxSize / largerSide), 1);
+                thumbnailHeight = std::max(static_cast<int32_t>(static_cast<int64_t>(height) * thumbnailMaxSize / largerSide), 1);
+            }
+        }
+
+        // only the width and height are stored, since the size of the thumbnail follows from them
+        constexpr static uint64_t pixelsOffset = sizeof(ready_flag_t) + sizeof(int32_t) * 2;
+        uint64_t thumbnailOffset() const noexcept {
+            const uint64_t pixelsEnd = pixelsOffset + static_cast<uint64_t>(width) * static_cast<uint64_t>(height);
+            return (pixelsEnd + alignof(uint32_t) - 1) / alignof(uint32_t) * alignof(uint32_t);
+        }
+        uint64_t totalSize() const noexcept {
+            return thumbnailOffset() + sizeof(uint32_t) * static_cast<uint64_t>(thumbnailWidth) * static_cast<uint64_t>(thumbnailHeight);
+        }
+    };
 
     struct Clipboard {
         ext::autoremove_shared_memory memory;
-        uint32_t id;
-        std::string buffer;
+        uint32_t id = 0; // zero if the clipboard is not in shared memory
+        std::vector<uint8_t> localBuffer; // only used if the clipboard couldn't be put in shared memory
+        const uint8_t* data = nullptr; // the clipboard, in the shared memory or in localBuffer
+        uint32_t size = 0;
         std::optional<UniqueTexture> thumbnail;
+        std::thread thumbnailThread; // only in the process that wrote the clipboard
         template <typename OpenMode>
-        Clipboard(const char* clipboardMemoryName, uint32_t size, uint32_t id, OpenMode open_mode = boost::interprocess::open_or_create, boost::interprocess::mode_t mode = boost::interprocess::read_write) : memory(clipboardMemoryName, size, open_mode, mode), id(id) {}
-        Clipboard() noexcept {}
+        Clipboard(const char* clipboardMemoryName, uint32_t size, uint32_t id, OpenMode open_mode = boost::interprocess::open_or_create, boost::interprocess::mode_t mode = boost::interprocess::read_write) : memory(clipboardMemoryName, size, open_mode, mode), id(id),
+            data(static_cast<const uint8_t*>(memory.address())), size(size) {}
+        Clipboard(uint32_t size) : localBuffer(size), data(localBuffer.data()), size(size) {}
+        ~Clipboard() {
+            // the thumbnail thread writes into the memory, so it has to finish before the memory is unmapped
+            if (thumbnailThread.joinable()) thumbnailThread.join();
+        }
+
+        const ready_flag_t& readyFlag() const noexcept {
+            return *reinterpret_cast<const ready_flag_t*>(data);
+        }
+
+        /**
+         * Gets the size of the canvas in the clipboard and its pixel bytes.
+         * Returns false if the clipboard is corrupted.
+         */
+        bool parse(ClipboardHeader& header, const uint8_t*& pixels) const noexcept {
+            if (size < ClipboardHeader::pixelsOffset) return false;
+            int32_t dimensions[2];
+            std::memcpy(dimensions, data + sizeof(ready_flag_t), sizeof dimensions);
+            if (dimensions[0] < 0 || dimensions[1] < 0) return false;
+            header = ClipboardHeader(dimensions[0], dimensions[1]);
+            if (size != header.totalSize()) return false;
+            pixels = data + ClipboardHeader::pixelsOffset;
+            return true;
+        }
+
+        /**
+         * Draws the thumbnail into the clipboard and sets the ready flag.
+         * Each pixel of the thumbnail takes the colour of the first non-empty pixel that falls into it, so that thin wires don't disappear when scaled down.
+         * Only called by the process that wrote the clipboard, on the thumbnail thread.
+         */
+        void drawThumbnail() {
+            ClipboardHeader header;
+            const uint8_t* pixels;
+            if (!parse(header, pixels)) return;
+            uint8_t* writableData = const_cast<uint8_t*>(data);
+            uint32_t* thumbnailPixels = reinterpret_cast<uint32_t*>(writableData + header.thumbnailOffset());
+            // the memory starts out zeroed, i.e. the thumbnail starts out black
+            std::vector<uint32_t> row(static_cast<size_t>(header.width));
+            for (int32_t y = 0; y != header.height; ++y) {
+                CanvasState::fillSurfaceFromPixelBytes(pixels + static_cast<size_t>(y) * header.width, row.size(), row.data());
+                uint32_t* thumbnailRow = thumbnailPixels + static_cast<size_t>(static_cast<int64_t>(y) * header.thumbnailHeight / header.height) * header.thumbnailWidth;
+                for (int32_t x = 0; x != header.width; ++x) {
+                    uint32_t& thumbnailPixel = thumbnailRow[static_cast<int64_t>(x) * header.thumbnailWidth / header.width];
+                    if (thumbnailPixel == 0) thumbnailPixel = row[x];
+                }
+            }
+            // std::memory_order_release so that the thumbnail is visible to whoever sees the flag
+            reinterpret_cast<ready_flag_t*>(writableData)->store(1, std::memory_order_release);
+        }
     };
 
     std::optional<ext::autoremove_shared_memory> indexTableMemory;
+    bool indexTableOpened = false; // whether we tried to open indexTableMemory (it is only opened when a clipboard is first used, to keep it out of startup)
     std::array<std::optional<Clipboard>, NumClipboards> clipboards;
 
     SDL_Renderer* renderer;
@@ -98,13 +194,31 @@ private:
         return std::string(memoryName) + '_' + std::to_string(id);
     }
 
+    /**
+     * Opens (or creates) the table of clipboards in the shared memory, if this wasn't tried before.
+     * Returns whether the table is available.
+     */
+    bool openIndexTable() {
+        if (!indexTableOpened) {
+            indexTableOpened = true;
+            try {
+                indexTableMemory.emplace(memoryName, NumClipboards * sizeof(TableEntry));
+            }
+            catch (std::exception& ex) {
+                // table cannot be created for some reason. Too bad, clipboards won't be shared.
+                std::cout << "Shared clipboard memory failed to initialize: " << ex.what() << std::endl;
+            }
+        }
+        return indexTableMemory.has_value();
+    }
+
     /**
      * Load a clipboard from the shared memory.
      * Returns true if a new clipboard was loaded.
      */
     bool reload(uint32_t index) {
         assert(index >= 0 && index < NumClipboards);
-        if (indexTableMemory) {
+        if (openIndexTable()) {
             TableEntry* table = static_cast<TableEntry*>(indexTableMemory->address());
             auto[id, size] = table[index].load();
             if (!id) {
@@ -116,9 +230,8 @@ private:
                 // replace outdated clipboard
                 try {
                     auto memName = getNameFromId(id);
-                    auto& clipboard = clipboards[index].emplace(memName.c_str(), size, id, boost::interprocess::open_only, boost::interprocess::read_only);
-                    const char* memBuffer = static_cast<const char*>(clipboard.memory.address());
-                    clipboard.buffer = std::string(memBuffer, size);
+                    // the clipboard is used from the mapped memory directly, since it is never modified after being added to the table
+                    clipboards[index].emplace(memName.c_str(), size, id, boost::interprocess::open_only, boost::interprocess::read_only);
                     return true;
                 }
                 catch (std::exception& ex) {
@@ -139,32 +252,29 @@ private:
     }
 
     /**
-     * Generate the thumbnail to be used in the clipboard action interface.
-     * Uses data from `buffer` only.
+     * Create the texture of the thumbnail to be used in the clipboard action interface.
+     * Does nothing if the thumbnail hasn't been drawn yet, so this should be tried again later.
      */
     void generateThumbnail(Clipboard& clipboard) {
         assert(!clipboard.thumbnail);
-        CanvasState state;
-        std::istringstream stream(clipboard.buffer);
-        if (state.loadSave(stream) == CanvasState::ReadResult::OK) {
-            SDL_Surface* surface = SDL_CreateRGBSurface(0, state.width(), state.height(), 32, 0x000000FFu, 0x0000FF00u, 0x00FF0000u, 0);
-            state.fillSurface(reinterpret_cast<uint32_t*>(surface->pixels));
-            SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-            SDL_FreeSurface(surface);
-            clipboard.thumbnail.emplace(texture);
+        ClipboardHeader header;
+        const uint8_t* pixels;
+        if (!clipboard.parse(header, pixels)) {
+            // a corrupted clipboard has no thumbnail, and won't get one later
+            clipboard.thumbnail.emplace(nullptr);
+            return;
         }
+        // std::memory_order_acquire so that we see the thumbnail that was drawn before the flag was set
+        if (!clipboard.readyFlag().load(std::memory_order_acquire)) return;
+        SDL_Surface* surface = SDL_CreateRGBSurface(0, header.thumbnailWidth, header.thumbnailHeight, 32, 0x000000FFu, 0x0000FF00u, 0x00FF0000u, 0);
+        std::memcpy(surface->pixels, clipboard.data + header.thumbnailOffset(), sizeof(uint32_t) * static_cast<size_t>(header.thumbnailWidth) * header.thumbnailHeight);
+        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_FreeSurface(surface);
+        clipboard.thumbnail.emplace(texture);
     }
 
 public:
-    ClipboardStore() {
-        try {
-            indexTableMemory.emplace(memoryName, NumClipboards * sizeof(TableEntry));
-        }
-        catch (std::exception& ex) {
-            // table cannot be created for some reason. Too bad, clipboards won't be shared.
-            std::cout << "Shared clipboard memory failed to initialize: " << ex.what() << std::endl;
-        }
-    }
+    ClipboardStore() = default;
 
     void setRenderer(SDL_Renderer* renderer) {
         this->renderer = renderer;
@@ -177,8 +287,11 @@ public:
         reload(index);
         CanvasState state;
         if (clipboards[index]) {
-            std::istringstream stream(clipboards[index]->buffer);
-            state.loadSave(stream);
+            ClipboardHeader header;
+            const uint8_t* pixels;
+            if (clipboards[index]->parse(header, pixels)) {
+                state.loadPixelBytes(pixels, header.width, header.height);
+            }
         }
         return state;
     }
@@ -187,22 +300,21 @@ public:
      * Write to a clipboard.
      */
     void write(uint32_t index, const CanvasState& state) {
-        std::ostringstream stream;
-        if (state.writeSave(stream) == CanvasState::WriteResult::OK) {
-            std::string buffer = stream.str();
-            if (std::numeric_limits<uint32_t>::max() < buffer.size()) {
-                // cannot write clipboard that is too big (this shouldn't happen in practice... a 4GB file?)
-                return;
-            }
-            auto buffer_size = static_cast<uint32_t>(buffer.size());
-            uint32_t id = 1; // zero is reserved to represent 'no clipboard'.
-            static constexpr uint32_t ID_MAX = 4096;
+        const ClipboardHeader header(state.width(), state.height());
+        const uint64_t size = header.totalSize();
+        if (std::numeric_limits<uint32_t>::max() < size) {
+            // cannot write clipboard that is too big (this shouldn't happen in practice... a 4GB selection?)
+            return;
+        }
+        auto buffer_size = static_cast<uint32_t>(size);
+        uint32_t id = 1; // zero is reserved to represent 'no clipboard'.
+        static constexpr uint32_t ID_MAX = 4096;
+        Clipboard* clipboard = nullptr;
+        if (openIndexTable()) {
             for (; id < ID_MAX; ++id) {
                 try {
                     auto memName = getNameFromId(id);
-                    auto& clipboard = clipboards[index].emplace(memName.c_str(), buffer_size, id, boost::interprocess::create_only);
-                    std::copy(buffer.begin(), buffer.end(), static_cast<char*>(clipboard.memory.address()));
-                    clipboard.buffer = std::move(buffer);
+                    clipboard = &clipboards[index].emplace(memName.c_str(), buffer_size, id, boost::interprocess::create_only);
                     break;
                 }
                 catch (std::exception& ex) {
@@ -212,17 +324,28 @@ public:
                     continue;
                 }
             }
-            if (id == ID_MAX || !indexTableMemory) {
-                // no shared memory, so we just save locally.
-                auto& clipboard = clipboards[index].emplace();
-                clipboard.buffer = std::move(buffer);
-            }
-            else {
-                // add to the table
-                TableEntry* table = static_cast<TableEntry*>(indexTableMemory->address());
-                table[index].store(id, buffer_size);
-            }
         }
+        if (!clipboard) {
+            // no shared memory, so we just save locally.
+            clipboard = &clipboards[index].emplace(buffer_size);
+        }
+
+        // encode the selection straight into the clipboard memory
+        uint8_t* data = const_cast<uint8_t*>(clipboard->data);
+        const int32_t dimensions[2] = { header.width, header.height };
+        std::memcpy(data + sizeof(ready_flag_t), dimensions, sizeof dimensions);
+        state.writePixelBytes(data + ClipboardHeader::pixelsOffset);
+
+        if (clipboard->id) {
+            // add to the table (only after the clipboard is complete, since other processes may read it as soon as it is in the table)
+            TableEntry* table = static_cast<TableEntry*>(indexTableMemory->address());
+            table[index].store(id, buffer_size);
+        }
+
+        // the thumbnail is not needed until the clipboard panel is opened, so it is drawn in the background
+        clipboard->thumbnailThread = std::thread([clipboard]() {
+            clipboard->drawThumbnail();
+        });
     }
 
     /**
@@ -234,8 +357,21 @@ public:
             if (!clipboards[index]->thumbnail) {
                 generateThumbnail(*clipboards[index]);
             }
-            return (*(clipboards[index]->thumbnail)).get(); // could be nullptr (if clipboard file is corrupted), but okay
+            // could be nullptr (if the thumbnail is not drawn yet, or the clipboard is corrupted), but okay
+            return clipboards[index]->thumbnail ? clipboards[index]->thumbnail->get() : nullptr;
         }
         return nullptr;
     }
+
+    /**
+     * Returns the number of bytes of the clipboards held by this process (mapped from the shared memory or in local buffers), including the table of clipboards.
+     * Thumbnail textures are not counted, since they are owned by the renderer.
+     */
+    size_t memoryUsage() const noexcept {
+        size_t bytes = indexTableMemory ? NumClipboards * sizeof(TableEntry) : 0;
+        for (const std::optional<Clipboard>& clipboard : clipboards) {
+            if (clipboard) bytes += clipboard->size;
+        }
+        return bytes;
+    }
 };
@@ -10,9 +10,17 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <istream>
+#include <ostream>
 #include "declarations.hpp"
 
+// number of bytes buffered between the simulation thread and the file thread of each file communicator (can be overridden by the build)
+#ifndef CCSB_FILE_COMMUNICATOR_BUFFER_SIZE
+#define CCSB_FILE_COMMUNICATOR_BUFFER_SIZE (1 << 20)
+#endif
+
 class Communicator {
 public:
     int32_t communicatorIndex;
@@ -26,6 +34,14 @@ public:
      * Must be called from the simulation thread only!
      */
     virtual void transmit(bool) noexcept {}
+    /**
+     * Whether receive() will keep returning the same bit, whatever is transmitted, until the communicator gets new input from another thread.
+     * The simulator stops stepping a circuit that has settled only if all its communicators are idle.
+     * Must be called from the simulation thread only!
+     */
+    virtual bool idle() const noexcept {
+        return false;
+    }
     /**
      * Reset temporary data in the communicator.  This is called by Simulator::compile()
      * Must be synchronized with all other method calls.
@@ -36,4 +52,22 @@ public:
      * Must be synchronized with all other method calls.
      */
     virtual void reset() noexcept {}
+    /**
+     * Writes the state of the communicator to a simulation checkpoint (see Checkpoint::write()).
+     * Must be synchronized with all other method calls.
+     */
+    virtual void writeCheckpoint(std::ostream&) const {}
+    /**
+     * Restores the state written by writeCheckpoint().  Returns false (leaving the communicator unchanged) if the data is malformed.
+     * Must be synchronized with all other method calls.
+     */
+    virtual bool readCheckpoint(std::istream&) {
+        return true;
+    }
+
+    /**
+     * Returns the number of bytes held by this communicator, including its buffers (see MemoryUsage).
+     * Must be called from the UI thread only!  It may be called while the simulation is running, so buffers owned by other threads are only estimated.
+     */
+    virtual size_t memoryUsage() const noexcept = 0;
 };
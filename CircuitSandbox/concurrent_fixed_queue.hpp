@@ -21,6 +21,7 @@
 #include <utility>
 #include <type_traits>
 #include <array>
+#include <algorithm>
 #include <cassert>
 
 namespace ext {
@@ -31,8 +32,15 @@ namespace ext {
     template <typename T, size_t Size>
     class concurrent_fixed_queue {
     private:
+        constexpr static size_t cache_line_size = 64;
+
         std::array<std::aligned_storage_t<sizeof(T), alignof(T)>, Size> buffer;
-        std::atomic<size_t> pushIndex, popIndex;
+        // the producer's index and the consumer's index are on separate cache lines, so that each push and pop doesn't steal the cache line from the other thread
+        // each side also keeps its last read of the other side's index, and only reads it again when that copy shows too little space (or too few elements)
+        alignas(cache_line_size) std::atomic<size_t> pushIndex;
+        mutable size_t cachedPopIndex; // only used by the producer
+        alignas(cache_line_size) std::atomic<size_t> popIndex;
+        mutable size_t cachedPushIndex; // only used by the consumer
 
         inline static size_t space(size_t tmp_pushIndex, size_t tmp_popIndex) noexcept {
             if (tmp_popIndex <= tmp_pushIndex) tmp_popIndex += Size;
@@ -44,10 +52,38 @@ namespace ext {
             return tmp_pushIndex - tmp_popIndex;
         }
 
+        /**
+         * Calling this method must be synchronized with push().
+         * Returns the space, reading popIndex again only if the cached copy shows less than the given amount of space.
+         */
+        inline size_t space_for(size_t tmp_pushIndex, size_t needed) const noexcept {
+            size_t result = space(tmp_pushIndex, cachedPopIndex);
+            if (result < needed) {
+                cachedPopIndex = popIndex.load(std::memory_order_acquire);
+                result = space(tmp_pushIndex, cachedPopIndex);
+            }
+            return result;
+        }
+
+        /**
+         * Calling this method must be synchronized with pop().
+         * Returns the number of elements available, reading pushIndex again only if the cached copy shows less than the given number of elements.
+         */
+        inline size_t available_for(size_t tmp_popIndex, size_t needed) const noexcept {
+            size_t result = available(cachedPushIndex, tmp_popIndex);
+            if (result < needed) {
+                cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+                result = available(cachedPushIndex, tmp_popIndex);
+            }
+            return result;
+        }
+
     public:
         concurrent_fixed_queue() {
             pushIndex.store(0, std::memory_order_relaxed);
             popIndex.store(0, std::memory_order_relaxed);
+            cachedPopIndex = 0;
+            cachedPushIndex = 0;
         }
         ~concurrent_fixed_queue() {}
 
@@ -57,8 +93,8 @@ namespace ext {
          */
         inline size_t space() const noexcept {
             size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
-            size_t tmp_popIndex = popIndex.load(std::memory_order_acquire);
-            return space(tmp_pushIndex, tmp_popIndex);
+            cachedPopIndex = popIndex.load(std::memory_order_acquire);
+            return space(tmp_pushIndex, cachedPopIndex);
         }
 
         /**
@@ -67,8 +103,8 @@ namespace ext {
          */
         inline size_t available() const noexcept {
             size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
-            size_t tmp_pushIndex = pushIndex.load(std::memory_order_acquire);
-            return available(tmp_pushIndex, tmp_popIndex);
+            cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+            return available(cachedPushIndex, tmp_popIndex);
         }
 
         /**
@@ -78,6 +114,7 @@ namespace ext {
         inline void clear() noexcept {
             size_t tmp_pushIndex = pushIndex.load(std::memory_order_acquire);
             size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            cachedPushIndex = tmp_pushIndex;
             while (tmp_popIndex != tmp_pushIndex) {
                 T& obj = reinterpret_cast<T&>(buffer[tmp_popIndex]);
                 obj.~T();
@@ -92,10 +129,10 @@ namespace ext {
          */
         template <typename... Args>
         inline bool try_emplace(Args&&... args) {
-            if (space() == 0) {
+            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
+            if (space_for(tmp_pushIndex, 1) == 0) {
                 return false;
             }
-            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
             new (&buffer[tmp_pushIndex]) T(std::forward<Args>(args)...);
             pushIndex.store((tmp_pushIndex + 1) % Size, std::memory_order_release);
             return true;
@@ -129,10 +166,10 @@ namespace ext {
          * Returns true if there was an element to remove.
          */
         inline bool try_pop(T& out) {
-            if (available() == 0) {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            if (available_for(tmp_popIndex, 1) == 0) {
                 return false;
             }
-            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
             T& obj = reinterpret_cast<T&>(buffer[tmp_popIndex]);
             out = std::move(obj);
             obj.~T();
@@ -187,15 +224,24 @@ namespace ext {
             }
         }
 
+        /**
+         * Gets the contiguous part of the buffer at the front of the queue, so that the consumer can read from it directly (e.g. into a file).
+         * The elements stay in the queue until they are popped with pop(count).
+         */
+        inline std::pair<const T*, size_t> peek_span() const noexcept {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            return { reinterpret_cast<const T*>(&buffer[tmp_popIndex]), std::min(available_for(tmp_popIndex, Size - tmp_popIndex), Size - tmp_popIndex) };
+        }
+
         /**
          * Peeks the element from the front of the queue if exists.
          * Returns true if there was an element to remove.
          */
         inline bool peek(T& out) const {
-            if (available() == 0) {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            if (available_for(tmp_popIndex, 1) == 0) {
                 return false;
             }
-            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
             T& obj = reinterpret_cast<T&>(buffer[tmp_popIndex]);
             out = obj;
             return true;
@@ -223,7 +269,8 @@ namespace ext {
             obj.~T();
             tmp_popIndex = (tmp_popIndex + 1) % Size;
             popIndex.store(tmp_popIndex, std::memory_order_release);
-            return space(pushIndex.load(std::memory_order_acquire), tmp_popIndex) <= 1;
+            cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+            return space(cachedPushIndex, tmp_popIndex) <= 1;
         }
 
         /**
@@ -237,7 +284,8 @@ namespace ext {
             new (&buffer[tmp_pushIndex]) T(std::forward<Args>(args)...);
             tmp_pushIndex = (tmp_pushIndex + 1) % Size;
             pushIndex.store(tmp_pushIndex, std::memory_order_release);
-            return available(tmp_pushIndex, popIndex.load(std::memory_order_acquire)) <= 1;
+            cachedPopIndex = popIndex.load(std::memory_order_acquire);
+            return available(tmp_pushIndex, cachedPopIndex) <= 1;
         }
     };
 }
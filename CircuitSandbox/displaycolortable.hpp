@@ -0,0 +1,95 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <variant>
+#include <type_traits>
+
+#include <SDL.h>
+
+#include "canvasstate.hpp"
+#include "elements.hpp"
+#include "sdl_fast_maprgb.hpp"
+
+/**
+ * The pixel color of every element, in a given pixel format.
+ * The color displayed for an element only depends on its type, the logic level it displays, and whether the default view is shown,
+ * so the colors are mapped once (when the texture is created) and drawing a pixel becomes a table lookup.
+ */
+class DisplayColorTable {
+private:
+    // colors[defaultView][elementIndex][level], where elementIndex is the index in CanvasState::element_variant_t
+    std::array<std::array<std::array<uint32_t, 2>, CanvasState::element_tags_t::size>, 2> colors{};
+
+public:
+    DisplayColorTable() noexcept = default;
+
+    explicit DisplayColorTable(uint32_t pixelFormat) {
+        invoke_RGB_format(pixelFormat, [&](const auto format) {
+            using FormatType = decltype(format);
+            CanvasState::element_tags_t::for_each([&](auto element_tag, auto index_tag) {
+                using ElementType = typename decltype(element_tag)::type;
+                if constexpr (!std::is_same_v<std::monostate, ElementType>) {
+                    for (size_t level = 0; level != 2; ++level) {
+                        ElementType element;
+                        if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                            element.transmitState = level;
+                        }
+                        else if constexpr (std::is_base_of_v<RenderLogicLevelElement, ElementType>) {
+                            element.logicLevel = level;
+                            element.startingLogicLevel = level;
+                        }
+                        colors[false][decltype(index_tag)::value][level] = fast_MapRGB<FormatType::value>(element.template computeDisplayColor<false>());
+                        colors[true][decltype(index_tag)::value][level] = fast_MapRGB<FormatType::value>(element.template computeDisplayColor<true>());
+                    }
+                }
+            });
+        });
+    }
+
+    /**
+     * The color of the element type with the given index in CanvasState::element_variant_t, when it displays the given logic level.
+     */
+    template <bool DefaultView>
+    uint32_t get(size_t elementIndex, bool level) const noexcept {
+        return colors[DefaultView][elementIndex][level];
+    }
+
+    /**
+     * The color of the given element (the same as mapping element.computeDisplayColor<DefaultView>() to the pixel format).
+     */
+    template <bool DefaultView>
+    uint32_t get(const CanvasState::element_variant_t& element) const noexcept {
+        return get<DefaultView>(element.index(), displayedLevel<DefaultView>(element));
+    }
+
+    /**
+     * The logic level that decides the display color of the given element.
+     */
+    template <bool DefaultView>
+    static bool displayedLevel(const CanvasState::element_variant_t& element) noexcept {
+        return std::visit([](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_same_v<std::monostate, ElementType>) {
+                return false;
+            }
+            else if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                return static_cast<bool>(element.transmitState);
+            }
+            else {
+                return static_cast<bool>(element.template getLogicLevel<DefaultView>());
+            }
+        }, element);
+    }
+};
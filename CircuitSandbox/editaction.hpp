@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <vector>
+#include <utility>
 #include <boost/logic/tribool.hpp>
 #include "playareaaction.hpp"
 #include "mainwindow.hpp"
@@ -29,6 +31,38 @@ protected:
     ext::point deltaTrans;
     bool const simulatorRunning;
     bool needsRecompile = true;
+    // rectangles (in canvas coordinates) covering the elements changed by this action, if the action keeps track of them
+    // when they are known and the canvas was not translated, the simulator only recompiles the components that touch these rectangles
+    bool editedRectKnown = false;
+    std::vector<std::pair<ext::point, ext::point>> editedRects;
+    // beyond this many rectangles, they are merged into their bounding rectangle (the incremental compilation looks through all of them for each relay it rebuilds)
+    static constexpr size_t maxEditedRects = 64;
+
+    /**
+     * Records that the elements in [topLeft, bottomRight) may have been changed.
+     */
+    void markEdited(const ext::point& topLeft, const ext::point& bottomRight) {
+        editedRectKnown = true;
+        if (editedRects.size() == maxEditedRects) {
+            const auto [boundsTopLeft, boundsBottomRight] = editedBounds();
+            editedRects.assign(1, { ext::min(boundsTopLeft, topLeft), ext::max(boundsBottomRight, bottomRight) });
+        }
+        else {
+            editedRects.emplace_back(topLeft, bottomRight);
+        }
+    }
+
+    /**
+     * The bounding rectangle of the rectangles recorded by markEdited() (an empty rectangle if there are none).
+     */
+    std::pair<ext::point, ext::point> editedBounds() const noexcept {
+        std::pair<ext::point, ext::point> bounds{ ext::point::max(), ext::point::min() };
+        for (const auto& rect : editedRects) {
+            bounds.first = ext::min(bounds.first, rect.first);
+            bounds.second = ext::max(bounds.second, rect.second);
+        }
+        return bounds;
+    }
 
 public:
 
@@ -36,6 +70,7 @@ public:
         // stop the simulator if running
         if (simulatorRunning) stateManager().stopSimulatorUnchecked();
         changed() = boost::indeterminate;
+        stateManager().editing = true;
     };
 
 
@@ -45,9 +80,12 @@ public:
         if (needsRecompile) {
             // update window title
             mainWindow.setUnsaved(stateManager().historyManager.changedSinceLastSave());
-            // recompile the simulator
-            stateManager().simulator.compile(canvas());
+            // recompile the simulator (in the background, unless only a few components have to be recompiled)
+            if (!(editedRectKnown && deltaTrans == ext::point{ 0, 0 } && stateManager().simulator.compileIncremental(canvas(), editedRects))) {
+                stateManager().simulator.compileInBackground(canvas(), deltaTrans);
+            }
         }
+        stateManager().editing = false;
         // start the simulator if its supposed to be running
         if (simulatorRunning) stateManager().startSimulator();
     }
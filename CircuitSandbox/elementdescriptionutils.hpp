@@ -16,6 +16,7 @@
 #include "elements.hpp"
 #include "fileinputcommunicator.hpp"
 #include "fileoutputcommunicator.hpp"
+#include "streaminputcommunicator.hpp"
 #include "canvasstate.hpp"
 
 using namespace std::literals;
@@ -62,8 +63,14 @@ namespace Description {
     struct FileCommunicatorDescriptionElement : public CommunicatorDescriptionElementBase<FileCommunicatorDescriptionElement<TElement>> {
         std::string filePath;
 
-        FileCommunicatorDescriptionElement(const TElement& el) : CommunicatorDescriptionElementBase<FileCommunicatorDescriptionElement<TElement>>(el) {
-            filePath = el.communicator ? el.communicator->getFile() : ""s;
+        FileCommunicatorDescriptionElement(const TElement& el, const CanvasState& canvas) : CommunicatorDescriptionElementBase<FileCommunicatorDescriptionElement<TElement>>(el) {
+            const auto* communicator = canvas.communicatorOf(el);
+            if constexpr (std::is_same_v<StreamInputCommunicatorElement, TElement>) {
+                filePath = communicator ? communicator->getAddress() : ""s;
+            }
+            else {
+                filePath = communicator ? communicator->getFile() : ""s;
+            }
         }
         FileCommunicatorDescriptionElement(const FileCommunicatorDescriptionElement<TElement>&) = default;
         FileCommunicatorDescriptionElement& operator=(const FileCommunicatorDescriptionElement<TElement>&) = default;
@@ -77,7 +84,8 @@ namespace Description {
         void setDescription(Callback&& callback) const {
             bool displayLogicLevel = this->getLogicLevel();
             if (!filePath.empty()) {
-                std::string str = " ["s + getFileName(filePath.c_str()) + "]";
+                // stream communicators show the whole address instead of a file name
+                std::string str = " ["s + (std::is_same_v<StreamInputCommunicatorElement, TElement> ? filePath : getFileName(filePath.c_str())) + "]";
                 std::forward<Callback>(callback)(
                     TElement::displayName,
                     TElement::displayColor,
@@ -92,7 +100,7 @@ namespace Description {
                     TElement::displayColor,
                     displayLogicLevel ? " [HIGH]" : " [LOW]",
                     displayLogicLevel ? SDL_Color{ 0x66, 0xFF, 0x66, 0xFF } : SDL_Color{ 0x66, 0x66, 0x66, 0xFF },
-                    " [No file]",
+                    std::is_same_v<StreamInputCommunicatorElement, TElement> ? " [Not linked]" : " [No file]",
                     SDL_Color{ 0x66, 0x66, 0x66, 0xFF });
             }
         }
@@ -123,15 +131,28 @@ namespace Description {
     struct ElementType<FileOutputCommunicatorElement> {
         using type = FileCommunicatorDescriptionElement<FileOutputCommunicatorElement>;
     };
+    template <>
+    struct ElementType<StreamInputCommunicatorElement> {
+        using type = FileCommunicatorDescriptionElement<StreamInputCommunicatorElement>;
+    };
 
     template <typename T>
     using ElementType_t = typename ElementType<T>::type;
 
     using ElementVariant_t = CanvasState::element_tags_t::transform<ElementType_t>::instantiate<std::variant>;
 
-    inline ElementVariant_t fromElementVariant(const CanvasState::element_variant_t& elementVariant) {
-        return std::visit([](const auto& element) {
-            return ElementVariant_t(std::in_place_type_t<ElementType_t<std::decay_t<decltype(element)>>>(), element);
+    /**
+     * Converts an element of the given canvas (which holds the communicators) to its description element.
+     */
+    inline ElementVariant_t fromElementVariant(const CanvasState::element_variant_t& elementVariant, const CanvasState& canvas) {
+        return std::visit([&](const auto& element) {
+            using DescriptionElementType = ElementType_t<std::decay_t<decltype(element)>>;
+            if constexpr (std::is_constructible_v<DescriptionElementType, decltype(element), const CanvasState&>) {
+                return ElementVariant_t(std::in_place_type_t<DescriptionElementType>(), element, canvas);
+            }
+            else {
+                return ElementVariant_t(std::in_place_type_t<DescriptionElementType>(), element);
+            }
         }, elementVariant);
     }
 
@@ -12,6 +12,7 @@
 
 #include <SDL.h>
 #include <algorithm>
+#include <cstdint>
 #include <variant>
 #include <memory>
 #include <atomic>
@@ -199,9 +200,12 @@ protected:
 public:
     bool transmitState; // This field is used for rendering only. It is filled in by Simulator::takeSnapshot() (which is called upon compilation and upon UI refresh)
 
-    // shared communicator instance
-    // after action is ended, this should point to a valid communicator instance (filled in by Simulator::compile())
-    std::shared_ptr<TCommunicator> communicator;
+    using communicator_t = TCommunicator;
+
+    // index of the shared communicator instance in the communicator table of the canvas state (see CanvasState::communicators), or -1 if there is none
+    // the communicator is kept out of the element so that elements are trivially copyable
+    // after action is ended, this should refer to a valid communicator instance (filled in by Simulator::compile())
+    int32_t communicatorId = -1;
 
     bool operator==(const T& other) const noexcept {
         return static_cast<const LogicLevelElementBase<T>&>(*this) == other;
@@ -415,3 +419,20 @@ struct FileOutputCommunicatorElement : public CommunicatorElementBase<FileOutput
         }
     }
 };
+
+struct StreamInputCommunicatorElement : public CommunicatorElementBase<StreamInputCommunicatorElement, StreamInputCommunicator> {
+    static constexpr SDL_Color displayColor = MAROON;
+    static constexpr const char* displayName = "Stream Input";
+
+    StreamInputCommunicatorElement(bool logicLevel = false, bool startingLogicLevel = false, bool transmitState = false) noexcept : CommunicatorElementBase<StreamInputCommunicatorElement, StreamInputCommunicator>(logicLevel, startingLogicLevel, transmitState) {}
+
+    template <bool StartingState = false>
+    SDL_Color computeDisplayColor() const noexcept {
+        if (transmitState) {
+            return SDL_Color{ static_cast<Uint8>(0xFF - (0xFF - displayColor.r) * 2 / 3), static_cast<Uint8>(0xFF - (0xFF - displayColor.g) * 2 / 3), static_cast<Uint8>(0xFF - (0xFF - displayColor.b) * 2 / 3), displayColor.a };
+        }
+        else {
+            return SDL_Color{ static_cast<Uint8>(displayColor.r * 2 / 3), static_cast<Uint8>(displayColor.g * 2 / 3), static_cast<Uint8>(displayColor.b * 2 / 3), displayColor.a };
+        }
+    }
+};
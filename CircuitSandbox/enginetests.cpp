@@ -0,0 +1,288 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Regression tests of the simulation engines, run without the window.
+ * Each synthetic circuit of circuitgenerator.hpp (and each save file in the given directories) is cross-validated against the reference engines (see EngineValidator)
+ * with every simulation engine and flood fill engine, on one thread and on several, with the native step (see NativeStepLibrary, which needs a C++ compiler on the machine),
+ * and in multi-instance mode (see Simulator::calculateLanes()) with different inputs in each instance.
+ * The simulator thread is also checked to stop at level breakpoints while it skips settled steps,
+ * and the frames of the simulation server (see SimulationProtocol) are checked to decode back to the pixels they were made from.
+ *
+ * Usage: CircuitSandboxTests [-n steps] [files or directories...]
+ *   -n  number of steps to cross-validate each circuit for (default 300)
+ * Prints each failure, and exits with 0 if every test passed, 1 if any failed, and 2 if the arguments are wrong.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <cstdint>
+
+#include "canvasstate.hpp"
+#include "simulator.hpp"
+#include "enginevalidator.hpp"
+#include "nativestep.hpp"
+#include "elements.hpp"
+#include "fileutils.hpp"
+#include "circuitgenerator.hpp"
+#include "simulationprotocol.hpp"
+
+namespace {
+    struct Options {
+        uint64_t steps = 300;
+        std::vector<std::filesystem::path> files;
+    };
+
+    bool parseOptions(int argc, char* argv[], Options& options) {
+        for (int i = 1; i != argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "-n" && i + 1 != argc) {
+                char* end;
+                unsigned long long value = std::strtoull(argv[++i], &end, 10);
+                if (*end != '\0' || value == 0) return false;
+                options.steps = value;
+            }
+            else if (!arg.empty() && arg.front() == '-') {
+                return false;
+            }
+            else if (std::error_code ec; std::filesystem::is_directory(arg, ec)) {
+                // in name order, like the benchmark
+                std::vector<std::filesystem::path> dirFiles;
+                for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(arg, ec)) {
+                    if (entry.path().extension() == "." CCSB_FILE_EXTENSION) dirFiles.push_back(entry.path());
+                }
+                std::sort(dirFiles.begin(), dirFiles.end());
+                options.files.insert(options.files.end(), dirFiles.begin(), dirFiles.end());
+            }
+            else {
+                options.files.emplace_back(arg);
+            }
+        }
+        return true;
+    }
+
+    // small enough that every engine and thread count runs in a few seconds, but with enough components that the multi-threaded engines split them
+    const std::pair<const char*, CanvasState> generatedCircuits[] = {
+        { "adder", CircuitGenerator::generate(CircuitGenerator::Structure::RIPPLE_ADDER, 8, 16) },
+        { "crossbar", CircuitGenerator::generate(CircuitGenerator::Structure::RELAY_CROSSBAR, 32, 32) },
+        { "mesh", CircuitGenerator::generate(CircuitGenerator::Structure::WIRE_MESH, 64, 64) },
+        { "clocktree", CircuitGenerator::generate(CircuitGenerator::Structure::CLOCK_TREE, 4, 10) },
+        { "ram", CircuitGenerator::generate(CircuitGenerator::Structure::RAM_ARRAY, 64, 16) },
+    };
+
+    constexpr std::pair<Simulator::SimulationEngine, const char*> simulationEngines[] = {
+        { Simulator::SimulationEngine::FULL, "full" },
+        { Simulator::SimulationEngine::EVENT_DRIVEN, "event-driven" },
+    };
+
+    constexpr std::pair<Simulator::FloodFillEngine, const char*> floodFillEngines[] = {
+        { Simulator::FloodFillEngine::DEPTH_FIRST, "depth-first" },
+        { Simulator::FloodFillEngine::PARALLEL, "parallel" },
+        { Simulator::FloodFillEngine::GROUPED, "grouped" },
+    };
+
+    constexpr size_t threadCounts[] = { 1, 4 };
+
+    // returns false if the configured engines diverge from the reference engines on the given circuit (or if the native step cannot be built)
+    bool crossValidate(const std::string& name, const CanvasState& circuit, uint64_t steps, Simulator::SimulationEngine simulationEngine, Simulator::FloodFillEngine floodFillEngine, size_t threads, bool nativeStep) {
+        CanvasState state = circuit;
+        NativeStepLibrary library;
+        Simulator simulator;
+        simulator.setWorkerThreads(threads);
+        simulator.setSimulationEngine(simulationEngine);
+        simulator.setFloodFillEngine(floodFillEngine);
+        simulator.compile(state);
+        if (std::string error; nativeStep && !library.build(simulator, error)) {
+            std::cout << name << ": " << error << std::endl;
+            return false;
+        }
+
+        const EngineValidator::CrossValidation result = EngineValidator(simulator).crossValidate(steps);
+        if (const auto& divergence = result.divergence) {
+            std::cout << name << ": diverged from the reference at step " << divergence->step << " (index " << divergence->index << ")";
+            if (divergence->point) std::cout << ", at (" << divergence->point->x << ", " << divergence->point->y << ")";
+            std::cout << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // returns false if any instance of multi-instance mode diverges from the reference engines on the given circuit
+    bool crossValidateLanes(const std::string& name, const CanvasState& circuit, uint64_t steps) {
+        CanvasState state = circuit;
+        Simulator simulator;
+        simulator.compile(state);
+
+        const EngineValidator::CrossValidation result = EngineValidator(simulator).crossValidateLanes(steps, 0);
+        if (const auto& divergence = result.divergence) {
+            std::cout << name << ": instance " << divergence->lane << " diverged from the reference at step " << divergence->step << " (index " << divergence->index << ")";
+            if (divergence->point) std::cout << ", at (" << divergence->point->x << ", " << divergence->point->y << ")";
+            std::cout << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // returns the number of failed tests
+    size_t testEngines(const Options& options) {
+        std::vector<std::pair<std::string, CanvasState>> circuits;
+        for (const auto& [name, state] : generatedCircuits) {
+            circuits.emplace_back(name, state);
+        }
+        for (const std::filesystem::path& path : options.files) {
+            CanvasState state;
+            std::ifstream saveFile(path, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile) != CanvasState::ReadResult::OK) {
+                std::cout << path.string() << ": cannot be loaded" << std::endl;
+                return 1;
+            }
+            circuits.emplace_back(path.filename().string(), std::move(state));
+        }
+
+        size_t failures = 0;
+        for (const auto& [circuitName, state] : circuits) {
+            for (const auto& [simulationEngine, simulationEngineName] : simulationEngines) {
+                for (const auto& [floodFillEngine, floodFillEngineName] : floodFillEngines) {
+                    for (size_t threads : threadCounts) {
+                        const std::string name = circuitName + ", " + simulationEngineName + " engine, " + floodFillEngineName + " flood fill, " + std::to_string(threads) + " thread(s)";
+                        if (!crossValidate(name, state, options.steps, simulationEngine, floodFillEngine, threads, false)) ++failures;
+                    }
+                }
+            }
+            // the native step does the work of the sources, gates and relays for every engine, so it is only built once for each circuit
+            if (!crossValidate(circuitName + ", native step", state, options.steps, Simulator::SimulationEngine::FULL, Simulator::FloodFillEngine::DEPTH_FIRST, 1, true)) ++failures;
+            // multi-instance mode has a single engine of its own
+            if (!crossValidateLanes(circuitName + ", " + std::to_string(Simulator::laneCount) + " instances", state, options.steps)) ++failures;
+        }
+        return failures;
+    }
+
+    /**
+     * A source feeding a wire settles after one step, so with settled steps skipped the simulator thread goes to sleep while a HIGH breakpoint on the wire is met at every step.
+     * The breakpoint must still count every step and stop the simulation at the step where it has been met count times, both when running and when fast-forwarding.
+     * Returns false if it does not.
+     */
+    bool testSettledBreakpoint(bool fastForward) {
+        constexpr uint64_t count = 1000;
+        CanvasState state;
+        state.extend({ 0, 0 }, { 8, 1 });
+        state[{ 0, 0 }] = Source{};
+        for (int32_t x = 1; x != 6; ++x) {
+            state[{ x, 0 }] = ConductiveWire{};
+        }
+        Simulator simulator;
+        simulator.compile(state);
+        simulator.setPeriod(Simulator::period_t::zero());
+        simulator.setSkipSettledSteps(true);
+        Simulator::Breakpoint breakpoint;
+        breakpoint.point = { 3, 0 };
+        breakpoint.condition = Simulator::Breakpoint::Condition::HIGH;
+        breakpoint.count = count;
+        simulator.setBreakpoints({ breakpoint });
+
+        const uint64_t startStep = simulator.getStepNumber();
+        if (fastForward) {
+            simulator.startFastForward(uint64_t{ 1 } << 20);
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (!simulator.fastForwardFinished() && !simulator.breakpointReached() && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        else {
+            simulator.start();
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+        const bool reached = simulator.breakpointReached();
+        simulator.stop();
+        const uint64_t steps = simulator.getStepNumber() - startStep;
+
+        if (!reached || steps != count) {
+            std::cout << "settled breakpoint (" << (fastForward ? "fast-forward" : "run") << "): " << (reached ? "reached" : "not reached") << " after " << steps << " steps, expected " << count << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Encodes the pixels of a rectangle of a running circuit as the simulation server does, and decodes them again with SimulationProtocol::decodeRuns().
+     * The rectangle is wider than the longest run, so that long runs of the same pixel are split.
+     * Returns false if the decoded pixels differ, or if a truncated frame is not rejected.
+     */
+    bool testProtocolRoundTrip() {
+        CanvasState state = CircuitGenerator::generate(CircuitGenerator::Structure::RIPPLE_ADDER, 8, 16);
+        Simulator simulator;
+        simulator.compile(state);
+        simulator.startFastForward(10);
+        while (!simulator.fastForwardFinished()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        simulator.stop();
+
+        const ext::point topLeft{ 0, 0 };
+        const ext::point bottomRight = state.size();
+        const Simulator::LiveState liveState = simulator.loadLiveState();
+        std::vector<uint8_t> expected;
+        std::string frame;
+        SimulationProtocol::RunEncoder runs(frame);
+        simulator.readLiveView(liveState, state, topLeft, bottomRight, [&](const ext::point&, size_t elementIndex, bool level) {
+            expected.push_back(SimulationProtocol::pixelCode(elementIndex, level));
+            runs.push(expected.back());
+        });
+        runs.finish();
+
+        const size_t numPixels = static_cast<size_t>(bottomRight.x - topLeft.x) * (bottomRight.y - topLeft.y);
+        std::vector<uint8_t> decoded(numPixels);
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(frame.data());
+        const uint8_t* end = in + frame.size();
+        const bool decodedAll = SimulationProtocol::decodeRuns(in, end, numPixels, [&](size_t index, uint8_t code) {
+            decoded[index] = code;
+        });
+        if (!decodedAll || in != end || expected.size() != numPixels || decoded != expected || numPixels <= 256) {
+            std::cout << "protocol round trip: the decoded pixels differ from the encoded ones" << std::endl;
+            return false;
+        }
+
+        const uint8_t* truncatedIn = reinterpret_cast<const uint8_t*>(frame.data());
+        if (SimulationProtocol::decodeRuns(truncatedIn, end - 1, numPixels, [](size_t, uint8_t) {})) {
+            std::cout << "protocol round trip: a truncated frame was accepted" << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [-n steps] [files or directories...]" << std::endl;
+        return 2;
+    }
+
+    size_t failures = testEngines(options);
+    for (bool fastForward : { false, true }) {
+        if (!testSettledBreakpoint(fastForward)) ++failures;
+    }
+    if (!testProtocolRoundTrip()) ++failures;
+
+    if (failures != 0) {
+        std::cout << failures << " test(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <memory>
+#include <optional>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+
+#include "enginevalidator.hpp"
+#include "simulator_kernels.hpp"
+
+EngineValidator::CrossValidation EngineValidator::crossValidate(uint64_t numSteps) {
+    using namespace std::chrono;
+    using DynamicData = Simulator::DynamicData;
+    const Simulator::StaticData& staticData = simulator.staticData;
+    // the levels that the communicators received in the last step are in inputLogLevels while the input log is recording or replaying, so a recording is made for the duration if there is none
+    const bool ownRecording = simulator.inputLogMode == Simulator::InputLogMode::NONE;
+    if (ownRecording) simulator.startRecordingInputs();
+
+    const int32_t numComponents = static_cast<int32_t>(staticData.components.size);
+    const int32_t numRelayPixels = static_cast<int32_t>(staticData.relayPixels.size);
+    const int32_t numCommunicators = static_cast<int32_t>(staticData.communicators.size);
+    DynamicData referenceOldState(numComponents, numRelayPixels, numCommunicators);
+    DynamicData referenceNewState(numComponents, numRelayPixels, numCommunicators);
+
+    CrossValidation result;
+    while (result.steps != numSteps) {
+        // both engines start from the state of the configured engines, so that a divergence is reported at the step that caused it
+        const DynamicData& oldState = *simulator.latestCompleteState;
+        referenceOldState.componentLogicLevels.assign(oldState.componentLogicLevels);
+        referenceOldState.relayPixelLogicLevels.assign(oldState.relayPixelLogicLevels);
+        referenceOldState.relayPixelIsConductive.assign(oldState.relayPixelIsConductive);
+        referenceOldState.communicatorTransmitStates.assign(oldState.communicatorTransmitStates);
+        const std::shared_ptr<DynamicData>& newState = simulator.acquireDynamicData();
+
+        const steady_clock::time_point candidateStart = steady_clock::now();
+        simulator.calculate(staticData, oldState, *newState);
+        const steady_clock::time_point referenceStart = steady_clock::now();
+        referenceNewState.clear();
+        calculateReference(referenceOldState, referenceNewState, simulator.inputLogLevels);
+        const steady_clock::time_point referenceEnd = steady_clock::now();
+        result.candidateTime += referenceStart - candidateStart;
+        result.referenceTime += referenceEnd - referenceStart;
+        ++result.steps;
+
+        simulator.flushStatistics();
+        simulator.flushProbes(*newState);
+        simulator.setLatestCompleteState(newState);
+
+        result.divergence = findDivergence(referenceNewState, *simulator.latestCompleteState, simulator.stepNumber.load(std::memory_order_relaxed));
+        if (result.divergence) break;
+    }
+
+    if (ownRecording) simulator.takeRecordedInputs();
+    return result;
+}
+
+
+EngineValidator::CrossValidation EngineValidator::crossValidateLanes(uint64_t numSteps, uint64_t seed) {
+    using namespace std::chrono;
+    using DynamicData = Simulator::DynamicData;
+    using lane_t = Simulator::lane_t;
+    constexpr size_t laneCount = Simulator::laneCount;
+    const Simulator::StaticData& staticData = simulator.staticData;
+
+    const int32_t numComponents = static_cast<int32_t>(staticData.components.size);
+    const int32_t numRelayPixels = static_cast<int32_t>(staticData.relayPixels.size);
+    const int32_t numCommunicators = static_cast<int32_t>(staticData.communicators.size);
+    Simulator::LaneState oldState = simulator.makeLaneState();
+    Simulator::LaneState newState = simulator.makeLaneState();
+    std::vector<DynamicData> referenceOldStates, referenceNewStates;
+    for (size_t lane = 0; lane != laneCount; ++lane) {
+        referenceOldStates.emplace_back(numComponents, numRelayPixels, numCommunicators);
+        referenceNewStates.emplace_back(numComponents, numRelayPixels, numCommunicators);
+    }
+    DynamicData candidateState(numComponents, numRelayPixels, numCommunicators); // one instance of newState
+    std::vector<lane_t> receivedLevels(numCommunicators);
+    std::vector<bool> laneReceivedLevels(numCommunicators);
+    std::mt19937_64 random(seed);
+
+    CrossValidation result;
+    while (result.steps != numSteps) {
+        for (lane_t& levels : receivedLevels) {
+            levels = random();
+        }
+
+        const steady_clock::time_point candidateStart = steady_clock::now();
+        simulator.calculateLanes(oldState, newState, receivedLevels);
+        const steady_clock::time_point referenceStart = steady_clock::now();
+        for (size_t lane = 0; lane != laneCount; ++lane) {
+            for (int32_t i = 0; i != numCommunicators; ++i) {
+                laneReceivedLevels[i] = (receivedLevels[i] >> lane) & 1;
+            }
+            referenceNewStates[lane].clear();
+            calculateReference(referenceOldStates[lane], referenceNewStates[lane], laneReceivedLevels);
+        }
+        const steady_clock::time_point referenceEnd = steady_clock::now();
+        result.candidateTime += referenceStart - candidateStart;
+        result.referenceTime += referenceEnd - referenceStart;
+        ++result.steps;
+
+        for (size_t lane = 0; lane != laneCount && !result.divergence; ++lane) {
+            const auto extract = [&](const std::vector<lane_t>& words, Simulator::logic_array_t& levels) {
+                for (size_t i = 0; i != words.size(); ++i) {
+                    levels.set_if(i, (words[i] >> lane) & 1);
+                }
+            };
+            candidateState.clear();
+            extract(newState.componentLogicLevels, candidateState.componentLogicLevels);
+            extract(newState.relayPixelLogicLevels, candidateState.relayPixelLogicLevels);
+            extract(newState.relayPixelIsConductive, candidateState.relayPixelIsConductive);
+            extract(newState.communicatorTransmitStates, candidateState.communicatorTransmitStates);
+            result.divergence = findDivergence(referenceNewStates[lane], candidateState, result.steps);
+            if (result.divergence) result.divergence->lane = lane;
+        }
+        if (result.divergence) break;
+        std::swap(oldState, newState);
+        std::swap(referenceOldStates, referenceNewStates);
+    }
+    return result;
+}
+
+
+void EngineValidator::calculateReference(const Simulator::DynamicData& oldState, Simulator::DynamicData& newState, const std::vector<bool>& receivedLevels) {
+    const Simulator::StaticData& staticData = simulator.staticData;
+    for (const Simulator::SimulatorSource& source : staticData.sources) {
+        source(oldState, newState);
+    }
+    // the gates as they are stored, rather than their columns, so that the SIMD kernels are checked too
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                gate(oldState, newState);
+            }
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& relay : y) {
+                relay(oldState, newState);
+            }
+        });
+    });
+    for (int32_t i = 0; i != staticData.communicators.size; ++i) {
+        const Simulator::SimulatorCommunicator& communicator = staticData.communicators.data[i];
+        bool transmitOutput = false;
+        for (int32_t j = communicator.inputComponentsBegin; j != communicator.inputComponentsEnd; ++j) {
+            transmitOutput |= oldState.componentLogicLevels[staticData.communicatorInputList.data[j]];
+        }
+        newState.communicatorTransmitStates.set_if(i, transmitOutput);
+        newState.componentLogicLevels.set_if(communicator.outputComponent, receivedLevels[i]);
+    }
+    simulator.floodFill(newState);
+}
+
+
+std::optional<EngineValidator::Divergence> EngineValidator::findDivergence(const Simulator::DynamicData& referenceState, const Simulator::DynamicData& candidateState, uint64_t step) const {
+    using DynamicData = Simulator::DynamicData;
+    const Simulator::StaticData& staticData = simulator.staticData;
+    std::optional<Divergence> divergence;
+    const auto findFirst = [&](const Simulator::logic_array_t DynamicData::* array, Divergence::Kind kind) {
+        if (divergence) return;
+        size_t first = SIZE_MAX;
+        (referenceState.*array).for_each_difference(candidateState.*array, [&](size_t i) {
+            first = std::min(first, i);
+        });
+        if (first == SIZE_MAX) return;
+        divergence = Divergence{ step, kind, static_cast<int32_t>(first), (referenceState.*array)[first], std::nullopt };
+    };
+    findFirst(&DynamicData::componentLogicLevels, Divergence::Kind::COMPONENT_LEVEL);
+    findFirst(&DynamicData::relayPixelLogicLevels, Divergence::Kind::RELAY_PIXEL_LEVEL);
+    findFirst(&DynamicData::relayPixelIsConductive, Divergence::Kind::RELAY_PIXEL_CONDUCTIVE);
+    findFirst(&DynamicData::communicatorTransmitStates, Divergence::Kind::COMMUNICATOR_TRANSMIT);
+    if (!divergence) return divergence;
+
+    // a communicator is displayed by the pixels of its output component, and a component spawned between two relays has no pixels, so it is shown by the relay pixels next to it
+    using PixelType = Simulator::StaticData::DisplayedPixel::PixelType;
+    const bool isRelayPixel = divergence->kind == Divergence::Kind::RELAY_PIXEL_LEVEL || divergence->kind == Divergence::Kind::RELAY_PIXEL_CONDUCTIVE;
+    const int32_t component = divergence->kind == Divergence::Kind::COMMUNICATOR_TRANSMIT ? staticData.communicators.data[divergence->index].outputComponent : divergence->index;
+    std::vector<int32_t> relayPixels;
+    if (isRelayPixel) {
+        relayPixels.push_back(divergence->index);
+    }
+    else {
+        const Simulator::Component& adjacent = staticData.components.data[component];
+        relayPixels.assign(staticData.adjComponentList.data + adjacent.adjRelayPixelsBegin, staticData.adjComponentList.data + adjacent.adjRelayPixelsEnd);
+    }
+    const auto find = [&](auto matches) -> std::optional<ext::point> {
+        for (int32_t y = 0; y != staticData.pixels.height(); ++y) {
+            for (int32_t x = 0; x != staticData.pixels.width(); ++x) {
+                if (matches(staticData.pixels[{ x, y }])) return ext::point{ x, y };
+            }
+        }
+        return std::nullopt;
+    };
+    if (!isRelayPixel) {
+        divergence->point = find([&](const Simulator::StaticData::DisplayedPixel& pixel) {
+            return (pixel.type == PixelType::COMPONENT || pixel.type == PixelType::COMMUNICATOR) && (pixel.index[0] == component || pixel.index[1] == component);
+        });
+    }
+    if (!divergence->point) {
+        divergence->point = find([&](const Simulator::StaticData::DisplayedPixel& pixel) {
+            return pixel.type == PixelType::RELAY && std::find(relayPixels.begin(), relayPixels.end(), pixel.index[0]) != relayPixels.end();
+        });
+    }
+    return divergence;
+}
@@ -0,0 +1,85 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+#include <cstdint>
+
+#include "simulator.hpp"
+#include "point.hpp"
+
+/**
+ * Checks the engines that a Simulator is configured with (including the native step), and its multi-instance mode, against the reference engines,
+ * which are kept as simple as possible so that they are easy to trust (see CircuitSandboxBenchmark -v and CircuitSandboxTests).
+ */
+class EngineValidator {
+public:
+    // the first difference between the state computed by the configured engines and the state computed by the reference engines (see crossValidate())
+    struct Divergence {
+        enum struct Kind : uint8_t {
+            COMPONENT_LEVEL,
+            RELAY_PIXEL_LEVEL,
+            RELAY_PIXEL_CONDUCTIVE,
+            COMMUNICATOR_TRANSMIT
+        };
+        uint64_t step; // the step number (see Simulator::getStepNumber()) after the step that diverged
+        Kind kind;
+        int32_t index; // the index of the component, relay pixel or communicator that differs (the lowest one, if there are several)
+        bool referenceLevel; // the value in the reference state (the configured engines computed the opposite)
+        std::optional<ext::point> point; // the first pixel (in reading order) that displays it, if any is found
+        size_t lane = 0; // the instance that differs (the lowest one, if there are several), for crossValidateLanes()
+    };
+    // the outcome of crossValidate()
+    struct CrossValidation {
+        uint64_t steps = 0; // the number of steps compared, including the one that diverged
+        Simulator::period_t candidateTime = Simulator::period_t::zero(); // the time spent in the steps of the configured engines
+        Simulator::period_t referenceTime = Simulator::period_t::zero(); // the time spent in the steps of the reference engines
+        std::optional<Divergence> divergence;
+    };
+
+private:
+    Simulator& simulator;
+
+    /**
+     * Calculates a single step with the reference engines (see crossValidate()), where communicator i receives receivedLevels[i] instead of being invoked.
+     */
+    void calculateReference(const Simulator::DynamicData& oldState, Simulator::DynamicData& newState, const std::vector<bool>& receivedLevels);
+
+    /**
+     * Returns the lowest index at which the two states differ (comparing the component levels first, then the relay pixel levels, the relay pixel conductivity and the communicator transmit states),
+     * and the pixel that displays it, or std::nullopt if the states are the same.
+     */
+    std::optional<Divergence> findDivergence(const Simulator::DynamicData& referenceState, const Simulator::DynamicData& candidateState, uint64_t step) const;
+
+public:
+    explicit EngineValidator(Simulator& simulator) noexcept : simulator(simulator) {}
+
+    /**
+     * Runs up to numSteps steps with the configured engines of the simulator (see Simulator::setSimulationEngine(), Simulator::setFloodFillEngine(), Simulator::setWorkerThreads() and Simulator::setNativeStep()), like Simulator::step() does,
+     * and runs each of them again from the same state with the reference engines (every source, gate and relay evaluated in order on this thread without SIMD, then Simulator::floodFill()),
+     * so that a new engine can be checked against the reference one on any circuit.
+     * The two states are compared after every step, and the run stops at the first step where they differ.
+     * Only the configured engines invoke the communicators; the reference receives the same levels as they did (see Simulator::inputLogLevels), so the communicators see an ordinary run.
+     * The state computed by the configured engines is kept, so after a divergence the simulation shows the state of the candidate engines.
+     * @pre the simulator holds a compiled circuit and is stopped.
+     */
+    CrossValidation crossValidate(uint64_t numSteps);
+
+    /**
+     * Runs up to numSteps steps of Simulator::laneCount instances with Simulator::calculateLanes(), starting with everything off,
+     * and runs each instance again with the reference engines, comparing every instance after every step like crossValidate() does.
+     * Every communicator receives a pseudo-random level (from the given seed) in each instance at every step, so that the instances diverge from each other.
+     * The simulation itself is left alone.
+     * @pre the simulator holds a compiled circuit and is stopped.
+     */
+    CrossValidation crossValidateLanes(uint64_t numSteps, uint64_t seed);
+};
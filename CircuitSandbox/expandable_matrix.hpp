@@ -50,8 +50,7 @@ namespace ext {
             ext::point translation = -min_pt;
             ext::point new_size = max_pt + translation;
 
-            matrix_t new_matrix(new_size);
-            new_matrix.fill(false);
+            matrix_t new_matrix(new_size, false);
             ext::move_range(dataMatrix, new_matrix, 0, 0, translation.x, translation.y, dataMatrix.width(), dataMatrix.height());
 
             dataMatrix = std::move(new_matrix);
@@ -0,0 +1,65 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <fstream>
+
+#include <SDL.h>
+#include <nfd.hpp>
+
+#include "action.hpp"
+#include "mainwindow.hpp"
+#include "fileutils.hpp"
+#include "notificationdisplay.hpp"
+
+/**
+ * Action that saves the current state of the simulation to a checkpoint file, or resumes the simulation from one.
+ * A checkpoint can only be restored into the circuit it was saved from.
+ */
+class FileCheckpointAction final : public Action {
+public:
+    FileCheckpointAction(MainWindow& mainWindow, bool restore) {
+        nfdfilteritem_t fileFilter{ CCSB_CHECKPOINT_FILE_FRIENDLY_NAME, CCSB_CHECKPOINT_FILE_EXTENSION };
+        NFD::UniquePath outPath;
+        nfdresult_t result = restore ? NFD::OpenDialog(outPath, &fileFilter, 1) : NFD::SaveDialog(outPath, &fileFilter, 1, nullptr, "Checkpoint1." CCSB_CHECKPOINT_FILE_EXTENSION);
+        mainWindow.suppressMouseUntilNextDown();
+        if (result != NFD_OKAY) return;
+
+        if (restore) {
+            std::ifstream checkpointFile(outPath.get(), std::ios::binary);
+            if (!checkpointFile.is_open()) {
+                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error restoring checkpoint: This file cannot be accessed.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            }
+            else if (!mainWindow.stateManager.readCheckpoint(checkpointFile)) {
+                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error restoring checkpoint: This checkpoint is of a different circuit, or is corrupted.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            }
+            else {
+                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Simulation restored ", NotificationDisplay::TEXT_COLOR_ACTION }, { "from checkpoint", NotificationDisplay::TEXT_COLOR } });
+            }
+        }
+        else {
+            std::ofstream checkpointFile(outPath.get(), std::ios::binary);
+            if (!checkpointFile.is_open() || !mainWindow.stateManager.writeCheckpoint(checkpointFile) || !checkpointFile.flush()) {
+                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving checkpoint: This file cannot be written to, or the simulation is still compiling.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            }
+            else {
+                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Checkpoint saved", NotificationDisplay::TEXT_COLOR_ACTION } });
+            }
+        }
+    }
+
+    static inline void start(MainWindow& mainWindow, const SDL_Keymod& modifiers, const ActionStarter& starter) {
+        if (mainWindow.stateManager.rejectIfViewOnly(mainWindow)) return;
+        // Shift restores the checkpoint instead of saving it
+        starter.start<FileCheckpointAction>(mainWindow, (modifiers & KMOD_SHIFT) != 0);
+        starter.reset();
+    }
+};
@@ -20,6 +20,7 @@
 #include "elements.hpp"
 #include "fileinputcommunicator.hpp"
 #include "fileoutputcommunicator.hpp"
+#include "streamcommunicatorselectaction.hpp"
 
 class FileCommunicatorSelectAction final : public PlayAreaAction {
 public:
@@ -69,7 +70,12 @@ public:
                         using ElementType = std::decay_t<decltype(element)>;
                         if constexpr(std::is_same_v<FileInputCommunicatorElement, ElementType> || std::is_same_v<FileOutputCommunicatorElement, ElementType>) {
                             // Only start the file input action if the mouse was pressed down over a File Input Communicator.
-                            starter.start<FileCommunicatorSelectAction>(mainWindow, *element.communicator);
+                            starter.start<FileCommunicatorSelectAction>(mainWindow, *mainWindow.stateManager.defaultState.communicatorOf(element));
+                            return ActionEventResult::PROCESSED;
+                        }
+                        else if constexpr(std::is_same_v<StreamInputCommunicatorElement, ElementType>) {
+                            // Stream Input Communicators ask for an address instead of a file.
+                            starter.start<StreamCommunicatorSelectAction>(mainWindow, mainWindow.renderer, *mainWindow.stateManager.defaultState.communicatorOf(element));
                             return ActionEventResult::PROCESSED;
                         }
                         else {
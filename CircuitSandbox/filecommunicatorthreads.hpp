@@ -0,0 +1,217 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+#include <cstddef>
+
+#include "tracing.hpp"
+
+/**
+ * A small pool of threads that does the file reading and writing of all the file communicators, so that a circuit with many file communicators doesn't need a thread for each of them.
+ * Each communicator is a client that is added while it has a file open; the pool calls its service() whenever it is notified, or when the last call asked to be called again (now or after a delay).
+ * A client is only serviced by one thread at a time, so there are a few threads in case some clients block (e.g. reading from a pipe whose writer is slow).
+ */
+class FileCommunicatorThreads {
+public:
+    class Client {
+    private:
+        friend class FileCommunicatorThreads;
+        // guarded by the mutex of the pool
+        bool pending = false; // whether service() should be called
+        bool busy = false; // whether a thread is calling service() now
+        std::chrono::steady_clock::time_point wakeTime = std::chrono::steady_clock::time_point::max(); // when service() should be called even if not notified
+
+    public:
+        enum class ServiceResult {
+            AGAIN, // there might be more to do, so call service() again
+            IDLE, // call service() again once notified
+            DELAYED, // call service() again once notified, or after serviceDelay at the latest
+            FINISHED // don't call service() again
+        };
+
+        /**
+         * Does a bounded amount of reading or writing.
+         * Called from one of the threads of the pool only!
+         */
+        virtual ServiceResult service() noexcept = 0;
+
+    protected:
+        // set by service() before it returns DELAYED
+        std::chrono::steady_clock::duration serviceDelay = std::chrono::steady_clock::duration::zero();
+
+        ~Client() {}
+    };
+
+private:
+    constexpr static size_t ThreadCount = 4;
+
+    std::mutex mutex;
+    std::condition_variable workCV; // signalled when a client becomes pending, or when stopping
+    std::condition_variable idleCV; // signalled when a client stops being busy
+    std::vector<Client*> clients;
+    size_t nextIndex = 0; // where to start looking for pending clients, so that clients take turns
+    bool stopping = false;
+    std::array<std::thread, ThreadCount> threads;
+
+    FileCommunicatorThreads() {
+        for (std::thread& thread : threads) {
+            thread = std::thread([this]() {
+                run();
+            });
+        }
+    }
+
+    ~FileCommunicatorThreads() {
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        workCV.notify_all();
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    /**
+     * Returns a pending client (or one whose delay has passed) that is not busy, or nullptr if there is none.
+     */
+    Client* takePendingClient() noexcept {
+        std::optional<std::chrono::steady_clock::time_point> now; // only read if some client is waiting for its delay, since this is called with the mutex held
+        for (size_t i = 0; i != clients.size(); ++i) {
+            size_t index = (nextIndex + i) % clients.size();
+            Client* client = clients[index];
+            if (client->busy) continue;
+            if (!client->pending && client->wakeTime != std::chrono::steady_clock::time_point::max()) {
+                if (!now) now = std::chrono::steady_clock::now();
+                if (client->wakeTime <= *now) client->pending = true;
+            }
+            if (client->pending) {
+                nextIndex = index + 1;
+                client->pending = false;
+                client->wakeTime = std::chrono::steady_clock::time_point::max();
+                client->busy = true;
+                return client;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Returns the earliest time that a client asked to be called again, or time_point::max() if there is none.
+     */
+    std::chrono::steady_clock::time_point nextWakeTime() const noexcept {
+        auto ret = std::chrono::steady_clock::time_point::max();
+        for (const Client* client : clients) {
+            ret = std::min(ret, client->wakeTime);
+        }
+        return ret;
+    }
+
+    /**
+     * This is the thread function of the pool.
+     */
+    void run() {
+        CIRCUIT_SANDBOX_TRACE_THREAD("file communicator");
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            Client* client = nullptr;
+            while (!stopping && (client = takePendingClient()) == nullptr) {
+                const auto wakeTime = nextWakeTime();
+                if (wakeTime == std::chrono::steady_clock::time_point::max()) {
+                    workCV.wait(lock);
+                }
+                else {
+                    workCV.wait_until(lock, wakeTime);
+                }
+            }
+            if (stopping) break;
+
+            lock.unlock();
+            Client::ServiceResult result;
+            {
+                CIRCUIT_SANDBOX_TRACE_SCOPE("FileCommunicatorThreads::service");
+                result = client->service();
+            }
+            lock.lock();
+
+            client->busy = false;
+            if (result == Client::ServiceResult::AGAIN) {
+                client->pending = true;
+            }
+            else if (result == Client::ServiceResult::DELAYED) {
+                client->wakeTime = std::chrono::steady_clock::now() + client->serviceDelay; // this thread will wait for it, if no other thread does
+            }
+            else if (result == Client::ServiceResult::FINISHED) {
+                clients.erase(std::find(clients.begin(), clients.end(), client));
+            }
+            idleCV.notify_all();
+        }
+    }
+
+public:
+    FileCommunicatorThreads(const FileCommunicatorThreads&) = delete;
+    FileCommunicatorThreads& operator=(const FileCommunicatorThreads&) = delete;
+
+    /**
+     * Returns the pool, starting its threads on the first call.
+     */
+    static FileCommunicatorThreads& get() {
+        static FileCommunicatorThreads pool;
+        return pool;
+    }
+
+    /**
+     * Starts calling service() of the given client.
+     * The client must not be in the pool already.
+     */
+    void add(Client& client) {
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            client.pending = true;
+            client.busy = false;
+            client.wakeTime = std::chrono::steady_clock::time_point::max();
+            clients.push_back(&client);
+        }
+        workCV.notify_one();
+    }
+
+    /**
+     * Stops calling service() of the given client, waiting for any call in progress to return.
+     * Does nothing if the client is not in the pool (e.g. if it has finished).
+     */
+    void remove(Client& client) noexcept {
+        std::unique_lock<std::mutex> lock(mutex);
+        idleCV.wait(lock, [&]() {
+            return !client.busy;
+        });
+        auto it = std::find(clients.begin(), clients.end(), &client);
+        if (it != clients.end()) clients.erase(it);
+    }
+
+    /**
+     * Makes the pool call service() of the given client (again), e.g. because the queue it is waiting on changed.
+     */
+    void notify(Client& client) {
+        {
+            std::scoped_lock<std::mutex> lock(mutex);
+            client.pending = true;
+        }
+        workCV.notify_one();
+    }
+};
@@ -13,37 +13,40 @@
 #include <atomic>
 #include <fstream>
 #include <string>
-#include <thread>
-#include <mutex>
+#include <limits>
+#include <vector>
 #include <queue>
+#include <algorithm>
 #include <cstdint>
 #include <cstddef>
-#include <condition_variable>
+#include <memory>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include "declarations.hpp"
 #include "communicator.hpp"
+#include "filecommunicatorthreads.hpp"
 #include "flushable_fixed_queue.hpp"
 #include "unrolled_linked_list_queue.hpp"
+#include "binary_io.hpp"
 
-class FileInputCommunicator final : public Communicator {
+class FileInputCommunicator final : public Communicator, private FileCommunicatorThreads::Client {
     /**
      * There are three threads that interacts with this class:
      * 1. The UI thread
      * 2. The simulation thread
-     * 3. The file reading thread
+     * 3. The file reading thread (one of the FileCommunicatorThreads, which calls service())
      * Most of the methods of this class should only be called by one of those threads.
-     * The file reading thread is owned by this class.
+     * Files that can be seeked (i.e. ordinary files) are instead mapped into memory and read directly by the simulation thread, so the file reading thread is only used for other inputs (e.g. pipes).
      */
 private:
-    std::thread fileThread;
-    std::atomic<bool> stoppingFlag;
-    std::mutex sigMutex;
-    std::condition_variable sigCV;
+    bool fileLoaded = false; // whether we were added to the FileCommunicatorThreads (used by UI thread only)
     std::filebuf inputBuf;
     std::string inputFilePath;
 
     // used by simulator thread only
     ext::unrolled_linked_list_queue<uint8_t, 65536> transmittedCommands;
     bool suppressEnded = true; // whether the we need to read a byte first (prevents zero-length files)
+    uint64_t bytesReceived = 0; // number of bytes of the file that were sent to the circuit (i.e. the offset in the file of the next byte it will receive)
 
     // used by simulator threaed only
     uint8_t currentTransmitChunk; // bitmask
@@ -51,46 +54,174 @@ private:
     uint16_t currentReceiveChunk; // bitmask
     uint8_t currentReceiveCount;
 
+    // bytes taken from fileInputQueue a word at a time, that were not sent to the circuit yet (used by simulator thread only)
+    uint64_t receiveWord = 0; // the next byte is in the lowest bits
+    uint8_t receiveWordCount = 0;
+    uint32_t receiveWordFlushCount = 0; // value of flushCount after the bytes were taken
+
+    // the memory-mapped file being read, if any (used by simulator thread only); the next byte is at bytesReceived
+    std::shared_ptr<const boost::interprocess::mapped_region> mappedFile;
+    uint32_t mappedFileFlushCount = 0; // value of flushCount when mappedFile was taken from newMappedFile
+
+    // shared between simulator and UI threads
+    std::atomic<uint32_t> flushCount = 0; // incremented whenever the UI thread changes the file, so that the simulator thread drops receiveWord and takes newMappedFile
+    std::shared_ptr<const boost::interprocess::mapped_region> newMappedFile; // only accessed with std::atomic_load/std::atomic_store
+
     // shared between simulator and file threads
-    constexpr static size_t BufSize = 65536;
+    constexpr static size_t BufSize = CCSB_FILE_COMMUNICATOR_BUFFER_SIZE;
     ext::flushable_fixed_queue<std::byte, BufSize> fileInputQueue;
 
     /**
      * Wakes up the file reading thread if it is sleeping.
      */
     void notifyFileThread() {
-        {
-            std::scoped_lock<std::mutex> lck(sigMutex);
+        FileCommunicatorThreads::get().notify(*this);
+    }
+
+    /**
+     * Flushes the bytes that are still in the buffer.
+     * Must be called from the UI thread only!
+     */
+    void flushQueue() noexcept {
+        fileInputQueue.flush();
+        flushCount.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Drops the bytes in receiveWord if the UI thread flushed the queue since they were taken from it,
+     * and takes the file mapped by the UI thread if it changed the file.
+     * Returns true if the file was changed.
+     * Must be called from the simulation thread only!
+     */
+    bool takeFileChanges() noexcept {
+        uint32_t tmp_flushCount = flushCount.load(std::memory_order_acquire);
+        if (receiveWordCount != 0 && tmp_flushCount != receiveWordFlushCount) {
+            receiveWordCount = 0;
         }
-        sigCV.notify_one();
+        if (tmp_flushCount == mappedFileFlushCount) return false;
+        mappedFileFlushCount = tmp_flushCount;
+        mappedFile = std::atomic_load(&newMappedFile);
+        if (mappedFile) bytesReceived = 0;
+        return true;
     }
 
     /**
-     * Joins the file reading thread if it is joinable.
+     * Makes sure that receiveWord has a byte, taking as many bytes as will fit in it from the queue if it is empty.
+     * Returns false if there are no bytes available.
+     * Must be called from the simulation thread only!
+     */
+    bool fillReceiveWord() noexcept {
+        if (receiveWordCount != 0) return true;
+        std::byte bytes[sizeof receiveWord];
+        bool producerNeedsSignal;
+        size_t byteCount = fileInputQueue.pop_before_end(bytes, sizeof receiveWord, producerNeedsSignal);
+        receiveWord = 0;
+        for (size_t i = 0; i != byteCount; ++i) {
+            receiveWord |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        receiveWordCount = static_cast<uint8_t>(byteCount);
+        // loaded after popping, so that bytes from a new file are never tagged with an older count (those from the old file may be, like bytes popped just before the flush)
+        receiveWordFlushCount = flushCount.load(std::memory_order_acquire);
+        if (producerNeedsSignal) {
+            notifyFileThread();
+        }
+        return byteCount != 0;
+    }
+
+    /**
+     * Checks if the next byte of the file is available, without taking it.
+     * Must be called from the simulation thread only!
+     */
+    bool byteAvailable() noexcept {
+        if (mappedFile) return bytesReceived < mappedFile->get_size();
+        return receiveWordCount != 0 || (!fileInputQueue.ended() && fillReceiveWord());
+    }
+
+    /**
+     * Checks if we have reached the end of the file.
+     * Must be called from the simulation thread only!
+     */
+    bool fileEnded() const noexcept {
+        if (mappedFile) return bytesReceived >= mappedFile->get_size();
+        return receiveWordCount == 0 && fileInputQueue.ended();
+    }
+
+    /**
+     * Takes the next byte of the file, if it is available.
+     * Must be called from the simulation thread only!
+     */
+    bool takeByte(uint8_t& out) noexcept {
+        if (mappedFile) {
+            if (bytesReceived >= mappedFile->get_size()) return false;
+            out = static_cast<const uint8_t*>(mappedFile->get_address())[bytesReceived];
+            return true;
+        }
+        if (!fillReceiveWord()) return false;
+        out = static_cast<uint8_t>(receiveWord);
+        receiveWord >>= 8;
+        --receiveWordCount;
+        return true;
+    }
+
+    /**
+     * Stops the file reading thread from reading the file, and closes it.
      */
     void unloadFile() noexcept {
-        if (fileThread.joinable()) {
-            {
-                std::scoped_lock<std::mutex> lock(sigMutex);
-                stoppingFlag.store(true, std::memory_order_relaxed);
+        if (fileLoaded) {
+            FileCommunicatorThreads::get().remove(*this);
+            if (inputBuf.is_open()) {
+                fileInputQueue.end();
+                inputBuf.close();
             }
-            sigCV.notify_one();
-            fileThread.join();
+            fileLoaded = false;
         }
     }
 
     // must call unloadFile() before calling this!
-    // returns true is load succeeded, false otherwise.
-    bool loadFile() {
-        if (!inputFilePath.empty() && inputBuf.open(inputFilePath, std::ios_base::in | std::ios_base::binary) != nullptr) {
-            // launch a new file thread
-            stoppingFlag.store(false, std::memory_order_relaxed);
-            fileThread = std::thread([this]() {
-                run();
-            });
-            return true;
+    // seekable files are mapped into memory and stored in newMappedFile (for the simulator thread to take), other files are opened for startReading()
+    // the file is read from the given offset (or from its end, if it is shorter than that)
+    // returns true is open succeeded, false otherwise.
+    bool openFile(uint64_t offset) {
+        std::shared_ptr<const boost::interprocess::mapped_region> mapping;
+        bool opened = !inputFilePath.empty() && inputBuf.open(inputFilePath, std::ios_base::in | std::ios_base::binary) != nullptr;
+        if (opened) {
+            // empty files can't be mapped, but the file reading thread will end immediately anyway
+            std::streampos fileSize = inputBuf.pubseekoff(0, std::ios_base::end, std::ios_base::in);
+            if (fileSize != std::streampos(std::streamoff(-1)) && fileSize > 0) {
+                inputBuf.close();
+                try {
+                    mapping = std::make_shared<const boost::interprocess::mapped_region>(boost::interprocess::file_mapping(inputFilePath.c_str(), boost::interprocess::read_only), boost::interprocess::read_only);
+                }
+                catch (const boost::interprocess::interprocess_exception&) {
+                    // can't be mapped after all, so use the file reading thread
+                    opened = inputBuf.open(inputFilePath, std::ios_base::in | std::ios_base::binary) != nullptr;
+                }
+            }
+            if (inputBuf.is_open() && inputBuf.pubseekpos(static_cast<std::streamoff>(offset), std::ios_base::in) == std::streampos(std::streamoff(-1))) {
+                inputBuf.pubseekoff(0, std::ios_base::end, std::ios_base::in);
+            }
         }
-        return false;
+        std::atomic_store(&newMappedFile, std::move(mapping));
+        return opened;
+    }
+
+    // makes the file reading thread start reading the file, if openFile() opened it for that
+    void startReading() {
+        if (inputBuf.is_open()) {
+            FileCommunicatorThreads::get().add(*this);
+            fileLoaded = true;
+        }
+    }
+
+    // must call unloadFile() before calling this, and must be synchronized with the simulator thread!
+    // the file is read from the given offset (or from its end, if it is shorter than that)
+    // returns true is load succeeded, false otherwise.
+    bool loadFile(uint64_t offset = 0) {
+        bool opened = openFile(offset);
+        mappedFile = std::atomic_load(&newMappedFile);
+        mappedFileFlushCount = flushCount.load(std::memory_order_relaxed);
+        startReading();
+        return opened;
     }
 
 public:
@@ -108,33 +239,31 @@ public:
         if (currentReceiveCount == 0) {
             if (!transmittedCommands.empty()) {
                 uint8_t command = transmittedCommands.front();
-                std::byte out;
+                bool fileChanged = takeFileChanges();
+                uint8_t out;
                 switch (command) {
                 case 0b001:
                     // byte request
-                    if (!suppressEnded) {
+                    if (!suppressEnded && !mappedFile) {
                         fileInputQueue.discard();
                     }
-                    if (fileInputQueue.peek(out)) {
-                        bool producerNeedsSignal = fileInputQueue.pop_testproducerneedssignal();
+                    if (takeByte(out)) {
                         currentReceiveChunk = (static_cast<uint16_t>(out) << 3) | 0b001;
                         currentReceiveCount = 11;
                         transmittedCommands.pop();
                         suppressEnded = false;
-                        if (producerNeedsSignal) {
-                            notifyFileThread();
-                        }
+                        ++bytesReceived;
                     }
                     break;
                 case 0b101:
                     // byte available in file?
-                    if (!suppressEnded && (fileInputQueue.discard() || fileInputQueue.ended())) {
+                    if (!suppressEnded && (fileChanged || (!mappedFile && fileInputQueue.discard()) || fileEnded())) {
                         currentReceiveChunk = 0b0101;
                         currentReceiveCount = 4;
                         transmittedCommands.pop();
                         suppressEnded = true;
                     }
-                    else if (suppressEnded || (!fileInputQueue.ended() && fileInputQueue.peek(out))) {
+                    else if (suppressEnded || byteAvailable()) {
                         currentReceiveChunk = 0b1101;
                         currentReceiveCount = 4;
                         transmittedCommands.pop();
@@ -179,11 +308,13 @@ public:
     void setFile(const char* filePath) {
         inputFilePath = filePath;
         unloadFile();
+        openFile(0);
 
-        // flush any bytes that are still in the buffer
-        fileInputQueue.flush();
+        // flush any bytes that are still in the buffer (this also gives the simulator thread the new mapped file, if any)
+        flushQueue();
+        bytesReceived = 0;
 
-        loadFile();
+        startReading();
     }
 
     /**
@@ -202,14 +333,33 @@ public:
     void clearFile() {
         inputFilePath.clear();
         unloadFile();
+        std::atomic_store(&newMappedFile, std::shared_ptr<const boost::interprocess::mapped_region>());
 
         // flush any bytes that are still in the buffer
-        fileInputQueue.flush();
+        flushQueue();
+        bytesReceived = 0;
+    }
+
+    /**
+     * Whether the circuit has been sent every byte of the file (always true if there is no file).
+     * Returns false until the circuit sends its first command after the file was set.
+     * Must be synchronized with the simulation thread (i.e. the simulator is stopped)!
+     */
+    bool inputEnded() const noexcept {
+        if (inputFilePath.empty()) return true;
+        if (flushCount.load(std::memory_order_acquire) != mappedFileFlushCount) return false;
+        if (mappedFile) return bytesReceived >= mappedFile->get_size();
+        return fileEnded();
     }
 
     /**
      * Load the file given by a previous setFilePath() call.
      */
+    // the queue to the file thread is part of the object; the mapped file is not counted, since its pages belong to the OS's file cache
+    size_t memoryUsage() const noexcept override {
+        return sizeof(FileInputCommunicator) + transmittedCommands.bytes();
+    }
+
     void reset() noexcept override {
         // stop the current thread if any
         unloadFile();
@@ -220,44 +370,90 @@ public:
         currentTransmitChunk = 0;
         currentReceiveCount = 0;
         currentReceiveChunk = 0;
+        receiveWordCount = 0;
         fileInputQueue.clear();
+        bytesReceived = 0;
 
         // open the new file
         loadFile();
     }
 
+    /**
+     * Writes the file and the offset in it of the next byte that the circuit will receive, and the commands and bits that are in flight.
+     * The bytes that were read ahead from the file are not written, they are read again when the checkpoint is restored.
+     */
+    void writeCheckpoint(std::ostream& out) const override {
+        ext::write_binary_string(out, inputFilePath);
+        ext::write_binary(out, bytesReceived);
+        ext::write_binary(out, suppressEnded);
+        ext::write_binary(out, currentTransmitChunk);
+        ext::write_binary(out, currentTransmitCount);
+        ext::write_binary(out, currentReceiveChunk);
+        ext::write_binary(out, currentReceiveCount);
+        std::vector<uint8_t> commands;
+        transmittedCommands.for_each([&](uint8_t command) {
+            commands.push_back(command);
+        });
+        ext::write_binary_array(out, commands.data(), commands.size());
+    }
+
+    /**
+     * Reopens the file at the offset given by the checkpoint.
+     */
+    bool readCheckpoint(std::istream& in) override {
+        std::string filePath;
+        uint64_t offset;
+        bool newSuppressEnded;
+        uint8_t transmitChunk, transmitCount, receiveCount;
+        uint16_t receiveChunk;
+        std::vector<uint8_t> commands;
+        if (!ext::read_binary_string(in, filePath, std::numeric_limits<uint16_t>::max()) || !ext::read_binary(in, offset) || !ext::read_binary(in, newSuppressEnded)) return false;
+        if (!ext::read_binary(in, transmitChunk) || !ext::read_binary(in, transmitCount) || !ext::read_binary(in, receiveChunk) || !ext::read_binary(in, receiveCount)) return false;
+        // the bits in flight are at most one command (3 bits) and one response (11 bits)
+        if (transmitCount >= 3 || receiveCount > 11) return false;
+        if (!ext::read_binary_array(in, commands, std::numeric_limits<uint32_t>::max())) return false;
+
+        unloadFile();
+        inputFilePath = std::move(filePath);
+        while (!transmittedCommands.empty()) transmittedCommands.pop();
+        for (uint8_t command : commands) transmittedCommands.push(command);
+        suppressEnded = newSuppressEnded;
+        currentTransmitChunk = transmitChunk;
+        currentTransmitCount = transmitCount;
+        currentReceiveChunk = receiveChunk;
+        currentReceiveCount = receiveCount;
+        receiveWordCount = 0;
+        fileInputQueue.clear();
+        bytesReceived = offset;
+
+        loadFile(offset);
+        return true;
+    }
+
 private:
 
     /**
-     * This is the file reading thread function.
+     * Reads as many bytes as there is space for (or as many as are available now, if the file is a pipe), straight into the queue.
      * Must be called from the file reading thread only!
      */
-    void run() {
-        bool fileEnded = false;
-        while (!stoppingFlag.load(std::memory_order_acquire) && !fileEnded) {
-            size_t space;
-            while (!stoppingFlag.load(std::memory_order_acquire) && (space = fileInputQueue.space()) > 0) {
-                // try to read as many bytes as possible from the file
-                std::byte bytes[BufSize];
-                auto byteCount = inputBuf.sgetn(reinterpret_cast<char*>(bytes), space);
-                assert(byteCount >= 0);
-                fileInputQueue.push(bytes, bytes + byteCount);
-                if (byteCount < static_cast<std::streamsize>(space)) {
-                    fileEnded = true;
-                    break;
-                }
-            }
-            if (!stoppingFlag.load(std::memory_order_acquire) && !fileEnded) {
-                // if we get here, it means the file hasn't ended but the buffer is full. so we sleep until notified.
-                std::unique_lock<std::mutex> lck(sigMutex);
-                sigCV.wait(lck, [this]() {
-                    return stoppingFlag.load(std::memory_order_relaxed) || fileInputQueue.space() > 0;
-                });
-            }
+    ServiceResult service() noexcept override {
+        if (fileInputQueue.space() == 0) {
+            // the buffer is full, so we wait until the simulator thread notifies us
+            return ServiceResult::IDLE;
         }
-        fileInputQueue.end();
+        auto [bytes, space] = fileInputQueue.push_span();
+        // read at least one byte, so that we either block until some data is available or find out that the file has ended
+        std::streamsize requested = std::min(static_cast<std::streamsize>(space), std::max(inputBuf.in_avail(), std::streamsize(1)));
+        auto byteCount = inputBuf.sgetn(reinterpret_cast<char*>(bytes), requested);
+        assert(byteCount >= 0);
+        fileInputQueue.push(static_cast<size_t>(byteCount));
+        if (byteCount < requested) {
+            fileInputQueue.end();
 
-        // close the file ASAP, even though unloadFile() might not have been called yet.
-        inputBuf.close();
+            // close the file ASAP, even though unloadFile() might not have been called yet.
+            inputBuf.close();
+            return ServiceResult::FINISHED;
+        }
+        return ServiceResult::AGAIN;
     }
 };
@@ -12,9 +12,15 @@
 
 #include <utility>
 #include <fstream>
+#include <string>
 #include <algorithm>
 #include <limits>
 #include <type_traits>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <sstream>
+#include <iterator>
 
 #include <boost/process/spawn.hpp>
 #include <SDL.h>
@@ -25,19 +31,114 @@
 #include "elements.hpp"
 #include "canvasstate.hpp"
 #include "fileutils.hpp"
+#include "filetask.hpp"
+#include "thread_pool.hpp"
+#include "tracing.hpp"
 
 class FileOpenAction final : public Action {
 private:
 
-    static CanvasState::ReadResult readSave(CanvasState& state, const char* filePath) {
+    static CanvasState::ReadResult readSave(CanvasState& state, const char* filePath, std::atomic<float>& progress) {
+        CIRCUIT_SANDBOX_TRACE_SCOPE("FileOpenAction::readSave");
         std::ifstream saveFile(filePath, std::ios::binary);
         if (!saveFile.is_open()) return CanvasState::ReadResult::IO_ERROR;
 
-        return state.loadSave(saveFile);
+        // this runs on the file task thread, so its batches only fill the gaps between the UI thread's on the bulk pool
+        const ext::thread_pool::priority_scope priority(ext::thread_pool::priority::low);
+        return state.loadSave(saveFile, &ext::thread_pool::shared(), &progress);
+    }
+
+    // reads the compiled netlist cached beside filePath (see compileSave()), or returns an empty string if there is none
+    // this is done on the file task thread, so that the UI thread only has to decode it
+    static std::string readCache(const char* filePath) {
+        std::ifstream cacheFile(std::string(filePath) + CCSB_CACHE_FILE_SUFFIX, std::ios::binary);
+        if (!cacheFile.is_open()) return std::string();
+        return std::string(std::istreambuf_iterator<char>(cacheFile), std::istreambuf_iterator<char>());
+    }
+
+    // compiles the state that was just read from filePath, using the compiled netlist cached beside the file (read by readCache()) if it is of the same circuit
+    // otherwise the cache is (re)written, so that the circuit does not have to be compiled the next time it is opened
+    static void compileSave(Simulator& simulator, CanvasState& state, const char* filePath, std::string&& cache) {
+        CIRCUIT_SANDBOX_TRACE_SCOPE("FileOpenAction::compileSave");
+        const std::string cachePath = std::string(filePath) + CCSB_CACHE_FILE_SUFFIX;
+        if (!cache.empty()) {
+            std::istringstream cacheStream(std::move(cache));
+            if (simulator.compileFromCache(state, cacheStream)) return;
+        }
+        // the cache is only an optimization, so it does not matter if it cannot be written
+        std::ofstream cacheFile(cachePath, std::ios::binary);
+        simulator.compile(state, cacheFile.is_open() ? &cacheFile : nullptr);
+    }
+
+    // whether a file can be opened in this window (instead of a new instance)
+    static bool canOpenHere(MainWindow& mainWindow) {
+        return mainWindow.stateManager.historyManager.empty() && !mainWindow.hasFilePath();
+    }
+
+    // intelligent translation/scale depending on dimensions of canvasstate:
+    //   place circuit in the centre of screen, at the largest possible size where the whole circuit can be seen (but clamped to reasonable bounds)
+    static void fitViewport(MainWindow& mainWindow, PlayArea& playArea) {
+        auto canvas_size = mainWindow.stateManager.defaultState.size();
+        auto render_size = ext::point{ playArea.renderArea.w, playArea.renderArea.h };
+
+        if (canvas_size.x != 0 && canvas_size.y != 0) {
+            playArea.scale = std::clamp(std::min(render_size.x / canvas_size.x, render_size.y / canvas_size.y), 1, mainWindow.logicalToPhysicalSize(20));
+            playArea.translation = (render_size - canvas_size * playArea.scale) / 2;
+        }
+        else {
+            playArea.translation = { 0, 0 };
+            playArea.scale = 20;
+        }
+        playArea.prepareTexture(mainWindow.renderer);
+    }
+
+    // opens filePath in view-only mode, where only the tiles in view are loaded (see StateManager::loadViewTiles())
+    // this only reads the tile index of the file, so it is quick enough to do on the UI thread
+    // returns whether the file was opened
+    static bool openForViewing(MainWindow& mainWindow, PlayArea& playArea, const char* filePath) {
+        auto saveFile = std::make_unique<std::ifstream>(filePath, std::ios::binary);
+        CanvasState::TileLoader tileLoader;
+        CanvasState state;
+        CanvasState::ReadResult result = saveFile->is_open() ? tileLoader.open(std::move(saveFile), state) : CanvasState::ReadResult::IO_ERROR;
+        if (result != CanvasState::ReadResult::OK) {
+            showReadError(mainWindow, result);
+            return false;
+        }
+        mainWindow.stateManager.defaultState = std::move(state);
+        mainWindow.stateManager.tileLoader = std::move(tileLoader);
+        mainWindow.stateManager.deltaTrans = { 0, 0 };
+        fitViewport(mainWindow, playArea);
+        // the history and the simulator are not given the circuit, since they would need all of it
+        mainWindow.setUnsaved(false);
+        mainWindow.setFilePath(filePath);
+        mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Viewing file ", NotificationDisplay::TEXT_COLOR_ACTION }, { "(only the part in view is loaded, and nothing can be edited or simulated)", NotificationDisplay::TEXT_COLOR } });
+        return true;
+    }
+
+    static void showReadError(MainWindow& mainWindow, CanvasState::ReadResult result) {
+        switch (result) {
+        case CanvasState::ReadResult::OK:
+            break;
+        case CanvasState::ReadResult::OUTDATED:
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file was created by a newer version of " CIRCUIT_SANDBOX_STRING ", and cannot be opened here.  Please update " CIRCUIT_SANDBOX_STRING " and try again.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            break;
+        case CanvasState::ReadResult::CORRUPTED:
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file is corrupted.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            break;
+        case CanvasState::ReadResult::IO_ERROR:
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file cannot be accessed.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            break;
+        case CanvasState::ReadResult::UNSUPPORTED:
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file is saved in an older format that cannot be viewed part by part.  Open it normally and save it again to convert it.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            break;
+        }
     }
 
 public:
-    FileOpenAction(MainWindow& mainWindow, PlayArea& playArea, const char* filePath = nullptr) {
+    /**
+     * Opens filePath (or asks for the file to open if it is null), in view-only mode if viewOnly is true.
+     */
+    FileOpenAction(MainWindow& mainWindow, PlayArea& playArea, const char* filePath, bool viewOnly) {
 
         // stop the simulator if running
         bool simulatorRunning = mainWindow.stateManager.simulator.running();
@@ -57,51 +158,21 @@ public:
         }
 
         if (filePath != nullptr) { // means that the user wants to open filePath
-            if (mainWindow.stateManager.historyManager.empty() && !mainWindow.hasFilePath()) {
-                // read from filePath
-                CanvasState::ReadResult result = readSave(mainWindow.stateManager.defaultState, filePath);
-                switch (result) {
-                case CanvasState::ReadResult::OK:
-                    // reset the translations
-                    mainWindow.stateManager.deltaTrans = { 0, 0 };
-                    // intelligent translation/scale depending on dimensions of canvasstate:
-                    //   place circuit in the centre of screen, at the largest possible size where the whole circuit can be seen (but clamped to reasonable bounds)
-                    {
-                        auto canvas_size = mainWindow.stateManager.defaultState.size();
-                        auto render_size = ext::point{ playArea.renderArea.w, playArea.renderArea.h };
-
-                        if (canvas_size.x != 0 && canvas_size.y != 0) {
-                            playArea.scale = std::clamp(std::min(render_size.x / canvas_size.x, render_size.y / canvas_size.y), 1, mainWindow.logicalToPhysicalSize(20));
-                            playArea.translation = (render_size - canvas_size * playArea.scale) / 2;
-                        }
-                        else {
-                            playArea.translation = { 0, 0 };
-                            playArea.scale = 20;
-                        }
-                        playArea.prepareTexture(mainWindow.renderer);
-                    }
-                    // imbue the history
-                    mainWindow.stateManager.historyManager.imbue(mainWindow.stateManager.defaultState);
-                    mainWindow.setUnsaved(false);
-                    mainWindow.setFilePath(filePath);
-                    // recompile the simulator (this will propagate all the logic levels properly for display)
-                    mainWindow.stateManager.simulator.compile(mainWindow.stateManager.defaultState);
-                    simulatorRunning = false; // don't restart the simulator
-                    break;
-                case CanvasState::ReadResult::OUTDATED:
-                    mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file was created by a newer version of " CIRCUIT_SANDBOX_STRING ", and cannot be opened here.  Please update " CIRCUIT_SANDBOX_STRING " and try again.", NotificationDisplay::TEXT_COLOR_ERROR } });
-                    break;
-                case CanvasState::ReadResult::CORRUPTED:
-                    mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file is corrupted.", NotificationDisplay::TEXT_COLOR_ERROR } });
-                    break;
-                case CanvasState::ReadResult::IO_ERROR:
-                    mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error opening file: This file cannot be accessed.", NotificationDisplay::TEXT_COLOR_ERROR } });
-                    break;
+            if (!canOpenHere(mainWindow) || mainWindow.fileTaskRunning()) {
+                // launch a new instance
+                if (viewOnly) {
+                    boost::process::spawn(mainWindow.processName, CCSB_VIEW_ONLY_ARGUMENT, filePath);
+                }
+                else {
+                    boost::process::spawn(mainWindow.processName, filePath);
                 }
             }
+            else if (viewOnly) {
+                // the simulator holds an empty circuit in view-only mode, so it must not be restarted
+                if (openForViewing(mainWindow, playArea, filePath)) simulatorRunning = false;
+            }
             else {
-                // launch a new instance
-                boost::process::spawn(mainWindow.processName, filePath);
+                mainWindow.startFileTask(startReading(filePath));
             }
         }
 
@@ -110,8 +181,53 @@ public:
 
     };
 
-    static inline void start(MainWindow& mainWindow, PlayArea& playArea, const ActionStarter& starter, const char* filePath = nullptr) {
-        starter.start<FileOpenAction>(mainWindow, playArea, filePath);
+    /**
+     * Swaps in the state read from filePath by the file task, and compiles it with the given contents of its cache file (empty if there is none).
+     * Since this is started as an action, any action in progress (e.g. a drawing on the empty canvas while the file was being read) is committed first.
+     */
+    FileOpenAction(MainWindow& mainWindow, PlayArea& playArea, const char* filePath, CanvasState&& state, CanvasState::ReadResult result, std::string&& cache) {
+        if (result != CanvasState::ReadResult::OK) {
+            showReadError(mainWindow, result);
+            return;
+        }
+        if (!canOpenHere(mainWindow)) {
+            // the canvas was edited while the file was being read, so don't discard the edits
+            boost::process::spawn(mainWindow.processName, filePath);
+            return;
+        }
+        // stop the simulator if it was started while the file was being read
+        if (mainWindow.stateManager.simulator.running()) mainWindow.stateManager.simulator.stop();
+        mainWindow.stateManager.defaultState = std::move(state);
+        // reset the translations
+        mainWindow.stateManager.deltaTrans = { 0, 0 };
+        fitViewport(mainWindow, playArea);
+        // imbue the history
+        mainWindow.stateManager.historyManager.imbue(mainWindow.stateManager.defaultState);
+        mainWindow.setUnsaved(false);
+        mainWindow.setFilePath(filePath);
+        // recompile the simulator (this will propagate all the logic levels properly for display)
+        compileSave(mainWindow.stateManager.simulator, mainWindow.stateManager.defaultState, filePath, std::move(cache));
+    }
+
+    /**
+     * Starts reading and decoding filePath (and its cache file) on a file task, which swaps it in when done (see the other constructor).
+     * This doesn't need the window, so the file can be read while the window is being created (see main()); MainWindow::startFileTask() takes the task.
+     */
+    static std::unique_ptr<FileTask> startReading(std::string filePath) {
+        return std::make_unique<FileTask>("Opening", [filePath = std::move(filePath)](std::atomic<float>& progress) -> FileTask::finisher_t {
+            CanvasState state;
+            CanvasState::ReadResult result = readSave(state, filePath.c_str(), progress);
+            std::string cache = result == CanvasState::ReadResult::OK ? readCache(filePath.c_str()) : std::string();
+            return [filePath, state = std::move(state), result, cache = std::move(cache)](MainWindow& mainWindow) mutable {
+                mainWindow.currentAction.getStarter().start<FileOpenAction>(mainWindow, mainWindow.playArea, filePath.c_str(), std::move(state), result, std::move(cache));
+                mainWindow.currentAction.getStarter().reset();
+            };
+        });
+    }
+
+    static inline void start(MainWindow& mainWindow, PlayArea& playArea, const SDL_Keymod& modifiers, const ActionStarter& starter, const char* filePath = nullptr) {
+        // Shift opens the file in view-only mode
+        starter.start<FileOpenAction>(mainWindow, playArea, filePath, (modifiers & KMOD_SHIFT) != 0);
         starter.reset();
     }
 };
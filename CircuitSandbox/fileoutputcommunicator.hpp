@@ -11,39 +11,64 @@
 #pragma once
 
 #include <atomic>
+#include <thread>
+#include <chrono>
 #include <cstdio>
 #include <string>
-#include <thread>
-#include <mutex>
+#include <limits>
+#include <vector>
 #include <queue>
+#include <optional>
+#include <algorithm>
 #include <cstdint>
 #include <cstddef>
-#include <condition_variable>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "declarations.hpp"
 #include "communicator.hpp"
+#include "filecommunicatorthreads.hpp"
 #include "concurrent_fixed_queue.hpp"
 #include "unrolled_linked_list_queue.hpp"
+#include "binary_io.hpp"
 
-class FileOutputCommunicator final : public Communicator {
+class FileOutputCommunicator final : public Communicator, private FileCommunicatorThreads::Client {
     /**
      * There are three threads that interacts with this class:
      * 1. The UI thread
      * 2. The simulation thread
-     * 3. The file writing thread
+     * 3. The file writing thread (one of the FileCommunicatorThreads, which calls service())
      * Most of the methods of this class should only be called by one of those threads.
-     * The file writing thread is owned by this class.
+     *
+     * The file writing thread acknowledges each byte as soon as it takes it from the queue, and collects the bytes into blocks so that the file is written in large pieces.
+     * A block is written when it is full, when no more bytes came for a while (so the file does not fall far behind a circuit that pauses or stops), and when the file is closed.
      */
+public:
+    enum class SyncPolicy : uint8_t {
+        NONE, // leave it to the OS to put the data on the disk
+        ON_CLOSE, // flush to the disk when the file is closed or drained
+        EVERY_BLOCK // flush to the disk after each block (slow, but little is lost if the machine crashes)
+    };
+
+    struct WritePolicy {
+        size_t blockSize = 64 << 10; // bytes written to the file at a time (at most the size of the queue)
+        std::chrono::milliseconds flushDelay{ 100 }; // how long a partial block may wait for more bytes before it is written anyway
+        SyncPolicy sync = SyncPolicy::NONE;
+    };
+
 private:
-    std::thread fileThread;
-    std::atomic<bool> stoppingFlag;
-    std::mutex sigMutex;
-    std::condition_variable sigCV;
-    std::FILE* outputHandle;
+    bool fileLoaded = false; // whether we were added to the FileCommunicatorThreads (used by UI thread only)
+    std::FILE* outputHandle = nullptr;
     std::string outputFilePath;
+    std::atomic<bool> writeFailed = false; // set by the file writing thread if the file could not be written, until the file is loaded again
 
     // used by simulator thread only
     ext::unrolled_linked_list_queue<std::byte, 65536> writeQueue;
     std::atomic<size_t> acknowledged_bytes = 0;
+    uint64_t bytesTransmitted = 0; // number of bytes that the circuit wrote (including those still in writeQueue)
+    uint64_t bytesAcknowledged = 0; // number of acknowledgements that were sent to the circuit
 
     // used by simulator threaed only
     uint16_t currentTransmitChunk; // bitmask
@@ -52,45 +77,100 @@ private:
     uint8_t currentReceiveCount;
 
     // shared between simulator and file threads
-    constexpr static size_t BufSize = 65536;
+    constexpr static size_t BufSize = CCSB_FILE_COMMUNICATOR_BUFFER_SIZE;
     ext::concurrent_fixed_queue<std::byte, BufSize> fileOutputQueue;
 
+    // set by the UI thread while the file is not loaded
+    WritePolicy writePolicy;
+
+    // used by file writing thread only (and by the UI thread while the file is not loaded)
+    std::vector<std::byte> pendingBlock; // acknowledged bytes that are not written yet
+    std::chrono::steady_clock::time_point pendingSince; // when the first byte of pendingBlock was taken
+
+    // shared between the UI thread and the file writing thread
+    std::atomic<size_t> pendingBytes = 0; // size of pendingBlock, so that drain() knows when everything is written
+    std::atomic<bool> flushRequested = false; // set by drain() to have the pending block written without waiting for flushDelay
+
     /**
      * Wakes up the file writing thread if it is sleeping.
      */
     void notifyFileThread() {
-        {
-            std::scoped_lock<std::mutex> lck(sigMutex);
-        }
-        sigCV.notify_one();
+        FileCommunicatorThreads::get().notify(*this);
     }
 
     /**
-     * Joins the file writing thread if it is joinable.
+     * Stops the file writing thread from writing to the file, and closes it (probably user requested to change the file).
      */
     void unloadFile() noexcept {
-        if (fileThread.joinable()) {
-            {
-                std::scoped_lock<std::mutex> lock(sigMutex);
-                stoppingFlag.store(true, std::memory_order_relaxed);
+        if (fileLoaded) {
+            FileCommunicatorThreads::get().remove(*this);
+            if (outputHandle != nullptr && writePendingBlock() && writePolicy.sync != SyncPolicy::NONE) {
+                syncFile();
+            }
+            if (outputHandle != nullptr) {
+                std::fclose(outputHandle);
+                outputHandle = nullptr;
             }
-            sigCV.notify_one();
-            fileThread.join();
+            pendingBlock.clear();
+            pendingBytes.store(0, std::memory_order_relaxed);
+            fileLoaded = false;
+        }
+    }
+
+    /**
+     * Flushes the file to the disk.  Returns false if that failed.
+     */
+    bool syncFile() noexcept {
+        if (std::fflush(outputHandle) != 0) return false;
+#if defined(_WIN32)
+        return _commit(_fileno(outputHandle)) == 0;
+#else
+        return fsync(fileno(outputHandle)) == 0;
+#endif
+    }
+
+    /**
+     * Writes the pending block to the file.  If that fails, the file is closed and writeFailed is set.
+     * Must be called from the file writing thread, or while the file writing thread is not servicing us!
+     */
+    bool writePendingBlock() noexcept {
+        if (pendingBlock.empty()) return true;
+        bool ok = std::fwrite(reinterpret_cast<const void*>(pendingBlock.data()), 1, pendingBlock.size(), outputHandle) == pendingBlock.size();
+        if (ok && writePolicy.sync == SyncPolicy::EVERY_BLOCK) ok = syncFile();
+        pendingBlock.clear();
+        if (!ok) {
+            // file broken for some reason
+            std::fclose(outputHandle);
+            outputHandle = nullptr;
+            writeFailed.store(true, std::memory_order_release);
         }
+        // stored after writeFailed, so that drain() sees the failure if it sees that nothing is pending
+        pendingBytes.store(0, std::memory_order_release);
+        return ok;
     }
 
     // must call unloadFile() before calling this!
+    // if resumeOffset is given, the existing file is written from that offset (or from its end, if it is shorter than that) instead of being truncated
     // returns true is load succeeded, false otherwise.
-    bool loadFile() {
-        if (!outputFilePath.empty() && (outputHandle = std::fopen(outputFilePath.c_str(), "wb")) != nullptr) {
-            // disable output buffering
+    bool loadFile(std::optional<uint64_t> resumeOffset = std::nullopt) {
+        if (!outputFilePath.empty() && resumeOffset && (outputHandle = std::fopen(outputFilePath.c_str(), "r+b")) != nullptr) {
+            if (std::fseek(outputHandle, 0, SEEK_END) != 0 || static_cast<uint64_t>(std::ftell(outputHandle)) > *resumeOffset) {
+                std::fseek(outputHandle, static_cast<long>(*resumeOffset), SEEK_SET);
+            }
+        }
+        else if (!outputFilePath.empty()) {
+            outputHandle = std::fopen(outputFilePath.c_str(), "wb");
+        }
+        writeFailed.store(false, std::memory_order_relaxed);
+        flushRequested.store(false, std::memory_order_relaxed);
+        if (!outputFilePath.empty() && outputHandle != nullptr) {
+            // disable output buffering, since we write whole blocks ourselves
             std::setvbuf(outputHandle, nullptr, _IONBF, 0);
-            
-            // launch a new file thread
-            stoppingFlag.store(false, std::memory_order_relaxed);
-            fileThread = std::thread([this]() {
-                run();
-            });
+            pendingBlock.reserve(writePolicy.blockSize);
+
+            // start writing to the file
+            FileCommunicatorThreads::get().add(*this);
+            fileLoaded = true;
             return true;
         }
         return false;
@@ -112,6 +192,7 @@ public:
             size_t currSize = acknowledged_bytes.load(std::memory_order_acquire);
             if (currSize > 0) {
                 acknowledged_bytes.fetch_sub(1, std::memory_order_release);
+                ++bytesAcknowledged;
                 currentReceiveChunk = 0b001;
                 currentReceiveCount = 3;
             }
@@ -131,11 +212,15 @@ public:
      */
     void transmit(bool value) noexcept override {
         // clear anything still in the write queue
-        while (!writeQueue.empty()) {
-            if (!fileOutputQueue.try_push(writeQueue.front())) {
-                break;
+        if (!writeQueue.empty()) {
+            bool consumerNeedsSignal = false;
+            while (!writeQueue.empty() && fileOutputQueue.space() > 0) {
+                consumerNeedsSignal |= fileOutputQueue.emplace_testconsumerneedssignal(writeQueue.front());
+                writeQueue.pop();
+            }
+            if (consumerNeedsSignal) {
+                notifyFileThread();
             }
-            writeQueue.pop();
         }
         currentTransmitChunk |= (static_cast<uint16_t>(value) << currentTransmitCount);
         if (currentTransmitChunk != 0) {
@@ -146,6 +231,7 @@ public:
                     if (currentTransmitCount == 11) {
                         // write to fileOutputQueue if possible, instead of the writeQueue
                         std::byte tmp = static_cast<std::byte>(currentTransmitChunk >> 3);
+                        ++bytesTransmitted;
                         bool consumerNeedsSignal = false;
                         if (writeQueue.empty() && fileOutputQueue.space() > 0) {
                             consumerNeedsSignal = fileOutputQueue.emplace_testconsumerneedssignal(tmp);
@@ -175,6 +261,7 @@ public:
     void setFile(const char* filePath) {
         outputFilePath = filePath;
         unloadFile();
+        bytesTransmitted = bytesAcknowledged = 0;
 
         loadFile();
     }
@@ -195,11 +282,56 @@ public:
     void clearFile() {
         outputFilePath.clear();
         unloadFile();
+        bytesTransmitted = bytesAcknowledged = 0;
+    }
+
+    /**
+     * Sets how the file is written.  This takes effect when the file is next opened (by setFile(), reset() or readCheckpoint()).
+     * Must be called from the UI thread only!
+     */
+    void setWritePolicy(const WritePolicy& policy) noexcept {
+        writePolicy = policy;
+        writePolicy.blockSize = std::clamp<size_t>(writePolicy.blockSize, 1, BufSize - 1);
+    }
+
+    const WritePolicy& getWritePolicy() const noexcept {
+        return writePolicy;
+    }
+
+    /**
+     * Waits until every byte that the circuit has transmitted is written to the file (e.g. before the process exits), and flushes it to the disk if the sync policy asks for it.
+     * Returns false if the file could not be opened or written.
+     * Must be called from the UI thread, while the simulator is stopped!
+     */
+    bool drain() {
+        if (outputFilePath.empty()) return true;
+        if (!fileLoaded) return false;
+        while (true) {
+            // move the bytes that did not fit in the buffer, as transmit() would
+            while (!writeQueue.empty() && fileOutputQueue.space() > 0) {
+                fileOutputQueue.emplace_testconsumerneedssignal(writeQueue.front());
+                writeQueue.pop();
+            }
+            const bool written = writeQueue.empty() && fileOutputQueue.space() == BufSize - 1 && pendingBytes.load(std::memory_order_acquire) == 0;
+            if (writeFailed.load(std::memory_order_acquire)) return false;
+            if (written) {
+                // the file writing thread has nothing left to do, so it does not touch the file while we flush it
+                return writePolicy.sync == SyncPolicy::NONE || syncFile();
+            }
+            flushRequested.store(true, std::memory_order_relaxed);
+            notifyFileThread();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
     }
 
     /**
      * Load the file given by a previous setFilePath() call.
      */
+    // the queue to the file thread is part of the object, and pendingBlock is reserved to the block size while a file is loaded
+    size_t memoryUsage() const noexcept override {
+        return sizeof(FileOutputCommunicator) + writeQueue.bytes() + (fileLoaded ? writePolicy.blockSize : 0);
+    }
+
     void reset() noexcept override {
         // stop the current thread if any
         unloadFile();
@@ -210,49 +342,104 @@ public:
         currentReceiveCount = 0;
         currentReceiveChunk = 0;
         fileOutputQueue.clear();
+        acknowledged_bytes.store(0, std::memory_order_relaxed);
+        bytesTransmitted = bytesAcknowledged = 0;
 
         // open the new file
         loadFile();
     }
 
+    /**
+     * Writes the file and the bits that are in flight, and the bytes that the file writing thread has not been given yet.
+     * The bytes that were given to the file writing thread are assumed to be in the file by the time the checkpoint is restored (unloadFile() writes the pending block).
+     */
+    void writeCheckpoint(std::ostream& out) const override {
+        std::vector<std::byte> pendingBytes;
+        writeQueue.for_each([&](std::byte byte) {
+            pendingBytes.push_back(byte);
+        });
+        ext::write_binary_string(out, outputFilePath);
+        ext::write_binary(out, bytesTransmitted - pendingBytes.size()); // the offset of the first pending byte
+        ext::write_binary(out, bytesAcknowledged);
+        ext::write_binary(out, currentTransmitChunk);
+        ext::write_binary(out, currentTransmitCount);
+        ext::write_binary(out, currentReceiveChunk);
+        ext::write_binary(out, currentReceiveCount);
+        ext::write_binary_array(out, pendingBytes.data(), pendingBytes.size());
+    }
+
+    /**
+     * Reopens the file, keeping what the circuit wrote to it up to the checkpoint, and sends the circuit the acknowledgements it has not received yet.
+     */
+    bool readCheckpoint(std::istream& in) override {
+        std::string filePath;
+        uint64_t offset, acknowledged;
+        uint16_t transmitChunk;
+        uint8_t transmitCount, receiveChunk, receiveCount;
+        std::vector<std::byte> pendingBytes;
+        if (!ext::read_binary_string(in, filePath, std::numeric_limits<uint16_t>::max()) || !ext::read_binary(in, offset) || !ext::read_binary(in, acknowledged)) return false;
+        if (!ext::read_binary(in, transmitChunk) || !ext::read_binary(in, transmitCount) || !ext::read_binary(in, receiveChunk) || !ext::read_binary(in, receiveCount)) return false;
+        // the bits in flight are at most one command (11 bits) and one acknowledgement (3 bits), and each byte is acknowledged once the file writing thread has taken it
+        if (transmitCount >= 11 || receiveCount > 3 || acknowledged > offset) return false;
+        if (!ext::read_binary_array(in, pendingBytes, std::numeric_limits<uint32_t>::max())) return false;
+
+        unloadFile();
+        outputFilePath = std::move(filePath);
+        while (!writeQueue.empty()) writeQueue.pop();
+        for (std::byte byte : pendingBytes) writeQueue.push(byte);
+        currentTransmitChunk = transmitChunk;
+        currentTransmitCount = transmitCount;
+        currentReceiveChunk = receiveChunk;
+        currentReceiveCount = receiveCount;
+        fileOutputQueue.clear();
+        acknowledged_bytes.store(static_cast<size_t>(offset - acknowledged), std::memory_order_relaxed);
+        bytesTransmitted = offset + pendingBytes.size();
+        bytesAcknowledged = acknowledged;
+
+        loadFile(offset);
+        return true;
+    }
+
 private:
 
     /**
-     * This is the file reading thread function.
+     * Takes the bytes from the queue (acknowledging them) into the pending block, and writes the block once it is full or has waited long enough.
      * Must be called from the file writing thread only!
      */
-    void run() {
-        while (!stoppingFlag.load(std::memory_order_acquire)) {
-            size_t available;
-            while (!stoppingFlag.load(std::memory_order_acquire) && (available = fileOutputQueue.available()) > 0) {
-                // try to write as many bytes as possible to the file
-                std::byte bytes[BufSize];
-                // peek at the bytes at the front, but don't modify the queue yet in case the write fails
-                fileOutputQueue.peek(bytes, bytes + available);
-                auto commitCount = std::fwrite(reinterpret_cast<void*>(bytes), 1, available, outputHandle);
-
-                // pop the bytes that were committed
-                fileOutputQueue.pop(commitCount);
-
-                // enqueue the acknowledgements
-                acknowledged_bytes.fetch_add(commitCount, std::memory_order_release);
-
-                // check if everything that was available were committed
-                if (commitCount != available) {
-                    // file broken for some reason
-                    stoppingFlag.store(true, std::memory_order_relaxed);
-                }
-            }
-            if (!stoppingFlag.load(std::memory_order_acquire)) {
-                // if we get here, it means the file hasn't ended but the buffer is empty. so we sleep until notified.
-                std::unique_lock<std::mutex> lck(sigMutex);
-                sigCV.wait(lck, [this]() {
-                    return stoppingFlag.load(std::memory_order_relaxed) || fileOutputQueue.available() > 0;
-                });
-            }
+    ServiceResult service() noexcept override {
+        auto [bytes, available] = fileOutputQueue.peek_span();
+        if (available != 0) {
+            if (pendingBlock.empty()) pendingSince = std::chrono::steady_clock::now();
+            const size_t count = std::min(available, writePolicy.blockSize - pendingBlock.size());
+            pendingBlock.insert(pendingBlock.end(), bytes, bytes + count);
+            // published before the bytes leave the queue, so that drain() always sees them in one place or the other
+            pendingBytes.store(pendingBlock.size(), std::memory_order_relaxed);
+            fileOutputQueue.pop(count);
+
+            // enqueue the acknowledgements
+            acknowledged_bytes.fetch_add(count, std::memory_order_release);
         }
 
-        // close the file, because we are stopping (probably user requested to change the file)
-        std::fclose(outputHandle);
+        if (pendingBlock.size() == writePolicy.blockSize) {
+            if (!writePendingBlock()) return ServiceResult::FINISHED;
+            return ServiceResult::AGAIN;
+        }
+        if (fileOutputQueue.available() != 0) {
+            // the rest of the queue wrapped around, or more bytes came in
+            return ServiceResult::AGAIN;
+        }
+        if (pendingBlock.empty()) {
+            // the buffer is empty, so we wait until the simulator thread notifies us
+            return ServiceResult::IDLE;
+        }
+        const auto flushTime = pendingSince + writePolicy.flushDelay;
+        const auto now = std::chrono::steady_clock::now();
+        if (flushRequested.exchange(false, std::memory_order_relaxed) || now >= flushTime) {
+            // no more bytes came for a while (e.g. the simulation stopped), so write what we have
+            if (!writePendingBlock()) return ServiceResult::FINISHED;
+            return ServiceResult::IDLE;
+        }
+        serviceDelay = flushTime - now;
+        return ServiceResult::DELAYED;
     }
 };
@@ -13,6 +13,8 @@
 #include <fstream>
 #include <cstring>
 #include <type_traits>
+#include <atomic>
+#include <string>
 
 #include <boost/process/spawn.hpp>
 #include <SDL.h>
@@ -24,16 +26,17 @@
 #include "elements.hpp"
 #include "canvasstate.hpp"
 #include "fileutils.hpp"
+#include "filetask.hpp"
 #include "notificationdisplay.hpp"
 
 class FileSaveAction final : public Action {
 private:
 
-    CanvasState::WriteResult writeSave(const CanvasState& state, const char* filePath) {
+    static CanvasState::WriteResult writeSave(const CanvasState& state, const char* filePath, std::atomic<float>& progress) {
         std::ofstream saveFile(filePath, std::ios::binary);
         if (!saveFile.is_open()) return CanvasState::WriteResult::IO_ERROR;
 
-        return state.writeSave(saveFile);
+        return state.writeSave(saveFile, &progress);
     }
 
 public:
@@ -55,18 +58,21 @@ public:
         }
 
         if (filePath != nullptr) { // means that the user wants to save to filePath
-            mainWindow.stateManager.updateDefaultState();
-            CanvasState::WriteResult result = writeSave(mainWindow.stateManager.defaultState, filePath);
-            switch (result) {
-            case CanvasState::WriteResult::OK:
-                mainWindow.setUnsaved(false);
-                mainWindow.setFilePath(filePath);
-                mainWindow.stateManager.historyManager.setSaved();
-                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "File saved", NotificationDisplay::TEXT_COLOR_ACTION } });
-                break;
-            case CanvasState::WriteResult::IO_ERROR:
-                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving file: This file cannot be written to.", NotificationDisplay::TEXT_COLOR_ERROR } });
-                break;
+            if (mainWindow.fileTaskRunning()) {
+                mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving file: Another file is still being opened or saved.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            }
+            else {
+                // write a snapshot in the background, so that editing can continue while the file is being written
+                // (the tiles are copy-on-write, so the snapshot only costs the tiles that are edited before the save completes)
+                mainWindow.stateManager.updateDefaultState();
+                mainWindow.stateManager.historyManager.setSaving();
+                mainWindow.startFileTask("Saving", [snapshot = CanvasState(mainWindow.stateManager.defaultState), filePath = std::string(filePath)](std::atomic<float>& progress) mutable -> FileTask::finisher_t {
+                    CanvasState::WriteResult result = writeSave(snapshot, filePath.c_str(), progress);
+                    // the snapshot is released on the UI thread, since its tiles may still be shared with the canvas
+                    return [filePath, result, snapshot = std::move(snapshot)](MainWindow& mainWindow) {
+                        finishSave(mainWindow, filePath.c_str(), result);
+                    };
+                });
             }
         }
 
@@ -74,7 +80,27 @@ public:
         if (simulatorRunning) mainWindow.stateManager.simulator.start();
     };
 
+    /**
+     * Called on the UI thread when the file task has written the snapshot to filePath.
+     */
+    static void finishSave(MainWindow& mainWindow, const char* filePath, CanvasState::WriteResult result) {
+        switch (result) {
+        case CanvasState::WriteResult::OK:
+            mainWindow.stateManager.historyManager.setSaved();
+            // the canvas might have been edited while the file was being written
+            mainWindow.setUnsaved(mainWindow.stateManager.historyManager.changedSinceLastSave());
+            mainWindow.setFilePath(filePath);
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "File saved", NotificationDisplay::TEXT_COLOR_ACTION } });
+            break;
+        case CanvasState::WriteResult::IO_ERROR:
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving file: This file cannot be written to.", NotificationDisplay::TEXT_COLOR_ERROR } });
+            break;
+        }
+    }
+
     static inline void start(MainWindow& mainWindow, const SDL_Keymod& modifiers, const ActionStarter& starter, const char* filePath = nullptr) {
+        // only part of the file is loaded in view-only mode, so it must not be saved
+        if (mainWindow.stateManager.rejectIfViewOnly(mainWindow)) return;
         if (modifiers & KMOD_SHIFT) {
             // force "Save As" dialog
             starter.start<FileSaveAction>(mainWindow, nullptr);
@@ -0,0 +1,74 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "declarations.hpp"
+
+/**
+ * Reads or writes a file on a background thread, so that the window stays responsive while a large circuit is opened or saved.
+ * The work is given the progress to update (from 0 to 1), and returns the finisher, which is called on the UI thread once the work is done (see MainWindow::updateFileTask()).
+ * The work must not touch anything that the UI thread might be using; it should work on its own copy of the state instead.
+ */
+class FileTask {
+public:
+    using finisher_t = std::function<void(MainWindow&)>;
+
+private:
+    std::string description; // what the task is doing, e.g. "Opening"
+    std::atomic<float> progress = 0;
+    std::atomic<bool> done = false;
+    finisher_t finisher; // only valid once done is true
+    std::thread thread; // has to be the last member, so that everything else is initialized before the thread starts
+
+public:
+    template <typename Work>
+    FileTask(std::string description, Work&& work) : description(std::move(description)), thread([this, work = std::forward<Work>(work)]() mutable {
+        finisher = work(progress);
+        done.store(true, std::memory_order_release);
+    }) {}
+
+    FileTask(const FileTask&) = delete;
+    FileTask& operator=(const FileTask&) = delete;
+
+    /**
+     * Waits for the work to complete (without calling the finisher).
+     */
+    ~FileTask() {
+        if (thread.joinable()) thread.join();
+    }
+
+    const std::string& getDescription() const noexcept {
+        return description;
+    }
+
+    float getProgress() const noexcept {
+        return progress.load(std::memory_order_relaxed);
+    }
+
+    bool finished() const noexcept {
+        return done.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Returns the finisher produced by the work.
+     * @pre finished() is true
+     */
+    finisher_t takeFinisher() {
+        thread.join();
+        return std::move(finisher);
+    }
+};
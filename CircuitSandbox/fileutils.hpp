@@ -15,6 +15,13 @@
 #define CCSB_FILE_MAGIC "CCPG"
 #define CCSB_FILE_EXTENSION "ccsb"
 #define CCSB_FILE_FRIENDLY_NAME "Circuit Sandbox save"
+#define CCSB_CHECKPOINT_FILE_EXTENSION "ccsbstate"
+#define CCSB_CHECKPOINT_FILE_FRIENDLY_NAME "Circuit Sandbox simulation checkpoint"
+#define CCSB_CACHE_FILE_SUFFIX ".netlist" // appended to the path of a save file to get the path of its compiled netlist cache
+#define CCSB_VIEW_ONLY_ARGUMENT "--view" // command line argument before the file path to open the file in view-only mode
+#define CCSB_BATCH_ARGUMENT "--batch" // command line argument that runs a file without the window (see BatchRunner)
+#define CCSB_SERVE_ARGUMENT "--serve" // command line argument that simulates a file without the window, for remote clients (see SimulationServer)
+#define CCSB_NODE_ARGUMENT "--node" // command line argument that evaluates part of a file for the coordinator of a distributed run (see ClusterNode)
 
 /**
  * Returns a pointer to the first character after the last '/' or '\\'
@@ -22,6 +22,7 @@
 #include <type_traits>
 #include <array>
 #include <limits>
+#include <algorithm>
 #include <cassert>
 
 namespace ext {
@@ -33,9 +34,17 @@ namespace ext {
     template <typename T, size_t Size>
     class flushable_fixed_queue {
     private:
+        constexpr static size_t cache_line_size = 64;
+
         std::array<T, Size> buffer;
-        std::atomic<size_t> pushIndex, popIndex;
-        std::atomic<size_t> endIndex, flushIndex;
+        // the indices that the producer writes and the indices that the consumer writes are on separate cache lines, so that each push and pop doesn't steal the cache line from the other thread
+        // each side also keeps its last read of the other side's index, and only reads it again when that copy shows too little space (or too few elements)
+        alignas(cache_line_size) std::atomic<size_t> pushIndex;
+        mutable size_t cachedPopIndex; // only used by the producer
+        alignas(cache_line_size) std::atomic<size_t> popIndex;
+        mutable size_t cachedPushIndex; // only used by the consumer
+        // these are rarely written, so both threads can keep their own copy of this cache line
+        alignas(cache_line_size) std::atomic<size_t> endIndex, flushIndex;
 
         inline static size_t space(size_t tmp_pushIndex, size_t tmp_popIndex) noexcept {
             if (tmp_popIndex <= tmp_pushIndex) tmp_popIndex += Size;
@@ -47,10 +56,38 @@ namespace ext {
             return tmp_pushIndex - tmp_popIndex;
         }
 
+        /**
+         * Calling this method must be synchronized with push().
+         * Returns the space, reading popIndex again only if the cached copy shows less than the given amount of space.
+         */
+        inline size_t space_for(size_t tmp_pushIndex, size_t needed) const noexcept {
+            size_t result = space(tmp_pushIndex, cachedPopIndex);
+            if (result < needed) {
+                cachedPopIndex = popIndex.load(std::memory_order_acquire);
+                result = space(tmp_pushIndex, cachedPopIndex);
+            }
+            return result;
+        }
+
+        /**
+         * Calling this method must be synchronized with pop().
+         * Returns the number of elements available, reading pushIndex again only if the cached copy shows less than the given number of elements.
+         */
+        inline size_t available_for(size_t tmp_popIndex, size_t needed) const noexcept {
+            size_t result = available(cachedPushIndex, tmp_popIndex);
+            if (result < needed) {
+                cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+                result = available(cachedPushIndex, tmp_popIndex);
+            }
+            return result;
+        }
+
     public:
         flushable_fixed_queue() {
             pushIndex.store(0, std::memory_order_relaxed);
             popIndex.store(0, std::memory_order_relaxed);
+            cachedPopIndex = 0;
+            cachedPushIndex = 0;
             endIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_relaxed);
             flushIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_relaxed);
         }
@@ -62,8 +99,8 @@ namespace ext {
          */
         inline size_t space() const noexcept {
             size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
-            size_t tmp_popIndex = popIndex.load(std::memory_order_acquire);
-            return space(tmp_pushIndex, tmp_popIndex);
+            cachedPopIndex = popIndex.load(std::memory_order_acquire);
+            return space(tmp_pushIndex, cachedPopIndex);
         }
 
         /**
@@ -72,8 +109,8 @@ namespace ext {
          */
         inline size_t available() const noexcept {
             size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
-            size_t tmp_pushIndex = pushIndex.load(std::memory_order_acquire);
-            return available(tmp_pushIndex, tmp_popIndex);
+            cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+            return available(cachedPushIndex, tmp_popIndex);
         }
 
         /**
@@ -82,6 +119,7 @@ namespace ext {
          */
         inline void clear() noexcept {
             size_t tmp_pushIndex = pushIndex.load(std::memory_order_acquire);
+            cachedPushIndex = tmp_pushIndex;
             popIndex.store(tmp_pushIndex, std::memory_order_release);
             endIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_relaxed);
             flushIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_relaxed);
@@ -98,7 +136,11 @@ namespace ext {
         * Calling this method must be synchronized with pop().
         */
         inline bool ended() const noexcept {
-            return endIndex.load(std::memory_order_acquire) == popIndex.load(std::memory_order_acquire);
+            size_t tmp_popIndex = popIndex.load(std::memory_order_acquire);
+            size_t tmp_pushIndex = pushIndex.load(std::memory_order_acquire);
+            size_t tmp_endIndex = endIndex.load(std::memory_order_acquire);
+            // elements pushed after a flush() at the end belong to the next stream, so they are not ended
+            return tmp_endIndex == tmp_popIndex && (tmp_pushIndex == tmp_popIndex || flushIndex.load(std::memory_order_acquire) != tmp_endIndex);
         }
 
         /**
@@ -120,6 +162,8 @@ namespace ext {
             size_t tmp_pushIndex = pushIndex.load(std::memory_order_acquire);
             size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
             if (tmp_popIndex == tmp_flushIndex || tmp_flushIndex == std::numeric_limits<size_t>::max() || available(tmp_pushIndex, tmp_popIndex) < available(tmp_flushIndex, tmp_popIndex)) return false;
+            // the cached pushIndex might be before the flush index, which would put it behind the new popIndex
+            cachedPushIndex = tmp_pushIndex;
             popIndex.store(tmp_flushIndex, std::memory_order_release);
             return true;
         }
@@ -129,10 +173,10 @@ namespace ext {
          */
         template <typename... Args>
         inline bool try_emplace(Args&&... args) {
-            if (space() == 0) {
+            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
+            if (space_for(tmp_pushIndex, 1) == 0) {
                 return false;
             }
-            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
             buffer[tmp_pushIndex] = T(std::forward<Args>(args)...);
             tmp_pushIndex = (tmp_pushIndex + 1) % Size;
             if (endIndex.load(std::memory_order_relaxed) == tmp_pushIndex) {
@@ -174,15 +218,44 @@ namespace ext {
             pushIndex.store(tmp_pushIndex, std::memory_order_release);
         }
 
+        /**
+         * Gets the contiguous free part of the buffer at the back of the queue, so that the producer can write into it directly (e.g. from a file).
+         * Call push(count) afterwards to make the first count elements of it available to the consumer.
+         */
+        inline std::pair<T*, size_t> push_span() noexcept {
+            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
+            return { buffer.data() + tmp_pushIndex, std::min(space_for(tmp_pushIndex, Size - tmp_pushIndex), Size - tmp_pushIndex) };
+        }
+
+        /**
+         * Pushes the first count elements that were written into the span given by push_span().
+         */
+        inline void push(size_t count) noexcept {
+            size_t old_pushIndex = pushIndex.load(std::memory_order_relaxed);
+            size_t tmp_pushIndex = old_pushIndex + count;
+            if (tmp_pushIndex >= Size) tmp_pushIndex -= Size;
+            // whether we pushed past the given index (same as the checks in the element-wise push())
+            auto passed = [old_pushIndex, count](size_t index) {
+                return index != std::numeric_limits<size_t>::max() && index != old_pushIndex && available(index, old_pushIndex) <= count;
+            };
+            if (passed(endIndex.load(std::memory_order_relaxed))) {
+                endIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_release);
+            }
+            if (passed(flushIndex.load(std::memory_order_relaxed))) {
+                flushIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_release);
+            }
+            pushIndex.store(tmp_pushIndex, std::memory_order_release);
+        }
+
         /**
          * Gets and removes the element from the front of the queue if exists.
          * Returns true if there was an element to remove.
          */
         inline bool try_pop(T& out) {
-            if (available() == 0) {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            if (available_for(tmp_popIndex, 1) == 0) {
                 return false;
             }
-            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
             out = std::move(buffer[tmp_popIndex]);
             popIndex.store((tmp_popIndex + 1) % Size, std::memory_order_release);
             return true;
@@ -203,15 +276,44 @@ namespace ext {
             popIndex.store(tmp_popIndex, std::memory_order_release);
         }
 
+        /**
+         * Pops up to max_count elements from the front of the queue into out, without going past the position marked by end().
+         * Returns the number of elements popped, and sets producer_needs_signal to whether the queue might have been full before this call.
+         */
+        inline size_t pop_before_end(T* out, size_t max_count, bool& producer_needs_signal) {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            // pushIndex has to be read before endIndex (if at all), like in ended()
+            size_t count = std::min(available_for(tmp_popIndex, max_count), max_count);
+            size_t tmp_endIndex = endIndex.load(std::memory_order_acquire);
+            // if the end is not between the front and the back of the queue, this is more than the number of available elements
+            // (once we are at an end that was flushed, the elements after it belong to the next stream, like in ended())
+            if (tmp_endIndex != std::numeric_limits<size_t>::max() && (tmp_endIndex != tmp_popIndex || flushIndex.load(std::memory_order_acquire) != tmp_endIndex)) count = std::min(count, available(tmp_endIndex, tmp_popIndex));
+            for (size_t i = 0; i != count; ++i) {
+                out[i] = std::move(buffer[tmp_popIndex]);
+                ++tmp_popIndex;
+                if (tmp_popIndex == Size) tmp_popIndex -= Size;
+            }
+            popIndex.store(tmp_popIndex, std::memory_order_release);
+            if (count != 0) {
+                // the producer might be waiting, so this needs the current pushIndex
+                cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+                producer_needs_signal = space(cachedPushIndex, tmp_popIndex) <= count;
+            }
+            else {
+                producer_needs_signal = false;
+            }
+            return count;
+        }
+
         /**
          * Peeks the element from the front of the queue if exists.
          * Returns true if there was an element to remove.
          */
         inline bool peek(T& out) {
-            if (available() == 0) {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            if (available_for(tmp_popIndex, 1) == 0) {
                 return false;
             }
-            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
             out = buffer[tmp_popIndex];
             return true;
         }
@@ -234,7 +336,8 @@ namespace ext {
             size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
             tmp_popIndex = (tmp_popIndex + 1) % Size;
             popIndex.store(tmp_popIndex, std::memory_order_release);
-            return space(pushIndex.load(std::memory_order_acquire), tmp_popIndex) <= 1;
+            cachedPushIndex = pushIndex.load(std::memory_order_acquire);
+            return space(cachedPushIndex, tmp_popIndex) <= 1;
         }
 
         /**
@@ -254,7 +357,8 @@ namespace ext {
                 flushIndex.store(std::numeric_limits<size_t>::max(), std::memory_order_release);
             }
             pushIndex.store(tmp_pushIndex, std::memory_order_release);
-            return available(tmp_pushIndex, popIndex.load(std::memory_order_acquire)) <= 1;
+            cachedPopIndex = popIndex.load(std::memory_order_acquire);
+            return available(tmp_pushIndex, cachedPopIndex) <= 1;
         }
     };
 }
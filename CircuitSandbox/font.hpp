@@ -56,6 +56,14 @@ public:
         }
     }
 
+    const char* path() const noexcept {
+        return fontPath;
+    }
+
+    int size() const noexcept {
+        return physicalSize;
+    }
+
     operator TTF_Font*() const {
         return font.get();
     }
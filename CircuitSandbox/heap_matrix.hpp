@@ -12,13 +12,27 @@
 
 #include <utility>
 #include <algorithm> // for std::copy, std::move, std::reverse, std::swap_ranges
+#include <memory> // for std::uninitialized_default_construct_n, std::uninitialized_fill_n, std::destroy_n
+#include <new>
+#include <cstddef>
+#include <cstdint>
 
 #include "algorithm.hpp"
 #include "point.hpp"
 
+// whether large matrices ask the OS to back them with transparent huge pages (only on Linux), so that walking over a big canvas takes fewer TLB misses
+#ifndef CIRCUIT_SANDBOX_HUGE_PAGES
+#define CIRCUIT_SANDBOX_HUGE_PAGES 1
+#endif
+
+#if CIRCUIT_SANDBOX_HUGE_PAGES && defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 /**
  * Represents a generic dynamically-allocated 2D array.
  * The size of the 2d array can be set at runtime, but it is not growable.
+ * The buffer is aligned to a cache line, and the elements are default-initialized (so trivial types are left uninitialized) unless a fill value is given.
  */
 
 namespace ext {
@@ -31,6 +45,71 @@ namespace ext {
         int32_t _width;
         int32_t _height;
 
+        // alignment of the buffer, so that rows split between threads don't share a cache line at the start of the buffer
+        constexpr static size_t cacheLineAlignment = 64;
+        // buffers of at least this size are aligned to it and advised to use transparent huge pages
+        constexpr static size_t hugePageSize = 2 * 1024 * 1024;
+
+        static size_t alignmentFor(size_t bytes) noexcept {
+#if CIRCUIT_SANDBOX_HUGE_PAGES && defined(__linux__)
+            if (bytes >= hugePageSize) return hugePageSize;
+#endif
+            return std::max(cacheLineAlignment, alignof(T));
+        }
+
+        /**
+         * Allocates storage for count elements, without constructing them.
+         */
+        static T* allocate(size_t count) {
+            const size_t bytes = count * sizeof(T);
+            void* const storage = ::operator new(bytes, std::align_val_t{ alignmentFor(bytes) });
+#if CIRCUIT_SANDBOX_HUGE_PAGES && defined(__linux__)
+            // only a hint, so failure (e.g. with huge pages disabled) is ignored; the pages are not touched yet, so the kernel can still give huge ones
+            if (bytes >= hugePageSize) madvise(storage, bytes / hugePageSize * hugePageSize, MADV_HUGEPAGE);
+#endif
+            return static_cast<T*>(storage);
+        }
+
+        /**
+         * Destroys count elements and frees the storage given by allocate().
+         */
+        static void deallocate(T* storage, size_t count) noexcept {
+            std::destroy_n(storage, count);
+            ::operator delete(storage, std::align_val_t{ alignmentFor(count * sizeof(T)) });
+        }
+
+        /**
+         * Allocates the buffer for the current size, and constructs the elements with the given callback (which gets the buffer and the number of elements).
+         */
+        template <typename Construct>
+        void allocateBuffer(Construct construct) {
+            if (_width == 0 || _height == 0) {
+                buffer = nullptr;
+                _width = 0;
+                _height = 0;
+                return;
+            }
+            const size_t count = static_cast<size_t>(_width) * static_cast<size_t>(_height);
+            buffer = allocate(count);
+            try {
+                construct(buffer, count);
+            }
+            catch (...) {
+                ::operator delete(buffer, std::align_val_t{ alignmentFor(count * sizeof(T)) });
+                throw;
+            }
+        }
+
+        /**
+         * Frees the buffer (if any).
+         */
+        void freeBuffer() noexcept {
+            if (buffer != nullptr) {
+                deallocate(buffer, static_cast<size_t>(_width) * static_cast<size_t>(_height));
+                buffer = nullptr;
+            }
+        }
+
     public:
 
         friend inline void swap(heap_matrix& a, heap_matrix& b) noexcept {
@@ -48,17 +127,12 @@ namespace ext {
         }
         heap_matrix& operator=(const heap_matrix& other) {
             if (_width != other._width || _height != other._height) {
-                if (!empty()) {
-                    delete[] buffer;
-                }
+                freeBuffer();
                 _width = other._width;
                 _height = other._height;
-                if (!other.empty()) {
-                    buffer = new T[_width * _height];
-                }
-                else {
-                    buffer = nullptr;
-                }
+                allocateBuffer([](T* storage, size_t count) {
+                    std::uninitialized_default_construct_n(storage, count);
+                });
             }
             copy_range(other, *this, 0, 0, 0, 0, _width, _height);
             return *this;
@@ -76,24 +150,28 @@ namespace ext {
         }
 
         ~heap_matrix() noexcept {
-            if (buffer != nullptr) {
-                delete[] buffer; // delete the heap array if it isn't nullptr
-            }
+            freeBuffer();
         }
 
         heap_matrix(int32_t width, int32_t height): _width(width), _height(height) {
-            if (_width == 0 || _height == 0) {
-                buffer = nullptr;
-                _width = 0;
-                _height = 0;
-            }
-            else {
-                buffer = new T[_width * _height]; // reserve the heap array
-            }
+            allocateBuffer([](T* storage, size_t count) {
+                std::uninitialized_default_construct_n(storage, count);
+            });
         }
 
         heap_matrix(const ext::point& size) : heap_matrix(size.x, size.y) {}
 
+        /**
+         * Creates a matrix with every element initialized to the given value (which is faster than creating it and then calling fill()).
+         */
+        heap_matrix(int32_t width, int32_t height, const T& value) : _width(width), _height(height) {
+            allocateBuffer([&](T* storage, size_t count) {
+                std::uninitialized_fill_n(storage, count, value);
+            });
+        }
+
+        heap_matrix(const ext::point& size, const T& value) : heap_matrix(size.x, size.y, value) {}
+
         /**
          * returns true if the matrix is empty (i.e. has no width and height)
          */
@@ -115,11 +193,18 @@ namespace ext {
             return _height;
         }
 
+        /**
+         * returns the number of bytes used by the elements of the matrix
+         */
+        size_t bytes() const noexcept {
+            return static_cast<size_t>(_width) * static_cast<size_t>(_height) * sizeof(T);
+        }
+
         /**
          * fills all elements in the matrix with the same value
          */
         void fill(const T& value) {
-            std::fill_n(buffer, _width * _height, value);
+            std::fill_n(buffer, static_cast<size_t>(_width) * static_cast<size_t>(_height), value);
         }
 
         /**
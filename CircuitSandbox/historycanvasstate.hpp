@@ -12,69 +12,67 @@
 
 #include <utility>
 #include <memory>
-#include <variant>
+#include <cstddef>
+#include <vector>
 #include "elements.hpp"
 #include "canvasstate.hpp"
-#include "heap_matrix.hpp"
+#include "tiled_matrix.hpp"
 
 /**
  * Canvas state that is for storing in the history manager.
- * The communicator elements only store weak references to the shared communicators
+ * The elements are trivially copyable, and the communicators are kept in the same side table as in CanvasState.
  */
 
 class HistoryCanvasState {
-private:
-    template <typename T, typename TCommunicator>
-    struct CommunicatorHistoryElementBase : public SignalReceivingElementBase<T>, public LogicLevelElementBase<T> {
-        CommunicatorHistoryElementBase(const T& other) noexcept : LogicLevelElementBase<T>(other.logicLevel, other.startingLogicLevel), transmitState(other.transmitState), communicator(other.communicator) {}
-        bool transmitState;
-        std::weak_ptr<TCommunicator> communicator;
-        operator T() const noexcept {
-            auto tmp = T(this->logicLevel, this->startingLogicLevel, this->transmitState);
-            tmp.communicator = communicator.lock();
-            return tmp;
-        }
-    };
-
-    template <typename T>
-    struct ElementType {
-        using type = T;
-    };
-
-    template <typename T, typename TCommunicator>
-    struct ElementType<CommunicatorElementBase<T, TCommunicator>> {
-        using type = CommunicatorHistoryElementBase<T, TCommunicator>;
-    };
-
-    template <typename T>
-    using ElementType_t = typename ElementType<T>::type;
-
 public:
-    using element_variant_t = CanvasState::element_tags_t::transform<ElementType_t>::instantiate<std::variant>;
+    using element_variant_t = CanvasState::element_variant_t;
 
 private:
-    using matrix_t = ext::heap_matrix<element_variant_t>;
+    using matrix_t = ext::tiled_matrix<element_variant_t>;
 
     matrix_t dataMatrix;
+    std::vector<std::shared_ptr<Communicator>> communicators;
 public:
     HistoryCanvasState() = default;
     HistoryCanvasState(const CanvasState& state) {
         dataMatrix = state.dataMatrix;
+        communicators = state.communicators;
     }
     HistoryCanvasState(CanvasState&& state) {
         dataMatrix = std::move(state.dataMatrix);
+        communicators = std::move(state.communicators);
     }
     operator CanvasState() const & {
         CanvasState ret;
         ret.dataMatrix = dataMatrix;
+        ret.communicators = communicators;
         return ret;
     }
     operator CanvasState() && {
         CanvasState ret;
         ret.dataMatrix = std::move(dataMatrix);
+        ret.communicators = std::move(communicators);
         return ret;
     }
 
+    /**
+     * Returns the number of bytes used by this state that are not shared with the given state.
+     * Only the tiles that were modified between the two states are counted, since the others are shared.
+     */
+    size_t unsharedBytes(const HistoryCanvasState& other) const noexcept {
+        return sizeof(HistoryCanvasState) + dataMatrix.unshared_bytes(other.dataMatrix) + communicators.size() * sizeof(std::shared_ptr<Communicator>);
+    }
+
+    /**
+     * Returns true if the given state has the same type of element as this state everywhere (ignoring logic levels and communicator settings).
+     * Only the tiles that are not shared with the given state are compared.
+     */
+    bool sameElementTypes(const CanvasState& state) const {
+        return dataMatrix.equal_elements(state.dataMatrix, [](const element_variant_t& a, const element_variant_t& b) {
+            return a.index() == b.index();
+        });
+    }
+
     /**
      * returns the width of the matrix
      */
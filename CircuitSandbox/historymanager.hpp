@@ -10,44 +10,111 @@
 
 #pragma once
 
-#include <stack>
+#include <deque>
 #include <optional>
+#include <initializer_list>
 #include <utility>
+#include <cstddef>
+#include <cstdint>
 #include "canvasstate.hpp"
 #include "point.hpp"
 #include "historycanvasstate.hpp"
+#include "tracing.hpp"
 
 struct HistoryManager {
+public:
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = static_cast<size_t>(1) << 30; // 1 GiB
+
 private:
+    struct Entry {
+        HistoryCanvasState state;
+        ext::point deltaTrans; // the translation to apply when restoring this state
+        size_t memoryUsage; // bytes of this state that are not shared with the next state towards currentHistoryState (see HistoryCanvasState::unsharedBytes())
+    };
+
     // fields for undo/redo stack
-    std::stack<std::pair<HistoryCanvasState, ext::point>> undoStack; // the undo stack stores entire CanvasStates (with accompanying deltaTrans) for now
-    std::stack<std::pair<HistoryCanvasState, ext::point>> redoStack; // the redo stack stores entire CanvasStates (with accompanying deltaTrans) for now
+    // the canvas tiles are copy-on-write, so consecutive states share all the tiles that were not modified in between, and each entry only costs the tiles that changed (and a pointer per tile).
+    // if the canvas was resized, nothing can be shared, so the entry is a full copy.
+    std::deque<Entry> undoStack; // the most recent state is at the back; the oldest states at the front are evicted when over the memory budget
+    std::deque<Entry> redoStack; // the next state is at the back
     HistoryCanvasState currentHistoryState; // the canvas state treated as 'current' by the history manager; this is either the state when saveToHistory() was last called, or the state after an undo/redo operation.
+    std::pair<uint64_t, uint64_t> currentCanvasVersion{ 0, 0 }; // the version of the canvas that currentHistoryState was last taken from or given to (see CanvasState::version())
+
+    size_t memoryBudget = DEFAULT_MEMORY_BUDGET; // the maximum total memoryUsage of the entries (the most recent undo entry is always kept)
+    size_t memoryUsage = 0; // the total memoryUsage of the entries in both stacks
 
     // distance of currentHistoryState from the last saved state in history
     // 0 if currentHistoryState is the same as the last saved state
+    // positive if the last saved state is that many undos away, and negative (as a wrapped-around size_t) if it is that many redos away
     // std::nullopt if it's not possible to reach the last saved state using undo/redo
     std::optional<size_t> saveDistance = 0;
 
+    // distance of currentHistoryState from the state being written by a save that has not completed yet, in the same representation as saveDistance
+    // this becomes saveDistance when the save succeeds, since the canvas may have been edited while the file was being written
+    std::optional<size_t> pendingSaveDistance;
+    bool savePending = false;
+
+    /**
+     * Moves currentHistoryState to the given stack, and replaces it with the given state.
+     */
+    void pushCurrentState(std::deque<Entry>& stack, HistoryCanvasState&& newState, const ext::point& deltaTrans) {
+        const size_t entryMemory = currentHistoryState.unsharedBytes(newState);
+        stack.push_back(Entry{ std::move(currentHistoryState), deltaTrans, entryMemory });
+        memoryUsage += entryMemory;
+        currentHistoryState = std::move(newState);
+    }
+
+    /**
+     * Removes the most recent entry of the given stack, and returns it.
+     * @pre the stack is not empty
+     */
+    Entry popEntry(std::deque<Entry>& stack) {
+        Entry entry = std::move(stack.back());
+        stack.pop_back();
+        memoryUsage -= entry.memoryUsage;
+        return entry;
+    }
+
+    /**
+     * Evicts the oldest undo entries until the history fits in the memory budget.
+     */
+    void enforceMemoryBudget() {
+        while (memoryUsage > memoryBudget && undoStack.size() > 1) {
+            memoryUsage -= undoStack.front().memoryUsage;
+            undoStack.pop_front();
+        }
+        // the last saved state might have been evicted
+        for (std::optional<size_t>* distance : { &saveDistance, &pendingSaveDistance }) {
+            if (*distance && static_cast<std::ptrdiff_t>(**distance) > static_cast<std::ptrdiff_t>(undoStack.size())) {
+                *distance = std::nullopt;
+            }
+        }
+    }
+
 public:
     void saveToHistory(const CanvasState& state, const ext::point& deltaTrans) {
+        CIRCUIT_SANDBOX_TRACE_SCOPE("HistoryManager::saveToHistory");
         // note: we save the inverse translation
-        undoStack.emplace(std::move(currentHistoryState), -deltaTrans);
         // save a snapshot of the defaultState (which should be in sync with the simulator)
-        currentHistoryState = state;
-
-        if (saveDistance) {
-            if (*saveDistance < 0) {
-                // it's impossible to reach the original state
-                saveDistance = std::nullopt;
-            }
-            else {
-                ++*saveDistance;
+        pushCurrentState(undoStack, HistoryCanvasState(state), -deltaTrans);
+        currentCanvasVersion = state.version();
+
+        for (std::optional<size_t>* distance : { &saveDistance, &pendingSaveDistance }) {
+            if (*distance) {
+                if (static_cast<std::ptrdiff_t>(**distance) < 0) {
+                    // the last saved state was in the redo stack, so it's impossible to reach the original state
+                    *distance = std::nullopt;
+                }
+                else {
+                    ++**distance;
+                }
             }
         }
 
         // flush the redoStack
-        while (!redoStack.empty()) redoStack.pop();
+        while (!redoStack.empty()) popEntry(redoStack);
+
+        enforceMemoryBudget();
     }
 
     /**
@@ -55,33 +122,53 @@ public:
      * Assumes that relevant undoStack/redoStack is not empty.
      */
     ext::point undo(CanvasState& state) {
-        auto[canvasState, tmpDeltaTrans] = std::move(undoStack.top());
-        undoStack.pop();
+        auto[canvasState, tmpDeltaTrans, entryMemory] = popEntry(undoStack);
 
         // note: we save the inverse of the undo translation into the redo stack
-        redoStack.emplace(std::move(currentHistoryState), -tmpDeltaTrans);
-        // note: explicit CanvasState constructor to lock the weak_ptr before losing the shared_ptrs from `state`
-        state = CanvasState(currentHistoryState = std::move(canvasState));
+        pushCurrentState(redoStack, std::move(canvasState), -tmpDeltaTrans);
+        // note: the history keeps its own copy, but the tiles are shared until either of them is modified
+        state = CanvasState(currentHistoryState);
+        currentCanvasVersion = state.version();
 
         if (saveDistance) --*saveDistance;
+        if (pendingSaveDistance) --*pendingSaveDistance;
 
         return tmpDeltaTrans;
     }
 
     ext::point redo(CanvasState& state) {
-        auto[canvasState, tmpDeltaTrans] = std::move(redoStack.top());
-        redoStack.pop();
+        auto[canvasState, tmpDeltaTrans, entryMemory] = popEntry(redoStack);
 
         // note: we save the inverse of the redo translation into the undo stack
-        undoStack.emplace(std::move(currentHistoryState), -tmpDeltaTrans);
-        // note: explicit CanvasState constructor to lock the weak_ptr before losing the shared_ptrs from `state`
-        state = CanvasState(currentHistoryState = std::move(canvasState));
+        pushCurrentState(undoStack, std::move(canvasState), -tmpDeltaTrans);
+        // note: the history keeps its own copy, but the tiles are shared until either of them is modified
+        state = CanvasState(currentHistoryState);
+        currentCanvasVersion = state.version();
 
         if (saveDistance) ++*saveDistance;
+        if (pendingSaveDistance) ++*pendingSaveDistance;
+
+        enforceMemoryBudget();
 
         return tmpDeltaTrans;
     }
 
+    /**
+     * Sets the maximum memory (in bytes) used by the undo and redo stacks, evicting the oldest undo entries if necessary.
+     * The most recent undo entry is kept even if it is larger than the budget.
+     */
+    void setMemoryBudget(size_t bytes) {
+        memoryBudget = bytes;
+        enforceMemoryBudget();
+    }
+
+    /**
+     * Returns the memory (in bytes) used by the undo and redo stacks, not counting the tiles shared with the current state.
+     */
+    size_t getMemoryUsage() const noexcept {
+        return memoryUsage;
+    }
+
     bool canUndo() const {
         return !undoStack.empty();
     }
@@ -95,6 +182,7 @@ public:
      */
     void imbue(const CanvasState& state) {
         currentHistoryState = state;
+        currentCanvasVersion = state.version();
     }
 
     /**
@@ -108,6 +196,14 @@ public:
         return currentHistoryState;
     }
 
+    /**
+     * Returns true if the given state has the same type of element as currentHistoryState everywhere, i.e. saving it to history would not record a change.
+     * This takes constant time if the state was not written to since it was last synchronized with the history, and otherwise only compares the tiles that were written to.
+     */
+    bool sameElementTypes(const CanvasState& state) const {
+        return state.version() == currentCanvasVersion || currentHistoryState.sameElementTypes(state);
+    }
+
     /**
      * returns whether currentHistoryState has changed since the game was last saved
      */
@@ -116,9 +212,21 @@ public:
     }
 
     /**
-     * inform the history manager that the gamestate was saved to disk
+     * inform the history manager that the current gamestate is being saved to disk
+     * the state only counts as saved once setSaved() is called, which may be after more changes were made
+     */
+    void setSaving() {
+        pendingSaveDistance = 0;
+        savePending = true;
+    }
+
+    /**
+     * inform the history manager that the save started by the last setSaving() call has completed
      */
     void setSaved() {
-        saveDistance = 0;
+        if (savePending) {
+            saveDistance = pendingSaveDistance;
+            savePending = false;
+        }
     }
 };
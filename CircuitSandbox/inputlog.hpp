@@ -0,0 +1,104 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <istream>
+#include <ostream>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include "binary_io.hpp"
+
+/**
+ * The levels received by the communicators of a circuit during a run, so that the run can be repeated exactly (see Simulator::startRecordingInputs() and Simulator::startReplayingInputs()).
+ * What a communicator receives depends on when the user clicks, and on how fast files and sockets are read, but the rest of the simulation is deterministic,
+ * so replaying the received levels at the same steps gives bit-identical runs (e.g. to compare the engines, or to benchmark without the noise of the inputs).
+ * Only the changes are stored: each entry is the level that a communicator receives from the given step on (every communicator receives LOW before its first entry).
+ */
+class InputLog {
+public:
+    struct Entry {
+        uint64_t step; // the number of steps since the recording started
+        int32_t communicatorIndex;
+        bool level;
+    };
+
+private:
+    // file format: magic, version, number of communicators, number of entries, then each entry as two varints: the steps since the previous entry, and (communicatorIndex << 1 | level)
+    constexpr static char magic[8] = { 'C', 'C', 'S', 'B', 'I', 'N', 'P', 'T' };
+    constexpr static uint32_t version = 1;
+
+    static void writeVarint(std::ostream& out, uint64_t value) {
+        while (value >= 0x80) {
+            ext::write_binary(out, static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        ext::write_binary(out, static_cast<uint8_t>(value));
+    }
+
+    static bool readVarint(std::istream& in, uint64_t& value) {
+        value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            uint8_t byte;
+            if (!ext::read_binary(in, byte)) return false;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+public:
+    int32_t numCommunicators = 0; // the number of communicators of the circuit that was recorded, since the entries only make sense for the same circuit
+    std::vector<Entry> entries; // in order of step (and of communicator index within a step)
+
+    /**
+     * Writes the log in its compact binary form.
+     */
+    void write(std::ostream& out) const {
+        out.write(magic, sizeof magic);
+        ext::write_binary(out, version);
+        ext::write_binary(out, numCommunicators);
+        ext::write_binary(out, static_cast<uint64_t>(entries.size()));
+        uint64_t lastStep = 0;
+        for (const Entry& entry : entries) {
+            writeVarint(out, entry.step - lastStep);
+            writeVarint(out, static_cast<uint64_t>(entry.communicatorIndex) << 1 | static_cast<uint64_t>(entry.level));
+            lastStep = entry.step;
+        }
+    }
+
+    /**
+     * Reads a log written by write().  Returns false (leaving this log unchanged) if the data is malformed.
+     */
+    bool read(std::istream& in) {
+        char fileMagic[sizeof magic];
+        uint32_t fileVersion;
+        int32_t newNumCommunicators;
+        uint64_t numEntries;
+        if (!in.read(fileMagic, sizeof fileMagic) || std::memcmp(fileMagic, magic, sizeof magic) != 0) return false;
+        if (!ext::read_binary(in, fileVersion) || fileVersion != version) return false;
+        if (!ext::read_binary(in, newNumCommunicators) || newNumCommunicators < 0 || !ext::read_binary(in, numEntries)) return false;
+        std::vector<Entry> newEntries;
+        uint64_t step = 0;
+        for (uint64_t i = 0; i != numEntries; ++i) {
+            uint64_t delta, communicatorAndLevel;
+            if (!readVarint(in, delta) || !readVarint(in, communicatorAndLevel) || (communicatorAndLevel >> 1) >= static_cast<uint64_t>(newNumCommunicators)) return false;
+            step += delta;
+            newEntries.push_back(Entry{ step, static_cast<int32_t>(communicatorAndLevel >> 1), static_cast<bool>(communicatorAndLevel & 1) });
+        }
+        numCommunicators = newNumCommunicators;
+        entries = std::move(newEntries);
+        return true;
+    }
+};
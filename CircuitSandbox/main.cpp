@@ -20,12 +20,19 @@ processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
 #include <stdexcept>
 #include <iostream>
 #include <string>
+#include <memory>
 
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include <nfd.h>
 
 #include "mainwindow.hpp"
+#include "fileopenaction.hpp"
+#include "batchrunner.hpp"
+#include "simulationserver.hpp"
+#include "simulationcluster.hpp"
+#include "fileutils.hpp"
+#include "tracing.hpp"
 
 
 using namespace std::literals::string_literals; // gives the 's' suffix for strings
@@ -56,13 +63,37 @@ struct InitGuard {
 };
 
 int main(int argc, char* argv[]) {
+    CIRCUIT_SANDBOX_TRACE_THREAD("main");
+    if (argc >= 2 && argv[1] == std::string(CCSB_BATCH_ARGUMENT)) {
+        // no window, so SDL is not initialized at all
+        const int exitCode = BatchRunner::run(argc - 2, argv + 2, argv[0]);
+        CIRCUIT_SANDBOX_TRACE_WRITE();
+        return exitCode;
+    }
+    if (argc >= 2 && argv[1] == std::string(CCSB_SERVE_ARGUMENT)) {
+        const int exitCode = SimulationServer::run(argc - 2, argv + 2, argv[0]);
+        CIRCUIT_SANDBOX_TRACE_WRITE();
+        return exitCode;
+    }
+    if (argc >= 2 && argv[1] == std::string(CCSB_NODE_ARGUMENT)) {
+        const int exitCode = ClusterNode::run(argc - 2, argv + 2, argv[0]);
+        CIRCUIT_SANDBOX_TRACE_WRITE();
+        return exitCode;
+    }
     try {
+        const bool viewOnly = argc >= 3 && argv[1] == std::string(CCSB_VIEW_ONLY_ARGUMENT);
+        // start reading the given file (if it exists) before SDL is initialized and the window is created, so that the two overlap
+        std::unique_ptr<FileTask> openTask;
+        if (argc >= 2 && !viewOnly) openTask = FileOpenAction::startReading(argv[1]);
+
         InitGuard init_guard; // this ensures that all the program-wide init and de-init works even if exceptions are thrown
         MainWindow main_window(argv[0]);
-        if (argc >= 2) {
-            // argv[1] is the file name (if it exists)]
-            char* givenFilePath = argv[1];
-            main_window.start(givenFilePath); // start... with given file path
+        if (viewOnly) {
+            // argv[2] is the file name to open in view-only mode
+            main_window.start(argv[2], true);
+        }
+        else if (openTask) {
+            main_window.start(std::move(openTask)); // start... with the file being read
         }
         else {
             main_window.start(); // this method will block until the window closes (or some exception is thrown)
@@ -70,8 +101,11 @@ int main(int argc, char* argv[]) {
     }
     catch (const std::exception& err) {
         std::cerr << "Error thrown out of MainWindow:  " << err.what() << std::endl;
+        CIRCUIT_SANDBOX_TRACE_WRITE();
         return 1;
     }
 
+    // written after the main window is destroyed, so that the simulator has stopped
+    CIRCUIT_SANDBOX_TRACE_WRITE();
     return 0;
 }
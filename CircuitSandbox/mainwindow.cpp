@@ -12,6 +12,11 @@
 #include <cstring>
 #include <numeric>
 #include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <sstream>
+#include <iomanip>
 
 #include <SDL.h>
 #include <SDL_ttf.h>
@@ -25,11 +30,14 @@
 #include "filenewaction.hpp"
 #include "fileopenaction.hpp"
 #include "filesaveaction.hpp"
+#include "filecheckpointaction.hpp"
 #include "historyaction.hpp"
 #include "eyedropperaction.hpp"
 #include "changesimulationspeedaction.hpp"
+#include "breakpointaction.hpp"
 #include "clipboardaction.hpp"
 #include "launch_browser.hpp"
+#include "tracing.hpp"
 
 #if defined(_WIN32)
 #define WIN32_LEAN_AND_MEAN
@@ -118,6 +126,7 @@ int resizeEventForwarder(void* main_window_void_ptr, SDL_Event* event) {
 
 
 MainWindow::MainWindow(const char* const processName) : stateManager(getSimulatorPeriodFromFPS(std::stold(displayedSimulationFPS))), closing(false), toolbox(*this), playArea(*this), buttonBar(*this, playArea), notificationDisplay(*this), currentEventTarget(nullptr), currentLocationTarget(nullptr), currentAction(*this), clipboard(notificationDisplay), interfaceFont("OpenSans-Bold.ttf", 12), processName(processName) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("MainWindow::MainWindow");
 
     // unset all the input handle selection state
     std::fill_n(selectedToolIndices, NUM_INPUT_HANDLES, EMPTY_INDEX);
@@ -172,6 +181,7 @@ MainWindow::MainWindow(const char* const processName) : stateManager(getSimulato
 
 
 MainWindow::~MainWindow() {
+    textCache.clear(); // the cached textures belong to the renderer
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
 }
@@ -280,6 +290,137 @@ void MainWindow::toggleBeginnerMode() {
     }
 }
 
+void MainWindow::togglePerformanceDisplay() {
+    performanceDisplayVisible = !performanceDisplayVisible;
+    stateManager.setCollectSimulatorStatistics(performanceDisplayVisible);
+    if (performanceDisplayVisible) {
+        // discard what was collected before, and show the display at the next frame
+        stateManager.takeSimulatorStatistics();
+        lastPerformanceDisplayUpdate = Drawable::RenderClock::now() - PERFORMANCE_DISPLAY_INTERVAL;
+        frameTimeTotal = frameTimeMax = Drawable::RenderClock::duration::zero();
+        framesDrawn = 0;
+    }
+    else {
+        for (NotificationDisplay::UniqueNotification& notification : performanceNotifications) {
+            notification.reset();
+        }
+        if (performanceLog.is_open()) togglePerformanceLog();
+    }
+}
+
+void MainWindow::togglePerformanceLog() {
+    if (performanceLog.is_open()) {
+        performanceLog.close();
+        performanceLogNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Performance log stopped", NotificationDisplay::TEXT_COLOR_CANCEL } });
+        return;
+    }
+    if (filePath.empty()) {
+        performanceLogNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error starting performance log: Save the circuit first, so that the log can be written next to it.", NotificationDisplay::TEXT_COLOR_ERROR } });
+        return;
+    }
+    const std::string logPath = filePath + ".performance.csv";
+    performanceLog.open(logPath, std::ios::trunc);
+    if (!performanceLog.is_open()) {
+        performanceLogNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error starting performance log: " + logPath + " cannot be written to.", NotificationDisplay::TEXT_COLOR_ERROR } });
+        return;
+    }
+    performanceLog << "time_s,";
+    Simulator::StepStatistics::writeCsvHeader(performanceLog);
+    performanceLog << ",frames,frame_ns,max_frame_ns,memory_bytes\n";
+    if (!performanceDisplayVisible) togglePerformanceDisplay();
+    performanceLogStart = Drawable::RenderClock::now();
+    performanceLogNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Performance log started ", NotificationDisplay::TEXT_COLOR_ACTION }, { "in "s + getFileName(logPath.c_str()), NotificationDisplay::TEXT_COLOR } });
+}
+
+void MainWindow::saveWaveform() {
+    const Waveform waveform = stateManager.readSimulatorWaveform();
+    if (waveform.probes.empty()) {
+        waveformNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving waveform: Press F5 over an element to add a probe first.", NotificationDisplay::TEXT_COLOR_ERROR } });
+        return;
+    }
+    if (filePath.empty()) {
+        waveformNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving waveform: Save the circuit first, so that the waveform can be written next to it.", NotificationDisplay::TEXT_COLOR_ERROR } });
+        return;
+    }
+    const std::string vcdPath = filePath + ".vcd";
+    std::ofstream vcd(vcdPath, std::ios::trunc);
+    if (vcd.is_open()) waveform.writeVcd(vcd);
+    if (!vcd.is_open() || !vcd) {
+        waveformNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Error saving waveform: " + vcdPath + " cannot be written to.", NotificationDisplay::TEXT_COLOR_ERROR } });
+        return;
+    }
+    waveformNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Waveform saved ", NotificationDisplay::TEXT_COLOR_ACTION }, { "in "s + getFileName(vcdPath.c_str()) + " (" + std::to_string(waveform.endStep - waveform.startStep) + " steps)", NotificationDisplay::TEXT_COLOR } });
+}
+
+// formats a duration with three significant digits in a suitable unit
+static std::string formatDuration(std::chrono::duration<double> duration) {
+    const double seconds = duration.count();
+    std::ostringstream ss;
+    if (seconds >= 1e-3) ss << std::setprecision(3) << seconds * 1e3 << " ms";
+    else if (seconds >= 1e-6) ss << std::setprecision(3) << seconds * 1e6 << " us";
+    else ss << std::setprecision(3) << seconds * 1e9 << " ns";
+    return ss.str();
+}
+
+// formats the given part of a total as a percentage
+static std::string formatShare(Simulator::period_t part, Simulator::period_t total) {
+    return std::to_string(total.count() != 0 ? static_cast<int>(100 * part.count() / total.count()) : 0) + "%";
+}
+
+void MainWindow::updatePerformanceDisplay() {
+    if (!performanceDisplayVisible) return;
+    const Drawable::RenderClock::time_point now = Drawable::RenderClock::now();
+    if (now - lastPerformanceDisplayUpdate < PERFORMANCE_DISPLAY_INTERVAL) return;
+    const std::chrono::duration<double> elapsed = now - lastPerformanceDisplayUpdate;
+    lastPerformanceDisplayUpdate = now;
+
+    const Simulator::StepStatistics statistics = stateManager.takeSimulatorStatistics();
+    NotificationDisplay::Data simulatorLine{ { "Simulator: ", NotificationDisplay::TEXT_COLOR } };
+    NotificationDisplay::Data stepLine{ { "Step: ", NotificationDisplay::TEXT_COLOR } };
+    if (statistics.steps == 0) {
+        simulatorLine.push_back({ "idle", NotificationDisplay::TEXT_COLOR_STATE });
+    }
+    else {
+        simulatorLine.push_back({ std::to_string(static_cast<uint64_t>(statistics.steps / elapsed.count())) + " steps/s", NotificationDisplay::TEXT_COLOR_KEY });
+        simulatorLine.push_back({ " (target " + (displayedSimulationFPS == "0" ? "max"s : displayedSimulationFPS) + "), ", NotificationDisplay::TEXT_COLOR });
+        simulatorLine.push_back({ std::to_string(statistics.missedDeadlines) + " missed deadlines", statistics.missedDeadlines != 0 ? NotificationDisplay::TEXT_COLOR_ERROR : NotificationDisplay::TEXT_COLOR });
+    }
+    if (statistics.sampledSteps != 0) {
+        stepLine.push_back({ "avg " + formatDuration(statistics.stepTime / static_cast<double>(statistics.sampledSteps)) + ", p99 " + formatDuration(statistics.percentileStepTime(0.99)), NotificationDisplay::TEXT_COLOR_KEY });
+        stepLine.push_back({ " (sources " + formatShare(statistics.sourceTime, statistics.stepTime) + ", gates " + formatShare(statistics.gateTime, statistics.stepTime) + ", relays " + formatShare(statistics.relayTime, statistics.stepTime) +
+            ", communicators " + formatShare(statistics.pullTime + statistics.communicatorTime, statistics.stepTime) + ", flood fill " + formatShare(statistics.floodFillTime, statistics.stepTime) + ")", NotificationDisplay::TEXT_COLOR });
+    }
+    else {
+        stepLine.push_back({ "-", NotificationDisplay::TEXT_COLOR });
+    }
+    NotificationDisplay::Data frameLine{ { "Frame: ", NotificationDisplay::TEXT_COLOR } };
+    if (framesDrawn == 0) {
+        frameLine.push_back({ "-", NotificationDisplay::TEXT_COLOR });
+    }
+    else {
+        frameLine.push_back({ "avg " + formatDuration(frameTimeTotal / static_cast<double>(framesDrawn)) + ", max " + formatDuration(frameTimeMax), NotificationDisplay::TEXT_COLOR_KEY });
+        frameLine.push_back({ " (" + std::to_string(static_cast<int>(framesDrawn / elapsed.count())) + " fps)", NotificationDisplay::TEXT_COLOR });
+    }
+    MemoryUsage memoryUsage = stateManager.getMemoryUsage();
+    memoryUsage.clipboards = clipboard.memoryUsage();
+    NotificationDisplay::Data memoryLine{ { "Memory: ", NotificationDisplay::TEXT_COLOR }, { MemoryUsage::format(memoryUsage.total()), NotificationDisplay::TEXT_COLOR_KEY } };
+    memoryLine.push_back({ " (canvas " + MemoryUsage::format(memoryUsage.canvas) + ", history " + MemoryUsage::format(memoryUsage.history) + ", static data " + MemoryUsage::format(memoryUsage.staticData) +
+        ", dynamic data " + MemoryUsage::format(memoryUsage.dynamicData) + ", clipboards " + MemoryUsage::format(memoryUsage.clipboards) + ", communicators " + MemoryUsage::format(memoryUsage.communicators) + ")", NotificationDisplay::TEXT_COLOR });
+    if (performanceLog.is_open()) {
+        performanceLog << std::chrono::duration<double>(now - performanceLogStart).count() << ',';
+        statistics.writeCsvRow(performanceLog);
+        performanceLog << ',' << framesDrawn << ',' << (framesDrawn != 0 ? std::chrono::duration_cast<std::chrono::nanoseconds>(frameTimeTotal).count() / static_cast<int64_t>(framesDrawn) : 0)
+            << ',' << std::chrono::duration_cast<std::chrono::nanoseconds>(frameTimeMax).count() << ',' << memoryUsage.total() << '\n';
+    }
+    frameTimeTotal = frameTimeMax = Drawable::RenderClock::duration::zero();
+    framesDrawn = 0;
+
+    performanceNotifications[0] = notificationDisplay.uniqueModify(std::move(performanceNotifications[0]), NotificationFlags::DEFAULT, std::move(simulatorLine));
+    performanceNotifications[1] = notificationDisplay.uniqueModify(std::move(performanceNotifications[1]), NotificationFlags::DEFAULT, std::move(stepLine));
+    performanceNotifications[2] = notificationDisplay.uniqueModify(std::move(performanceNotifications[2]), NotificationFlags::DEFAULT, std::move(frameLine));
+    performanceNotifications[3] = notificationDisplay.uniqueModify(std::move(performanceNotifications[3]), NotificationFlags::DEFAULT, std::move(memoryLine));
+}
+
 
 void MainWindow::layoutComponents(bool forceLayout) {
 
@@ -331,8 +472,13 @@ void MainWindow::start() {
     startEventLoop();
 }
 
-void MainWindow::start(const char* filePath) {
-    loadFile(filePath);
+void MainWindow::start(const char* filePath, bool viewOnly) {
+    loadFile(filePath, viewOnly);
+    startEventLoop();
+}
+
+void MainWindow::start(std::unique_ptr<FileTask> openTask) {
+    startFileTask(std::move(openTask));
     startEventLoop();
 }
 
@@ -362,10 +508,13 @@ void MainWindow::startEventLoop() {
     // event/drawing loop:
     while (true) {
 
-        // get the next event to process, if any
+        // notifications added while processing events expire relative to renderTime, which may be long ago if no frame was drawn since
+        Drawable::renderTime = Drawable::RenderClock::now();
+
+        // process all the pending events
         while (true) {
             SDL_Event event;
-            if (visible ? SDL_PollEvent(&event) : SDL_WaitEvent(&event)) {
+            if (SDL_PollEvent(&event)) {
 #if defined(_WIN32)
                 if (_sizeMoveTimerRunning) {
                     KillTimer(GetActiveWindow(), SIZE_MOVE_TIMER_ID);
@@ -394,13 +543,62 @@ void MainWindow::startEventLoop() {
                 processEvent(event);
 #endif
                 if (closing) return;
+                renderRequested = true;
             }
             else break;
         }
 
-        // draw everything onto the screen
-        render();
+        if (!visible) {
+            // nothing is drawn, so just wait for the next event
+            SDL_WaitEvent(nullptr);
+            continue;
+        }
+
+        // stop at a breakpoint, and finish the fast-forward if it is done
+        stateManager.updateBreakpoint(*this);
+        stateManager.updateFastForward(*this);
+
+        // swap in the recompiled simulation if it is ready
+        stateManager.updateBackgroundCompile();
+
+        // finish opening or saving the file if it is done
+        updateFileTask();
+
+        // refresh the performance display if it is time to
+        updatePerformanceDisplay();
+
+        // draw everything onto the screen, but only if something might have changed since the previous frame
+        const Drawable::RenderClock::time_point now = Drawable::RenderClock::now();
+        const Drawable::RenderClock::time_point earliestFrameTime = lastRenderTime + minFrameInterval;
+        Drawable::RenderClock::time_point wakeTime = std::max(nextRenderTime(), earliestFrameTime);
+        if (wakeTime <= now) {
+            render();
+            continue;
+        }
+
+        // otherwise sleep until the next event arrives, or until something has to be drawn
+        if (stateManager.simulatorBusy() || fileTask) {
+            // the simulator and the file task don't send events, so keep checking on them
+            wakeTime = std::min(wakeTime, std::max(now + BUSY_POLL_INTERVAL, earliestFrameTime));
+        }
+        if (performanceDisplayVisible) {
+            wakeTime = std::min(wakeTime, lastPerformanceDisplayUpdate + PERFORMANCE_DISPLAY_INTERVAL);
+        }
+        if (wakeTime == Drawable::RenderClock::time_point::max()) {
+            SDL_WaitEvent(nullptr);
+        }
+        else {
+            const auto timeout = std::chrono::ceil<std::chrono::milliseconds>(wakeTime - now).count();
+            SDL_WaitEventTimeout(nullptr, static_cast<int>(std::min<decltype(timeout)>(timeout, std::numeric_limits<int>::max())));
+        }
+    }
+}
+
+Drawable::RenderClock::time_point MainWindow::nextRenderTime() const {
+    if (renderRequested || playArea.isAnimating() || stateManager.liveStateChanged()) {
+        return Drawable::RenderClock::time_point::min();
     }
+    return notificationDisplay.nextRedrawTime();
 }
 
 
@@ -592,11 +790,14 @@ void MainWindow::processKeyboardEvent(const SDL_KeyboardEvent& event) {
                 case SDL_SCANCODE_A: // Select all
                     SelectionAction::startBySelectingAll(*this, currentAction.getStarter());
                     return;
+                case SDL_SCANCODE_K: // Save simulation checkpoint (or restore it with Shift)
+                    FileCheckpointAction::start(*this, modifiers, currentAction.getStarter());
+                    return;
                 case SDL_SCANCODE_N: // Spawn new instance
                     FileNewAction::start(*this, currentAction.getStarter());
                     return;
-                case SDL_SCANCODE_O: // Open file
-                    FileOpenAction::start(*this, playArea, currentAction.getStarter());
+                case SDL_SCANCODE_O: // Open file (or view it with Shift)
+                    FileOpenAction::start(*this, playArea, modifiers, currentAction.getStarter());
                     return;
                 case SDL_SCANCODE_S: // Save file
                     FileSaveAction::start(*this, modifiers, currentAction.getStarter());
@@ -653,6 +854,30 @@ void MainWindow::processKeyboardEvent(const SDL_KeyboardEvent& event) {
                 case SDL_SCANCODE_B:
                     toggleBeginnerMode();
                     return;
+                case SDL_SCANCODE_F3:
+                    if (modifiers & KMOD_SHIFT) {
+                        togglePerformanceLog();
+                    }
+                    else {
+                        togglePerformanceDisplay();
+                    }
+                    return;
+                case SDL_SCANCODE_F4:
+                    playArea.toggleHeatmap();
+                    return;
+                case SDL_SCANCODE_F5:
+                    if (modifiers & KMOD_SHIFT) {
+                        saveWaveform();
+                    }
+                    else {
+                        playArea.toggleProbe();
+                    }
+                    return;
+                case SDL_SCANCODE_F6:
+                    if (const std::optional<ext::point> canvasPoint = playArea.getMouseoverCanvasPoint()) {
+                        BreakpointAction::start(*this, renderer, *canvasPoint, currentAction.getStarter());
+                    }
+                    return;
                 case SDL_SCANCODE_F1: [[fallthrough]];
                 case SDL_SCANCODE_HELP:
                     if (WebResource::launch(WebResource::USER_MANUAL)) {
@@ -664,9 +889,16 @@ void MainWindow::processKeyboardEvent(const SDL_KeyboardEvent& event) {
                 }
             }
             switch (event.keysym.scancode) { // using the scancode layout so that keys will be in the same position if the user has a non-qwerty keyboard
-            case SDL_SCANCODE_RIGHT: // Step simulator
+            case SDL_SCANCODE_RIGHT: // Step simulator (or fast-forward with Shift)
                 currentAction.reset();
-                stateManager.stepSimulator();
+                if (modifiers & KMOD_SHIFT) {
+                    if (!event.repeat && !stateManager.simulatorRunning()) {
+                        stateManager.fastForwardSimulator(*this, StateManager::DEFAULT_FAST_FORWARD_STEPS);
+                    }
+                }
+                else {
+                    stateManager.stepSimulator();
+                }
                 return;
             default:
                 break;
@@ -688,6 +920,8 @@ void MainWindow::processTextInputEvent(const SDL_TextInputEvent& event) {
 // TODO: needs some way to use the old data when resizing, for consistency?
 void MainWindow::render() {
     Drawable::renderTime = Drawable::RenderClock::now();
+    lastRenderTime = Drawable::renderTime;
+    renderRequested = false;
 
     // Clear the window with a black background
     SDL_SetRenderDrawColor(renderer, backgroundColor.r, backgroundColor.g, backgroundColor.b, 255);
@@ -712,11 +946,36 @@ void MainWindow::render() {
 
     // Then display to the user
     SDL_RenderPresent(renderer);
+
+    if (performanceDisplayVisible) {
+        const Drawable::RenderClock::duration frameTime = Drawable::RenderClock::now() - Drawable::renderTime;
+        frameTimeTotal += frameTime;
+        frameTimeMax = std::max(frameTimeMax, frameTime);
+        ++framesDrawn;
+    }
 }
 
 
-void MainWindow::loadFile(const char* filePath) {
-    FileOpenAction::start(*this, playArea, currentAction.getStarter(), filePath);
+void MainWindow::loadFile(const char* filePath, bool viewOnly) {
+    FileOpenAction::start(*this, playArea, viewOnly ? KMOD_SHIFT : KMOD_NONE, currentAction.getStarter(), filePath);
+}
+
+void MainWindow::updateFileTask() {
+    if (!fileTask) return;
+    if (fileTask->finished()) {
+        FileTask::finisher_t finisher = fileTask->takeFinisher();
+        fileTask = nullptr;
+        fileTaskNotification = NotificationDisplay::UniqueNotification();
+        finisher(*this);
+        renderRequested = true;
+        return;
+    }
+    // only update the notification when the displayed number changes, since it has to be re-rendered
+    const int percent = static_cast<int>(fileTask->getProgress() * 100);
+    if (percent != fileTaskDisplayedPercent) {
+        fileTaskDisplayedPercent = percent;
+        fileTaskNotification = notificationDisplay.uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { fileTask->getDescription() + " ", NotificationDisplay::TEXT_COLOR_ACTION }, { std::to_string(percent) + "%", NotificationDisplay::TEXT_COLOR_KEY } });
+    }
 }
 
 void MainWindow::setUnsaved(bool unsaved) {
@@ -758,6 +1017,14 @@ void MainWindow::bindTool(size_t inputHandleIndex, size_t tool_index) {
 }
 
 // throws std::logic_error or its derived classes
+void MainWindow::setMaxFrameRate(long double fps) {
+    if (fps < 0) {
+        throw std::logic_error("The frame rate cannot be less than zero.");
+    }
+    minFrameInterval = fps == 0.0 ? Drawable::RenderClock::duration::zero() : std::chrono::duration_cast<Drawable::RenderClock::duration>(std::chrono::duration<long double>(1.0L / fps));
+    stateManager.setPublishInterval(minFrameInterval);
+}
+
 Simulator::period_t MainWindow::getSimulatorPeriodFromFPS(long double fps) {
     // try to parse and save the fps of the simulator
     using rep = Simulator::period_t::rep;
@@ -18,6 +18,11 @@
 #include <optional>
 #include <vector>
 #include <tuple>
+#include <memory>
+#include <string>
+#include <array>
+#include <utility>
+#include <fstream>
 #if defined(__APPLE__)
 #include <mutex>
 #include <atomic>
@@ -33,8 +38,10 @@
 #include "notificationdisplay.hpp"
 #include "control.hpp"
 #include "font.hpp"
+#include "textcache.hpp"
 #include "statemanager.hpp"
 #include "clipboardmanager.hpp"
+#include "filetask.hpp"
 #include "tag_tuple.hpp"
 
 
@@ -89,12 +96,38 @@ private:
 
     bool visible = true; // whether the window is visible (used to avoid rendering if window is not visible)
 
+    // frame pacing: a frame is only drawn if something might have changed since the previous frame, and at least minFrameInterval after it
+    bool renderRequested = true; // whether an event was processed since the previous frame
+    Drawable::RenderClock::time_point lastRenderTime = Drawable::RenderClock::time_point::min(); // when the previous frame was drawn
+    Drawable::RenderClock::duration minFrameInterval = Drawable::RenderClock::duration::zero(); // zero = only limited by vsync
+    // how often to check for new simulation states (and fast-forward, background compilation or file progress) while the simulator or a file task is busy and there is nothing else to draw
+    constexpr static Drawable::RenderClock::duration BUSY_POLL_INTERVAL = std::chrono::milliseconds(1);
+
     // RAII object so we can remove the old notification immediately if the user toggles multiples times in succession
     NotificationDisplay::UniqueNotification toggleBeginnerModeNotification;
     NotificationDisplay::UniqueNotification noUndoNotification;
     NotificationDisplay::UniqueNotification noRedoNotification;
     NotificationDisplay::UniqueNotification changeSpeedNotification;
 
+    // performance display (toggled with F3), which shows the simulator statistics, the frame times and the memory usage as notifications, refreshed every PERFORMANCE_DISPLAY_INTERVAL
+    bool performanceDisplayVisible = false;
+    Drawable::RenderClock::time_point lastPerformanceDisplayUpdate; // when the statistics shown were taken
+    Drawable::RenderClock::duration frameTimeTotal = Drawable::RenderClock::duration::zero(); // time spent in render() since lastPerformanceDisplayUpdate
+    Drawable::RenderClock::duration frameTimeMax = Drawable::RenderClock::duration::zero();
+    size_t framesDrawn = 0;
+    std::array<NotificationDisplay::UniqueNotification, 4> performanceNotifications;
+    // CSV file that each refresh of the performance display is also written to (toggled with Shift+F3), if it is open
+    std::ofstream performanceLog;
+    Drawable::RenderClock::time_point performanceLogStart;
+    NotificationDisplay::UniqueNotification performanceLogNotification;
+    NotificationDisplay::UniqueNotification waveformNotification;
+    constexpr static Drawable::RenderClock::duration PERFORMANCE_DISPLAY_INTERVAL = std::chrono::milliseconds(500);
+
+    // the file being opened or saved in the background, if any
+    std::unique_ptr<FileTask> fileTask;
+    NotificationDisplay::UniqueNotification fileTaskNotification;
+    int fileTaskDisplayedPercent = -1; // the progress shown in fileTaskNotification
+
 #if defined(_WIN32)
     unsigned long mainThreadId;
 #endif
@@ -218,10 +251,12 @@ private:
     friend class PlayAreaAction;
     friend class KeyboardEventHook;
     friend class MainWindowEventHook;
-    friend void PlayArea::changeMouseoverElement(const CanvasState::element_variant_t&);
+    friend void PlayArea::changeMouseoverElement(const Description::ElementVariant_t&);
     friend class ClipboardAction;
     friend class HistoryAction;
     friend class ChangeSimulationSpeedAction;
+    friend class BreakpointAction;
+    friend class FileOpenAction;
 
     /**
      * Process the event that has occurred (called by start())
@@ -238,6 +273,11 @@ private:
      * Renders everything to the screen
      */
     void render();
+
+    /**
+     * The earliest time at which the next frame should be drawn (ignoring minFrameInterval), time_point::max() if nothing will change until the next event.
+     */
+    Drawable::RenderClock::time_point nextRenderTime() const;
 #if defined(_WIN32)
     // hack for issue with window resizing on Windows and Mac not giving live events
     friend int resizeEventForwarder(void* main_window_void_ptr, SDL_Event* event);
@@ -280,6 +320,33 @@ private:
      */
     void toggleBeginnerMode();
 
+    /**
+     * Updates the progress notification of the file task, and calls its finisher if it is done.
+     * This should be called once per frame.
+     */
+    void updateFileTask();
+
+    /**
+     * Show or hide the performance display
+     */
+    void togglePerformanceDisplay();
+
+    /**
+     * Start or stop writing the performance display to a CSV file next to the current file (showing the display if necessary)
+     */
+    void togglePerformanceLog();
+
+    /**
+     * Writes the recorded levels of the probes (see PlayArea::toggleProbe()) to a VCD file next to the current file.
+     */
+    void saveWaveform();
+
+    /**
+     * Refreshes the performance display if it is visible and PERFORMANCE_DISPLAY_INTERVAL has passed since it was last refreshed.
+     * This should be called once per frame.
+     */
+    void updatePerformanceDisplay();
+
 public:
 
     // SDL and window stuff:
@@ -289,6 +356,9 @@ public:
     // fonts (loaded in constructor and closed in destructor)
     Font interfaceFont;
 
+    // text rendered by the controls, shared so that repeated strings are not rasterised again
+    TextCache textCache;
+
 
     /**
      * Stores the element that is selected by the toolbox.
@@ -317,13 +387,22 @@ public:
      * 'filePath' overload will open the given file.
      */
     void start();
-    void start(const char* filePath);
+    void start(const char* filePath, bool viewOnly = false);
+    // 'openTask' overload swaps in the file read by the given task (see FileOpenAction::startReading()), which may have been started before the window was created
+    void start(std::unique_ptr<FileTask> openTask);
 
     /**
-     * Overwrite the current canvas state with the given file.
+     * Overwrite the current canvas state with the given file (in view-only mode if viewOnly is true, see FileOpenAction).
      * This will reset the history system.
      */
-    void loadFile(const char* filePath);
+    void loadFile(const char* filePath, bool viewOnly = false);
+
+    /**
+     * Limits how often the window is redrawn, independently of the simulation speed (0 = no limit other than vsync).
+     * The simulator also publishes states for rendering at most this often, since the ones in between would not be drawn.
+     * throws std::logic_error if fps is negative
+     */
+    void setMaxFrameRate(long double fps);
 
     /**
      * Set the asterisk in the title bar
@@ -345,6 +424,34 @@ public:
      */
     bool hasFilePath() const;
 
+    /**
+     * Starts reading or writing a file in the background (see FileTask), showing its progress as a notification.
+     * description is shown in the notification, e.g. "Opening".
+     * @pre fileTaskRunning() is false
+     */
+    template <typename Work>
+    void startFileTask(std::string description, Work&& work) {
+        startFileTask(std::make_unique<FileTask>(std::move(description), std::forward<Work>(work)));
+    }
+
+    /**
+     * Shows the progress of a file task that was already started, and calls its finisher when it is done.
+     * @pre fileTaskRunning() is false
+     */
+    void startFileTask(std::unique_ptr<FileTask> task) {
+        assert(!fileTask);
+        fileTaskDisplayedPercent = -1;
+        fileTask = std::move(task);
+        updateFileTask();
+    }
+
+    /**
+     * Whether a file is being opened or saved in the background.
+     */
+    bool fileTaskRunning() const {
+        return static_cast<bool>(fileTask);
+    }
+
     /**
      * Bind a tool to an input handle. If there is already a handle bound to the tool, swap the handles.
      */
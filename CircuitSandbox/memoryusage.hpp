@@ -0,0 +1,62 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <ostream>
+#include <cstddef>
+
+/**
+ * The number of bytes used by each of the large structures of a circuit, so that it can be seen which of them is to blame when a board takes too much memory.
+ * Each structure reports its own bytes (see StateManager::getMemoryUsage()); these are the sizes of what was allocated, without the overhead of the allocator.
+ */
+struct MemoryUsage {
+    size_t canvas = 0; // the canvas being edited, counting the tiles it shares with the history (see CanvasState::memoryUsage())
+    size_t history = 0; // the undo and redo stacks, not counting the tiles shared with the canvas (see HistoryManager::getMemoryUsage())
+    size_t staticData = 0; // the compiled circuit, and the compilations kept for undo and redo (see Simulator::getStaticDataMemoryUsage())
+    size_t dynamicData = 0; // the simulation state buffers (see Simulator::getDynamicDataMemoryUsage())
+    size_t clipboards = 0; // the clipboards mapped by this process, in shared memory or not (see ClipboardStore::memoryUsage())
+    size_t communicators = 0; // the communicators and their queues (see Communicator::memoryUsage())
+
+    size_t total() const noexcept {
+        return canvas + history + staticData + dynamicData + clipboards + communicators;
+    }
+
+    /**
+     * Formats a number of bytes with three significant digits in a suitable binary unit, e.g. "1.5 MiB".
+     */
+    static std::string format(size_t bytes) {
+        constexpr static const char* units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+        double value = static_cast<double>(bytes);
+        size_t unit = 0;
+        while (value >= 1024 && unit + 1 != std::size(units)) {
+            value /= 1024;
+            ++unit;
+        }
+        std::ostringstream ss;
+        if (unit == 0) ss << bytes;
+        else ss << std::setprecision(3) << value;
+        ss << ' ' << units[unit];
+        return ss.str();
+    }
+
+    /**
+     * Writes each part and the total on one line, e.g. for the output of the batch runner.
+     */
+    friend std::ostream& operator<<(std::ostream& out, const MemoryUsage& usage) {
+        return out << "canvas " << format(usage.canvas) << ", history " << format(usage.history) << ", static data " << format(usage.staticData)
+            << ", dynamic data " << format(usage.dynamicData) << ", clipboards " << format(usage.clipboards) << ", communicators " << format(usage.communicators)
+            << " (total " << format(usage.total()) << ")";
+    }
+};
@@ -0,0 +1,150 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <random>
+#include <cstdlib>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "simulator.hpp"
+
+/**
+ * Builds the native step of a compiled circuit (see Simulator::writeNativeStepSource()) with the C++ compiler of the machine, loads it, and gives it to the simulator.
+ * The source and the shared library are written to a new directory in the temporary directory, which is removed when the library is unloaded.
+ * The compiler is run as `compiler source -o library` (or `compiler source /Fe:library` on Windows) with the flags for a shared library, where compiler is the CIRCUIT_SANDBOX_NATIVE_CXX environment variable,
+ * or c++ (cl on Windows) if it is not set.
+ * The library is unloaded when this object is destroyed, so the simulator must go back to interpreting (or be destroyed) first.
+ */
+class NativeStepLibrary {
+private:
+#if defined(_WIN32)
+    HMODULE library = nullptr;
+#else
+    void* library = nullptr;
+#endif
+    std::filesystem::path directory; // holds the source and the library (empty if there is none)
+
+    void unload() noexcept {
+        if (library) {
+#if defined(_WIN32)
+            FreeLibrary(library);
+#else
+            dlclose(library);
+#endif
+            library = nullptr;
+        }
+        if (!directory.empty()) {
+            std::error_code ec;
+            std::filesystem::remove_all(directory, ec);
+            directory.clear();
+        }
+    }
+
+    void* symbol(const char* name) const noexcept {
+#if defined(_WIN32)
+        return reinterpret_cast<void*>(GetProcAddress(library, name));
+#else
+        return dlsym(library, name);
+#endif
+    }
+
+public:
+    NativeStepLibrary() noexcept = default;
+    NativeStepLibrary(const NativeStepLibrary&) = delete;
+    NativeStepLibrary& operator=(const NativeStepLibrary&) = delete;
+    ~NativeStepLibrary() {
+        unload();
+    }
+
+    /**
+     * Builds and loads the native step of the circuit that the simulator has compiled, and gives it to the simulator with Simulator::setNativeStep().
+     * Returns false, and leaves the simulator interpreting, if any of this fails; error is then set to the reason.
+     * Any library that was loaded before is unloaded, so the simulator must not be using it any more.
+     * @pre simulation is currently stopped.
+     */
+    bool build(Simulator& simulator, std::string& error) {
+        unload();
+        simulator.setNativeStep(nullptr, 0);
+
+        // a new directory every time, so that simultaneous builds never see each other's files
+        std::error_code ec;
+        directory = std::filesystem::temp_directory_path(ec) / ("circuit-sandbox-native-" + std::to_string(simulator.nativeStepFingerprint()) + "-" + std::to_string(std::random_device()()));
+        if (ec || !std::filesystem::create_directory(directory, ec)) {
+            error = "cannot create " + directory.string();
+            directory.clear();
+            return false;
+        }
+        const std::filesystem::path source = directory / "step.cpp";
+#if defined(_WIN32)
+        const std::filesystem::path libraryPath = directory / "step.dll";
+#else
+        const std::filesystem::path libraryPath = directory / "step.so";
+#endif
+
+        {
+            std::ofstream out(source);
+            simulator.writeNativeStepSource(out);
+            if (!out.flush()) {
+                error = "cannot write " + source.string();
+                unload();
+                return false;
+            }
+        }
+        const char* compiler = std::getenv("CIRCUIT_SANDBOX_NATIVE_CXX");
+#if defined(_WIN32)
+        const std::string command = std::string(compiler ? compiler : "cl") + " /nologo /O2 /LD \"" + source.string() + "\" /Fe:\"" + libraryPath.string() + "\" /Fo:\"" + (directory / "step.obj").string() + "\" > nul";
+        // cmd.exe removes the first and last quotes of the command
+        const int status = std::system(("\"" + command + "\"").c_str());
+#else
+        const std::string command = std::string(compiler ? compiler : "c++") + " -std=c++17 -O2 -shared -fPIC \"" + source.string() + "\" -o \"" + libraryPath.string() + "\"";
+        const int status = std::system(command.c_str());
+#endif
+        if (status != 0) {
+            error = "cannot compile the native step (" + command + ")";
+            unload();
+            return false;
+        }
+
+#if defined(_WIN32)
+        library = LoadLibraryW(libraryPath.c_str());
+#else
+        library = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+        if (!library) {
+            error = "cannot load " + libraryPath.string();
+            unload();
+            return false;
+        }
+        const auto* libraryFingerprint = static_cast<const uint64_t*>(symbol("circuit_sandbox_native_fingerprint"));
+        const auto function = reinterpret_cast<Simulator::NativeStepFunction>(symbol("circuit_sandbox_native_step"));
+        if (!libraryFingerprint || !function || !simulator.setNativeStep(function, *libraryFingerprint)) {
+            error = libraryPath.string() + " is not the native step of this circuit";
+            unload();
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,193 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <tuple>
+#include <type_traits>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <cstdint>
+
+#include "netlist.hpp"
+#include "point.hpp"
+
+// writes an integer in little-endian byte order, whatever the byte order of this machine
+template <typename T>
+static void writeLittleEndian(std::ostream& out, T value) {
+    std::make_unsigned_t<T> bits = static_cast<std::make_unsigned_t<T>>(value);
+    char bytes[sizeof(T)];
+    for (char& byte : bytes) {
+        byte = static_cast<char>(bits & 0xFF);
+        bits = static_cast<std::make_unsigned_t<T>>(bits >> 8);
+    }
+    out.write(bytes, sizeof bytes);
+}
+
+
+void Netlist::write(const Simulator& simulator, std::ostream& out) {
+    const Simulator::StaticData& staticData = simulator.staticData;
+    const int32_t numComponents = static_cast<int32_t>(staticData.components.size);
+    const int32_t numRelayPixels = static_cast<int32_t>(staticData.relayPixels.size);
+    out.write("CCSBNETL", 8);
+    writeLittleEndian(out, uint32_t{ 1 });
+    writeLittleEndian(out, numComponents);
+    writeLittleEndian(out, numRelayPixels);
+    writeLittleEndian(out, static_cast<int32_t>(staticData.communicators.size));
+
+    writeLittleEndian(out, static_cast<int32_t>(staticData.sources.size));
+    for (const Simulator::SimulatorSource& source : staticData.sources) {
+        writeLittleEndian(out, source.outputComponent);
+    }
+
+    // only the groups with any elements are written
+    const auto writeGroups = [&](const auto& packs, auto outputOf) {
+        uint32_t numGroups = 0;
+        packs.forEach([&](const auto& pack) {
+            pack.forEach([&](const auto& elements) {
+                if (elements.size != 0) ++numGroups;
+            });
+        });
+        writeLittleEndian(out, numGroups);
+        packs.forEach([&](const auto& pack) {
+            pack.forEach([&](const auto& elements) {
+                if (elements.size == 0) return;
+                using ElementType = std::decay_t<decltype(*elements.begin())>;
+                writeLittleEndian(out, static_cast<uint8_t>((ElementType::conjunctive ? 1 : 0) | (ElementType::inverted ? 2 : 0)));
+                writeLittleEndian(out, static_cast<uint8_t>(std::tuple_size_v<decltype(ElementType::inputComponents)>));
+                writeLittleEndian(out, static_cast<int32_t>(elements.size));
+                for (const ElementType& element : elements) {
+                    for (int32_t input : element.inputComponents) {
+                        writeLittleEndian(out, input);
+                    }
+                    writeLittleEndian(out, outputOf(element));
+                }
+            });
+        });
+    };
+    writeGroups(staticData.logicGates, [](const auto& gate) {
+        return gate.outputComponent;
+    });
+    writeGroups(staticData.relays, [](const auto& relay) {
+        return relay.outputRelayPixel;
+    });
+
+    for (const Simulator::SimulatorCommunicator& communicator : staticData.communicators) {
+        writeLittleEndian(out, communicator.inputComponentsEnd - communicator.inputComponentsBegin);
+        for (int32_t i = communicator.inputComponentsBegin; i != communicator.inputComponentsEnd; ++i) {
+            writeLittleEndian(out, staticData.communicatorInputList.data[i]);
+        }
+        writeLittleEndian(out, communicator.outputComponent);
+    }
+
+    for (const Simulator::Component& component : staticData.components) {
+        writeLittleEndian(out, component.adjRelayPixelsEnd - component.adjRelayPixelsBegin);
+        for (int32_t i = component.adjRelayPixelsBegin; i != component.adjRelayPixelsEnd; ++i) {
+            writeLittleEndian(out, staticData.adjComponentList.data[i]);
+        }
+    }
+    for (const Simulator::RelayPixel& relayPixel : staticData.relayPixels) {
+        writeLittleEndian(out, relayPixel.adjComponentsEnd - relayPixel.adjComponentsBegin);
+        for (int32_t i = relayPixel.adjComponentsBegin; i != relayPixel.adjComponentsEnd; ++i) {
+            writeLittleEndian(out, staticData.adjRelayPixelList.data[i]);
+        }
+    }
+
+    // components first, then relay pixels, like the vertices of the netlist
+    using PixelType = Simulator::StaticData::DisplayedPixel::PixelType;
+    std::vector<ext::point> positions(static_cast<size_t>(numComponents) + numRelayPixels, ext::point{ -1, -1 });
+    for (int32_t y = 0; y != staticData.pixels.height(); ++y) {
+        for (int32_t x = 0; x != staticData.pixels.width(); ++x) {
+            const Simulator::StaticData::DisplayedPixel& pixel = staticData.pixels[{ x, y }];
+            const auto visit = [&](size_t vertex) {
+                if (positions[vertex].x == -1) positions[vertex] = ext::point{ x, y };
+            };
+            switch (pixel.type) {
+            case PixelType::COMPONENT: [[fallthrough]];
+            case PixelType::COMMUNICATOR:
+                for (int32_t index : pixel.index) {
+                    if (index != -1) visit(index);
+                }
+                break;
+            case PixelType::RELAY:
+                visit(static_cast<size_t>(numComponents) + pixel.index[0]);
+                break;
+            case PixelType::EMPTY:
+                break;
+            }
+        }
+    }
+    for (const ext::point& position : positions) {
+        writeLittleEndian(out, position.x);
+        writeLittleEndian(out, position.y);
+    }
+}
+
+
+Simulator::NodeAssignment Netlist::balancedAssignment(const Simulator& simulator, uint32_t numNodes) {
+    const Simulator::StaticData& staticData = simulator.staticData;
+    // every gate or relay costs one more than its number of inputs
+    std::vector<uint64_t> componentCosts(staticData.components.size, 0);
+    std::vector<uint64_t> relayPixelCosts(staticData.relayPixels.size, 0);
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                componentCosts[gate.outputComponent] += gate.inputComponents.size() + 1;
+            }
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& relay : y) {
+                relayPixelCosts[relay.outputRelayPixel] += relay.inputComponents.size() + 1;
+            }
+        });
+    });
+
+    // each index goes to the node whose share of the total cost its cost starts in
+    const auto split = [&](const std::vector<uint64_t>& costs) {
+        const uint64_t total = std::max<uint64_t>(std::accumulate(costs.begin(), costs.end(), uint64_t{ 0 }), 1);
+        std::vector<uint32_t> nodes(costs.size());
+        uint64_t before = 0;
+        for (size_t i = 0; i != costs.size(); ++i) {
+            // the indices after the last one with a cost go to the last node
+            nodes[i] = static_cast<uint32_t>(std::min<uint64_t>(before * numNodes / total, numNodes - 1));
+            before += costs[i];
+        }
+        return nodes;
+    };
+
+    Simulator::NodeAssignment assignment;
+    assignment.numNodes = numNodes;
+    assignment.componentNodes = split(componentCosts);
+    assignment.relayPixelNodes = split(relayPixelCosts);
+    return assignment;
+}
+
+
+bool Netlist::readAssignment(const Simulator& simulator, std::istream& in, uint32_t numNodes, Simulator::NodeAssignment& assignment) {
+    const Simulator::StaticData& staticData = simulator.staticData;
+    Simulator::NodeAssignment newAssignment;
+    newAssignment.numNodes = numNodes;
+    newAssignment.componentNodes.resize(staticData.components.size);
+    newAssignment.relayPixelNodes.resize(staticData.relayPixels.size);
+    for (std::vector<uint32_t>* nodes : { &newAssignment.componentNodes, &newAssignment.relayPixelNodes }) {
+        for (uint32_t& node : *nodes) {
+            if (!(in >> node) || node >= numNodes) return false;
+        }
+    }
+    // there must not be anything left
+    in >> std::ws;
+    if (!in.eof()) return false;
+    assignment = std::move(newAssignment);
+    return true;
+}
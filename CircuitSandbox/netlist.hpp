@@ -0,0 +1,55 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+#include "simulator.hpp"
+
+/**
+ * The circuit compiled by a Simulator as a netlist for other tools, and the ways of splitting it between the nodes of a distributed run (see simulationcluster.hpp).
+ * These only read the static data of the simulator, so they can be used whether or not it is running.
+ */
+class Netlist {
+public:
+    /**
+     * Writes the compiled circuit as a netlist, so that other tools can analyse it (e.g. to partition it for a distributed run, see readAssignment()).
+     * If constants have been folded, the folded gates and relays are left out and the components they held high are driven by sources instead.
+     * All the numbers are little-endian, and indices are int32 unless stated otherwise:
+     *   header         "CCSBNETL" [uint32 version = 1] [number of components] [number of relay pixels] [number of communicators]
+     *   sources        [count] then the component driven by each source
+     *   gate groups    [uint32 count] then each group: [uint8 kind] [uint8 number of inputs] [number of gates] then each gate: [input component]... [output component]
+     *   relay groups   [uint32 count] then each group: [uint8 kind] [uint8 number of inputs] [number of relays] then each relay: [input component]... [output relay pixel]
+     *   communicators  each communicator: [number of inputs] [input component]... [output component]
+     *   adjacency      each component: [number of relay pixels] [relay pixel]..., then each relay pixel: [number of components] [component]...
+     *   positions      each component, then each relay pixel: [x] [y] of its first pixel on the canvas in reading order, or -1 -1 if it has none
+     * The kind of a group has bit 0 set if the inputs are combined with AND (otherwise OR), and bit 1 set if the result is inverted; so a gate of kind 3 is a NAND gate,
+     * and a relay of kind 3 is a negative relay.  Gates drive their output component high, and relays make their relay pixel conductive, when the result is true.
+     * Each step computes the result of every gate and relay from the component levels of the previous step, then the levels received by the communicators,
+     * then turns on everything connected to a component that is driven high through conductive relay pixels.
+     */
+    static void write(const Simulator& simulator, std::ostream& out);
+
+    /**
+     * Splits the gates and relays between the given number of nodes, in contiguous ranges of components and of relay pixels with about the same number of gate and relay inputs each
+     * (the components are numbered for locality, see Simulator::renumberForLocality(), so few of them are read across the ranges).
+     */
+    static Simulator::NodeAssignment balancedAssignment(const Simulator& simulator, uint32_t numNodes);
+
+    /**
+     * Reads a node assignment made by an external partitioner: one node number for each component, then one for each relay pixel, separated by whitespace
+     * (the vertices of the netlist written by write() in this order, as METIS writes a partition).
+     * Returns false if the numbers are not all less than numNodes, or there are not as many numbers as components and relay pixels.
+     */
+    static bool readAssignment(const Simulator& simulator, std::istream& in, uint32_t numNodes, Simulator::NodeAssignment& assignment);
+};
@@ -26,6 +26,7 @@
 NotificationDisplay::NotificationDisplay(MainWindow& mainWindow, Flags visibleFlags) : mainWindow(mainWindow), visibleFlags(visibleFlags) {}
 
 void NotificationDisplay::render(SDL_Renderer* renderer) {
+    changed = false;
     // from bottom-left corner
     ext::point currOffset = mainWindow.logicalToPhysicalSize(LOGICAL_OFFSET);
     for (size_t i = 0; i != notifications.size(); ++i) {
@@ -83,6 +84,7 @@ NotificationDisplay::NotificationHandle NotificationDisplay::add(Flags flags, Dr
         notification->layout(mainWindow.renderer, *this);
         NotificationHandle handle(notification);
         notifications.emplace_back(std::move(notification));
+        changed = true;
         return handle;
     }
     else {
@@ -95,6 +97,7 @@ void NotificationDisplay::remove(const NotificationHandle& data) noexcept {
     if (notification && notification->expireTime >= Drawable::renderTime) {
         // set to expire now if it isn't already expired
         notification->expireTime = Drawable::renderTime;
+        changed = true;
     }
 }
 
@@ -106,6 +109,7 @@ NotificationDisplay::NotificationHandle NotificationDisplay::modifyOrAdd(const N
         notification->data = std::move(description);
         notification->expireTime = expire;
         notification->layout(mainWindow.renderer, *this);
+        changed = true;
         return data;
     }
     else {
@@ -119,14 +123,19 @@ void NotificationDisplay::Notification::layout(SDL_Renderer* renderer, Notificat
         return;
     }
 
-    TTF_Font* font = notificationDisplay.mainWindow.interfaceFont;
+    const Font& font = notificationDisplay.mainWindow.interfaceFont;
+    TextCache& textCache = notificationDisplay.mainWindow.textCache;
 
     // proper multiline multicolor text
     int32_t lineHeight = TTF_FontHeight(font);
     const int32_t fullwidth = notificationDisplay.renderArea.w - LOGICAL_OFFSET.x * 2;
     int32_t availableWidth = fullwidth;
-    // surfaces, grouped by line
-    std::vector<std::vector<SDL_Surface*>> surfaces;
+    // pieces of text, grouped by line
+    struct Piece {
+        TextCache::TextHandle text;
+        int32_t width; // may be less than the width of the text, if a single word does not fit in the line
+    };
+    std::vector<std::vector<Piece>> surfaces;
     surfaces.emplace_back();
     for (const ColorText& colorText : data) {
         const char* text = colorText.text.c_str();
@@ -151,36 +160,23 @@ void NotificationDisplay::Notification::layout(SDL_Renderer* renderer, Notificat
                     break;
                 }
             }
-            SDL_Surface* textSurface;
+            TextCache::TextHandle textSurface;
+            int32_t textWidth = 0;
             if (best == done && surfaces.back().empty()) {
-                // even a single word wouldn't fit in the line
+                // even a single word wouldn't fit in the line, so it is cut off when blitting
                 assert(availableWidth > 0);
                 best = ext::next_space(ext::next_non_space(best));
-                std::string tmp(done, best);
-                SDL_Surface* tmpSurface = TTF_RenderText_Blended(font, tmp.c_str(), colorText.color);
-                if (tmpSurface) {
-                    textSurface = create_alpha_surface(availableWidth, tmpSurface->h);
-                    assert(textSurface);
-                    SDL_Rect srcRect{ 0, 0, availableWidth, tmpSurface->h };
-                    SDL_Rect destRect{ 0, 0, availableWidth, tmpSurface->h };
-                    SDL_BlitSurface(tmpSurface, &srcRect, textSurface, &destRect);
-                    SDL_FreeSurface(tmpSurface);
-                }
-                else {
-                    textSurface = nullptr;
-                }
+                textSurface = textCache.renderBlended(font, std::string_view(done, best - done), colorText.color);
+                if (textSurface) textWidth = std::min(availableWidth, textSurface->size().x);
             }
             else if (best != done) {
-                std::string tmp(done, best);
-                textSurface = TTF_RenderText_Blended(font, tmp.c_str(), colorText.color);
-            }
-            else {
-                textSurface = nullptr;
+                textSurface = textCache.renderBlended(font, std::string_view(done, best - done), colorText.color);
+                if (textSurface) textWidth = textSurface->size().x;
             }
             done = best;
             if (textSurface) {
-                surfaces.back().emplace_back(textSurface);
-                availableWidth -= textSurface->w;
+                surfaces.back().push_back(Piece{ std::move(textSurface), textWidth });
+                availableWidth -= textWidth;
                 assert(availableWidth >= 0);
             }
             if (*done) {
@@ -202,9 +198,9 @@ void NotificationDisplay::Notification::layout(SDL_Renderer* renderer, Notificat
         return;
     }
 
-    int32_t max_width = std::accumulate(surfaces.begin(), surfaces.end(), 0, [](int32_t best, const std::vector<SDL_Surface*>& line) {
-        return std::max(best, std::accumulate(line.begin(), line.end(), 0, [](int32_t prev, const SDL_Surface* surface) {
-            return prev + surface->w;
+    int32_t max_width = std::accumulate(surfaces.begin(), surfaces.end(), 0, [](int32_t best, const std::vector<Piece>& line) {
+        return std::max(best, std::accumulate(line.begin(), line.end(), 0, [](int32_t prev, const Piece& piece) {
+            return prev + piece.width;
         }));
     });
 
@@ -218,13 +214,13 @@ void NotificationDisplay::Notification::layout(SDL_Renderer* renderer, Notificat
     ext::point offset = TEXT_PADDING;
     for (auto& line : surfaces) {
         offset.x = TEXT_PADDING.x;
-        for (SDL_Surface* surface : line) {
-            assert(surface);
-            assert(offset.x + surface->w <= fullsurface->w && offset.y + surface->h <= fullsurface->h);
-            SDL_Rect destRect{ offset.x, offset.y, surface->w, surface->h };
-            SDL_BlitSurface(surface, nullptr, fullsurface, &destRect);
-            offset.x += surface->w;
-            SDL_FreeSurface(surface);
+        for (const Piece& piece : line) {
+            SDL_Surface* surface = piece.text->getSurface();
+            assert(offset.x + piece.width <= fullsurface->w && offset.y + surface->h <= fullsurface->h);
+            SDL_Rect srcRect{ 0, 0, piece.width, surface->h };
+            SDL_Rect destRect{ offset.x, offset.y, piece.width, surface->h };
+            SDL_BlitSurface(surface, &srcRect, fullsurface, &destRect);
+            offset.x += piece.width;
         }
         offset.y += lineHeight;
     }
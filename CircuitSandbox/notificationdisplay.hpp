@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <vector>
 #include <memory>
 #include <cstdint>
@@ -78,6 +79,9 @@ private:
     // flags that decide which type of notifications are visible.
     Flags visibleFlags;
 
+    // whether a notification was added, modified, or removed since the last render()
+    bool changed = false;
+
 public:
     using NotificationHandle = std::weak_ptr<Notification>;
 
@@ -153,6 +157,20 @@ public:
         for (auto& notification_ptr : notifications) {
             notification_ptr->layout(renderer, *this);
         }
+        changed = true;
+    }
+
+    /**
+     * The time when the display next has to be redrawn, or time_point::max() if nothing will change until another notification is added.
+     * This is no later than the current time if the notifications changed since the last render(), or if a notification is fading out.
+     */
+    Drawable::RenderClock::time_point nextRedrawTime() const noexcept {
+        if (changed) return Drawable::RenderClock::time_point::min();
+        Drawable::RenderClock::time_point ret = Drawable::RenderClock::time_point::max();
+        for (const auto& notification_ptr : notifications) {
+            ret = std::min(ret, notification_ptr->expireTime);
+        }
+        return ret;
     }
 
     /**
@@ -228,6 +246,7 @@ public:
         for (size_t i = 0; i != notifications.size(); ++i) {
             if (!(flags & notifications[i]->flags)) {
                 notifications.erase(notifications.begin() + i--);
+                changed = true;
             }
         }
         // return the old flags
@@ -14,12 +14,14 @@
 #include <type_traits>
 #include <variant>
 #include <optional>
+#include <utility>
 #include <vector>
 #include <numeric>
+#include <algorithm>
+#include <tuple>
 
 #include <SDL.h>
 #include "point.hpp"
-#include "reduce.hpp"
 #include "saveableaction.hpp"
 #include "statemanager.hpp"
 #include "playarea.hpp"
@@ -111,14 +113,12 @@ private:
     // notification
     NotificationDisplay::UniqueNotification notification;
 
-    template <typename NewPencilType = PencilType, typename ElementVariant>
-    bool change(ElementVariant& element) {
-        if (!std::holds_alternative<CanvasStateVariantElement_t<NewPencilType>>(element)) {
-            element = CanvasStateVariantElement_t<NewPencilType>{};
-            return true;
-        }
-        return false;
-    }
+    // an element written by the stroke, and the index of the polyline segment that wrote it
+    struct StrokePixel {
+        ext::point pt;
+        size_t segment;
+        CanvasState::element_variant_t element;
+    };
 
 public:
 
@@ -128,64 +128,99 @@ public:
 
     ~PencilAction() override {
         // commit the state
+        // the stroke is first collected into the set of elements that actually change, and then applied in a single pass over the canvas,
+        // so that the canvas is only extended to (and only recompiled around) what was changed
         CanvasState& outputState = this->canvas();
-        ext::point minPt = ext::reduce(keyPoints.begin(), keyPoints.end(), ext::point::max(), [](const ext::point& pt1, const ext::point& pt2) {
-            return min(pt1, pt2);
-        });
-        ext::point maxPt = ext::reduce(keyPoints.begin(), keyPoints.end(), ext::point::min(), [](const ext::point& pt1, const ext::point& pt2) {
-            return max(pt1, pt2);
-        }) + ext::point(1, 1); // extra (1, 1) for past-the-end required by outputState.extend()
-        this->deltaTrans = outputState.extend(minPt, maxPt); // this is okay because actionState is guaranteed to be non-empty
+        auto elementAt = [&](const ext::point& pt) {
+            return outputState.contains(pt) ? outputState[pt] : CanvasState::element_variant_t{};
+        };
 
-        // whether we actually changed anything
-        bool hasChanges = false;
+        std::vector<StrokePixel> stroke;
+        auto draw = [&](const ext::point& pt, size_t segment, auto element) {
+            stroke.push_back(StrokePixel{ pt, segment, element });
+        };
 
         // check if the PencilAction was a single click instead of a drag
         // clicking on a gate/relay with the same tool draws a signal instead
         if (keyPoints.size() == 1) {
-            auto& element = outputState[this->deltaTrans + keyPoints.front()];
-            hasChanges = change(element);
+            const ext::point& pt = keyPoints.front();
             if constexpr (std::is_base_of_v<LogicGate, PencilType> || std::is_base_of_v<Relay, PencilType> || std::is_base_of_v<CommunicatorElement, PencilType>) {
-                if (!hasChanges) {
-                    element = Signal{};
-                    hasChanges = true;
+                if (std::holds_alternative<PencilType>(elementAt(pt))) {
+                    draw(pt, 0, Signal{});
+                }
+                else {
+                    draw(pt, 0, PencilType{});
                 }
             }
+            else {
+                draw(pt, 0, CanvasStateVariantElement_t<PencilType>{});
+            }
         }
         else {
-            // note: eraser can be optimized to not extend the canvas first
             auto prev = keyPoints.begin();
-            hasChanges = change(outputState[this->deltaTrans + *prev]);
-            auto curr = prev;
-            // when drawing insulated wires, draw conductive wire at intermediate keypoints
-            if constexpr (std::is_same_v<InsulatedWire, PencilType>) {
-                for (++curr; curr != keyPoints.end(); prev = curr++) {
-                    interpolate_orthogonal(*prev, *curr, [&](const ext::point& pt) {
-                        hasChanges = change(outputState[this->deltaTrans + pt]) || hasChanges;
-                    });
-                }
-                curr = prev = keyPoints.begin();
-                for (++curr; curr + 1 != keyPoints.end(); prev = curr++) {
-                    hasChanges = change<ConductiveWire>(outputState[this->deltaTrans + *curr]) || hasChanges;
-                }
-                hasChanges = change(outputState[this->deltaTrans + *curr]) || hasChanges;
-            }
-            else {
-                for (++curr; curr != keyPoints.end(); prev = curr++) {
-                    interpolate_orthogonal(*prev, *curr, [&](const ext::point& pt) {
-                        hasChanges = change(outputState[this->deltaTrans + pt]) || hasChanges;
-                    });
-                    hasChanges = change(outputState[this->deltaTrans + *curr]) || hasChanges;
+            draw(*prev, 0, CanvasStateVariantElement_t<PencilType>{});
+            size_t segment = 0;
+            for (auto curr = prev + 1; curr != keyPoints.end(); prev = curr++, ++segment) {
+                interpolate_orthogonal(*prev, *curr, [&](const ext::point& pt) {
+                    draw(pt, segment, CanvasStateVariantElement_t<PencilType>{});
+                });
+                // when drawing insulated wires, draw conductive wire at intermediate keypoints
+                if constexpr (std::is_same_v<InsulatedWire, PencilType>) {
+                    if (curr + 1 != keyPoints.end()) {
+                        draw(*curr, segment, ConductiveWire{});
+                        continue;
+                    }
                 }
+                draw(*curr, segment, CanvasStateVariantElement_t<PencilType>{});
             }
         }
 
+        // keep only the last element written to each point (the stroke may cross itself), in raster order so that the writes stay within a tile as long as possible
+        std::stable_sort(stroke.begin(), stroke.end(), [](const StrokePixel& a, const StrokePixel& b) {
+            return std::tie(a.pt.y, a.pt.x) < std::tie(b.pt.y, b.pt.x);
+        });
+        auto last = stroke.begin();
+        for (auto it = stroke.begin(); it != stroke.end(); ++it) {
+            if (it + 1 != stroke.end() && it[1].pt == it->pt) continue;
+            // only a change of the type of element is a change (e.g. erasing outside the canvas, or redrawing an element with the same tool, changes nothing)
+            if (elementAt(it->pt).index() == it->element.index()) continue;
+            *last++ = *it;
+        }
+        stroke.erase(last, stroke.end());
+
+        if (stroke.empty()) {
+            this->changed() = false;
+            return;
+        }
+
+        // every point that changes is within [minPt, maxPt)
+        ext::point minPt = ext::point::max(), maxPt = ext::point::min();
+        for (const StrokePixel& pixel : stroke) {
+            minPt = min(minPt, pixel.pt);
+            maxPt = max(maxPt, pixel.pt);
+        }
+        maxPt += ext::point(1, 1); // extra (1, 1) for past-the-end required by outputState.extend()
+        this->deltaTrans = outputState.extend(minPt, maxPt); // an eraser never needs to extend the canvas, since it only changes existing elements
+
+        // the edited area is marked as one rectangle per segment, so that a long polyline only recompiles the components along it
+        std::vector<std::pair<ext::point, ext::point>> segmentBounds(std::max<size_t>(keyPoints.size() - 1, 1), std::pair<ext::point, ext::point>{ ext::point::max(), ext::point::min() });
+        for (const StrokePixel& pixel : stroke) {
+            outputState[this->deltaTrans + pixel.pt] = pixel.element;
+            auto& [segmentTopLeft, segmentBottomRight] = segmentBounds[pixel.segment];
+            segmentTopLeft = min(segmentTopLeft, pixel.pt);
+            segmentBottomRight = max(segmentBottomRight, pixel.pt + ext::point(1, 1));
+        }
+        for (const auto& [segmentTopLeft, segmentBottomRight] : segmentBounds) {
+            if (segmentTopLeft.x < segmentBottomRight.x) this->markEdited(segmentTopLeft + this->deltaTrans, segmentBottomRight + this->deltaTrans);
+        }
+
         if constexpr (std::is_same_v<PencilType, Eraser>) {
-            this->deltaTrans += outputState.shrinkDataMatrix();
+            // the erased tiles can only be in the area that was drawn on
+            this->deltaTrans += outputState.shrinkDataMatrix(minPt + this->deltaTrans, maxPt + this->deltaTrans);
         }
 
         // set changed flag
-        this->changed() = hasChanges;
+        this->changed() = true;
     }
 
     static inline ActionEventResult startWithPlayAreaMouseButtonDown(const SDL_MouseButtonEvent& event, MainWindow& mainWindow, PlayArea& playArea, const ActionStarter& starter) {
@@ -305,6 +340,16 @@ public:
         });
     }
 
+    std::optional<std::pair<ext::point, ext::point>> playAreaSurfaceBounds() const override {
+        // the stroke only covers the bounding rectangle of its key points
+        std::pair<ext::point, ext::point> bounds{ ext::point::max(), ext::point::min() };
+        for (const ext::point& pt : keyPoints) {
+            bounds.first = min(bounds.first, pt);
+            bounds.second = max(bounds.second, pt + ext::point(1, 1));
+        }
+        return bounds;
+    }
+
     void renderPlayAreaDirect(SDL_Renderer* renderer) const override {
         ext::point newPos = find_orthogonal_keypoint(mousePos, keyPoints.back());
 
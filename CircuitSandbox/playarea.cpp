@@ -13,6 +13,10 @@
 #include <cstdint>
 #include <stdexcept>
 #include <variant>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 #include <SDL.h>
 
@@ -25,14 +29,17 @@
 #include "sdl_fast_maprgb.hpp"
 #include "notificationdisplay.hpp"
 #include "interpolate.hpp"
+#include "tracing.hpp"
 
-PlayArea::PlayArea(MainWindow& main_window) : mainWindow(main_window), currentAction(mainWindow.currentAction, mainWindow, *this) {}
+// the UI thread draws one band itself, so it needs one fewer worker thread than the number of cores (hardware_concurrency() may return 0 if it is unknown)
+PlayArea::PlayArea(MainWindow& main_window) : mainWindow(main_window), renderPool(std::max(std::thread::hardware_concurrency(), 1u) - 1), currentAction(mainWindow.currentAction, mainWindow, *this) {}
 
 
 void PlayArea::render(SDL_Renderer* renderer) {
     render(renderer, mainWindow.stateManager);
 }
 void PlayArea::render(SDL_Renderer* renderer, StateManager& stateManager) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("PlayArea::render");
     double renderScale = scale;
     ext::point renderTranslation = translation;
     static constexpr Drawable::RenderClock::duration zoomAnimationDuration = 100ms;
@@ -61,21 +68,85 @@ void PlayArea::render(SDL_Renderer* renderer, StateManager& stateManager) {
     surfaceRect.w = pixelTextureSize.x;
     surfaceRect.h = pixelTextureSize.y;
 
-    // lock the texture so we can start drawing onto it
-    uint32_t* pixelData;
-    int32_t pitch;
-    SDL_LockTexture(pixelTexture.get(), nullptr, &reinterpret_cast<void*&>(pixelData), &pitch);
-    pitch >>= 2; // divide by 4, because uint32_t is 4 bytes
+    // everything has to be redrawn if an action might have drawn anywhere on the surface, or if the surface was resized
+    const std::optional<std::pair<ext::point, ext::point>> actionBounds = currentAction.playAreaSurfaceBounds();
+    const bool actionDrawing = currentAction.hasAction() && !actionBounds;
+    bool redrawAll = pixelBufferStale || actionDrawing || surfaceRect.w != drawnSurfaceRect.w || surfaceRect.h != drawnSurfaceRect.h || defaultView != drawnDefaultView;
+    // in view-only mode, the tiles that came into view are loaded from the file, and the pixels that were drawn as empty before they were loaded have to be redrawn
+    if (stateManager.loadViewTiles(mainWindow, surfaceRect)) redrawAll = true;
+    const int32_t pitch = pixelTextureSize.x;
+
+    // if the surface was panned, the pixels that are still visible are moved instead of being redrawn, and only the newly exposed strips are drawn
+    exposedRects.clear();
+    bool scrolled = false;
+    if (!redrawAll && (surfaceRect.x != drawnSurfaceRect.x || surfaceRect.y != drawnSurfaceRect.y)) {
+        const ext::point shift{ drawnSurfaceRect.x - surfaceRect.x, drawnSurfaceRect.y - surfaceRect.y };
+        if (std::abs(shift.x) >= surfaceRect.w || std::abs(shift.y) >= surfaceRect.h) {
+            redrawAll = true;
+        }
+        else {
+            scrollPixelBuffer(shift);
+            scrolled = true;
+            // the rows that came into view (across the whole width), then the columns that came into view (in the remaining rows)
+            int32_t keptTop = surfaceRect.y;
+            int32_t keptBottom = surfaceRect.y + surfaceRect.h;
+            if (shift.y > 0) {
+                exposedRects.push_back(SDL_Rect{ surfaceRect.x, surfaceRect.y, surfaceRect.w, shift.y });
+                keptTop += shift.y;
+            }
+            else if (shift.y < 0) {
+                exposedRects.push_back(SDL_Rect{ surfaceRect.x, keptBottom + shift.y, surfaceRect.w, -shift.y });
+                keptBottom += shift.y;
+            }
+            if (shift.x > 0) {
+                exposedRects.push_back(SDL_Rect{ surfaceRect.x, keptTop, shift.x, keptBottom - keptTop });
+            }
+            else if (shift.x < 0) {
+                exposedRects.push_back(SDL_Rect{ surfaceRect.x + surfaceRect.w + shift.x, keptTop, -shift.x, keptBottom - keptTop });
+            }
+        }
+    }
 
-    // render the gamestate
+    // an action that says where it draws only needs what it drew over in the last frame and what it will draw over now to be redrawn beneath it
+    if (!redrawAll && (actionDrawnBounds || actionBounds)) {
+        ext::point topLeft = ext::point::max(), bottomRight = ext::point::min();
+        for (const auto& bounds : { actionDrawnBounds, actionBounds }) {
+            if (!bounds) continue;
+            topLeft = ext::min(topLeft, bounds->first);
+            bottomRight = ext::max(bottomRight, bounds->second);
+        }
+        topLeft = ext::max(topLeft, ext::point{ surfaceRect.x, surfaceRect.y });
+        bottomRight = ext::min(bottomRight, ext::point{ surfaceRect.x + surfaceRect.w, surfaceRect.y + surfaceRect.h });
+        if (topLeft.x < bottomRight.x && topLeft.y < bottomRight.y) {
+            exposedRects.push_back(SDL_Rect{ topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y });
+        }
+    }
+
+    // render the gamestate (only the parts that changed or came into view, unless we are redrawing everything)
+    redrawnRects.clear();
     if (!currentAction.disablePlayAreaDefaultRender()) {
-        stateManager.fillSurface(defaultView, pixelData, pixelFormat, surfaceRect, pitch);
+        stateManager.updateSurface(defaultView, redrawAll, renderPool, pixelBuffer.get(), colorTable, surfaceRect, pitch, exposedRects, redrawnRects);
     }
     // ask current action to render pixels to the surface if necessary
-    currentAction.renderPlayAreaSurface(pixelData, pixelFormat, surfaceRect, pitch);
+    currentAction.renderPlayAreaSurface(pixelBuffer.get(), pixelFormat, surfaceRect, pitch);
 
-    // unlock the texture
-    SDL_UnlockTexture(pixelTexture.get());
+    // upload the redrawn parts to the texture (after scrolling, all the pixels are in different places on the texture)
+    // only the top-left part of the texture is used at this scale
+    const SDL_Rect usedTextureRect{ 0, 0, pixelTextureSize.x, pixelTextureSize.y };
+    if (redrawAll || scrolled) {
+        SDL_UpdateTexture(pixelTexture.get(), &usedTextureRect, pixelBuffer.get(), static_cast<int>(pitch * sizeof(uint32_t)));
+    }
+    else {
+        for (const SDL_Rect& rect : redrawnRects) {
+            const SDL_Rect textureRect{ rect.x - surfaceRect.x, rect.y - surfaceRect.y, rect.w, rect.h };
+            SDL_UpdateTexture(pixelTexture.get(), &textureRect, pixelBuffer.get() + textureRect.y * pitch + textureRect.x, static_cast<int>(pitch * sizeof(uint32_t)));
+        }
+    }
+    // whatever the action drew has to be erased at the next frame
+    pixelBufferStale = actionDrawing;
+    actionDrawnBounds = actionBounds;
+    drawnSurfaceRect = surfaceRect;
+    drawnDefaultView = defaultView;
 
     // scale and translate the surface according to the the pan and zoom level
     // the section of the surface enclosed within surfaceRect is mapped to dstRect
@@ -85,7 +156,15 @@ void PlayArea::render(SDL_Renderer* renderer, StateManager& stateManager) {
         static_cast<int>(surfaceRect.w * renderScale),
         static_cast<int>(surfaceRect.h * renderScale)
     };
-    SDL_RenderCopy(renderer, pixelTexture.get(), nullptr, &dstRect);
+    SDL_RenderCopy(renderer, pixelTexture.get(), &usedTextureRect, &dstRect);
+
+    if (heatmapVisible) {
+        stateManager.fillHeatmap(renderPool, heatmapBuffer.get(), heatmapFormat, surfaceRect, pitch);
+        SDL_UpdateTexture(heatmapTexture.get(), &usedTextureRect, heatmapBuffer.get(), static_cast<int>(pitch * sizeof(uint32_t)));
+        SDL_RenderCopy(renderer, heatmapTexture.get(), &usedTextureRect, &dstRect);
+    }
+
+    renderProbes(renderer, stateManager, renderScale, renderTranslation);
 
     if (mouseoverPoint) {
         ext::point canvasPoint = canvasFromWindowOffset(*mouseoverPoint);
@@ -110,22 +189,140 @@ void PlayArea::render(SDL_Renderer* renderer, StateManager& stateManager) {
     currentAction.renderPlayAreaDirect(renderer);
 }
 
+void PlayArea::scrollPixelBuffer(ext::point shift) {
+    const int32_t width = pixelTextureSize.x - std::abs(shift.x);
+    const int32_t srcX = std::max(-shift.x, 0);
+    const int32_t destX = std::max(shift.x, 0);
+    const auto moveRow = [&](int32_t srcY, int32_t destY) {
+        std::memmove(pixelBuffer.get() + destY * pixelTextureSize.x + destX, pixelBuffer.get() + srcY * pixelTextureSize.x + srcX, width * sizeof(uint32_t));
+    };
+    // go in the direction that doesn't overwrite rows that are still to be moved
+    if (shift.y > 0) {
+        for (int32_t destY = pixelTextureSize.y - 1; destY >= shift.y; --destY) {
+            moveRow(destY - shift.y, destY);
+        }
+    }
+    else {
+        for (int32_t destY = 0; destY < pixelTextureSize.y + shift.y; ++destY) {
+            moveRow(destY - shift.y, destY);
+        }
+    }
+}
+
 void PlayArea::prepareTexture(SDL_Renderer* renderer) {
     prepareTexture(renderer, zoomAnimationStartTime == Drawable::RenderClock::time_point::max() ? scale : std::min(scale, zoomScaleStart));
 }
 
 void PlayArea::prepareTexture(SDL_Renderer* renderer, int32_t textureScale) {
-    // free the old texture first (if any)
-    pixelTexture.reset(nullptr);
+    pixelTextureSize = textureSizeAt(textureScale);
+    pixelBufferStale = true;
 
-    // calculate the required texture size - the maximum size necessary for *any* possible translation.
-    pixelTextureSize.x = (renderArea.w - 2) / textureScale + 2;
-    pixelTextureSize.y = (renderArea.h - 2) / textureScale + 2;
+    // the smallest scale is 1, so that is the most that any zoom level will use
+    const ext::point capacity = textureSizeAt(1);
+    if (pixelTexture != nullptr && capacity == pixelTextureCapacity) return;
+    pixelTextureCapacity = capacity;
 
-    pixelTexture.reset(create_fast_texture(renderer, SDL_TEXTUREACCESS_STREAMING, pixelTextureSize, pixelFormat));
+    // free the old texture first (if any)
+    pixelTexture.reset(nullptr);
+    pixelTexture.reset(create_fast_texture(renderer, SDL_TEXTUREACCESS_STREAMING, pixelTextureCapacity, pixelFormat));
     if (pixelTexture == nullptr) {
         throw std::runtime_error("Renderer does not support any 32-bit ARGB textures!");
     }
+    colorTable = DisplayColorTable(pixelFormat);
+    pixelBuffer = std::make_unique<uint32_t[]>(static_cast<size_t>(pixelTextureCapacity.x) * pixelTextureCapacity.y);
+    if (heatmapVisible) prepareHeatmapTexture(renderer);
+}
+
+void PlayArea::prepareHeatmapTexture(SDL_Renderer* renderer) {
+    heatmapTexture.reset(nullptr);
+    heatmapTexture.reset(create_fast_alpha_texture(renderer, SDL_TEXTUREACCESS_STREAMING, pixelTextureCapacity, heatmapFormat));
+    if (heatmapTexture == nullptr) {
+        throw std::runtime_error("Renderer does not support any 32-bit ARGB textures!");
+    }
+    SDL_SetTextureBlendMode(heatmapTexture.get(), SDL_BLENDMODE_BLEND);
+    heatmapBuffer = std::make_unique<uint32_t[]>(static_cast<size_t>(pixelTextureCapacity.x) * pixelTextureCapacity.y);
+}
+
+void PlayArea::toggleHeatmap() {
+    heatmapVisible = !heatmapVisible;
+    mainWindow.stateManager.setCollectSimulatorActivity(heatmapVisible);
+    if (heatmapVisible) {
+        prepareHeatmapTexture(mainWindow.renderer);
+        heatmapNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, NotificationDisplay::Data{ { "Heatmap: ", NotificationDisplay::TEXT_COLOR_STATE }, { "how often each element changed, from blue (rarely) to red (most often)", NotificationDisplay::TEXT_COLOR } });
+    }
+    else {
+        heatmapTexture.reset(nullptr);
+        heatmapBuffer.reset();
+        heatmapNotification.reset();
+    }
+}
+
+void PlayArea::renderProbes(SDL_Renderer* renderer, StateManager& stateManager, double renderScale, ext::point renderTranslation) {
+    const auto outline = [&](ext::point pt) {
+        const SDL_Rect rect{
+            renderArea.x + static_cast<int>(pt.x * renderScale) + renderTranslation.x,
+            renderArea.y + static_cast<int>(pt.y * renderScale) + renderTranslation.y,
+            std::max(static_cast<int>(renderScale), 1),
+            std::max(static_cast<int>(renderScale), 1)
+        };
+        SDL_RenderDrawRect(renderer, &rect);
+    };
+
+    SDL_SetRenderDrawColor(renderer, 0xFF, 0x00, 0x00, 0xFF);
+    for (const Simulator::Breakpoint& breakpoint : stateManager.getSimulatorBreakpoints()) {
+        outline(breakpoint.point);
+    }
+
+    const std::vector<ext::point>& probes = stateManager.getSimulatorProbes();
+    if (probes.empty()) return;
+
+    SDL_SetRenderDrawColor(renderer, 0x00, 0xFF, 0xFF, 0xFF);
+    for (const ext::point& pt : probes) {
+        outline(pt);
+    }
+
+    const int32_t rowHeight = mainWindow.logicalToPhysicalSize(LOGICAL_WAVEFORM_ROW_HEIGHT);
+    const int32_t panelHeight = std::min(rowHeight * static_cast<int32_t>(probes.size()), renderArea.h);
+    const SDL_Rect panelRect{ renderArea.x, renderArea.y + renderArea.h - panelHeight, renderArea.w, panelHeight };
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xC0);
+    SDL_RenderFillRect(renderer, &panelRect);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+    const Waveform waveform = stateManager.readSimulatorWaveform(static_cast<uint64_t>(panelRect.w - 1));
+    if (waveform.startLevels.size() != probes.size()) return;
+    const auto xOf = [&](uint64_t step) {
+        return panelRect.x + panelRect.w - 1 - static_cast<int>(waveform.endStep - step);
+    };
+    SDL_SetRenderDrawColor(renderer, 0x00, 0xFF, 0xFF, 0xFF);
+    for (size_t i = 0; i != probes.size(); ++i) {
+        const int32_t top = panelRect.y + static_cast<int32_t>(i) * rowHeight;
+        if (top + rowHeight > panelRect.y + panelRect.h) break;
+        const auto yOf = [&](bool level) {
+            return level ? top + 2 : top + rowHeight - 3;
+        };
+        bool level = waveform.startLevels[i];
+        int x = xOf(waveform.startStep);
+        for (const Waveform::Change& change : waveform.changes) {
+            if (change.probe != i) continue;
+            const int changeX = xOf(change.step);
+            SDL_RenderDrawLine(renderer, x, yOf(level), changeX, yOf(level));
+            SDL_RenderDrawLine(renderer, changeX, yOf(level), changeX, yOf(change.level));
+            level = change.level;
+            x = changeX;
+        }
+        SDL_RenderDrawLine(renderer, x, yOf(level), xOf(waveform.endStep), yOf(level));
+    }
+}
+
+void PlayArea::toggleProbe() {
+    if (!mouseoverPoint) return;
+    const ext::point canvasPoint = canvasFromWindowOffset(*mouseoverPoint);
+    const bool added = mainWindow.stateManager.toggleSimulatorProbe(canvasPoint);
+    probeNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{
+        { added ? "Probe added " : "Probe removed ", NotificationDisplay::TEXT_COLOR_ACTION },
+        { "at (" + std::to_string(canvasPoint.x) + ", " + std::to_string(canvasPoint.y) + "), Shift+F5 saves the waveform of the probes", NotificationDisplay::TEXT_COLOR }
+    });
 }
 
 void PlayArea::layoutComponents(SDL_Renderer* renderer) {
@@ -140,10 +337,9 @@ void PlayArea::initScale() {
 };
 
 
-void PlayArea::changeMouseoverElement(const CanvasState::element_variant_t& newElement) {
-    Description::ElementVariant_t descElement = Description::fromElementVariant(newElement);
-    if (mouseoverElement != descElement) {
-        mouseoverElement = std::move(descElement);
+void PlayArea::changeMouseoverElement(const Description::ElementVariant_t& newElement) {
+    if (mouseoverElement != newElement) {
+        mouseoverElement = newElement;
         std::visit([&](const auto& element) {
             if constexpr (std::is_base_of_v<Element, std::decay_t<decltype(element)>>) {
                 element.setDescription([&](auto&&... args) {
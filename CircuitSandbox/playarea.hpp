@@ -13,6 +13,7 @@
 #include <cstdint>
 #include <optional>
 #include <memory>
+#include <vector>
 
 #include <SDL.h>
 
@@ -24,6 +25,8 @@
 #include "sdl_automatic.hpp"
 #include "elementdescriptionutils.hpp"
 #include "notificationdisplay.hpp"
+#include "thread_pool.hpp"
+#include "displaycolortable.hpp"
 
 /**
  * Represents the play area - the part of the window where the user can draw on.
@@ -65,9 +68,38 @@ private:
     // the texture used to render the canvas pixels on.
     // This is in canvas coordinates - the area that is visible on the play area.  Updated during layoutComponents(), or when the scale changes.
     // Note: depending on the translation, there might be one row/column of pixels at the right or bottom that is totally hidden from view.
+    // The texture (and pixelBuffer and the heatmap) is allocated with pixelTextureCapacity, which is enough for the smallest scale, so that zooming only changes which part of it is used (the top-left pixelTextureSize).
+    // It is only recreated when the play area is resized.
     UniqueTexture pixelTexture;
     uint32_t pixelFormat;
     ext::point pixelTextureSize;
+    ext::point pixelTextureCapacity{ 0, 0 };
+    DisplayColorTable colorTable; // the colors of the elements in pixelFormat
+
+    // copy of the pixels on pixelTexture, so that at each frame only the parts that changed have to be redrawn and uploaded with SDL_UpdateTexture()
+    std::unique_ptr<uint32_t[]> pixelBuffer;
+    std::vector<SDL_Rect> exposedRects; // the rectangles (in canvas coordinates) that came into view because the surface was panned in the current frame
+    std::vector<SDL_Rect> redrawnRects; // the rectangles (in canvas coordinates) redrawn in the current frame
+    bool pixelBufferStale = true; // whether everything has to be redrawn at the next frame (e.g. the texture was recreated, or an action drew over it without saying where)
+    std::optional<std::pair<ext::point, ext::point>> actionDrawnBounds; // the rectangle that the action drew over in the last frame, which has to be redrawn at the next frame
+    SDL_Rect drawnSurfaceRect; // the surfaceRect and defaultView of the last frame
+    bool drawnDefaultView = false;
+
+    // heatmap of how often each element changes (toggled with F4), blended over the canvas with the same size and position as pixelTexture
+    // it is redrawn in full at every frame, since every count might have changed
+    bool heatmapVisible = false;
+    UniqueTexture heatmapTexture;
+    uint32_t heatmapFormat;
+    std::unique_ptr<uint32_t[]> heatmapBuffer;
+    NotificationDisplay::UniqueNotification heatmapNotification;
+
+    // the probes (toggled with F5 on the element under the mouse) are outlined on the canvas, and their recorded levels are drawn in a panel along the bottom, one row for each probe
+    // the panel shows one step per pixel, with the latest step at the right edge
+    constexpr static int32_t LOGICAL_WAVEFORM_ROW_HEIGHT = 12;
+    NotificationDisplay::UniqueNotification probeNotification;
+
+    // persistent threads that fill the pixel buffer in bands of rows (see getRenderPool())
+    ext::thread_pool renderPool;
 
     bool defaultView = false; // whether default view (instead of live view) is being rendered
     NotificationDisplay::UniqueNotification defaultViewNotification;
@@ -109,11 +141,38 @@ private:
     /**
      * Prepares the texture for use.
      * This method must be called is the dimensions of the canvas might have changed (e.g. zoom in/out, resize window).
+     * The texture is only recreated if the play area was resized; otherwise a different part of it is used, and everything is redrawn at the next frame.
      * @pre renderer must not be null.
      */
     void prepareTexture(SDL_Renderer*);
     void prepareTexture(SDL_Renderer*, int32_t textureScale);
 
+    /**
+     * Gets the size of the texture needed to show the play area at the given scale - the maximum size necessary for *any* possible translation.
+     */
+    ext::point textureSizeAt(int32_t textureScale) const noexcept {
+        return { (renderArea.w - 2) / textureScale + 2, (renderArea.h - 2) / textureScale + 2 };
+    }
+
+    /**
+     * Creates heatmapTexture and heatmapBuffer with the size of pixelTexture.
+     * @pre renderer must not be null.
+     */
+    void prepareHeatmapTexture(SDL_Renderer*);
+
+    /**
+     * Draws the outlines of the breakpoints and the probes, and the waveform panel (see toggleProbe()) if there are any probes.
+     * @pre renderer must not be null.
+     */
+    void renderProbes(SDL_Renderer*, StateManager& stateManager, double renderScale, ext::point renderTranslation);
+
+    /**
+     * Moves the pixels in pixelBuffer by the given offset (in pixels), for when the surface is panned.
+     * The pixels that are moved in from outside the buffer are left unchanged, and have to be redrawn.
+     * @pre the offset is smaller than the size of the buffer in both dimensions.
+     */
+    void scrollPixelBuffer(ext::point shift);
+
 public:
     /**
      * Currently this just calls prepareTexture();
@@ -128,10 +187,50 @@ public:
         return defaultView;
     }
 
+    /**
+     * Check if a zoom animation is in progress (so every frame has to be drawn until it ends)
+     */
+    inline bool isAnimating() const noexcept {
+        return zoomAnimationStartTime != Drawable::RenderClock::time_point::max();
+    }
+
+    /**
+     * The threads used for drawing on the pixel buffer, for use by StateManager and the actions to split their drawing into bands of rows.
+     * Must only be used from the UI thread.
+     */
+    inline ext::thread_pool& getRenderPool() noexcept {
+        return renderPool;
+    }
+
+    /**
+     * The colors of the elements in the pixel format of the surface passed to the actions' renderPlayAreaSurface().
+     */
+    inline const DisplayColorTable& getColorTable() const noexcept {
+        return colorTable;
+    }
+
     /**
      * Sets mouseoverElement field and updates description in button bar if necessary.
      */
-    void changeMouseoverElement(const CanvasState::element_variant_t& newElement);
+    void changeMouseoverElement(const Description::ElementVariant_t& newElement);
+
+    /**
+     * Show or hide the heatmap of how often each element changes, which is counted by the simulator while it is shown.
+     */
+    void toggleHeatmap();
+
+    /**
+     * Adds or removes a probe on the element under the mouse, whose level is recorded by the simulator at every step and drawn in the waveform panel.
+     */
+    void toggleProbe();
+
+    /**
+     * Gets the point of the canvas under the mouse, if the mouse is over the play area.
+     */
+    std::optional<ext::point> getMouseoverCanvasPoint() const {
+        if (!mouseoverPoint) return std::nullopt;
+        return canvasFromWindowOffset(*mouseoverPoint);
+    }
 
     /**
      * Save and toggle between two zoom levels.
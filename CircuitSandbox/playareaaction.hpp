@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <optional>
+#include <utility>
+
 #include "statefulaction.hpp"
 #include "playarea.hpp"
 
@@ -72,6 +75,13 @@ public:
      * `renderRect` is the part of the canvas that should be drawn onto this surface.
      */
     virtual void renderPlayAreaSurface(uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& renderRect, int32_t pitch) const {}
+    /**
+     * The rectangle [topLeft, bottomRight) (in canvas units) that renderPlayAreaSurface() draws within, if the action knows it.
+     * When it is known, the play area only redraws the pixels under this rectangle and the one from the previous frame, instead of the whole surface.
+     */
+    virtual std::optional<std::pair<ext::point, ext::point>> playAreaSurfaceBounds() const {
+        return std::nullopt;
+    }
     /**
      * Render directly using the SDL_Renderer (it is in window coordinates).
      */
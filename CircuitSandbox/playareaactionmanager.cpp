@@ -20,6 +20,8 @@ bool PlayAreaActionManager::processPlayAreaMouseButtonDown(const SDL_MouseButton
     return mouseDownResult = forwardEvent(data, [&, this]() {
         return data->processPlayAreaMouseButtonDown(event);
     }, [&, this]() {
+        // nothing can be edited in view-only mode, so only the default handling of the play area (e.g. panning) is done
+        if (mainWindow.stateManager.viewOnly()) return ActionEventResult::UNPROCESSED;
         ActionEventResult res;
         playarea_action_tags_t::for_each([&, this](auto action_tag, auto) {
             using action_t = typename decltype(action_tag)::type;
@@ -74,6 +76,9 @@ bool PlayAreaActionManager::disablePlayAreaDefaultRender() const {
 void PlayAreaActionManager::renderPlayAreaSurface(uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& renderRect, int32_t pitch) const {
     if (data) data->renderPlayAreaSurface(pixelBuffer, pixelFormat, renderRect, pitch);
 }
+std::optional<std::pair<ext::point, ext::point>> PlayAreaActionManager::playAreaSurfaceBounds() const {
+    return data ? data->playAreaSurfaceBounds() : std::nullopt;
+}
 void PlayAreaActionManager::renderPlayAreaDirect(SDL_Renderer* renderer) const {
     if (data) data->renderPlayAreaDirect(renderer);
 }
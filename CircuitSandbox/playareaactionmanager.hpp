@@ -11,6 +11,8 @@
 #pragma once
 
 #include <memory>
+#include <optional>
+#include <utility>
 
 #include <SDL.h>
 
@@ -18,6 +20,7 @@
 
 #include "actionmanager.hpp"
 #include "action.hpp"
+#include "point.hpp"
 
 class PlayAreaActionManager {
 private:
@@ -102,8 +105,14 @@ public:
     bool processPlayAreaMouseHover(const SDL_MouseMotionEvent& event);
     bool processPlayAreaMouseLeave();
 
+    // whether there is a current action (which might draw on the play area surface)
+    bool hasAction() const {
+        return data != nullptr;
+    }
+
     // renderer
     bool disablePlayAreaDefaultRender() const;
     void renderPlayAreaSurface(uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& renderRect, int32_t pitch) const;
+    std::optional<std::pair<ext::point, ext::point>> playAreaSurfaceBounds() const;
     void renderPlayAreaDirect(SDL_Renderer* renderer) const;
 };
@@ -0,0 +1,367 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <array>
+#include <queue>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "concurrent_queue.hpp"
+#include "concurrent_fixed_queue.hpp"
+#include "flushable_fixed_queue.hpp"
+#include "unrolled_linked_list_queue.hpp"
+
+/**
+ * Micro-benchmarks of the ext:: queues, so that changes to them can be compared.
+ * Every queue that is used between two threads is measured with one producer and one consumer thread, for:
+ * - throughput of try_push()/try_pop() of single elements,
+ * - throughput of push(begin, end)/pop(begin, end) of batches of elements (the fixed queues only),
+ * - round trip latency of one element sent to the other thread and back through a second queue.
+ * Each is repeated for several element sizes and buffer sizes.
+ * The fixed queues are also compared to a reference ring buffer that keeps the push and pop indices next to each other and reads the other thread's index on every push and pop,
+ * so the difference shows what the fixed queues gain from keeping the indices of each thread on a separate cache line (avoiding false sharing) and caching the other thread's index.
+ * The unrolled linked list queue is not thread-safe, so it is only measured on one thread, against std::queue.
+ * The concurrent tests need at least two cores to be meaningful; the waiting threads yield after spinning for a while so that they still finish on one core.
+ */
+class QueueBenchmark {
+private:
+    using clock = std::chrono::steady_clock;
+
+    template <size_t Bytes>
+    struct Element {
+        std::array<uint8_t, Bytes> bytes;
+    };
+
+    /**
+     * The same algorithm as ext::concurrent_fixed_queue, but with the push and pop indices on the same cache line, and without caching them.
+     */
+    template <typename T, size_t Size>
+    class AdjacentRing {
+    private:
+        std::array<T, Size> buffer;
+        std::atomic<size_t> pushIndex{ 0 };
+        std::atomic<size_t> popIndex{ 0 };
+
+        inline static size_t space(size_t tmp_pushIndex, size_t tmp_popIndex) noexcept {
+            if (tmp_popIndex <= tmp_pushIndex) tmp_popIndex += Size;
+            return tmp_popIndex - tmp_pushIndex - 1;
+        }
+
+        inline static size_t available(size_t tmp_pushIndex, size_t tmp_popIndex) noexcept {
+            if (tmp_pushIndex < tmp_popIndex) tmp_pushIndex += Size;
+            return tmp_pushIndex - tmp_popIndex;
+        }
+
+    public:
+        inline size_t space() const noexcept {
+            return space(pushIndex.load(std::memory_order_relaxed), popIndex.load(std::memory_order_acquire));
+        }
+        inline size_t available() const noexcept {
+            return available(pushIndex.load(std::memory_order_acquire), popIndex.load(std::memory_order_relaxed));
+        }
+        inline bool try_push(const T& value) noexcept {
+            if (space() == 0) return false;
+            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
+            buffer[tmp_pushIndex] = value;
+            pushIndex.store((tmp_pushIndex + 1) % Size, std::memory_order_release);
+            return true;
+        }
+        template <typename InBegin, typename InEnd>
+        inline void push(InBegin begin, InEnd end) {
+            size_t tmp_pushIndex = pushIndex.load(std::memory_order_relaxed);
+            for (; begin != end; ++begin) {
+                buffer[tmp_pushIndex] = *begin;
+                ++tmp_pushIndex;
+                if (tmp_pushIndex == Size) tmp_pushIndex -= Size;
+            }
+            pushIndex.store(tmp_pushIndex, std::memory_order_release);
+        }
+        inline bool try_pop(T& out) noexcept {
+            if (available() == 0) return false;
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            out = buffer[tmp_popIndex];
+            popIndex.store((tmp_popIndex + 1) % Size, std::memory_order_release);
+            return true;
+        }
+        template <typename InBegin, typename InEnd>
+        inline void pop(InBegin begin, InEnd end) {
+            size_t tmp_popIndex = popIndex.load(std::memory_order_relaxed);
+            for (; begin != end; ++begin) {
+                *begin = buffer[tmp_popIndex];
+                ++tmp_popIndex;
+                if (tmp_popIndex == Size) tmp_popIndex -= Size;
+            }
+            popIndex.store(tmp_popIndex, std::memory_order_release);
+        }
+    };
+
+    /**
+     * Waits for another thread without sleeping, but yields after spinning for a while, in case both threads share a core.
+     */
+    class Spinner {
+    private:
+        unsigned spins = 0;
+    public:
+        inline void wait() noexcept {
+            if (++spins == 64) {
+                spins = 0;
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    // the element that carries the given sequence number (the number is spread over the element, so that every byte is copied)
+    template <size_t Bytes>
+    inline static Element<Bytes> makeElement(uint64_t seq) noexcept {
+        Element<Bytes> element;
+        for (size_t i = 0; i != Bytes; ++i) element.bytes[i] = static_cast<uint8_t>(seq >> (8 * (i % 8)));
+        return element;
+    }
+
+    template <size_t Bytes>
+    inline static uint64_t checksum(const Element<Bytes>& element) noexcept {
+        return element.bytes.front() + element.bytes.back();
+    }
+
+    template <size_t Bytes>
+    static uint64_t expectedChecksum(uint64_t count) noexcept {
+        uint64_t sum = 0;
+        for (uint64_t seq = 0; seq != count; ++seq) sum += checksum(makeElement<Bytes>(seq));
+        return sum;
+    }
+
+    // concurrent_queue is unbounded, so pushing always succeeds
+    template <typename Queue, typename T>
+    inline static bool tryPush(Queue& queue, const T& value) {
+        return queue.try_push(value);
+    }
+    template <typename T>
+    inline static bool tryPush(ext::concurrent_queue<T>& queue, const T& value) {
+        queue.push(value);
+        return true;
+    }
+    template <typename Queue, typename T>
+    inline static bool tryPop(Queue& queue, T& out) {
+        return queue.try_pop(out);
+    }
+    template <typename T>
+    inline static bool tryPop(ext::concurrent_queue<T>& queue, T& out) {
+        return queue.pop(out);
+    }
+
+    struct Result {
+        double value; // elements per microsecond, or nanoseconds per round trip
+        bool correct; // whether the consumer received exactly what was sent
+    };
+
+    /**
+     * One producer pushes count elements one at a time, while one consumer pops them.
+     */
+    template <typename Queue, size_t Bytes>
+    static Result throughput(uint64_t count) {
+        using T = Element<Bytes>;
+        // the fixed queues can be a few megabytes large
+        const std::unique_ptr<Queue> queue = std::make_unique<Queue>();
+        std::atomic<bool> ready{ false };
+        uint64_t received = 0;
+        std::thread consumer([&]() {
+            ready.store(true, std::memory_order_release);
+            Spinner spinner;
+            T value;
+            for (uint64_t seq = 0; seq != count; ++seq) {
+                while (!tryPop(*queue, value)) spinner.wait();
+                received += checksum(value);
+            }
+        });
+        while (!ready.load(std::memory_order_acquire)) std::this_thread::yield();
+
+        const auto start = clock::now();
+        Spinner spinner;
+        for (uint64_t seq = 0; seq != count; ++seq) {
+            const T value = makeElement<Bytes>(seq);
+            while (!tryPush(*queue, value)) spinner.wait();
+        }
+        consumer.join();
+        const std::chrono::duration<double, std::micro> time = clock::now() - start;
+        return { count / time.count(), received == expectedChecksum<Bytes>(count) };
+    }
+
+    /**
+     * Like throughput(), but the elements are pushed and popped in batches with push(begin, end) and pop(begin, end).
+     */
+    template <typename Queue, size_t Bytes, size_t Size>
+    static Result bulkThroughput(uint64_t count) {
+        using T = Element<Bytes>;
+        // a batch has to fit in the queue (which holds at most Size - 1 elements)
+        constexpr size_t batchSize = std::min<size_t>(64, Size / 2);
+        count -= count % batchSize;
+        const std::unique_ptr<Queue> queue = std::make_unique<Queue>();
+        std::atomic<bool> ready{ false };
+        uint64_t received = 0;
+        std::thread consumer([&]() {
+            ready.store(true, std::memory_order_release);
+            Spinner spinner;
+            std::array<T, batchSize> batch;
+            for (uint64_t seq = 0; seq != count; seq += batchSize) {
+                while (queue->available() < batchSize) spinner.wait();
+                queue->pop(batch.begin(), batch.end());
+                for (const T& value : batch) received += checksum(value);
+            }
+        });
+        while (!ready.load(std::memory_order_acquire)) std::this_thread::yield();
+
+        const auto start = clock::now();
+        Spinner spinner;
+        std::array<T, batchSize> batch;
+        for (uint64_t seq = 0; seq != count; seq += batchSize) {
+            for (size_t i = 0; i != batchSize; ++i) batch[i] = makeElement<Bytes>(seq + i);
+            while (queue->space() < batchSize) spinner.wait();
+            queue->push(batch.begin(), batch.end());
+        }
+        consumer.join();
+        const std::chrono::duration<double, std::micro> time = clock::now() - start;
+        return { count / time.count(), received == expectedChecksum<Bytes>(count) };
+    }
+
+    /**
+     * Sends one element at a time to the other thread, which sends it back through a second queue.
+     */
+    template <typename Queue, size_t Bytes>
+    static Result latency(uint64_t roundTrips) {
+        using T = Element<Bytes>;
+        const std::unique_ptr<Queue> there = std::make_unique<Queue>();
+        const std::unique_ptr<Queue> back = std::make_unique<Queue>();
+        std::atomic<bool> ready{ false };
+        std::thread echo([&]() {
+            ready.store(true, std::memory_order_release);
+            Spinner spinner;
+            T value;
+            for (uint64_t seq = 0; seq != roundTrips; ++seq) {
+                while (!tryPop(*there, value)) spinner.wait();
+                while (!tryPush(*back, value)) spinner.wait();
+            }
+        });
+        while (!ready.load(std::memory_order_acquire)) std::this_thread::yield();
+
+        const auto start = clock::now();
+        Spinner spinner;
+        uint64_t received = 0;
+        T value;
+        for (uint64_t seq = 0; seq != roundTrips; ++seq) {
+            while (!tryPush(*there, makeElement<Bytes>(seq))) spinner.wait();
+            while (!tryPop(*back, value)) spinner.wait();
+            received += checksum(value);
+        }
+        echo.join();
+        const std::chrono::duration<double, std::nano> time = clock::now() - start;
+        return { time.count() / roundTrips, received == expectedChecksum<Bytes>(roundTrips) };
+    }
+
+    /**
+     * Pushes and pops count elements on one thread, in rounds of the given number of elements, so that the queue grows and shrinks like a breadth-first search frontier.
+     */
+    template <typename Queue, size_t Bytes>
+    static Result singleThreaded(uint64_t count, size_t round) {
+        Queue queue;
+        uint64_t received = 0;
+        const auto start = clock::now();
+        for (uint64_t seq = 0; seq < count; seq += round) {
+            const uint64_t roundEnd = std::min<uint64_t>(seq + round, count);
+            for (uint64_t i = seq; i != roundEnd; ++i) queue.push(makeElement<Bytes>(i));
+            while (!queue.empty()) {
+                received += checksum(queue.front());
+                queue.pop();
+            }
+        }
+        const std::chrono::duration<double, std::micro> time = clock::now() - start;
+        return { count / time.count(), received == expectedChecksum<Bytes>(count) };
+    }
+
+    static void printHeader(std::ostream& out) {
+        out << std::left << std::setw(28) << "queue" << std::right
+            << std::setw(9) << "element"
+            << std::setw(9) << "buffer"
+            << std::setw(16) << "test"
+            << std::setw(16) << "result" << std::endl;
+    }
+
+    // returns whether the result is correct
+    static bool printRow(std::ostream& out, const std::string& queue, size_t bytes, size_t bufferSize, const char* test, const Result& result, const char* unit) {
+        out << std::left << std::setw(28) << queue << std::right
+            << std::setw(9) << bytes
+            << std::setw(9) << (bufferSize != 0 ? std::to_string(bufferSize) : std::string("-"))
+            << std::setw(16) << test
+            << std::setw(10) << std::fixed << std::setprecision(1) << result.value << ' ' << std::left << std::setw(5) << unit << std::right
+            << (result.correct ? "" : "  WRONG") << std::endl;
+        return result.correct;
+    }
+
+    template <typename T>
+    struct type_tag {
+        using type = T;
+    };
+
+    template <size_t Bytes, size_t Size>
+    static bool runFixed(std::ostream& out, uint64_t count) {
+        using T = Element<Bytes>;
+        const uint64_t roundTrips = std::max<uint64_t>(count / 100, 1);
+        auto runQueue = [&](const std::string& name, auto tag) {
+            using Queue = typename decltype(tag)::type;
+            bool correct = printRow(out, name, Bytes, Size, "throughput", throughput<Queue, Bytes>(count), "M/s");
+            correct &= printRow(out, name, Bytes, Size, "bulk throughput", bulkThroughput<Queue, Bytes, Size>(count), "M/s");
+            correct &= printRow(out, name, Bytes, Size, "round trip", latency<Queue, Bytes>(roundTrips), "ns");
+            return correct;
+        };
+        bool correct = runQueue("concurrent_fixed_queue", type_tag<ext::concurrent_fixed_queue<T, Size>>{});
+        correct &= runQueue("flushable_fixed_queue", type_tag<ext::flushable_fixed_queue<T, Size>>{});
+        correct &= runQueue("unpadded reference", type_tag<AdjacentRing<T, Size>>{});
+        return correct;
+    }
+
+    template <size_t Bytes>
+    static bool runElement(std::ostream& out, uint64_t count) {
+        using T = Element<Bytes>;
+        const uint64_t roundTrips = std::max<uint64_t>(count / 100, 1);
+        bool correct = printRow(out, "concurrent_queue", Bytes, 0, "throughput", throughput<ext::concurrent_queue<T>, Bytes>(count), "M/s");
+        correct &= printRow(out, "concurrent_queue", Bytes, 0, "round trip", latency<ext::concurrent_queue<T>, Bytes>(roundTrips), "ns");
+        correct &= runFixed<Bytes, 64>(out, count);
+        correct &= runFixed<Bytes, 1024>(out, count);
+        correct &= runFixed<Bytes, 65536>(out, count);
+        // the buffer column is the node size here
+        correct &= printRow(out, "unrolled_linked_list_queue", Bytes, 16, "single thread", singleThreaded<ext::unrolled_linked_list_queue<T, 16>, Bytes>(count, 4096), "M/s");
+        correct &= printRow(out, "unrolled_linked_list_queue", Bytes, 256, "single thread", singleThreaded<ext::unrolled_linked_list_queue<T, 256>, Bytes>(count, 4096), "M/s");
+        correct &= printRow(out, "std::queue", Bytes, 0, "single thread", singleThreaded<std::queue<T>, Bytes>(count, 4096), "M/s");
+        return correct;
+    }
+
+public:
+    /**
+     * Runs all the queue benchmarks, passing count elements through each queue (the round trip tests use a hundredth of that).
+     * Returns false if any queue delivered different elements than were pushed.
+     */
+    static bool run(std::ostream& out, uint64_t count) {
+        out << count << " elements per test, " << std::thread::hardware_concurrency() << " hardware thread(s)" << std::endl;
+        printHeader(out);
+        bool correct = runElement<1>(out, count);
+        correct &= runElement<8>(out, count);
+        correct &= runElement<64>(out, count);
+        return correct;
+    }
+};
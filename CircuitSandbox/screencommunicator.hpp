@@ -11,40 +11,155 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
 #include "declarations.hpp"
 #include "communicator.hpp"
+#include "binary_io.hpp"
 
 class ScreenCommunicator final : public Communicator {
 public:
     using element_t = ScreenCommunicatorElement;
-    struct Input {
-        // this is a bit field
-        // state : queue of states for communicator (up to 5 in queue)
-        // count : number of states in queue excluding the first (live) one
-        uint8_t state : 5, count : 3;
-    } input; // prepared and used by simulator thread only!
-    void insertEvent(bool value) noexcept {
-        if (input.count < 4) {
-            input.state |= (value << (++input.count));
+
+    // default number of levels that can wait to be received (see setInputDepth())
+    constexpr static size_t DEFAULT_INPUT_DEPTH = 4096;
+
+private:
+    constexpr static size_t wordBits = 64;
+
+    // all these are used by the simulator thread only!
+    bool level = false; // the level being received
+    // ring of the levels waiting to be received, one per step, oldest first
+    // the bits of the ring are [pendingBegin, pendingEnd) modulo the capacity (the number of bits in pendingWords, which is a power of two)
+    std::vector<uint64_t> pendingWords;
+    uint64_t pendingBegin = 0;
+    uint64_t pendingEnd = 0;
+
+    size_t capacity() const noexcept {
+        return pendingWords.size() * wordBits;
+    }
+
+    bool pendingBit(uint64_t index) const noexcept {
+        return (pendingWords[(index / wordBits) & (pendingWords.size() - 1)] >> (index % wordBits)) & 1;
+    }
+
+public:
+    ScreenCommunicator() {
+        setInputDepth(DEFAULT_INPUT_DEPTH);
+    }
+
+    /**
+     * Sets the number of levels that can wait to be received (rounded up to a power of two, and at least 64).
+     * The levels that are waiting are kept, except the newest ones if there are more than the new depth.
+     * Must be synchronized with all other method calls.
+     */
+    void setInputDepth(size_t depth) {
+        size_t words = 1;
+        while (words * wordBits < depth) words *= 2;
+        if (words == pendingWords.size()) return;
+        std::vector<uint64_t> oldWords(words, 0);
+        pendingWords.swap(oldWords);
+        const uint64_t oldBegin = pendingBegin;
+        const uint64_t oldEnd = std::min(pendingEnd, pendingBegin + capacity());
+        pendingBegin = pendingEnd = 0;
+        for (uint64_t i = oldBegin; i != oldEnd; ++i) {
+            const bool bit = (oldWords[(i / wordBits) & (oldWords.size() - 1)] >> (i % wordBits)) & 1;
+            insertBits(bit, 1);
         }
-        else {
-            input.state |= (value << 4);
+    }
+
+    /**
+     * Number of levels that can be inserted before the ring is full.
+     */
+    size_t inputSpace() const noexcept {
+        return capacity() - static_cast<size_t>(pendingEnd - pendingBegin);
+    }
+
+    /**
+     * Appends the lowest count bits of bits (lowest first) to the levels that are waiting, to be received one per step.
+     * Returns false (without inserting anything) if there is not enough space.
+     * @pre 1 <= count <= 64
+     */
+    bool insertBits(uint64_t bits, size_t count) noexcept {
+        if (count > inputSpace()) return false;
+        const uint64_t mask = count == wordBits ? ~uint64_t{ 0 } : (uint64_t{ 1 } << count) - 1;
+        bits &= mask;
+        const size_t wordMask = pendingWords.size() - 1;
+        const size_t shift = pendingEnd % wordBits;
+        uint64_t& first = pendingWords[(pendingEnd / wordBits) & wordMask];
+        first = (first & ~(mask << shift)) | (bits << shift);
+        if (shift + count > wordBits) {
+            // the rest goes to the low bits of the next word
+            uint64_t& second = pendingWords[(pendingEnd / wordBits + 1) & wordMask];
+            const uint64_t secondMask = mask >> (wordBits - shift);
+            second = (second & ~secondMask) | (bits >> (wordBits - shift));
         }
+        pendingEnd += count;
+        return true;
     }
+
     bool receive() noexcept override {
-        if (input.count > 0) {
-            input.state >>= 1;
-            --input.count;
+        if (pendingBegin != pendingEnd) {
+            level = pendingBit(pendingBegin++);
         }
-        return input.state & 1;
+        return level;
+    }
+    bool idle() const noexcept override {
+        // new levels are inserted by the simulator, which wakes up when they are sent
+        return pendingBegin == pendingEnd;
     }
     void refresh() noexcept override {
-        input.state = 0;
-        input.count = 0;
+        level = false;
+        pendingBegin = pendingEnd = 0;
+    }
+    // the format starts with two bytes that older versions (which could only hold five levels) never wrote, so that their checkpoints can still be read:
+    // [level] [checkpointMarker] [number of waiting levels (uint32)] [array of the waiting levels, 8 per byte, oldest in the lowest bit]
+    void writeCheckpoint(std::ostream& out) const override {
+        const uint32_t count = static_cast<uint32_t>(pendingEnd - pendingBegin);
+        ext::write_binary(out, static_cast<uint8_t>(level));
+        ext::write_binary(out, checkpointMarker);
+        ext::write_binary(out, count);
+        std::vector<uint8_t> bytes((static_cast<size_t>(count) + 7) / 8, 0);
+        for (uint32_t i = 0; i != count; ++i) {
+            bytes[i / 8] |= static_cast<uint8_t>(pendingBit(pendingBegin + i)) << (i % 8);
+        }
+        ext::write_binary_array(out, bytes.data(), bytes.size());
+    }
+    bool readCheckpoint(std::istream& in) override {
+        uint8_t first, second;
+        if (!ext::read_binary(in, first) || !ext::read_binary(in, second)) return false;
+        if (second != checkpointMarker) {
+            // the old format: [state] [count], where the lowest bit of state is the level being received and the next count bits are the waiting levels
+            if (first >= (1 << 5) || second > 4) return false;
+            refresh();
+            level = first & 1;
+            insertBits(first >> 1, second);
+            return true;
+        }
+        uint32_t count;
+        if (first > 1 || !ext::read_binary(in, count)) return false;
+        std::vector<uint8_t> bytes;
+        if (!ext::read_binary_array(in, bytes, (static_cast<size_t>(count) + 7) / 8) || bytes.size() != (static_cast<size_t>(count) + 7) / 8) return false;
+        if (count > capacity()) setInputDepth(count);
+        refresh();
+        level = first;
+        for (uint32_t i = 0; i < count; i += 8) {
+            insertBits(bytes[i / 8], std::min<uint32_t>(8, count - i));
+        }
+        return true;
+    }
+    size_t memoryUsage() const noexcept override {
+        return sizeof(ScreenCommunicator) + pendingWords.capacity() * sizeof(uint64_t);
     }
+
+private:
+    constexpr static uint8_t checkpointMarker = 0xFF;
 };
 
 struct ScreenInputCommunicatorEvent {
+    uint64_t stepNumber; // the event is received by the first step whose number (see Simulator::getStepNumber()) is at least this, so 0 means the next step
     int32_t communicatorIndex;
-    bool turnOn;
+    uint8_t count; // number of levels in bits (1 to 64)
+    uint64_t bits; // the levels, one per step, lowest bit first
 };
@@ -47,7 +47,7 @@ private:
                 using ElementType = std::decay_t<decltype(element)>;
                 if constexpr(std::is_same_v<ScreenCommunicatorElement, ElementType>) {
                     // there is a communicator under the mouse
-                    changeTarget(element.communicator.get());
+                    changeTarget(canvas().communicatorOf(element));
                 }
                 else {
                     // the thing under the mouse isn't a communicator
@@ -28,9 +28,13 @@ SelectionAction::SelectionAction(MainWindow& mainWindow, State state) :SaveableA
 // destructor, called to finish the action immediately
 SelectionAction::~SelectionAction() {
     // note that base is only shrunk on destruction
-    auto baseTrans = canvas().shrinkDataMatrix();
+    // (elements were only removed from base in the edited area, so the tiles that became empty can only be there)
+    // the canvas may be large, so its edges are scanned and the selection is copied in parallel
+    const auto [editedTopLeft, editedBottomRight] = editedBounds();
+    auto baseTrans = canvas().shrinkDataMatrix(editedTopLeft, editedBottomRight, &ext::thread_pool::shared());
     if (state != State::SELECTING) {
-        auto[tmpDefaultState, translation] = CanvasState::merge(std::move(canvas()), -baseTrans, std::move(selection), selectionTrans);
+        if (!selection.empty()) markEdited(selectionTrans, selectionTrans + selection.size());
+        auto[tmpDefaultState, translation] = CanvasState::merge(std::move(canvas()), -baseTrans, std::move(selection), selectionTrans, &ext::thread_pool::shared());
         canvas() = std::move(tmpDefaultState);
         deltaTrans = std::move(translation);
     }
@@ -63,16 +67,18 @@ ActionEventResult SelectionAction::startWithPlayAreaMouseButtonDown(const SDL_Mo
 }
 
 void SelectionAction::startBySelectingAll(MainWindow& mainWindow, const ActionStarter& starter) {
-    if (mainWindow.stateManager.defaultState.empty()) return;
+    if (mainWindow.stateManager.defaultState.empty() || mainWindow.stateManager.rejectIfViewOnly(mainWindow)) return;
 
     auto& action = starter.start<SelectionAction>(mainWindow, State::SELECTED);
     action.selection = action.canvas().splice(0, 0, action.canvas().width(), action.canvas().height());
     action.selectionTrans = { 0, 0 };
+    action.markEdited({ 0, 0 }, action.selection.size());
     // action.selectionOrigin = { 0, 0 };
     // action.selectionEnd = action.selection.size() - ext::point{ 1, 1 };
 }
 
 void SelectionAction::startByPasting(MainWindow& mainWindow, PlayArea& playArea, const ActionStarter& starter, std::optional<int32_t> index) {
+    if (mainWindow.stateManager.rejectIfViewOnly(mainWindow)) return;
     auto& action = starter.start<SelectionAction>(mainWindow, State::MOVED);
     action.selection = index ? mainWindow.clipboard.read(*index) : mainWindow.clipboard.read();
     if (action.selection.empty()) return;
@@ -312,48 +318,78 @@ bool SelectionAction::disablePlayAreaDefaultRender() const {
     return !selection.empty();
 }
 
-// rendering function, render the selection (since base will already be rendered)
+void SelectionAction::updateSelectionRaster(uint32_t pixelFormat, bool defaultView) const {
+    const bool modifiable = state == State::SELECTING || state == State::SELECTED;
+    if (selectionRaster.version == selection.version() && selectionRaster.pixelFormat == pixelFormat && selectionRaster.defaultView == defaultView && selectionRaster.modifiable == modifiable) return;
+    selectionRaster.version = selection.version();
+    selectionRaster.pixelFormat = pixelFormat;
+    selectionRaster.defaultView = defaultView;
+    selectionRaster.modifiable = modifiable;
+
+    const size_t width = static_cast<size_t>(selection.width());
+    selectionRaster.colors.assign(width * static_cast<size_t>(selection.height()), 0);
+    selectionRaster.masks.assign(selectionRaster.colors.size(), 0);
+    invoke_RGB_format(pixelFormat, [&](const auto format_tag) {
+        using FormatType = decltype(format_tag);
+        invoke_bool(defaultView, [&](const auto defaultView_tag) {
+            using DefaultViewType = decltype(defaultView_tag);
+            // empty tiles have no elements, so they can be skipped
+            selection.dataMatrix.for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+                std::visit(visitor{
+                    [](std::monostate) {},
+                    [&](const auto& element) {
+                        alignas(uint32_t) SDL_Color computedColor = element.template computeDisplayColor<DefaultViewType::value>();
+                        if (modifiable) {
+                            computedColor.b = 0xFF; // colour the selection blue if it can still be modified
+                        }
+                        else {
+                            computedColor.r = 0xFF; // otherwise colour the selection red
+                        }
+                        const size_t index = static_cast<size_t>(pt.y) * width + static_cast<size_t>(pt.x);
+                        selectionRaster.colors[index] = fast_MapRGB<FormatType::value>(computedColor);
+                        selectionRaster.masks[index] = ~uint32_t{ 0 };
+                    },
+                }, element);
+            });
+        });
+    });
+}
+
+// rendering function, render the base and the selection over it
 void SelectionAction::renderPlayAreaSurface(uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& renderRect, int32_t pitch) const {
     if (!selection.empty()) {
         bool defaultView = playArea().isDefaultView();
-
-        invoke_RGB_format(pixelFormat, [&](const auto format_tag) {
-            using FormatType = decltype(format_tag);
-            invoke_bool(defaultView, [&](const auto defaultView_tag) {
-                using DefaultViewType = decltype(defaultView_tag);
-
-                for (int32_t y = renderRect.y; y != renderRect.y + renderRect.h; ++y, pixelBuffer += pitch) {
-                    uint32_t* pixel = pixelBuffer;
+        const DisplayColorTable& colorTable = playArea().getColorTable();
+        updateSelectionRaster(pixelFormat, defaultView);
+
+        // the columns of the render rectangle covered by the selection
+        const int32_t selectionBegin = std::max(renderRect.x, selectionTrans.x);
+        const int32_t selectionEnd = std::min(renderRect.x + renderRect.w, selectionTrans.x + selection.width());
+
+        invoke_bool(defaultView, [&](const auto defaultView_tag) {
+            using DefaultViewType = decltype(defaultView_tag);
+
+            // like StateManager::fillSurface(), bands of rows are drawn in parallel
+            playArea().getRenderPool().parallel_for_ranges(renderRect.h, StateManager::renderBandRows, [&](size_t bandBegin, size_t bandEnd) {
+                uint32_t* row = pixelBuffer + static_cast<int32_t>(bandBegin) * pitch;
+                for (int32_t y = renderRect.y + static_cast<int32_t>(bandBegin); y != renderRect.y + static_cast<int32_t>(bandEnd); ++y, row += pitch) {
+                    // draw base
+                    uint32_t* pixel = row;
                     for (int32_t x = renderRect.x; x != renderRect.x + renderRect.w; ++x, ++pixel) {
                         const ext::point canvasPt{ x, y };
-                        uint32_t color = 0;
-                        // draw base, check if the requested pixel inside the buffer
-                        if (canvas().contains(canvasPt)) {
-                            std::visit(visitor{
-                                [](std::monostate) {},
-                                [&color](const auto& element) {
-                                color = fast_MapRGB<FormatType::value>(element.template computeDisplayColor<DefaultViewType::value>());
-                            },
-                                }, canvas()[canvasPt]);
-                        }
+                        *pixel = canvas().contains(canvasPt) ? colorTable.get<DefaultViewType::value>(std::as_const(canvas())[canvasPt]) : 0;
+                    }
 
-                        // draw selection, check if the requested pixel inside the buffer
-                        if (selection.contains(canvasPt - selectionTrans)) {
-                            std::visit(visitor{
-                                [](std::monostate) {},
-                                [this, &color](const auto& element) {
-                                alignas(uint32_t) SDL_Color computedColor = element.template computeDisplayColor<DefaultViewType::value>();
-                                if (state == State::SELECTING || state == State::SELECTED) {
-                                    computedColor.b = 0xFF; // colour the selection blue if it can still be modified
-                                }
-                                else {
-                                    computedColor.r = 0xFF; // otherwise colour the selection red
-                                }
-                                color = fast_MapRGB<FormatType::value>(computedColor);
-                            },
-                                }, selection[canvasPt - selectionTrans]);
-                        }
-                        *pixel = color;
+                    // draw selection over it, without branches so that the compiler can vectorize it
+                    const int32_t selectionY = y - selectionTrans.y;
+                    if (selectionY < 0 || selectionY >= selection.height() || selectionBegin >= selectionEnd) continue;
+                    const size_t offset = static_cast<size_t>(selectionY) * static_cast<size_t>(selection.width()) + static_cast<size_t>(selectionBegin - selectionTrans.x);
+                    const uint32_t* colors = selectionRaster.colors.data() + offset;
+                    const uint32_t* masks = selectionRaster.masks.data() + offset;
+                    uint32_t* out = row + (selectionBegin - renderRect.x);
+                    const size_t count = static_cast<size_t>(selectionEnd - selectionBegin);
+                    for (size_t i = 0; i != count; ++i) {
+                        out[i] = (out[i] & ~masks[i]) | colors[i];
                     }
                 }
             });
@@ -11,8 +11,11 @@
 #pragma once
 
 #include <functional> // for std::reference_wrapper
+#include <utility> // for std::as_const
+#include <vector>
 #include <SDL.h>
 #include "point.hpp"
+#include "heap_matrix.hpp"
 #include "saveableaction.hpp"
 #include "playarea.hpp"
 #include "mainwindow.hpp"
@@ -53,6 +56,24 @@ private:
     NotificationDisplay::UniqueNotification notification;
     bool notificationActive = false;
 
+    // the selection drawn in the pixel format of the play area, so that moving it around only blends rows of pixels (see renderPlayAreaSurface())
+    // it is redrawn by updateSelectionRaster() when the selection, its tint, the view or the pixel format changes
+    struct SelectionRaster {
+        std::pair<uint64_t, uint64_t> version{ 0, 0 }; // selection.version() when it was drawn (no selection has version zero)
+        uint32_t pixelFormat = 0;
+        bool defaultView = false;
+        bool modifiable = false; // whether it is tinted blue (instead of red)
+        // row-major, selection.width() pixels per row
+        std::vector<uint32_t> colors; // zero where the selection has no element
+        std::vector<uint32_t> masks; // all ones where the selection has an element, zero elsewhere
+    };
+    mutable SelectionRaster selectionRaster;
+
+    /**
+     * Redraws selectionRaster if it is not of the current selection in the given format.
+     */
+    void updateSelectionRaster(uint32_t pixelFormat, bool defaultView) const;
+
     friend class ClipboardAction;
 
     /**
@@ -77,16 +98,17 @@ private:
 
             // no elements in the selection rect
             if (selectionSize.x <= 0 || selectionSize.y <= 0) return !selection.empty();
+            markEdited(topLeft, bottomRight);
 
             // splice out a part of the working selection
             CanvasState unselected = selection.splice(topLeft.x - selectionTrans.x, topLeft.y - selectionTrans.y, selectionSize.x, selectionSize.y);
-            selectionTrans -= selection.shrinkDataMatrix();
+            selectionTrans -= selection.shrinkDataMatrix(topLeft - selectionTrans, bottomRight - selectionTrans);
 
             // shrink the unselected part
             ext::point unselectedShrinkTrans = unselected.shrinkDataMatrix();
 
             // merge the unselected part with base
-            auto tmpBase = CanvasState::merge(std::move(unselected), topLeft - unselectedShrinkTrans, std::move(base), { 0, 0 }).first;
+            auto tmpBase = CanvasState::merge(std::move(unselected), topLeft - unselectedShrinkTrans, std::move(base), { 0, 0 }, &ext::thread_pool::shared()).first;
             base = std::move(tmpBase);
         }
         else {
@@ -97,6 +119,7 @@ private:
 
             // no elements in the selection rect
             if (selectionSize.x <= 0 || selectionSize.y <= 0) return !selection.empty();
+            markEdited(topLeft, bottomRight);
 
             // splice out the newest selection from the base
             CanvasState newSelection = base.splice(topLeft.x, topLeft.y, selectionSize.x, selectionSize.y);
@@ -124,10 +147,11 @@ private:
 
         // splice out the connected component
         auto [connectedComponent, componentTrans] = spliceConnectedComponent<UseExtendedComponent>(pt);
+        markEdited(componentTrans, componentTrans + connectedComponent.size());
 
         if (subtract) {
             // merge the component with base
-            auto tmpBase = CanvasState::merge(std::move(base), { 0, 0 }, std::move(connectedComponent), componentTrans).first;
+            auto tmpBase = CanvasState::merge(std::move(base), { 0, 0 }, std::move(connectedComponent), componentTrans, &ext::thread_pool::shared()).first;
             base = std::move(tmpBase);
         }
         else {
@@ -179,10 +203,23 @@ private:
 
         newState.dataMatrix = CanvasState::matrix_t(spliceSize);
 
+        // the component might come from both the base and the selection, so the new state gets the communicators of both (the ids of the selection are offset)
+        const int32_t selectionIdOffset = static_cast<int32_t>(base.communicators.size());
+        newState.communicators = base.communicators;
+        newState.communicators.insert(newState.communicators.end(), selection.communicators.begin(), selection.communicators.end());
+
         // swap the data over to the new state
         while (!componentData.empty()) {
             auto& [pt, element] = componentData.back();
 
+            if (selection.contains(pt - selectionTrans) && &std::as_const(selection)[pt - selectionTrans] == &element.get()) {
+                std::visit([&](auto& element) {
+                    if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                        if (element.communicatorId >= 0) element.communicatorId += selectionIdOffset;
+                    }
+                }, element.get());
+            }
+
             using std::swap;
             // swap will give correct results because matrix_t is initialized to std::monostate elements
             swap(element.get(), newState.dataMatrix[pt - minPt]);
@@ -279,14 +316,17 @@ private:
                             std::holds_alternative<FileOutputCommunicatorElement>(nextElement)) {
                             pendingVisit.emplace(nextPt, axis);
                         }
+                        else if (std::holds_alternative<StreamInputCommunicatorElement>(currElement) &&
+                            std::holds_alternative<StreamInputCommunicatorElement>(nextElement)) {
+                            pendingVisit.emplace(nextPt, axis);
+                        }
                     }
                 });
             }
         }
         else {
             // using triple-click
-            ext::heap_matrix<bool> visitedMatrix(base.width(), base.height());
-            visitedMatrix.fill(false);
+            ext::heap_matrix<bool> visitedMatrix(base.width(), base.height(), false);
 
             std::stack<ext::point> pendingVisit;
             // flood fill from origin along both axes; guaranteed to never visit monostate
@@ -359,7 +399,7 @@ public:
     // disable default rendering when not SELECTING
     bool disablePlayAreaDefaultRender() const override;
 
-    // rendering function, render the selection (since base will already be rendered)
+    // rendering function, render the base and the selection over it (from selectionRaster)
     void renderPlayAreaSurface(uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& renderRect, int32_t pitch) const override;
 
     // rendering function, render the selection rectangle if it exists
@@ -0,0 +1,478 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Distributed runs, which split the gates and relays of a circuit between several machines (nodes), for circuits whose steps are limited by the memory bandwidth of one machine.
+ * Every step only reads the old state and writes the new one, so each node can evaluate its own gates and relays as long as it has the old levels of the components they read.
+ * In every step, the coordinator (node 0, a batch run with -d, see ClusterCoordinator) sends each node the old levels of the components that its gates and relays read,
+ * evaluates its own gates and relays meanwhile, and then ORs in the outputs that each node sends back.
+ * The sources, the communicators and the flood fill (which may cross any part of the circuit) stay on the coordinator.
+ * The other nodes run CircuitSandbox --node with the same save file (see ClusterNode), and are told which gates and relays are theirs by the coordinator (see Simulator::NodeAssignment).
+ *
+ * The coordinator talks to each node over TCP, with little-endian numbers:
+ *   coordinator to node  "CCSBNODE" [uint32 version] [uint64 circuit fingerprint] [uint32 number of nodes] [uint32 node] [uint32 number of components] [uint32 number of relay pixels]
+ *                        [uint32 node of each component]... [uint32 node of each relay pixel]...
+ *   node to coordinator  [uint8 accepted] (0 if the node has compiled a different circuit, see Simulator::nativeStepFingerprint())
+ * then for every step:
+ *   coordinator to node  [uint8 STEP] [input bits]
+ *   node to coordinator  [output bits]
+ * and at the end:
+ *   coordinator to node  [uint8 STOP]
+ * The input bits are the levels of the components that the gates and relays of the node read, and the output bits are the levels of the components that its gates drive followed by
+ * the conductivity of the relay pixels of its relays, each in increasing order of index (see ClusterCoordinator::Links), packed 8 to a byte with the first in the lowest bit.
+ *
+ * Usage: CircuitSandbox --node [-p port] [-t threads] savefile
+ *   -p  TCP port to wait for the coordinator on (default 5731)
+ *   -t  number of threads used to evaluate the gates and relays of this node (default 1)
+ * Serves one run, and exits with 0 when the coordinator ends it.  Exits with 1 if the save file cannot be loaded, the port cannot be opened, the coordinator has compiled
+ * a different circuit, or the connection is lost, and 2 if the arguments are wrong.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/connect.hpp>
+
+#include "canvasstate.hpp"
+#include "simulator.hpp"
+#include "simulationprotocol.hpp"
+#include "fileutils.hpp"
+
+struct ClusterProtocol {
+    constexpr static char magic[8] = { 'C', 'C', 'S', 'B', 'N', 'O', 'D', 'E' };
+    constexpr static uint32_t version = 1;
+    constexpr static uint16_t defaultPort = 5731;
+
+    enum class Command : uint8_t {
+        STOP = 0,
+        STEP = 1
+    };
+
+    static size_t packedSize(size_t count) noexcept {
+        return (count + 7) / 8;
+    }
+
+    /**
+     * Appends level(0), ..., level(count - 1) to out, 8 to a byte with the first in the lowest bit.
+     */
+    template <typename Level>
+    static void packBits(std::string& out, size_t count, Level&& level) {
+        for (size_t i = 0; i < count; i += 8) {
+            uint8_t byte = 0;
+            for (size_t j = i; j != std::min(count, i + 8); ++j) {
+                byte |= static_cast<uint8_t>(static_cast<uint8_t>(level(j)) << (j - i));
+            }
+            out.push_back(static_cast<char>(byte));
+        }
+    }
+
+    /**
+     * Invokes set(i, bit) for each of the count bits packed by packBits() at in.
+     */
+    template <typename Set>
+    static void unpackBits(const uint8_t* in, size_t count, Set&& set) {
+        for (size_t i = 0; i != count; ++i) {
+            set(i, static_cast<bool>((in[i / 8] >> (i % 8)) & 1));
+        }
+    }
+};
+
+/**
+ * The coordinator of a distributed run (node 0), which hands out the gates and relays of the other nodes and exchanges the levels with them in every step.
+ * It is used by the simulator thread during the steps, so failed() and error() may only be read while the simulation is stopped.
+ */
+class ClusterCoordinator : public Simulator::RemoteNodes {
+public:
+    // what a node exchanges in every step (each sorted and without duplicates)
+    struct Links {
+        std::vector<int32_t> inputComponents; // the components read by the gates and relays of the node
+        std::vector<int32_t> outputComponents; // the components driven by the gates of the node
+        std::vector<int32_t> outputRelayPixels; // the relay pixels of the relays of the node
+        size_t outputBits() const noexcept {
+            return outputComponents.size() + outputRelayPixels.size();
+        }
+    };
+
+    /**
+     * Finds what the given node exchanges, from the compiled circuit before it is restricted (see Simulator::restrictToNode()).
+     */
+    static Links makeLinks(const Simulator& simulator, const Simulator::NodeAssignment& assignment, uint32_t node) {
+        Links links;
+        const auto addInputs = [&](const auto& element) {
+            links.inputComponents.insert(links.inputComponents.end(), element.inputComponents.begin(), element.inputComponents.end());
+        };
+        simulator.staticData.logicGates.forEach([&](const auto& x) {
+            x.forEach([&](const auto& y) {
+                for (const auto& gate : y) {
+                    if (assignment.componentNodes[gate.outputComponent] != node) continue;
+                    addInputs(gate);
+                    links.outputComponents.push_back(gate.outputComponent);
+                }
+            });
+        });
+        simulator.staticData.relays.forEach([&](const auto& x) {
+            x.forEach([&](const auto& y) {
+                for (const auto& relay : y) {
+                    if (assignment.relayPixelNodes[relay.outputRelayPixel] != node) continue;
+                    addInputs(relay);
+                    links.outputRelayPixels.push_back(relay.outputRelayPixel);
+                }
+            });
+        });
+        for (std::vector<int32_t>* indices : { &links.inputComponents, &links.outputComponents, &links.outputRelayPixels }) {
+            std::sort(indices->begin(), indices->end());
+            indices->erase(std::unique(indices->begin(), indices->end()), indices->end());
+        }
+        return links;
+    }
+
+private:
+    using tcp = boost::asio::ip::tcp;
+
+    struct Node {
+        std::string address;
+        tcp::socket socket;
+        Links links;
+        std::string message; // the message being sent, kept to reuse its buffer
+        std::vector<uint8_t> received; // the output bits of the current step
+        Node(std::string address, boost::asio::io_context& ioContext) : address(std::move(address)), socket(ioContext) {}
+    };
+
+    boost::asio::io_context ioContext;
+    std::vector<std::unique_ptr<Node>> nodes; // node i + 1 is nodes[i]
+    bool hasFailed = false;
+    std::string errorMessage;
+
+    void fail(const Node& node, const std::string& message) {
+        if (hasFailed) return;
+        hasFailed = true;
+        errorMessage = node.address + ": " + message;
+    }
+
+    void sendInputs(const Simulator::DynamicData& oldState) override {
+        if (hasFailed) return;
+        for (const std::unique_ptr<Node>& node : nodes) {
+            node->message.clear();
+            SimulationProtocol::append(node->message, static_cast<uint8_t>(ClusterProtocol::Command::STEP));
+            const std::vector<int32_t>& inputs = node->links.inputComponents;
+            ClusterProtocol::packBits(node->message, inputs.size(), [&](size_t i) {
+                return oldState.componentLogicLevels[inputs[i]];
+            });
+            boost::system::error_code ec;
+            boost::asio::write(node->socket, boost::asio::buffer(node->message), ec);
+            if (ec) {
+                fail(*node, ec.message());
+                return;
+            }
+        }
+    }
+
+    void receiveOutputs(Simulator::DynamicData& newState) override {
+        if (hasFailed) return;
+        for (const std::unique_ptr<Node>& node : nodes) {
+            boost::system::error_code ec;
+            boost::asio::read(node->socket, boost::asio::buffer(node->received), ec);
+            if (ec) {
+                fail(*node, ec.message());
+                return;
+            }
+            const Links& links = node->links;
+            const size_t numComponents = links.outputComponents.size();
+            ClusterProtocol::unpackBits(node->received.data(), links.outputBits(), [&](size_t i, bool bit) {
+                if (i < numComponents) newState.componentLogicLevels.set_if(links.outputComponents[i], bit);
+                else newState.relayPixelIsConductive.set_if(links.outputRelayPixels[i - numComponents], bit);
+            });
+        }
+    }
+
+public:
+    ClusterCoordinator() = default;
+    ClusterCoordinator(const ClusterCoordinator&) = delete;
+    ClusterCoordinator& operator=(const ClusterCoordinator&) = delete;
+
+    ~ClusterCoordinator() {
+        close();
+    }
+
+    /**
+     * Connects to the nodes at the given addresses ("host:port"), which become nodes 1, 2, ... of the assignment, checks that they have compiled the same circuit,
+     * and sends them the assignment.  Then restricts the simulator to the gates and relays of node 0, and has it exchange the levels with the nodes in every step.
+     * Returns false (see error()) if a node cannot be reached or has a different circuit; the simulator is then left as it was.
+     * @pre simulation is currently stopped, and the assignment is of the compiled circuit and has addresses.size() + 1 nodes.
+     */
+    bool connect(Simulator& simulator, const std::vector<std::string>& addresses, const Simulator::NodeAssignment& assignment) {
+        const uint64_t fingerprint = simulator.nativeStepFingerprint();
+        std::string handshake(ClusterProtocol::magic, sizeof ClusterProtocol::magic);
+        SimulationProtocol::append(handshake, ClusterProtocol::version);
+        SimulationProtocol::append(handshake, fingerprint);
+        SimulationProtocol::append(handshake, assignment.numNodes);
+        const size_t nodeFieldPos = handshake.size();
+        SimulationProtocol::append(handshake, uint32_t{ 0 });
+        SimulationProtocol::append(handshake, static_cast<uint32_t>(assignment.componentNodes.size()));
+        SimulationProtocol::append(handshake, static_cast<uint32_t>(assignment.relayPixelNodes.size()));
+        for (const std::vector<uint32_t>* nodeList : { &assignment.componentNodes, &assignment.relayPixelNodes }) {
+            for (uint32_t node : *nodeList) {
+                SimulationProtocol::append(handshake, node);
+            }
+        }
+
+        tcp::resolver resolver(ioContext);
+        for (size_t i = 0; i != addresses.size(); ++i) {
+            const uint32_t nodeIndex = static_cast<uint32_t>(i + 1);
+            Node& node = *nodes.emplace_back(std::make_unique<Node>(addresses[i], ioContext));
+            const size_t colon = node.address.rfind(':');
+            if (colon == std::string::npos) {
+                fail(node, "not of the form host:port");
+                break;
+            }
+            boost::system::error_code ec;
+            const auto endpoints = resolver.resolve(node.address.substr(0, colon), node.address.substr(colon + 1), ec);
+            if (!ec) boost::asio::connect(node.socket, endpoints, ec);
+            if (!ec) node.socket.set_option(tcp::no_delay(true), ec);
+            SimulationProtocol::patch(handshake, nodeFieldPos, nodeIndex);
+            if (!ec) boost::asio::write(node.socket, boost::asio::buffer(handshake), ec);
+            uint8_t accepted = 0;
+            if (!ec) boost::asio::read(node.socket, boost::asio::buffer(&accepted, 1), ec);
+            if (ec) {
+                fail(node, ec.message());
+                break;
+            }
+            if (!accepted) {
+                fail(node, "has compiled a different circuit");
+                break;
+            }
+            node.links = makeLinks(simulator, assignment, nodeIndex);
+            node.received.resize(ClusterProtocol::packedSize(node.links.outputBits()));
+        }
+        if (hasFailed) {
+            nodes.clear();
+            return false;
+        }
+
+        simulator.restrictToNode(assignment, 0, this);
+        return true;
+    }
+
+    /**
+     * Returns true if a node could not be reached during the run; the steps since then are missing the outputs of the other nodes.
+     */
+    bool failed() const noexcept {
+        return hasFailed;
+    }
+
+    /**
+     * Describes why connect() failed or failed() is true.
+     */
+    const std::string& error() const noexcept {
+        return errorMessage;
+    }
+
+    /**
+     * Ends the run on all the nodes (they exit).
+     * @pre simulation is currently stopped.
+     */
+    void close() {
+        for (const std::unique_ptr<Node>& node : nodes) {
+            const uint8_t stop = static_cast<uint8_t>(ClusterProtocol::Command::STOP);
+            boost::system::error_code ec;
+            boost::asio::write(node->socket, boost::asio::buffer(&stop, 1), ec);
+            node->socket.close(ec);
+        }
+        nodes.clear();
+    }
+};
+
+/**
+ * A node of a distributed run other than the coordinator, which evaluates its share of the gates and relays whenever the coordinator sends it the levels that they read.
+ */
+class ClusterNode {
+private:
+    using tcp = boost::asio::ip::tcp;
+
+    uint16_t port = ClusterProtocol::defaultPort;
+    size_t threads = 1;
+    std::string savePath;
+
+    CanvasState state;
+    Simulator simulator;
+
+    bool parseArguments(int argc, char* argv[]) {
+        for (int i = 0; i != argc; ++i) {
+            const std::string arg = argv[i];
+            if ((arg == "-p" || arg == "-t") && i + 1 != argc) {
+                char* end;
+                const unsigned long long value = std::strtoull(argv[++i], &end, 10);
+                if (*end != '\0' || value == 0) return false;
+                if (arg == "-p") {
+                    if (value > UINT16_MAX) return false;
+                    port = static_cast<uint16_t>(value);
+                }
+                else threads = static_cast<size_t>(value);
+            }
+            else if (!arg.empty() && arg.front() != '-' && savePath.empty()) {
+                savePath = arg;
+            }
+            else {
+                return false;
+            }
+        }
+        return !savePath.empty();
+    }
+
+    // reads the handshake after the magic, and returns the assignment and the node, or false if it is malformed or not of this circuit
+    bool readHandshake(tcp::socket& socket, Simulator::NodeAssignment& assignment, uint32_t& node, boost::system::error_code& ec) {
+        std::vector<uint8_t> header(sizeof ClusterProtocol::magic + 28);
+        boost::asio::read(socket, boost::asio::buffer(header), ec);
+        if (ec || std::memcmp(header.data(), ClusterProtocol::magic, sizeof ClusterProtocol::magic) != 0) return false;
+        const uint8_t* in = header.data() + sizeof ClusterProtocol::magic;
+        const uint8_t* const end = header.data() + header.size();
+        uint32_t version, numComponents, numRelayPixels;
+        uint64_t fingerprint;
+        SimulationProtocol::read(in, end, version);
+        SimulationProtocol::read(in, end, fingerprint);
+        SimulationProtocol::read(in, end, assignment.numNodes);
+        SimulationProtocol::read(in, end, node);
+        SimulationProtocol::read(in, end, numComponents);
+        SimulationProtocol::read(in, end, numRelayPixels);
+        if (version != ClusterProtocol::version || fingerprint != simulator.nativeStepFingerprint() || node == 0 || node >= assignment.numNodes) return false;
+        if (numComponents != simulator.staticData.components.size || numRelayPixels != simulator.staticData.relayPixels.size) return false;
+
+        std::vector<uint8_t> nodes((static_cast<size_t>(numComponents) + numRelayPixels) * sizeof(uint32_t));
+        boost::asio::read(socket, boost::asio::buffer(nodes), ec);
+        if (ec) return false;
+        in = nodes.data();
+        assignment.componentNodes.resize(numComponents);
+        assignment.relayPixelNodes.resize(numRelayPixels);
+        for (std::vector<uint32_t>* nodeList : { &assignment.componentNodes, &assignment.relayPixelNodes }) {
+            for (uint32_t& entry : *nodeList) {
+                SimulationProtocol::read(in, nodes.data() + nodes.size(), entry);
+                if (entry >= assignment.numNodes) return false;
+            }
+        }
+        return true;
+    }
+
+    // returns the exit code
+    int execute() {
+        {
+            std::ifstream saveFile(savePath, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile, &ext::thread_pool::shared()) != CanvasState::ReadResult::OK) {
+                std::cerr << savePath << ": cannot be loaded" << std::endl;
+                return 1;
+            }
+        }
+        simulator.setWorkerThreads(threads);
+        simulator.compile(state);
+
+        boost::asio::io_context ioContext;
+        tcp::acceptor acceptor(ioContext);
+        tcp::socket socket(ioContext);
+        boost::system::error_code ec;
+        acceptor.open(tcp::v4(), ec);
+        if (!ec) acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+        if (!ec) acceptor.bind(tcp::endpoint(tcp::v4(), port), ec);
+        if (!ec) acceptor.listen(1, ec);
+        if (ec) {
+            std::cerr << "port " << port << ": " << ec.message() << std::endl;
+            return 1;
+        }
+        std::cout << savePath << ": waiting for the coordinator on port " << port << std::endl;
+        acceptor.accept(socket, ec);
+        acceptor.close();
+        if (!ec) socket.set_option(tcp::no_delay(true), ec);
+        if (ec) {
+            std::cerr << "port " << port << ": " << ec.message() << std::endl;
+            return 1;
+        }
+
+        Simulator::NodeAssignment assignment;
+        uint32_t node;
+        const bool accepted = readHandshake(socket, assignment, node, ec);
+        if (!ec) {
+            const uint8_t reply = accepted ? 1 : 0;
+            boost::asio::write(socket, boost::asio::buffer(&reply, 1), ec);
+        }
+        if (ec || !accepted) {
+            std::cerr << savePath << ": " << (ec ? ec.message() : std::string("the coordinator has compiled a different circuit")) << std::endl;
+            return 1;
+        }
+
+        const ClusterCoordinator::Links links = ClusterCoordinator::makeLinks(simulator, assignment, node);
+        simulator.restrictToNode(assignment, node, nullptr);
+        std::cout << savePath << ": node " << node << " of " << assignment.numNodes << ", " << simulator.getGateCount() << " gates and relays, reading "
+            << links.inputComponents.size() << " components" << std::endl;
+
+        const int32_t numComponents = static_cast<int32_t>(simulator.staticData.components.size);
+        const int32_t numRelayPixels = static_cast<int32_t>(simulator.staticData.relayPixels.size);
+        Simulator::DynamicData oldState(numComponents, numRelayPixels, 0);
+        Simulator::DynamicData newState(numComponents, numRelayPixels, 0);
+        std::vector<uint8_t> inputs(ClusterProtocol::packedSize(links.inputComponents.size()));
+        std::string outputs;
+        uint64_t steps = 0;
+        while (true) {
+            uint8_t command;
+            boost::asio::read(socket, boost::asio::buffer(&command, 1), ec);
+            if (ec || command != static_cast<uint8_t>(ClusterProtocol::Command::STEP)) break;
+            boost::asio::read(socket, boost::asio::buffer(inputs), ec);
+            if (ec) break;
+
+            // only the levels that the gates and relays of this node read are known, the others stay low
+            oldState.componentLogicLevels.clear();
+            ClusterProtocol::unpackBits(inputs.data(), links.inputComponents.size(), [&](size_t i, bool bit) {
+                oldState.componentLogicLevels.set_if(links.inputComponents[i], bit);
+            });
+            newState.clear();
+            simulator.calculateGatesAndRelays(oldState, newState);
+
+            outputs.clear();
+            const size_t numOutputComponents = links.outputComponents.size();
+            ClusterProtocol::packBits(outputs, links.outputBits(), [&](size_t i) {
+                return i < numOutputComponents ? newState.componentLogicLevels[links.outputComponents[i]] : newState.relayPixelIsConductive[links.outputRelayPixels[i - numOutputComponents]];
+            });
+            boost::asio::write(socket, boost::asio::buffer(outputs), ec);
+            if (ec) break;
+            ++steps;
+        }
+        std::cout << savePath << ": " << steps << " steps" << std::endl;
+        if (ec && ec != boost::asio::error::eof) {
+            std::cerr << savePath << ": " << ec.message() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+public:
+    /**
+     * Runs the node given by the arguments after CCSB_NODE_ARGUMENT until the coordinator ends the run, and returns the exit code of the process.
+     */
+    static int run(int argc, char* argv[], const char* processName) {
+        ClusterNode node;
+        if (!node.parseArguments(argc, argv)) {
+            std::cerr << "Usage: " << processName << " " CCSB_NODE_ARGUMENT " [-p port] [-t threads] savefile" << std::endl;
+            return 2;
+        }
+        return node.execute();
+    }
+};
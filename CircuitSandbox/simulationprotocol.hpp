@@ -0,0 +1,158 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * The messages between a simulation server (see SimulationServer) and its clients, over TCP.
+ * Every message is a one-byte type followed by its fields, which are little-endian.
+ *
+ * Client to server:
+ *   VIEWPORT  [int32 x] [int32 y] [int32 width] [int32 height]
+ *             the part of the canvas that the client shows; the server answers with a frame of the whole viewport, and then only with the parts that change
+ *             (only the part of the viewport on the canvas is sent, and a viewport whose far corner does not fit in an int32 is an error)
+ *   RUN       [uint8 running]
+ *             starts (1) or stops (0) the simulation, for every client
+ *   PRESS     [int32 x] [int32 y] [uint8 on]
+ *             presses (1) or releases (0) the screen communicator at the given point, like clicking it in the window
+ *
+ * Server to client:
+ *   HELLO     [uint32 version] [int32 canvas width] [int32 canvas height]
+ *             sent once, when the client connects
+ *   FRAME     [uint64 step number] [uint8 running] [uint32 number of rectangles] then for each rectangle: [int32 x] [int32 y] [int32 width] [int32 height] [uint32 number of runs] [runs]
+ *             the pixels of the viewport that changed since the previous frame sent to this client; each run is [uint8 length - 1] [uint8 pixel code],
+ *             and the runs cover the pixels of the rectangle in row-major order
+ *
+ * A pixel code is the index of the element in CanvasState::element_variant_t shifted left by one, with the logic level it displays in the lowest bit (see Simulator::readLiveView()).
+ */
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <boost/endian/conversion.hpp>
+
+#include "canvasstate.hpp"
+
+struct SimulationProtocol {
+    constexpr static uint32_t version = 1;
+
+    enum class ClientMessage : uint8_t {
+        VIEWPORT = 1,
+        RUN = 2,
+        PRESS = 3
+    };
+
+    enum class ServerMessage : uint8_t {
+        HELLO = 1,
+        FRAME = 2
+    };
+
+    // size of the fields after the type byte of each client message (0 if the type is unknown)
+    constexpr static size_t payloadSize(uint8_t type) noexcept {
+        switch (static_cast<ClientMessage>(type)) {
+        case ClientMessage::VIEWPORT: return 16;
+        case ClientMessage::RUN: return 1;
+        case ClientMessage::PRESS: return 9;
+        }
+        return 0;
+    }
+
+    // the largest viewport that a server sends, so that a client cannot make it encode arbitrarily large frames
+    constexpr static int64_t maxViewportArea = int64_t{ 1 } << 24;
+
+    static_assert(CanvasState::element_tags_t::size <= 128, "Element indices must fit in the pixel code.");
+
+    static uint8_t pixelCode(size_t elementIndex, bool level) noexcept {
+        return static_cast<uint8_t>((elementIndex << 1) | static_cast<size_t>(level));
+    }
+
+    template <typename T>
+    static void append(std::string& out, T value) {
+        boost::endian::native_to_little_inplace(value);
+        out.append(reinterpret_cast<const char*>(&value), sizeof value);
+    }
+
+    // overwrites the value at the given position of out (for counts that are only known after what they count was appended)
+    template <typename T>
+    static void patch(std::string& out, size_t pos, T value) {
+        boost::endian::native_to_little_inplace(value);
+        out.replace(pos, sizeof value, reinterpret_cast<const char*>(&value), sizeof value);
+    }
+
+    /**
+     * Reads a value from [in, end) and advances in, or returns false if there are not enough bytes.
+     */
+    template <typename T>
+    static bool read(const uint8_t*& in, const uint8_t* end, T& value) noexcept {
+        if (static_cast<size_t>(end - in) < sizeof value) return false;
+        std::memcpy(&value, in, sizeof value);
+        boost::endian::little_to_native_inplace(value);
+        in += sizeof value;
+        return true;
+    }
+
+    /**
+     * Appends pixel codes to a message as runs, preceded by the number of runs.
+     */
+    class RunEncoder {
+    private:
+        std::string& out;
+        size_t countPos;
+        uint32_t numRuns = 0;
+        uint8_t code = 0;
+        size_t length = 0;
+
+        void flush() {
+            if (length == 0) return;
+            append(out, static_cast<uint8_t>(length - 1));
+            append(out, code);
+            ++numRuns;
+            length = 0;
+        }
+
+    public:
+        explicit RunEncoder(std::string& out) : out(out), countPos(out.size()) {
+            append(out, uint32_t{ 0 });
+        }
+
+        void push(uint8_t newCode) {
+            if (length != 0 && (newCode != code || length == 256)) flush();
+            code = newCode;
+            ++length;
+        }
+
+        void finish() {
+            flush();
+            patch(out, countPos, numRuns);
+        }
+    };
+
+    /**
+     * Reads the runs of a rectangle of numPixels pixels (see RunEncoder) from [in, end), invoking callback(index, code) for each pixel in order.
+     * Returns false if the runs are truncated or do not cover exactly numPixels pixels.
+     */
+    template <typename Callback>
+    static bool decodeRuns(const uint8_t*& in, const uint8_t* end, size_t numPixels, Callback&& callback) {
+        uint32_t numRuns;
+        if (!read(in, end, numRuns)) return false;
+        size_t index = 0;
+        for (uint32_t i = 0; i != numRuns; ++i) {
+            uint8_t lengthMinusOne, code;
+            if (!read(in, end, lengthMinusOne) || !read(in, end, code)) return false;
+            const size_t runEnd = index + lengthMinusOne + 1;
+            if (runEnd > numPixels) return false;
+            for (; index != runEnd; ++index) {
+                callback(index, code);
+            }
+        }
+        return index == numPixels;
+    }
+};
@@ -0,0 +1,366 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Simulates a save file without the window (and without initializing SDL), and streams the part of it that each client is looking at over TCP (see SimulationProtocol),
+ * so that a huge circuit can run on a server while it is watched from machines that could not hold it.
+ * Each client gets the pixels of its viewport once, and then only the rectangles that changed (see Simulator::findChangedRects()), run-length encoded.
+ * A client that is slower than the frame rate simply gets fewer frames, each with everything that changed since the last one it received.
+ * The circuit is compiled once; clients can start and stop it and press its screen communicators, but the canvas cannot be edited remotely.
+ *
+ * Usage: CircuitSandbox --serve [-p port] [-t threads] [-f fps] [-d microseconds] [-r] savefile
+ *   -p  TCP port to listen on (default 5730)
+ *   -t  number of threads used to calculate each step (default: the number of cores)
+ *   -f  number of frames sent to each client per second (default 30)
+ *   -d  period of each step in microseconds (0 = as fast as possible; if not given, the default period of Simulator is used)
+ *   -r  start running immediately, instead of waiting for a client to start the simulation
+ * Runs until interrupted, then exits with 0.  Exits with 1 if the save file cannot be loaded or the port cannot be opened, and 2 if the arguments are wrong.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <cstdint>
+#include <csignal>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include "canvasstate.hpp"
+#include "simulator.hpp"
+#include "elements.hpp"
+#include "screencommunicator.hpp"
+#include "simulationprotocol.hpp"
+#include "fileutils.hpp"
+
+class SimulationServer {
+private:
+    using tcp = boost::asio::ip::tcp;
+
+    uint16_t port = 5730;
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    uint32_t framesPerSecond = 30;
+    bool periodGiven = false;
+    Simulator::period_t period{};
+    bool runImmediately = false;
+    std::string savePath;
+
+    CanvasState state;
+    Simulator simulator;
+
+    // everything below is only used by the thread that runs ioContext (which plays the part of the UI thread for the simulator)
+    boost::asio::io_context ioContext;
+    tcp::acceptor acceptor{ ioContext };
+    boost::asio::steady_timer frameTimer{ ioContext };
+    boost::asio::signal_set signals{ ioContext, SIGINT, SIGTERM };
+
+    struct Client {
+        tcp::socket socket;
+        std::array<uint8_t, 1 + 16> message; // the type and fields of the message being read
+        bool hasViewport = false;
+        ext::point viewportTopLeft, viewportBottomRight;
+        bool needsWholeViewport = true;
+        Simulator::LiveState sentState; // the state that the last frame was made from
+        std::string frame; // the frame being written
+        bool writing = false;
+        bool closed = false;
+        ScreenCommunicator* pressed = nullptr;
+
+        explicit Client(tcp::socket&& socket) : socket(std::move(socket)) {}
+    };
+    std::vector<std::shared_ptr<Client>> clients;
+
+    bool parseArguments(int argc, char* argv[]) {
+        for (int i = 0; i != argc; ++i) {
+            const std::string arg = argv[i];
+            if ((arg == "-p" || arg == "-t" || arg == "-f" || arg == "-d") && i + 1 != argc) {
+                char* end;
+                const unsigned long long value = std::strtoull(argv[++i], &end, 10);
+                if (*end != '\0') return false;
+                if (arg == "-p") {
+                    if (value == 0 || value > UINT16_MAX) return false;
+                    port = static_cast<uint16_t>(value);
+                }
+                else if (arg == "-t") {
+                    if (value == 0) return false;
+                    threads = static_cast<size_t>(value);
+                }
+                else if (arg == "-f") {
+                    if (value == 0 || value > 1000) return false;
+                    framesPerSecond = static_cast<uint32_t>(value);
+                }
+                else {
+                    periodGiven = true;
+                    period = std::chrono::duration_cast<Simulator::period_t>(std::chrono::microseconds(value));
+                }
+            }
+            else if (arg == "-r") {
+                runImmediately = true;
+            }
+            else if (!arg.empty() && arg.front() != '-' && savePath.empty()) {
+                savePath = arg;
+            }
+            else {
+                return false;
+            }
+        }
+        return !savePath.empty();
+    }
+
+    std::chrono::steady_clock::duration framePeriod() const {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::seconds(1)) / framesPerSecond;
+    }
+
+    void accept() {
+        acceptor.async_accept([this](const boost::system::error_code& ec, tcp::socket socket) {
+            if (ec) {
+                if (acceptor.is_open()) accept();
+                return;
+            }
+            socket.set_option(tcp::no_delay(true));
+            auto client = std::make_shared<Client>(std::move(socket));
+            clients.push_back(client);
+            client->frame.clear();
+            SimulationProtocol::append(client->frame, static_cast<uint8_t>(SimulationProtocol::ServerMessage::HELLO));
+            SimulationProtocol::append(client->frame, SimulationProtocol::version);
+            SimulationProtocol::append(client->frame, state.width());
+            SimulationProtocol::append(client->frame, state.height());
+            write(client);
+            readMessage(client);
+            accept();
+        });
+    }
+
+    void close(const std::shared_ptr<Client>& client) {
+        if (client->closed) return;
+        client->closed = true;
+        // a button that is held down by a client that goes away is released
+        if (client->pressed) simulator.sendCommunicatorEvent(client->pressed->communicatorIndex, false);
+        boost::system::error_code ec;
+        client->socket.close(ec);
+        clients.erase(std::find(clients.begin(), clients.end(), client));
+    }
+
+    void readMessage(const std::shared_ptr<Client>& client) {
+        boost::asio::async_read(client->socket, boost::asio::buffer(client->message.data(), 1), [this, client](const boost::system::error_code& ec, size_t) {
+            if (client->closed) return;
+            const size_t size = SimulationProtocol::payloadSize(client->message[0]);
+            if (ec || size == 0) {
+                close(client);
+                return;
+            }
+            boost::asio::async_read(client->socket, boost::asio::buffer(client->message.data() + 1, size), [this, client](const boost::system::error_code& ec, size_t size) {
+                if (client->closed) return;
+                if (ec || !handleMessage(*client, size)) {
+                    close(client);
+                    return;
+                }
+                readMessage(client);
+            });
+        });
+    }
+
+    // returns false if the message is malformed
+    bool handleMessage(Client& client, size_t size) {
+        const uint8_t* in = client.message.data() + 1;
+        const uint8_t* end = in + size;
+        switch (static_cast<SimulationProtocol::ClientMessage>(client.message[0])) {
+        case SimulationProtocol::ClientMessage::VIEWPORT: {
+            int32_t x, y, width, height;
+            SimulationProtocol::read(in, end, x);
+            SimulationProtocol::read(in, end, y);
+            SimulationProtocol::read(in, end, width);
+            SimulationProtocol::read(in, end, height);
+            if (width < 0 || height < 0 || static_cast<int64_t>(width) * height > SimulationProtocol::maxViewportArea) return false;
+            // the far corner must be a point too
+            const int64_t right = static_cast<int64_t>(x) + width;
+            const int64_t bottom = static_cast<int64_t>(y) + height;
+            if (right > INT32_MAX || bottom > INT32_MAX) return false;
+            // only the part on the canvas is sent, so that nothing downstream (e.g. Simulator::findChangedRects()) sees points outside it
+            client.hasViewport = true;
+            client.viewportTopLeft = ext::min(ext::max(ext::point{ x, y }, ext::point{ 0, 0 }), state.size());
+            client.viewportBottomRight = ext::max(ext::min(ext::point{ static_cast<int32_t>(right), static_cast<int32_t>(bottom) }, state.size()), client.viewportTopLeft);
+            client.needsWholeViewport = true;
+            return true;
+        }
+        case SimulationProtocol::ClientMessage::RUN: {
+            uint8_t run;
+            SimulationProtocol::read(in, end, run);
+            if (run && !simulator.running()) simulator.start();
+            else if (!run && simulator.running()) simulator.stop();
+            return true;
+        }
+        case SimulationProtocol::ClientMessage::PRESS: {
+            int32_t x, y;
+            uint8_t on;
+            SimulationProtocol::read(in, end, x);
+            SimulationProtocol::read(in, end, y);
+            SimulationProtocol::read(in, end, on);
+            ScreenCommunicator* target = nullptr;
+            const ext::point pt{ x, y };
+            if (on && state.contains(pt)) {
+                if (const auto* element = std::get_if<ScreenCommunicatorElement>(&std::as_const(state)[pt])) {
+                    target = state.communicatorOf(*element);
+                }
+            }
+            // like ScreenInputAction, each client holds at most one screen communicator down
+            if (client.pressed != target) {
+                if (client.pressed) simulator.sendCommunicatorEvent(client.pressed->communicatorIndex, false);
+                if (target) simulator.sendCommunicatorEvent(target->communicatorIndex, true);
+                client.pressed = target;
+            }
+            return true;
+        }
+        }
+        return false;
+    }
+
+    void write(const std::shared_ptr<Client>& client) {
+        client->writing = true;
+        boost::asio::async_write(client->socket, boost::asio::buffer(client->frame), [this, client](const boost::system::error_code& ec, size_t) {
+            if (client->closed) return;
+            client->writing = false;
+            if (ec) close(client);
+        });
+    }
+
+    void scheduleFrames() {
+        frameTimer.expires_after(framePeriod());
+        frameTimer.async_wait([this](const boost::system::error_code& ec) {
+            if (ec) return;
+            sendFrames();
+            scheduleFrames();
+        });
+    }
+
+    void sendFrames() {
+        // the simulator computes the pixels of the bounding rectangle of all the viewports, so that most clients don't have to look up each pixel in the simulation state
+        ext::point requestTopLeft = ext::point::max();
+        ext::point requestBottomRight = ext::point::min();
+        for (const auto& client : clients) {
+            if (!client->hasViewport) continue;
+            requestTopLeft = ext::min(requestTopLeft, client->viewportTopLeft);
+            requestBottomRight = ext::max(requestBottomRight, client->viewportBottomRight);
+        }
+        if (requestTopLeft.x < requestBottomRight.x && requestTopLeft.y < requestBottomRight.y
+            && static_cast<int64_t>(requestBottomRight.x - requestTopLeft.x) * (requestBottomRight.y - requestTopLeft.y) <= SimulationProtocol::maxViewportArea) {
+            simulator.requestViewport(requestTopLeft, requestBottomRight);
+        }
+
+        const Simulator::LiveState liveState = simulator.loadLiveState();
+        if (!liveState) return;
+        const bool running = simulator.running();
+        std::vector<std::pair<ext::point, ext::point>> rects;
+        // a copy, since a failed write closes the client
+        const std::vector<std::shared_ptr<Client>> currentClients = clients;
+        for (const auto& client : currentClients) {
+            // a client that is still receiving its last frame gets the changes since then in a later frame
+            if (!client->hasViewport || client->writing) continue;
+            rects.clear();
+            if (client->needsWholeViewport || !simulator.findChangedRects(client->sentState, liveState, client->viewportTopLeft, client->viewportBottomRight, rects)) {
+                rects.assign(1, { client->viewportTopLeft, client->viewportBottomRight });
+            }
+            else if (rects.empty()) {
+                continue;
+            }
+            client->needsWholeViewport = false;
+            client->sentState = liveState;
+
+            std::string& frame = client->frame;
+            frame.clear();
+            SimulationProtocol::append(frame, static_cast<uint8_t>(SimulationProtocol::ServerMessage::FRAME));
+            SimulationProtocol::append(frame, simulator.getStepNumber());
+            SimulationProtocol::append(frame, static_cast<uint8_t>(running));
+            SimulationProtocol::append(frame, static_cast<uint32_t>(rects.size()));
+            for (const auto& [topLeft, bottomRight] : rects) {
+                SimulationProtocol::append(frame, topLeft.x);
+                SimulationProtocol::append(frame, topLeft.y);
+                SimulationProtocol::append(frame, bottomRight.x - topLeft.x);
+                SimulationProtocol::append(frame, bottomRight.y - topLeft.y);
+                SimulationProtocol::RunEncoder runs(frame);
+                simulator.readLiveView(liveState, state, topLeft, bottomRight, [&](const ext::point&, size_t elementIndex, bool level) {
+                    runs.push(SimulationProtocol::pixelCode(elementIndex, level));
+                });
+                runs.finish();
+            }
+            write(client);
+        }
+    }
+
+    // returns the exit code
+    int execute() {
+        {
+            std::ifstream saveFile(savePath, std::ios::binary);
+            if (!saveFile.is_open() || state.loadSave(saveFile, &ext::thread_pool::shared()) != CanvasState::ReadResult::OK) {
+                std::cerr << savePath << ": cannot be loaded" << std::endl;
+                return 1;
+            }
+        }
+
+        simulator.setWorkerThreads(threads);
+        if (periodGiven) simulator.setPeriod(period);
+        // no client can see more than one state per frame
+        simulator.setPublishInterval(framePeriod());
+        simulator.compile(state);
+
+        boost::system::error_code ec;
+        acceptor.open(tcp::v4(), ec);
+        if (!ec) acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+        if (!ec) acceptor.bind(tcp::endpoint(tcp::v4(), port), ec);
+        if (!ec) acceptor.listen(tcp::socket::max_listen_connections, ec);
+        if (ec) {
+            std::cerr << "port " << port << ": " << ec.message() << std::endl;
+            return 1;
+        }
+        std::cout << savePath << ": serving on port " << port << std::endl;
+
+        signals.async_wait([this](const boost::system::error_code&, int) {
+            acceptor.close();
+            frameTimer.cancel();
+            const std::vector<std::shared_ptr<Client>> currentClients = clients;
+            for (const auto& client : currentClients) {
+                close(client);
+            }
+        });
+        accept();
+        scheduleFrames();
+        if (runImmediately) simulator.start();
+
+        ioContext.run();
+        if (simulator.running()) simulator.stop();
+        return 0;
+    }
+
+public:
+    /**
+     * Runs the server given by the arguments after CCSB_SERVE_ARGUMENT until it is interrupted, and returns the exit code of the process.
+     */
+    static int run(int argc, char* argv[], const char* processName) {
+        SimulationServer server;
+        if (!server.parseArguments(argc, argv)) {
+            std::cerr << "Usage: " << processName << " " CCSB_SERVE_ARGUMENT " [-p port] [-t threads] [-f fps] [-d microseconds] [-r] savefile" << std::endl;
+            return 2;
+        }
+        return server.execute();
+    }
+};
@@ -13,235 +13,399 @@
 #include <thread>
 #include <chrono>
 #include <type_traits>
+#include <variant>
 #include <stack>
 #include <unordered_map>
+#include <unordered_set>
+#include <iterator>
+#include <functional>
 #include <algorithm>
 #include <numeric>
 #include <cassert>
+#include <string>
+#include <limits>
 
 #include "simulator.hpp"
 #include "simulator_compile.hpp"
+#include "simulator_kernels.hpp"
 #include "elements.hpp"
 #include "tag_tuple.hpp"
 #include "visitor.hpp"
 #include "screencommunicator.hpp"
 #include "fileinputcommunicator.hpp"
 #include "fileoutputcommunicator.hpp"
+#include "streaminputcommunicator.hpp"
+#include "staticdatacache.hpp"
+#include "tracing.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+Simulator::Simulator() {
+    // use all the cores by default (hardware_concurrency() may return 0 if it is unknown)
+    setWorkerThreads(std::thread::hardware_concurrency());
+}
 
 Simulator::~Simulator() {
     if (running())stop();
+    discardBackgroundCompile();
+    joinDiscardedCompilations(true);
 }
 
 
-void Simulator::compile(CanvasState& gameState) {
+Simulator::CompiledCanvasKey Simulator::buildStaticData(const CanvasState& gameState, uint64_t hash, StaticData& staticData, ext::thread_pool* pool) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::buildStaticData");
     // temporary compiler data (unpacked representation)
     CompilerStaticData compilerStaticData;
     compilerStaticData.pixels = ext::heap_matrix<Simulator::StaticData::DisplayedPixel>(gameState.size());
 
-    // flags to tell us whether each pixel has been processed (originally everything is unprocessed)
-    // horizontal followed by vertical
-    ext::heap_matrix<std::array<bool, 2>> visited(gameState.size());
-    visited.fill({ false, false });
+    // the per-pixel passes are done in parallel over bands of rows (tiles that span the whole width, so that the bands are in raster order)
+    // the results of the bands are combined in order, so the compiled data does not depend on the number of bands
+    std::vector<std::pair<int32_t, int32_t>> bands;
+    {
+        const int64_t maxBands = pool ? static_cast<int64_t>(pool->concurrency() * compileBandsPerThread) : 1;
+        const int64_t numBands = std::max<int64_t>(1, std::min<int64_t>(maxBands, gameState.height() / minRowsPerCompileBand));
+        for (int64_t i = 0; i != numBands; ++i) {
+            bands.emplace_back(static_cast<int32_t>(gameState.height() * i / numBands), static_cast<int32_t>(gameState.height() * (i + 1) / numBands));
+        }
+    }
+    // calls callback(band, firstRow, lastRow) for every band, in parallel if we have a pool
+    auto forEachBand = [&](const auto& callback) {
+        const auto task = [&](size_t band) {
+            callback(band, bands[band].first, bands[band].second);
+        };
+        if (pool) {
+            pool->parallel_for(bands.size(), task);
+        }
+        else {
+            for (size_t band = 0; band != bands.size(); ++band) task(band);
+        }
+    };
 
-    // store whether each point is a relay
-    for (int32_t y = 0; y != gameState.height(); ++y) {
-        for (int32_t x = 0; x != gameState.width(); ++x) {
-            ext::point pt{ x, y };
-            std::visit([&](const auto& element) {
-                using ElementType = std::decay_t<decltype(element)>;
-                if constexpr(std::is_base_of_v<Relay, ElementType>) {
-                    compilerStaticData.pixels[pt].type = StaticData::DisplayedPixel::PixelType::RELAY;
-                }
-                else if constexpr(std::is_base_of_v<CommunicatorElement, ElementType>) {
-                    compilerStaticData.pixels[pt].type = StaticData::DisplayedPixel::PixelType::COMMUNICATOR;
-                }
-                else if constexpr(std::is_base_of_v<Element, ElementType>) {
-                    compilerStaticData.pixels[pt].type = StaticData::DisplayedPixel::PixelType::COMPONENT;
-                }
-                else {
-                    compilerStaticData.pixels[pt].type = StaticData::DisplayedPixel::PixelType::EMPTY;
+    // directions for flood fill
+    using up = integral_pair<int32_t, 0, -1>;
+    using down = integral_pair<int32_t, 0, 1>;
+    using left = integral_pair<int32_t, -1, 0>;
+    using right = integral_pair<int32_t, 1, 0>;
+    using directions_t = ext::tag_tuple<up, down, left, right>;
+
+    using Flags = CompilerPixelFlags;
+
+    // classify every pixel once, so that the component labelling does not have to visit the elements again
+    // the communicator pixels are also listed (in raster order, separately for each type of element), so that each communicator pass only visits the pixels of its own type
+    ext::heap_matrix<uint8_t> pixelFlags(gameState.size());
+    std::vector<std::vector<ext::point>> bandCommunicatorPixels(bands.size());
+    forEachBand([&](size_t band, int32_t firstRow, int32_t lastRow) {
+        for (int32_t y = firstRow; y != lastRow; ++y) {
+            for (int32_t x = 0; x != gameState.width(); ++x) {
+                ext::point pt{ x, y };
+                compilerStaticData.pixels[pt].type = CompilerStaticData::displayedPixelType(gameState[pt]);
+                compilerStaticData.pixels[pt].elementIndex = static_cast<uint8_t>(gameState[pt].index());
+                compilerStaticData.pixels[pt].index[0] = compilerStaticData.pixels[pt].index[1] = -1;
+                pixelFlags[pt] = Flags::of(gameState[pt]);
+                if (compilerStaticData.pixels[pt].type == StaticData::DisplayedPixel::PixelType::COMMUNICATOR) {
+                    bandCommunicatorPixels[band].push_back(pt);
                 }
-            }, gameState[pt]);
-            compilerStaticData.pixels[pt].index[0] = compilerStaticData.pixels[pt].index[1] = -1;
+            }
+        }
+    });
+    std::array<std::vector<ext::point>, std::variant_size_v<CanvasState::element_variant_t>> communicatorPixels;
+    for (const std::vector<ext::point>& pixels : bandCommunicatorPixels) {
+        for (const ext::point& pt : pixels) {
+            communicatorPixels[gameState[pt].index()].push_back(pt);
         }
     }
+    bandCommunicatorPixels.clear();
 
     // populate all the components first
-    for (int32_t y = 0; y != gameState.height(); ++y) {
-        for (int32_t x = 0; x != gameState.width(); ++x) {
-            ext::point pt{ x, y };
-
-            if (isFloodfillableElement(gameState[pt])) {
-                for (int dir = 0; dir < 2; ++dir) {
-                    if (!visited[pt][dir]) {
-                        // since we have not visited this pixel yet, we do a flood fill algorithm to find all pixels that are connected
-
-                        // whether it might be useful to process this element (an optimization to remove useless components)
-                        bool componentIsUseful = false;
+    // each floodfillable pixel has a horizontal (0) and a vertical (1) node, and each component is a connected set of nodes.
+    // each band labels its horizontal and vertical runs of connected nodes in one raster scan (temporarily storing the band-local run index in the pixels),
+    // and joins the two runs that cross at each pixel that is not an insulated wire.
+    // then the vertical runs that cross the seams between bands are joined, and the components are numbered in the order of their first node in the raster scan.
+    {
+        // the runs of each band, and whether each run has a useful element or is next to a relay (in the direction of the run)
+        // runs are always joined to the run with the smaller index, so every run has a smaller index than its parent
+        struct BandRuns {
+            std::vector<int32_t> parents;
+            std::vector<char> useful;
+        };
+        std::vector<BandRuns> bandRuns(bands.size());
+        auto findRoot = [](std::vector<int32_t>& runParents, int32_t run) {
+            while (runParents[run] != run) {
+                run = runParents[run] = runParents[runParents[run]];
+            }
+            return run;
+        };
+        auto join = [&](std::vector<int32_t>& runParents, int32_t a, int32_t b) {
+            a = findRoot(runParents, a);
+            b = findRoot(runParents, b);
+            if (a > b) std::swap(a, b);
+            runParents[b] = a;
+        };
 
-                        std::vector<std::pair<ext::point, int>> updatedPixels;
+        forEachBand([&](size_t band, int32_t firstRow, int32_t lastRow) {
+            std::vector<int32_t>& runParents = bandRuns[band].parents;
+            std::vector<char>& runUseful = bandRuns[band].useful;
+            auto newRun = [&]() {
+                runParents.push_back(static_cast<int32_t>(runParents.size()));
+                runUseful.push_back(false);
+                return runParents.back();
+            };
 
-                        // flood fill
-                        {
-                            std::stack<std::pair<ext::point, int>> floodStack;
-                            floodStack.emplace(pt, dir);
+            for (int32_t y = firstRow; y != lastRow; ++y) {
+                for (int32_t x = 0; x != gameState.width(); ++x) {
+                    ext::point pt{ x, y };
+                    const uint8_t flags = pixelFlags[pt];
+                    if (!(flags & Flags::FLOODFILLABLE)) continue;
+                    auto& index = compilerStaticData.pixels[pt].index;
+                    const bool useful = flags & Flags::USEFUL;
 
-                            while (!floodStack.empty()) {
-                                // retrieve topmost point
-                                auto[currPt, currDir] = floodStack.top();
-                                floodStack.pop();
+                    // continue the runs from the left and from above (within the band) if they are connected, otherwise start new runs
+                    const uint8_t leftFlags = x > 0 ? pixelFlags[{ x - 1, y }] : 0;
+                    const uint8_t rightFlags = x + 1 != gameState.width() ? pixelFlags[{ x + 1, y }] : 0;
+                    const uint8_t upFlags = y > 0 ? pixelFlags[{ x, y - 1 }] : 0;
+                    const uint8_t downFlags = y + 1 != gameState.height() ? pixelFlags[{ x, y + 1 }] : 0;
+                    index[0] = Flags::connected(leftFlags, flags) ? compilerStaticData.pixels[{ x - 1, y }].index[0] : newRun();
+                    index[1] = y != firstRow && Flags::connected(upFlags, flags) ? compilerStaticData.pixels[{ x, y - 1 }].index[1] : newRun();
+                    runUseful[index[0]] |= useful || ((leftFlags | rightFlags) & Flags::RELAY);
+                    runUseful[index[1]] |= useful || ((upFlags | downFlags) & Flags::RELAY);
 
-                                // ignore if already processed
-                                if (visited[currPt][currDir]) continue;
+                    // if its not insulated wire, the two directions are connected
+                    if (!(flags & Flags::INSULATED)) {
+                        join(runParents, index[0], index[1]);
+                    }
+                }
+            }
+        });
 
-                                // set visited
-                                visited[currPt][currDir] = true;
+        // combine the runs of all the bands, so that run r of band b becomes run runOffsets[b] + r
+        std::vector<int32_t> runOffsets(bands.size() + 1, 0);
+        for (size_t band = 0; band != bands.size(); ++band) {
+            runOffsets[band + 1] = runOffsets[band] + static_cast<int32_t>(bandRuns[band].parents.size());
+        }
+        std::vector<int32_t> runParents(runOffsets.back());
+        std::vector<char> runUseful(runOffsets.back());
+        forEachBand([&](size_t band, int32_t, int32_t) {
+            const int32_t offset = runOffsets[band];
+            std::transform(bandRuns[band].parents.begin(), bandRuns[band].parents.end(), runParents.begin() + offset, [offset](int32_t parent) {
+                return parent + offset;
+            });
+            std::copy(bandRuns[band].useful.begin(), bandRuns[band].useful.end(), runUseful.begin() + offset);
+            bandRuns[band] = BandRuns{};
+        });
 
-                                // set its component index
-                                updatedPixels.emplace_back(currPt, currDir);
+        // join the vertical runs that cross the seams between bands
+        for (size_t band = 1; band < bands.size(); ++band) {
+            const int32_t y = bands[band].first;
+            for (int32_t x = 0; x != gameState.width(); ++x) {
+                if (Flags::connected(pixelFlags[{ x, y - 1 }], pixelFlags[{ x, y }])) {
+                    join(runParents, compilerStaticData.pixels[{ x, y - 1 }].index[1] + runOffsets[band - 1], compilerStaticData.pixels[{ x, y }].index[1] + runOffsets[band]);
+                }
+            }
+        }
 
-                                // check if component is useful
-                                if (!componentIsUseful && isFloodfillableUsefulElement(gameState[currPt])) {
-                                    componentIsUseful = true;
-                                }
+        // since every parent has a smaller index, one pass in increasing order points every run directly at its root
+        // (the root of each component is its run with the smallest index, which is also its first run in the raster scan)
+        for (int32_t run = 0; run != static_cast<int32_t>(runParents.size()); ++run) {
+            runParents[run] = runParents[runParents[run]];
+            runUseful[runParents[run]] |= runUseful[run];
+        }
 
-                                // if its not insulated wire, push the opposite direction
-                                if (!std::holds_alternative<InsulatedWire>(gameState[currPt]) && !visited[currPt][currDir ^ 1]) {
-                                    floodStack.emplace(currPt, currDir ^ 1);
-                                }
+        // assign the component indices in the order of their roots (useless components don't get one)
+        std::vector<int32_t> rootComponents(runParents.size(), -1);
+        int32_t numComponents = 0;
+        for (int32_t run = 0; run != static_cast<int32_t>(runParents.size()); ++run) {
+            if (runParents[run] == run && runUseful[run]) rootComponents[run] = numComponents++;
+        }
+        compilerStaticData.components.resize(numComponents);
+        forEachBand([&](size_t band, int32_t firstRow, int32_t lastRow) {
+            for (int32_t y = firstRow; y != lastRow; ++y) {
+                for (int32_t x = 0; x != gameState.width(); ++x) {
+                    ext::point pt{ x, y };
+                    if (!(pixelFlags[pt] & Flags::FLOODFILLABLE)) continue;
+                    for (int32_t& index : compilerStaticData.pixels[pt].index) {
+                        index = rootComponents[runParents[index + runOffsets[band]]];
+                    }
+                }
+            }
+        });
+    }
 
-                                // visit the adjacent pixels
-                                using positive_one_t = std::integral_constant<int32_t, 1>;
-                                using negative_one_t = std::integral_constant<int32_t, -1>;
-                                using directions_t = ext::tag_tuple<negative_one_t, positive_one_t>;
-                                // verbose capture due to clang 6.0.0 issue with structured bindings
-                                directions_t::for_each([&, &currPt = currPt, &currDir = currDir](auto direction_tag_t, auto) {
-                                    ext::point newPt = currPt;
-                                    if (currDir == 0) {
-                                        newPt.x += decltype(direction_tag_t)::type::value;
-                                    }
-                                    else {
-                                        newPt.y += decltype(direction_tag_t)::type::value;
-                                    }
-                                    if (gameState.contains(newPt) && !visited[newPt][currDir] &&
-                                        isFloodfillableElement(gameState[newPt]) &&
-                                        !(isSignalReceiver(gameState[newPt]) && isSignal(gameState[currPt])) &&
-                                        !(isSignal(gameState[newPt]) && isSignalReceiver(gameState[currPt]))) {
-                                        floodStack.emplace(newPt, currDir);
-                                    }
-                                    if (!componentIsUseful && gameState.contains(newPt) && isRelayElement(gameState[newPt])) {
-                                        componentIsUseful = true;
-                                    }
-                                });
-                                
-                            }
-                        }
+    // next, we populate the sources, logic gates and relays (and spawn new components if two relays are adjacent)
+    // each band collects its own elements, which are then appended in band order
+    // the relay pixels and the components between adjacent relays are numbered in raster order, so each band first counts them
+    struct BandElements {
+        std::vector<SimulatorSource> sources;
+        CompilerGates logicGates;
+        CompilerRelays relays;
+        int32_t numRelayPixels = 0;
+        int32_t numRelayLinks = 0;
+        int32_t relayPixelOffset;
+        int32_t relayLinkOffset;
+        // (component, relay pixel) pairs to add to the adjacency lists of the components, in raster order
+        std::vector<std::pair<int32_t, int32_t>> adjRelayPixels;
+        // (relay pixel, component) pairs to add to the adjComponents of relay pixels in previous rows, in raster order
+        std::vector<std::pair<int32_t, int32_t>> linkedRelayPixels;
+    };
+    std::vector<BandElements> bandElements(bands.size());
+    forEachBand([&](size_t band, int32_t firstRow, int32_t lastRow) {
+        BandElements& elements = bandElements[band];
+        for (int32_t y = firstRow; y != lastRow; ++y) {
+            for (int32_t x = 0; x != gameState.width(); ++x) {
+                ext::point pt{ x, y };
+                std::visit([&](const auto& element) {
+                    using ElementType = std::decay_t<decltype(element)>;
+                    if constexpr(std::is_same_v<Source, ElementType>) {
+                        auto& source = elements.sources.emplace_back();
+                        source.outputComponent = compilerStaticData.pixels[pt].index[0]; // for sources, index 0 and 1 should be the same
+                        assert(source.outputComponent >= 0 && source.outputComponent < static_cast<int32_t>(compilerStaticData.components.size()));
+                    }
+                    else if constexpr (std::is_base_of_v<LogicGate, ElementType>) {
+                        int32_t outputComponent = compilerStaticData.pixels[pt].index[0];
+                        assert(outputComponent >= 0 && outputComponent < static_cast<int32_t>(compilerStaticData.components.size()));
+                        CompilerInputs inputComponents;
 
-                        if (componentIsUseful) {
-                            // assign it the next component index
-                            int32_t componentIndex = compilerStaticData.components.size();
-                            // commit the changes
-                            for (auto [currPt, currDir] : updatedPixels) {
-                                compilerStaticData.pixels[currPt].index[currDir] = componentIndex;
+                        directions_t::for_each([&](auto direction_tag_t, auto) {
+                            ext::point newPt = pt;
+                            newPt.x += decltype(direction_tag_t)::type::first;
+                            newPt.y += decltype(direction_tag_t)::type::second;
+                            if (gameState.contains(newPt) && (pixelFlags[newPt] & Flags::SIGNAL)) {
+                                assert(compilerStaticData.pixels[newPt].index[0] >= 0 && compilerStaticData.pixels[newPt].index[0] < static_cast<int32_t>(compilerStaticData.components.size()));
+                                inputComponents.emplace_back(compilerStaticData.pixels[newPt].index[0]);
                             }
-                            // register this component
-                            compilerStaticData.components.emplace_back();
-                        }
+                        });
+                        elements.logicGates.emplace<ElementType>(inputComponents, outputComponent);
                     }
-                }
+                    else if constexpr (std::is_base_of_v<Relay, ElementType>) {
+                        ++elements.numRelayPixels;
+                        // a component is spawned for each adjacent relay that comes before this one
+                        if (y > 0 && (pixelFlags[{ x, y - 1 }] & Flags::RELAY)) ++elements.numRelayLinks;
+                        if (x > 0 && (pixelFlags[{ x - 1, y }] & Flags::RELAY)) ++elements.numRelayLinks;
+                    }
+                }, gameState[pt]);
             }
         }
-    }
+    });
 
-    // directions for flood fill
-    using up = integral_pair<int32_t, 0, -1>;
-    using down = integral_pair<int32_t, 0, 1>;
-    using left = integral_pair<int32_t, -1, 0>;
-    using right = integral_pair<int32_t, 1, 0>;
-    using directions_t = ext::tag_tuple<up, down, left, right>;
+    {
+        int32_t numRelayPixels = 0;
+        int32_t numComponents = static_cast<int32_t>(compilerStaticData.components.size());
+        for (BandElements& elements : bandElements) {
+            elements.relayPixelOffset = numRelayPixels;
+            elements.relayLinkOffset = numComponents;
+            numRelayPixels += elements.numRelayPixels;
+            numComponents += elements.numRelayLinks;
+        }
+        compilerStaticData.relayPixels.resize(numRelayPixels);
+        compilerStaticData.components.resize(numComponents);
+    }
 
-    // next, we populate the sources and logic gates
-    for (int32_t y = 0; y != gameState.height(); ++y) {
-        for (int32_t x = 0; x != gameState.width(); ++x) {
-            ext::point pt{ x, y };
-            std::visit([&](const auto& element) {
-                using ElementType = std::decay_t<decltype(element)>;
-                if constexpr(std::is_same_v<Source, ElementType>) {
-                    auto& source = compilerStaticData.sources.emplace_back();
-                    source.outputComponent = compilerStaticData.pixels[pt].index[0]; // for sources, index 0 and 1 should be the same
-                    assert(source.outputComponent >= 0 && source.outputComponent < static_cast<int32_t>(compilerStaticData.components.size()));
-                }
-                else if constexpr (std::is_base_of_v<LogicGate, ElementType>) {
-                    int32_t outputComponent = compilerStaticData.pixels[pt].index[0];
-                    assert(outputComponent >= 0 && outputComponent < static_cast<int32_t>(compilerStaticData.components.size()));
-                    // Note: can optimize if heap allocation for the std::vector is slow
-                    std::vector<int32_t> inputComponents;
-                    
-                    directions_t::for_each([&](auto direction_tag_t, auto) {
-                        ext::point newPt = pt;
-                        newPt.x += decltype(direction_tag_t)::type::first;
-                        newPt.y += decltype(direction_tag_t)::type::second;
-                        if (gameState.contains(newPt) && isSignal(gameState[newPt])) {
-                            assert(compilerStaticData.pixels[newPt].index[0] >= 0 && compilerStaticData.pixels[newPt].index[0] < static_cast<int32_t>(compilerStaticData.components.size()));
-                            inputComponents.emplace_back(compilerStaticData.pixels[newPt].index[0]);
-                        }
-                    });
-                    compilerStaticData.logicGates.emplace<ElementType>(inputComponents, outputComponent);
+    // number the relay pixels (the relays in each band need the indices of the relays in the previous row)
+    forEachBand([&](size_t band, int32_t firstRow, int32_t lastRow) {
+        int32_t relayPixelIndex = bandElements[band].relayPixelOffset;
+        for (int32_t y = firstRow; y != lastRow; ++y) {
+            for (int32_t x = 0; x != gameState.width(); ++x) {
+                ext::point pt{ x, y };
+                if (pixelFlags[pt] & Flags::RELAY) {
+                    compilerStaticData.pixels[pt].index[0] = compilerStaticData.pixels[pt].index[1] = relayPixelIndex++;
                 }
-            }, gameState[pt]);
+            }
         }
-    }
+    });
 
-    // next, we populate the relays (and spawn new components if two relays are adjacent)
-    for (int32_t y = 0; y != gameState.height(); ++y) {
-        for (int32_t x = 0; x != gameState.width(); ++x) {
-            ext::point pt{ x, y };
-            visited[pt] = { true, true };
-            std::visit([&](const auto& element) {
-                using ElementType = std::decay_t<decltype(element)>;
-                if constexpr (std::is_base_of_v<Relay, ElementType>) {
-                    int32_t outputRelayPixelIndex = compilerStaticData.relayPixels.size();
-                    auto& relayPixel = compilerStaticData.relayPixels.emplace_back();
-                    relayPixel.numAdjComponents = 0;
-                    // TODO: optimize if heap allocation is slow
-                    std::vector<int32_t> inputComponents;
-                    directions_t::for_each([&](auto direction_tag_t, auto) {
-                        ext::point newPt = pt;
-                        int32_t dir = (decltype(direction_tag_t)::type::second != 0);
-                        newPt.x += decltype(direction_tag_t)::type::first;
-                        newPt.y += decltype(direction_tag_t)::type::second;
-                        if (gameState.contains(newPt)) {
-                            auto& element = gameState[newPt];
-                            if (isSignal(element)) {
-                                inputComponents.emplace_back(compilerStaticData.pixels[newPt].index[0]);
-                            }
-                            else if (isFloodfillableElement(element)) {
-                                assert(compilerStaticData.pixels[newPt].index[dir] >= 0 && compilerStaticData.pixels[newPt].index[dir] < static_cast<int32_t>(compilerStaticData.components.size()));
-                                relayPixel.adjComponents[relayPixel.numAdjComponents++] = compilerStaticData.pixels[newPt].index[dir];
-                                compilerStaticData.components[compilerStaticData.pixels[newPt].index[dir]].adjRelayPixels.emplace_back(outputRelayPixelIndex);
-                            }
-                            else if (isRelayElement(element)) {
-                                // special case where two relays are adjacent
-                                // spawn a new component between them, if the other component is already processed
-                                if (visited[newPt][0]) { // this ensures that we only spawn the new component once per pair of adjacent relays
-                                    assert(compilerStaticData.pixels[newPt].index[0] >= 0 && compilerStaticData.pixels[newPt].index[0] < static_cast<int32_t>(compilerStaticData.relayPixels.size()));
-                                    int32_t componentIndex = compilerStaticData.components.size();
-                                    auto& newComponent = compilerStaticData.components.emplace_back();
-                                    newComponent.adjRelayPixels.emplace_back(outputRelayPixelIndex);
-                                    relayPixel.adjComponents[relayPixel.numAdjComponents++] = componentIndex;
-                                    newComponent.adjRelayPixels.emplace_back(compilerStaticData.pixels[newPt].index[0]);
-                                    auto& otherRelayPixel = compilerStaticData.relayPixels[compilerStaticData.pixels[newPt].index[0]];
-                                    otherRelayPixel.adjComponents[otherRelayPixel.numAdjComponents++] = componentIndex;
+    forEachBand([&](size_t band, int32_t firstRow, int32_t lastRow) {
+        BandElements& elements = bandElements[band];
+        int32_t relayLinkIndex = elements.relayLinkOffset;
+        for (int32_t y = firstRow; y != lastRow; ++y) {
+            for (int32_t x = 0; x != gameState.width(); ++x) {
+                ext::point pt{ x, y };
+                std::visit([&](const auto& element) {
+                    using ElementType = std::decay_t<decltype(element)>;
+                    if constexpr (std::is_base_of_v<Relay, ElementType>) {
+                        int32_t outputRelayPixelIndex = compilerStaticData.pixels[pt].index[0];
+                        auto& relayPixel = compilerStaticData.relayPixels[outputRelayPixelIndex];
+                        relayPixel.numAdjComponents = 0;
+                        CompilerInputs inputComponents;
+                        directions_t::for_each([&](auto direction_tag_t, auto) {
+                            ext::point newPt = pt;
+                            int32_t dir = (decltype(direction_tag_t)::type::second != 0);
+                            newPt.x += decltype(direction_tag_t)::type::first;
+                            newPt.y += decltype(direction_tag_t)::type::second;
+                            if (gameState.contains(newPt)) {
+                                if (pixelFlags[newPt] & Flags::SIGNAL) {
+                                    inputComponents.emplace_back(compilerStaticData.pixels[newPt].index[0]);
+                                }
+                                else if (pixelFlags[newPt] & Flags::FLOODFILLABLE) {
+                                    assert(compilerStaticData.pixels[newPt].index[dir] >= 0 && compilerStaticData.pixels[newPt].index[dir] < static_cast<int32_t>(compilerStaticData.components.size()));
+                                    relayPixel.adjComponents[relayPixel.numAdjComponents++] = compilerStaticData.pixels[newPt].index[dir];
+                                    elements.adjRelayPixels.emplace_back(compilerStaticData.pixels[newPt].index[dir], outputRelayPixelIndex);
+                                }
+                                else if (pixelFlags[newPt] & Flags::RELAY) {
+                                    // special case where two relays are adjacent
+                                    // spawn a new component between them, if the other relay comes before this one
+                                    if (newPt.y < pt.y || newPt.x < pt.x) { // this ensures that we only spawn the new component once per pair of adjacent relays
+                                        assert(compilerStaticData.pixels[newPt].index[0] >= 0 && compilerStaticData.pixels[newPt].index[0] < static_cast<int32_t>(compilerStaticData.relayPixels.size()));
+                                        int32_t componentIndex = relayLinkIndex++;
+                                        compilerStaticData.components[componentIndex].relayLink = true;
+                                        elements.adjRelayPixels.emplace_back(componentIndex, outputRelayPixelIndex);
+                                        relayPixel.adjComponents[relayPixel.numAdjComponents++] = componentIndex;
+                                        elements.adjRelayPixels.emplace_back(componentIndex, compilerStaticData.pixels[newPt].index[0]);
+                                        // the other relay pixel may belong to another band
+                                        elements.linkedRelayPixels.emplace_back(compilerStaticData.pixels[newPt].index[0], componentIndex);
+                                    }
                                 }
                             }
-                        }
-                    });
-                    compilerStaticData.relays.emplace<ElementType>(inputComponents, outputRelayPixelIndex);
-                    compilerStaticData.pixels[pt].index[0] = compilerStaticData.pixels[pt].index[1] = outputRelayPixelIndex;
-                }
-            }, gameState[pt]);
+                        });
+                        elements.relays.emplace<ElementType>(inputComponents, outputRelayPixelIndex);
+                    }
+                }, gameState[pt]);
+            }
+        }
+    });
+
+    // count the relay pixels adjacent to each component, so that the adjacency lists can be filled in place
+    {
+        const int32_t numComponents = static_cast<int32_t>(compilerStaticData.components.size());
+        std::vector<int32_t>& adjRelayPixelsBegin = compilerStaticData.adjRelayPixelsBegin;
+        adjRelayPixelsBegin.assign(numComponents + 1, 0);
+        for (const BandElements& elements : bandElements) {
+            for (const auto& adjacency : elements.adjRelayPixels) {
+                ++adjRelayPixelsBegin[adjacency.first + 1];
+            }
+        }
+        std::partial_sum(adjRelayPixelsBegin.begin(), adjRelayPixelsBegin.end(), adjRelayPixelsBegin.begin());
+        compilerStaticData.adjRelayPixelList.resize(adjRelayPixelsBegin.back());
+        // the bands are visited in order, so each list stays in raster order
+        std::vector<int32_t> adjRelayPixelsEnd(adjRelayPixelsBegin.begin(), adjRelayPixelsBegin.end() - 1);
+        for (const BandElements& elements : bandElements) {
+            for (auto [componentIndex, relayPixelIndex] : elements.adjRelayPixels) {
+                compilerStaticData.adjRelayPixelList[adjRelayPixelsEnd[componentIndex]++] = relayPixelIndex;
+            }
+        }
+    }
+
+    // combine the elements of the bands in order
+    for (BandElements& elements : bandElements) {
+        appendMoved(compilerStaticData.sources, elements.sources);
+        compilerStaticData.logicGates.append(elements.logicGates);
+        compilerStaticData.relays.append(elements.relays);
+        for (auto [relayPixelIndex, componentIndex] : elements.linkedRelayPixels) {
+            auto& otherRelayPixel = compilerStaticData.relayPixels[relayPixelIndex];
+            otherRelayPixel.adjComponents[otherRelayPixel.numAdjComponents++] = componentIndex;
         }
     }
+    bandElements.clear();
 
     /*
     === Filling in the communicators ===
@@ -258,84 +422,95 @@ void Simulator::compile(CanvasState& gameState) {
     2) For each component whose pixels are not all null (not bound to any communicator):
     2.1) Set all pixels of that component to the communicator with the largest number of pixels in that component
 
-    Algorithm is expected to run in O(N) where N is the number of pixels on the canvas (with some constant factor for hashing).
+    Algorithm is expected to run in O(N log N) where N is the number of communicator pixels (the rest of the canvas is not visited).
     */
 
     // types of communicators that we recognize:
-    using CommunicatorTypes_t = ext::tag_tuple<ScreenCommunicator, FileInputCommunicator, FileOutputCommunicator>;
+    using CommunicatorTypes_t = ext::tag_tuple<ScreenCommunicator, FileInputCommunicator, FileOutputCommunicator, StreamInputCommunicator>;
 
-    // Describes the communicator index of each pixel (if it is a communicator)
-    ext::heap_matrix<int32_t> communicatorComponentIndices(gameState.size());
-    communicatorComponentIndices.fill(-1); // no assigned communicator for all pixels at first
-    
     // the cumulative number of communicators used
     int32_t communicatorTypeComponentOffset = 0;
 
+    // the new communicator table of the canvas state, with the same indices as compilerStaticData.communicators (so unused communicators are dropped)
+    std::vector<std::shared_ptr<Communicator>> newCommunicators;
+    // the new communicator id of each communicator pixel, to be put into the key (the canvas is not written to, since it may share tiles with a canvas on another thread)
+    std::vector<std::pair<ext::point, int32_t>> newCommunicatorIds;
+
     CommunicatorTypes_t::for_each([&](auto CommunicatorTypeTag, auto) {
         using CommunicatorType = typename decltype(CommunicatorTypeTag)::type;
+        using ElementType = typename CommunicatorType::element_t;
 
         if constexpr(std::is_same_v<ScreenCommunicator, CommunicatorType>) {
             staticData.screenCommunicatorStartIndex = communicatorTypeComponentOffset;
         }
 
+        // the pixels of this type, in raster order
+        const std::vector<ext::point>& typePixels = communicatorPixels[CanvasState::element_variant_t(std::in_place_type<ElementType>).index()];
+        // the position of the given point in typePixels, or typePixels.size() if it is not a pixel of this type
+        const auto positionOf = [&](const ext::point& pt) {
+            const auto it = std::lower_bound(typePixels.begin(), typePixels.end(), pt, [](const ext::point& a, const ext::point& b) {
+                return std::tie(a.y, a.x) < std::tie(b.y, b.x);
+            });
+            return static_cast<size_t>((it != typePixels.end() && *it == pt ? it : typePixels.end()) - typePixels.begin());
+        };
+
         // the number of communicators of this particular type
         int32_t communicatorComponentCount = 0;
+        // the communicator component of each pixel of typePixels (-1 if not assigned yet)
+        std::vector<int32_t> pixelComponents(typePixels.size(), -1);
 
-        // pair<communicator component index, count> , keep sorted by communicator component index, expected to be quite small so we use vector
-        std::unordered_map<std::shared_ptr<CommunicatorType>, std::vector<std::pair<int32_t, int32_t>>> communicatorMapToCommunicatorComponent;
+        // the shared communicator instances that the pixels are bound to, numbered in the order they are first seen (those that are not bound to any are one more entry, with nullptr)
+        // the same instance can be in the communicator table more than once, so they are numbered by instance rather than by communicatorId
+        std::vector<std::shared_ptr<CommunicatorType>> candidates;
+        std::vector<int32_t> candidateOfId(gameState.communicators.size(), -1);
+        std::unordered_map<const Communicator*, int32_t> candidateOfInstance;
+        const auto candidateOf = [&](const ElementType& element) {
+            int32_t* id = gameState.communicatorOf(element) ? &candidateOfId[element.communicatorId] : nullptr;
+            if (id && *id != -1) return *id;
+            std::shared_ptr<CommunicatorType> instance = id ? std::static_pointer_cast<CommunicatorType>(gameState.communicators[element.communicatorId]) : nullptr;
+            const auto [it, inserted] = candidateOfInstance.emplace(instance.get(), static_cast<int32_t>(candidates.size()));
+            if (inserted) candidates.push_back(std::move(instance));
+            if (id) *id = it->second;
+            return it->second;
+        };
+        // pair<candidate, communicator component index> for each pixel
+        std::vector<std::pair<int32_t, int32_t>> votes;
+        votes.reserve(typePixels.size());
 
         // First, we extract all the connected communicator components and assign each component a unique index
-        for (int32_t y = 0; y != gameState.height(); ++y) {
-            for (int32_t x = 0; x != gameState.width(); ++x) {
-                ext::point pt{ x, y };
-                std::visit([&](const auto& element) {
-                    using ElementType = std::decay_t<decltype(element)>;
-                    if constexpr (std::is_same_v<typename CommunicatorType::element_t, ElementType>) {
-                        if (communicatorComponentIndices[pt] == -1) {
-                            // this is a new communicator
-
-                            // register the communicator (get an index for it)
-                            int32_t communicatorIndex = communicatorComponentCount++;
-
-                            // use flood fill to assign all adjacent communicators (of the same type) the same index
-                            std::stack<ext::point> floodStack;
-                            floodStack.emplace(pt);
-                            while (!floodStack.empty()) {
-                                // retrieve topmost point
-                                ext::point currPt = floodStack.top();
-                                floodStack.pop();
-
-                                // ignore if already processed
-                                if (communicatorComponentIndices[currPt] != -1) continue;
-
-                                // assign communicator index
-                                communicatorComponentIndices[currPt] = communicatorIndex;
-
-                                // store the communicator in the map
-                                std::vector<std::pair<int32_t, int32_t>>& mapEntry = communicatorMapToCommunicatorComponent.emplace(element.communicator, std::vector<std::pair<int32_t, int32_t>>()).first->second;
-                                auto vectorEntry = std::lower_bound(mapEntry.begin(), mapEntry.end(), communicatorIndex, [](const std::pair<int32_t, int32_t>& entry, const int32_t& searchValue) {
-                                    return entry.first < searchValue;
-                                });
-                                if (vectorEntry != mapEntry.end() && vectorEntry->first == communicatorIndex) {
-                                    vectorEntry->second++;
-                                }
-                                else {
-                                    mapEntry.emplace(vectorEntry, communicatorIndex, 1);
-                                }
+        std::stack<size_t> floodStack;
+        for (size_t i = 0; i != typePixels.size(); ++i) {
+            if (pixelComponents[i] != -1) continue;
 
-                                // submit unprocessed adjacent communicators to stack
-                                directions_t::for_each([&](auto direction_tag_t, auto) {
-                                    ext::point newPt = currPt;
-                                    newPt.x += decltype(direction_tag_t)::type::first;
-                                    newPt.y += decltype(direction_tag_t)::type::second;
-                                    if (gameState.contains(newPt) && std::holds_alternative<ElementType>(gameState[newPt])) {
-                                        floodStack.emplace(newPt);
-                                    }
-                                });
-                            }
-                        }
+            // this is a new communicator, so register it (get an index for it)
+            int32_t communicatorIndex = communicatorComponentCount++;
+            // every pixel of the component votes for the communicator of the pixel it was found from
+            const int32_t seedCandidate = candidateOf(std::get<ElementType>(gameState[typePixels[i]]));
+
+            // use flood fill to assign all adjacent communicators (of the same type) the same index
+            floodStack.push(i);
+            while (!floodStack.empty()) {
+                // retrieve topmost pixel
+                const size_t curr = floodStack.top();
+                floodStack.pop();
+
+                // ignore if already processed
+                if (pixelComponents[curr] != -1) continue;
+
+                // assign communicator index, and cast the vote
+                pixelComponents[curr] = communicatorIndex;
+                votes.emplace_back(seedCandidate, communicatorIndex);
+
+                // submit unprocessed adjacent communicators to stack
+                directions_t::for_each([&](auto direction_tag_t, auto) {
+                    ext::point newPt = typePixels[curr];
+                    newPt.x += decltype(direction_tag_t)::type::first;
+                    newPt.y += decltype(direction_tag_t)::type::second;
+                    const size_t adjacent = positionOf(newPt);
+                    if (adjacent != typePixels.size() && pixelComponents[adjacent] == -1) {
+                        floodStack.push(adjacent);
                     }
-                }, gameState[pt]);
+                });
             }
         }
 
@@ -347,68 +522,68 @@ void Simulator::compile(CanvasState& gameState) {
 
         // Second, keep on the communicator component with maximum pixels from each communicator
         // Third, elect a communicator for each communicator component, or create a new communicator if there are none to choose from (interleaved with second step)
-        for (auto& mapEntry : communicatorMapToCommunicatorComponent) {
-            auto& vect = mapEntry.second;
-
-            // sort by the counts
-            sort(vect.begin(), vect.end(), [](const std::pair<int32_t, int32_t>& a, const std::pair<int32_t, int32_t>& b) {
-                return a.second < b.second;
-            });
+        // sorting the votes groups them by candidate, and then by component, so the pixels of a candidate in each component are a run
+        std::sort(votes.begin(), votes.end());
+        for (auto candidateBegin = votes.begin(); candidateBegin != votes.end();) {
+            const int32_t candidate = candidateBegin->first;
+            // the component with the fewest pixels of this candidate, and that number of pixels (the lowest component wins a tie)
+            std::pair<int32_t, int32_t> chosen{ -1, std::numeric_limits<int32_t>::max() };
+            auto runBegin = candidateBegin;
+            for (; runBegin != votes.end() && runBegin->first == candidate;) {
+                const auto runEnd = std::find_if(runBegin, votes.end(), [&](const std::pair<int32_t, int32_t>& vote) {
+                    return vote != *runBegin;
+                });
+                const int32_t count = static_cast<int32_t>(runEnd - runBegin);
+                if (count < chosen.second) chosen = { runBegin->second, count };
+                runBegin = runEnd;
+            }
+            candidateBegin = runBegin;
 
             // can we outvote the current leader?
-            if (communicatorComponents[vect.front().first].second < vect.front().second) {
+            if (communicatorComponents[chosen.first].second < chosen.second) {
                 // outvoted! keep the new component instead
-                communicatorComponents[vect.front().first] = std::make_pair(mapEntry.first, vect.front().second);
+                communicatorComponents[chosen.first] = std::make_pair(candidates[candidate], chosen.second);
             }
         }
 
-        // Fourth, create communicator objects for null communicators, and assign communicator indices
+        // Fourth, create communicator objects for null communicators (their indices are assigned by installStaticData())
         compilerStaticData.communicators.reserve(communicatorTypeComponentOffset + communicatorComponentCount);
         for (int32_t index = 0; index != communicatorComponentCount; ++index) {
             if (communicatorComponents[index].first == nullptr) {
                 communicatorComponents[index].first = std::make_shared<CommunicatorType>();
             }
-            communicatorComponents[index].first->communicatorIndex = communicatorTypeComponentOffset + index;
-            communicatorComponents[index].first->refresh();
             // spawn the communicator in the static data
             auto& comm = compilerStaticData.communicators.emplace_back();
             comm.communicator = communicatorComponents[index].first.get();
+            newCommunicators.push_back(communicatorComponents[index].first);
         }
 
         // Fifth, fill in the input and output components for the compiler static data
-        for (int32_t y = 0; y != gameState.height(); ++y) {
-            for (int32_t x = 0; x != gameState.width(); ++x) {
-                ext::point pt{ x, y };
-                std::visit([&](auto& element) {
-                    using ElementType = std::decay_t<decltype(element)>;
-                    if constexpr (std::is_same_v<typename CommunicatorType::element_t, ElementType>) {
-                        int32_t outputComponent = compilerStaticData.pixels[pt].index[0];
-                        assert(outputComponent >= 0 && outputComponent < static_cast<int32_t>(compilerStaticData.components.size()));
-                        int32_t typeLocalCommunicatorIndex = communicatorComponentIndices[pt];
-                        auto& communicatorObj = compilerStaticData.communicators[communicatorTypeComponentOffset + typeLocalCommunicatorIndex];
-
-                        // set the output components
-                        communicatorObj.outputComponent = outputComponent; // will be overwritten many times, but it's always the same outputComponent.
-                        if (element.communicator != communicatorComponents[typeLocalCommunicatorIndex].first) {
-                            // currently the element is storing the wrong communicator, so we update it
-                            element.communicator = communicatorComponents[typeLocalCommunicatorIndex].first;
-                        }
+        for (size_t i = 0; i != typePixels.size(); ++i) {
+            const ext::point& pt = typePixels[i];
+            const ElementType& element = std::get<ElementType>(gameState[pt]);
+            int32_t outputComponent = compilerStaticData.pixels[pt].index[0];
+            assert(outputComponent >= 0 && outputComponent < static_cast<int32_t>(compilerStaticData.components.size()));
+            int32_t typeLocalCommunicatorIndex = pixelComponents[i];
+            auto& communicatorObj = compilerStaticData.communicators[communicatorTypeComponentOffset + typeLocalCommunicatorIndex];
 
-                        // add all the input components for this communicator
-                        // note that there might be duplicate input components, because each communicator spans multiple pixels
-                        // we de-duplicate it later
-                        directions_t::for_each([&](auto direction_tag_t, auto) {
-                            ext::point newPt = pt;
-                            newPt.x += decltype(direction_tag_t)::type::first;
-                            newPt.y += decltype(direction_tag_t)::type::second;
-                            if (gameState.contains(newPt) && isSignal(gameState[newPt])) {
-                                assert(compilerStaticData.pixels[newPt].index[0] >= 0 && compilerStaticData.pixels[newPt].index[0] < compilerStaticData.components.size());
-                                communicatorObj.inputComponents.emplace_back(compilerStaticData.pixels[newPt].index[0]);
-                            }
-                        });
-                    }
-                }, gameState[pt]);
-            }
+            // set the output components
+            communicatorObj.outputComponent = outputComponent; // will be overwritten many times, but it's always the same outputComponent.
+            // the element will point to its communicator in the new communicator table
+            newCommunicatorIds.emplace_back(pt, communicatorTypeComponentOffset + typeLocalCommunicatorIndex);
+
+            // add all the input components for this communicator
+            // note that there might be duplicate input components, because each communicator spans multiple pixels
+            // we de-duplicate it later
+            directions_t::for_each([&](auto direction_tag_t, auto) {
+                ext::point newPt = pt;
+                newPt.x += decltype(direction_tag_t)::type::first;
+                newPt.y += decltype(direction_tag_t)::type::second;
+                if (gameState.contains(newPt) && (pixelFlags[newPt] & CompilerPixelFlags::SIGNAL)) {
+                    assert(compilerStaticData.pixels[newPt].index[0] >= 0 && compilerStaticData.pixels[newPt].index[0] < compilerStaticData.components.size());
+                    communicatorObj.inputComponents.emplace_back(compilerStaticData.pixels[newPt].index[0]);
+                }
+            });
         }
 
         // Sixth, update the number of communicators of this type
@@ -420,20 +595,32 @@ void Simulator::compile(CanvasState& gameState) {
     });
 
     assert(communicatorTypeComponentOffset == static_cast<int32_t>(compilerStaticData.communicators.size()));
+    CompiledCanvasKey key{ hash, gameState.size(), std::move(newCommunicators), {} };
+    // the ids are in raster order for each type, but the key has them in the order of the tiles
+    std::sort(newCommunicatorIds.begin(), newCommunicatorIds.end(), [](const std::pair<ext::point, int32_t>& a, const std::pair<ext::point, int32_t>& b) {
+        return std::tie(a.first.y, a.first.x) < std::tie(b.first.y, b.first.x);
+    });
+    key.communicatorIds.reserve(newCommunicatorIds.size());
+    gameState.dataMatrix.for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        if (!isCommunicatorElement(element)) return;
+        const auto it = std::lower_bound(newCommunicatorIds.begin(), newCommunicatorIds.end(), pt, [](const std::pair<ext::point, int32_t>& a, const ext::point& b) {
+            return std::tie(a.first.y, a.first.x) < std::tie(b.y, b.x);
+        });
+        assert(it != newCommunicatorIds.end() && it->first == pt);
+        key.communicatorIds.push_back(it->second);
+    });
 
     // Seventh, de-duplicate the communicators' input components
-    for (SimulatorCommunicator& comm : compilerStaticData.communicators) {
+    for (CompilerCommunicator& comm : compilerStaticData.communicators) {
         auto& inputs = comm.inputComponents;
         // sort the input components
         std::sort(inputs.begin(), inputs.end());
         // erase the consecutive duplicates
         inputs.erase(std::unique(inputs.begin(), inputs.end()), inputs.end());
-        // free unnecessary memory (because this vector will be *moved* to the real static data later)
-        inputs.shrink_to_fit();
     }
 
-    // Eighth, prepare the received data storage and clear the input queue
-    screenInputQueue.clear();
+    // renumber the components and relay pixels to improve memory locality during simulation
+    renumberForLocality(compilerStaticData);
 
     // === generate the fixed (packed) representation from the unpacked representation ===
 
@@ -442,442 +629,3471 @@ void Simulator::compile(CanvasState& gameState) {
 
     // logic gates
     compilerStaticData.logicGates.forEachGate(staticData.logicGates, [&](auto& gate, const auto& compilerGate) {
-        using indices_t = ext::tag_tuple<std::integral_constant<int32_t, 0>, std::integral_constant<int32_t, 1>, std::integral_constant<int32_t, 2>, std::integral_constant<int32_t, 3>, std::integral_constant<int32_t, 4>>;
-        indices_t::for_each([&](const auto index_tag, auto) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
             constexpr int32_t Index = decltype(index_tag)::type::value;
-            std::get<Index>(gate.data).update(std::move(std::get<Index>(compilerGate.data)));
+            auto& gates = std::get<Index>(gate.data);
+            gates.update(std::move(std::get<Index>(compilerGate.data)));
+            // sort by output so that each partition is a contiguous range (the order of evaluation does not matter)
+            std::sort(gates.begin(), gates.end(), [](const auto& a, const auto& b) {
+                return a.outputComponent < b.outputComponent;
+            });
+            std::get<Index>(gate.columns).update(gates);
         });
     });
     
     // relays
     compilerStaticData.relays.forEachRelay(staticData.relays, [&](auto& relay, const auto& compilerRelay) {
-        using indices_t = ext::tag_tuple<std::integral_constant<int32_t, 0>, std::integral_constant<int32_t, 1>, std::integral_constant<int32_t, 2>, std::integral_constant<int32_t, 3>, std::integral_constant<int32_t, 4>>;
-        indices_t::for_each([&](const auto index_tag, auto) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
             constexpr int32_t Index = decltype(index_tag)::type::value;
-            std::get<Index>(relay.data).update(std::move(std::get<Index>(compilerRelay.data)));
+            auto& relays = std::get<Index>(relay.data);
+            relays.update(std::move(std::get<Index>(compilerRelay.data)));
+            // sort by output so that each partition is a contiguous range (the order of evaluation does not matter)
+            std::sort(relays.begin(), relays.end(), [](const auto& a, const auto& b) {
+                return a.outputRelayPixel < b.outputRelayPixel;
+            });
         });
     });
 
     // communicators
-    staticData.communicators.update(std::move(compilerStaticData.communicators));
+    int32_t communicatorInputListSize = std::accumulate(compilerStaticData.communicators.begin(), compilerStaticData.communicators.end(), 0, [](const int32_t& prev, const CompilerCommunicator& curr) {
+        return prev + static_cast<int32_t>(curr.inputComponents.size());
+    });
 
-    // components
-    int32_t adjComponentListSize = std::accumulate(compilerStaticData.components.begin(), compilerStaticData.components.end(), 0, [](const int32_t& prev, const CompilerComponent& curr) {
-        return prev + static_cast<int32_t>(curr.adjRelayPixels.size());
+    staticData.communicatorInputList.resize(communicatorInputListSize);
+
+    staticData.communicators.resize(compilerStaticData.communicators.size());
+    int32_t communicatorInputOffset = 0;
+    std::transform(compilerStaticData.communicators.begin(), compilerStaticData.communicators.end(), staticData.communicators.begin(), [&](const CompilerCommunicator& old) {
+        int32_t newBegin = communicatorInputOffset;
+        std::copy(old.inputComponents.begin(), old.inputComponents.end(), staticData.communicatorInputList.begin() + newBegin);
+        communicatorInputOffset += static_cast<int32_t>(old.inputComponents.size());
+        return SimulatorCommunicator{ newBegin, communicatorInputOffset, old.outputComponent, old.communicator };
     });
 
-    staticData.adjComponentList.resize(adjComponentListSize);
+    // components (the adjacency lists are already in the packed form)
+    staticData.adjComponentList.update(compilerStaticData.adjRelayPixelList);
 
     staticData.components.resize(compilerStaticData.components.size());
-    int32_t offset = 0;
-    std::transform(compilerStaticData.components.begin(), compilerStaticData.components.end(), staticData.components.begin(), [&](const CompilerComponent& old) {
-        int32_t newBegin = offset;
-        std::copy(old.adjRelayPixels.begin(), old.adjRelayPixels.end(), staticData.adjComponentList.begin() + newBegin);
-        offset += static_cast<int32_t>(old.adjRelayPixels.size());
-        return Simulator::Component{ newBegin, offset };
+    for (size_t i = 0; i != compilerStaticData.components.size(); ++i) {
+        staticData.components[i] = Simulator::Component{ compilerStaticData.adjRelayPixelsBegin[i], compilerStaticData.adjRelayPixelsBegin[i + 1] };
+    }
+
+    staticData.relayLinkComponents.resize(compilerStaticData.components.size());
+    std::transform(compilerStaticData.components.begin(), compilerStaticData.components.end(), staticData.relayLinkComponents.begin(), [](const CompilerComponent& component) {
+        return component.relayLink;
     });
+    staticData.freeComponents.clear();
+    staticData.freeRelayPixels.clear();
 
-    staticData.relayPixels.update(std::move(compilerStaticData.relayPixels));
+    // relay pixels
+    int32_t adjRelayPixelListSize = std::accumulate(compilerStaticData.relayPixels.begin(), compilerStaticData.relayPixels.end(), 0, [](const int32_t& prev, const CompilerRelayPixel& curr) {
+        return prev + static_cast<int32_t>(curr.numAdjComponents);
+    });
 
-    staticData.pixels = std::move(compilerStaticData.pixels);
+    staticData.adjRelayPixelList.resize(adjRelayPixelListSize);
 
+    staticData.relayPixels.resize(compilerStaticData.relayPixels.size());
+    int32_t adjRelayPixelOffset = 0;
+    std::transform(compilerStaticData.relayPixels.begin(), compilerStaticData.relayPixels.end(), staticData.relayPixels.begin(), [&](const CompilerRelayPixel& old) {
+        int32_t newBegin = adjRelayPixelOffset;
+        std::copy(old.adjComponents.begin(), old.adjComponents.begin() + old.numAdjComponents, staticData.adjRelayPixelList.begin() + newBegin);
+        adjRelayPixelOffset += old.numAdjComponents;
+        return Simulator::RelayPixel{ newBegin, adjRelayPixelOffset };
+    });
 
-    // === dynamic state ===
-    // sets everything to false by default
-    DynamicData dynamicData(staticData.components.size, staticData.relayPixels.size, staticData.communicators.size);
+    staticData.pixels = std::move(compilerStaticData.pixels);
+    return key;
+}
 
-    // fill from all the currently sources and logic gates,
-    // and fill the conductive state from the relays
-    for (int32_t y = 0; y != gameState.height(); ++y) {
-        for (int32_t x = 0; x != gameState.width(); ++x) {
-            ext::point pt{ x, y };
-            std::visit([&](const auto& element) {
-                using ElementType = std::decay_t<decltype(element)>;
-                if constexpr (std::is_same_v<Source, ElementType>) {
-                    int32_t outputComponent = staticData.pixels[pt].index[0];
-                    assert(outputComponent >= 0 && outputComponent < staticData.components.size);
-                    dynamicData.componentLogicLevels[outputComponent] = true;
-                }
-                if constexpr (std::is_base_of_v<LogicLevelElement, ElementType>) {
-                    if (element.logicLevel) {
-                        int32_t outputComponent = staticData.pixels[pt].index[0];
-                        assert(outputComponent >= 0 && outputComponent < staticData.components.size);
-                        dynamicData.componentLogicLevels[outputComponent] = true;
-                    }
-                }
-                if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
-                    if (element.transmitState) {
-                        int32_t outputCommunicator = element.communicator->communicatorIndex;
-                        assert(outputCommunicator >= 0 && outputCommunicator < staticData.communicators.size);
-                        dynamicData.communicatorTransmitStates[outputCommunicator] = true;
-                    }
-                }
-                if constexpr(std::is_base_of_v<Relay, ElementType>) {
-                    if (element.conductiveState) {
-                        int32_t outputRelayPixel = staticData.pixels[pt].index[0];
-                        assert(outputRelayPixel >= 0 && outputRelayPixel < staticData.relayPixels.size);
-                        dynamicData.relayPixelIsConductive[outputRelayPixel] = true;
-                    }
-                }
-            }, gameState[pt]);
-        }
-    }
 
-    // flood fill to ensure that the current state is a valid simulation state
-    floodFill(staticData, dynamicData);
+uint64_t Simulator::compileHash(const CanvasState& gameState) noexcept {
+    // 64-bit FNV-1a of the size of the canvas, then the position and element type of each non-empty pixel
+    // (tiles are visited in a fixed order, and unallocated tiles only have empty pixels, so this does not depend on which tiles are allocated)
+    uint64_t hash = 0xcbf29ce484222325;
+    const auto combine = [&](uint32_t value) {
+        for (int i = 0; i != 4; ++i) {
+            hash = (hash ^ ((value >> (i * 8)) & 0xFF)) * 0x100000001b3;
+        }
+    };
+    combine(static_cast<uint32_t>(gameState.width()));
+    combine(static_cast<uint32_t>(gameState.height()));
+    gameState.dataMatrix.for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        if (std::holds_alternative<std::monostate>(element)) return;
+        combine(static_cast<uint32_t>(pt.x));
+        combine(static_cast<uint32_t>(pt.y));
+        combine(static_cast<uint32_t>(element.index()));
+    });
+    return hash;
+}
 
-    // Note: no atomics required here because the simulation thread has not started, and starting the thread automatically does synchronization.
-    latestCompleteState = std::make_shared<DynamicData>(std::move(dynamicData));
 
-    // take a snapshot (with the immediate propagation done)
-    takeSnapshot(gameState);
+Simulator::CompiledCanvasKey Simulator::makeCompiledCanvasKey(const CanvasState& gameState, uint64_t hash) {
+    CompiledCanvasKey key{ hash, gameState.size(), gameState.communicators, {} };
+    gameState.dataMatrix.for_each([&](const ext::point&, const CanvasState::element_variant_t& element) {
+        std::visit([&](const auto& element) {
+            if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                key.communicatorIds.push_back(element.communicatorId);
+            }
+        }, element);
+    });
+    return key;
 }
 
 
-void Simulator::reset(CanvasState& gameState) {
-    // Reset the transient state to the starting state
-    for (auto& element : gameState.dataMatrix) {
-        resetLogicLevel(element);
-    }
+bool Simulator::matchesCompiledCanvasKey(const CompiledCanvasKey& key, const CanvasState& gameState, uint64_t hash) {
+    if (key.hash != hash || key.size != gameState.size()) return false;
+    // the elements are the same, so the communicator pixels are visited in the same order as by makeCompiledCanvasKey()
+    bool matches = true;
+    size_t i = 0;
+    gameState.dataMatrix.for_each([&](const ext::point&, const CanvasState::element_variant_t& element) {
+        std::visit([&](const auto& element) {
+            if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                if (!matches) return;
+                const int32_t id = element.communicatorId;
+                matches = i != key.communicatorIds.size() && id >= 0 && id < static_cast<int32_t>(gameState.communicators.size()) && gameState.communicators[id] && gameState.communicators[id] == key.communicators[key.communicatorIds[i]];
+                ++i;
+            }
+        }, element);
+    });
+    return matches && i == key.communicatorIds.size();
+}
 
-    // compile
-    compile(gameState);
 
-    // reset the communicators
-    for (auto& simComm : staticData.communicators) {
-        simComm.communicator->reset();
-    }
+void Simulator::applyCompiledCanvasKey(const CompiledCanvasKey& key, CanvasState& gameState) {
+    auto communicatorId = key.communicatorIds.begin();
+    gameState.dataMatrix.for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                // only written if it changed, so that tiles shared with other canvas states are not duplicated
+                if (element.communicatorId != *communicatorId) std::get<ElementType>(gameState[pt]).communicatorId = *communicatorId;
+                ++communicatorId;
+            }
+        }, element);
+    });
+    gameState.communicators = key.communicators;
 }
 
 
-void Simulator::start() {
-    // Unset the 'stopping' flag
-    // note:  // std::memory_order_relaxed, because when starting the thread, the std::thread constructor automatically does synchronization.
-    simStopping.store(false, std::memory_order_relaxed);
+void Simulator::cacheStaticData(CompiledCanvasKey&& key, StaticData&& oldStaticData) {
+    assert(!oldStaticData.constantsFolded);
+    staticDataCache.push_front(CachedStaticData{ std::move(key), std::move(oldStaticData) });
+    if (staticDataCache.size() > staticDataCacheSize) staticDataCache.pop_back();
+}
 
-    // Spawn the simulator thread
-    simThread = std::thread([this]() {
-        run();
+
+bool Simulator::takeCachedStaticData(CanvasState& gameState, uint64_t hash, StaticData& newStaticData, CompiledCanvasKey& key) {
+    const auto it = std::find_if(staticDataCache.begin(), staticDataCache.end(), [&](const CachedStaticData& entry) {
+        return matchesCompiledCanvasKey(entry.key, gameState, hash);
     });
+    if (it == staticDataCache.end()) return false;
+    applyCompiledCanvasKey(it->key, gameState);
+    newStaticData = std::move(it->staticData);
+    key = std::move(it->key);
+    staticDataCache.erase(it);
+    return true;
 }
 
 
-void Simulator::stop() {
-    // Set the 'stopping' flag, and flush it so that the simulation thread can see it
-    {
-        std::lock_guard<std::mutex> lock(simSleepMutex);
-        simStopping.store(true, std::memory_order_relaxed);
+void Simulator::installStaticData(StaticData&& newStaticData) {
+    staticData = std::move(newStaticData);
+
+    // assign the communicator indices
+    for (int32_t i = 0; i != static_cast<int32_t>(staticData.communicators.size); ++i) {
+        staticData.communicators[i].communicator->communicatorIndex = i;
+        if (i >= staticData.screenCommunicatorStartIndex && i < staticData.screenCommunicatorEndIndex) {
+            static_cast<ScreenCommunicator*>(staticData.communicators[i].communicator)->setInputDepth(screenInputDepth);
+        }
+        staticData.communicators[i].communicator->refresh();
     }
-    simSleepCV.notify_one();
 
-    // Wait for the simulation thread to be done
-    simThread.join();
+    // prepare the received data storage and clear the input queue
+    screenInputQueue.clear();
 
-    // Free up resources used by the std::thread object by assigning an empty std::thread
-    simThread = std::thread();
+    // the input log is only valid for the circuit it was started on
+    inputLogMode = InputLogMode::NONE;
+    inputLog = InputLog();
+
+    prepareEngines();
 }
 
 
-void Simulator::step() {
-    // this runs the simulator in the main thread, since we want to block until the step is complete.
+void Simulator::setScreenInputDepth(size_t depth) {
+    screenInputDepth = depth;
+    for (int32_t i = staticData.screenCommunicatorStartIndex; i != staticData.screenCommunicatorEndIndex; ++i) {
+        static_cast<ScreenCommunicator*>(staticData.communicators[i].communicator)->setInputDepth(depth);
+    }
+}
+
+
+void Simulator::compile(CanvasState& gameState, std::ostream* cache) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::compile");
+    // any compilation still running in the background is of an older canvas
+    discardBackgroundCompile();
+
+    {
+        const uint64_t hash = compileHash(gameState);
+        StaticData newStaticData;
+        CompiledCanvasKey newKey;
+        if (staticDataKey && matchesCompiledCanvasKey(*staticDataKey, gameState, hash)) {
+            // the canvas has not changed since the last compilation (e.g. the simulation is being reset)
+            unfoldConstants();
+            applyCompiledCanvasKey(*staticDataKey, gameState);
+            newStaticData = std::move(staticData);
+            newKey = std::move(*staticDataKey);
+            staticDataKey.reset();
+        }
+        else if (!takeCachedStaticData(gameState, hash, newStaticData, newKey)) {
+            newKey = buildStaticData(gameState, hash, newStaticData, workerPool.get());
+            applyCompiledCanvasKey(newKey, gameState);
+        }
+        if (cache) StaticDataCache::write(gameState, newStaticData, *cache);
+        if (staticDataKey) {
+            unfoldConstants();
+            cacheStaticData(std::move(*staticDataKey), std::move(staticData));
+        }
+        installStaticData(std::move(newStaticData));
+        staticDataKey = std::move(newKey);
+    }
+
+    initDynamicData(gameState);
+}
+
+
+bool Simulator::compileFromCache(CanvasState& gameState, std::istream& cache) {
+    // the communicators are created anew from the cache, so the canvas must not have any yet
+    if (!gameState.communicators.empty()) return false;
+
+    StaticData newStaticData;
+    std::vector<std::shared_ptr<Communicator>> newCommunicators;
+    std::vector<int32_t> communicatorIds;
+    if (!StaticDataCache::read(gameState, newStaticData, newCommunicators, communicatorIds, cache)) return false;
+
+    // any compilation still running in the background is of an older canvas
+    discardBackgroundCompile();
+
+    // point the communicator elements to their communicators in the new communicator table (the ids are in raster order)
+    auto communicatorId = communicatorIds.begin();
+    for (int32_t y = 0; y != gameState.height(); ++y) {
+        for (int32_t x = 0; x != gameState.width(); ++x) {
+            const ext::point pt{ x, y };
+            if (newStaticData.pixels[pt].type != StaticData::DisplayedPixel::PixelType::COMMUNICATOR) continue;
+            std::visit([&](auto& element) {
+                if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                    element.communicatorId = *communicatorId;
+                }
+            }, gameState[pt]);
+            ++communicatorId;
+        }
+    }
+    gameState.communicators = std::move(newCommunicators);
+
+    installStaticData(std::move(newStaticData));
+    staticDataKey = makeCompiledCanvasKey(gameState, compileHash(gameState));
+
+    initDynamicData(gameState);
+    return true;
+}
+
+
+void Simulator::initDynamicData(CanvasState& gameState) {
+    stepNumber.store(0, std::memory_order_relaxed);
+
+    // the buffers from the previous compilation have the wrong sizes, so we discard them (the new buffer has everything set to false)
+    const std::shared_ptr<DynamicData>& dynamicDataPtr = resetDynamicDataPool(staticData.components.size, staticData.relayPixels.size, staticData.communicators.size);
+    DynamicData& dynamicData = *dynamicDataPtr;
+
+    // fill from all the currently sources and logic gates,
+    // and fill the conductive state from the relays
+    // empty tiles have no elements, so they can be skipped
+    std::as_const(gameState.dataMatrix).for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_same_v<Source, ElementType>) {
+                int32_t outputComponent = staticData.pixels[pt].index[0];
+                assert(outputComponent >= 0 && outputComponent < staticData.components.size);
+                dynamicData.componentLogicLevels.set(outputComponent);
+            }
+            if constexpr (std::is_base_of_v<LogicLevelElement, ElementType>) {
+                if (element.logicLevel) {
+                    int32_t outputComponent = staticData.pixels[pt].index[0];
+                    assert(outputComponent >= 0 && outputComponent < staticData.components.size);
+                    dynamicData.componentLogicLevels.set(outputComponent);
+                }
+            }
+            if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                if (element.transmitState) {
+                    int32_t outputCommunicator = gameState.communicatorOf(element)->communicatorIndex;
+                    assert(outputCommunicator >= 0 && outputCommunicator < staticData.communicators.size);
+                    dynamicData.communicatorTransmitStates.set(outputCommunicator);
+                }
+            }
+            if constexpr(std::is_base_of_v<Relay, ElementType>) {
+                if (element.conductiveState) {
+                    int32_t outputRelayPixel = staticData.pixels[pt].index[0];
+                    assert(outputRelayPixel >= 0 && outputRelayPixel < staticData.relayPixels.size);
+                    dynamicData.relayPixelIsConductive.set(outputRelayPixel);
+                }
+            }
+        }, element);
+    });
+
+    // flood fill to ensure that the current state is a valid simulation state
+    propagate(dynamicData);
+
+    foldConstants(dynamicData);
+
+    // Note: no atomics required here because the simulation thread has not started, and starting the thread automatically does synchronization.
+    setLatestCompleteState(dynamicDataPtr);
+
+    // take a snapshot (with the immediate propagation done)
+    takeSnapshot(gameState);
+}
+
+
+void Simulator::compileInBackground(const CanvasState& gameState, ext::point translation) {
+    if (backgroundCompilation) {
+        // the pending compilation is out of date, but the running simulation has not seen its translation yet
+        translation += backgroundCompilation->translation;
+        discardBackgroundCompile();
+    }
+
+    backgroundCompilation = std::make_unique<BackgroundCompilation>();
+    BackgroundCompilation& compilation = *backgroundCompilation;
+    compilation.canvas = gameState;
+    compilation.translation = translation;
+
+    // going back to a canvas that was compiled recently (e.g. by undo or redo) takes its static data from the cache, without starting a thread
+    // (the canvas is only hashed if some cached static data has the same size, since hashing visits every element)
+    if (std::any_of(staticDataCache.begin(), staticDataCache.end(), [&](const CachedStaticData& entry) { return entry.key.size == gameState.size(); })) {
+        if (takeCachedStaticData(compilation.canvas, compileHash(gameState), compilation.staticData, compilation.key)) {
+            compilation.done.store(true, std::memory_order_release);
+            return;
+        }
+    }
+
+    compilation.thread = std::thread([&compilation]() {
+        CIRCUIT_SANDBOX_TRACE_THREAD("background compilation");
+        // the worker pool is in use by the running simulation, so the compilation fills the gaps on the bulk pool instead
+        const ext::thread_pool::priority_scope priority(ext::thread_pool::priority::low);
+        compilation.key = buildStaticData(compilation.canvas, compileHash(compilation.canvas), compilation.staticData, &ext::thread_pool::shared());
+        compilation.done.store(true, std::memory_order_release);
+    });
+}
+
+
+bool Simulator::finishBackgroundCompile(CanvasState& gameState) {
+    joinDiscardedCompilations(false);
+
+    if (!backgroundCompilation || !backgroundCompilation->done.load(std::memory_order_acquire)) return false;
+    // don't interrupt a fast-forward, the new static data will be swapped in after it is stopped
+    if (fastForwarding()) return false;
+
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::finishBackgroundCompile");
+    const std::unique_ptr<BackgroundCompilation> compilation = std::move(backgroundCompilation);
+    if (compilation->thread.joinable()) compilation->thread.join();
+    assert(compilation->canvas.size() == gameState.size());
+
+    // swap the static data at a step boundary
+    const bool simulatorRunning = running();
+    if (simulatorRunning) stop();
+
+    const std::shared_ptr<DynamicData> oldDynamicData = latestCompleteState;
+    // the old static data goes to the cache when we are done with it, so the constants are put back first (this leaves the pixels and indices unchanged)
+    if (staticDataKey) unfoldConstants();
+    StaticData oldStaticData = std::move(staticData);
+    std::optional<CompiledCanvasKey> oldStaticDataKey = std::move(staticDataKey);
+    // the probes stay on the same elements
+    for (ext::point& pt : probePoints) pt += compilation->translation;
+    for (Breakpoint& breakpoint : breakpoints) breakpoint.point += compilation->translation;
+    installStaticData(std::move(compilation->staticData));
+    staticDataKey = std::move(compilation->key);
+
+    // remember the old index of each communicator, so that we can keep its transmit state
+    std::unordered_map<const Communicator*, int32_t> oldCommunicatorIndices;
+    for (int32_t i = 0; i != static_cast<int32_t>(oldStaticData.communicators.size); ++i) {
+        oldCommunicatorIndices.emplace(oldStaticData.communicators[i].communicator, i);
+    }
+
+    // === dynamic state ===
+    // same as compile(), except that the levels are taken from the old simulation state (at the same pixel) where there is one
+    const std::shared_ptr<DynamicData>& dynamicDataPtr = resetDynamicDataPool(staticData.components.size, staticData.relayPixels.size, staticData.communicators.size);
+    DynamicData& dynamicData = *dynamicDataPtr;
+
+    // the compilation may have created communicators for the new communicator elements, and the communicator elements point into its communicator table
+    // (the compilation thread leaves its copy of the canvas alone, since it shares tiles with gameState, so the ids are in the key instead)
+    applyCompiledCanvasKey(*staticDataKey, gameState);
+
+    // empty tiles have no elements, so they can be skipped
+    std::as_const(gameState.dataMatrix).for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        // the old pixel at the same element (there is none if it was outside the old canvas)
+        const ext::point oldPt = pt - compilation->translation;
+        const StaticData::DisplayedPixel* oldPixel = oldStaticData.pixels.contains(oldPt) ? &oldStaticData.pixels[oldPt] : nullptr;
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_same_v<Source, ElementType>) {
+                int32_t outputComponent = staticData.pixels[pt].index[0];
+                assert(outputComponent >= 0 && outputComponent < staticData.components.size);
+                dynamicData.componentLogicLevels.set(outputComponent);
+            }
+            if constexpr (std::is_base_of_v<LogicLevelElement, ElementType>) {
+                bool logicLevel = element.logicLevel;
+                if (oldPixel && (oldPixel->type == StaticData::DisplayedPixel::PixelType::COMPONENT || oldPixel->type == StaticData::DisplayedPixel::PixelType::COMMUNICATOR) && oldPixel->index[0] >= 0 && oldPixel->index[0] < static_cast<int32_t>(oldStaticData.components.size)) {
+                    logicLevel = oldDynamicData->componentLogicLevels[oldPixel->index[0]];
+                }
+                if (logicLevel) {
+                    int32_t outputComponent = staticData.pixels[pt].index[0];
+                    assert(outputComponent >= 0 && outputComponent < staticData.components.size);
+                    dynamicData.componentLogicLevels.set(outputComponent);
+                }
+            }
+            if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                bool transmitState = element.transmitState;
+                if (auto it = oldCommunicatorIndices.find(gameState.communicatorOf(element)); it != oldCommunicatorIndices.end()) {
+                    transmitState = oldDynamicData->communicatorTransmitStates[it->second];
+                }
+                if (transmitState) {
+                    int32_t outputCommunicator = gameState.communicatorOf(element)->communicatorIndex;
+                    assert(outputCommunicator >= 0 && outputCommunicator < staticData.communicators.size);
+                    dynamicData.communicatorTransmitStates.set(outputCommunicator);
+                }
+            }
+            if constexpr (std::is_base_of_v<Relay, ElementType>) {
+                bool conductiveState = element.conductiveState;
+                if (oldPixel && oldPixel->type == StaticData::DisplayedPixel::PixelType::RELAY && oldPixel->index[0] >= 0 && oldPixel->index[0] < static_cast<int32_t>(oldStaticData.relayPixels.size)) {
+                    conductiveState = oldDynamicData->relayPixelIsConductive[oldPixel->index[0]];
+                }
+                if (conductiveState) {
+                    int32_t outputRelayPixel = staticData.pixels[pt].index[0];
+                    assert(outputRelayPixel >= 0 && outputRelayPixel < staticData.relayPixels.size);
+                    dynamicData.relayPixelIsConductive.set(outputRelayPixel);
+                }
+            }
+        }, element);
+    });
+
+    // flood fill to ensure that the current state is a valid simulation state
+    propagate(dynamicData);
+
+    foldConstants(dynamicData);
+
+    // Note: no atomics required here because the simulation thread is stopped, and starting the thread automatically does synchronization.
+    setLatestCompleteState(dynamicDataPtr);
+
+    takeSnapshot(gameState);
+
+    if (oldStaticDataKey) cacheStaticData(std::move(*oldStaticDataKey), std::move(oldStaticData));
+
+    if (simulatorRunning) start();
+    return true;
+}
+
+
+void Simulator::discardBackgroundCompile() {
+    // the thread can't be interrupted, so it is joined later when it is done
+    if (backgroundCompilation) {
+        discardedCompilations.push_back(std::move(backgroundCompilation));
+    }
+    joinDiscardedCompilations(false);
+}
+
+
+void Simulator::joinDiscardedCompilations(bool wait) {
+    for (auto it = discardedCompilations.begin(); it != discardedCompilations.end();) {
+        if (wait || (*it)->done.load(std::memory_order_acquire)) {
+            if ((*it)->thread.joinable()) (*it)->thread.join();
+            it = discardedCompilations.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+
+bool Simulator::compileIncremental(CanvasState& gameState, const std::vector<std::pair<ext::point, ext::point>>& editedRects) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::compileIncremental");
+    using PixelType = StaticData::DisplayedPixel::PixelType;
+
+    // the static data is out of date until the pending compilation is swapped in
+    if (backgroundCompilation) return false;
+
+    // we can only patch the previous compilation if it was of the same canvas (apart from the edited rectangle)
+    if (!latestCompleteState || staticData.pixels.size() != gameState.size()) return false;
+
+    // the pixels next to an edited rectangle may connect differently too, so we re-flood everything that touches the expanded rectangles
+    std::vector<std::pair<ext::point, ext::point>> rects, outerRects;
+    for (const auto& [topLeft, bottomRight] : editedRects) {
+        const ext::point first = ext::max(topLeft, ext::point{ 0, 0 });
+        const ext::point last = ext::min(bottomRight, gameState.size());
+        if (first.x >= last.x || first.y >= last.y) continue;
+        rects.emplace_back(first, last);
+        outerRects.emplace_back(ext::max(first - ext::point{ 1, 1 }, ext::point{ 0, 0 }), ext::min(last + ext::point{ 1, 1 }, gameState.size()));
+    }
+    // nothing was edited
+    if (rects.empty()) return true;
+
+    // the patching below needs the gates and relays of every element
+    unfoldConstants();
+    // the patched static data is not of any canvas that can be recognized later
+    staticDataKey.reset();
+
+    auto forEachPoint = [](const ext::point& first, const ext::point& last, auto callback) {
+        for (int32_t y = first.y; y != last.y; ++y) {
+            for (int32_t x = first.x; x != last.x; ++x) {
+                callback(ext::point{ x, y });
+            }
+        }
+    };
+    // the rectangles may overlap, so the callback has to cope with seeing a point more than once
+    auto forEachRectPoint = [&](const std::vector<std::pair<ext::point, ext::point>>& rectList, auto callback) {
+        for (const auto& [first, last] : rectList) {
+            forEachPoint(first, last, callback);
+        }
+    };
+    // the index of the first edited rectangle that contains the point, or rects.size() if it was not edited
+    auto editedRectOf = [&](const ext::point& pt) {
+        return static_cast<size_t>(std::find_if(rects.begin(), rects.end(), [&](const std::pair<ext::point, ext::point>& rect) {
+            return pt.x >= rect.first.x && pt.x < rect.second.x && pt.y >= rect.first.y && pt.y < rect.second.y;
+        }) - rects.begin());
+    };
+    // keys of points, in the same order as the raster scan of compile()
+    auto keyOf = [&](const ext::point& pt) {
+        return static_cast<int64_t>(pt.y) * gameState.width() + pt.x;
+    };
+    auto pointOf = [&](int64_t key) {
+        return ext::point{ static_cast<int32_t>(key % gameState.width()), static_cast<int32_t>(key / gameState.width()) };
+    };
+    auto sortUnique = [](std::vector<int64_t>& keys) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    };
+
+    // directions for the gates and relays (in the same order as compile())
+    using up = integral_pair<int32_t, 0, -1>;
+    using down = integral_pair<int32_t, 0, 1>;
+    using left = integral_pair<int32_t, -1, 0>;
+    using right = integral_pair<int32_t, 1, 0>;
+    using directions_t = ext::tag_tuple<up, down, left, right>;
+
+    const int32_t oldNumComponents = static_cast<int32_t>(staticData.components.size);
+    const int32_t oldNumRelayPixels = static_cast<int32_t>(staticData.relayPixels.size);
+
+    // === find the old components that touch the expanded rectangles ===
+    // communicators are matched up over the whole canvas, so edits that involve them need a full compilation
+    std::vector<bool> releasedComponents(oldNumComponents, false);
+    bool touchesCommunicator = false;
+    forEachRectPoint(outerRects, [&](const ext::point& pt) {
+        const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+        if (pixel.type == PixelType::COMMUNICATOR || isCommunicatorElement(gameState[pt])) touchesCommunicator = true;
+        if (pixel.type == PixelType::COMPONENT) {
+            for (int32_t index : pixel.index) {
+                if (index != -1) releasedComponents[index] = true;
+            }
+        }
+    });
+    if (touchesCommunicator) return false;
+
+    // remember the old pixels in the edited rectangles (all of them before any is reset, since they may overlap), and reset them to match the new elements
+    std::vector<ext::heap_matrix<StaticData::DisplayedPixel>> oldEditedPixels;
+    oldEditedPixels.reserve(rects.size());
+    for (const std::pair<ext::point, ext::point>& rect : rects) {
+        ext::heap_matrix<StaticData::DisplayedPixel>& oldPixels = oldEditedPixels.emplace_back(rect.second - rect.first);
+        forEachPoint(rect.first, rect.second, [&](const ext::point& pt) {
+            oldPixels[pt - rect.first] = staticData.pixels[pt];
+        });
+    }
+    forEachRectPoint(rects, [&](const ext::point& pt) {
+        StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+        pixel.type = CompilerStaticData::displayedPixelType(gameState[pt]);
+        pixel.elementIndex = static_cast<uint8_t>(gameState[pt].index());
+        pixel.index[0] = pixel.index[1] = -1;
+    });
+
+    // === flood fill the new components ===
+    // this reaches exactly the pixels of the released components (that are still floodfillable) and the new pixels in the edited rectangles
+    // while flooding, an index of VISITED_USELESS marks a visited pixel of a useless component, and -3 - k marks a visited pixel of the k-th new component
+    constexpr int32_t VISITED_USELESS = -2;
+    auto isVisited = [](int32_t index) {
+        return index <= VISITED_USELESS;
+    };
+    std::vector<std::pair<ext::point, int>> floodedPixels;
+    // the indices the flooded pixels had before, so that the pixels can be restored if we have to give up
+    std::vector<int32_t> floodedOldIndices;
+    int32_t numFloodedComponents = 0;
+    std::stack<std::pair<ext::point, int>> floodStack;
+    forEachRectPoint(outerRects, [&](const ext::point& pt) {
+        if (!isFloodfillableElement(gameState[pt])) return;
+        for (int dir = 0; dir < 2; ++dir) {
+            if (isVisited(staticData.pixels[pt].index[dir])) continue;
+
+            bool componentIsUseful = false;
+            const size_t firstPixel = floodedPixels.size();
+            floodStack.emplace(pt, dir);
+            while (!floodStack.empty()) {
+                auto [currPt, currDir] = floodStack.top();
+                floodStack.pop();
+
+                int32_t& currIndex = staticData.pixels[currPt].index[currDir];
+                if (isVisited(currIndex)) continue;
+                floodedOldIndices.push_back(currIndex);
+                currIndex = VISITED_USELESS;
+                floodedPixels.emplace_back(currPt, currDir);
+
+                if (!componentIsUseful && isFloodfillableUsefulElement(gameState[currPt])) {
+                    componentIsUseful = true;
+                }
+
+                // if its not insulated wire, push the opposite direction
+                if (!std::holds_alternative<InsulatedWire>(gameState[currPt]) && !isVisited(staticData.pixels[currPt].index[currDir ^ 1])) {
+                    floodStack.emplace(currPt, currDir ^ 1);
+                }
+
+                // visit the adjacent pixels
+                for (int32_t delta : { -1, 1 }) {
+                    ext::point newPt = currPt;
+                    (currDir == 0 ? newPt.x : newPt.y) += delta;
+                    if (!gameState.contains(newPt)) continue;
+                    if (!isVisited(staticData.pixels[newPt].index[currDir]) && isFloodfillConnected(gameState[currPt], gameState[newPt])) {
+                        floodStack.emplace(newPt, currDir);
+                    }
+                    if (!componentIsUseful && isRelayElement(gameState[newPt])) {
+                        componentIsUseful = true;
+                    }
+                }
+            }
+
+            if (componentIsUseful) {
+                const int32_t floodedIndex = -3 - numFloodedComponents++;
+                for (size_t i = firstPixel; i != floodedPixels.size(); ++i) {
+                    staticData.pixels[floodedPixels[i].first].index[floodedPixels[i].second] = floodedIndex;
+                }
+            }
+        }
+    });
+
+    // undoes the changes to the pixels, for when the edit turns out to need a full compilation
+    auto restorePixels = [&]() {
+        for (size_t i = 0; i != floodedPixels.size(); ++i) {
+            staticData.pixels[floodedPixels[i].first].index[floodedPixels[i].second] = floodedOldIndices[i];
+        }
+        for (size_t i = 0; i != rects.size(); ++i) {
+            forEachPoint(rects[i].first, rects[i].second, [&](const ext::point& pt) {
+                staticData.pixels[pt] = oldEditedPixels[i][pt - rects[i].first];
+            });
+        }
+    };
+
+    // the elements whose compiled data may have changed
+    std::vector<int64_t> floodedKeys, gateKeys, relayKeys;
+    floodedKeys.reserve(floodedPixels.size());
+    for (const auto& [pt, dir] : floodedPixels) {
+        floodedKeys.push_back(keyOf(pt));
+    }
+    sortUnique(floodedKeys);
+    for (int64_t key : floodedKeys) {
+        const ext::point pt = pointOf(key);
+        const auto& element = gameState[pt];
+        if (isCommunicatorElement(element)) {
+            restorePixels();
+            return false;
+        }
+        if (isLogicGateElement(element)) gateKeys.push_back(key);
+        const bool signal = isSignal(element);
+        directions_t::for_each([&](auto direction_tag_t, auto) {
+            ext::point newPt = pt;
+            newPt.x += decltype(direction_tag_t)::type::first;
+            newPt.y += decltype(direction_tag_t)::type::second;
+            if (!gameState.contains(newPt)) return;
+            const auto& newElement = gameState[newPt];
+            if (isRelayElement(newElement)) relayKeys.push_back(keyOf(newPt));
+            else if (signal && isLogicGateElement(newElement)) gateKeys.push_back(keyOf(newPt));
+            else if (signal && isCommunicatorElement(newElement)) touchesCommunicator = true;
+        });
+    }
+    if (touchesCommunicator) {
+        restorePixels();
+        return false;
+    }
+    sortUnique(gateKeys);
+
+    // === find the relays to rebuild ===
+    // these are the relays in the expanded rectangles and those next to flooded pixels, together with all relays connected to them through adjacent relays
+    // (so that the components spawned between adjacent relays are always rebuilt from both sides)
+    forEachRectPoint(outerRects, [&](const ext::point& pt) {
+        if (isRelayElement(gameState[pt])) relayKeys.push_back(keyOf(pt));
+    });
+    {
+        std::unordered_set<int64_t> seenRelays(relayKeys.begin(), relayKeys.end());
+        for (size_t i = 0; i != relayKeys.size(); ++i) {
+            const ext::point pt = pointOf(relayKeys[i]);
+            directions_t::for_each([&](auto direction_tag_t, auto) {
+                ext::point newPt = pt;
+                newPt.x += decltype(direction_tag_t)::type::first;
+                newPt.y += decltype(direction_tag_t)::type::second;
+                if (gameState.contains(newPt) && isRelayElement(gameState[newPt]) && seenRelays.insert(keyOf(newPt)).second) {
+                    relayKeys.push_back(keyOf(newPt));
+                }
+            });
+        }
+    }
+    sortUnique(relayKeys);
+
+    // the old relay pixel at a point that is now a relay, or -1 if there was none
+    auto oldRelayPixelAt = [&](const ext::point& pt) {
+        const size_t rect = editedRectOf(pt);
+        const StaticData::DisplayedPixel& oldPixel = rect != rects.size() ? oldEditedPixels[rect][pt - rects[rect].first] : staticData.pixels[pt];
+        return oldPixel.type == PixelType::RELAY ? oldPixel.index[0] : -1;
+    };
+
+    // old relay pixels whose relays get rebuilt or were erased, and the ones that are kept (with the same index) by rebuilt relays
+    std::vector<bool> removedRelayPixels(oldNumRelayPixels, false);
+    std::vector<bool> keptRelayPixels(oldNumRelayPixels, false);
+    for (int64_t key : relayKeys) {
+        const int32_t oldIndex = oldRelayPixelAt(pointOf(key));
+        if (oldIndex != -1) {
+            removedRelayPixels[oldIndex] = true;
+            keptRelayPixels[oldIndex] = true;
+        }
+    }
+    for (const ext::heap_matrix<StaticData::DisplayedPixel>& oldPixels : oldEditedPixels) {
+        forEachPoint(ext::point{ 0, 0 }, oldPixels.size(), [&](const ext::point& pt) {
+            if (oldPixels[pt].type == PixelType::RELAY) removedRelayPixels[oldPixels[pt].index[0]] = true;
+        });
+    }
+
+    // the components spawned between removed relays are released too
+    for (int32_t i = 0; i != oldNumRelayPixels; ++i) {
+        if (!removedRelayPixels[i]) continue;
+        const RelayPixel& relayPixel = staticData.relayPixels[i];
+        for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+            if (staticData.relayLinkComponents[staticData.adjRelayPixelList[j]]) releasedComponents[staticData.adjRelayPixelList[j]] = true;
+        }
+    }
+
+    // === allocate indices, reusing the released ones first ===
+    std::vector<int32_t> freeComponents = std::move(staticData.freeComponents);
+    for (int32_t i = 0; i != oldNumComponents; ++i) {
+        if (releasedComponents[i]) freeComponents.push_back(i);
+    }
+    std::sort(freeComponents.begin(), freeComponents.end(), std::greater<int32_t>());
+    std::vector<int32_t> freeRelayPixels = std::move(staticData.freeRelayPixels);
+    for (int32_t i = 0; i != oldNumRelayPixels; ++i) {
+        if (removedRelayPixels[i] && !keptRelayPixels[i]) freeRelayPixels.push_back(i);
+    }
+    std::sort(freeRelayPixels.begin(), freeRelayPixels.end(), std::greater<int32_t>());
+
+    int32_t numComponents = oldNumComponents;
+    int32_t numRelayPixels = oldNumRelayPixels;
+    // data about new components: their indices, adjacent relay pixels, and whether they are spawned between relays
+    std::vector<int32_t> newComponentIndices;
+    std::vector<std::vector<int32_t>> newComponentAdjRelayPixels;
+    std::vector<bool> newComponentRelayLinks;
+    // the position of each component in the above vectors, or -1 for components that are not new
+    std::vector<int32_t> newComponentOf(oldNumComponents, -1);
+    auto allocateComponent = [&](bool relayLink) {
+        int32_t index;
+        if (!freeComponents.empty()) {
+            index = freeComponents.back();
+            freeComponents.pop_back();
+        }
+        else {
+            index = numComponents++;
+            newComponentOf.push_back(-1);
+        }
+        newComponentOf[index] = static_cast<int32_t>(newComponentIndices.size());
+        newComponentIndices.push_back(index);
+        newComponentAdjRelayPixels.emplace_back();
+        newComponentRelayLinks.push_back(relayLink);
+        return index;
+    };
+    auto allocateRelayPixel = [&]() {
+        if (!freeRelayPixels.empty()) {
+            int32_t index = freeRelayPixels.back();
+            freeRelayPixels.pop_back();
+            return index;
+        }
+        return numRelayPixels++;
+    };
+
+    for (int32_t i = 0; i != numFloodedComponents; ++i) {
+        allocateComponent(false);
+    }
+    for (const auto& [pt, dir] : floodedPixels) {
+        int32_t& index = staticData.pixels[pt].index[dir];
+        index = (index == VISITED_USELESS) ? -1 : newComponentIndices[-3 - index];
+    }
+
+    // === rebuild the relays ===
+    std::vector<CompilerRelayPixel> rebuiltRelayPixels(relayKeys.size());
+    for (int64_t key : relayKeys) {
+        const ext::point pt = pointOf(key);
+        const int32_t oldIndex = oldRelayPixelAt(pt);
+        staticData.pixels[pt].index[0] = staticData.pixels[pt].index[1] = (oldIndex != -1 ? oldIndex : allocateRelayPixel());
+    }
+    CompilerRelays newRelays;
+    for (size_t i = 0; i != relayKeys.size(); ++i) {
+        const ext::point pt = pointOf(relayKeys[i]);
+        const int32_t outputRelayPixelIndex = staticData.pixels[pt].index[0];
+        CompilerRelayPixel& relayPixel = rebuiltRelayPixels[i];
+        CompilerInputs inputComponents;
+        directions_t::for_each([&](auto direction_tag_t, auto) {
+            ext::point newPt = pt;
+            int32_t dir = (decltype(direction_tag_t)::type::second != 0);
+            newPt.x += decltype(direction_tag_t)::type::first;
+            newPt.y += decltype(direction_tag_t)::type::second;
+            if (gameState.contains(newPt)) {
+                auto& element = gameState[newPt];
+                if (isSignal(element)) {
+                    inputComponents.emplace_back(staticData.pixels[newPt].index[0]);
+                }
+                else if (isFloodfillableElement(element)) {
+                    const int32_t componentIndex = staticData.pixels[newPt].index[dir];
+                    assert(componentIndex >= 0 && componentIndex < numComponents);
+                    relayPixel.adjComponents[relayPixel.numAdjComponents++] = componentIndex;
+                    // components that are not new already know about this relay pixel
+                    if (newComponentOf[componentIndex] != -1) {
+                        newComponentAdjRelayPixels[newComponentOf[componentIndex]].emplace_back(outputRelayPixelIndex);
+                    }
+                }
+                else if (isRelayElement(element)) {
+                    // spawn a new component between two adjacent relays, if the other relay is already processed
+                    const int64_t otherKey = keyOf(newPt);
+                    if (otherKey < relayKeys[i]) {
+                        const size_t otherPos = std::lower_bound(relayKeys.begin(), relayKeys.end(), otherKey) - relayKeys.begin();
+                        assert(otherPos < relayKeys.size() && relayKeys[otherPos] == otherKey);
+                        const int32_t componentIndex = allocateComponent(true);
+                        auto& newAdjRelayPixels = newComponentAdjRelayPixels.back();
+                        newAdjRelayPixels.emplace_back(outputRelayPixelIndex);
+                        relayPixel.adjComponents[relayPixel.numAdjComponents++] = componentIndex;
+                        newAdjRelayPixels.emplace_back(staticData.pixels[newPt].index[0]);
+                        CompilerRelayPixel& otherRelayPixel = rebuiltRelayPixels[otherPos];
+                        otherRelayPixel.adjComponents[otherRelayPixel.numAdjComponents++] = componentIndex;
+                    }
+                }
+            }
+        });
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_base_of_v<Relay, ElementType>) {
+                newRelays.emplace<ElementType>(inputComponents, outputRelayPixelIndex);
+            }
+        }, gameState[pt]);
+    }
+
+    // === rebuild the gates and sources ===
+    CompilerGates newGates;
+    for (int64_t key : gateKeys) {
+        const ext::point pt = pointOf(key);
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_base_of_v<LogicGate, ElementType>) {
+                int32_t outputComponent = staticData.pixels[pt].index[0];
+                assert(outputComponent >= 0 && outputComponent < numComponents);
+                CompilerInputs inputComponents;
+                directions_t::for_each([&](auto direction_tag_t, auto) {
+                    ext::point newPt = pt;
+                    newPt.x += decltype(direction_tag_t)::type::first;
+                    newPt.y += decltype(direction_tag_t)::type::second;
+                    if (gameState.contains(newPt) && isSignal(gameState[newPt])) {
+                        inputComponents.emplace_back(staticData.pixels[newPt].index[0]);
+                    }
+                });
+                newGates.emplace<ElementType>(inputComponents, outputComponent);
+            }
+        }, gameState[pt]);
+    }
+    auto isReleased = [&](int32_t index) {
+        return index < oldNumComponents && releasedComponents[index];
+    };
+    {
+        std::vector<SimulatorSource> sources;
+        std::copy_if(staticData.sources.begin(), staticData.sources.end(), std::back_inserter(sources), [&](const SimulatorSource& source) {
+            return !isReleased(source.outputComponent);
+        });
+        for (int64_t key : floodedKeys) {
+            const ext::point pt = pointOf(key);
+            if (std::holds_alternative<Source>(gameState[pt])) {
+                sources.push_back(SimulatorSource{ staticData.pixels[pt].index[0] });
+            }
+        }
+        staticData.sources.update(std::move(sources));
+    }
+    newGates.forEachGate(staticData.logicGates, [&](auto& gate, const auto& compilerGate) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            auto& gates = std::get<Index>(gate.data);
+            using GateType = std::decay_t<decltype(*gates.begin())>;
+            // keep the gates that don't touch any released component
+            std::vector<GateType> newData;
+            std::copy_if(gates.begin(), gates.end(), std::back_inserter(newData), [&](const GateType& g) {
+                return !isReleased(g.outputComponent) && std::none_of(g.inputComponents.begin(), g.inputComponents.end(), isReleased);
+            });
+            const auto& added = std::get<Index>(compilerGate.data);
+            newData.insert(newData.end(), added.begin(), added.end());
+            std::sort(newData.begin(), newData.end(), [](const auto& a, const auto& b) {
+                return a.outputComponent < b.outputComponent;
+            });
+            gates.update(std::move(newData));
+            std::get<Index>(gate.columns).update(gates);
+        });
+    });
+    newRelays.forEachRelay(staticData.relays, [&](auto& relay, const auto& compilerRelay) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            auto& relays = std::get<Index>(relay.data);
+            using RelayType = std::decay_t<decltype(*relays.begin())>;
+            std::vector<RelayType> newData;
+            std::copy_if(relays.begin(), relays.end(), std::back_inserter(newData), [&](const RelayType& r) {
+                return !removedRelayPixels[r.outputRelayPixel];
+            });
+            const auto& added = std::get<Index>(compilerRelay.data);
+            newData.insert(newData.end(), added.begin(), added.end());
+            std::sort(newData.begin(), newData.end(), [](const auto& a, const auto& b) {
+                return a.outputRelayPixel < b.outputRelayPixel;
+            });
+            relays.update(std::move(newData));
+        });
+    });
+
+    // === splice the components and relay pixels ===
+    {
+        std::vector<int32_t> rebuiltRelayPixelOf(numRelayPixels, -1);
+        for (size_t i = 0; i != relayKeys.size(); ++i) {
+            rebuiltRelayPixelOf[staticData.pixels[pointOf(relayKeys[i])].index[0]] = static_cast<int32_t>(i);
+        }
+        std::vector<int32_t> adjRelayPixelList;
+        adjRelayPixelList.reserve(staticData.adjRelayPixelList.size);
+        std::vector<RelayPixel> relayPixels(numRelayPixels);
+        for (int32_t i = 0; i != numRelayPixels; ++i) {
+            relayPixels[i].adjComponentsBegin = static_cast<int32_t>(adjRelayPixelList.size());
+            if (rebuiltRelayPixelOf[i] != -1) {
+                const CompilerRelayPixel& rebuilt = rebuiltRelayPixels[rebuiltRelayPixelOf[i]];
+                adjRelayPixelList.insert(adjRelayPixelList.end(), rebuilt.adjComponents.begin(), rebuilt.adjComponents.begin() + rebuilt.numAdjComponents);
+            }
+            else if (i < oldNumRelayPixels && !removedRelayPixels[i]) {
+                const RelayPixel& oldRelayPixel = staticData.relayPixels[i];
+                adjRelayPixelList.insert(adjRelayPixelList.end(), staticData.adjRelayPixelList.begin() + oldRelayPixel.adjComponentsBegin, staticData.adjRelayPixelList.begin() + oldRelayPixel.adjComponentsEnd);
+            }
+            // (otherwise it is an unused relay pixel)
+            relayPixels[i].adjComponentsEnd = static_cast<int32_t>(adjRelayPixelList.size());
+        }
+        staticData.relayPixels.update(std::move(relayPixels));
+        staticData.adjRelayPixelList.update(std::move(adjRelayPixelList));
+    }
+    {
+        std::vector<int32_t> adjComponentList;
+        adjComponentList.reserve(staticData.adjComponentList.size);
+        std::vector<Component> components(numComponents);
+        staticData.relayLinkComponents.resize(numComponents);
+        for (int32_t i = 0; i != numComponents; ++i) {
+            components[i].adjRelayPixelsBegin = static_cast<int32_t>(adjComponentList.size());
+            if (newComponentOf[i] != -1) {
+                const auto& adjRelayPixels = newComponentAdjRelayPixels[newComponentOf[i]];
+                adjComponentList.insert(adjComponentList.end(), adjRelayPixels.begin(), adjRelayPixels.end());
+                staticData.relayLinkComponents[i] = newComponentRelayLinks[newComponentOf[i]];
+            }
+            else if (isReleased(i)) {
+                // unused component
+                staticData.relayLinkComponents[i] = false;
+            }
+            else {
+                const Component& oldComponent = staticData.components[i];
+                adjComponentList.insert(adjComponentList.end(), staticData.adjComponentList.begin() + oldComponent.adjRelayPixelsBegin, staticData.adjComponentList.begin() + oldComponent.adjRelayPixelsEnd);
+            }
+            components[i].adjRelayPixelsEnd = static_cast<int32_t>(adjComponentList.size());
+        }
+        staticData.components.update(std::move(components));
+        staticData.adjComponentList.update(std::move(adjComponentList));
+    }
+    staticData.freeComponents = std::move(freeComponents);
+    staticData.freeRelayPixels = std::move(freeRelayPixels);
+
+    screenInputQueue.clear();
+
+    prepareEngines();
+
+    // === dynamic state ===
+    // like compile(), components start from the levels of the sources, gates and communicators in them
+    // the elements in untouched components take their levels from the previous state (which is what the canvas shows), and the other elements are read from the canvas
+    const std::shared_ptr<DynamicData> oldStatePtr = latestCompleteState;
+    const DynamicData& oldState = *oldStatePtr;
+    const std::shared_ptr<DynamicData>& dynamicDataPtr = resetDynamicDataPool(numComponents, numRelayPixels, staticData.communicators.size);
+    DynamicData& dynamicData = *dynamicDataPtr;
+    auto copyOldLevel = [&](int32_t index) {
+        if (index < oldNumComponents && !releasedComponents[index] && oldState.componentLogicLevels[index]) dynamicData.componentLogicLevels.set(index);
+    };
+    for (const SimulatorSource& source : staticData.sources) {
+        if (!isReleased(source.outputComponent)) dynamicData.componentLogicLevels.set(source.outputComponent);
+    }
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                copyOldLevel(gate.outputComponent);
+            }
+        });
+    });
+    for (const SimulatorCommunicator& comm : staticData.communicators) {
+        copyOldLevel(comm.outputComponent);
+    }
+    for (int32_t i = 0; i != oldNumRelayPixels; ++i) {
+        if (!removedRelayPixels[i] && oldState.relayPixelIsConductive[i]) dynamicData.relayPixelIsConductive.set(i);
+    }
+    dynamicData.communicatorTransmitStates.assign(oldState.communicatorTransmitStates);
+    for (int64_t key : floodedKeys) {
+        const ext::point pt = pointOf(key);
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_same_v<Source, ElementType>) {
+                dynamicData.componentLogicLevels.set(staticData.pixels[pt].index[0]);
+            }
+            if constexpr (std::is_base_of_v<LogicLevelElement, ElementType>) {
+                if (element.logicLevel && staticData.pixels[pt].index[0] != -1) {
+                    dynamicData.componentLogicLevels.set(staticData.pixels[pt].index[0]);
+                }
+            }
+        }, gameState[pt]);
+    }
+    for (int64_t key : relayKeys) {
+        const ext::point pt = pointOf(key);
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_base_of_v<Relay, ElementType>) {
+                if (element.conductiveState) dynamicData.relayPixelIsConductive.set(staticData.pixels[pt].index[0]);
+            }
+        }, gameState[pt]);
+    }
+
+    // flood fill to ensure that the current state is a valid simulation state
+    propagate(dynamicData);
+
+    foldConstants(dynamicData);
+
+    setLatestCompleteState(dynamicDataPtr);
+
+    // take a snapshot (with the immediate propagation done)
+    takeSnapshot(gameState);
+
+    return true;
+}
+
+
+void Simulator::prepareEngines() {
+    computePartitions();
+    eventDrivenData.valid = false;
+    groupedFloodFillData.valid = false;
+    staticData.displayBoundsValid = false;
+    nativeStep = nullptr;
+    ++compileGeneration;
+    // the viewports hold on to states of the old static data
+    latestViewport.clear();
+    viewportPool.clear();
+    remoteNodes = nullptr;
+    floodFillWorklist = std::make_unique<int32_t[]>(staticData.components.size + staticData.relayPixels.size);
+    floodFillPeakDepth.store(0, std::memory_order_relaxed);
+    floodFillMaxPeakDepth.store(0, std::memory_order_relaxed);
+    componentActivity = std::make_unique<std::atomic<uint32_t>[]>(staticData.components.size);
+    relayPixelActivity = std::make_unique<std::atomic<uint32_t>[]>(staticData.relayPixels.size);
+    // the recorded probes refer to the old static data, so the recording restarts from the first state of the new one
+    recordedProbePixels.clear();
+    probeChangeBuffer.clear();
+    resolveProbes();
+    armedBreakpoints.clear();
+    resolveBreakpoints();
+}
+
+void Simulator::foldConstants(const DynamicData& initialState) {
+    assert(!staticData.constantsFolded);
+    const int32_t numComponents = staticData.components.size;
+
+    // the gates and relays, numbered in the order of forEach() (like in initEventDriven())
+    struct FoldElement {
+        int32_t target; // the output component of a gate, or the output relay pixel of a relay
+        int32_t numVariableInputs; // number of inputs that are not known to be constant yet
+        bool conjunctive, inverted, relay;
+        bool anyInputHigh = false, allInputsHigh = true; // over the inputs that are known to be constant
+        bool folded = false, high = false; // whether all the inputs are constant, and the resulting output
+    };
+    std::vector<FoldElement> elements;
+    std::vector<int32_t> fanoutBegin(numComponents + 1, 0);
+    const auto addElement = [&](const auto& element, int32_t target, bool relay) {
+        using ElementType = std::decay_t<decltype(element)>;
+        elements.push_back(FoldElement{ target, static_cast<int32_t>(element.inputComponents.size()), ElementType::conjunctive, ElementType::inverted, relay });
+        for (int32_t inputComponent : element.inputComponents) {
+            ++fanoutBegin[inputComponent + 1];
+        }
+    };
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                addElement(gate, gate.outputComponent, false);
+            }
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& relay : y) {
+                addElement(relay, relay.outputRelayPixel, true);
+            }
+        });
+    });
+    std::partial_sum(fanoutBegin.begin(), fanoutBegin.end(), fanoutBegin.begin());
+    std::vector<int32_t> fanout(fanoutBegin[numComponents]);
+    {
+        std::vector<int32_t> fanoutEnd(fanoutBegin.begin(), fanoutBegin.end() - 1);
+        int32_t elementIndex = 0;
+        const auto fillFanout = [&](const auto& x) {
+            x.forEach([&](const auto& y) {
+                for (const auto& element : y) {
+                    for (int32_t inputComponent : element.inputComponents) {
+                        fanout[fanoutEnd[inputComponent]++] = elementIndex;
+                    }
+                    ++elementIndex;
+                }
+            });
+        };
+        staticData.logicGates.forEach(fillFanout);
+        staticData.relays.forEach(fillFanout);
+    }
+
+    // number of things that might make each component high: sources, communicators and gates that are not known to be constantly low,
+    // and relay pixels next to it that are not known to be constantly non-conductive
+    std::vector<int32_t> numHighReasons(numComponents, 0);
+    std::vector<bool> hasSource(numComponents, false);
+    for (const SimulatorSource& source : staticData.sources) {
+        hasSource[source.outputComponent] = true;
+        ++numHighReasons[source.outputComponent];
+    }
+    for (const SimulatorCommunicator& comm : staticData.communicators) {
+        ++numHighReasons[comm.outputComponent];
+    }
+    for (const FoldElement& element : elements) {
+        if (!element.relay) ++numHighReasons[element.target];
+    }
+    for (int32_t adjComponent : staticData.adjRelayPixelList) {
+        ++numHighReasons[adjComponent];
+    }
+
+    // the logic level of each component that is constant from the initial state onwards, or -1 if it might change
+    std::vector<int8_t> constantLevels(numComponents, -1);
+    std::vector<int32_t> worklist;
+    const auto setConstant = [&](int32_t component, bool level) {
+        // it is only constant if it is already at that level
+        if (constantLevels[component] == -1 && initialState.componentLogicLevels[component] == level) {
+            constantLevels[component] = level;
+            worklist.push_back(component);
+        }
+    };
+    const auto removeHighReason = [&](int32_t component) {
+        if (--numHighReasons[component] == 0) setConstant(component, false);
+    };
+    // the inputs of this element are constant, so its output is constant after the first step
+    const auto foldElement = [&](FoldElement& element) {
+        element.folded = true;
+        element.high = (element.conjunctive ? element.allInputsHigh : element.anyInputHigh) != element.inverted;
+        if (element.relay) {
+            if (!element.high) {
+                const RelayPixel& relayPixel = staticData.relayPixels[element.target];
+                for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+                    removeHighReason(staticData.adjRelayPixelList[j]);
+                }
+            }
+        }
+        else if (element.high) {
+            setConstant(element.target, true);
+        }
+        else {
+            removeHighReason(element.target);
+        }
+    };
+    for (int32_t i = 0; i != numComponents; ++i) {
+        if (hasSource[i]) setConstant(i, true);
+        else if (numHighReasons[i] == 0) setConstant(i, false);
+    }
+    for (FoldElement& element : elements) {
+        if (element.numVariableInputs == 0) foldElement(element);
+    }
+    while (!worklist.empty()) {
+        const int32_t component = worklist.back();
+        worklist.pop_back();
+        const bool level = constantLevels[component];
+        for (int32_t j = fanoutBegin[component]; j != fanoutBegin[component + 1]; ++j) {
+            FoldElement& element = elements[fanout[j]];
+            element.anyInputHigh |= level;
+            element.allInputsHigh &= level;
+            if (--element.numVariableInputs == 0) foldElement(element);
+        }
+    }
+
+    // take out the folded gates and relays (in the same order as they were numbered), keeping the rest sorted by output
+    // the gates that drive a constantly high component are taken out too, since the component is high regardless of them
+    std::vector<bool> needsSource(numComponents, false);
+    int32_t elementIndex = 0;
+    const auto foldPack = [&](auto& pack, auto& foldedPack, auto isFolded) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            auto& data = std::get<Index>(pack.data);
+            using ElementType = std::decay_t<decltype(*data.begin())>;
+            std::vector<ElementType> kept;
+            std::vector<ElementType> folded;
+            for (const ElementType& element : data) {
+                (isFolded(elements[elementIndex++]) ? folded : kept).push_back(element);
+            }
+            if (!folded.empty()) {
+                data.update(std::move(kept));
+                std::get<Index>(foldedPack.data).update(std::move(folded));
+            }
+        });
+    };
+    const auto isFoldedGate = [&](const FoldElement& element) {
+        if (element.folded && element.high && !hasSource[element.target]) needsSource[element.target] = true;
+        return element.folded || constantLevels[element.target] == 1;
+    };
+    const auto isFoldedRelay = [&](const FoldElement& element) {
+        // Note: constantly conductive relays are kept, because there is no element that is conductive without inputs
+        return element.folded && !element.high;
+    };
+    foldPack(staticData.logicGates.andGate, staticData.foldedGates.andGate, isFoldedGate);
+    foldPack(staticData.logicGates.orGate, staticData.foldedGates.orGate, isFoldedGate);
+    foldPack(staticData.logicGates.nandGate, staticData.foldedGates.nandGate, isFoldedGate);
+    foldPack(staticData.logicGates.norGate, staticData.foldedGates.norGate, isFoldedGate);
+    foldPack(staticData.relays.positiveRelay, staticData.foldedRelays.positiveRelay, isFoldedRelay);
+    foldPack(staticData.relays.negativeRelay, staticData.foldedRelays.negativeRelay, isFoldedRelay);
+    assert(elementIndex == static_cast<int32_t>(elements.size()));
+    const auto updateColumns = [&](auto& pack) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            std::get<Index>(pack.columns).update(std::get<Index>(pack.data));
+        });
+    };
+    updateColumns(staticData.logicGates.andGate);
+    updateColumns(staticData.logicGates.orGate);
+    updateColumns(staticData.logicGates.nandGate);
+    updateColumns(staticData.logicGates.norGate);
+
+    // the constantly high gates are replaced by sources
+    std::vector<SimulatorSource> sources(staticData.sources.begin(), staticData.sources.end());
+    for (int32_t i = 0; i != numComponents; ++i) {
+        if (needsSource[i]) sources.push_back(SimulatorSource{ i });
+    }
+    staticData.numFoldedSources = static_cast<int32_t>(sources.size() - staticData.sources.size);
+    staticData.sources.update(std::move(sources));
+    staticData.constantsFolded = true;
+
+    computePartitions();
+    eventDrivenData.valid = false;
+    nativeStep = nullptr;
+}
+
+
+void Simulator::unfoldConstants() {
+    if (!staticData.constantsFolded) return;
+
+    staticData.sources.update(std::vector<SimulatorSource>(staticData.sources.begin(), staticData.sources.end() - staticData.numFoldedSources));
+    staticData.numFoldedSources = 0;
+
+    const auto unfoldPack = [&](auto& pack, auto& foldedPack, auto outputOf) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            auto& data = std::get<Index>(pack.data);
+            auto& folded = std::get<Index>(foldedPack.data);
+            if (folded.size == 0) return;
+            using ElementType = std::decay_t<decltype(*data.begin())>;
+            std::vector<ElementType> merged(data.begin(), data.end());
+            merged.insert(merged.end(), folded.begin(), folded.end());
+            std::sort(merged.begin(), merged.end(), [&](const auto& a, const auto& b) {
+                return outputOf(a) < outputOf(b);
+            });
+            data.update(std::move(merged));
+            folded.resize(0);
+        });
+    };
+    const auto outputComponentOf = [](const auto& gate) {
+        return gate.outputComponent;
+    };
+    const auto outputRelayPixelOf = [](const auto& relay) {
+        return relay.outputRelayPixel;
+    };
+    unfoldPack(staticData.logicGates.andGate, staticData.foldedGates.andGate, outputComponentOf);
+    unfoldPack(staticData.logicGates.orGate, staticData.foldedGates.orGate, outputComponentOf);
+    unfoldPack(staticData.logicGates.nandGate, staticData.foldedGates.nandGate, outputComponentOf);
+    unfoldPack(staticData.logicGates.norGate, staticData.foldedGates.norGate, outputComponentOf);
+    unfoldPack(staticData.relays.positiveRelay, staticData.foldedRelays.positiveRelay, outputRelayPixelOf);
+    unfoldPack(staticData.relays.negativeRelay, staticData.foldedRelays.negativeRelay, outputRelayPixelOf);
+    const auto updateColumns = [&](auto& pack) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            std::get<Index>(pack.columns).update(std::get<Index>(pack.data));
+        });
+    };
+    updateColumns(staticData.logicGates.andGate);
+    updateColumns(staticData.logicGates.orGate);
+    updateColumns(staticData.logicGates.nandGate);
+    updateColumns(staticData.logicGates.norGate);
+    staticData.constantsFolded = false;
+
+    computePartitions();
+    eventDrivenData.valid = false;
+    nativeStep = nullptr;
+}
+
+
+void Simulator::renumberForLocality(CompilerStaticData& compilerStaticData) {
+    const int32_t numComponents = static_cast<int32_t>(compilerStaticData.components.size());
+    const int32_t numRelayPixels = static_cast<int32_t>(compilerStaticData.relayPixels.size());
+    const int32_t numNodes = numComponents + numRelayPixels;
+    if (numNodes == 0) return;
+
+    // build the undirected netlist graph in compressed sparse row form
+    // nodes [0, numComponents) are components, and node numComponents + i is relay pixel i
+    // duplicate edges are harmless
+    std::vector<int32_t> edgesBegin(numNodes + 1, 0);
+    std::vector<int32_t> edges;
+    auto forEachEdge = [&](auto callback) {
+        compilerStaticData.logicGates.forEach([&](const auto& gates) {
+            for (const auto& gate : gates) {
+                for (int32_t input : gate.inputComponents) callback(input, gate.outputComponent);
+            }
+        });
+        compilerStaticData.relays.forEach([&](const auto& relays) {
+            for (const auto& relay : relays) {
+                for (int32_t input : relay.inputComponents) callback(input, numComponents + relay.outputRelayPixel);
+            }
+        });
+        for (int32_t i = 0; i != numRelayPixels; ++i) {
+            const CompilerRelayPixel& relayPixel = compilerStaticData.relayPixels[i];
+            for (uint8_t j = 0; j != relayPixel.numAdjComponents; ++j) callback(relayPixel.adjComponents[j], numComponents + i);
+        }
+        for (const CompilerCommunicator& comm : compilerStaticData.communicators) {
+            for (int32_t input : comm.inputComponents) callback(input, comm.outputComponent);
+        }
+    };
+    forEachEdge([&](int32_t a, int32_t b) {
+        ++edgesBegin[a + 1];
+        ++edgesBegin[b + 1];
+    });
+    std::partial_sum(edgesBegin.begin(), edgesBegin.end(), edgesBegin.begin());
+    edges.resize(edgesBegin.back());
+    {
+        std::vector<int32_t> edgesEnd(edgesBegin.begin(), edgesBegin.end() - 1);
+        forEachEdge([&](int32_t a, int32_t b) {
+            edges[edgesEnd[a]++] = b;
+            edges[edgesEnd[b]++] = a;
+        });
+    }
+    auto degree = [&](int32_t node) {
+        return edgesBegin[node + 1] - edgesBegin[node];
+    };
+
+    // visit the nodes breadth-first, starting each connected part of the graph from a node of lowest degree and visiting neighbours in increasing order of degree
+    std::vector<int32_t> startOrder(numNodes);
+    std::iota(startOrder.begin(), startOrder.end(), 0);
+    std::stable_sort(startOrder.begin(), startOrder.end(), [&](int32_t a, int32_t b) {
+        return degree(a) < degree(b);
+    });
+    std::vector<bool> visited(numNodes, false);
+    std::vector<int32_t> order; // doubles as the queue
+    order.reserve(numNodes);
+    for (int32_t start : startOrder) {
+        if (visited[start]) continue;
+        size_t head = order.size();
+        visited[start] = true;
+        order.push_back(start);
+        for (; head != order.size(); ++head) {
+            const int32_t node = order[head];
+            const size_t firstNeighbour = order.size();
+            for (int32_t i = edgesBegin[node]; i != edgesBegin[node + 1]; ++i) {
+                if (!visited[edges[i]]) {
+                    visited[edges[i]] = true;
+                    order.push_back(edges[i]);
+                }
+            }
+            std::stable_sort(order.begin() + firstNeighbour, order.end(), [&](int32_t a, int32_t b) {
+                return degree(a) < degree(b);
+            });
+        }
+    }
+
+    // new index of each component and relay pixel, in order of visiting (components and relay pixels are numbered separately)
+    std::vector<int32_t> componentMap(numComponents);
+    std::vector<int32_t> relayPixelMap(numRelayPixels);
+    {
+        int32_t nextComponent = 0, nextRelayPixel = 0;
+        for (int32_t node : order) {
+            if (node < numComponents) componentMap[node] = nextComponent++;
+            else relayPixelMap[node - numComponents] = nextRelayPixel++;
+        }
+    }
+
+    // apply the new numbering to everything that refers to components or relay pixels
+    for (SimulatorSource& source : compilerStaticData.sources) {
+        source.outputComponent = componentMap[source.outputComponent];
+    }
+    compilerStaticData.logicGates.forEach([&](auto& gates) {
+        for (auto& gate : gates) {
+            for (int32_t& input : gate.inputComponents) input = componentMap[input];
+            gate.outputComponent = componentMap[gate.outputComponent];
+        }
+    });
+    compilerStaticData.relays.forEach([&](auto& relays) {
+        for (auto& relay : relays) {
+            for (int32_t& input : relay.inputComponents) input = componentMap[input];
+            relay.outputRelayPixel = relayPixelMap[relay.outputRelayPixel];
+        }
+    });
+    for (CompilerCommunicator& comm : compilerStaticData.communicators) {
+        for (int32_t& input : comm.inputComponents) input = componentMap[input];
+        // keep the input components sorted
+        std::sort(comm.inputComponents.begin(), comm.inputComponents.end());
+        comm.outputComponent = componentMap[comm.outputComponent];
+    }
+    {
+        std::vector<CompilerComponent> components(numComponents);
+        std::vector<int32_t> adjRelayPixelsBegin(numComponents + 1, 0);
+        for (int32_t i = 0; i != numComponents; ++i) {
+            components[componentMap[i]] = compilerStaticData.components[i];
+            adjRelayPixelsBegin[componentMap[i] + 1] = compilerStaticData.adjRelayPixelsBegin[i + 1] - compilerStaticData.adjRelayPixelsBegin[i];
+        }
+        std::partial_sum(adjRelayPixelsBegin.begin(), adjRelayPixelsBegin.end(), adjRelayPixelsBegin.begin());
+        std::vector<int32_t> adjRelayPixelList(adjRelayPixelsBegin.back());
+        for (int32_t i = 0; i != numComponents; ++i) {
+            std::transform(compilerStaticData.adjRelayPixelList.begin() + compilerStaticData.adjRelayPixelsBegin[i], compilerStaticData.adjRelayPixelList.begin() + compilerStaticData.adjRelayPixelsBegin[i + 1], adjRelayPixelList.begin() + adjRelayPixelsBegin[componentMap[i]], [&](int32_t relayPixel) {
+                return relayPixelMap[relayPixel];
+            });
+        }
+        compilerStaticData.components = std::move(components);
+        compilerStaticData.adjRelayPixelsBegin = std::move(adjRelayPixelsBegin);
+        compilerStaticData.adjRelayPixelList = std::move(adjRelayPixelList);
+    }
+    {
+        std::vector<CompilerRelayPixel> relayPixels(numRelayPixels);
+        for (int32_t i = 0; i != numRelayPixels; ++i) {
+            CompilerRelayPixel& relayPixel = relayPixels[relayPixelMap[i]];
+            relayPixel = compilerStaticData.relayPixels[i];
+            for (uint8_t j = 0; j != relayPixel.numAdjComponents; ++j) relayPixel.adjComponents[j] = componentMap[relayPixel.adjComponents[j]];
+        }
+        compilerStaticData.relayPixels = std::move(relayPixels);
+    }
+    for (int32_t y = 0; y != compilerStaticData.pixels.height(); ++y) {
+        for (int32_t x = 0; x != compilerStaticData.pixels.width(); ++x) {
+            StaticData::DisplayedPixel& pixel = compilerStaticData.pixels[{ x, y }];
+            for (int32_t& index : pixel.index) {
+                if (index == -1) continue;
+                if (pixel.type == StaticData::DisplayedPixel::PixelType::RELAY) index = relayPixelMap[index];
+                else index = componentMap[index];
+            }
+        }
+    }
+}
+
+void Simulator::reset(CanvasState& gameState) {
+    // Reset the transient state to the starting state
+    // empty tiles only hold std::monostate, so they can be skipped
+    gameState.dataMatrix.for_each([&](const ext::point&, CanvasState::element_variant_t& element) {
+        resetLogicLevel(element);
+    });
+
+    // compile
+    compile(gameState);
+
+    // reset the communicators
+    for (auto& simComm : staticData.communicators) {
+        simComm.communicator->reset();
+    }
+}
+
+
+void Simulator::installRestoredState(const std::shared_ptr<DynamicData>& dynamicDataPtr, CanvasState& gameState) {
+    // the components between two adjacent relays have no pixels, so their levels are propagated again
+    propagate(*dynamicDataPtr);
+
+    foldConstants(*dynamicDataPtr);
+
+    // the viewport was computed from the old state
+    latestViewport.clear();
+    setLatestCompleteState(dynamicDataPtr);
+
+    takeSnapshot(gameState);
+}
+
+
+void Simulator::applySimThreadScheduling() const {
+    // failures are ignored, since the simulation is still correct without them
+#if defined(_WIN32)
+    if (simThreadCore >= 0 && simThreadCore < static_cast<int32_t>(sizeof(DWORD_PTR) * 8)) {
+        SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << simThreadCore);
+    }
+    if (simThreadHighPriority) {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+    }
+#elif defined(__linux__)
+    if (simThreadCore >= 0 && simThreadCore < CPU_SETSIZE) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(simThreadCore, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    if (simThreadHighPriority) {
+        // Linux gives each thread its own nice value (a real-time policy could starve the UI when the simulation runs as fast as possible)
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), -10);
+    }
+#elif defined(__APPLE__)
+    // macOS does not let threads be pinned to a core
+    if (simThreadHighPriority) {
+        pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+    }
+#endif
+}
+
+
+void Simulator::start() {
+    // Unset the 'stopping' flag
+    // note:  // std::memory_order_relaxed, because when starting the thread, the std::thread constructor automatically does synchronization.
+    simStopping.store(false, std::memory_order_relaxed);
+
+    // the last viewport is from before the simulator was stopped, so it might be older than latestCompleteState
+    latestViewport.clear();
+
+    // start recording new probes from the current state, rather than from the first state published by the simulator thread
+    flushProbes(*latestCompleteState);
+    breakpointReachedFlag.store(false, std::memory_order_relaxed);
+
+    runStartTime = std::chrono::steady_clock::now();
+    runStartStepNumber = stepNumber.load(std::memory_order_relaxed);
+
+    // Spawn the simulator thread
+    simThread = std::thread([this]() {
+        CIRCUIT_SANDBOX_TRACE_THREAD("simulator");
+        applySimThreadScheduling();
+        run();
+    });
+}
+
+
+void Simulator::stop() {
+    // Set the 'stopping' flag, and flush it so that the simulation thread can see it
+    {
+        std::lock_guard<std::mutex> lock(simSleepMutex);
+        simStopping.store(true, std::memory_order_relaxed);
+    }
+    simSleepCV.notify_one();
+
+    // measure the rate of this run while running() is still true (the thread calculates at most one more step)
+    if (!fastForwarding()) lastRunStepRate = getAchievedStepRate();
+
+    // Wait for the simulation thread to be done
+    simThread.join();
+
+    // Free up resources used by the std::thread object by assigning an empty std::thread
+    simThread = std::thread();
+
+    // we are no longer fast-forwarding (if we were)
+    fastForwardTarget = 0;
+}
+
+
+double Simulator::getAchievedStepRate() const {
+    if (!running() || fastForwarding()) return lastRunStepRate;
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - runStartTime;
+    if (elapsed.count() <= 0.0) return 0.0;
+    return static_cast<double>(stepNumber.load(std::memory_order_relaxed) - runStartStepNumber) / elapsed.count();
+}
+
+
+void Simulator::startFastForward(uint64_t numSteps) {
+    fastForwardTarget = numSteps;
+    fastForwardStepsDone.store(0, std::memory_order_relaxed);
+    fastForwardCompleted.store(false, std::memory_order_relaxed);
+
+    // Unset the 'stopping' flag
+    // note:  // std::memory_order_relaxed, because when starting the thread, the std::thread constructor automatically does synchronization.
+    simStopping.store(false, std::memory_order_relaxed);
+
+    flushProbes(*latestCompleteState);
+    breakpointReachedFlag.store(false, std::memory_order_relaxed);
+
+    // Spawn the simulator thread
+    simThread = std::thread([this, numSteps]() {
+        CIRCUIT_SANDBOX_TRACE_THREAD("simulator");
+        applySimThreadScheduling();
+        runFastForward(numSteps);
+    });
+}
+
+
+void Simulator::step() {
+    // this runs the simulator in the main thread, since we want to block until the step is complete.
     // since the simulator is stopped, we can read from latestCompleteState without synchronization.
     const DynamicData& oldState = *latestCompleteState;
-    DynamicData newState(staticData.components.size, staticData.relayPixels.size, staticData.communicators.size);
+    const std::shared_ptr<DynamicData>& newState = acquireDynamicData();
+
+    // calculate the new state
+    calculate(staticData, oldState, *newState);
+    flushStatistics();
+    flushProbes(*newState);
+
+    // save the new state (again without synchronization because simulator thread is not running).
+    setLatestCompleteState(newState);
+}
+
+
+uint64_t Simulator::nativeStepFingerprint() const noexcept {
+    // 64-bit FNV-1a of the layout of the state and the indices of every source, gate and relay, in the order that calculate() visits them
+    uint64_t hash = 0xcbf29ce484222325;
+    const auto combine = [&](uint32_t value) {
+        for (int i = 0; i != 4; ++i) {
+            hash = (hash ^ ((value >> (i * 8)) & 0xFF)) * 0x100000001b3;
+        }
+    };
+    combine(CIRCUIT_SANDBOX_BIT_PACKED_STATE);
+    combine(static_cast<uint32_t>(staticData.components.size));
+    combine(static_cast<uint32_t>(staticData.relayPixels.size));
+    combine(static_cast<uint32_t>(staticData.sources.size));
+    for (const SimulatorSource& source : staticData.sources) {
+        combine(static_cast<uint32_t>(source.outputComponent));
+    }
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            combine(static_cast<uint32_t>(y.size));
+            for (const auto& gate : y) {
+                for (int32_t input : gate.inputComponents) combine(static_cast<uint32_t>(input));
+                combine(static_cast<uint32_t>(gate.outputComponent));
+            }
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            combine(static_cast<uint32_t>(y.size));
+            for (const auto& relay : y) {
+                for (int32_t input : relay.inputComponents) combine(static_cast<uint32_t>(input));
+                combine(static_cast<uint32_t>(relay.outputRelayPixel));
+            }
+        });
+    });
+    return hash;
+}
+
+
+void Simulator::writeNativeStepSource(std::ostream& out) const {
+    // the statements are split into functions of at most this many, since compilers get very slow on huge functions
+    constexpr size_t statementsPerFunction = 4096;
+
+    // expressions that read a bit of the old component levels, and statements that set a bit of the new state
+#if CIRCUIT_SANDBOX_BIT_PACKED_STATE
+    const auto read = [](int32_t index) {
+        return "(o[" + std::to_string(index / 64) + "] >> " + std::to_string(index % 64) + " & 1)";
+    };
+    const auto write = [](const char* array, int32_t index, const std::string& value) {
+        return std::string(array) + "[" + std::to_string(index / 64) + "] |= word_t(" + value + ") << " + std::to_string(index % 64) + ";";
+    };
+    const char* wordType = "uint64_t";
+#else
+    const auto read = [](int32_t index) {
+        return "o[" + std::to_string(index) + "]";
+    };
+    const auto write = [](const char* array, int32_t index, const std::string& value) {
+        return std::string(array) + "[" + std::to_string(index) + "] |= " + value + ";";
+    };
+    const char* wordType = "bool";
+#endif
+
+    std::vector<std::string> statements;
+    for (const SimulatorSource& source : staticData.sources) {
+        statements.push_back(write("n", source.outputComponent, "1"));
+    }
+    // the same as combineInputs(), with the indices as constants
+    const auto combine = [&](const auto& element) {
+        using ElementType = std::decay_t<decltype(element)>;
+        std::string value = ElementType::inverted ? "1 ^ (" : "(";
+        value += ElementType::conjunctive ? "1" : "0";
+        for (int32_t input : element.inputComponents) {
+            value += ElementType::conjunctive ? " & " : " | ";
+            value += read(input);
+        }
+        return value + ")";
+    };
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) statements.push_back(write("n", gate.outputComponent, combine(gate)));
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& relay : y) statements.push_back(write("c", relay.outputRelayPixel, combine(relay)));
+        });
+    });
+
+    out << "// generated by Circuit Sandbox (Simulator::writeNativeStepSource()), for one compiled circuit only\n";
+    out << "#include <cstdint>\n\n";
+    // the two symbols are looked up after the library is loaded (see NativeStepLibrary), so they have to be exported
+    out << "#if defined(_WIN32)\n#define EXPORT __declspec(dllexport)\n#else\n#define EXPORT __attribute__((visibility(\"default\")))\n#endif\n\n";
+    out << "using word_t = " << wordType << ";\n\n";
+    const size_t numFunctions = (statements.size() + statementsPerFunction - 1) / statementsPerFunction;
+    for (size_t i = 0; i != numFunctions; ++i) {
+        out << "static void part" << i << "(const word_t* o, word_t* n, word_t* c) {\n";
+        out << "    (void)o; (void)n; (void)c;\n";
+        for (size_t j = i * statementsPerFunction; j != std::min(statements.size(), (i + 1) * statementsPerFunction); ++j) {
+            out << "    " << statements[j] << '\n';
+        }
+        out << "}\n\n";
+    }
+    out << "extern \"C\" EXPORT const uint64_t circuit_sandbox_native_fingerprint = " << nativeStepFingerprint() << "ull;\n\n";
+    out << "extern \"C\" EXPORT void circuit_sandbox_native_step(const void* oldComponentLogicLevels, void* newComponentLogicLevels, void* newRelayPixelIsConductive) {\n";
+    out << "    const word_t* o = static_cast<const word_t*>(oldComponentLogicLevels);\n";
+    out << "    word_t* n = static_cast<word_t*>(newComponentLogicLevels);\n";
+    out << "    word_t* c = static_cast<word_t*>(newRelayPixelIsConductive);\n";
+    out << "    (void)o; (void)n; (void)c;\n";
+    for (size_t i = 0; i != numFunctions; ++i) {
+        out << "    part" << i << "(o, n, c);\n";
+    }
+    out << "}\n";
+}
+
+
+void Simulator::restrictToNode(const NodeAssignment& assignment, uint32_t node, RemoteNodes* newRemoteNodes) {
+    const auto restrictPack = [&](auto& pack, auto isLocal) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            auto& data = std::get<Index>(pack.data);
+            using ElementType = std::decay_t<decltype(*data.begin())>;
+            std::vector<ElementType> kept;
+            std::copy_if(data.begin(), data.end(), std::back_inserter(kept), isLocal);
+            if (kept.size() != data.size) data.update(std::move(kept));
+        });
+    };
+    const auto isLocalGate = [&](const auto& gate) {
+        return assignment.componentNodes[gate.outputComponent] == node;
+    };
+    const auto isLocalRelay = [&](const auto& relay) {
+        return assignment.relayPixelNodes[relay.outputRelayPixel] == node;
+    };
+    restrictPack(staticData.logicGates.andGate, isLocalGate);
+    restrictPack(staticData.logicGates.orGate, isLocalGate);
+    restrictPack(staticData.logicGates.nandGate, isLocalGate);
+    restrictPack(staticData.logicGates.norGate, isLocalGate);
+    restrictPack(staticData.relays.positiveRelay, isLocalRelay);
+    restrictPack(staticData.relays.negativeRelay, isLocalRelay);
+    const auto updateColumns = [&](auto& pack) {
+        fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            std::get<Index>(pack.columns).update(std::get<Index>(pack.data));
+        });
+    };
+    updateColumns(staticData.logicGates.andGate);
+    updateColumns(staticData.logicGates.orGate);
+    updateColumns(staticData.logicGates.nandGate);
+    updateColumns(staticData.logicGates.norGate);
+
+    // the restricted static data is not the compilation of the canvas, so it must not be reused by the next compilation
+    staticDataKey.reset();
+    prepareEngines();
+    remoteNodes = newRemoteNodes;
+}
+
+
+bool Simulator::setNativeStep(NativeStepFunction function, uint64_t fingerprint) {
+    if (function && fingerprint != nativeStepFingerprint()) return false;
+    nativeStep = function;
+    return true;
+}
+
+
+Simulator::LaneState Simulator::makeLaneState() const {
+    LaneState state;
+    state.componentLogicLevels.resize(staticData.components.size);
+    state.relayPixelLogicLevels.resize(staticData.relayPixels.size);
+    state.relayPixelIsConductive.resize(staticData.relayPixels.size);
+    state.communicatorTransmitStates.resize(staticData.communicators.size);
+    state.worklist.reserve(static_cast<size_t>(staticData.components.size) + staticData.relayPixels.size);
+    state.queued.resize(static_cast<size_t>(staticData.components.size) + staticData.relayPixels.size, false);
+    return state;
+}
+
+
+void Simulator::calculateLanes(const LaneState& oldState, LaneState& newState, const std::vector<lane_t>& receivedLevels) const {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::calculateLanes");
+    assert(receivedLevels.empty() || receivedLevels.size() == static_cast<size_t>(staticData.communicators.size));
+    std::fill(newState.componentLogicLevels.begin(), newState.componentLogicLevels.end(), 0);
+    std::fill(newState.relayPixelLogicLevels.begin(), newState.relayPixelLogicLevels.end(), 0);
+    std::fill(newState.relayPixelIsConductive.begin(), newState.relayPixelIsConductive.end(), 0);
+    std::fill(newState.communicatorTransmitStates.begin(), newState.communicatorTransmitStates.end(), 0);
+
+    // the same as combineInputs(), for all the lanes at once
+    const auto combineLanes = [&](const auto& element) {
+        using ElementType = std::decay_t<decltype(element)>;
+        lane_t result = ElementType::conjunctive ? ~lane_t{ 0 } : lane_t{ 0 };
+        for (int32_t input : element.inputComponents) {
+            if constexpr (ElementType::conjunctive) {
+                result &= oldState.componentLogicLevels[input];
+            }
+            else {
+                result |= oldState.componentLogicLevels[input];
+            }
+        }
+        return ElementType::inverted ? ~result : result;
+    };
+
+    // sources are on in every lane
+    for (const SimulatorSource& source : staticData.sources) {
+        newState.componentLogicLevels[source.outputComponent] = ~lane_t{ 0 };
+    }
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                newState.componentLogicLevels[gate.outputComponent] |= combineLanes(gate);
+            }
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& relay : y) {
+                newState.relayPixelIsConductive[relay.outputRelayPixel] |= combineLanes(relay);
+            }
+        });
+    });
+
+    // each lane transmits and receives on its own (the caller connects them)
+    for (int32_t i = 0; i != staticData.communicators.size; ++i) {
+        const SimulatorCommunicator& communicator = staticData.communicators[i];
+        lane_t transmitOutput = 0;
+        for (int32_t j = communicator.inputComponentsBegin; j != communicator.inputComponentsEnd; ++j) {
+            transmitOutput |= oldState.componentLogicLevels[staticData.communicatorInputList[j]];
+        }
+        newState.communicatorTransmitStates[i] = transmitOutput;
+        if (!receivedLevels.empty()) newState.componentLogicLevels[communicator.outputComponent] |= receivedLevels[i];
+    }
+
+    // flood fill all the lanes together: a node is revisited whenever it gains lanes, and it only passes on the lanes its neighbours don't have yet
+    // (the levels only ever gain lanes, so this stops after each node has been visited at most laneCount + 1 times)
+    const int32_t numComponents = staticData.components.size;
+    std::vector<int32_t>& worklist = newState.worklist;
+    std::vector<char>& queued = newState.queued;
+    for (int32_t i = 0; i != numComponents; ++i) {
+        if (newState.componentLogicLevels[i]) {
+            worklist.push_back(i);
+            queued[i] = true;
+        }
+    }
+    while (!worklist.empty()) {
+        const int32_t node = worklist.back();
+        worklist.pop_back();
+        queued[node] = false;
+
+        if (node < numComponents) {
+            const lane_t levels = newState.componentLogicLevels[node];
+            const Component& component = staticData.components[node];
+            for (int32_t j = component.adjRelayPixelsBegin; j != component.adjRelayPixelsEnd; ++j) {
+                const int32_t relayIndex = staticData.adjComponentList[j];
+                const lane_t added = levels & newState.relayPixelIsConductive[relayIndex] & ~newState.relayPixelLogicLevels[relayIndex];
+                if (added) {
+                    newState.relayPixelLogicLevels[relayIndex] |= added;
+                    if (!queued[numComponents + relayIndex]) {
+                        queued[numComponents + relayIndex] = true;
+                        worklist.push_back(numComponents + relayIndex);
+                    }
+                }
+            }
+        }
+        else {
+            const lane_t levels = newState.relayPixelLogicLevels[node - numComponents];
+            const RelayPixel& relayPixel = staticData.relayPixels[node - numComponents];
+            for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+                const int32_t componentIndex = staticData.adjRelayPixelList[j];
+                const lane_t added = levels & ~newState.componentLogicLevels[componentIndex];
+                if (added) {
+                    newState.componentLogicLevels[componentIndex] |= added;
+                    if (!queued[componentIndex]) {
+                        queued[componentIndex] = true;
+                        worklist.push_back(componentIndex);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+const std::shared_ptr<Simulator::DynamicData>& Simulator::acquireDynamicData() {
+    for (const std::shared_ptr<DynamicData>& buffer : dynamicDataPool) {
+        // if the pool holds the only reference, then this buffer is not latestCompleteState (which always holds a reference),
+        // so no other thread can acquire a new reference to it, and it is safe to reuse.
+        if (buffer.use_count() == 1) {
+            // synchronize with the other thread releasing its reference, so that its reads happen before our writes
+            std::atomic_thread_fence(std::memory_order_acquire);
+            buffer->clear();
+            return buffer;
+        }
+    }
+    // all buffers are in use (this only happens in the first few steps after compilation), so make a new one
+    const std::shared_ptr<DynamicData>& buffer = dynamicDataPool.emplace_back(std::make_shared<DynamicData>(staticData.components.size, staticData.relayPixels.size, staticData.communicators.size));
+    dynamicDataPoolBytes.fetch_add(buffer->bytes(), std::memory_order_relaxed);
+    return buffer;
+}
+
+const std::shared_ptr<Simulator::DynamicData>& Simulator::resetDynamicDataPool(int32_t numComponents, int32_t numRelayPixels, int32_t numCommunicators) {
+    dynamicDataPool.clear();
+    const std::shared_ptr<DynamicData>& buffer = dynamicDataPool.emplace_back(std::make_shared<DynamicData>(numComponents, numRelayPixels, numCommunicators));
+    dynamicDataPoolBytes.store(buffer->bytes(), std::memory_order_relaxed);
+    return buffer;
+}
+
+
+void Simulator::setWorkerThreads(size_t numThreads) {
+    if (numThreads == 0) numThreads = 1;
+    if (numThreads == getWorkerThreads()) return;
+    // destroying the old pool joins its threads
+    workerPool = nullptr;
+    if (numThreads > 1) {
+        workerPool = std::make_shared<ext::thread_pool>(numThreads - 1);
+    }
+    if (holdsSimulation()) {
+        computePartitions();
+    }
+}
+
+
+void Simulator::setWorkerPool(std::shared_ptr<ext::thread_pool> pool) {
+    workerPool = std::move(pool);
+    if (holdsSimulation()) {
+        computePartitions();
+    }
+}
+
+
+void Simulator::computePartitions() {
+    // histogram of the cost of the gates and relays that write to each granule of outputs
+    // each gate or relay costs one for its output and one for each of its inputs, since reading the (scattered) inputs dominates the time
+    const int32_t numComponentGranules = (staticData.components.size + partitionGranularity - 1) / partitionGranularity;
+    const int32_t numRelayPixelGranules = (staticData.relayPixels.size + partitionGranularity - 1) / partitionGranularity;
+    std::vector<size_t> componentGranuleCosts(numComponentGranules, 0);
+    std::vector<size_t> relayPixelGranuleCosts(numRelayPixelGranules, 0);
+    size_t numElements = 0;
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                componentGranuleCosts[gate.outputComponent / partitionGranularity] += 1 + gate.inputComponents.size();
+            }
+            numElements += y.size;
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& relay : y) {
+                relayPixelGranuleCosts[relay.outputRelayPixel / partitionGranularity] += 1 + relay.inputComponents.size();
+            }
+            numElements += y.size;
+        });
+    });
+
+    const size_t numPartitions = std::min(getWorkerThreads() * partitionsPerThread, numElements / minElementsPerPartition);
+    if (numPartitions <= 1 || !workerPool) {
+        // not worth splitting, calculate() will do everything on the simulation thread
+        staticData.componentPartitionBounds.resize(0);
+        staticData.relayPixelPartitionBounds.resize(0);
+        return;
+    }
+
+    // split so that each partition has about the same cost
+    // if crossings is not empty, each bound is moved to the boundary with the fewest crossings among those whose cost is within the slack of the target (the nearest one if there is a tie)
+    const auto makeBounds = [numPartitions](SizedArray<int32_t>& bounds, const std::vector<size_t>& granuleCosts, const std::vector<size_t>& crossings, int32_t numOutputs) {
+        const size_t numGranules = granuleCosts.size();
+        std::vector<size_t> prefixCosts(numGranules + 1, 0);
+        std::partial_sum(granuleCosts.begin(), granuleCosts.end(), prefixCosts.begin() + 1);
+        const size_t total = prefixCosts.back();
+        const size_t slack = crossings.empty() ? 0 : total / numPartitions / partitionCutSlackDivisor;
+        bounds.resize(numPartitions + 1);
+        size_t granule = 0;
+        size_t prevGranule = 0;
+        for (size_t i = 0; i != numPartitions; ++i) {
+            // first granule where at least i/numPartitions of the cost comes before it
+            const size_t target = total * i / numPartitions;
+            while (granule != numGranules && prefixCosts[granule] < target) {
+                ++granule;
+            }
+            // look outwards within the slack, without going back past the previous bound
+            size_t chosen = granule;
+            if (i != 0 && slack != 0) {
+                for (size_t d = 1;; ++d) {
+                    const bool below = granule >= prevGranule + d && prefixCosts[granule - d] + slack >= target;
+                    const bool above = granule + d <= numGranules && prefixCosts[granule + d] <= target + slack;
+                    if (!below && !above) break;
+                    if (below && crossings[granule - d] < crossings[chosen]) chosen = granule - d;
+                    if (above && crossings[granule + d] < crossings[chosen]) chosen = granule + d;
+                }
+            }
+            bounds[i] = std::min(static_cast<int32_t>(chosen) * partitionGranularity, numOutputs);
+            prevGranule = chosen;
+            granule = std::max(granule, chosen);
+        }
+        bounds[numPartitions] = numOutputs;
+    };
+    // the relays write relay pixels, which nothing reads until the flood fill, so they are only balanced
+    makeBounds(staticData.componentPartitionBounds, componentGranuleCosts, countCrossingInputs(staticData), staticData.components.size);
+    makeBounds(staticData.relayPixelPartitionBounds, relayPixelGranuleCosts, {}, staticData.relayPixels.size);
+}
+
+
+std::vector<size_t> Simulator::countCrossingInputs(const StaticData& staticData) {
+    // each input that is in a different granule from the output crosses the boundaries after the lower granule up to the higher one
+    // so sum +1 at the first boundary crossed and -1 after the last
+    const int32_t numGranules = (staticData.components.size + partitionGranularity - 1) / partitionGranularity;
+    std::vector<ptrdiff_t> deltas(numGranules + 2, 0);
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& gate : y) {
+                const int32_t outputGranule = gate.outputComponent / partitionGranularity;
+                for (int32_t input : gate.inputComponents) {
+                    const int32_t inputGranule = input / partitionGranularity;
+                    if (inputGranule == outputGranule) continue;
+                    ++deltas[std::min(inputGranule, outputGranule) + 1];
+                    --deltas[std::max(inputGranule, outputGranule) + 1];
+                }
+            }
+        });
+    });
+    std::vector<size_t> crossings(numGranules + 1);
+    ptrdiff_t sum = 0;
+    for (int32_t g = 0; g <= numGranules; ++g) {
+        sum += deltas[g];
+        crossings[g] = static_cast<size_t>(sum);
+    }
+    return crossings;
+}
+
+
+void Simulator::takeSnapshot(CanvasState& returnState) const {
+    takeSnapshot(returnState, ext::point{ 0, 0 }, returnState.size());
+}
+
+
+void Simulator::takeSnapshot(CanvasState& returnState, ext::point topLeft, ext::point bottomRight) const {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::takeSnapshot");
+    // the canvas was edited since the running simulation was compiled, so its elements might not match the static data
+    if (backgroundCompilation) return;
+    topLeft = ext::max(topLeft, ext::point{ 0, 0 });
+    bottomRight = ext::min(bottomRight, returnState.size());
+    if (topLeft.x >= bottomRight.x || topLeft.y >= bottomRight.y) return;
+    const std::shared_ptr<DynamicData> dynamicData = publishedState.read();
+    // empty tiles have no elements with any state, so they can be skipped
+    // only the elements whose state changed are written, so that tiles shared with other canvas states (e.g. the history) are not duplicated
+    std::as_const(returnState.dataMatrix).for_each(topLeft, bottomRight, [&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr(std::is_base_of_v<RenderLogicLevelElement, ElementType>) {
+                const bool logicLevel = staticData.pixels[pt].logicLevel(*dynamicData);
+                if (element.logicLevel != logicLevel) std::get<ElementType>(returnState[pt]).logicLevel = logicLevel;
+            }
+            if constexpr(std::is_base_of_v<CommunicatorElement, ElementType>) {
+                const bool transmitState = dynamicData->communicatorTransmitStates[returnState.communicatorOf(element)->communicatorIndex];
+                if (element.transmitState != transmitState) std::get<ElementType>(returnState[pt]).transmitState = transmitState;
+            }
+            if constexpr(std::is_base_of_v<Relay, ElementType>) {
+                const bool conductiveState = dynamicData->relayPixelIsConductive[staticData.pixels[pt].index[0]];
+                if (element.conductiveState != conductiveState) std::get<ElementType>(returnState[pt]).conductiveState = conductiveState;
+            }
+        }, element);
+    });
+}
+
+
+
+CanvasState::element_variant_t Simulator::readLiveElement(const LiveState& liveState, const CanvasState& canvas, ext::point pt) const {
+    CanvasState::element_variant_t result = canvas[pt];
+    if (!liveState || liveState.compileGeneration != compileGeneration || backgroundCompilation || !staticData.pixels.contains(pt)) return result;
+    const DynamicData& dynamicData = *liveState.dynamicData;
+    const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+    std::visit([&](auto& element) {
+        using ElementType = std::decay_t<decltype(element)>;
+        if constexpr(std::is_base_of_v<RenderLogicLevelElement, ElementType>) {
+            element.logicLevel = pixel.logicLevel(dynamicData);
+        }
+        if constexpr(std::is_base_of_v<CommunicatorElement, ElementType>) {
+            if (const auto* communicator = canvas.communicatorOf(element)) {
+                element.transmitState = dynamicData.communicatorTransmitStates[communicator->communicatorIndex];
+            }
+        }
+        if constexpr(std::is_base_of_v<Relay, ElementType>) {
+            element.conductiveState = dynamicData.relayPixelIsConductive[pixel.index[0]];
+        }
+    }, result);
+    return result;
+}
+
+
+void Simulator::computeDisplayBounds() {
+    if (staticData.displayBoundsValid) return;
+    using PixelType = StaticData::DisplayedPixel::PixelType;
+    staticData.componentBounds.resize(staticData.components.size);
+    std::fill(staticData.componentBounds.begin(), staticData.componentBounds.end(), StaticData::DisplayBounds{});
+    staticData.relayPixelBounds.resize(staticData.relayPixels.size);
+    std::fill(staticData.relayPixelBounds.begin(), staticData.relayPixelBounds.end(), StaticData::DisplayBounds{});
+    const auto extend = [](StaticData::DisplayBounds& bounds, const ext::point& pt) {
+        bounds.topLeft = ext::min(bounds.topLeft, pt);
+        bounds.bottomRight = ext::max(bounds.bottomRight, pt + ext::point{ 1, 1 });
+    };
+    for (int32_t y = 0; y != staticData.pixels.height(); ++y) {
+        for (int32_t x = 0; x != staticData.pixels.width(); ++x) {
+            const ext::point pt{ x, y };
+            const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+            switch (pixel.type) {
+            case PixelType::COMPONENT: [[fallthrough]];
+            case PixelType::COMMUNICATOR:
+                if (pixel.index[0] != -1) extend(staticData.componentBounds[pixel.index[0]], pt);
+                if (pixel.index[1] != -1) extend(staticData.componentBounds[pixel.index[1]], pt);
+                break;
+            case PixelType::RELAY:
+                extend(staticData.relayPixelBounds[pixel.index[0]], pt);
+                break;
+            case PixelType::EMPTY:
+                break;
+            }
+        }
+    }
+    staticData.displayBoundsValid = true;
+}
+
+
+bool Simulator::findChangedRects(const LiveState& oldState, const LiveState& newState, ext::point topLeft, ext::point bottomRight, std::vector<std::pair<ext::point, ext::point>>& changedRects) {
+    if (!oldState || !newState || oldState.compileGeneration != newState.compileGeneration || newState.compileGeneration != compileGeneration) return false;
+    // nothing can have changed if the simulator did not publish a new state
+    if (oldState.dynamicData == newState.dynamicData) return true;
+    const DynamicData& oldData = *oldState.dynamicData;
+    const DynamicData& newData = *newState.dynamicData;
+
+    // mark the tiles covered by the bounding rectangles of everything that changed
+    const ext::point numTiles = (bottomRight - topLeft + ext::point{ changedRectTileSize - 1, changedRectTileSize - 1 }) / changedRectTileSize;
+    std::vector<bool> changedTiles; // allocated when the first change is found, so that static scenes cost almost nothing
+    const auto mark = [&](const StaticData::DisplayBounds& bounds) {
+        // components that don't display any pixels have empty bounds
+        if (bounds.topLeft.x >= bounds.bottomRight.x) return;
+        const ext::point markTopLeft = ext::max(bounds.topLeft, topLeft) - topLeft;
+        const ext::point markBottomRight = ext::min(bounds.bottomRight, bottomRight) - topLeft;
+        if (markTopLeft.x >= markBottomRight.x || markTopLeft.y >= markBottomRight.y) return;
+        if (changedTiles.empty()) changedTiles.resize(static_cast<size_t>(numTiles.x) * numTiles.y);
+        const ext::point tileTopLeft = markTopLeft / changedRectTileSize;
+        const ext::point tileBottomRight = (markBottomRight + ext::point{ changedRectTileSize - 1, changedRectTileSize - 1 }) / changedRectTileSize;
+        for (int32_t y = tileTopLeft.y; y != tileBottomRight.y; ++y) {
+            std::fill(changedTiles.begin() + (static_cast<size_t>(y) * numTiles.x + tileTopLeft.x), changedTiles.begin() + (static_cast<size_t>(y) * numTiles.x + tileBottomRight.x), true);
+        }
+    };
+    computeDisplayBounds();
+    newData.componentLogicLevels.for_each_difference(oldData.componentLogicLevels, [&](size_t component) {
+        mark(staticData.componentBounds[component]);
+    });
+    newData.relayPixelLogicLevels.for_each_difference(oldData.relayPixelLogicLevels, [&](size_t relayPixel) {
+        mark(staticData.relayPixelBounds[relayPixel]);
+    });
+    // each communicator pixel is part of the output component of its communicator
+    newData.communicatorTransmitStates.for_each_difference(oldData.communicatorTransmitStates, [&](size_t communicator) {
+        mark(staticData.componentBounds[staticData.communicators[communicator].outputComponent]);
+    });
+    if (changedTiles.empty()) return true;
+
+    // join each row of tiles into runs of changed tiles
+    for (int32_t y = 0; y != numTiles.y; ++y) {
+        for (int32_t x = 0; x != numTiles.x;) {
+            if (!changedTiles[static_cast<size_t>(y) * numTiles.x + x]) {
+                ++x;
+                continue;
+            }
+            const int32_t begin = x;
+            while (x != numTiles.x && changedTiles[static_cast<size_t>(y) * numTiles.x + x]) ++x;
+            changedRects.emplace_back(
+                topLeft + ext::point{ begin, y } * changedRectTileSize,
+                ext::min(topLeft + ext::point{ x, y + 1 } * changedRectTileSize, bottomRight)
+            );
+        }
+    }
+    return true;
+}
+
+
+bool Simulator::transmitStateOf(const CanvasState& gameState, ext::point pt, const DynamicData& dynamicData) noexcept {
+    return std::visit([&](const auto& element) {
+        if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+            return static_cast<bool>(dynamicData.communicatorTransmitStates[gameState.communicatorOf(element)->communicatorIndex]);
+        }
+        else {
+            return false;
+        }
+    }, gameState[pt]);
+}
+
+
+
+// To be invoked from the simulator thread only!
+void Simulator::run() {
+    // set the next step time to now
+    nextStepTime = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point lastPublishTime = nextStepTime;
+
+    // the most recently calculated state, which might not be published yet
+    // note: we just use the member field 'latestCompleteState' directly without any synchronization,
+    // because when the simulator thread is running, no other thread will modify 'latestCompleteState'.
+    std::shared_ptr<DynamicData> currentState = latestCompleteState;
+
+    while (true) {
+        // calculate a batch of steps back-to-back
+        // the buffers that are neither published nor current get recycled by acquireDynamicData(), so the unpublished steps just alternate between two buffers
+        const size_t batchSize = stepsPerWakeup.load(std::memory_order_acquire);
+        size_t stepsDone = 0;
+        bool stopping = false;
+        bool isSettled = false;
+        while (stepsDone != batchSize) {
+            const std::shared_ptr<DynamicData>& newState = acquireDynamicData();
+
+            // calculate the new state
+            calculate(staticData, *currentState, *newState);
+            // only the last step of the batch is checked, so that the comparison doesn't slow down the other steps
+            if (stepsDone + 1 == batchSize && skipSettledSteps.load(std::memory_order_relaxed)) {
+                isSettled = settled(*currentState, *newState);
+            }
+            const bool reached = checkBreakpoints(*currentState, *newState);
+            currentState = newState;
+            ++stepsDone;
+
+            // stop at the step where a breakpoint was reached, which is published below
+            if (reached) {
+                breakpointReachedFlag.store(true, std::memory_order_release);
+                stopping = true;
+                break;
+            }
+
+            // check if we are being asked to stop.
+            if (simStopping.load(std::memory_order_acquire)) {
+                stopping = true;
+                break;
+            }
+        }
+
+        // the state gets published after the loop ends
+        if (stopping) break;
+
+        // publish the last state of the batch, unless we published one too recently for anyone to see this one
+        // note that the communicators have already seen every step of the batch, so skipping publications does not skip any ticks
+        const std::chrono::steady_clock::duration publishInterval(publish_interval_rep.load(std::memory_order_acquire));
+        // special case when the interval is zero to avoid getting the current time (getting current time is an expensive operation).
+        bool publish = true;
+        if (publishInterval.count() != 0) {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            publish = (now - lastPublishTime >= publishInterval);
+            if (publish) lastPublishTime = now;
+        }
+        if (publish) {
+            // note: this only copies the shared_ptr from the pool, so there is no allocation here
+            publishState(currentState);
+        }
+
+        // a settled circuit is not stepped again until something could change it (e.g. a screen communicator event is sent), since all the steps would be the same
+        if (isSettled) {
+            // the settled state is always published, so that the UI doesn't keep showing an older one
+            if (!publish) publishState(currentState);
+            {
+                std::unique_lock<std::mutex> lock(simSleepMutex);
+                simSleepCV.wait(lock, [this] {
+                    return settledSleepInterrupted();
+                });
+            }
+            if (simStopping.load(std::memory_order_relaxed)) break;
+            // carry on from now, rather than catching up on the steps that were skipped
+            nextStepTime = lastPublishTime = std::chrono::steady_clock::now();
+            continue;
+        }
+
+        // sleep for an amount of time given by `period` for each step, if the time is not already used up
+        // this code will account for the time spent calculating the simulation, as long as it is less than `period`
+        std::chrono::steady_clock::duration period(period_rep.load(std::memory_order_acquire));
+        // special case when period is zero to avoid getting the current time (getting current time is an expensive operation).
+        if (period.count() != 0) {
+            nextStepTime += period * static_cast<period_t::rep>(stepsDone);
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (nextStepTime > now) {
+                // still can sleep awhile
+                // the last part of the sleep is busy-waited, since the wakeup from the condition variable might come too late
+                const std::chrono::steady_clock::duration spin(spin_rep.load(std::memory_order_acquire));
+                if (nextStepTime - now > spin) {
+                    std::unique_lock<std::mutex> lock(simSleepMutex);
+                    simSleepCV.wait_until(lock, nextStepTime - spin, [this] {
+                        return simStopping.load(std::memory_order_relaxed);
+                    });
+                }
+                while (!simStopping.load(std::memory_order_acquire) && std::chrono::steady_clock::now() < nextStepTime) {}
+                // break immediately if we got woken up due to simulator stopping.
+                if (simStopping.load(std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (now - nextStepTime > maxScheduleLag) {
+                // the next step is so overdue that catching up would run the circuit visibly fast for a while, so we give up on the late steps
+                // if we come here, it means that the period is too fast for the simulator (or the thread was descheduled for a long time)
+                nextStepTime = now;
+                if (CIRCUIT_SANDBOX_STEP_STATISTICS && collectStatistics.load(std::memory_order_relaxed)) ++pendingStatistics.missedDeadlines;
+            }
+            // otherwise the next step is only slightly overdue (usually because the wakeup came late), so the next batch is calculated at once to catch up, which keeps the average rate on target
+        }
+    }
+
+    // commit the last calculated state, even if we have already been asked to stop, otherwise the communicators will skip a step when we resume.
+    publishState(currentState);
+    flushStatistics();
+}
+
+
+// To be invoked from the simulator thread only!
+void Simulator::runFastForward(uint64_t numSteps) {
+    // the most recently calculated state, which is only published once in a while
+    std::shared_ptr<DynamicData> currentState = latestCompleteState;
+
+    for (uint64_t stepsDone = 0; stepsDone != numSteps;) {
+        const std::shared_ptr<DynamicData>& newState = acquireDynamicData();
+
+        // calculate the new state
+        calculate(staticData, *currentState, *newState);
+        // check once in a while if the circuit has settled, in which case the remaining steps would all be the same as this one
+        const bool isSettled = (stepsDone + 1) % fastForwardPublishSteps == 0 && skipSettledSteps.load(std::memory_order_relaxed) && settled(*currentState, *newState);
+        const bool reached = checkBreakpoints(*currentState, *newState);
+        currentState = newState;
+        ++stepsDone;
+        if (reached) {
+            fastForwardStepsDone.store(stepsDone, std::memory_order_relaxed);
+            breakpointReachedFlag.store(true, std::memory_order_release);
+            break;
+        }
+        if (isSettled) {
+            // the skipped steps are counted, so that the step number is the same as if they were calculated
+            stepNumber.store(stepNumber.load(std::memory_order_relaxed) + (numSteps - stepsDone), std::memory_order_relaxed);
+            stepsDone = numSteps;
+        }
+        fastForwardStepsDone.store(stepsDone, std::memory_order_relaxed);
+
+        // check if we are being asked to stop (i.e. cancelled).
+        if (simStopping.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        // publish a state once in a while, so that the UI can show something
+        if (stepsDone % fastForwardPublishSteps == 0) {
+            publishState(currentState);
+        }
+    }
+
+    // commit the last calculated state, then tell the UI thread that we are done
+    publishState(currentState);
+    flushStatistics();
+    fastForwardCompleted.store(true, std::memory_order_release);
+}
+
+
+void Simulator::invokeCommunicatorsWithLog(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState) {
+    const uint64_t step = stepNumber.load(std::memory_order_relaxed) - inputLogStartStep;
+    if (inputLogMode == InputLogMode::REPLAYING) {
+        for (; inputLogPosition != inputLog.entries.size() && inputLog.entries[inputLogPosition].step <= step; ++inputLogPosition) {
+            const InputLog::Entry& entry = inputLog.entries[inputLogPosition];
+            inputLogLevels[entry.communicatorIndex] = entry.level;
+        }
+    }
+    for (int32_t i = 0; i != staticData.communicators.size; ++i) {
+        const SimulatorCommunicator& communicator = staticData.communicators.data[i];
+        bool received = communicator.exchange(staticData, oldState, newState, i);
+        if (inputLogMode == InputLogMode::RECORDING) {
+            if (received != inputLogLevels[i]) {
+                inputLog.entries.push_back(InputLog::Entry{ step, i, received });
+                inputLogLevels[i] = received;
+            }
+        }
+        else {
+            received = inputLogLevels[i];
+        }
+        newState.componentLogicLevels.set_if(communicator.outputComponent, received);
+    }
+}
+
+
+void Simulator::startRecordingInputs() {
+    inputLogMode = InputLogMode::RECORDING;
+    inputLog = InputLog();
+    inputLog.numCommunicators = static_cast<int32_t>(staticData.communicators.size);
+    inputLogStartStep = stepNumber.load(std::memory_order_relaxed);
+    inputLogLevels.assign(staticData.communicators.size, false);
+}
+
+
+InputLog Simulator::takeRecordedInputs() {
+    InputLog log;
+    if (inputLogMode == InputLogMode::RECORDING) {
+        log = std::move(inputLog);
+        inputLogMode = InputLogMode::NONE;
+    }
+    inputLog = InputLog();
+    return log;
+}
+
+
+bool Simulator::startReplayingInputs(InputLog log) {
+    if (log.numCommunicators != static_cast<int32_t>(staticData.communicators.size)) return false;
+    inputLogMode = InputLogMode::REPLAYING;
+    inputLog = std::move(log);
+    inputLogPosition = 0;
+    inputLogStartStep = stepNumber.load(std::memory_order_relaxed);
+    inputLogLevels.assign(staticData.communicators.size, false);
+    return true;
+}
+
+
+void Simulator::stopReplayingInputs() {
+    if (inputLogMode == InputLogMode::REPLAYING) {
+        inputLogMode = InputLogMode::NONE;
+        inputLog = InputLog();
+    }
+}
+
+
+bool Simulator::settled(const DynamicData& oldState, const DynamicData& newState) const noexcept {
+    // queued screen communicator events would change what the communicators receive
+    if (screenInputQueue.available() != 0) return false;
+    // so would the entries of the input log that have not been replayed yet (the recorded run did not sleep before them, since the communicators were not idle then)
+    if (!inputReplayFinished()) return false;
+    for (const SimulatorCommunicator& communicator : staticData.communicators) {
+        if (!communicator.communicator->idle()) return false;
+    }
+    // new probes and breakpoints are only picked up by the steps
+    if (probesChanged.load(std::memory_order_acquire) || breakpointsChanged.load(std::memory_order_acquire)) return false;
+    // a level breakpoint that is met counts every step, so it is reached after a few more steps even though nothing changes
+    // (edge breakpoints can only be met by a change, so they never are on a settled circuit)
+    for (const ArmedBreakpoint& armed : armedBreakpoints) {
+        if ((armed.breakpoint.condition == Breakpoint::Condition::HIGH && probeLevel(armed.pixel, newState)) || (armed.breakpoint.condition == Breakpoint::Condition::LOW && !probeLevel(armed.pixel, newState))) return false;
+    }
+    return oldState == newState;
+}
+
+
+// To be invoked from the simulator thread only!
+void Simulator::publishState(const std::shared_ptr<DynamicData>& state) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::publishState");
+    setLatestCompleteState(state);
+    flushProbes(*state);
+
+    if (!viewportRequested.exchange(false, std::memory_order_acquire)) return;
+    ext::point topLeft;
+    ext::point bottomRight;
+    {
+        std::lock_guard<std::mutex> lock(viewportMutex);
+        topLeft = requestedViewportTopLeft;
+        bottomRight = requestedViewportBottomRight;
+    }
+
+    // get a viewport buffer that nobody else is holding (like acquireDynamicData())
+    auto it = std::find_if(viewportPool.begin(), viewportPool.end(), [](const std::shared_ptr<ViewportData>& buffer) {
+        return buffer.use_count() == 1;
+    });
+    if (it != viewportPool.end()) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    else {
+        it = viewportPool.insert(viewportPool.end(), std::make_shared<ViewportData>());
+    }
+    ViewportData& viewport = **it;
+    viewport.dynamicData = state;
+    viewport.topLeft = topLeft;
+    viewport.bottomRight = bottomRight;
+    const int32_t width = bottomRight.x - topLeft.x;
+    const int32_t height = bottomRight.y - topLeft.y;
+    viewport.pixels.resize(static_cast<size_t>(width) * height);
+
+    // each row is independent, so the rows are spread over the worker threads
+    const auto fillRows = [&](size_t rowBegin, size_t rowEnd) {
+        using PixelType = StaticData::DisplayedPixel::PixelType;
+        for (int32_t y = topLeft.y + static_cast<int32_t>(rowBegin); y != topLeft.y + static_cast<int32_t>(rowEnd); ++y) {
+            uint8_t* code = viewport.pixels.data() + static_cast<size_t>(y - topLeft.y) * width;
+            for (int32_t x = topLeft.x; x != bottomRight.x; ++x, ++code) {
+                const ext::point pt{ x, y };
+                if (!staticData.pixels.contains(pt)) {
+                    *code = 0;
+                    continue;
+                }
+                const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+                switch (pixel.type) {
+                case PixelType::EMPTY:
+                    *code = static_cast<uint8_t>(pixel.elementIndex << 1);
+                    break;
+                case PixelType::COMMUNICATOR:
+                    *code = static_cast<uint8_t>(pixel.elementIndex << 1) | viewportCommunicatorBit;
+                    break;
+                default:
+                    *code = static_cast<uint8_t>(pixel.elementIndex << 1) | static_cast<uint8_t>(pixel.logicLevel(*state));
+                    break;
+                }
+            }
+        }
+    };
+    if (workerPool) {
+        workerPool->parallel_for_ranges(height, viewportBandRows, fillRows);
+    }
+    else {
+        fillRows(0, height);
+    }
+
+    latestViewport.publish(*it);
+}
+
+
+void Simulator::calculate(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::calculate");
+    // when collecting statistics, every step is counted but only one in statisticsSampleInterval is timed
+    // when timing, endPhase() adds the time since the previous phase ended to the given phase
+    const bool collecting = CIRCUIT_SANDBOX_STEP_STATISTICS && collectStatistics.load(std::memory_order_relaxed);
+    bool sampling = false;
+    if (collecting) {
+        ++pendingStatistics.steps;
+        if (--statisticsSampleCountdown == 0) {
+            statisticsSampleCountdown = statisticsSampleInterval.load(std::memory_order_relaxed);
+            sampling = true;
+        }
+    }
+    std::chrono::steady_clock::time_point stepStart;
+    std::chrono::steady_clock::time_point phaseStart;
+    if (sampling) stepStart = phaseStart = std::chrono::steady_clock::now();
+    const auto endPhase = [&](period_t StepStatistics::* phase) {
+        if (!sampling) return;
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        pendingStatistics.*phase += now - phaseStart;
+        phaseStart = now;
+    };
+    const auto endGatePhase = [&](size_t numInputs) {
+        if (!sampling) return;
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        pendingStatistics.gateTime += now - phaseStart;
+        pendingStatistics.gateFanInTime[numInputs] += now - phaseStart;
+        phaseStart = now;
+    };
+
+    // the other nodes work on their gates and relays while this node works on its own
+    if (remoteNodes) remoteNodes->sendInputs(oldState);
+
+    if (nativeStep) {
+        // the sources, gates and relays are all compiled into the native step
+        nativeStep(oldState.componentLogicLevels.data(), newState.componentLogicLevels.data(), newState.relayPixelIsConductive.data());
+        endPhase(&StepStatistics::gateTime);
+    }
+    else if (simulationEngine == SimulationEngine::EVENT_DRIVEN && !remoteNodes && calculateEventDriven(oldState, newState)) {
+        // only the gates and relays whose inputs changed were invoked (the sources are remembered as drive counts)
+        endPhase(&StepStatistics::gateTime);
+    }
+    else if (staticData.componentPartitionBounds.size == 0) {
+        // invoke all the sources
+        for (const SimulatorSource& source : staticData.sources) {
+            source(oldState, newState);
+        }
+        endPhase(&StepStatistics::sourceTime);
+
+        // invoke all the logic gates
+        staticData.logicGates.forEach([&](const auto& x) {
+            x.forEachColumns([&](const auto& y) {
+                evaluateGateColumns(y, 0, y.outputs.size, oldState, newState);
+                endGatePhase(y.inputs.size());
+            });
+        });
+
+        // invoke all the relays
+        staticData.relays.forEach([&](const auto& x) {
+            x.forEach([&](const auto& y) {
+                for (const auto& relay : y) {
+                    relay(oldState, newState);
+                }
+            });
+        });
+        endPhase(&StepStatistics::relayTime);
+    }
+    else {
+        // invoke all the sources
+        for (const SimulatorSource& source : staticData.sources) {
+            source(oldState, newState);
+        }
+        endPhase(&StepStatistics::sourceTime);
+
+        // invoke the logic gates and relays on the worker pool
+        // parallel_for() only returns after all partitions are done, so it is also the barrier before the communicators and flood fill
+        const SizedArray<int32_t>& componentBounds = staticData.componentPartitionBounds;
+        const SizedArray<int32_t>& relayPixelBounds = staticData.relayPixelPartitionBounds;
+        workerPool->parallel_for(componentBounds.size - 1, [&](size_t i) {
+            calculatePartition(staticData, oldState, newState, componentBounds[i], componentBounds[i + 1], relayPixelBounds[i], relayPixelBounds[i + 1]);
+        });
+        endPhase(&StepStatistics::gateTime);
+    }
+
+    if (remoteNodes) {
+        remoteNodes->receiveOutputs(newState);
+        endPhase(&StepStatistics::gateTime);
+    }
+
+    // receive all the data for screen communicators
+    pullCommunicatorReceivedData();
+    endPhase(&StepStatistics::pullTime);
 
-    // calculate the new state
-    calculate(staticData, oldState, newState);
+    // invoke all the communicators
+    if (inputLogMode == InputLogMode::NONE) {
+        for (int32_t i = 0; i != staticData.communicators.size; ++i) {
+            staticData.communicators.data[i](staticData, oldState, newState, i);
+        }
+    }
+    else {
+        invokeCommunicatorsWithLog(staticData, oldState, newState);
+    }
+    endPhase(&StepStatistics::communicatorTime);
 
-    // save the new state (again without synchronization because simulator thread is not running).
-    latestCompleteState = std::make_shared<DynamicData>(std::move(newState));
+    // flood fill all the components
+    propagate(newState);
+    endPhase(&StepStatistics::floodFillTime);
+
+    // only this thread writes the step number, so it doesn't need a read-modify-write
+    stepNumber.store(stepNumber.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (collectActivity.load(std::memory_order_relaxed)) {
+        countActivity(oldState, newState);
+    }
+
+    if (!recordedProbePixels.empty()) {
+        recordProbes(newState);
+    }
+
+    // the statistics are only handed over after a timed step, so that the other steps don't need to read the clock
+    if (sampling) {
+        pendingStatistics.addSampledStep(phaseStart - stepStart);
+        if (phaseStart - lastStatisticsFlush >= statisticsFlushInterval) {
+            flushStatistics();
+            lastStatisticsFlush = phaseStart;
+        }
+    }
+}
+
+
+void Simulator::countActivity(const DynamicData& oldState, const DynamicData& newState) noexcept {
+    newState.componentLogicLevels.for_each_difference(oldState.componentLogicLevels, [&](size_t i) {
+        componentActivity[i].fetch_add(1, std::memory_order_relaxed);
+    });
+    newState.relayPixelIsConductive.for_each_difference(oldState.relayPixelIsConductive, [&](size_t i) {
+        relayPixelActivity[i].fetch_add(1, std::memory_order_relaxed);
+    });
 }
 
 
+// the counters of StepStatistics as the integers stored in publishedStatistics
+static uint64_t counterValue(uint64_t counter) noexcept {
+    return counter;
+}
+static uint64_t counterValue(uint32_t counter) noexcept {
+    return counter;
+}
+static uint64_t counterValue(Simulator::period_t counter) noexcept {
+    return static_cast<uint64_t>(counter.count());
+}
+static void setCounterValue(uint64_t& counter, uint64_t value) noexcept {
+    counter = value;
+}
+static void setCounterValue(uint32_t& counter, uint64_t value) noexcept {
+    counter = static_cast<uint32_t>(value);
+}
+static void setCounterValue(Simulator::period_t& counter, uint64_t value) noexcept {
+    counter = Simulator::period_t(static_cast<Simulator::period_t::rep>(value));
+}
+
 
-void Simulator::takeSnapshot(CanvasState& returnState) const {
-    const std::shared_ptr<DynamicData> dynamicData = std::atomic_load_explicit(&latestCompleteState, std::memory_order_acquire);
-    for (int32_t y = 0; y != returnState.dataMatrix.height(); ++y) {
-        for (int32_t x = 0; x != returnState.dataMatrix.width(); ++x) {
-            ext::point pt{ x, y };
-            std::visit([&](auto& element) {
-                using ElementType = std::decay_t<decltype(element)>;
-                if constexpr(std::is_base_of_v<RenderLogicLevelElement, ElementType>) {
-                    element.logicLevel = staticData.pixels[pt].logicLevel(*dynamicData);
-                }
-                if constexpr(std::is_base_of_v<CommunicatorElement, ElementType>) {
-                    element.transmitState = dynamicData->communicatorTransmitStates[element.communicator->communicatorIndex];
-                }
-                if constexpr(std::is_base_of_v<Relay, ElementType>) {
-                    element.conductiveState = dynamicData->relayPixelIsConductive[staticData.pixels[pt].index[0]];
-                }
-            }, returnState[pt]);
+void Simulator::setProbes(std::vector<ext::point> points) {
+    probePoints = std::move(points);
+    resolveProbes();
+    // while the simulation is stopped, this is the thread that calculates the steps, so the recording can start right away
+    if (!running() && latestCompleteState) flushProbes(*latestCompleteState);
+}
+
+
+void Simulator::resolveProbes() {
+    probePixels.clear();
+    for (const ext::point& pt : probePoints) {
+        probePixels.push_back(pixelAt(pt));
+    }
+    {
+        std::lock_guard<std::mutex> lock(probeMutex);
+        pendingProbePixels = probePixels;
+        probesChanged.store(true, std::memory_order_release);
+    }
+    wakeSettledSimulator();
+}
+
+
+void Simulator::recordProbes(const DynamicData& newState) {
+    const uint64_t step = stepNumber.load(std::memory_order_relaxed);
+    for (size_t i = 0; i != recordedProbePixels.size(); ++i) {
+        const bool level = probeLevel(recordedProbePixels[i], newState);
+        if (level != recordedProbeLevels[i]) {
+            recordedProbeLevels[i] = level;
+            probeChangeBuffer.push_back(Waveform::Change{ step, static_cast<uint32_t>(i), level });
         }
     }
+    if (probeChangeBuffer.size() >= probeChangeBufferSize) flushProbes(newState);
 }
 
 
+void Simulator::flushProbes(const DynamicData& state) {
+    if (recordedProbePixels.empty() && !probesChanged.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lock(probeMutex);
+    const uint64_t step = stepNumber.load(std::memory_order_relaxed);
+    for (const Waveform::Change& change : probeChangeBuffer) {
+        if (waveformChanges.size() == maxWaveformChanges) {
+            // the oldest step that has changes becomes the start of the recording
+            waveformStartStep = waveformChanges.front().step;
+            while (!waveformChanges.empty() && waveformChanges.front().step == waveformStartStep) {
+                waveformStartLevels[waveformChanges.front().probe] = waveformChanges.front().level;
+                waveformChanges.pop_front();
+            }
+        }
+        waveformChanges.push_back(change);
+    }
+    probeChangeBuffer.clear();
+    if (probesChanged.load(std::memory_order_relaxed)) {
+        // restart the recording with the new probes
+        recordedProbePixels = pendingProbePixels;
+        recordedProbeLevels.clear();
+        for (const StaticData::DisplayedPixel& pixel : recordedProbePixels) {
+            recordedProbeLevels.push_back(probeLevel(pixel, state));
+        }
+        waveformStartStep = step;
+        waveformStartLevels = recordedProbeLevels;
+        waveformChanges.clear();
+        probesChanged.store(false, std::memory_order_relaxed);
+    }
+    waveformEndStep = step;
+}
 
-// To be invoked from the simulator thread only!
-void Simulator::run() {
-    // set the next step time to now
-    nextStepTime = std::chrono::steady_clock::now();
 
-    while (true) {
-        // note: we just use the member field 'latestCompleteState' directly without any synchronization,
-        // because when the simulator thread is running, no other thread will modify 'latestCompleteState'.
-        const DynamicData& oldState = *latestCompleteState;
-        DynamicData newState(staticData.components.size, staticData.relayPixels.size, staticData.communicators.size);
+void Simulator::setBreakpoints(std::vector<Breakpoint> newBreakpoints) {
+    breakpoints = std::move(newBreakpoints);
+    resolveBreakpoints();
+}
 
-        // calculate the new state
-        calculate(staticData, oldState, newState);
 
-        // now we are done with the simulation, we save the new state.
-        // so commit the new state (i.e. replace 'latestCompleteState' with the new state).
-        // note that we need to commit this state even if we have already been asked to stop, otherwise the communicators will skip a step.
-        // also, std::memory_order_release to flush the changes so that the main thread can see them
-        std::atomic_store_explicit(&latestCompleteState, std::make_shared<DynamicData>(std::move(newState)), std::memory_order_release);
+void Simulator::resolveBreakpoints() {
+    {
+        std::lock_guard<std::mutex> lock(breakpointMutex);
+        pendingBreakpoints.clear();
+        for (const Breakpoint& breakpoint : breakpoints) {
+            pendingBreakpoints.push_back(ArmedBreakpoint{ breakpoint, pixelAt(breakpoint.point), std::max<uint64_t>(breakpoint.count, 1) });
+        }
+        breakpointsChanged.store(true, std::memory_order_release);
+    }
+    wakeSettledSimulator();
+}
+
 
-        // check if we are being asked to stop.
-        if (simStopping.load(std::memory_order_acquire)) {
+bool Simulator::checkBreakpoints(const DynamicData& oldState, const DynamicData& newState) noexcept {
+    if (breakpointsChanged.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(breakpointMutex);
+        armedBreakpoints = pendingBreakpoints;
+        breakpointsChanged.store(false, std::memory_order_relaxed);
+    }
+    bool reached = false;
+    for (ArmedBreakpoint& armed : armedBreakpoints) {
+        const bool oldLevel = probeLevel(armed.pixel, oldState);
+        const bool newLevel = probeLevel(armed.pixel, newState);
+        bool met = false;
+        switch (armed.breakpoint.condition) {
+        case Breakpoint::Condition::RISING:
+            met = !oldLevel && newLevel;
+            break;
+        case Breakpoint::Condition::FALLING:
+            met = oldLevel && !newLevel;
+            break;
+        case Breakpoint::Condition::CHANGE:
+            met = oldLevel != newLevel;
+            break;
+        case Breakpoint::Condition::HIGH:
+            met = newLevel;
             break;
+        case Breakpoint::Condition::LOW:
+            met = !newLevel;
+            break;
+        }
+        // all the breakpoints are counted, even if an earlier one was reached at the same step
+        if (met && --armed.remaining == 0) {
+            armed.remaining = std::max<uint64_t>(armed.breakpoint.count, 1);
+            if (!reached) reachedBreakpoint = armed.breakpoint;
+            reached = true;
         }
+    }
+    return reached;
+}
 
-        // sleep for an amount of time given by `period`, if the time is not already used up
-        // this code will account for the time spent calculating the simulation, as long as it is less than `period`
-        std::chrono::steady_clock::duration period(period_rep.load(std::memory_order_acquire));
-        // special case when period is zero to avoid getting the current time (getting current time is an expensive operation).
-        if (period.count() != 0) {
-            nextStepTime += period;
-            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-            if (nextStepTime > now) {
-                // still can sleep awhile
-                std::unique_lock<std::mutex> lock(simSleepMutex);
-                simSleepCV.wait_until(lock, nextStepTime, [this] {
-                    return simStopping.load(std::memory_order_relaxed);
-                });
-                // break immediately if we got woken up due to simulator stopping.
-                if (simStopping.load(std::memory_order_relaxed)) {
-                    break;
+
+Waveform Simulator::readWaveform(uint64_t maxSteps) {
+    // while the simulation is stopped, this is the thread that calculates the steps, so it can pick up new probes itself
+    if (!running() && latestCompleteState) flushProbes(*latestCompleteState);
+
+    Waveform waveform;
+    waveform.probes = probePoints;
+    std::lock_guard<std::mutex> lock(probeMutex);
+    // the recording of the current probes has not started yet
+    if (probesChanged.load(std::memory_order_relaxed) || waveformStartLevels.size() != probePoints.size()) return waveform;
+
+    const uint64_t fromStep = waveformEndStep - std::min(maxSteps, waveformEndStep - waveformStartStep);
+    waveform.startStep = fromStep;
+    waveform.endStep = waveformEndStep;
+    waveform.startLevels = waveformStartLevels;
+    const auto split = std::upper_bound(waveformChanges.begin(), waveformChanges.end(), fromStep, [](uint64_t step, const Waveform::Change& change) {
+        return step < change.step;
+    });
+    // the level of each probe at fromStep is its last change up to then, so the changes are searched backwards until every probe is found
+    std::vector<bool> found(probePoints.size());
+    size_t remaining = probePoints.size();
+    for (auto it = split; it != waveformChanges.begin() && remaining != 0;) {
+        --it;
+        if (!found[it->probe]) {
+            found[it->probe] = true;
+            waveform.startLevels[it->probe] = it->level;
+            --remaining;
+        }
+    }
+    waveform.changes.assign(split, waveformChanges.end());
+    return waveform;
+}
+
+
+void Simulator::flushStatistics() {
+    size_t i = 0;
+    StepStatistics::forEachCounter(pendingStatistics, [&](const auto& counter) {
+        const uint64_t value = counterValue(counter);
+        if (value != 0) publishedStatistics[i].fetch_add(value, std::memory_order_relaxed);
+        ++i;
+    });
+    assert(i == StepStatistics::counterCount);
+    pendingStatistics = StepStatistics{};
+}
+
+
+Simulator::StepStatistics Simulator::takeStepStatistics() {
+    // the published counters only increase, so the statistics since the previous call are the differences from the counters read then
+    StepStatistics statistics;
+    size_t i = 0;
+    StepStatistics::forEachCounter(statistics, [&](auto& counter) {
+        const uint64_t value = publishedStatistics[i].load(std::memory_order_relaxed);
+        setCounterValue(counter, value - takenStatistics[i]);
+        takenStatistics[i] = value;
+        ++i;
+    });
+    return statistics;
+}
+
+
+void Simulator::StepStatistics::writeCsvHeader(std::ostream& out) {
+    out << "steps,sampled_steps,missed_deadlines,step_ns,p50_step_ns,p99_step_ns,source_ns,gate_ns";
+    for (size_t i = 0; i <= maxFanIn; ++i) {
+        out << ",gate_" << i << "_inputs_ns";
+    }
+    out << ",relay_ns,pull_ns,communicator_ns,flood_fill_ns";
+}
+
+
+void Simulator::StepStatistics::writeCsvRow(std::ostream& out) const {
+    const auto nanos = [](period_t time) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    };
+    out << steps << ',' << sampledSteps << ',' << missedDeadlines << ',' << nanos(stepTime) << ',' << nanos(percentileStepTime(0.5)) << ',' << nanos(percentileStepTime(0.99)) << ','
+        << nanos(sourceTime) << ',' << nanos(gateTime);
+    for (period_t time : gateFanInTime) {
+        out << ',' << nanos(time);
+    }
+    out << ',' << nanos(relayTime) << ',' << nanos(pullTime) << ',' << nanos(communicatorTime) << ',' << nanos(floodFillTime);
+}
+
+
+void Simulator::initEventDriven() {
+    EventDrivenData& data = eventDrivenData;
+    const int32_t numComponents = staticData.components.size;
+
+    // count the gates and relays, and how many of them each component is an input to
+    int32_t numElements = 0;
+    data.fanoutBegin.resize(numComponents + 1);
+    std::fill(data.fanoutBegin.begin(), data.fanoutBegin.end(), 0);
+    const auto countInputs = [&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& element : y) {
+                for (int32_t inputComponent : element.inputComponents) {
+                    ++data.fanoutBegin[inputComponent + 1];
                 }
             }
-            else {
-                // the next step is overdue, so we don't sleep
-                // if we come here, it means that the period is too fast for the simulator
-                nextStepTime = now;
+            numElements += static_cast<int32_t>(y.size);
+        });
+    };
+    staticData.logicGates.forEach(countInputs);
+    data.numGates = numElements;
+    staticData.relays.forEach(countInputs);
+    std::partial_sum(data.fanoutBegin.begin(), data.fanoutBegin.end(), data.fanoutBegin.begin());
+
+    // fill in the fanout lists
+    data.fanout.resize(data.fanoutBegin[numComponents]);
+    std::vector<int32_t> fanoutEnd(data.fanoutBegin.begin(), data.fanoutBegin.end() - 1);
+    int32_t elementIndex = 0;
+    const auto fillFanout = [&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            for (const auto& element : y) {
+                for (int32_t inputComponent : element.inputComponents) {
+                    data.fanout[fanoutEnd[inputComponent]++] = elementIndex;
+                }
+                ++elementIndex;
             }
-        }
+        });
+    };
+    staticData.logicGates.forEach(fillFanout);
+    staticData.relays.forEach(fillFanout);
+
+    // find the components that can be on without being driven
+    data.externalBlocks.clear();
+    const auto addExternal = [&](int32_t componentIndex) {
+        const int32_t block = componentIndex / eventDrivenBlockSize;
+        if (data.externalBlocks.empty() || data.externalBlocks.back() < block) data.externalBlocks.push_back(block);
+    };
+    std::vector<bool> external(numComponents);
+    for (const SimulatorCommunicator& communicator : staticData.communicators) {
+        external[communicator.outputComponent] = true;
     }
+    for (int32_t i = 0; i != numComponents; ++i) {
+        const Component& component = staticData.components.data[i];
+        if (external[i] || component.adjRelayPixelsBegin != component.adjRelayPixelsEnd) addExternal(i);
+    }
+
+    data.outputs = logic_array_t(numElements);
+    data.dirty = logic_array_t(numElements);
+    data.driveCounts = std::make_unique<int32_t[]>(numComponents);
+    data.driven = logic_array_t(numComponents);
+    data.lastLevels = logic_array_t(numComponents);
+    data.conductive = logic_array_t(staticData.relayPixels.size);
+    data.valid = true;
 }
 
 
-void Simulator::calculate(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState) {
+void Simulator::syncEventDriven(const DynamicData& oldState) {
+    EventDrivenData& data = eventDrivenData;
+    const int32_t numComponents = staticData.components.size;
 
-    // invoke all the sources
+    // evaluate everything
+    data.outputs.clear();
+    data.toggled.clear();
+    std::fill_n(data.driveCounts.get(), numComponents, 0);
+    data.driven.clear();
+    data.conductive.clear();
+    data.lastLevels.assign(oldState.componentLogicLevels);
     for (const SimulatorSource& source : staticData.sources) {
-        source(oldState, newState);
+        ++data.driveCounts[source.outputComponent];
     }
-
-    // invoke all the logic gates
+    int32_t elementIndex = 0;
     staticData.logicGates.forEach([&](const auto& x) {
         x.forEach([&](const auto& y) {
             for (const auto& gate : y) {
-                gate(oldState, newState);
+                const bool output = gate.evaluate(oldState);
+                data.outputs.set_if(elementIndex++, output);
+                data.driveCounts[gate.outputComponent] += output;
             }
         });
     });
-    
-    // invoke all the relays
     staticData.relays.forEach([&](const auto& x) {
         x.forEach([&](const auto& y) {
             for (const auto& relay : y) {
-                relay(oldState, newState);
+                const bool output = relay.evaluate(oldState);
+                data.outputs.set_if(elementIndex++, output);
+                data.conductive.set_if(relay.outputRelayPixel, output);
             }
         });
     });
+    for (int32_t i = 0; i != numComponents; ++i) {
+        data.driven.set_if(i, data.driveCounts[i] != 0);
+    }
+    // the next state will have the driven levels, so the components where they differ from the given state change in the first step
+    data.driven.for_each_difference(oldState.componentLogicLevels, [&](size_t i) {
+        data.toggled.push_back(static_cast<int32_t>(i));
+    });
 
-    // receive all the data for screen communicators
-    pullCommunicatorReceivedData();
+    data.synced = true;
+}
 
-    // invoke all the communicators
-    for (int32_t i = 0; i != staticData.communicators.size; ++i) {
-        staticData.communicators.data[i](oldState, newState, newState.communicatorTransmitStates[i]);
+
+bool Simulator::calculateEventDriven(const DynamicData& oldState, DynamicData& newState) {
+    EventDrivenData& data = eventDrivenData;
+    const size_t numComponents = staticData.components.size;
+    if (!data.valid) {
+        initEventDriven();
+        data.synced = false;
+        data.lastLevels.assign(oldState.componentLogicLevels);
+    }
+    else if (!data.synced) {
+        // the previous step was calculated by the full engine, and so is this one unless few components changed
+        const size_t changes = oldState.componentLogicLevels.count_differences(data.lastLevels);
+        data.lastLevels.assign(oldState.componentLogicLevels);
+        if (changes * eventDrivenResumeShare > numComponents) return false;
     }
 
-    // flood fill all the components
-    floodFill(staticData, newState);
+    if (!data.synced) {
+        // every output is evaluated with the given state, so nothing needs to be re-evaluated in this step
+        syncEventDriven(oldState);
+    }
+    else {
+        // mark everything that reads from a component that changed in the previous step
+        // counting the marks (some of which might be for the same gate) is enough to tell if the step is busy
+        size_t markedInputs = 0;
+        const auto markFanout = [&](size_t i) {
+            for (int32_t j = data.fanoutBegin[i]; j != data.fanoutBegin[i + 1]; ++j) {
+                data.dirty.set(data.fanout[j]);
+            }
+            markedInputs += data.fanoutBegin[i + 1] - data.fanoutBegin[i];
+        };
+        // the components that the gates and sources changed
+        for (int32_t componentIndex : data.toggled) {
+            markFanout(componentIndex);
+        }
+        data.toggled.clear();
+        // the components that the communicators and the flood fill might have changed, which can only be seen in the levels
+        for (int32_t block : data.externalBlocks) {
+            const size_t begin = static_cast<size_t>(block) * eventDrivenBlockSize;
+            const size_t end = std::min(begin + eventDrivenBlockSize, numComponents);
+            oldState.componentLogicLevels.for_each_difference(data.lastLevels, begin, end, [&](size_t i) {
+                markFanout(i);
+                if (oldState.componentLogicLevels[i]) data.lastLevels.set(i);
+                else data.lastLevels.reset(i);
+            });
+        }
+        if (markedInputs * eventDrivenMaxDirtyShare > data.outputs.size()) {
+            // too busy, so this step goes to the full engine, which doesn't keep the outputs up to date
+            data.dirty.clear();
+            data.synced = false;
+            data.lastLevels.assign(oldState.componentLogicLevels);
+            return false;
+        }
+    }
+
+    // re-evaluate the marked gates and relays, visiting them in the same order as they are numbered
+    int32_t arrayBegin = 0;
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            const int32_t arrayEnd = arrayBegin + static_cast<int32_t>(y.size);
+            data.dirty.for_each_set(arrayBegin, arrayEnd, [&](size_t elementIndex) {
+                const auto& gate = y[elementIndex - arrayBegin];
+                const bool output = gate.evaluate(oldState);
+                if (output != data.outputs[elementIndex]) {
+                    int32_t& driveCount = data.driveCounts[gate.outputComponent];
+                    if (output) {
+                        data.outputs.set(elementIndex);
+                        if (driveCount++ == 0) {
+                            data.driven.set(gate.outputComponent);
+                            data.toggled.push_back(gate.outputComponent);
+                        }
+                    }
+                    else {
+                        data.outputs.reset(elementIndex);
+                        if (--driveCount == 0) {
+                            data.driven.reset(gate.outputComponent);
+                            data.toggled.push_back(gate.outputComponent);
+                        }
+                    }
+                }
+            });
+            arrayBegin = arrayEnd;
+        });
+    });
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            const int32_t arrayEnd = arrayBegin + static_cast<int32_t>(y.size);
+            data.dirty.for_each_set(arrayBegin, arrayEnd, [&](size_t elementIndex) {
+                const auto& relay = y[elementIndex - arrayBegin];
+                const bool output = relay.evaluate(oldState);
+                if (output != data.outputs[elementIndex]) {
+                    if (output) {
+                        data.outputs.set(elementIndex);
+                        data.conductive.set(relay.outputRelayPixel);
+                    }
+                    else {
+                        data.outputs.reset(elementIndex);
+                        data.conductive.reset(relay.outputRelayPixel);
+                    }
+                }
+            });
+            arrayBegin = arrayEnd;
+        });
+    });
+    data.dirty.clear();
+
+    // publish the results into the new state
+    newState.componentLogicLevels.assign(data.driven);
+    newState.relayPixelIsConductive.assign(data.conductive);
+    return true;
 }
 
 
-void Simulator::floodFill(const StaticData& staticData, DynamicData& dynamicData) {
-    // first field of pair is true if it is a relay instead of a component
-    std::stack<std::pair<bool, int32_t>> componentStack;
-    for (int32_t i = 0; i != staticData.components.size; ++i) {
-        if (dynamicData.componentLogicLevels[i]) {
-            componentStack.emplace(false, i);
-            dynamicData.componentLogicLevels[i] = false; // will be turned on again in the flood fill algorithm
+template <typename Gate>
+void Simulator::evaluateGateColumns(const GateColumns<Gate>& columns, size_t begin, size_t end, const DynamicData& oldState, DynamicData& newState) noexcept {
+    constexpr size_t NumInputs = Gate::numInputs;
+    size_t i = begin;
+#if CIRCUIT_SANDBOX_SIMD_GATES
+    if constexpr (NumInputs > 0) {
+        // 8 gates at a time: gather the 32-bit word holding each input bit, then shift the bit down to the lowest position
+        // (the 64-bit words of the bit array are little-endian, so they can be read as pairs of 32-bit words)
+        const int* const levels = reinterpret_cast<const int*>(oldState.componentLogicLevels.data());
+        const __m256i lowBitsMask = _mm256_set1_epi32(31);
+        for (; i + 8 <= end; i += 8) {
+            __m256i ans = Gate::conjunctive ? _mm256_set1_epi32(1) : _mm256_setzero_si256();
+            for (size_t k = 0; k != NumInputs; ++k) {
+                const __m256i indices = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(columns.inputs[k].data + i));
+                const __m256i words = _mm256_i32gather_epi32(levels, _mm256_srli_epi32(indices, 5), 4);
+                const __m256i bits = _mm256_srlv_epi32(words, _mm256_and_si256(indices, lowBitsMask));
+                ans = Gate::conjunctive ? _mm256_and_si256(ans, bits) : _mm256_or_si256(ans, bits);
+            }
+            // one bit per gate, from the lowest bit of each lane
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(ans, 31))));
+            if constexpr (Gate::inverted) mask ^= 0xFF;
+            while (mask != 0) {
+                newState.componentLogicLevels.set(columns.outputs[i + ext::count_trailing_zeros(mask)]);
+                mask &= mask - 1; // remove the lowest set bit
+            }
         }
     }
-    while (!componentStack.empty()) {
-        auto [isRelay, i] = componentStack.top();
-        componentStack.pop();
+#endif
+    // the remaining gates
+    for (; i != end; ++i) {
+        const bool ans = combineInputs<Gate::conjunctive, Gate::inverted>([&](size_t k) {
+            return oldState.componentLogicLevels[columns.inputs[k][i]];
+        }, std::make_index_sequence<NumInputs>{});
+        newState.componentLogicLevels.set_if(columns.outputs[i], ans);
+    }
+}
+
+
+void Simulator::calculateGatesAndRelays(const DynamicData& oldState, DynamicData& newState) {
+    const SizedArray<int32_t>& componentBounds = staticData.componentPartitionBounds;
+    const SizedArray<int32_t>& relayPixelBounds = staticData.relayPixelPartitionBounds;
+    if (componentBounds.size == 0) {
+        calculatePartition(staticData, oldState, newState, 0, static_cast<int32_t>(staticData.components.size), 0, static_cast<int32_t>(staticData.relayPixels.size));
+    }
+    else {
+        workerPool->parallel_for(componentBounds.size - 1, [&](size_t i) {
+            calculatePartition(staticData, oldState, newState, componentBounds[i], componentBounds[i + 1], relayPixelBounds[i], relayPixelBounds[i + 1]);
+        });
+    }
+}
+
+
+void Simulator::calculatePartition(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState, int32_t componentBegin, int32_t componentEnd, int32_t relayPixelBegin, int32_t relayPixelEnd) noexcept {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("Simulator::calculatePartition");
+    // invoke the logic gates with outputs in [componentBegin, componentEnd)
+    staticData.logicGates.forEach([&](const auto& x) {
+        x.forEachColumns([&](const auto& y) {
+            const int32_t* first = std::lower_bound(y.outputs.begin(), y.outputs.end(), componentBegin);
+            const int32_t* last = std::lower_bound(first, y.outputs.end(), componentEnd);
+            evaluateGateColumns(y, first - y.outputs.begin(), last - y.outputs.begin(), oldState, newState);
+        });
+    });
+
+    // invoke the relays with outputs in [relayPixelBegin, relayPixelEnd)
+    staticData.relays.forEach([&](const auto& x) {
+        x.forEach([&](const auto& y) {
+            const auto* first = std::partition_point(y.begin(), y.end(), [&](const auto& relay) {
+                return relay.outputRelayPixel < relayPixelBegin;
+            });
+            const auto* last = std::partition_point(first, y.end(), [&](const auto& relay) {
+                return relay.outputRelayPixel < relayPixelEnd;
+            });
+            for (; first != last; ++first) {
+                (*first)(oldState, newState);
+            }
+        });
+    });
+}
+
+
+void Simulator::propagate(DynamicData& dynamicData) {
+    switch (floodFillEngine) {
+    case FloodFillEngine::DEPTH_FIRST:
+        floodFill(dynamicData);
+        break;
+    case FloodFillEngine::PARALLEL:
+        parallelFloodFill(dynamicData);
+        break;
+    case FloodFillEngine::GROUPED:
+        groupedFloodFill(dynamicData);
+        break;
+    }
+}
 
-        if (!isRelay) {
-            // ignore if already on
-            if (dynamicData.componentLogicLevels[i]) continue;
 
-            // turn the component on
-            dynamicData.componentLogicLevels[i] = true;
+void Simulator::floodFill(DynamicData& dynamicData) {
+    // nodes are marked as on when they are pushed (rather than when they are popped), so each node is pushed at most once and the worklist cannot overflow
+    const int32_t numComponents = staticData.components.size;
+    int32_t* const worklist = floodFillWorklist.get();
+    size_t depth = 0;
+    dynamicData.componentLogicLevels.for_each_set([&](size_t i) {
+        worklist[depth++] = static_cast<int32_t>(i);
+    });
+    size_t peakDepth = depth;
+    while (depth != 0) {
+        const int32_t node = worklist[--depth];
 
+        if (node < numComponents) {
             // flood to neighbours
-            Component& component = staticData.components.data[i];
+            const Component& component = staticData.components.data[node];
             for (int32_t j = component.adjRelayPixelsBegin; j != component.adjRelayPixelsEnd; ++j) {
                 int32_t relayIndex = staticData.adjComponentList.data[j];
                 if (dynamicData.relayPixelIsConductive[relayIndex] && !dynamicData.relayPixelLogicLevels[relayIndex]) {
-                    componentStack.emplace(true, relayIndex);
+                    // turn the relay pixel on
+                    dynamicData.relayPixelLogicLevels.set(relayIndex);
+                    worklist[depth++] = numComponents + relayIndex;
                 }
             }
         }
         else {
-            // ignore if already on
-            if (dynamicData.relayPixelLogicLevels[i]) continue;
-
-            // turn the component on
-            dynamicData.relayPixelLogicLevels[i] = true;
-
             // flood to neighbours
-            RelayPixel& relayPixel = staticData.relayPixels.data[i];
-            for (int32_t j = 0; j != relayPixel.numAdjComponents; ++j) {
-                if (!dynamicData.componentLogicLevels[relayPixel.adjComponents[j]]) {
-                    componentStack.emplace(false, relayPixel.adjComponents[j]);
+            const RelayPixel& relayPixel = staticData.relayPixels.data[node - numComponents];
+            for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+                const int32_t componentIndex = staticData.adjRelayPixelList.data[j];
+                if (!dynamicData.componentLogicLevels[componentIndex]) {
+                    // turn the component on
+                    dynamicData.componentLogicLevels.set(componentIndex);
+                    worklist[depth++] = componentIndex;
                 }
             }
         }
+        peakDepth = std::max(peakDepth, depth);
+    }
+
+    floodFillPeakDepth.store(peakDepth, std::memory_order_relaxed);
+    if (peakDepth > floodFillMaxPeakDepth.load(std::memory_order_relaxed)) {
+        // only this thread writes to it, so there is no need for compare-exchange
+        floodFillMaxPeakDepth.store(peakDepth, std::memory_order_relaxed);
     }
 }
 
-void Simulator::pullCommunicatorReceivedData() {
-    ScreenInputCommunicatorEvent commEvent;
-    while (screenInputQueue.pop(commEvent)) {
-        const bool turnOn = commEvent.turnOn;
-        const int32_t commIndex = commEvent.communicatorIndex;
-        assert(dynamic_cast<ScreenCommunicator*>(staticData.communicators[commIndex].communicator) != nullptr);
-        auto& screenCommunicator = static_cast<ScreenCommunicator&>(*staticData.communicators[commIndex].communicator);
-        screenCommunicator.insertEvent(turnOn);
-    }
-}
-
-
-// simulator sepecific stuff
-inline void Simulator::SimulatorSource::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    newData.componentLogicLevels[this->outputComponent] = true;
-}
-template <size_t NumInputs>
-inline void Simulator::SimulatorAndGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    bool& output = newData.componentLogicLevels[this->outputComponent];
-    if (!output) {
-        bool ans = true;
-        // hopefully compilers will unroll the loop
-        for (size_t i = 0; i != NumInputs; ++i) {
-            if (!oldData.componentLogicLevels[this->inputComponents[i]]) {
-                ans = false;
-                break;
+
+void Simulator::parallelFloodFill(DynamicData& dynamicData) {
+    if (!workerPool || workerPool->concurrency() == 1) {
+        floodFill(dynamicData);
+        return;
+    }
+
+    // nodes [0, numComponents) are the components, and nodes [numComponents, numNodes) are the relay pixels
+    const int32_t numComponents = staticData.components.size;
+    if (parallelFloodFillSeeds.size() != static_cast<size_t>(numComponents)) {
+        parallelFloodFillSeeds = logic_array_t(numComponents);
+    }
+    // the searches start from a copy of the components that are on, so that a task doesn't search again from the components that another task has turned on
+    parallelFloodFillSeeds.assign(dynamicData.componentLogicLevels);
+    const size_t numTasks = std::max<size_t>(std::min<size_t>(workerPool->concurrency() * parallelFloodFillTasksPerThread, numComponents / partitionGranularity), 1);
+    parallelFloodFillWorklists.resize(numTasks);
+    parallelFloodFillPeakDepths.resize(numTasks);
+
+    workerPool->parallel_for(numTasks, [&](size_t task) {
+        std::vector<int32_t>& worklist = parallelFloodFillWorklists[task];
+        size_t peakDepth = 0;
+        // like floodFill(), nodes are turned on when they are pushed, so each node is pushed by only one task
+        parallelFloodFillSeeds.for_each_set(numComponents * task / numTasks, numComponents * (task + 1) / numTasks, [&](size_t seed) {
+            worklist.push_back(static_cast<int32_t>(seed));
+            while (!worklist.empty()) {
+                peakDepth = std::max(peakDepth, worklist.size());
+                const int32_t node = worklist.back();
+                worklist.pop_back();
+
+                if (node < numComponents) {
+                    const Component& component = staticData.components.data[node];
+                    for (int32_t j = component.adjRelayPixelsBegin; j != component.adjRelayPixelsEnd; ++j) {
+                        const int32_t relayIndex = staticData.adjComponentList.data[j];
+                        // the relay pixel is read first, so that the atomic operation is only done for the relay pixels that are probably still off
+                        if (dynamicData.relayPixelIsConductive[relayIndex] && !dynamicData.relayPixelLogicLevels.get_atomic(relayIndex) && !dynamicData.relayPixelLogicLevels.test_and_set_atomic(relayIndex)) {
+                            worklist.push_back(numComponents + relayIndex);
+                        }
+                    }
+                }
+                else {
+                    const RelayPixel& relayPixel = staticData.relayPixels.data[node - numComponents];
+                    for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+                        const int32_t componentIndex = staticData.adjRelayPixelList.data[j];
+                        if (!dynamicData.componentLogicLevels.get_atomic(componentIndex) && !dynamicData.componentLogicLevels.test_and_set_atomic(componentIndex)) {
+                            worklist.push_back(componentIndex);
+                        }
+                    }
+                }
             }
-        }
-        output = ans;
+        });
+        parallelFloodFillPeakDepths[task] = peakDepth;
+    });
+
+    const size_t peakDepth = *std::max_element(parallelFloodFillPeakDepths.begin(), parallelFloodFillPeakDepths.end());
+    floodFillPeakDepth.store(peakDepth, std::memory_order_relaxed);
+    if (peakDepth > floodFillMaxPeakDepth.load(std::memory_order_relaxed)) {
+        floodFillMaxPeakDepth.store(peakDepth, std::memory_order_relaxed);
     }
 }
-template <size_t NumInputs>
-inline void Simulator::SimulatorOrGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    bool& output = newData.componentLogicLevels[this->outputComponent];
-    if (!output) {
-        // hopefully compilers will unroll the loop
-        for (size_t i = 0; i != NumInputs; ++i) {
-            if (oldData.componentLogicLevels[this->inputComponents[i]]) {
-                output = true;
-                break;
+
+
+template <typename IsConductive>
+void Simulator::fillFloodFillGroup(int32_t start, int32_t group, IsConductive isConductive) {
+    GroupedFloodFillData& data = groupedFloodFillData;
+    const int32_t numComponents = staticData.components.size;
+    int32_t* const worklist = floodFillWorklist.get();
+    // like floodFill(), nodes are put in the group when they are pushed, so the worklist cannot overflow
+    size_t depth = 0;
+    const auto add = [&](int32_t node) {
+        data.groupOf[node] = group;
+        data.nextInGroup[node] = data.groupHead[group];
+        data.groupHead[group] = node;
+        ++data.groupSize[group];
+        worklist[depth++] = node;
+    };
+    add(start);
+    while (depth != 0) {
+        const int32_t node = worklist[--depth];
+        if (node < numComponents) {
+            const Component& component = staticData.components.data[node];
+            for (int32_t j = component.adjRelayPixelsBegin; j != component.adjRelayPixelsEnd; ++j) {
+                const int32_t relayIndex = staticData.adjComponentList.data[j];
+                if (isConductive(relayIndex) && data.groupOf[numComponents + relayIndex] == -1) add(numComponents + relayIndex);
             }
         }
-    }
-}
-template <size_t NumInputs>
-inline void Simulator::SimulatorNandGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    bool& output = newData.componentLogicLevels[this->outputComponent];
-    if (!output) {
-        // hopefully compilers will unroll the loop
-        for (size_t i = 0; i != NumInputs; ++i) {
-            if (!oldData.componentLogicLevels[this->inputComponents[i]]) {
-                output = true;
-                break;
+        else if (isConductive(node - numComponents)) {
+            const RelayPixel& relayPixel = staticData.relayPixels.data[node - numComponents];
+            for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+                const int32_t componentIndex = staticData.adjRelayPixelList.data[j];
+                if (data.groupOf[componentIndex] == -1) add(componentIndex);
             }
         }
     }
 }
-template <size_t NumInputs>
-inline void Simulator::SimulatorNorGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    bool& output = newData.componentLogicLevels[this->outputComponent];
-    if (!output) {
-        bool ans = true;
-        // hopefully compilers will unroll the loop
-        for (size_t i = 0; i != NumInputs; ++i) {
-            if (oldData.componentLogicLevels[this->inputComponents[i]]) {
-                ans = false;
-                break;
+
+
+void Simulator::groupedFloodFill(DynamicData& dynamicData) {
+    GroupedFloodFillData& data = groupedFloodFillData;
+    const int32_t numComponents = staticData.components.size;
+    const int32_t numNodes = numComponents + static_cast<int32_t>(staticData.relayPixels.size);
+    const logic_array_t& conductive = dynamicData.relayPixelIsConductive;
+
+    if (!data.valid) {
+        // build every group from scratch (each group is numbered by the node it was started from)
+        data.conductive = logic_array_t(staticData.relayPixels.size);
+        data.groupOf = std::make_unique<int32_t[]>(numNodes);
+        data.nextInGroup = std::make_unique<int32_t[]>(numNodes);
+        data.groupHead = std::make_unique<int32_t[]>(numNodes);
+        data.groupSize = std::make_unique<int32_t[]>(numNodes);
+        data.freeGroups = std::make_unique<int32_t[]>(numNodes);
+        data.regroupNodes = std::make_unique<int32_t[]>(numNodes);
+        data.groupOn = std::make_unique<bool[]>(numNodes);
+        data.onGroups = std::make_unique<int32_t[]>(numNodes);
+        std::fill_n(data.groupOf.get(), numNodes, -1);
+        std::fill_n(data.groupHead.get(), numNodes, -1);
+        for (int32_t node = 0; node != numNodes; ++node) {
+            if (data.groupOf[node] == -1) {
+                fillFloodFillGroup(node, node, [&](int32_t relayIndex) {
+                    return conductive[relayIndex];
+                });
             }
         }
-        output = ans;
+        data.numFreeGroups = 0;
+        for (int32_t group = 0; group != numNodes; ++group) {
+            if (data.groupHead[group] == -1) data.freeGroups[data.numFreeGroups++] = group;
+        }
+        data.conductive.assign(conductive);
+        data.valid = true;
     }
-}
+    else {
+        const auto releaseGroup = [&](int32_t group) {
+            data.groupHead[group] = -1;
+            data.groupSize[group] = 0;
+            data.freeGroups[data.numFreeGroups++] = group;
+        };
 
-template <size_t NumInputs>
-inline void Simulator::SimulatorPositiveRelay<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    // hopefully compilers will unroll the loop
-    for (size_t i = 0; i != NumInputs; ++i) {
-        if (oldData.componentLogicLevels[this->inputComponents[i]]) {
-            newData.relayPixelIsConductive[this->outputRelayPixel] = true;
-            return;
+        // take apart the groups of the relay pixels that stopped conducting
+        int32_t numRegroupNodes = 0;
+        conductive.for_each_difference(data.conductive, [&](size_t relayIndex) {
+            if (conductive[relayIndex]) return;
+            const int32_t group = data.groupOf[numComponents + relayIndex];
+            if (group == -1) return; // already taken apart by another relay pixel of the same group
+            for (int32_t node = data.groupHead[group]; node != -1; node = data.nextInGroup[node]) {
+                data.groupOf[node] = -1;
+                data.regroupNodes[numRegroupNodes++] = node;
+            }
+            releaseGroup(group);
+        });
+        // and group their nodes again, through the relay pixels that conducted before and still do (so no other group is reached)
+        for (int32_t i = 0; i != numRegroupNodes; ++i) {
+            const int32_t node = data.regroupNodes[i];
+            if (data.groupOf[node] == -1) {
+                fillFloodFillGroup(node, data.freeGroups[--data.numFreeGroups], [&](int32_t relayIndex) {
+                    return conductive[relayIndex] && data.conductive[relayIndex];
+                });
+            }
         }
+
+        // merge the groups next to the relay pixels that started conducting (each of them was in a group by itself)
+        // the nodes of the smaller group are moved to the larger one
+        const auto merge = [&](int32_t a, int32_t b) {
+            if (a == b) return a;
+            if (data.groupSize[a] < data.groupSize[b]) std::swap(a, b);
+            int32_t last = -1;
+            for (int32_t node = data.groupHead[b]; node != -1; node = data.nextInGroup[node]) {
+                data.groupOf[node] = a;
+                last = node;
+            }
+            data.nextInGroup[last] = data.groupHead[a];
+            data.groupHead[a] = data.groupHead[b];
+            data.groupSize[a] += data.groupSize[b];
+            releaseGroup(b);
+            return a;
+        };
+        conductive.for_each_difference(data.conductive, [&](size_t relayIndex) {
+            if (!conductive[relayIndex]) return;
+            const RelayPixel& relayPixel = staticData.relayPixels.data[relayIndex];
+            int32_t group = data.groupOf[numComponents + relayIndex];
+            for (int32_t j = relayPixel.adjComponentsBegin; j != relayPixel.adjComponentsEnd; ++j) {
+                group = merge(group, data.groupOf[staticData.adjRelayPixelList.data[j]]);
+            }
+        });
+
+        data.conductive.assign(conductive);
     }
-}
-template <size_t NumInputs>
-inline void Simulator::SimulatorNegativeRelay<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
-    // hopefully compilers will unroll the loop
-    for (size_t i = 0; i != NumInputs; ++i) {
-        if (!oldData.componentLogicLevels[this->inputComponents[i]]) {
-            newData.relayPixelIsConductive[this->outputRelayPixel] = true;
-            return;
+
+    // a group is on if any of its components is on (the relay pixels are never on by themselves)
+    int32_t numOnGroups = 0;
+    dynamicData.componentLogicLevels.for_each_set([&](size_t i) {
+        const int32_t group = data.groupOf[i];
+        if (!data.groupOn[group]) {
+            data.groupOn[group] = true;
+            data.onGroups[numOnGroups++] = group;
         }
-    }
-}
-inline void Simulator::SimulatorCommunicator::operator()(const DynamicData& oldData, DynamicData& newData, bool& transmitOutput) const noexcept {
-    // hopefully compilers will unroll the loop
-    for (int32_t inputComponent : inputComponents) {
-        if (oldData.componentLogicLevels[inputComponent]) {
-            transmitOutput = true;
-            break;
+    });
+    // everything in a group that is on is turned on
+    for (int32_t i = 0; i != numOnGroups; ++i) {
+        const int32_t group = data.onGroups[i];
+        for (int32_t node = data.groupHead[group]; node != -1; node = data.nextInGroup[node]) {
+            if (node < numComponents) {
+                dynamicData.componentLogicLevels.set(node);
+            }
+            else {
+                dynamicData.relayPixelLogicLevels.set(node - numComponents);
+            }
         }
+        data.groupOn[group] = false;
     }
+}
 
-    communicator->transmit(transmitOutput);
 
-    bool& receiveOutput = newData.componentLogicLevels[outputComponent];
-    receiveOutput = communicator->receive() || receiveOutput;
-}
-inline bool Simulator::StaticData::DisplayedPixel::logicLevel(const DynamicData& execData) const noexcept {
-    switch (type) {
-    case PixelType::COMPONENT: [[fallthrough]];
-    case PixelType::COMMUNICATOR:
-        return (index[0] != -1 ? execData.componentLogicLevels[index[0]] : false) || (index[1] != -1 ? execData.componentLogicLevels[index[1]] : false);
-    case PixelType::RELAY:
-        return execData.relayPixelLogicLevels[index[0]];
-    case PixelType::EMPTY:
-        break;
+void Simulator::pullCommunicatorReceivedData() {
+    // the events are read straight from the queue buffer, one contiguous span at a time (there are at most two, if the queue wraps around)
+    const uint64_t currentStep = stepNumber.load(std::memory_order_relaxed);
+    while (true) {
+        const auto [events, count] = screenInputQueue.peek_span();
+        size_t received = 0;
+        // stop at the first event that is scheduled for a later step, so that the events are received in order
+        while (received != count && events[received].stepNumber <= currentStep) {
+            const ScreenInputCommunicatorEvent& commEvent = events[received];
+            assert(dynamic_cast<ScreenCommunicator*>(staticData.communicators[commEvent.communicatorIndex].communicator) != nullptr);
+            auto& screenCommunicator = static_cast<ScreenCommunicator&>(*staticData.communicators[commEvent.communicatorIndex].communicator);
+            // a burst that does not fit waits until the levels before it are received
+            if (!screenCommunicator.insertBits(commEvent.bits, commEvent.count)) break;
+            ++received;
+        }
+        if (received == 0) break;
+        screenInputQueue.pop(received);
+        if (received != count) break;
     }
-    assert(false);
-#ifdef NDEBUG
-#ifdef _MSC_VER // MSVC
-    __assume(0);
-#endif
-#ifdef __GNUC__ // GCC or Clang
-    __builtin_unreachable();
-#endif
-#endif // NDEBUG
 }
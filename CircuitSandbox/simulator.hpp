@@ -25,20 +25,239 @@
 #include <array>
 #include <tuple>
 #include <vector>
+#include <deque>
 #include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <climits>
+#include <limits>
+#include <utility>
+#include <optional>
+#include <istream>
+#include <ostream>
 
 #include "canvasstate.hpp"
 #include "heap_matrix.hpp"
 #include "communicator.hpp"
 #include "screencommunicator.hpp"
-#include "concurrent_queue.hpp"
+#include "inputlog.hpp"
+#include "waveform.hpp"
+#include "concurrent_fixed_queue.hpp"
+#include "triple_buffer.hpp"
+#include "bit_array.hpp"
+#include "thread_pool.hpp"
+#include "tag_tuple.hpp"
 
+// whether the simulator stores logic levels bit-packed (64 per word) instead of one bool per byte
+#ifndef CIRCUIT_SANDBOX_BIT_PACKED_STATE
+#define CIRCUIT_SANDBOX_BIT_PACKED_STATE 1
+#endif
+
+// whether the gate kernels use AVX2 gathers (only possible with bit-packed state, since gathers read whole 32-bit words)
+#ifndef CIRCUIT_SANDBOX_SIMD_GATES
+#if CIRCUIT_SANDBOX_BIT_PACKED_STATE && defined(__AVX2__)
+#define CIRCUIT_SANDBOX_SIMD_GATES 1
+#else
+#define CIRCUIT_SANDBOX_SIMD_GATES 0
+#endif
+#endif
+
+// whether Simulator::setCollectStatistics() is honoured (with 0, the steps are never timed and the statistics stay empty)
+#ifndef CIRCUIT_SANDBOX_STEP_STATISTICS
+#define CIRCUIT_SANDBOX_STEP_STATISTICS 1
+#endif
+
+#if CIRCUIT_SANDBOX_SIMD_GATES
+#include <immintrin.h>
+#endif
+
+struct CompilerStaticData;
 
 class Simulator {
 public:
     using period_t = std::chrono::steady_clock::duration;
+
+    // algorithm used to propagate logic levels through conductive relays at the end of each step
+    enum struct FloodFillEngine : unsigned char {
+        DEPTH_FIRST, // depth-first search from the components that are on (fast when the circuit is small or mostly off)
+        PARALLEL, // depth-first searches from the components that are on, spread over the worker pool (the same as DEPTH_FIRST without worker threads; scales with cores when many separate relay networks are on)
+        GROUPED // keeps the groups of components connected by conductive relays between steps, and only regroups around the relays that toggled (fast when the relays rarely change)
+    };
+
+    // how the gates and relays are evaluated at each step
+    enum struct SimulationEngine : unsigned char {
+        FULL, // evaluate every gate and relay (on the worker pool if the circuit is large)
+        EVENT_DRIVEN // only re-evaluate the gates and relays whose inputs changed in the previous step (fast when most of the circuit is idle)
+    };
+
+    // the largest number of inputs of a gate or relay (every pixel has 4 neighbours, but gate blocks spanning many pixels would need more)
+    // the gates and relays are stored in a separate array for each number of inputs in [0, maxFanIn]
+    constexpr static size_t maxFanIn = 4;
+
+    // std::tuple<Container<Element<0>>, ..., Container<Element<maxFanIn>>>
+    template <template <typename> typename Container, template <size_t> typename Element, typename Sequence = std::make_index_sequence<maxFanIn + 1>>
+    struct FanInTuple;
+    template <template <typename> typename Container, template <size_t> typename Element, size_t... NumInputs>
+    struct FanInTuple<Container, Element, std::index_sequence<NumInputs...>> {
+        using type = std::tuple<Container<Element<NumInputs>>...>;
+    };
+
+    // ext::tag_tuple<std::integral_constant<int32_t, 0>, ..., std::integral_constant<int32_t, maxFanIn>>, for iterating over the arrays of a FanInTuple
+    template <typename Sequence = std::make_integer_sequence<int32_t, maxFanIn + 1>>
+    struct FanInIndices;
+    template <int32_t... NumInputs>
+    struct FanInIndices<std::integer_sequence<int32_t, NumInputs...>> {
+        using type = ext::tag_tuple<std::integral_constant<int32_t, NumInputs>...>;
+    };
+    using fan_in_indices_t = typename FanInIndices<>::type;
+
+    /**
+     * Timing of the steps calculated while statistics are collected (see setCollectStatistics()).
+     * All the steps are counted, but only one in every sample interval is timed (see setStatisticsSampleInterval()), so the times and the histogram cover sampledSteps steps.
+     * The phase times are parts of stepTime.  When the gates and relays are evaluated together (by the worker threads or the event-driven engine), all of that time is counted in gateTime, and gateFanInTime stays zero.
+     */
+    struct StepStatistics {
+        uint64_t steps = 0;
+        uint64_t sampledSteps = 0; // steps that were timed
+        uint64_t missedDeadlines = 0; // number of times the simulator thread fell more than maxScheduleLag behind, so it gave up on the steps it was late for and the period could not be kept
+        period_t stepTime = period_t::zero();
+        period_t sourceTime = period_t::zero(); // the event-driven engine remembers the sources as drive counts, so it has none
+        period_t gateTime = period_t::zero();
+        std::array<period_t, maxFanIn + 1> gateFanInTime{}; // gateTime of the serial engine, split by the number of inputs of the gates
+        period_t relayTime = period_t::zero();
+        period_t pullTime = period_t::zero(); // receiving the data of the screen communicators
+        period_t communicatorTime = period_t::zero();
+        period_t floodFillTime = period_t::zero(); // propagating logic levels through relays
+
+        // histogram of the step times, where bucket i < 8 holds times of i nanoseconds, and the other buckets split each power of two into four
+        constexpr static size_t histogramSize = 192;
+        std::array<uint32_t, histogramSize> stepTimeHistogram{};
+
+        // number of counters visited by forEachCounter()
+        constexpr static size_t counterCount = 10 + (maxFanIn + 1) + histogramSize;
+
+        /**
+         * Calls the callback with a reference to each counter of the given statistics (each an integer or a period_t), always in the same order.
+         * This lets the counters be copied to and from an array of integers.
+         */
+        template <typename Statistics, typename Callback>
+        static void forEachCounter(Statistics& statistics, Callback callback) {
+            callback(statistics.steps);
+            callback(statistics.sampledSteps);
+            callback(statistics.missedDeadlines);
+            callback(statistics.stepTime);
+            callback(statistics.sourceTime);
+            callback(statistics.gateTime);
+            for (auto& time : statistics.gateFanInTime) callback(time);
+            callback(statistics.relayTime);
+            callback(statistics.pullTime);
+            callback(statistics.communicatorTime);
+            callback(statistics.floodFillTime);
+            for (auto& count : statistics.stepTimeHistogram) callback(count);
+        }
+
+        void addSampledStep(period_t time) noexcept {
+            ++sampledSteps;
+            stepTime += time;
+            uint64_t nanos = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count(), 0);
+            size_t shift = 0;
+            while (nanos >= 8) {
+                nanos >>= 1;
+                ++shift;
+            }
+            ++stepTimeHistogram[std::min(shift * 4 + static_cast<size_t>(nanos), histogramSize - 1)];
+        }
+
+        /**
+         * Returns a time that the given fraction of the sampled steps took at most (rounded up to the end of a histogram bucket).
+         */
+        period_t percentileStepTime(double fraction) const noexcept {
+            const uint64_t target = static_cast<uint64_t>(fraction * sampledSteps);
+            uint64_t count = 0;
+            size_t i = 0;
+            while (i + 1 < histogramSize && count + stepTimeHistogram[i] <= target) {
+                count += stepTimeHistogram[i++];
+            }
+            // the end of bucket i is the start of bucket i + 1
+            const size_t end = i + 1;
+            const uint64_t nanos = end < 8 ? end : (static_cast<uint64_t>(end % 4 + 4) << (end / 4 - 1));
+            return std::chrono::duration_cast<period_t>(std::chrono::nanoseconds(nanos));
+        }
+
+        /**
+         * Writes the names of the columns written by writeCsvRow(), separated by commas.
+         * No line break is written, so that the caller can add columns of its own.
+         */
+        static void writeCsvHeader(std::ostream& out);
+
+        /**
+         * Writes these statistics as comma-separated values, with the times in nanoseconds.
+         * No line break is written, so that the caller can add columns of its own.
+         */
+        void writeCsvRow(std::ostream& out) const;
+    };
+
+    // the most changes kept by the recording, the oldest ones are dropped (i.e. folded into the levels at the start) to make space
+    constexpr static size_t maxWaveformChanges = 1 << 20;
+
+    // a condition on the level of the element at a point of the canvas, which stops the simulation at the step where it has been met count times
+    struct Breakpoint {
+        enum struct Condition : uint8_t {
+            RISING, // the level goes from low to high
+            FALLING, // the level goes from high to low
+            CHANGE, // the level changes either way
+            HIGH, // the level is high
+            LOW // the level is low
+        };
+        ext::point point;
+        Condition condition = Condition::RISING;
+        uint64_t count = 1;
+    };
+
+    /**
+     * Which node of a distributed run (see simulationcluster.hpp) evaluates the gates that drive each component, and the relay of each relay pixel.
+     * Node 0 is the coordinator, which also invokes the sources and the communicators, and does the flood fill.
+     */
+    struct NodeAssignment {
+        uint32_t numNodes = 1;
+        std::vector<uint32_t> componentNodes;
+        std::vector<uint32_t> relayPixelNodes;
+    };
+    class RemoteNodes;
+
+    /**
+     * A step function generated by writeNativeStepSource() and compiled to native code.
+     * It does the work of the sources, gates and relays for one step: it reads the component levels of the old state, and sets the component levels and the relay pixel conductivity of the new state
+     * (the arguments are the storage of the logic arrays of DynamicData, so their layout depends on CIRCUIT_SANDBOX_BIT_PACKED_STATE).
+     */
+    using NativeStepFunction = void (*)(const void* oldComponentLogicLevels, void* newComponentLogicLevels, void* newRelayPixelIsConductive);
+
+    // one bit for each of the instances that are simulated together in multi-instance mode (see calculateLanes())
+    using lane_t = uint64_t;
+    constexpr static size_t laneCount = std::numeric_limits<lane_t>::digits;
+
+    /**
+     * The state of laneCount independent instances of the compiled circuit, where bit i of every word belongs to instance i.
+     * The words have the same indices as the bits of DynamicData.
+     */
+    struct LaneState {
+        std::vector<lane_t> componentLogicLevels;
+        std::vector<lane_t> relayPixelLogicLevels;
+        std::vector<lane_t> relayPixelIsConductive;
+        std::vector<lane_t> communicatorTransmitStates;
+
+        // scratch space of calculateLanes(), kept here so that a step allocates nothing
+        std::vector<int32_t> worklist;
+        std::vector<char> queued; // one for each component and then each relay pixel, all false between steps
+    };
+
 private:
+#if CIRCUIT_SANDBOX_BIT_PACKED_STATE
+    using logic_array_t = ext::bit_array;
+#else
+    using logic_array_t = ext::bool_array;
+#endif
     template <typename T>
     struct SizedArray {
         T* data;
@@ -58,6 +277,7 @@ private:
             data = other.data;
             size = other.size;
             other.size = 0;
+            return *this;
         }
         ~SizedArray() noexcept {
             if (size > 0) {
@@ -99,9 +319,18 @@ private:
         const T& operator[](size_t size) const noexcept {
             return data[size];
         }
+        size_t bytes() const noexcept {
+            return size * sizeof(T);
+        }
     };
     struct DynamicData;
     struct StaticData;
+    /**
+     * Combines inputLevel(0), ..., inputLevel(NumInputs - 1) with AND (or OR), and inverts the result if required.
+     * The fold expression is expanded separately for every gate type and number of inputs, so each of them gets its own branchless kernel.
+     */
+    template <bool Conjunctive, bool Inverted, typename InputLevel, size_t... Indices>
+    static inline bool combineInputs(const InputLevel& inputLevel, std::index_sequence<Indices...>) noexcept;
     struct SimulatorSource {
         int32_t outputComponent;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
@@ -110,33 +339,90 @@ private:
     struct SimulatorLogicGate {
         std::array<int32_t, NumInputs> inputComponents;
         int32_t outputComponent;
+        constexpr static size_t numInputs = NumInputs;
     };
     template <size_t NumInputs>
     struct SimulatorAndGate : public SimulatorLogicGate<NumInputs> {
+        // whether the inputs are combined with AND (instead of OR), and whether the result is inverted
+        constexpr static bool conjunctive = true, inverted = false;
+        // the output of this gate given the previous state
+        inline bool evaluate(const DynamicData& oldData) const noexcept;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
     };
     template <size_t NumInputs>
     struct SimulatorOrGate : public SimulatorLogicGate<NumInputs> {
+        // whether the inputs are combined with AND (instead of OR), and whether the result is inverted
+        constexpr static bool conjunctive = false, inverted = false;
+        // the output of this gate given the previous state
+        inline bool evaluate(const DynamicData& oldData) const noexcept;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
     };
     template <size_t NumInputs>
     struct SimulatorNandGate : public SimulatorLogicGate<NumInputs> {
+        // whether the inputs are combined with AND (instead of OR), and whether the result is inverted
+        constexpr static bool conjunctive = true, inverted = true;
+        // the output of this gate given the previous state
+        inline bool evaluate(const DynamicData& oldData) const noexcept;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
     };
     template <size_t NumInputs>
     struct SimulatorNorGate : public SimulatorLogicGate<NumInputs> {
+        // whether the inputs are combined with AND (instead of OR), and whether the result is inverted
+        constexpr static bool conjunctive = false, inverted = true;
+        // the output of this gate given the previous state
+        inline bool evaluate(const DynamicData& oldData) const noexcept;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
     };
+    // structure-of-arrays copy of a SizedArray of gates, in the same order, so that the kernels can load the inputs of many gates at once
+    template <typename Gate>
+    struct GateColumns {
+        // inputs[k][i] is input k of gate i
+        std::array<SizedArray<int32_t>, Gate::numInputs> inputs;
+        SizedArray<int32_t> outputs;
+        void update(const SizedArray<Gate>& gates) {
+            for (size_t k = 0; k != Gate::numInputs; ++k) {
+                inputs[k].resize(gates.size);
+                for (size_t i = 0; i != gates.size; ++i) {
+                    inputs[k][i] = gates[i].inputComponents[k];
+                }
+            }
+            outputs.resize(gates.size);
+            for (size_t i = 0; i != gates.size; ++i) {
+                outputs[i] = gates[i].outputComponent;
+            }
+        }
+        size_t bytes() const noexcept {
+            size_t total = outputs.bytes();
+            for (const SizedArray<int32_t>& input : inputs) total += input.bytes();
+            return total;
+        }
+    };
     template <template <size_t> typename Gate>
     struct GatePack {
-        std::tuple<SizedArray<Gate<0>>, SizedArray<Gate<1>>, SizedArray<Gate<2>>, SizedArray<Gate<3>>, SizedArray<Gate<4>>> data;
+        typename FanInTuple<SizedArray, Gate>::type data;
+        // filled in by Simulator::compile() from data
+        typename FanInTuple<GateColumns, Gate>::type columns;
         template <typename Callback>
         void forEach(Callback callback) const noexcept {
-            callback(std::get<0>(data));
-            callback(std::get<1>(data));
-            callback(std::get<2>(data));
-            callback(std::get<3>(data));
-            callback(std::get<4>(data));
+            std::apply([&](const auto&... arrays) {
+                (callback(arrays), ...);
+            }, data);
+        }
+        template <typename Callback>
+        void forEachColumns(Callback callback) const noexcept {
+            std::apply([&](const auto&... arrays) {
+                (callback(arrays), ...);
+            }, columns);
+        }
+        size_t bytes() const noexcept {
+            size_t total = 0;
+            forEach([&](const auto& array) {
+                total += array.bytes();
+            });
+            forEachColumns([&](const auto& array) {
+                total += array.bytes();
+            });
+            return total;
         }
     };
     struct Gates {
@@ -151,6 +437,13 @@ private:
             callback(nandGate);
             callback(norGate);
         }
+        size_t bytes() const noexcept {
+            size_t total = 0;
+            forEach([&](const auto& pack) {
+                total += pack.bytes();
+            });
+            return total;
+        }
     };
     template <size_t NumInputs>
     struct SimulatorRelay {
@@ -159,22 +452,35 @@ private:
     };
     template <size_t NumInputs>
     struct SimulatorPositiveRelay : public SimulatorRelay<NumInputs> {
+        // whether the inputs are combined with AND (instead of OR), and whether the result is inverted
+        constexpr static bool conjunctive = false, inverted = false;
+        // whether this relay is conductive given the previous state
+        inline bool evaluate(const DynamicData& oldData) const noexcept;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
     };
     template <size_t NumInputs>
     struct SimulatorNegativeRelay : public SimulatorRelay<NumInputs> {
+        // whether the inputs are combined with AND (instead of OR), and whether the result is inverted
+        constexpr static bool conjunctive = true, inverted = true;
+        // whether this relay is conductive given the previous state
+        inline bool evaluate(const DynamicData& oldData) const noexcept;
         inline void operator()(const DynamicData& oldData, DynamicData& newData) const noexcept;
     };
     template <template <size_t> typename Relay>
     struct RelayPack {
-        std::tuple<SizedArray<Relay<0>>, SizedArray<Relay<1>>, SizedArray<Relay<2>>, SizedArray<Relay<3>>, SizedArray<Relay<4>>> data;
+        typename FanInTuple<SizedArray, Relay>::type data;
         template <typename Callback>
         void forEach(Callback callback) const noexcept {
-            callback(std::get<0>(data));
-            callback(std::get<1>(data));
-            callback(std::get<2>(data));
-            callback(std::get<3>(data));
-            callback(std::get<4>(data));
+            std::apply([&](const auto&... arrays) {
+                (callback(arrays), ...);
+            }, data);
+        }
+        size_t bytes() const noexcept {
+            size_t total = 0;
+            forEach([&](const auto& array) {
+                total += array.bytes();
+            });
+            return total;
         }
     };
     struct Relays {
@@ -185,16 +491,24 @@ private:
             callback(positiveRelay);
             callback(negativeRelay);
         }
+        size_t bytes() const noexcept {
+            return positiveRelay.bytes() + negativeRelay.bytes();
+        }
     };
     struct SimulatorCommunicator {
-        std::vector<int32_t> inputComponents;
+        // the input components are communicatorInputList[inputComponentsBegin, inputComponentsEnd) of the static data
+        int32_t inputComponentsBegin;
+        int32_t inputComponentsEnd;
         int32_t outputComponent;
         Communicator* communicator;
-        inline void operator()(const DynamicData& oldData, DynamicData& newData, bool& transmitOutput) const noexcept;
+        inline void operator()(const StaticData& staticData, const DynamicData& oldData, DynamicData& newData, int32_t communicatorIndex) const noexcept;
+        // transmits to the communicator (and sets its transmit state in newData), and returns what it receives, without setting the output component
+        inline bool exchange(const StaticData& staticData, const DynamicData& oldData, DynamicData& newData, int32_t communicatorIndex) const noexcept;
     };
     struct RelayPixel {
-        std::array<int32_t, 4> adjComponents;
-        uint8_t numAdjComponents;
+        // the adjacent components are adjRelayPixelList[adjComponentsBegin, adjComponentsEnd) of the static data
+        int32_t adjComponentsBegin;
+        int32_t adjComponentsEnd;
     };
     struct Component {
         int32_t adjRelayPixelsBegin;
@@ -215,8 +529,10 @@ private:
 
         // data about communicators
         SizedArray<SimulatorCommunicator> communicators;
+        // input components of all the communicators
+        SizedArray<int32_t> communicatorInputList;
 
-        int32_t screenCommunicatorStartIndex, screenCommunicatorEndIndex;
+        int32_t screenCommunicatorStartIndex = 0, screenCommunicatorEndIndex = 0;
 
         // list of components
         SizedArray<Component> components;
@@ -224,6 +540,20 @@ private:
         SizedArray<RelayPixel> relayPixels;
         // adj component list
         SizedArray<int32_t> adjComponentList;
+        // adj relay pixel list (the components next to each relay pixel)
+        SizedArray<int32_t> adjRelayPixelList;
+        // whether each component was spawned between two adjacent relays (such components have no pixels)
+        std::vector<bool> relayLinkComponents;
+        // component and relay pixel indices that were released by incremental compilation and are not used by anything
+        std::vector<int32_t> freeComponents;
+        std::vector<int32_t> freeRelayPixels;
+
+        // the gates and relays that were taken out by Simulator::foldConstants(), and the number of sources it added at the end of sources
+        // (Simulator::unfoldConstants() puts everything back, so that incremental compilation sees every element of the canvas)
+        bool constantsFolded = false;
+        Gates foldedGates;
+        Relays foldedRelays;
+        int32_t numFoldedSources = 0;
 
         struct DisplayedPixel {
             enum struct PixelType : unsigned char {
@@ -232,6 +562,7 @@ private:
                 RELAY,
                 COMMUNICATOR
             } type;
+            uint8_t elementIndex; // index of the element in CanvasState::element_variant_t (so that the live view can be rendered without looking at the canvas)
             int32_t index[2]; // index[1] used only if it is an insulated wire with two directions
             inline bool logicLevel(const DynamicData&) const noexcept;
         };
@@ -239,21 +570,48 @@ private:
         // state mapping
         ext::heap_matrix<DisplayedPixel> pixels;
 
+        // bounding rectangle [topLeft, bottomRight) of the pixels that display each component and relay pixel, so that the UI can find the parts of the canvas that changed between two states
+        // only the UI needs them, so they are computed on demand by Simulator::computeDisplayBounds()
+        struct DisplayBounds {
+            ext::point topLeft = ext::point::max();
+            ext::point bottomRight = ext::point::min();
+        };
+        bool displayBoundsValid = false;
+        SizedArray<DisplayBounds> componentBounds;
+        SizedArray<DisplayBounds> relayPixelBounds;
+
+        // partitions for evaluating the gates and relays on multiple threads (filled in by Simulator::computePartitions())
+        // partition i owns the outputs in [componentPartitionBounds[i], componentPartitionBounds[i + 1]) and [relayPixelPartitionBounds[i], relayPixelPartitionBounds[i + 1]).
+        // the bounds are aligned to partitionGranularity, so no two partitions write to the same word (or cache line) of the DynamicData.
+        // the gates and relays in each SizedArray are sorted by their output, so each partition is a contiguous range of every SizedArray.
+        // there are no bounds when there is only one partition.
+        SizedArray<int32_t> componentPartitionBounds;
+        SizedArray<int32_t> relayPixelPartitionBounds;
+
         // sizes
         /*int32_t numComponents;
         int32_t numRelayPixels;*/
+
+        // number of bytes used by all the arrays above
+        size_t bytes() const noexcept {
+            return sizeof(StaticData) + sources.bytes() + logicGates.bytes() + relays.bytes() + communicators.bytes() + communicatorInputList.bytes() +
+                components.bytes() + relayPixels.bytes() + adjComponentList.bytes() + adjRelayPixelList.bytes() +
+                relayLinkComponents.capacity() / CHAR_BIT + (freeComponents.capacity() + freeRelayPixels.capacity()) * sizeof(int32_t) +
+                foldedGates.bytes() + foldedRelays.bytes() + pixels.bytes() + componentBounds.bytes() + relayPixelBounds.bytes() +
+                componentPartitionBounds.bytes() + relayPixelPartitionBounds.bytes();
+        }
     };
     struct DynamicData {
         // for things that change at every simulation step
 
         // array of logic level of each connected component
-        std::unique_ptr<bool[]> componentLogicLevels;
+        logic_array_t componentLogicLevels;
         // array of logic level of each relay pixel
-        std::unique_ptr<bool[]> relayPixelLogicLevels;
+        logic_array_t relayPixelLogicLevels;
         // array of whether each relay pixel is conductive
-        std::unique_ptr<bool[]> relayPixelIsConductive;
+        logic_array_t relayPixelIsConductive;
         // array of whether each communicator is transmitting at HIGH
-        std::unique_ptr<bool[]> communicatorTransmitStates;
+        logic_array_t communicatorTransmitStates;
 
 
         DynamicData() = delete;
@@ -261,15 +619,26 @@ private:
         DynamicData& operator=(const DynamicData&) = delete;
         DynamicData(DynamicData&&) = default;
         DynamicData& operator=(DynamicData&&) = default;
-        DynamicData(int32_t numComponents, int32_t numRelayPixels, int32_t numCommunicators) {
-            componentLogicLevels = std::make_unique<bool[]>(numComponents);
-            std::fill_n(componentLogicLevels.get(), numComponents, false);
-            relayPixelLogicLevels = std::make_unique<bool[]>(numRelayPixels);
-            std::fill_n(relayPixelLogicLevels.get(), numRelayPixels, false);
-            relayPixelIsConductive = std::make_unique<bool[]>(numRelayPixels);
-            std::fill_n(relayPixelIsConductive.get(), numRelayPixels, false);
-            communicatorTransmitStates = std::make_unique<bool[]>(numCommunicators);
-            std::fill_n(communicatorTransmitStates.get(), numCommunicators, false);
+        // sets everything to false
+        DynamicData(int32_t numComponents, int32_t numRelayPixels, int32_t numCommunicators) :
+            componentLogicLevels(numComponents), relayPixelLogicLevels(numRelayPixels), relayPixelIsConductive(numRelayPixels), communicatorTransmitStates(numCommunicators) {}
+
+        // sets everything to false, so that a recycled buffer can be reused for a new step
+        void clear() noexcept {
+            componentLogicLevels.clear();
+            relayPixelLogicLevels.clear();
+            relayPixelIsConductive.clear();
+            communicatorTransmitStates.clear();
+        }
+
+        // number of bytes used by the arrays
+        size_t bytes() const noexcept {
+            return sizeof(DynamicData) + componentLogicLevels.bytes() + relayPixelLogicLevels.bytes() + relayPixelIsConductive.bytes() + communicatorTransmitStates.bytes();
+        }
+
+        // whether the two states are the same, i.e. whether a step from one to the other changed nothing
+        friend bool operator==(const DynamicData& a, const DynamicData& b) noexcept {
+            return a.componentLogicLevels == b.componentLogicLevels && a.relayPixelLogicLevels == b.relayPixelLogicLevels && a.relayPixelIsConductive == b.relayPixelIsConductive && a.communicatorTransmitStates == b.communicatorTransmitStates;
         }
     };
     /*struct CommunicatorInput {
@@ -283,10 +652,259 @@ private:
     friend struct CompilerGates;
     friend struct CompilerRelays;
     friend struct CompilerStaticData;
+    friend class ClusterCoordinator;
+    friend class ClusterNode;
+    friend class Netlist;
+    friend class EngineValidator;
+    friend class StaticDataCache;
+    friend class Checkpoint;
 
     // The thread on which the simulation will run.
     std::thread simThread;
 
+    // Extra threads that help the simulation thread evaluate the gates and relays (nullptr if we only use the simulation thread).
+    // By default this is a pool of our own with one thread per core, so that a step never waits behind another submitter's batch.
+    std::shared_ptr<ext::thread_pool> workerPool;
+
+    // number of outputs (components or relay pixels) that partitions are aligned to, so that they don't share cache lines
+    constexpr static int32_t partitionGranularity = 512;
+    // smallest number of gates and relays worth giving a thread by itself
+    constexpr static size_t minElementsPerPartition = 4096;
+    // fraction of the cost of a partition that its end may move by, to land where fewer gates read inputs from the next partition
+    constexpr static size_t partitionCutSlackDivisor = 4;
+    // number of partitions per thread (more than one so that uneven partitions get balanced out between threads)
+    constexpr static size_t partitionsPerThread = 4;
+    // number of bands of rows per thread that the canvas is split into for compilation, and the smallest number of rows worth giving a band
+    constexpr static size_t compileBandsPerThread = 4;
+    constexpr static int32_t minRowsPerCompileBand = 32;
+
+    // the algorithm used by propagate()
+    FloodFillEngine floodFillEngine = FloodFillEngine::DEPTH_FIRST;
+
+    // the way calculate() evaluates the gates and relays
+    SimulationEngine simulationEngine = SimulationEngine::FULL;
+
+    // the step function compiled from writeNativeStepSource() for the current static data, or nullptr to interpret the static data
+    // reset whenever the static data changes
+    NativeStepFunction nativeStep = nullptr;
+
+    // the nodes that evaluate the gates and relays taken out by restrictToNode(), or nullptr if everything is evaluated here
+    // reset whenever the static data changes
+    RemoteNodes* remoteNodes = nullptr;
+
+    // state kept between steps by the event-driven engine
+    // gates and relays are numbered in the order in which Gates::forEach() and Relays::forEach() visit them, with the relays after all the gates
+    // only accessed by calculate(), or by the UI thread when the simulation is stopped
+    struct EventDrivenData {
+        // false if it needs to be rebuilt from scratch before the next step (e.g. after compilation)
+        bool valid = false;
+        // false while the steps are too busy for the event-driven engine, so they are calculated by the full engine, and the outputs below are out of date
+        bool synced = false;
+        int32_t numGates;
+        // the gates and relays that each component is an input to, i.e. fanout[fanoutBegin[i]] to fanout[fanoutBegin[i + 1]] (exclusive) for component i
+        SizedArray<int32_t> fanoutBegin;
+        SizedArray<int32_t> fanout;
+        // last evaluated output of each gate and relay
+        logic_array_t outputs;
+        // gates and relays that need to be re-evaluated, walked in order of their numbers
+        logic_array_t dirty;
+        // number of sources and gates that are currently driving each component
+        std::unique_ptr<int32_t[]> driveCounts;
+        // whether each component has a nonzero drive count (i.e. the component logic levels before communicators and flood fill)
+        logic_array_t driven;
+        // the components whose driven level changed in the last step, so their fanouts are re-evaluated in the next step
+        std::vector<int32_t> toggled;
+        // whether each relay pixel is conductive (i.e. the output of its relay)
+        logic_array_t conductive;
+        // the blocks of eventDrivenBlockSize components that hold a component which the communicators or the flood fill can turn on
+        // a component outside these blocks is only ever at its driven level, so its changes are all in toggled; the ones inside are found by comparing the levels with lastLevels
+        std::vector<int32_t> externalBlocks;
+        // the component logic levels that the outputs were evaluated with (only kept in externalBlocks, except while not synced)
+        logic_array_t lastLevels;
+    };
+    // number of components in each block of EventDrivenData::externalBlocks (one word of the bit-packed levels)
+    constexpr static int32_t eventDrivenBlockSize = 64;
+    // a step is handed to the full engine if more than one in this many gates and relays would be re-evaluated, since the full engine evaluates them much faster per gate
+    constexpr static size_t eventDrivenMaxDirtyShare = 4;
+    // and the event-driven engine takes over again once fewer than one in this many components changed in a step
+    constexpr static size_t eventDrivenResumeShare = 16;
+    EventDrivenData eventDrivenData;
+
+    // worklist for the depth-first flood fill, with room for every component and relay pixel (each of them is pushed at most once)
+    // components are stored as their index, and relay pixels as their index plus the number of components
+    // allocated by compile() so that floodFill() never allocates
+    std::unique_ptr<int32_t[]> floodFillWorklist;
+    // largest number of entries in the worklist during the most recent flood fill, and during any flood fill since compilation
+    std::atomic<size_t> floodFillPeakDepth = 0;
+    std::atomic<size_t> floodFillMaxPeakDepth = 0;
+
+    // state kept between steps by the grouped flood fill engine
+    // a group is a set of nodes (numbered like in floodFillWorklist) connected through conductive relay pixels, so everything in a group is on if any of its components is on
+    // a relay pixel that is not conductive is in a group by itself; group ids are node indices, since there are never more groups than nodes
+    // only accessed by propagate()
+    struct GroupedFloodFillData {
+        // false if the groups need to be rebuilt from scratch before the next flood fill (e.g. after compilation)
+        bool valid = false;
+        // the conductive states of the relay pixels that the groups are of
+        logic_array_t conductive;
+        // the group of each node, and the next node in the same group (-1 at the end of the group)
+        std::unique_ptr<int32_t[]> groupOf;
+        std::unique_ptr<int32_t[]> nextInGroup;
+        // the first node and the number of nodes of each group (-1 and 0 if the group id is unused)
+        std::unique_ptr<int32_t[]> groupHead;
+        std::unique_ptr<int32_t[]> groupSize;
+        // stack of unused group ids
+        std::unique_ptr<int32_t[]> freeGroups;
+        int32_t numFreeGroups;
+        // the nodes of the groups that are split up by relay pixels that stopped conducting
+        std::unique_ptr<int32_t[]> regroupNodes;
+        // whether each group has a component that is on, and the list of those groups (only used within a flood fill, and left all false)
+        std::unique_ptr<bool[]> groupOn;
+        std::unique_ptr<int32_t[]> onGroups;
+    };
+    GroupedFloodFillData groupedFloodFillData;
+
+    // statistics collection: pendingStatistics is only accessed by the thread that calculates the steps, which adds it to publishedStatistics every statisticsFlushInterval
+    // publishedStatistics holds the counters of StepStatistics (in the order of StepStatistics::forEachCounter()) since the simulator was created, so that takeStepStatistics() can read them without locking
+    std::atomic<bool> collectStatistics = false;
+    std::atomic<uint32_t> statisticsSampleInterval = 1;
+    uint32_t statisticsSampleCountdown = 1; // steps until the next timed step (only accessed by the thread that calculates the steps)
+    StepStatistics pendingStatistics;
+    std::chrono::steady_clock::time_point lastStatisticsFlush;
+    std::array<std::atomic<uint64_t>, StepStatistics::counterCount> publishedStatistics{};
+    std::array<uint64_t, StepStatistics::counterCount> takenStatistics{}; // the counters when takeStepStatistics() was last called
+    constexpr static std::chrono::milliseconds statisticsFlushInterval{ 100 };
+
+    /**
+     * Adds the pending statistics to where takeStepStatistics() can see them.
+     */
+    void flushStatistics();
+
+    // activity counting (for the heatmap): the number of times each component changed its logic level, and each relay pixel changed whether it is conductive, since the counts were reset
+    // the counts are allocated by prepareEngines(), incremented by the thread that calculates the steps, and read by the UI thread
+    std::atomic<bool> collectActivity = false;
+    std::unique_ptr<std::atomic<uint32_t>[]> componentActivity;
+    std::unique_ptr<std::atomic<uint32_t>[]> relayPixelActivity;
+
+    /**
+     * Adds the changes from oldState to newState to the activity counts.
+     */
+    void countActivity(const DynamicData& oldState, const DynamicData& newState) noexcept;
+
+    /**
+     * Whether the circuit has settled at newState, the step after oldState, so that the steps after it are unobservable and may be skipped.
+     * A step is unobservable when it would calculate the same state and have no effect that any other thread can see, i.e. when all of these hold:
+     * - newState is the same as oldState, so the gates, relays and flood fill would calculate newState again (they only read the previous state and what the communicators receive)
+     * - no screen communicator events are queued, and no entries of a replayed input log are left, so the communicators would receive the same levels again
+     * - every communicator is idle (see Communicator::idle()), so none of them would receive anything new or send anything
+     * - no new probes or breakpoints are waiting to be picked up, since only the steps pick them up (see flushProbes() and checkBreakpoints())
+     * - no HIGH or LOW breakpoint is met by newState, since those count down at every step until they are reached (edge breakpoints need a change, so they are never met)
+     * The probe recording, the activity counts and the remote nodes only see changes, so skipping the steps loses nothing there, and the step statistics only count the steps that were calculated.
+     * Anything else that a step does on its own must be checked here too, or it would be silently skipped.
+     * Only the last step of each wakeup (and every fastForwardPublishSteps steps while fast-forwarding) is checked, so that the comparison doesn't slow down the other steps.
+     * Must be invoked from the thread that calculates the steps.
+     */
+    bool settled(const DynamicData& oldState, const DynamicData& newState) const noexcept;
+
+    /**
+     * Whether the simulator thread should stop sleeping on a settled circuit (see settled()).
+     * Must be invoked with simSleepMutex held.
+     */
+    bool settledSleepInterrupted() const noexcept {
+        return simStopping.load(std::memory_order_relaxed) || !skipSettledSteps.load(std::memory_order_relaxed) || screenInputQueue.available() != 0 ||
+            probesChanged.load(std::memory_order_relaxed) || breakpointsChanged.load(std::memory_order_relaxed);
+    }
+
+    // the probes (see setProbes()), in canvas coordinates, and the pixel that each of them reads in the static data
+    // only accessed by the UI thread (probeMutex is only needed to hand them to the thread that calculates the steps)
+    std::vector<ext::point> probePoints;
+    std::vector<StaticData::DisplayedPixel> probePixels;
+    // the recording, guarded by probeMutex
+    // the thread that calculates the steps picks up new probes (when probesChanged is set) and appends its changes once in a while, in flushProbes()
+    std::mutex probeMutex;
+    std::atomic<bool> probesChanged = false;
+    std::vector<StaticData::DisplayedPixel> pendingProbePixels;
+    uint64_t waveformStartStep = 0;
+    std::vector<bool> waveformStartLevels;
+    std::deque<Waveform::Change> waveformChanges;
+    uint64_t waveformEndStep = 0;
+    // the probes and their levels as seen by the thread that calculates the steps, and the changes that it has not handed over yet
+    std::vector<StaticData::DisplayedPixel> recordedProbePixels;
+    std::vector<bool> recordedProbeLevels;
+    std::vector<Waveform::Change> probeChangeBuffer;
+    // number of changes that are buffered before they are handed over even if no state is published
+    constexpr static size_t probeChangeBufferSize = 4096;
+
+    /**
+     * Looks up the pixels of probePoints in the static data, and has the recording restarted by the thread that calculates the steps.
+     * Must be invoked from the UI thread.
+     */
+    void resolveProbes();
+
+    /**
+     * Appends the changes of the probes in the new state to probeChangeBuffer.
+     * Must be invoked from the thread that calculates the steps.
+     */
+    void recordProbes(const DynamicData& newState);
+
+    /**
+     * Hands the buffered changes to the recording, and picks up new probes (starting from the given state).
+     * Must be invoked from the thread that calculates the steps.
+     */
+    void flushProbes(const DynamicData& state);
+
+    // the breakpoints (see setBreakpoints()), only accessed by the UI thread
+    std::vector<Breakpoint> breakpoints;
+    // a breakpoint with the pixel that it reads in the static data, and the number of times its condition still has to be met
+    struct ArmedBreakpoint {
+        Breakpoint breakpoint;
+        StaticData::DisplayedPixel pixel;
+        uint64_t remaining;
+    };
+    // the breakpoints handed to the thread that calculates the steps (guarded by breakpointMutex), which picks them up when breakpointsChanged is set
+    std::mutex breakpointMutex;
+    std::atomic<bool> breakpointsChanged = false;
+    std::vector<ArmedBreakpoint> pendingBreakpoints;
+    // the breakpoints checked by the thread that calculates the steps
+    std::vector<ArmedBreakpoint> armedBreakpoints;
+    // set by the simulator thread when it ends at a breakpoint, which it leaves in reachedBreakpoint (cleared when the simulator is started)
+    std::atomic<bool> breakpointReachedFlag = false;
+    Breakpoint reachedBreakpoint;
+
+    /**
+     * Looks up the pixels of the breakpoints in the static data, and has them re-armed by the thread that calculates the steps.
+     * Must be invoked from the UI thread.
+     */
+    void resolveBreakpoints();
+
+    /**
+     * Checks the breakpoints on the step from oldState to newState, and returns true if one of them was reached (leaving it in reachedBreakpoint).
+     * New breakpoints are picked up first.
+     * Must be invoked from the simulator thread.
+     */
+    bool checkBreakpoints(const DynamicData& oldState, const DynamicData& newState) noexcept;
+
+    /**
+     * Gets the pixel at the given point of the static data (an empty one outside the canvas).
+     */
+    StaticData::DisplayedPixel pixelAt(ext::point pt) const noexcept {
+        return staticData.pixels.contains(pt) ? staticData.pixels[pt] : StaticData::DisplayedPixel{ StaticData::DisplayedPixel::PixelType::EMPTY, 0, { -1, -1 } };
+    }
+
+    // the level that a probe reads from the given state
+    static bool probeLevel(const StaticData::DisplayedPixel& pixel, const DynamicData& state) noexcept {
+        return pixel.type != StaticData::DisplayedPixel::PixelType::EMPTY && pixel.logicLevel(state);
+    }
+
+    // scratch space for the parallel flood fill, only accessed by propagate()
+    // the components that were on before the fill (the starting points of the searches), reallocated when the number of components changes
+    logic_array_t parallelFloodFillSeeds;
+    // the worklist of each task (numbered like floodFillWorklist), which keeps its capacity from step to step, and its peak depth in the last fill
+    std::vector<std::vector<int32_t>> parallelFloodFillWorklists;
+    std::vector<size_t> parallelFloodFillPeakDepths;
+    // number of tasks of the parallel flood fill for each thread of the worker pool, so that the threads stay busy even if some searches are much larger than the others
+    constexpr static size_t parallelFloodFillTasksPerThread = 4;
+
     // the static data
     StaticData staticData;
 
@@ -295,10 +913,21 @@ private:
     // prepared and initialized by Simulator::compile()
     //CommunicatorReceivedData communicatorReceivedData;
 
-    // The last CanvasState that is completely calculated.  This object might be accessed by the UI thread (for rendering purposes), but is updated (atomically) by the simulation thread.
-    std::shared_ptr<DynamicData> latestCompleteState; // note: in C++20 this should be changed to std::atomic<std::shared_ptr<CanvasState>>.
+    // The last state that is completely calculated and published.  Only accessed by the thread that calculates the steps (the simulator thread while it is running, the UI thread otherwise).
+    std::shared_ptr<DynamicData> latestCompleteState;
+    // latestCompleteState as seen by the UI thread (for rendering purposes); every change to latestCompleteState is published here too (see setLatestCompleteState())
+    // it is a triple buffer rather than an atomically loaded shared_ptr, since those take a lock (shared with all other atomic shared_ptrs) on every load and store
+    ext::triple_buffer<std::shared_ptr<DynamicData>> publishedState;
     std::atomic<bool> simStopping; // flag for the UI thread to tell the simulation thread to stop.
 
+    // recycled DynamicData buffers, so that we don't allocate a new one at every step.
+    // usually there are four or five: one published as latestCompleteState, one still held by the UI thread (e.g. in takeSnapshot, or in the reader's slot of publishedState), one held by the UI as the last state it rendered (see LiveState), and one being written by the simulator.
+    // a few more may be held by the published viewports (see ViewportData).
+    // only accessed by the simulator thread, or by the UI thread when the simulation is stopped.
+    std::vector<std::shared_ptr<DynamicData>> dynamicDataPool;
+    // total bytes of the buffers in dynamicDataPool, so that the UI thread can read it while the simulation is running (see getDynamicDataMemoryUsage())
+    std::atomic<size_t> dynamicDataPoolBytes = 0;
+
     // synchronization stuff to wake the simulator thread if its sleeping
     std::mutex simSleepMutex;
     std::condition_variable simSleepCV;
@@ -306,9 +935,117 @@ private:
     // minimum time between successive simulation steps (zero = as fast as possible)
     std::atomic<period_t::rep> period_rep; // it is stored using the underlying integer type so that we can use atomics
     std::chrono::steady_clock::time_point nextStepTime; // next time the simulator will be stepped
+    // how far the simulator thread may fall behind nextStepTime and still catch up by calculating the late steps without sleeping
+    // wakeups from the OS can be late by more than a short period (up to about 15ms on Windows), so catching up keeps the average rate on target; beyond this the late steps are given up on
+    constexpr static std::chrono::milliseconds maxScheduleLag{ 50 };
+    // when the simulator thread was last started by start(), and the step number then, for getAchievedStepRate() (only accessed by the UI thread)
+    std::chrono::steady_clock::time_point runStartTime;
+    uint64_t runStartStepNumber = 0;
+    double lastRunStepRate = 0.0; // the rate achieved by the last run, measured by stop()
+
+    // number of steps calculated back-to-back before the simulator thread publishes a state and sleeps (at least 1)
+    // communicators are still invoked at every step, so they see every tick
+    std::atomic<size_t> stepsPerWakeup = 1;
+    // minimum time between successive states published to latestCompleteState (zero = publish after every wakeup)
+    // usually set to the display frame time, since takeSnapshot() can only observe one state per frame anyway
+    std::atomic<period_t::rep> publish_interval_rep = 0;
+    // the last part of each sleep that the simulator thread busy-waits for instead of waiting on simSleepCV (zero = never busy-wait)
+    // waking up from the condition variable can take longer than a short period, so busy-waiting keeps the steps of a fast clock evenly spaced
+    std::atomic<period_t::rep> spin_rep = 0;
+    // whether the simulator thread sleeps once the circuit has settled (see settled()), instead of calculating steps that change nothing, until something interrupts it (see settledSleepInterrupted())
+    // it is checked at the last step of each wakeup, and every fastForwardPublishSteps steps while fast-forwarding
+    std::atomic<bool> skipSettledSteps = true;
+
+    // the core that the simulator thread is pinned to (-1 = any core), and whether it asks the OS for a higher priority than the other threads
+    // applied by the simulator thread when it starts (see applySimThreadScheduling())
+    int32_t simThreadCore = -1;
+    bool simThreadHighPriority = false;
+
+    // the displayed pixels of the part of the canvas that the UI is showing, computed by the simulator thread from each published state (if the UI asked for one since the last publication)
+    // so that while the simulation is running, the UI does not have to look up the static and dynamic data for every pixel it draws
+    struct ViewportData {
+        std::shared_ptr<DynamicData> dynamicData; // the published state that the pixels were read from
+        ext::point topLeft;
+        ext::point bottomRight;
+        std::vector<uint8_t> pixels; // the viewportPixelCode of each pixel in [topLeft, bottomRight), in row-major order
+    };
+    // viewport pixel codes are (elementIndex << 1) | level, except for communicators, which are (elementIndex << 1) | viewportCommunicatorBit (their transmit state is read by the UI thread, because only the canvas knows which communicator each pixel belongs to)
+    constexpr static uint8_t viewportCommunicatorBit = 0x80;
+    // smallest number of rows of a viewport that publishState() gives to a worker thread at a time
+    constexpr static size_t viewportBandRows = 16;
+    ext::triple_buffer<std::shared_ptr<ViewportData>> latestViewport; // published by the simulator thread, cleared by the UI thread when the simulator is stopped
+    std::vector<std::shared_ptr<ViewportData>> viewportPool; // recycled viewport buffers (same rules as dynamicDataPool)
+    // the viewport that the UI asked for, guarded by viewportMutex
+    std::mutex viewportMutex;
+    ext::point requestedViewportTopLeft;
+    ext::point requestedViewportBottomRight;
+    std::atomic<bool> viewportRequested = false; // whether the UI wants a new viewport since the last one was computed
 
-    // screen communicator input queue
-    ext::concurrent_queue<ScreenInputCommunicatorEvent> screenInputQueue;
+    // fast-forward state (fastForwardTarget is zero if the simulator thread is not fast-forwarding)
+    // fastForwardTarget is only accessed by the UI thread, the others are written by the simulator thread
+    uint64_t fastForwardTarget = 0;
+    std::atomic<uint64_t> fastForwardStepsDone = 0;
+    std::atomic<bool> fastForwardCompleted = false;
+    // number of steps between states published while fast-forwarding (so that the UI can show the progress)
+    constexpr static uint64_t fastForwardPublishSteps = 1024;
+
+    // screen communicator input queue (pushed by the UI thread, drained at every step into the ring of each screen communicator)
+    // each event carries up to 64 levels, so bursts move in bulk; an event that does not fit in its ring waits in the queue until the levels before it are received
+    // it has a fixed size, so that nothing is allocated when clicking; if the simulator is stopped for long enough to fill it, further events are dropped
+    constexpr static size_t screenInputQueueSize = 1024;
+    ext::concurrent_fixed_queue<ScreenInputCommunicatorEvent, screenInputQueueSize> screenInputQueue;
+    // number of levels that each screen communicator can hold before they are received (see ScreenCommunicator::setInputDepth())
+    size_t screenInputDepth = ScreenCommunicator::DEFAULT_INPUT_DEPTH;
+
+    // the log of received levels being recorded or replayed (see startRecordingInputs() and startReplayingInputs())
+    // only accessed by the simulator thread, or by the UI thread when the simulation is stopped
+    enum class InputLogMode : uint8_t { NONE, RECORDING, REPLAYING };
+    InputLogMode inputLogMode = InputLogMode::NONE;
+    InputLog inputLog;
+    size_t inputLogPosition = 0; // the next entry to replay
+    uint64_t inputLogStartStep = 0; // the step number at which the recording or replay started
+    std::vector<bool> inputLogLevels; // the level that each communicator last received (when recording) or was given (when replaying)
+    // number of steps calculated since the last compile (only written by the thread that calculates the steps)
+    std::atomic<uint64_t> stepNumber = 0;
+
+    // identifies the canvas that some static data was compiled from: the compileHash() of the canvas, and the communicator of each communicator pixel
+    // the communicators are held (rather than compared by address) so that a new communicator can never be mistaken for a freed one
+    struct CompiledCanvasKey {
+        uint64_t hash;
+        ext::point size;
+        std::vector<std::shared_ptr<Communicator>> communicators; // the communicator table of the canvas after compilation
+        std::vector<int32_t> communicatorIds; // id of each communicator pixel, in the order of CanvasState::dataMatrix.for_each()
+    };
+    // static data that was replaced, kept so that going back to the same canvas (e.g. by undo and redo) does not have to compile it again
+    // the constants are never folded in the cached static data
+    struct CachedStaticData {
+        CompiledCanvasKey key;
+        StaticData staticData;
+    };
+    // the canvas that the current static data was compiled from, or nothing if it was patched by compileIncremental() since
+    // only accessed by the UI thread
+    std::optional<CompiledCanvasKey> staticDataKey;
+    // most recently replaced first; each entry holds a whole compilation (including a DisplayedPixel for every pixel), so only a few are kept
+    constexpr static size_t staticDataCacheSize = 4;
+    std::deque<CachedStaticData> staticDataCache;
+
+    // a compilation running on its own thread while the simulation carries on with the old static data
+    struct BackgroundCompilation {
+        CanvasState canvas; // snapshot of the canvas being compiled (only read by the compilation thread until done is set, since it shares tiles with the canvas of the UI thread)
+        StaticData staticData;
+        CompiledCanvasKey key; // the canvas that staticData is of
+        ext::point translation; // position in canvas of each point of the canvas that the running simulation was compiled from
+        std::thread thread;
+        std::atomic<bool> done = false;
+    };
+    // the pending compilation of the current canvas (if any)
+    // only accessed by the UI thread
+    std::unique_ptr<BackgroundCompilation> backgroundCompilation;
+
+    // incremented whenever new static data is installed, so that states from different compilations are never compared (only accessed by the UI thread)
+    uint64_t compileGeneration = 0;
+    // compilations that were superseded before they were done, which have to be joined when they finish
+    std::vector<std::unique_ptr<BackgroundCompilation>> discardedCompilations;
 
     /**
      * Method that actually runs the simulator.
@@ -318,6 +1055,117 @@ private:
      */
     void run();
 
+    /**
+     * Method that runs the given number of steps as fast as possible (without sleeping) on the simulator thread.
+     * Must be invoked from the simulator thread only!
+     * This method returns when all the steps are done or when the simulation is stopped.
+     * @pre simulation has been compiled.
+     */
+    void runFastForward(uint64_t numSteps);
+
+    /**
+     * Applies simThreadCore and simThreadHighPriority to the calling thread.
+     * Must be invoked from the simulator thread only!
+     */
+    void applySimThreadScheduling() const;
+
+    /**
+     * Compiles gameState into the given static data, without touching the simulator, and returns its key (hash is the compileHash() of gameState).
+     * The canvas is only read: the communicator table and the communicator ids that the compilation gives it are in the key, to be given to it with applyCompiledCanvasKey().
+     * The per-pixel passes are spread over the given pool (if any), which must not be used by anything else in the meantime.
+     * This does not assign the communicator indices (see installStaticData()), so it may be invoked from any thread.
+     */
+    static CompiledCanvasKey buildStaticData(const CanvasState& gameState, uint64_t hash, StaticData& staticData, ext::thread_pool* pool);
+
+    /**
+     * A hash of the size of the canvas and the type of the element at each pixel, which is everything that buildStaticData() depends on.
+     */
+    static uint64_t compileHash(const CanvasState& gameState) noexcept;
+
+    /**
+     * Makes the key of gameState, which has just been compiled (so its communicator elements point to the communicators of the compilation).
+     */
+    static CompiledCanvasKey makeCompiledCanvasKey(const CanvasState& gameState, uint64_t hash);
+
+    /**
+     * Returns true if static data with the given key can be used for gameState, i.e. the canvas has the same elements (its compileHash() is the given hash) and each communicator pixel has the same communicator.
+     */
+    static bool matchesCompiledCanvasKey(const CompiledCanvasKey& key, const CanvasState& gameState, uint64_t hash);
+
+    /**
+     * Gives gameState the communicator table of the compilation with the given key, which must match it (see matchesCompiledCanvasKey()).
+     */
+    static void applyCompiledCanvasKey(const CompiledCanvasKey& key, CanvasState& gameState);
+
+    /**
+     * Puts static data that was replaced into staticDataCache as the most recent entry, evicting the least recent one if the cache is full.
+     * The constants must not be folded in the given static data.
+     */
+    void cacheStaticData(CompiledCanvasKey&& key, StaticData&& oldStaticData);
+
+    /**
+     * If staticDataCache has static data for gameState (see matchesCompiledCanvasKey()), moves it out of the cache to staticData and key, and gives gameState its communicator table.
+     * Returns false if there is none.
+     */
+    bool takeCachedStaticData(CanvasState& gameState, uint64_t hash, StaticData& staticData, CompiledCanvasKey& key);
+
+    /**
+     * Sets up the initial state of the simulation from the logic levels of the given gamestate, after compile() installed its static data.
+     */
+    void initDynamicData(CanvasState& gameState);
+
+    /**
+     * Replaces the static data with the given one, and assigns the communicator indices.
+     * @pre simulation is currently stopped.
+     */
+    void installStaticData(StaticData&& newStaticData);
+
+    /**
+     * Moves the pending background compilation (if any) to discardedCompilations, and joins those that are done.
+     */
+    void discardBackgroundCompile();
+
+    /**
+     * Joins the threads of the discarded compilations that are done (or all of them, if wait is true).
+     */
+    void joinDiscardedCompilations(bool wait);
+
+    /**
+     * The transmit state of the communicator element at the given point of the canvas (communicators are rare, so readLiveView() just looks up their index from the canvas).
+     */
+    static bool transmitStateOf(const CanvasState& gameState, ext::point pt, const DynamicData& dynamicData) noexcept;
+
+    /**
+     * Computes the bounding rectangles of the components and relay pixels in the static data, if they are out of date.
+     * Must be invoked from the UI thread.
+     */
+    void computeDisplayBounds();
+
+    /**
+     * Prepares the partitions and the buffers of the flood fill and event-driven engines for newly compiled static data.
+     */
+    void prepareEngines();
+
+    /**
+     * Folds the gates and relays whose inputs are constant from the given state onwards (e.g. because they are driven by sources).
+     * The gates driving a constantly high component are replaced by a source, and the gates driving a constantly low component and the constantly non-conductive relays are taken out.
+     * The folded components are still in the static data (and are displayed as usual), and the simulation is the same as without folding.
+     * @pre initialState is the current state of the simulation, and the static data is not folded.
+     */
+    void foldConstants(const DynamicData& initialState);
+
+    /**
+     * Puts back the gates, relays and sources changed by foldConstants().
+     */
+    void unfoldConstants();
+
+    /**
+     * Renumbers the components and relay pixels in breadth-first (Cuthill-McKee) order over the netlist, so that elements connected by gates and relays have nearby indices.
+     * This keeps the logic levels read by each gate in the same few cache lines.
+     * Called by compile() before the packed representation is generated.
+     */
+    static void renumberForLocality(CompilerStaticData& compilerStaticData);
+
     /**
     * Method that calculates a single step of the simulation.
     * May be invoked in the simulator thread (by run()) or from the main thread (by step()).
@@ -326,95 +1174,936 @@ private:
     */
     void calculate(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState);
 
-    static void floodFill(const StaticData& staticData, DynamicData& dynamicData);
+    /**
+     * Invokes all the communicators like calculate() does, but records what they receive to inputLog, or replaces it by what inputLog says.
+     */
+    void invokeCommunicatorsWithLog(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState);
 
-    void pullCommunicatorReceivedData();
+    /**
+     * Evaluates all the gates and relays (but not the sources) from oldState into newState, on the worker pool if there are partitions.
+     */
+    void calculateGatesAndRelays(const DynamicData& oldState, DynamicData& newState);
 
-public:
+    /**
+     * Evaluates gates [begin, end) of the given columns, using SIMD gathers where available.
+     */
+    template <typename Gate>
+    static void evaluateGateColumns(const GateColumns<Gate>& columns, size_t begin, size_t end, const DynamicData& oldState, DynamicData& newState) noexcept;
 
-    ~Simulator();
+    /**
+     * Evaluates the gates and relays whose outputs are in the given partition.
+     * Different partitions may be evaluated concurrently.
+     */
+    static void calculatePartition(const StaticData& staticData, const DynamicData& oldState, DynamicData& newState, int32_t componentBegin, int32_t componentEnd, int32_t relayPixelBegin, int32_t relayPixelEnd) noexcept;
 
     /**
-     * Compiles the given gamestate and save the compiled simulation state (but does not start running the simulation).
-     * Even though the simulator is stopped, those things that propagate immediately will be updated immediately (back to the CanvasState parameter).
-     * @pre simulation is currently stopped.
+     * Splits the compiled gates and relays into partitions for the current number of worker threads.
+     * The partitions are balanced by the number of inputs that their gates and relays read, and the bounds between gate partitions are moved (within partitionCutSlackDivisor)
+     * to where the fewest gates read an input from the other side (see countCrossingInputs()), which tends to be between the independent modules of the circuit.
+     * @pre simulation has been compiled, and is currently stopped.
      */
-    void compile(CanvasState& gameState);
+    void computePartitions();
 
     /**
-     * Resets the transient state and communicator data, and calls compile().
-     * Even though the simulator is stopped, those things that propagate immediately will be updated immediately (back to the CanvasState parameter).
-     * @pre simulation is currently stopped.
+     * Counts, for each boundary between granules of components (see partitionGranularity), the gate inputs that are on the other side of it from the output of the gate.
+     * Boundary g is the start of granule g.
+     * The components are numbered by renumberForLocality(), so a partition that ends where this is small reads few levels written by other partitions, and keeps its working set in its own cache.
      */
-    void reset(CanvasState& gameState);
+    static std::vector<size_t> countCrossingInputs(const StaticData& staticData);
 
     /**
-     * Start running the simulation.
-     * @pre simulation is currently stopped.
+     * Sets the component logic levels and relay conductive states of newState, by re-evaluating only the gates and relays whose inputs have changed.
+     * Does the same thing as invoking all the sources, gates and relays.
+     * Returns false without touching newState if the step is too busy for it (see eventDrivenMaxDirtyShare), in which case the step has to be calculated by the full engine.
      */
-    void start();
+    bool calculateEventDriven(const DynamicData& oldState, DynamicData& newState);
 
     /**
-     * Stops (i.e. pauses) the simulation.
-     * @pre simulation is currently running.
+     * Builds the parts of eventDrivenData that only depend on the static data (the fanouts and the external blocks).
      */
-    void stop();
+    void initEventDriven();
 
     /**
-    * Runs a single step of the simulation, then stops the simulation.
-    * This method will block until the step is completed and the simulation is stopped.
-    * @pre simulation is currently stopped.
-    * @post simulation is stopped.
-    */
-    void step();
+     * Evaluates every gate and relay with the given state, so that the outputs, drive counts and levels of eventDrivenData are up to date with it.
+     */
+    void syncEventDriven(const DynamicData& oldState);
 
     /**
-     * Returns true if the simulation is currently running, false otherwise.
+     * Propagates logic levels from the components that are on through the conductive relays, using the current FloodFillEngine.
      */
-    bool running() const {
-        return simThread.joinable();
-    }
+    void propagate(DynamicData& dynamicData);
+
+    void floodFill(DynamicData& dynamicData);
 
     /**
-     * Returns true is the simulator currently holds a compiled simulation.
+     * Same result as floodFill(), but the components that are on are split into ranges, and the searches from each range run on the worker pool.
+     * The nodes are turned on with atomic operations, so each of them is still visited once, by whichever search reaches it first.
+     * Without worker threads this is just floodFill().
      */
-    bool holdsSimulation() const {
-        std::shared_ptr<DynamicData> tmpState = std::atomic_load_explicit(&latestCompleteState, std::memory_order_acquire);
-        return tmpState != nullptr;
-    }
+    void parallelFloodFill(DynamicData& dynamicData);
 
     /**
-     * Clears any active simulation.
-     * @pre simulation is currently stopped.
+     * Same result as floodFill(), but reads the connected regions from groupedFloodFillData, which is only updated around the relay pixels whose conductive state changed since the last flood fill.
+     * Once the groups are up to date, every component in a group that has a component that is on is turned on, without looking at the relay pixels in between.
      */
-    void clear() {
-        latestCompleteState = nullptr;
-    }
+    void groupedFloodFill(DynamicData& dynamicData);
 
     /**
-     * Take a "snapshot" of the current simulation state and writes it to the argument supplied.
-     * This works regardless whether the simulation is running or stopped.
-     * @pre the supplied canvas state has the correct element positions as the canvas state that was compiled.
+     * Puts every node reachable from start (which must not be in a group) into the given group, through the relay pixels for which isConductive() is true.
+     * Only the nodes that are not in a group yet are visited.
      */
-    void takeSnapshot(CanvasState&) const;
+    template <typename IsConductive>
+    void fillFloodFillGroup(int32_t start, int32_t group, IsConductive isConductive);
+
+    void pullCommunicatorReceivedData();
 
     /**
-     * Gets this period of the simulation step.
-     * This works regardless whether the simulation is running or stopped.
+     * Gets a cleared buffer from dynamicDataPool that nobody else is holding, allocating a new one if there are none.
+     * Must be invoked from the simulator thread, or from the UI thread when the simulation is stopped.
+     * @pre simulation has been compiled.
      */
-    std::chrono::steady_clock::duration getPeriod() const {
-        return std::chrono::steady_clock::duration(period_rep.load(std::memory_order_acquire));
-    }
+    const std::shared_ptr<DynamicData>& acquireDynamicData();
 
     /**
-    * Gets this period of the simulation step.
-    * This works regardless whether the simulation is running or stopped.
-    */
+     * Replaces the buffers in dynamicDataPool with a single new one of the given size, and returns it.
+     * Must be invoked from the UI thread when the simulation is stopped.
+     */
+    const std::shared_ptr<DynamicData>& resetDynamicDataPool(int32_t numComponents, int32_t numRelayPixels, int32_t numCommunicators);
+
+    /**
+     * Sets latestCompleteState, and publishes it to the UI thread.
+     * To be invoked from the thread that calculates the steps only.
+     */
+    void setLatestCompleteState(const std::shared_ptr<DynamicData>& state) {
+        latestCompleteState = state;
+        publishedState.publish(state);
+    }
+
+    /**
+     * Publishes the given state as latestCompleteState, and computes the viewport from it if the UI asked for one.
+     * Must be invoked from the simulator thread.
+     */
+    void publishState(const std::shared_ptr<DynamicData>& state);
+
+    /**
+     * Makes a state restored from a checkpoint (see Checkpoint::read()) the current state: propagates it, folds the constants again, publishes it and updates gameState.
+     * @pre simulation is currently stopped, and the constants have been unfolded before the state was filled in.
+     */
+    void installRestoredState(const std::shared_ptr<DynamicData>& state, CanvasState& gameState);
+
+public:
+
+    Simulator();
+    ~Simulator();
+
+    /**
+     * Compiles the given gamestate and save the compiled simulation state (but does not start running the simulation).
+     * Even though the simulator is stopped, those things that propagate immediately will be updated immediately (back to the CanvasState parameter).
+     * If a cache is given, the compiled static data is also written to it (see compileFromCache()).
+     * @pre simulation is currently stopped.
+     */
+    void compile(CanvasState& gameState, std::ostream* cache = nullptr);
+
+    /**
+     * Same as compile(), but reads the static data from a cache written by compile() instead of compiling the canvas.
+     * Returns false (leaving the simulator and the canvas unchanged) if the cache cannot be used, i.e. it is of a canvas with different elements, it is malformed, or the canvas already has communicators (the cache can only be used for a canvas that was just loaded).
+     * @pre simulation is currently stopped.
+     */
+    bool compileFromCache(CanvasState& gameState, std::istream& cache);
+
+    /**
+     * Recompiles the given gamestate after the elements in the given rectangles (each a [topLeft, bottomRight) pair, which may overlap) were edited.
+     * Only the components that touch an edited rectangle are flood filled again, and the indices of all other components are unchanged.
+     * Returns false (leaving the static data unchanged, apart from undoing foldConstants()) if the edit cannot be compiled incrementally (e.g. the canvas was resized, communicators are involved, or a background compilation is pending).
+     * @pre simulation is currently stopped, and gameState was the last state compiled except within the edited rectangles.
+     */
+    bool compileIncremental(CanvasState& gameState, const std::vector<std::pair<ext::point, ext::point>>& editedRects);
+
+    /**
+     * Starts compiling a copy of the given gamestate on another thread, while the simulation (if running) carries on with the old static data.
+     * translation is the position in gameState of each point of the canvas that was last compiled.
+     * A pending background compilation is superseded by this one.
+     * No snapshots are taken until the compilation is swapped in by finishBackgroundCompile().
+     */
+    void compileInBackground(const CanvasState& gameState, ext::point translation);
+
+    /**
+     * Returns true if a background compilation is pending.
+     */
+    bool compilingInBackground() const {
+        return backgroundCompilation != nullptr;
+    }
+
+    /**
+     * If the background compilation is done, swaps its static data in at a step boundary, carrying over the logic levels of the running simulation by pixel.
+     * The simulation is left running if it was running.  Does nothing while fast-forwarding.
+     * Returns true if the static data was swapped.
+     * @pre gameState has not been edited since compileInBackground().
+     */
+    bool finishBackgroundCompile(CanvasState& gameState);
+
+    /**
+     * Resets the transient state and communicator data, and calls compile().
+     * Even though the simulator is stopped, those things that propagate immediately will be updated immediately (back to the CanvasState parameter).
+     * @pre simulation is currently stopped.
+     */
+    void reset(CanvasState& gameState);
+
+    /**
+     * Starts recording the level that each communicator receives at every step, from the next step on (see InputLog).
+     * Recording stops when the circuit is compiled again, or when takeRecordedInputs() is called.
+     * @pre simulation is currently stopped.
+     */
+    void startRecordingInputs();
+
+    /**
+     * Stops recording, and returns what was recorded since startRecordingInputs() (an empty log if nothing was being recorded).
+     * @pre simulation is currently stopped.
+     */
+    InputLog takeRecordedInputs();
+
+    /**
+     * Replays a log recorded by startRecordingInputs() from the next step on: each communicator receives the levels in the log instead of its own, at the same steps (counted from now) as when they were recorded.
+     * The communicators are still invoked (so that file outputs are still written, for example), but what they return is ignored.
+     * For the run to be repeated exactly, the simulation must start from the state that the recording started from (e.g. straight after compiling the same save file).
+     * The replay stops when the circuit is compiled again, or when stopReplayingInputs() is called.  After the last entry, each communicator keeps receiving its last level.
+     * Returns false (without replaying anything) if the log was recorded from a circuit with a different number of communicators.
+     * @pre simulation is currently stopped.
+     */
+    bool startReplayingInputs(InputLog log);
+
+    /**
+     * Stops replaying, so that the communicators are listened to again.
+     * @pre simulation is currently stopped.
+     */
+    void stopReplayingInputs();
+
+    /**
+     * Whether every entry of the log being replayed has been reached (true if nothing is being replayed).
+     * @pre simulation is currently stopped.
+     */
+    bool inputReplayFinished() const noexcept {
+        return inputLogMode != InputLogMode::REPLAYING || inputLogPosition == inputLog.entries.size();
+    }
+
+    /**
+     * Start running the simulation.
+     * @pre simulation is currently stopped.
+     */
+    void start();
+
+    /**
+     * Stops (i.e. pauses) the simulation.
+     * @pre simulation is currently running.
+     */
+    void stop();
+
+    /**
+    * Runs a single step of the simulation, then stops the simulation.
+    * This method will block until the step is completed and the simulation is stopped.
+    * @pre simulation is currently stopped.
+    * @post simulation is stopped.
+    */
+    void step();
+
+    /**
+     * The other nodes of a distributed run, which evaluate the gates and relays that restrictToNode() took out of this simulator (see ClusterCoordinator).
+     */
+    class RemoteNodes {
+    public:
+        virtual ~RemoteNodes() = default;
+    private:
+        friend class Simulator;
+        // sends what the other nodes read from the old state; called before this node evaluates its own gates and relays, so that all the nodes work at the same time
+        virtual void sendInputs(const DynamicData& oldState) = 0;
+        // ORs the outputs of the gates and relays of the other nodes into the new state
+        virtual void receiveOutputs(DynamicData& newState) = 0;
+    };
+
+    /**
+     * Takes the gates and relays that the assignment gives to other nodes out of the compiled circuit.
+     * On node 0, remoteNodes then evaluates them during each step; the other nodes do not step on their own (see ClusterNode).
+     * The event-driven engine needs every gate and relay, so the full engine is used instead until the next compilation, which puts everything back.
+     * @pre simulation is currently stopped, and the assignment is of the compiled circuit.
+     */
+    void restrictToNode(const NodeAssignment& assignment, uint32_t node, RemoteNodes* remoteNodes);
+
+    /**
+     * Writes a C++ source file that defines `circuit_sandbox_native_step` (a NativeStepFunction for the compiled circuit, as straight-line code with all the indices as constants)
+     * and `circuit_sandbox_native_fingerprint` (the nativeStepFingerprint() of the compiled circuit), both with C linkage.
+     * Compiled into a shared library and loaded, they can be passed to setNativeStep().
+     */
+    void writeNativeStepSource(std::ostream& out) const;
+
+    /**
+     * Returns a hash of the sources, gates and relays of the compiled circuit and of the layout of the state, which the source written by writeNativeStepSource() is only valid for.
+     */
+    uint64_t nativeStepFingerprint() const noexcept;
+
+    /**
+     * Uses the given native step function (see writeNativeStepSource()) instead of interpreting the sources, gates and relays, until the compiled circuit changes.
+     * Returns false, and keeps interpreting, if the fingerprint is not the nativeStepFingerprint() of the compiled circuit.
+     * Any compilation (including incremental compilation and constant folding) goes back to the interpreter, since the function no longer matches.
+     * Passing nullptr goes back to the interpreter.
+     * @pre simulation is currently stopped.
+     */
+    bool setNativeStep(NativeStepFunction function, uint64_t fingerprint);
+
+    /**
+     * Returns the state of laneCount instances of the compiled circuit in which everything is off, for use with calculateLanes().
+     */
+    LaneState makeLaneState() const;
+
+    /**
+     * Calculates one step of laneCount independent instances of the compiled circuit at once (multi-instance mode), from oldState into newState.
+     * Every component holds one bit for each instance, so each gate and relay is evaluated for all the instances with a few bitwise operations.
+     * Communicator i of instance l receives bit l of receivedLevels[i] (every instance receives LOW if receivedLevels is empty), and what the instances transmit is left in newState.communicatorTransmitStates,
+     * so the caller decides what each instance is connected to.
+     * The communicators of the canvas are not used, and nothing is published, so this does not disturb the single-instance simulation.
+     * @pre simulation is currently stopped, receivedLevels is empty or has one word for each communicator, and both states come from makeLaneState().
+     */
+    void calculateLanes(const LaneState& oldState, LaneState& newState, const std::vector<lane_t>& receivedLevels) const;
+
+    /**
+     * Start running the given number of steps as fast as possible, ignoring the period.
+     * The simulation counts as running until stop() is called, even after all the steps are done (see fastForwardFinished()).
+     * Calling stop() before that cancels the remaining steps.
+     * @pre simulation is currently stopped.
+     */
+    void startFastForward(uint64_t numSteps);
+
+    /**
+     * Returns true if the simulation was started by startFastForward() and has not been stopped.
+     */
+    bool fastForwarding() const {
+        return fastForwardTarget != 0;
+    }
+
+    /**
+     * Returns true if all the steps requested by startFastForward() are done, so the simulator thread is waiting to be stopped.
+     * @pre fastForwarding()
+     */
+    bool fastForwardFinished() const {
+        return fastForwardCompleted.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Gets the number of steps completed since startFastForward().
+     */
+    uint64_t getFastForwardProgress() const {
+        return fastForwardStepsDone.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of steps requested by startFastForward().
+     */
+    uint64_t getFastForwardTarget() const {
+        return fastForwardTarget;
+    }
+
+    /**
+     * Returns true if the simulation is currently running, false otherwise.
+     */
+    bool running() const {
+        return simThread.joinable();
+    }
+
+    /**
+     * Returns true is the simulator currently holds a compiled simulation.
+     */
+    bool holdsSimulation() const {
+        return publishedState.read() != nullptr;
+    }
+
+    /**
+     * Clears any active simulation.
+     * @pre simulation is currently stopped.
+     */
+    void clear() {
+        discardBackgroundCompile();
+        latestCompleteState = nullptr;
+        publishedState.clear();
+        dynamicDataPool.clear();
+        dynamicDataPoolBytes.store(0, std::memory_order_relaxed);
+        eventDrivenData.valid = false;
+        nativeStep = nullptr;
+    }
+
+    /**
+     * Gets the number of threads used to calculate each step (including the simulation thread).
+     */
+    size_t getWorkerThreads() const {
+        return workerPool ? workerPool->concurrency() : 1;
+    }
+
+    /**
+     * Sets the number of threads used to calculate each step (including the simulation thread).
+     * Small circuits are still calculated on a single thread, since it is not worth the synchronization.
+     * The simulator then gets a pool of its own instead of sharing one.
+     * @pre simulation is currently stopped.
+     */
+    void setWorkerThreads(size_t numThreads);
+
+    /**
+     * Calculates each step on the given pool, which may be shared with other simulators (nullptr = only the simulation thread).
+     * Batches from different submitters run in turn, so a simulator sharing a pool is slowed down by the others; its batches have the priority of the simulation thread's priority_scope (normal by default).
+     * @pre simulation is currently stopped.
+     */
+    void setWorkerPool(std::shared_ptr<ext::thread_pool> pool);
+
+    /**
+     * Gets the core that the simulator thread is pinned to (-1 = any core).
+     */
+    int32_t getSimThreadCore() const {
+        return simThreadCore;
+    }
+
+    /**
+     * Gets whether the simulator thread runs at a higher OS priority than the other threads.
+     */
+    bool getSimThreadHighPriority() const {
+        return simThreadHighPriority;
+    }
+
+    /**
+     * Pins the simulator thread to the given core (-1 = any core), and gives it a higher OS priority than the other threads if highPriority is true,
+     * so that it does not migrate between cores or wait for the render thread, which makes the step times jitter.
+     * Both are only requests: they are ignored if the OS does not support them or does not allow them (e.g. raising the priority may need elevated privileges).
+     * @pre simulation is currently stopped.
+     */
+    void setSimThreadScheduling(int32_t core, bool highPriority) {
+        simThreadCore = core;
+        simThreadHighPriority = highPriority;
+    }
+
+    /**
+     * Gets the algorithm used to propagate logic levels through relays.
+     */
+    FloodFillEngine getFloodFillEngine() const {
+        return floodFillEngine;
+    }
+
+    /**
+     * Sets the algorithm used to propagate logic levels through relays.
+     * All engines give the same results.
+     * @pre simulation is currently stopped.
+     */
+    void setFloodFillEngine(FloodFillEngine engine) {
+        floodFillEngine = engine;
+    }
+
+    /**
+     * Gets the largest depth of the flood fill worklist in the most recent step, which shows how far logic levels propagated through relays.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    size_t getFloodFillPeakDepth() const {
+        return floodFillPeakDepth.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the largest depth of the flood fill worklist in any step since compilation.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    size_t getFloodFillMaxPeakDepth() const {
+        return floodFillMaxPeakDepth.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of bytes used by the static data, including the static data kept for undo and redo (see staticDataCache).
+     * Must be called from the UI thread only.
+     */
+    size_t getStaticDataMemoryUsage() const noexcept {
+        size_t bytes = staticData.bytes();
+        for (const CachedStaticData& cached : staticDataCache) bytes += cached.staticData.bytes();
+        return bytes;
+    }
+
+    /**
+     * Gets the number of bytes used by the simulation state buffers (see dynamicDataPool).
+     * This works regardless whether the simulation is running or stopped.
+     */
+    size_t getDynamicDataMemoryUsage() const noexcept {
+        return dynamicDataPoolBytes.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of logic gates and relays in the compiled simulation.
+     */
+    size_t getGateCount() const {
+        size_t count = 0;
+        const auto countElements = [&](const auto& x) {
+            x.forEach([&](const auto& y) {
+                count += y.size;
+            });
+        };
+        staticData.logicGates.forEach(countElements);
+        staticData.relays.forEach(countElements);
+        return count;
+    }
+
+    /**
+     * Sets whether the steps are timed for takeStepStatistics().  This is off by default, since it reads the clock several times per step.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    void setCollectStatistics(bool collect) {
+        collectStatistics.store(collect, std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the statistics to time only one in every 'interval' steps (the others are only counted), to make collecting them cheaper on fast circuits.
+     * The default is 1.  Since the statistics are handed over after a timed step, a large interval on a slow circuit delays takeStepStatistics().
+     */
+    void setStatisticsSampleInterval(uint32_t interval) {
+        statisticsSampleInterval.store(std::max<uint32_t>(interval, 1), std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns the statistics collected since the previous call, and starts collecting afresh.
+     * The simulator thread hands over its statistics every statisticsFlushInterval, and when it stops.
+     * This never waits for the simulator thread, so the counters of a hand-over that is in progress may be split between consecutive calls.
+     * This works regardless whether the simulation is running or stopped, but should only be called from one thread.
+     */
+    StepStatistics takeStepStatistics();
+
+    /**
+     * Gets the way the gates and relays are evaluated at each step.
+     */
+    SimulationEngine getSimulationEngine() const {
+        return simulationEngine;
+    }
+
+    /**
+     * Sets the way the gates and relays are evaluated at each step.
+     * All engines give the same results.
+     * @pre simulation is currently stopped.
+     */
+    void setSimulationEngine(SimulationEngine engine) {
+        simulationEngine = engine;
+        eventDrivenData.valid = false;
+    }
+
+    /**
+     * Take a "snapshot" of the current simulation state and writes it to the argument supplied.
+     * This works regardless whether the simulation is running or stopped.
+     * @pre the supplied canvas state has the correct element positions as the canvas state that was compiled.
+     */
+    void takeSnapshot(CanvasState&) const;
+
+    /**
+     * Like takeSnapshot(), but only writes the elements in [topLeft, bottomRight) (clipped to the canvas), so that the UI can refresh just the visible part while the simulation is running.
+     * @pre the supplied canvas state has the correct element positions as the canvas state that was compiled.
+     */
+    void takeSnapshot(CanvasState&, ext::point topLeft, ext::point bottomRight) const;
+
+    /**
+     * A published simulation state, as loaded by the UI thread for rendering the live view.
+     * Holding on to one keeps its buffer from being recycled, so that a later state can be compared against it by findChangedRects().
+     */
+    class LiveState {
+        std::shared_ptr<const DynamicData> dynamicData; // nullptr if there is no live view
+        std::shared_ptr<const ViewportData> viewport; // the viewport computed from dynamicData (nullptr if there is none)
+        uint64_t compileGeneration = 0;
+        friend class Simulator;
+    public:
+        explicit operator bool() const noexcept {
+            return dynamicData != nullptr;
+        }
+    };
+
+    /**
+     * Loads the latest simulation state, for use with readLiveView() and findChangedRects().
+     * While the simulation is running, this is the state of the latest viewport (see requestViewport()) if there is one.
+     * Returns an empty LiveState if the canvas was edited since the running simulation was compiled (i.e. a background compilation is pending).
+     * This works regardless whether the simulation is running or stopped.
+     */
+    LiveState loadLiveState() const {
+        LiveState liveState;
+        if (backgroundCompilation) return liveState;
+        if (running()) {
+            liveState.viewport = latestViewport.read();
+        }
+        liveState.dynamicData = liveState.viewport ? liveState.viewport->dynamicData : publishedState.read();
+        liveState.compileGeneration = compileGeneration;
+        return liveState;
+    }
+
+    /**
+     * Copies the element at the given point of the canvas that was compiled, with the levels that it has in the given live state, without writing to the canvas.
+     * Only the compiled pixels and the live state are read, and neither changes once published, so the UI can hit-test while the simulation runs without taking a snapshot or touching any reference counts.
+     * Returns the element as it is in the canvas if the live state is empty or out of date.
+     * @pre pt is inside the canvas.
+     */
+    CanvasState::element_variant_t readLiveElement(const LiveState& liveState, const CanvasState& canvas, ext::point pt) const;
+
+    /**
+     * Whether loadLiveState() would now return a different state from the given one, i.e. whether a frame drawn from the given state is out of date.
+     * While the simulation is running, this only becomes true when the next viewport is published (if the UI asked for one).
+     */
+    bool liveStateChanged(const LiveState& liveState) const {
+        const LiveState latest = loadLiveState();
+        return latest.dynamicData != liveState.dynamicData || latest.compileGeneration != liveState.compileGeneration;
+    }
+
+    /**
+     * Asks the simulator thread to compute the displayed pixels of [topLeft, bottomRight) from the next state it publishes, so that the next frame can be drawn by readLiveView() without looking up the simulation state of each pixel.
+     * This should be called by the UI thread once per frame, with the rectangle that it expects to draw in the next frame.
+     */
+    void requestViewport(ext::point topLeft, ext::point bottomRight) {
+        {
+            std::lock_guard<std::mutex> lock(viewportMutex);
+            requestedViewportTopLeft = topLeft;
+            requestedViewportBottomRight = bottomRight;
+        }
+        viewportRequested.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Reads the live view of the elements in [topLeft, bottomRight) from the given state, without writing a snapshot into the canvas state.
+     * Invokes callback(pt, elementIndex, level) for each point in row-major order, where elementIndex is the index of the element in CanvasState::element_variant_t (0 outside the canvas),
+     * and level is the logic level displayed by the element (the transmit state for communicators).
+     * The pixels are taken from the viewport of the given state if it covers [topLeft, bottomRight), otherwise they are looked up in the static and dynamic data.
+     * Returns false without invoking the callback if the given state is empty.
+     * @pre the supplied canvas state has the correct element positions as the canvas state that was compiled, and liveState was loaded since the last compilation.
+     */
+    template <typename Callback>
+    bool readLiveView(const LiveState& liveState, const CanvasState& gameState, ext::point topLeft, ext::point bottomRight, Callback&& callback) const {
+        using PixelType = StaticData::DisplayedPixel::PixelType;
+        if (!liveState) return false;
+        const DynamicData& dynamicData = *liveState.dynamicData;
+        if (const ViewportData* viewport = liveState.viewport.get(); viewport && viewport->topLeft.x <= topLeft.x && viewport->topLeft.y <= topLeft.y && bottomRight.x <= viewport->bottomRight.x && bottomRight.y <= viewport->bottomRight.y) {
+            // the simulator thread has already looked up these pixels
+            const int32_t viewportWidth = viewport->bottomRight.x - viewport->topLeft.x;
+            for (int32_t y = topLeft.y; y != bottomRight.y; ++y) {
+                const uint8_t* code = viewport->pixels.data() + static_cast<size_t>(y - viewport->topLeft.y) * viewportWidth + (topLeft.x - viewport->topLeft.x);
+                for (int32_t x = topLeft.x; x != bottomRight.x; ++x, ++code) {
+                    const ext::point pt{ x, y };
+                    if (*code & viewportCommunicatorBit) {
+                        callback(pt, static_cast<size_t>((*code & ~viewportCommunicatorBit) >> 1), transmitStateOf(gameState, pt, dynamicData));
+                    }
+                    else {
+                        callback(pt, static_cast<size_t>(*code >> 1), static_cast<bool>(*code & 1));
+                    }
+                }
+            }
+            return true;
+        }
+        for (int32_t y = topLeft.y; y != bottomRight.y; ++y) {
+            for (int32_t x = topLeft.x; x != bottomRight.x; ++x) {
+                const ext::point pt{ x, y };
+                if (!staticData.pixels.contains(pt)) {
+                    callback(pt, static_cast<size_t>(0), false);
+                    continue;
+                }
+                const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+                switch (pixel.type) {
+                case PixelType::EMPTY:
+                    callback(pt, static_cast<size_t>(pixel.elementIndex), false);
+                    break;
+                case PixelType::COMMUNICATOR:
+                    callback(pt, static_cast<size_t>(pixel.elementIndex), transmitStateOf(gameState, pt, dynamicData));
+                    break;
+                default:
+                    callback(pt, static_cast<size_t>(pixel.elementIndex), pixel.logicLevel(dynamicData));
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Sets whether the simulator counts how often each component and relay pixel changes, for readActivity().  This is off by default.
+     * Turning it on resets the counts.  The counts also restart whenever the circuit is compiled.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    void setCollectActivity(bool collect) {
+        if (collect) {
+            for (size_t i = 0; i != staticData.components.size; ++i) componentActivity[i].store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i != staticData.relayPixels.size; ++i) relayPixelActivity[i].store(0, std::memory_order_relaxed);
+        }
+        collectActivity.store(collect, std::memory_order_relaxed);
+    }
+
+    /**
+     * Reads the activity counts (see setCollectActivity()) of the elements in [topLeft, bottomRight).
+     * Invokes callback(pt, count) for each point in row-major order, where count is the number of times the component or relay pixel at that point has changed (0 for the other pixels).
+     * Insulated wires show the busier of their two components.
+     * Returns false without invoking the callback if the given state is empty.
+     * @pre liveState was loaded since the last compilation.
+     */
+    template <typename Callback>
+    bool readActivity(const LiveState& liveState, ext::point topLeft, ext::point bottomRight, Callback&& callback) const {
+        using PixelType = StaticData::DisplayedPixel::PixelType;
+        if (!liveState) return false;
+        for (int32_t y = topLeft.y; y != bottomRight.y; ++y) {
+            for (int32_t x = topLeft.x; x != bottomRight.x; ++x) {
+                const ext::point pt{ x, y };
+                uint32_t count = 0;
+                if (staticData.pixels.contains(pt)) {
+                    const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+                    switch (pixel.type) {
+                    case PixelType::COMPONENT: [[fallthrough]];
+                    case PixelType::COMMUNICATOR:
+                        for (int32_t index : pixel.index) {
+                            if (index != -1) count = std::max(count, componentActivity[index].load(std::memory_order_relaxed));
+                        }
+                        break;
+                    case PixelType::RELAY:
+                        count = relayPixelActivity[pixel.index[0]].load(std::memory_order_relaxed);
+                        break;
+                    case PixelType::EMPTY:
+                        break;
+                    }
+                }
+                callback(pt, count);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Sets the elements whose levels are recorded at every step, for readWaveform().  The recording restarts from the current state.
+     * Each probe is a point on the canvas, and records the level that the element there displays (always low if it is empty).
+     * The probes stay at the same points when the circuit is recompiled (moving with the canvas if it is extended), but the recording restarts.
+     * Must be invoked from the UI thread.  This works regardless whether the simulation is running or stopped.
+     */
+    void setProbes(std::vector<ext::point> points);
+
+    /**
+     * Gets the points set by setProbes().
+     */
+    const std::vector<ext::point>& getProbes() const noexcept {
+        return probePoints;
+    }
+
+    /**
+     * Copies the recorded levels of the probes (see setProbes()) in the last maxSteps steps (or all the steps that are still recorded, if there are fewer).
+     * The levels are empty if the recording of the current probes has not started yet.  While the simulation is running, the last few steps might not be included yet.
+     * Must be invoked from the UI thread.
+     */
+    Waveform readWaveform(uint64_t maxSteps = std::numeric_limits<uint64_t>::max());
+
+    /**
+     * Sets the breakpoints that the simulator thread checks after every step, while it is running or fast-forwarding (but not for single steps).
+     * When the condition of one of them has been met count times (counted from when the breakpoints were set, the circuit was compiled, or the breakpoint last stopped the simulation),
+     * the simulator thread publishes that step and ends, and breakpointReached() becomes true.
+     * Like the probes, the breakpoints stay at the same points when the circuit is recompiled.
+     * Must be invoked from the UI thread.  This works regardless whether the simulation is running or stopped.
+     */
+    void setBreakpoints(std::vector<Breakpoint> newBreakpoints);
+
+    /**
+     * Gets the breakpoints set by setBreakpoints().
+     */
+    const std::vector<Breakpoint>& getBreakpoints() const noexcept {
+        return breakpoints;
+    }
+
+    /**
+     * Returns true if the simulator thread has ended because a breakpoint was reached, so it is waiting to be stopped.
+     */
+    bool breakpointReached() const {
+        return breakpointReachedFlag.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Gets the breakpoint that was reached (see breakpointReached()).
+     * @pre the simulator thread has ended because a breakpoint was reached, and has been stopped since.
+     */
+    const Breakpoint& getReachedBreakpoint() const noexcept {
+        return reachedBreakpoint;
+    }
+
+    /**
+     * Finds the parts of [topLeft, bottomRight) where the elements might be displayed differently in newState than in oldState, and appends them to changedRects as [topLeft, bottomRight) pairs.
+     * The rectangles are made from the bounding rectangles of the components and relay pixels whose logic levels differ, rounded out to tiles of changedRectTileSize pixels.
+     * Returns false if the states cannot be compared (because either of them is empty or they are from different compilations), in which case everything should be redrawn.
+     * Must be invoked from the UI thread.
+     */
+    bool findChangedRects(const LiveState& oldState, const LiveState& newState, ext::point topLeft, ext::point bottomRight, std::vector<std::pair<ext::point, ext::point>>& changedRects);
+
+    // size of the square tiles that findChangedRects() rounds out to
+    constexpr static int32_t changedRectTileSize = 16;
+
+    /**
+     * Gets this period of the simulation step.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    std::chrono::steady_clock::duration getPeriod() const {
+        return std::chrono::steady_clock::duration(period_rep.load(std::memory_order_acquire));
+    }
+
+    /**
+    * Gets this period of the simulation step.
+    * This works regardless whether the simulation is running or stopped.
+    */
     void setPeriod(const std::chrono::steady_clock::duration& period) {
         period_rep.store(period.count(), std::memory_order_release);
     }
 
-    void sendCommunicatorEvent(int32_t communicatorIndex, bool turnOn) {
-        screenInputQueue.push(ScreenInputCommunicatorEvent{ communicatorIndex, turnOn });
+    /**
+     * Gets the average number of steps per second calculated since the simulator was started, or by the last run if it is stopped (zero if there was none).
+     * Fast-forwards are not counted, and neither are the steps skipped while the circuit is settled.
+     * Must be invoked from the UI thread.
+     */
+    double getAchievedStepRate() const;
+
+    /**
+     * Gets the number of steps calculated for each wakeup of the simulator thread.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    size_t getStepsPerWakeup() const {
+        return stepsPerWakeup.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Sets the number of steps calculated for each wakeup of the simulator thread.
+     * Only the last state of each wakeup is published for rendering, and the simulator thread sleeps for `period` times this number of steps.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    void setStepsPerWakeup(size_t steps) {
+        stepsPerWakeup.store(std::max<size_t>(steps, 1), std::memory_order_release);
+    }
+
+    /**
+     * Gets the minimum time between states published for rendering.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    std::chrono::steady_clock::duration getPublishInterval() const {
+        return std::chrono::steady_clock::duration(publish_interval_rep.load(std::memory_order_acquire));
+    }
+
+    /**
+     * Sets the minimum time between states published for rendering (zero = publish after every wakeup).
+     * The latest state is always published when the simulation is stopped.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    void setPublishInterval(const std::chrono::steady_clock::duration& interval) {
+        publish_interval_rep.store(interval.count(), std::memory_order_release);
+    }
+
+    /**
+     * Gets the time at the end of each sleep of the simulator thread that it busy-waits for.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    std::chrono::steady_clock::duration getSpinDuration() const {
+        return std::chrono::steady_clock::duration(spin_rep.load(std::memory_order_acquire));
+    }
+
+    /**
+     * Sets the time at the end of each sleep of the simulator thread that it busy-waits for instead of waiting for a wakeup (zero = never busy-wait).
+     * Sleeps that are shorter than this are busy-waited entirely, which is useful for periods that are shorter than the wakeup latency of the OS (usually below a millisecond), at the cost of keeping a core busy.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    void setSpinDuration(const std::chrono::steady_clock::duration& duration) {
+        spin_rep.store(duration.count(), std::memory_order_release);
+    }
+
+    /**
+     * Gets whether settled circuits are skipped.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    bool getSkipSettledSteps() const {
+        return skipSettledSteps.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Sets whether the simulator thread stops calculating steps once the circuit has settled into a state that no longer changes, and all its communicators are idle.
+     * It carries on when a screen communicator event is sent, or the probes or breakpoints are changed (see settled() for the exact conditions).  Skipped steps are not counted by getStepNumber(), except while fast-forwarding, where they count towards the target.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    void setSkipSettledSteps(bool skip) {
+        {
+            std::lock_guard<std::mutex> lock(simSleepMutex);
+            skipSettledSteps.store(skip, std::memory_order_release);
+        }
+        // the simulator thread might be sleeping on a settled circuit
+        simSleepCV.notify_one();
+    }
+
+    /**
+     * Gets the number of steps calculated since the circuit was last compiled (incremental and background compiles don't reset it).
+     * The next step to be calculated has this number.
+     * This works regardless whether the simulation is running or stopped.
+     */
+    uint64_t getStepNumber() const noexcept {
+        return stepNumber.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sends an event to the given screen communicator, which it receives at the next step.
+     * Returns false if the event was dropped because too many events are waiting for the simulation to receive them.
+     * Must only be called from the UI thread.
+     */
+    bool sendCommunicatorEvent(int32_t communicatorIndex, bool turnOn) {
+        return scheduleCommunicatorEvent(0, communicatorIndex, turnOn);
+    }
+
+    /**
+     * Sends an event to the given screen communicator, which it receives at the step with the given number (or the next step, if that step has already been calculated).
+     * Events are received in the order they are sent, so an event scheduled for a later step holds back the events sent after it.
+     * Returns false if the event was dropped because too many events are waiting for the simulation to receive them.
+     * Must only be called from the UI thread.
+     */
+    bool scheduleCommunicatorEvent(uint64_t stepNumber, int32_t communicatorIndex, bool turnOn) {
+        if (!screenInputQueue.try_push(ScreenInputCommunicatorEvent{ stepNumber, communicatorIndex, 1, turnOn })) return false;
+        wakeSettledSimulator();
+        return true;
+    }
+
+    /**
+     * Sends a burst of levels to the given screen communicator, which receives one of them at each step, starting from the next step.
+     * The levels are packed 64 per word, lowest bit first, so bit i of the burst is (words[i / 64] >> (i % 64)) & 1.
+     * None of them are lost or merged, unless too many are waiting for the simulation to receive them, in which case the rest of the burst is dropped.
+     * Returns the number of levels that were sent (the first ones of the burst).
+     * Must only be called from the UI thread.
+     */
+    size_t sendCommunicatorBits(int32_t communicatorIndex, const uint64_t* words, size_t count) {
+        size_t sent = 0;
+        while (sent != count) {
+            const uint8_t chunk = static_cast<uint8_t>(std::min<size_t>(count - sent, 64));
+            if (!screenInputQueue.try_push(ScreenInputCommunicatorEvent{ 0, communicatorIndex, chunk, words[sent / 64] })) break;
+            sent += chunk;
+        }
+        if (sent != 0) wakeSettledSimulator();
+        return sent;
+    }
+
+    /**
+     * Sets the number of levels that each screen communicator can hold before they are received (rounded up to a power of two).
+     * Levels sent beyond it wait in the input queue of the simulator, which holds 1024 events of up to 64 levels each.
+     * @pre simulation is currently stopped.
+     */
+    void setScreenInputDepth(size_t depth);
+
+private:
+    // wakes the simulator thread, in case it is sleeping on a settled circuit, after something that settledSleepInterrupted() checks was changed
+    void wakeSettledSimulator() {
+        // taking the mutex makes sure that it is either already waiting, or will see the change before it waits
+        {
+            std::lock_guard<std::mutex> lock(simSleepMutex);
+        }
+        simSleepCV.notify_one();
     }
 };
+
+inline bool Simulator::StaticData::DisplayedPixel::logicLevel(const DynamicData& execData) const noexcept {
+    switch (type) {
+    case PixelType::COMPONENT: [[fallthrough]];
+    case PixelType::COMMUNICATOR:
+        return (index[0] != -1 ? execData.componentLogicLevels[index[0]] : false) || (index[1] != -1 ? execData.componentLogicLevels[index[1]] : false);
+    case PixelType::RELAY:
+        return execData.relayPixelLogicLevels[index[0]];
+    case PixelType::EMPTY:
+        break;
+    }
+    assert(false);
+#ifdef NDEBUG
+#ifdef _MSC_VER // MSVC
+    __assume(0);
+#endif
+#ifdef __GNUC__ // GCC or Clang
+    __builtin_unreachable();
+#endif
+#endif // NDEBUG
+}
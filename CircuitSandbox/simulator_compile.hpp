@@ -10,8 +10,14 @@
 
 #pragma once
 
+#include <array>
+#include <tuple>
 #include <vector>
 #include <variant>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <cassert>
 
 #include "simulator.hpp"
 
@@ -19,39 +25,91 @@
  * This header file contains the things that are only necessary for the simulation compiler
  */
 
-template <typename Callback>
+/**
+ * Invokes callback with std::integral_constant<int32_t, x>, for x in [0, Simulator::maxFanIn].
+ */
+template <int32_t I = 0, typename Callback>
 inline auto callback_as_template(int32_t x, Callback&& callback) {
-    switch (x) {
-    case 0:
-        return std::forward<Callback>(callback)(std::integral_constant<int32_t, 0>{});
-    case 1:
-        return std::forward<Callback>(callback)(std::integral_constant<int32_t, 1>{});
-    case 2:
-        return std::forward<Callback>(callback)(std::integral_constant<int32_t, 2>{});
-    case 3:
-        return std::forward<Callback>(callback)(std::integral_constant<int32_t, 3>{});
-    case 4:
-        return std::forward<Callback>(callback)(std::integral_constant<int32_t, 4>{});
+    if constexpr (I == static_cast<int32_t>(Simulator::maxFanIn)) {
+        assert(x == I);
+        return std::forward<Callback>(callback)(std::integral_constant<int32_t, I>{});
+    }
+    else {
+        if (x == I) return std::forward<Callback>(callback)(std::integral_constant<int32_t, I>{});
+        return callback_as_template<I + 1>(x, std::forward<Callback>(callback));
     }
 }
 
+/**
+ * Moves all the elements of source to the end of target.
+ */
+template <typename T>
+inline void appendMoved(std::vector<T>& target, std::vector<T>& source) {
+    if (target.empty()) {
+        target = std::move(source);
+    }
+    else {
+        target.insert(target.end(), std::make_move_iterator(source.begin()), std::make_move_iterator(source.end()));
+    }
+    source.clear();
+}
+
+/**
+ * The input components of a gate, relay or communicator being compiled.
+ * Each element has at most one input in each direction, so they are kept in place instead of in a heap-allocated vector.
+ */
+struct CompilerInputs {
+    std::array<int32_t, Simulator::maxFanIn> data;
+    int32_t count = 0;
+
+    void emplace_back(int32_t component) noexcept {
+        assert(count < static_cast<int32_t>(Simulator::maxFanIn));
+        data[count++] = component;
+    }
+    size_t size() const noexcept {
+        return static_cast<size_t>(count);
+    }
+    const int32_t* begin() const noexcept {
+        return data.data();
+    }
+    const int32_t* end() const noexcept {
+        return data.data() + count;
+    }
+};
+
+// std::vector with a single template parameter, for Simulator::FanInTuple
+template <typename T>
+using compiler_vector_t = std::vector<T>;
+
 template <template <size_t> typename Gate>
 struct CompilerGatePack {
-    std::tuple<std::vector<Gate<0>>, std::vector<Gate<1>>, std::vector<Gate<2>>, std::vector<Gate<3>>, std::vector<Gate<4>>> data;
-    void emplace(const std::vector<int32_t>& inputComponents, int32_t outputComponent) {
+    typename Simulator::FanInTuple<compiler_vector_t, Gate>::type data;
+    void emplace(const CompilerInputs& inputComponents, int32_t outputComponent) {
         callback_as_template(inputComponents.size(), [&](auto integer_t) {
             auto& target = std::get<decltype(integer_t)::value>(data).emplace_back();
             std::copy(inputComponents.begin(), inputComponents.begin() + decltype(integer_t)::value, target.inputComponents.begin());
             target.outputComponent = outputComponent;
         });
     }
+    void append(CompilerGatePack& other) {
+        Simulator::fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            appendMoved(std::get<Index>(data), std::get<Index>(other.data));
+        });
+    }
+    template <typename Callback>
+    void forEach(Callback callback) {
+        std::apply([&](auto&... arrays) {
+            (callback(arrays), ...);
+        }, data);
+    }
 };
 struct CompilerGates {
     CompilerGatePack<Simulator::SimulatorAndGate> andGate;
     CompilerGatePack<Simulator::SimulatorOrGate> orGate;
     CompilerGatePack<Simulator::SimulatorNandGate> nandGate;
     CompilerGatePack<Simulator::SimulatorNorGate> norGate;
-    template <typename Element> void emplace(const std::vector<int32_t>& inputComponents, int32_t outputComponent) {
+    template <typename Element> void emplace(const CompilerInputs& inputComponents, int32_t outputComponent) {
         if (std::is_same_v<AndGate, Element>) {
             andGate.emplace(inputComponents, outputComponent);
         }
@@ -65,6 +123,15 @@ struct CompilerGates {
             norGate.emplace(inputComponents, outputComponent);
         }
     }
+    /**
+     * Moves all the gates of other to the end of this.
+     */
+    void append(CompilerGates& other) {
+        andGate.append(other.andGate);
+        orGate.append(other.orGate);
+        nandGate.append(other.nandGate);
+        norGate.append(other.norGate);
+    }
     template <typename Callback>
     void forEachGate(Simulator::Gates& gates, Callback callback) {
         callback(gates.andGate, andGate);
@@ -72,22 +139,41 @@ struct CompilerGates {
         callback(gates.nandGate, nandGate);
         callback(gates.norGate, norGate);
     }
+    template <typename Callback>
+    void forEach(Callback callback) {
+        andGate.forEach(callback);
+        orGate.forEach(callback);
+        nandGate.forEach(callback);
+        norGate.forEach(callback);
+    }
 };
 template <template <size_t> typename Relay>
 struct CompilerRelayPack {
-    std::tuple<std::vector<Relay<0>>, std::vector<Relay<1>>, std::vector<Relay<2>>, std::vector<Relay<3>>, std::vector<Relay<4>>> data;
-    void emplace(const std::vector<int32_t>& inputComponents, int32_t outputRelayPixel) {
+    typename Simulator::FanInTuple<compiler_vector_t, Relay>::type data;
+    void emplace(const CompilerInputs& inputComponents, int32_t outputRelayPixel) {
         callback_as_template(inputComponents.size(), [&](auto integer_t) {
             auto& target = std::get<decltype(integer_t)::value>(data).emplace_back();
             std::copy(inputComponents.begin(), inputComponents.begin() + decltype(integer_t)::value, target.inputComponents.begin());
             target.outputRelayPixel = outputRelayPixel;
         });
     }
+    void append(CompilerRelayPack& other) {
+        Simulator::fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            appendMoved(std::get<Index>(data), std::get<Index>(other.data));
+        });
+    }
+    template <typename Callback>
+    void forEach(Callback callback) {
+        std::apply([&](auto&... arrays) {
+            (callback(arrays), ...);
+        }, data);
+    }
 };
 struct CompilerRelays {
     CompilerRelayPack<Simulator::SimulatorPositiveRelay> positiveRelay;
     CompilerRelayPack<Simulator::SimulatorNegativeRelay> negativeRelay;
-    template <typename Element> void emplace(const std::vector<int32_t>& inputComponents, int32_t outputRelayPixel) {
+    template <typename Element> void emplace(const CompilerInputs& inputComponents, int32_t outputRelayPixel) {
         if (std::is_same_v<PositiveRelay, Element>) {
             positiveRelay.emplace(inputComponents, outputRelayPixel);
         }
@@ -95,14 +181,36 @@ struct CompilerRelays {
             negativeRelay.emplace(inputComponents, outputRelayPixel);
         }
     }
+    /**
+     * Moves all the relays of other to the end of this.
+     */
+    void append(CompilerRelays& other) {
+        positiveRelay.append(other.positiveRelay);
+        negativeRelay.append(other.negativeRelay);
+    }
     template <typename Callback>
     void forEachRelay(Simulator::Relays& relays, Callback callback) {
         callback(relays.positiveRelay, positiveRelay);
         callback(relays.negativeRelay, negativeRelay);
     }
+    template <typename Callback>
+    void forEach(Callback callback) {
+        positiveRelay.forEach(callback);
+        negativeRelay.forEach(callback);
+    }
 };
 struct CompilerComponent {
-    std::vector<int32_t> adjRelayPixels;
+    // whether this component was spawned between two adjacent relays (so it has no pixels)
+    bool relayLink = false;
+};
+struct CompilerRelayPixel {
+    std::array<int32_t, 4> adjComponents;
+    uint8_t numAdjComponents = 0;
+};
+struct CompilerCommunicator {
+    std::vector<int32_t> inputComponents;
+    int32_t outputComponent;
+    Communicator* communicator;
 };
 struct CompilerStaticData {
     // for all data that does not change after compilation
@@ -117,15 +225,42 @@ struct CompilerStaticData {
     CompilerRelays relays;
 
     // data about communicators
-    std::vector<Simulator::SimulatorCommunicator> communicators;
+    std::vector<CompilerCommunicator> communicators;
 
     // list of components
     std::vector<CompilerComponent> components;
+    // the relay pixels adjacent to each component, in compressed sparse row form: those of component i are [adjRelayPixelsBegin[i], adjRelayPixelsBegin[i + 1]) of adjRelayPixelList
+    // they are counted before they are filled in, so this is two allocations instead of one per component
+    std::vector<int32_t> adjRelayPixelsBegin;
+    std::vector<int32_t> adjRelayPixelList;
     // list of relay pixels (relay pixels have one-to-one correspondence to relays)
-    std::vector<Simulator::RelayPixel> relayPixels;
+    std::vector<CompilerRelayPixel> relayPixels;
 
     // state mapping
     ext::heap_matrix<Simulator::StaticData::DisplayedPixel> pixels;
+
+    /**
+     * The type of displayed pixel that the compiler generates for an element.
+     */
+    template <typename ElementVariant>
+    static Simulator::StaticData::DisplayedPixel::PixelType displayedPixelType(ElementVariant&& element) noexcept {
+        using PixelType = Simulator::StaticData::DisplayedPixel::PixelType;
+        return std::visit([&](const auto& element) {
+            using ElementType = std::decay_t<decltype(element)>;
+            if constexpr (std::is_base_of_v<Relay, ElementType>) {
+                return PixelType::RELAY;
+            }
+            else if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                return PixelType::COMMUNICATOR;
+            }
+            else if constexpr (std::is_base_of_v<Element, ElementType>) {
+                return PixelType::COMPONENT;
+            }
+            else {
+                return PixelType::EMPTY;
+            }
+        }, std::forward<ElementVariant>(element));
+    }
 };
 
 template <typename ElementVariant>
@@ -150,6 +285,14 @@ inline bool isFloodfillableUsefulElement(ElementVariant&& element) noexcept {
     }, std::forward<ElementVariant>(element));
 }
 
+/**
+ * Whether the flood fill for a component may continue from the element curr to the adjacent element next (in the same direction).
+ */
+template <typename ElementVariant>
+inline bool isFloodfillConnected(const ElementVariant& curr, const ElementVariant& next) noexcept {
+    return isFloodfillableElement(next) && !(isSignalReceiver(next) && isSignal(curr)) && !(isSignal(next) && isSignalReceiver(curr));
+}
+
 template <typename ElementVariant>
 inline bool isRelayElement(ElementVariant&& element) noexcept {
     return std::visit([&](const auto& element) {
@@ -161,6 +304,17 @@ inline bool isRelayElement(ElementVariant&& element) noexcept {
     }, std::forward<ElementVariant>(element));
 }
 
+template <typename ElementVariant>
+inline bool isCommunicatorElement(ElementVariant&& element) noexcept {
+    return std::visit([&](const auto& element) {
+        using ElementType = std::decay_t<decltype(element)>;
+        if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+            return true;
+        }
+        else return false;
+    }, std::forward<ElementVariant>(element));
+}
+
 template <typename ElementVariant>
 inline bool isLogicGateElement(ElementVariant&& element) noexcept {
     return std::visit([&](const auto& element) {
@@ -172,6 +326,31 @@ inline bool isLogicGateElement(ElementVariant&& element) noexcept {
     }, std::forward<ElementVariant>(element));
 }
 
+/**
+ * Flags that classify each pixel for the component labelling in Simulator::compile(), so that each element is only visited once.
+ */
+struct CompilerPixelFlags {
+    constexpr static uint8_t FLOODFILLABLE = 1 << 0;
+    constexpr static uint8_t USEFUL = 1 << 1; // floodfillable and useful (see isFloodfillableUsefulElement())
+    constexpr static uint8_t INSULATED = 1 << 2;
+    constexpr static uint8_t SIGNAL = 1 << 3;
+    constexpr static uint8_t SIGNAL_RECEIVER = 1 << 4;
+    constexpr static uint8_t RELAY = 1 << 5;
+
+    template <typename ElementVariant>
+    static uint8_t of(const ElementVariant& element) noexcept {
+        return (isFloodfillableElement(element) ? FLOODFILLABLE : 0) | (isFloodfillableUsefulElement(element) ? USEFUL : 0) | (std::holds_alternative<InsulatedWire>(element) ? INSULATED : 0) |
+            (isSignal(element) ? SIGNAL : 0) | (isSignalReceiver(element) ? SIGNAL_RECEIVER : 0) | (isRelayElement(element) ? RELAY : 0);
+    }
+
+    /**
+     * Same as isFloodfillConnected(), but also false if curr is not floodfillable.
+     */
+    static bool connected(uint8_t curr, uint8_t next) noexcept {
+        return (curr & next & FLOODFILLABLE) && !((next & SIGNAL_RECEIVER) && (curr & SIGNAL)) && !((next & SIGNAL) && (curr & SIGNAL_RECEIVER));
+    }
+};
+
 template <typename T, T First, T Second>
 struct integral_pair {
     static constexpr T first = First;
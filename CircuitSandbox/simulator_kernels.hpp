@@ -0,0 +1,113 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "simulator.hpp"
+#include "communicator.hpp"
+
+/**
+ * This header file contains the definitions of the inline sources, gates, relays and communicators of the compiled circuit, for the translation units that evaluate them
+ */
+
+// the gate kernels below are branchless: they combine the input bits and OR the result into the output bit,
+// so they work the same way whether the state is stored one bool per byte or bit-packed.
+inline void Simulator::SimulatorSource::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.componentLogicLevels.set(this->outputComponent);
+}
+template <bool Conjunctive, bool Inverted, typename InputLevel, size_t... Indices>
+inline bool Simulator::combineInputs(const InputLevel& inputLevel, std::index_sequence<Indices...>) noexcept {
+    // bitwise operators instead of && and ||, so that all the inputs are read without branching
+    if constexpr (Conjunctive) {
+        return static_cast<bool>((1 & ... & static_cast<int>(inputLevel(Indices)))) != Inverted;
+    }
+    else {
+        return static_cast<bool>((0 | ... | static_cast<int>(inputLevel(Indices)))) != Inverted;
+    }
+}
+template <size_t NumInputs>
+inline bool Simulator::SimulatorAndGate<NumInputs>::evaluate(const DynamicData& oldData) const noexcept {
+    return combineInputs<conjunctive, inverted>([&](size_t i) {
+        return oldData.componentLogicLevels[this->inputComponents[i]];
+    }, std::make_index_sequence<NumInputs>{});
+}
+template <size_t NumInputs>
+inline void Simulator::SimulatorAndGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.componentLogicLevels.set_if(this->outputComponent, evaluate(oldData));
+}
+template <size_t NumInputs>
+inline bool Simulator::SimulatorOrGate<NumInputs>::evaluate(const DynamicData& oldData) const noexcept {
+    return combineInputs<conjunctive, inverted>([&](size_t i) {
+        return oldData.componentLogicLevels[this->inputComponents[i]];
+    }, std::make_index_sequence<NumInputs>{});
+}
+template <size_t NumInputs>
+inline void Simulator::SimulatorOrGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.componentLogicLevels.set_if(this->outputComponent, evaluate(oldData));
+}
+template <size_t NumInputs>
+inline bool Simulator::SimulatorNandGate<NumInputs>::evaluate(const DynamicData& oldData) const noexcept {
+    return combineInputs<conjunctive, inverted>([&](size_t i) {
+        return oldData.componentLogicLevels[this->inputComponents[i]];
+    }, std::make_index_sequence<NumInputs>{});
+}
+template <size_t NumInputs>
+inline void Simulator::SimulatorNandGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.componentLogicLevels.set_if(this->outputComponent, evaluate(oldData));
+}
+template <size_t NumInputs>
+inline bool Simulator::SimulatorNorGate<NumInputs>::evaluate(const DynamicData& oldData) const noexcept {
+    return combineInputs<conjunctive, inverted>([&](size_t i) {
+        return oldData.componentLogicLevels[this->inputComponents[i]];
+    }, std::make_index_sequence<NumInputs>{});
+}
+template <size_t NumInputs>
+inline void Simulator::SimulatorNorGate<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.componentLogicLevels.set_if(this->outputComponent, evaluate(oldData));
+}
+
+template <size_t NumInputs>
+inline bool Simulator::SimulatorPositiveRelay<NumInputs>::evaluate(const DynamicData& oldData) const noexcept {
+    return combineInputs<conjunctive, inverted>([&](size_t i) {
+        return oldData.componentLogicLevels[this->inputComponents[i]];
+    }, std::make_index_sequence<NumInputs>{});
+}
+template <size_t NumInputs>
+inline void Simulator::SimulatorPositiveRelay<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.relayPixelIsConductive.set_if(this->outputRelayPixel, evaluate(oldData));
+}
+template <size_t NumInputs>
+inline bool Simulator::SimulatorNegativeRelay<NumInputs>::evaluate(const DynamicData& oldData) const noexcept {
+    return combineInputs<conjunctive, inverted>([&](size_t i) {
+        return oldData.componentLogicLevels[this->inputComponents[i]];
+    }, std::make_index_sequence<NumInputs>{});
+}
+template <size_t NumInputs>
+inline void Simulator::SimulatorNegativeRelay<NumInputs>::operator()(const DynamicData& oldData, DynamicData& newData) const noexcept {
+    newData.relayPixelIsConductive.set_if(this->outputRelayPixel, evaluate(oldData));
+}
+inline bool Simulator::SimulatorCommunicator::exchange(const StaticData& staticData, const DynamicData& oldData, DynamicData& newData, int32_t communicatorIndex) const noexcept {
+    bool transmitOutput = false;
+    for (int32_t i = inputComponentsBegin; i != inputComponentsEnd; ++i) {
+        transmitOutput |= oldData.componentLogicLevels[staticData.communicatorInputList.data[i]];
+    }
+    newData.communicatorTransmitStates.set_if(communicatorIndex, transmitOutput);
+
+    communicator->transmit(transmitOutput);
+
+    return communicator->receive();
+}
+inline void Simulator::SimulatorCommunicator::operator()(const StaticData& staticData, const DynamicData& oldData, DynamicData& newData, int32_t communicatorIndex) const noexcept {
+    newData.componentLogicLevels.set_if(outputComponent, exchange(staticData, oldData, newData, communicatorIndex));
+}
@@ -8,16 +8,25 @@
  * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <array>
+#include <vector>
 #include <variant>
+#include <utility>
+#include <type_traits>
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
 
 #include "statemanager.hpp"
-#include "visitor.hpp"
 #include "sdl_fast_maprgb.hpp"
 #include "mainwindow.hpp"
 #include "notificationdisplay.hpp"
+#include "checkpoint.hpp"
+#include "tracing.hpp"
 
 StateManager::StateManager(Simulator::period_t period) {
     // compile the empty stateManager, so that simulator won't be empty
@@ -28,33 +37,64 @@ StateManager::StateManager(Simulator::period_t period) {
 StateManager::~StateManager() {
 }
 
-void StateManager::fillSurface(bool useDefaultView, uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& surfaceRect, int32_t pitch) {
+void StateManager::fillSurface(bool useDefaultView, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch) {
+    fillSurface(useDefaultView, simulator.loadLiveState(), renderPool, pixelBuffer, colorTable, surfaceRect, pitch);
+}
+
+void StateManager::updateSurface(bool useDefaultView, bool redrawAll, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch, const std::vector<SDL_Rect>& exposedRects, std::vector<SDL_Rect>& redrawnRects) {
+    Simulator::LiveState liveState = simulator.loadLiveState();
+    changedRects.clear();
+    if (redrawAll || !simulator.findChangedRects(drawnState, liveState, ext::point{ surfaceRect.x, surfaceRect.y }, ext::point{ surfaceRect.x + surfaceRect.w, surfaceRect.y + surfaceRect.h }, changedRects)) {
+        fillSurface(useDefaultView, liveState, renderPool, pixelBuffer, colorTable, surfaceRect, pitch);
+        redrawnRects.push_back(surfaceRect);
+    }
+    else {
+        // when nothing changed (e.g. the simulator is stopped) and nothing came into view, there is nothing to draw
+        const auto fillRect = [&](const SDL_Rect& rect) {
+            fillSurface(useDefaultView, liveState, renderPool, pixelBuffer + (rect.y - surfaceRect.y) * pitch + (rect.x - surfaceRect.x), colorTable, rect, pitch);
+            redrawnRects.push_back(rect);
+        };
+        for (const SDL_Rect& rect : exposedRects) {
+            fillRect(rect);
+        }
+        for (const auto& [topLeft, bottomRight] : changedRects) {
+            fillRect(SDL_Rect{ topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y });
+        }
+    }
+    drawnState = std::move(liveState);
+    // have the simulator thread look up the pixels of the next frame (assuming that it will show the same rectangle)
+    if (!useDefaultView && simulator.running()) {
+        simulator.requestViewport(ext::point{ surfaceRect.x, surfaceRect.y }, ext::point{ surfaceRect.x + surfaceRect.w, surfaceRect.y + surfaceRect.h });
+    }
+}
+
+void StateManager::fillSurface(bool useDefaultView, const Simulator::LiveState& liveState, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch) {
+    CIRCUIT_SANDBOX_TRACE_SCOPE("StateManager::fillSurface");
+    // while the simulator is running, the live view is drawn straight from the simulation state (without a snapshot)
+    if (!useDefaultView && simulator.running() && fillSurfaceLive(liveState, renderPool, pixelBuffer, colorTable, surfaceRect, pitch)) {
+        return;
+    }
+
     if (simulator.running()) {
-        updateDefaultState();
+        // only the elements that are drawn need to be up to date, the rest of defaultState is refreshed when the simulator is stopped
+        simulator.takeSnapshot(defaultState, ext::point{ surfaceRect.x, surfaceRect.y }, ext::point{ surfaceRect.x + surfaceRect.w, surfaceRect.y + surfaceRect.h });
     }
 
     // this function has been optimized, as it is a bottleneck for large screens when zoomed out
-    invoke_RGB_format(pixelFormat, [&](const auto format) {
-        using FormatType = decltype(format);
-        invoke_bool(useDefaultView, [&](const auto defaultView_tag) {
-            using DefaultViewType = decltype(defaultView_tag);
+    // each row only depends on defaultState, so bands of rows are drawn in parallel
+    invoke_bool(useDefaultView, [&](const auto defaultView_tag) {
+        using DefaultViewType = decltype(defaultView_tag);
 
-            uint32_t* row = pixelBuffer;
-            for (int32_t y = surfaceRect.y; y != surfaceRect.y + surfaceRect.h; ++y, row += pitch) {
+        renderPool.parallel_for_ranges(surfaceRect.h, renderBandRows, [&](size_t bandBegin, size_t bandEnd) {
+            uint32_t* row = pixelBuffer + static_cast<int32_t>(bandBegin) * pitch;
+            for (int32_t y = surfaceRect.y + static_cast<int32_t>(bandBegin); y != surfaceRect.y + static_cast<int32_t>(bandEnd); ++y, row += pitch) {
                 uint32_t* pixel = row;
                 for (int32_t x = surfaceRect.x; x != surfaceRect.x + surfaceRect.w; ++x, ++pixel) {
                     const ext::point canvasPt{ x, y };
 
                     // check if the requested pixel is inside the buffer
                     if (defaultState.contains(canvasPt)) {
-                        std::visit(visitor{
-                            [pixel](std::monostate) {
-                            *pixel = 0;
-                        },
-                            [pixel, useDefaultView](const auto& element) {
-                            *pixel = fast_MapRGB<FormatType::value>(element.template computeDisplayColor<DefaultViewType::value>());
-                        },
-                            }, defaultState.dataMatrix[canvasPt]);
+                        *pixel = colorTable.get<DefaultViewType::value>(std::as_const(defaultState)[canvasPt]);
                     }
                     else {
                         *pixel = 0;
@@ -65,29 +105,27 @@ void StateManager::fillSurface(bool useDefaultView, uint32_t* pixelBuffer, uint3
     });
 }
 
+bool StateManager::fillSurfaceLive(const Simulator::LiveState& liveState, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch) {
+    if (!liveState) return false;
+
+    renderPool.parallel_for_ranges(surfaceRect.h, renderBandRows, [&](size_t bandBegin, size_t bandEnd) {
+        simulator.readLiveView(liveState, defaultState, ext::point{ surfaceRect.x, surfaceRect.y + static_cast<int32_t>(bandBegin) }, ext::point{ surfaceRect.x + surfaceRect.w, surfaceRect.y + static_cast<int32_t>(bandEnd) }, [&](const ext::point& pt, size_t elementIndex, bool level) {
+            pixelBuffer[(pt.y - surfaceRect.y) * pitch + (pt.x - surfaceRect.x)] = colorTable.get<false>(elementIndex, level);
+        });
+    });
+    return true;
+}
+
 bool StateManager::evaluateChangedState() {
     // return immediately if it isn't indeterminate
     if (!boost::indeterminate(changed)) {
         return changed;
     }
 
-    const auto& currentState = historyManager.currentState();
-    if (defaultState.width() != currentState.width() ||
-        defaultState.height() != currentState.height()) {
-
-        changed = true;
-        return true;
-    }
-    for (int32_t y = 0; y < defaultState.height(); ++y) {
-        for (int32_t x = 0; x < defaultState.width(); ++x) {
-            if (defaultState[{x, y}].index() != currentState[{x, y}].index()) {
-                changed = true;
-                return true;
-            }
-        }
-    }
-    changed = false;
-    return false;
+    // the canvas shares its tiles with the history, so only the tiles written to since the last save are compared
+    const bool result = !historyManager.sameElementTypes(defaultState);
+    changed = result;
+    return result;
 }
 
 void StateManager::reloadSimulator() {
@@ -118,8 +156,14 @@ void StateManager::startSimulatorUnchecked() {
 }
 
 void StateManager::startOrStopSimulator(MainWindow& mainWindow) {
+    if (rejectIfViewOnly(mainWindow)) return;
     bool simulatorRunning = simulator.running();
-    if (simulatorRunning) {
+    if (simulatorRunning && simulator.fastForwarding()) {
+        const std::string stepsText = std::to_string(simulator.getFastForwardProgress());
+        fastForwardNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Fast-forward cancelled ", NotificationDisplay::TEXT_COLOR_CANCEL }, { "after ", NotificationDisplay::TEXT_COLOR }, { stepsText, NotificationDisplay::TEXT_COLOR_KEY }, { " steps", NotificationDisplay::TEXT_COLOR } });
+        stopSimulatorUnchecked();
+    }
+    else if (simulatorRunning) {
         runningNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Simulation paused", NotificationDisplay::TEXT_COLOR_ACTION },  });
         stopSimulatorUnchecked();
     }
@@ -152,16 +196,183 @@ void StateManager::stopSimulator() {
 }
 
 void StateManager::stepSimulator() {
-    if (!simulator.running()) {
+    if (!simulator.running() && !viewOnly()) {
         stepSimulatorUnchecked();
     }
 }
 
+void StateManager::fastForwardSimulator(MainWindow& mainWindow, uint64_t numSteps) {
+    if (rejectIfViewOnly(mainWindow)) return;
+    if (simulator.running()) {
+        stopSimulatorUnchecked();
+    }
+    if (numSteps == 0) return;
+    runningNotification = NotificationDisplay::UniqueNotification();
+    fastForwardDisplayedPercent = -1;
+    simulator.startFastForward(numSteps);
+    updateFastForward(mainWindow);
+}
+
+void StateManager::updateBreakpoint(MainWindow& mainWindow) {
+    if (!simulator.running() || !simulator.breakpointReached()) return;
+    const bool fastForwarding = simulator.fastForwarding();
+    stopSimulatorUnchecked();
+    const Simulator::Breakpoint& breakpoint = simulator.getReachedBreakpoint();
+    const std::string pointText = "(" + std::to_string(breakpoint.point.x) + ", " + std::to_string(breakpoint.point.y) + ")";
+    if (fastForwarding) fastForwardNotification = NotificationDisplay::UniqueNotification();
+    runningNotification = NotificationDisplay::UniqueNotification();
+    breakpointNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Breakpoint reached ", NotificationDisplay::TEXT_COLOR_ACTION }, { "at ", NotificationDisplay::TEXT_COLOR }, { pointText, NotificationDisplay::TEXT_COLOR_KEY }, { " on step ", NotificationDisplay::TEXT_COLOR }, { std::to_string(simulator.getStepNumber()), NotificationDisplay::TEXT_COLOR_KEY } });
+}
+
+void StateManager::updateFastForward(MainWindow& mainWindow) {
+    if (!simulator.fastForwarding()) return;
+    const uint64_t numSteps = simulator.getFastForwardTarget();
+    if (simulator.fastForwardFinished()) {
+        stopSimulatorUnchecked();
+        fastForwardNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Fast-forwarded ", NotificationDisplay::TEXT_COLOR_ACTION }, { std::to_string(numSteps), NotificationDisplay::TEXT_COLOR_KEY }, { " steps", NotificationDisplay::TEXT_COLOR } });
+        return;
+    }
+    // only update the notification when the displayed number changes, since it has to be re-rendered
+    const int percent = static_cast<int>(simulator.getFastForwardProgress() * 100 / numSteps);
+    if (percent != fastForwardDisplayedPercent) {
+        fastForwardDisplayedPercent = percent;
+        fastForwardNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Fast-forwarding ", NotificationDisplay::TEXT_COLOR_ACTION }, { std::to_string(percent) + "%", NotificationDisplay::TEXT_COLOR_KEY }, { " (press Space to cancel)", NotificationDisplay::TEXT_COLOR } });
+    }
+}
+
+void StateManager::updateBackgroundCompile() {
+    if (!editing) {
+        simulator.finishBackgroundCompile(defaultState);
+    }
+}
+
+bool StateManager::liveStateChanged() const {
+    return simulator.liveStateChanged(drawnState);
+}
+
+bool StateManager::simulatorBusy() const {
+    return simulator.running() || simulator.compilingInBackground();
+}
+
+void StateManager::setPublishInterval(const std::chrono::steady_clock::duration& interval) {
+    simulator.setPublishInterval(interval);
+}
+
+void StateManager::setCollectSimulatorStatistics(bool collect) {
+    simulator.setCollectStatistics(collect);
+}
+
+Simulator::StepStatistics StateManager::takeSimulatorStatistics() {
+    return simulator.takeStepStatistics();
+}
+
+MemoryUsage StateManager::getMemoryUsage() const {
+    MemoryUsage usage;
+    usage.canvas = defaultState.memoryUsage();
+    usage.history = historyManager.getMemoryUsage();
+    usage.staticData = simulator.getStaticDataMemoryUsage();
+    usage.dynamicData = simulator.getDynamicDataMemoryUsage();
+    usage.communicators = defaultState.communicatorMemoryUsage();
+    return usage;
+}
+
+void StateManager::setCollectSimulatorActivity(bool collect) {
+    simulator.setCollectActivity(collect);
+}
+
+void StateManager::fillHeatmap(ext::thread_pool& renderPool, uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& surfaceRect, int32_t pitch) {
+    const Simulator::LiveState liveState = simulator.loadLiveState();
+    if (!liveState) {
+        for (int32_t y = 0; y != surfaceRect.h; ++y) {
+            std::fill_n(pixelBuffer + y * pitch, surfaceRect.w, 0);
+        }
+        return;
+    }
+
+    // first pass: the counts themselves are written to the buffer, so that the colours can be made relative to the largest of them
+    std::atomic<uint32_t> maxCount = 0;
+    renderPool.parallel_for_ranges(surfaceRect.h, renderBandRows, [&](size_t bandBegin, size_t bandEnd) {
+        uint32_t bandMax = 0;
+        simulator.readActivity(liveState, ext::point{ surfaceRect.x, surfaceRect.y + static_cast<int32_t>(bandBegin) }, ext::point{ surfaceRect.x + surfaceRect.w, surfaceRect.y + static_cast<int32_t>(bandEnd) }, [&](const ext::point& pt, uint32_t count) {
+            pixelBuffer[(pt.y - surfaceRect.y) * pitch + (pt.x - surfaceRect.x)] = count;
+            bandMax = std::max(bandMax, count);
+        });
+        uint32_t current = maxCount.load(std::memory_order_relaxed);
+        while (current < bandMax && !maxCount.compare_exchange_weak(current, bandMax, std::memory_order_relaxed));
+    });
+
+    // second pass: the counts are replaced by their colours, from blue (rarely changes) through yellow to red (changes the most), getting more opaque
+    invoke_RGB_format(pixelFormat, [&](const auto format) {
+        using FormatType = decltype(format);
+        std::array<uint32_t, 256> palette;
+        for (size_t i = 0; i != palette.size(); ++i) {
+            const double t = static_cast<double>(i) / (palette.size() - 1);
+            const SDL_Color color = t < 0.5 ?
+                SDL_Color{ static_cast<uint8_t>(255 * 2 * t), static_cast<uint8_t>(64 + 156 * 2 * t), static_cast<uint8_t>(255 * (1 - 2 * t)), static_cast<uint8_t>(96 + 128 * t) } :
+                SDL_Color{ 255, static_cast<uint8_t>(220 * (2 - 2 * t)), 0, static_cast<uint8_t>(96 + 128 * t) };
+            palette[i] = fast_MapRGBA<FormatType::value>(color);
+        }
+        const double scale = (palette.size() - 1) / std::log1p(static_cast<double>(maxCount.load(std::memory_order_relaxed)));
+        renderPool.parallel_for_ranges(surfaceRect.h, renderBandRows, [&](size_t bandBegin, size_t bandEnd) {
+            for (size_t y = bandBegin; y != bandEnd; ++y) {
+                uint32_t* const row = pixelBuffer + static_cast<int32_t>(y) * pitch;
+                for (uint32_t* pixel = row; pixel != row + surfaceRect.w; ++pixel) {
+                    if (*pixel != 0) *pixel = palette[static_cast<size_t>(std::log1p(static_cast<double>(*pixel)) * scale)];
+                }
+            }
+        });
+    });
+}
+
+bool StateManager::toggleSimulatorProbe(ext::point pt) {
+    std::vector<ext::point> probes = simulator.getProbes();
+    const auto it = std::find(probes.begin(), probes.end(), pt);
+    const bool add = it == probes.end();
+    if (add) probes.push_back(pt);
+    else probes.erase(it);
+    simulator.setProbes(std::move(probes));
+    return add;
+}
+
+const std::vector<ext::point>& StateManager::getSimulatorProbes() const {
+    return simulator.getProbes();
+}
+
+Waveform StateManager::readSimulatorWaveform(uint64_t maxSteps) {
+    return simulator.readWaveform(maxSteps);
+}
+
+void StateManager::setSimulatorBreakpoint(ext::point pt, std::optional<Simulator::Breakpoint> breakpoint) {
+    std::vector<Simulator::Breakpoint> breakpoints = simulator.getBreakpoints();
+    breakpoints.erase(std::remove_if(breakpoints.begin(), breakpoints.end(), [pt](const Simulator::Breakpoint& b) { return b.point == pt; }), breakpoints.end());
+    if (breakpoint) {
+        breakpoint->point = pt;
+        breakpoints.push_back(*breakpoint);
+    }
+    simulator.setBreakpoints(std::move(breakpoints));
+}
+
+std::optional<Simulator::Breakpoint> StateManager::getSimulatorBreakpoint(ext::point pt) const {
+    for (const Simulator::Breakpoint& breakpoint : simulator.getBreakpoints()) {
+        if (breakpoint.point == pt) return breakpoint;
+    }
+    return std::nullopt;
+}
+
+const std::vector<Simulator::Breakpoint>& StateManager::getSimulatorBreakpoints() const {
+    return simulator.getBreakpoints();
+}
+
+bool StateManager::simulatorFastForwarding() const {
+    return simulator.fastForwarding();
+}
+
 bool StateManager::simulatorRunning() const {
     return simulator.running();
 }
 
 void StateManager::resetSimulator(MainWindow& mainWindow) {
+    if (rejectIfViewOnly(mainWindow)) return;
     bool simulatorRunning = simulator.running();
     if (simulatorRunning) simulator.stop();
     simulator.reset(defaultState);
@@ -173,9 +384,51 @@ void StateManager::updateDefaultState() {
     simulator.takeSnapshot(defaultState);
 }
 
-CanvasState::element_variant_t StateManager::getElementAtPoint(const ext::point& pt) const {
+bool StateManager::writeCheckpoint(std::ostream& checkpoint) {
+    // the simulator doesn't hold the circuit in view-only mode
+    if (viewOnly()) return false;
+    bool simulatorRunning = simulator.running();
+    if (simulatorRunning) simulator.stop();
+    bool result = Checkpoint::write(simulator, defaultState, checkpoint);
+    if (simulatorRunning) simulator.start();
+    return result;
+}
+
+bool StateManager::readCheckpoint(std::istream& checkpoint) {
+    if (viewOnly()) return false;
+    bool simulatorRunning = simulator.running();
+    if (simulatorRunning) simulator.stop();
+    bool result = Checkpoint::read(simulator, defaultState, checkpoint);
+    if (simulatorRunning) simulator.start();
+    return result;
+}
+
+bool StateManager::viewOnly() const {
+    return tileLoader.has_value();
+}
+
+bool StateManager::rejectIfViewOnly(MainWindow& mainWindow) {
+    if (!viewOnly()) return false;
+    viewOnlyNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "This file is open for viewing only", NotificationDisplay::TEXT_COLOR_ERROR }, { " (open it normally to edit or simulate it)", NotificationDisplay::TEXT_COLOR } });
+    return true;
+}
+
+bool StateManager::loadViewTiles(MainWindow& mainWindow, const SDL_Rect& rect) {
+    if (!tileLoader) return false;
+    bool changed;
+    const CanvasState::ReadResult result = tileLoader->loadTiles(defaultState, ext::point{ rect.x, rect.y }, ext::point{ rect.x + rect.w, rect.y + rect.h }, changed);
+    if (result != CanvasState::ReadResult::OK) {
+        viewOnlyNotification = mainWindow.getNotificationDisplay().uniqueAdd(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { result == CanvasState::ReadResult::IO_ERROR ? "Error reading file: Part of this file cannot be accessed." : "Error reading file: Part of this file is corrupted.", NotificationDisplay::TEXT_COLOR_ERROR } });
+    }
+    return changed;
+}
+
+Description::ElementVariant_t StateManager::getElementAtPoint(const ext::point& pt) {
     if (defaultState.contains(pt)) {
-        return defaultState[pt];
+        // the live view is not written to defaultState while the simulator is running, so the levels are read from the state that was drawn last instead
+        if (simulator.running()) return Description::fromElementVariant(simulator.readLiveElement(drawnState, defaultState, pt), defaultState);
+        // read through a const reference, so that hovering over an empty area doesn't allocate its tile
+        return Description::fromElementVariant(std::as_const(defaultState)[pt], defaultState);
     }
     else return std::monostate{};
 }
@@ -12,6 +12,13 @@
 
 #include <cstdint> // for int32_t and uint32_t
 #include <string>
+#include <vector>
+#include <utility>
+#include <chrono>
+#include <istream>
+#include <ostream>
+#include <optional>
+#include <limits>
 
 #include <boost/logic/tribool.hpp>
 
@@ -19,7 +26,11 @@
 #include "canvasstate.hpp"
 #include "simulator.hpp"
 #include "historymanager.hpp"
+#include "memoryusage.hpp"
 #include "notificationdisplay.hpp"
+#include "thread_pool.hpp"
+#include "displaycolortable.hpp"
+#include "elementdescriptionutils.hpp"
 
 
 /**
@@ -28,22 +39,48 @@
 
 class StateManager {
 private:
-    CanvasState defaultState; // stores a cache of the simulator state.  this is guaranteed to be updated if the simulator is not running.
+    CanvasState defaultState; // stores a cache of the simulator state.  this is guaranteed to be updated if the simulator is not running (while it is running, the live view is rendered straight from the simulator instead).
     Simulator simulator; // stores the 'live' states and has methods to compile and run the simulation
 
     boost::tribool changed = false; // whether canvasstate changed since the last write to the undo stack
     ext::point deltaTrans{ 0, 0 }; // difference in viewport translation from previous gamestate (TODO: move this into a proper UndoDelta class)
 
     bool hasSelection = false; // whether selection/base contain meaningful data (neccessary to prevent overwriting defaultState)
+    bool editing = false; // whether an edit action is in progress (so defaultState must not be touched by a background compilation)
 
     HistoryManager historyManager; // stores the undo/redo stack
 
+    // only set in view-only mode, where the file is not loaded at once: it loads the tiles of the file that are in view into defaultState (see loadViewTiles())
+    // nothing can be edited or simulated in this mode, and the simulator holds an empty circuit
+    std::optional<CanvasState::TileLoader> tileLoader;
+
+    NotificationDisplay::UniqueNotification viewOnlyNotification;
     NotificationDisplay::UniqueNotification resetNotification;
     NotificationDisplay::UniqueNotification runningNotification;
+    NotificationDisplay::UniqueNotification fastForwardNotification;
+    NotificationDisplay::UniqueNotification breakpointNotification;
+    int fastForwardDisplayedPercent = -1; // the progress shown in fastForwardNotification
+
+    Simulator::LiveState drawnState; // the simulator state drawn by the last call to updateSurface()
+    std::vector<std::pair<ext::point, ext::point>> changedRects; // scratch space for updateSurface(), so that it doesn't allocate at every frame
+
+    // smallest number of rows that fillSurface() gives to a render thread at a time, so that small rectangles are not split up
+    constexpr static size_t renderBandRows = 16;
+
+    /**
+     * Same as the public fillSurface(), but draws the given simulator state.
+     */
+    void fillSurface(bool useDefaultView, const Simulator::LiveState& liveState, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch);
+
+    /**
+     * Draws the live view straight from the given simulator state (see fillSurface()).
+     * Returns false without drawing anything if the simulator can't provide the live view (because the canvas was edited and a background compilation is pending).
+     */
+    bool fillSurfaceLive(const Simulator::LiveState& liveState, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch);
 
     /**
-     * Explicitly scans the current gamestate to determine if it changed. Updates 'changed'.
-     * This should only be used if no faster alternative exists.
+     * Compares the current gamestate with the last state in the undo stack to determine if it changed. Updates 'changed'.
+     * This is immediate if the gamestate was not written to since then, and otherwise only compares the tiles that were written to (see HistoryManager::sameElementTypes()).
      */
     bool evaluateChangedState();
 
@@ -69,15 +106,25 @@ private:
 
 public:
 
+    // number of steps run by the fast-forward button
+    constexpr static uint64_t DEFAULT_FAST_FORWARD_STEPS = 1000000;
+
     StateManager(Simulator::period_t);
     ~StateManager();
 
     /**
      * Draw a rectangle of elements onto a pixel buffer supplied by PlayArea.
-     * Pixel format: pixel = R | (G << 8) | (B << 16)
+     * colorTable: the colors of the elements in the pixel format of the buffer (see PlayArea::prepareTexture())
      * useDefaultView: whether we want to render the default view (instead of live view)
+     * renderPool: the threads that draw bands of rows in parallel
      */
-    void fillSurface(bool useDefaultView, uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& surfaceRect, int32_t pitch);
+    void fillSurface(bool useDefaultView, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch);
+
+    /**
+     * Same as fillSurface(), but only redraws the parts of the pixel buffer where the simulator state changed since the last call and the given exposedRects, and appends the redrawn rectangles (in canvas coordinates) to redrawnRects.
+     * Unless redrawAll is true, the pixel buffer must still hold what the last call drew (moved to the new surfaceRect, except in exposedRects), with the same useDefaultView, and defaultState must not have been edited without recompiling the simulator.
+     */
+    void updateSurface(bool useDefaultView, bool redrawAll, ext::thread_pool& renderPool, uint32_t* pixelBuffer, const DisplayColorTable& colorTable, const SDL_Rect& surfaceRect, int32_t pitch, const std::vector<SDL_Rect>& exposedRects, std::vector<SDL_Rect>& redrawnRects);
 
     /**
      * Take a snapshot of the gamestate and save it in the history.
@@ -124,6 +171,95 @@ public:
      */
     void stepSimulator();
 
+    /**
+     * Runs the given number of steps as fast as possible on the simulator thread, then stops the simulator.
+     * The simulator counts as running while it is fast-forwarding, so stopping the simulator cancels the remaining steps.
+     */
+    void fastForwardSimulator(MainWindow&, uint64_t numSteps);
+
+    /**
+     * Updates the fast-forward progress notification, and stops the simulator if the fast-forward has completed.
+     * This should be called once per frame.
+     */
+    void updateFastForward(MainWindow&);
+
+    /**
+     * Stops the simulator and notifies the user if it has reached a breakpoint.
+     * This should be called once per frame, before updateFastForward().
+     */
+    void updateBreakpoint(MainWindow&);
+
+    /**
+     * Swaps in the background compilation of the simulator if it is done and no edit action is in progress.
+     * This should be called once per frame.
+     */
+    void updateBackgroundCompile();
+
+    /**
+     * Whether the simulator published a state that differs from the one drawn by the last call to updateSurface(), so the play area has to be redrawn.
+     */
+    bool liveStateChanged() const;
+
+    /**
+     * Whether the simulator is running or compiling, so liveStateChanged() or updateBackgroundCompile() might have something new without any event happening.
+     */
+    bool simulatorBusy() const;
+
+    /**
+     * Sets the minimum time between simulation states published for rendering, usually the time between frames.
+     */
+    void setPublishInterval(const std::chrono::steady_clock::duration& interval);
+
+    /**
+     * Sets whether the simulator times its steps, and gets the statistics collected since the previous call (see Simulator::takeStepStatistics()).
+     */
+    void setCollectSimulatorStatistics(bool collect);
+    Simulator::StepStatistics takeSimulatorStatistics();
+
+    /**
+     * Gets the bytes used by the canvas, the history, the simulator and the communicators (the clipboards are left at zero, since they are not ours).
+     * This works regardless whether the simulator is running or stopped.
+     */
+    MemoryUsage getMemoryUsage() const;
+
+    /**
+     * Sets whether the simulator counts how often each element changes, for fillHeatmap() (see Simulator::setCollectActivity()).
+     */
+    void setCollectSimulatorActivity(bool collect);
+
+    /**
+     * Draw the activity counts of a rectangle of elements onto a pixel buffer supplied by PlayArea, to be blended over the canvas.
+     * Elements that never changed are transparent, and the others are coloured from blue to red on a log scale relative to the busiest element in the rectangle.
+     * pixelFormat: the pixel format of the buffer, which must have an alpha channel
+     * renderPool: the threads that draw bands of rows in parallel
+     */
+    void fillHeatmap(ext::thread_pool& renderPool, uint32_t* pixelBuffer, uint32_t pixelFormat, const SDL_Rect& surfaceRect, int32_t pitch);
+
+    /**
+     * Adds a probe at the given point if there isn't one, otherwise removes it (see Simulator::setProbes()).
+     * Returns true if a probe was added.
+     */
+    bool toggleSimulatorProbe(ext::point pt);
+    const std::vector<ext::point>& getSimulatorProbes() const;
+
+    /**
+     * Gets the recorded levels of the probes in the last maxSteps steps (see Simulator::readWaveform()).
+     */
+    Waveform readSimulatorWaveform(uint64_t maxSteps = std::numeric_limits<uint64_t>::max());
+
+    /**
+     * Sets the breakpoint at the given point, or removes it if breakpoint is empty (see Simulator::setBreakpoints()).
+     * Gets the breakpoint at the given point, if there is one.
+     */
+    void setSimulatorBreakpoint(ext::point pt, std::optional<Simulator::Breakpoint> breakpoint);
+    std::optional<Simulator::Breakpoint> getSimulatorBreakpoint(ext::point pt) const;
+    const std::vector<Simulator::Breakpoint>& getSimulatorBreakpoints() const;
+
+    /**
+     * Whether the simulator is fast-forwarding.
+     */
+    bool simulatorFastForwarding() const;
+
     /**
     * Whether the simulator is running.
     */
@@ -141,8 +277,32 @@ public:
     void updateDefaultState();
 
     /**
-     * Get the element at the given canvas point.
+     * Writes the current state of the simulation to a checkpoint, or resumes the simulation from one (see Checkpoint::write() and Checkpoint::read()).
+     * These work even if the simulator is running.  They return false if the simulator is still compiling, or if the checkpoint cannot be restored.
+     */
+    bool writeCheckpoint(std::ostream& checkpoint);
+    bool readCheckpoint(std::istream& checkpoint);
+
+    /**
+     * Whether the file was opened in view-only mode (see FileOpenAction), so nothing can be edited or simulated.
+     */
+    bool viewOnly() const;
+
+    /**
+     * If in view-only mode, shows a notification that the action can't be done, and returns true.
+     * Actions that edit the canvas or run the simulator should do nothing if this returns true.
+     */
+    bool rejectIfViewOnly(MainWindow&);
+
+    /**
+     * In view-only mode, loads the tiles of the file that are inside the given rectangle (in canvas coordinates), and releases those that are far from it.
+     * Returns true if defaultState changed, so the rectangle has to be redrawn.
+     */
+    bool loadViewTiles(MainWindow&, const SDL_Rect& rect);
+
+    /**
+     * Get the element at the given canvas point, as its description element (which includes the file of file communicators).
      * Returns std::monostate if the point is outside the canvas bounds.
      */
-    CanvasState::element_variant_t getElementAtPoint(const ext::point& pt) const;
+    Description::ElementVariant_t getElementAtPoint(const ext::point& pt);
 };
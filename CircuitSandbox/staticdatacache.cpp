@@ -0,0 +1,276 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <array>
+#include <tuple>
+#include <variant>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+
+#include "staticdatacache.hpp"
+#include "simulator_compile.hpp"
+#include "elements.hpp"
+#include "screencommunicator.hpp"
+#include "fileinputcommunicator.hpp"
+#include "fileoutputcommunicator.hpp"
+#include "streaminputcommunicator.hpp"
+#include "binary_io.hpp"
+
+// identifies a static data cache, and its version (incremented whenever StaticData or the cache format changes)
+constexpr char CACHE_MAGIC[4] = { 'C', 'C', 'N', 'L' };
+constexpr uint32_t CACHE_VERSION = 1;
+
+
+void StaticDataCache::write(const CanvasState& gameState, const Simulator::StaticData& staticData, std::ostream& cache) {
+    using StaticData = Simulator::StaticData;
+    using PixelType = StaticData::DisplayedPixel::PixelType;
+
+    cache.write(CACHE_MAGIC, sizeof CACHE_MAGIC);
+    ext::write_binary(cache, CACHE_VERSION);
+    ext::write_binary(cache, ext::byte_order_mark);
+    ext::write_binary(cache, Simulator::compileHash(gameState));
+    ext::write_binary(cache, gameState.width());
+    ext::write_binary(cache, gameState.height());
+
+    ext::write_binary_array(cache, staticData.sources.data, staticData.sources.size);
+    staticData.logicGates.forEach([&](const auto& gatePack) {
+        gatePack.forEach([&](const auto& gates) {
+            ext::write_binary_array(cache, gates.data, gates.size);
+        });
+    });
+    staticData.relays.forEach([&](const auto& relayPack) {
+        relayPack.forEach([&](const auto& relays) {
+            ext::write_binary_array(cache, relays.data, relays.size);
+        });
+    });
+
+    // the communicator objects are not written, only their types (given by the elements of their pixels) and the components they are connected to
+    std::vector<std::array<int32_t, 3>> communicators;
+    for (const Simulator::SimulatorCommunicator& communicator : staticData.communicators) {
+        communicators.push_back({ communicator.inputComponentsBegin, communicator.inputComponentsEnd, communicator.outputComponent });
+    }
+    ext::write_binary_array(cache, communicators.data(), communicators.size());
+    ext::write_binary_array(cache, staticData.communicatorInputList.data, staticData.communicatorInputList.size);
+    ext::write_binary(cache, staticData.screenCommunicatorStartIndex);
+    ext::write_binary(cache, staticData.screenCommunicatorEndIndex);
+
+    ext::write_binary_array(cache, staticData.components.data, staticData.components.size);
+    ext::write_binary_array(cache, staticData.relayPixels.data, staticData.relayPixels.size);
+    ext::write_binary_array(cache, staticData.adjComponentList.data, staticData.adjComponentList.size);
+    ext::write_binary_array(cache, staticData.adjRelayPixelList.data, staticData.adjRelayPixelList.size);
+    std::vector<uint8_t> relayLinkComponents(staticData.relayLinkComponents.begin(), staticData.relayLinkComponents.end());
+    ext::write_binary_array(cache, relayLinkComponents.data(), relayLinkComponents.size());
+
+    // the types of the pixels are given by the canvas, so only the indices of the non-empty pixels are written (in raster order), and the communicator index of each communicator pixel
+    std::vector<std::array<int32_t, 2>> pixelIndices;
+    std::vector<int32_t> communicatorIds;
+    for (int32_t y = 0; y != gameState.height(); ++y) {
+        for (int32_t x = 0; x != gameState.width(); ++x) {
+            const ext::point pt{ x, y };
+            const StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+            if (pixel.type == PixelType::EMPTY) continue;
+            pixelIndices.push_back({ pixel.index[0], pixel.index[1] });
+            if (pixel.type == PixelType::COMMUNICATOR) {
+                std::visit([&](const auto& element) {
+                    if constexpr (std::is_base_of_v<CommunicatorElement, std::decay_t<decltype(element)>>) {
+                        communicatorIds.push_back(element.communicatorId);
+                    }
+                }, gameState[pt]);
+            }
+        }
+    }
+    ext::write_binary_array(cache, pixelIndices.data(), pixelIndices.size());
+    ext::write_binary_array(cache, communicatorIds.data(), communicatorIds.size());
+}
+
+
+bool StaticDataCache::read(const CanvasState& gameState, Simulator::StaticData& staticData, std::vector<std::shared_ptr<Communicator>>& communicators, std::vector<int32_t>& communicatorIds, std::istream& cache) {
+    using StaticData = Simulator::StaticData;
+    using PixelType = StaticData::DisplayedPixel::PixelType;
+
+    // check that the cache is of this canvas
+    char magic[sizeof CACHE_MAGIC];
+    uint32_t version, byteOrder;
+    uint64_t hash;
+    int32_t width, height;
+    if (!cache.read(magic, sizeof magic) || !std::equal(magic, magic + sizeof magic, CACHE_MAGIC)) return false;
+    if (!ext::read_binary(cache, version) || version != CACHE_VERSION) return false;
+    if (!ext::read_binary(cache, byteOrder) || byteOrder != ext::byte_order_mark) return false;
+    if (!ext::read_binary(cache, hash) || !ext::read_binary(cache, width) || !ext::read_binary(cache, height)) return false;
+    if (width != gameState.width() || height != gameState.height() || hash != Simulator::compileHash(gameState)) return false;
+
+    // no list in the static data has more than a few entries per pixel
+    const size_t maxSize = static_cast<size_t>(width) * height * 4 + 4;
+
+    // read everything, then check that all the indices are in range, so that a malformed cache can't make the simulator read out of bounds
+    bool ok = ext::read_binary_array(cache, staticData.sources, maxSize);
+    const auto readPacks = [&](auto&... packs) {
+        const auto readPack = [&](auto& pack) {
+            return std::apply([&](auto&... arrays) {
+                return (ext::read_binary_array(cache, arrays, maxSize) && ...);
+            }, pack.data);
+        };
+        return (readPack(packs) && ...);
+    };
+    ok = ok && readPacks(staticData.logicGates.andGate, staticData.logicGates.orGate, staticData.logicGates.nandGate, staticData.logicGates.norGate);
+    ok = ok && readPacks(staticData.relays.positiveRelay, staticData.relays.negativeRelay);
+
+    std::vector<std::array<int32_t, 3>> cachedCommunicators;
+    ok = ok && ext::read_binary_array(cache, cachedCommunicators, maxSize);
+    ok = ok && ext::read_binary_array(cache, staticData.communicatorInputList, maxSize);
+    ok = ok && ext::read_binary(cache, staticData.screenCommunicatorStartIndex) && ext::read_binary(cache, staticData.screenCommunicatorEndIndex);
+
+    ok = ok && ext::read_binary_array(cache, staticData.components, maxSize);
+    ok = ok && ext::read_binary_array(cache, staticData.relayPixels, maxSize);
+    ok = ok && ext::read_binary_array(cache, staticData.adjComponentList, maxSize);
+    ok = ok && ext::read_binary_array(cache, staticData.adjRelayPixelList, maxSize);
+    std::vector<uint8_t> relayLinkComponents;
+    ok = ok && ext::read_binary_array(cache, relayLinkComponents, maxSize);
+
+    std::vector<std::array<int32_t, 2>> pixelIndices;
+    ok = ok && ext::read_binary_array(cache, pixelIndices, maxSize) && ext::read_binary_array(cache, communicatorIds, maxSize);
+    if (!ok) return false;
+
+    const int32_t numComponents = static_cast<int32_t>(staticData.components.size);
+    const int32_t numRelayPixels = static_cast<int32_t>(staticData.relayPixels.size);
+    const int32_t numCommunicators = static_cast<int32_t>(cachedCommunicators.size());
+    const auto inRange = [](int32_t index, int32_t size) {
+        return index >= 0 && index < size;
+    };
+    // whether [begin, end) is a range of a list of the given size
+    const auto isRange = [](int32_t begin, int32_t end, size_t size) {
+        return begin >= 0 && begin <= end && static_cast<size_t>(end) <= size;
+    };
+
+    for (const Simulator::SimulatorSource& source : staticData.sources) {
+        if (!inRange(source.outputComponent, numComponents)) return false;
+    }
+    // the gates and relays must also be sorted by their output, for the partitions
+    bool gatesValid = true;
+    staticData.logicGates.forEach([&](const auto& gatePack) {
+        gatePack.forEach([&](const auto& gates) {
+            for (size_t i = 0; i != gates.size; ++i) {
+                gatesValid = gatesValid && inRange(gates[i].outputComponent, numComponents) && (i == 0 || gates[i - 1].outputComponent <= gates[i].outputComponent);
+                for (int32_t input : gates[i].inputComponents) gatesValid = gatesValid && inRange(input, numComponents);
+            }
+        });
+    });
+    staticData.relays.forEach([&](const auto& relayPack) {
+        relayPack.forEach([&](const auto& relays) {
+            for (size_t i = 0; i != relays.size; ++i) {
+                gatesValid = gatesValid && inRange(relays[i].outputRelayPixel, numRelayPixels) && (i == 0 || relays[i - 1].outputRelayPixel <= relays[i].outputRelayPixel);
+                for (int32_t input : relays[i].inputComponents) gatesValid = gatesValid && inRange(input, numComponents);
+            }
+        });
+    });
+    if (!gatesValid) return false;
+
+    for (const std::array<int32_t, 3>& communicator : cachedCommunicators) {
+        if (!isRange(communicator[0], communicator[1], staticData.communicatorInputList.size) || !inRange(communicator[2], numComponents)) return false;
+    }
+    for (int32_t input : staticData.communicatorInputList) {
+        if (!inRange(input, numComponents)) return false;
+    }
+    if (!isRange(staticData.screenCommunicatorStartIndex, staticData.screenCommunicatorEndIndex, cachedCommunicators.size())) return false;
+
+    for (const Simulator::Component& component : staticData.components) {
+        if (!isRange(component.adjRelayPixelsBegin, component.adjRelayPixelsEnd, staticData.adjComponentList.size)) return false;
+    }
+    for (int32_t relayPixel : staticData.adjComponentList) {
+        if (!inRange(relayPixel, numRelayPixels)) return false;
+    }
+    for (const Simulator::RelayPixel& relayPixel : staticData.relayPixels) {
+        if (!isRange(relayPixel.adjComponentsBegin, relayPixel.adjComponentsEnd, staticData.adjRelayPixelList.size)) return false;
+    }
+    for (int32_t component : staticData.adjRelayPixelList) {
+        if (!inRange(component, numComponents)) return false;
+    }
+    if (relayLinkComponents.size() != staticData.components.size) return false;
+    staticData.relayLinkComponents.assign(relayLinkComponents.begin(), relayLinkComponents.end());
+
+    // fill in the pixels from the canvas and the cached indices, and create a communicator of the right type for each communicator index
+    staticData.pixels = ext::heap_matrix<StaticData::DisplayedPixel>(gameState.size(), StaticData::DisplayedPixel{ PixelType::EMPTY, 0, { -1, -1 } });
+    gameState.dataMatrix.for_each([&](const ext::point& pt, const CanvasState::element_variant_t& element) {
+        staticData.pixels[pt].type = CompilerStaticData::displayedPixelType(element);
+        staticData.pixels[pt].elementIndex = static_cast<uint8_t>(element.index());
+    });
+    communicators.assign(cachedCommunicators.size(), nullptr);
+    auto pixelIndex = pixelIndices.begin();
+    auto communicatorId = communicatorIds.begin();
+    for (int32_t y = 0; y != height; ++y) {
+        for (int32_t x = 0; x != width; ++x) {
+            const ext::point pt{ x, y };
+            StaticData::DisplayedPixel& pixel = staticData.pixels[pt];
+            if (pixel.type == PixelType::EMPTY) continue;
+            if (pixelIndex == pixelIndices.end()) return false;
+            pixel.index[0] = (*pixelIndex)[0];
+            pixel.index[1] = (*pixelIndex)[1];
+            ++pixelIndex;
+            switch (pixel.type) {
+            case PixelType::COMPONENT:
+                // pixels that are not part of any useful component have no index, and index[1] is only used by insulated wires
+                if ((pixel.index[0] != -1 && !inRange(pixel.index[0], numComponents)) || (pixel.index[1] != -1 && !inRange(pixel.index[1], numComponents))) return false;
+                break;
+            case PixelType::RELAY:
+                if (!inRange(pixel.index[0], numRelayPixels) || !inRange(pixel.index[1], numRelayPixels)) return false;
+                break;
+            case PixelType::COMMUNICATOR: {
+                if (!inRange(pixel.index[0], numComponents) || (pixel.index[1] != -1 && !inRange(pixel.index[1], numComponents)) || communicatorId == communicatorIds.end()) return false;
+                const int32_t id = *communicatorId++;
+                if (!inRange(id, numCommunicators) || cachedCommunicators[id][2] != pixel.index[0]) return false;
+                const bool communicatorValid = std::visit([&](const auto& element) {
+                    using ElementType = std::decay_t<decltype(element)>;
+                    if constexpr (std::is_base_of_v<CommunicatorElement, ElementType>) {
+                        using CommunicatorType = typename ElementType::communicator_t;
+                        // the screen communicators must be in their range, and all the pixels of a communicator must be of the same type
+                        const bool isScreen = id >= staticData.screenCommunicatorStartIndex && id < staticData.screenCommunicatorEndIndex;
+                        if (isScreen != std::is_same_v<ScreenCommunicator, CommunicatorType>) return false;
+                        if (!communicators[id]) communicators[id] = std::make_shared<CommunicatorType>();
+                        return dynamic_cast<CommunicatorType*>(communicators[id].get()) != nullptr;
+                    }
+                    else {
+                        return false;
+                    }
+                }, gameState[pt]);
+                if (!communicatorValid) return false;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+    }
+    if (pixelIndex != pixelIndices.end() || communicatorId != communicatorIds.end()) return false;
+
+    staticData.communicators.resize(cachedCommunicators.size());
+    for (size_t i = 0; i != cachedCommunicators.size(); ++i) {
+        if (!communicators[i]) return false;
+        staticData.communicators[i] = Simulator::SimulatorCommunicator{ cachedCommunicators[i][0], cachedCommunicators[i][1], cachedCommunicators[i][2], communicators[i].get() };
+    }
+
+    // the columns of the gates are not cached, since they are copies of the gates
+    auto updateColumns = [](auto& gatePack) {
+        Simulator::fan_in_indices_t::for_each([&](const auto index_tag, auto) {
+            constexpr int32_t Index = decltype(index_tag)::type::value;
+            std::get<Index>(gatePack.columns).update(std::get<Index>(gatePack.data));
+        });
+    };
+    updateColumns(staticData.logicGates.andGate);
+    updateColumns(staticData.logicGates.orGate);
+    updateColumns(staticData.logicGates.nandGate);
+    updateColumns(staticData.logicGates.norGate);
+
+    return true;
+}
@@ -0,0 +1,39 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+#include "simulator.hpp"
+#include "canvasstate.hpp"
+#include "communicator.hpp"
+
+/**
+ * The file format of the static data cache (see Simulator::compile() and Simulator::compileFromCache()), which lets a canvas be opened again without compiling it.
+ * The cache is in the native byte order and layout, so it is only meant to be read on the machine that wrote it.
+ */
+class StaticDataCache {
+public:
+    /**
+     * Writes static data that was just built from gameState by Simulator::buildStaticData() to the given cache.
+     */
+    static void write(const CanvasState& gameState, const Simulator::StaticData& staticData, std::ostream& cache);
+
+    /**
+     * Reads static data written by write(), together with the new communicator table of the canvas and the communicator index of each communicator pixel (in raster order).
+     * Returns false if the cache is not of a canvas with the same elements as gameState, or if it is malformed.
+     */
+    static bool read(const CanvasState& gameState, Simulator::StaticData& staticData, std::vector<std::shared_ptr<Communicator>>& communicators, std::vector<int32_t>& communicatorIds, std::istream& cache);
+};
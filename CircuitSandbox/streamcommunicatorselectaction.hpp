@@ -0,0 +1,55 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Action that asks the user for the address of a Stream Input communicator.
+ */
+
+#include <string>
+#include <SDL.h>
+#include "textdialogaction.hpp"
+#include "streaminputcommunicator.hpp"
+
+class StreamCommunicatorSelectAction final : public TextDialogAction<StreamCommunicatorSelectAction> {
+private:
+    StreamInputCommunicator& comm;
+
+public:
+    StreamCommunicatorSelectAction(MainWindow& mainWindow, SDL_Renderer* renderer, StreamInputCommunicator& comm) : TextDialogAction<StreamCommunicatorSelectAction>(mainWindow, renderer, comm.getAddress(), "Enter the address to stream from:", "(host:port to connect, or :port to listen)"), comm(comm) {}
+
+    // keep only the printable ASCII characters other than space
+    static inline char filterCharacter(char ch) noexcept {
+        if (ch > ' ' && ch <= '~') return ch;
+        return 0;
+    }
+
+    inline ActionEventResult commit() {
+        if (text.empty()) {
+            comm.clearAddress();
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Communicator unlinked", NotificationDisplay::TEXT_COLOR } });
+        }
+        else if (comm.setAddress(text)) {
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{
+                { "Communicator linked to ", NotificationDisplay::TEXT_COLOR },
+                { text, NotificationDisplay::TEXT_COLOR_FILE }
+            });
+        }
+        else {
+            mainWindow.getNotificationDisplay().add(NotificationFlags::DEFAULT, 5s, NotificationDisplay::Data{ { "Invalid input: This address is malformed, or its port cannot be listened on", NotificationDisplay::TEXT_COLOR_ERROR } });
+        }
+
+        // save to history, but never recompile
+        changed() = true;
+        stateManager().saveToHistory();
+        return ActionEventResult::COMPLETED;
+    }
+};
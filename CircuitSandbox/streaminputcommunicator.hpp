@@ -0,0 +1,459 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <limits>
+#include <vector>
+#include <thread>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/post.hpp>
+#include "declarations.hpp"
+#include "communicator.hpp"
+#include "flushable_fixed_queue.hpp"
+#include "unrolled_linked_list_queue.hpp"
+#include "binary_io.hpp"
+
+/**
+ * Communicator that receives bytes from another process over TCP, using the same commands as FileInputCommunicator.
+ * The address is either "host:port", to connect to a process that is listening on that port, or ":port", to listen on that port (of all interfaces) for one process to connect.
+ * (Named pipes don't need this, since FileInputCommunicator reads them like files.)
+ */
+class StreamInputCommunicator final : public Communicator {
+    /**
+     * There are three threads that interacts with this class:
+     * 1. The UI thread
+     * 2. The simulation thread
+     * 3. The network thread, which runs the handlers of the asynchronous socket operations
+     * Most of the methods of this class should only be called by one of those threads.
+     * The network thread is owned by this class.
+     * We only read from the socket while there is space in streamQueue, so a producer that is faster than the circuit is held back by TCP flow control.
+     */
+private:
+    std::thread networkThread;
+    boost::asio::io_context ioContext;
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> workGuard; // keeps the network thread running while the reads are paused
+    boost::asio::ip::tcp::resolver resolver{ ioContext };
+    boost::asio::ip::tcp::acceptor acceptor{ ioContext };
+    boost::asio::ip::tcp::socket socket{ ioContext };
+    std::string address;
+
+    // used by network thread only (or by the UI thread while the network thread is stopped)
+    uint32_t connectionId = 0; // changed whenever we disconnect, so that the handlers of the old operations do nothing
+    bool readInProgress = false;
+
+    // used by simulator thread only
+    ext::unrolled_linked_list_queue<uint8_t, 65536> transmittedCommands;
+    bool suppressEnded = true; // whether the we need to read a byte first (prevents zero-length streams)
+    uint8_t currentTransmitChunk = 0; // bitmask
+    uint8_t currentTransmitCount = 0;
+    uint16_t currentReceiveChunk = 0; // bitmask
+    uint8_t currentReceiveCount = 0;
+
+    // bytes taken from streamQueue a word at a time, that were not sent to the circuit yet (used by simulator thread only)
+    uint64_t receiveWord = 0; // the next byte is in the lowest bits
+    uint8_t receiveWordCount = 0;
+    uint32_t receiveWordFlushCount = 0; // value of flushCount after the bytes were taken
+
+    // shared between simulator and UI threads
+    std::atomic<uint32_t> flushCount = 0; // incremented whenever the UI thread changes the address, so that the simulator thread drops receiveWord
+
+    // shared between simulator and network threads
+    constexpr static size_t BufSize = CCSB_FILE_COMMUNICATOR_BUFFER_SIZE;
+    ext::flushable_fixed_queue<std::byte, BufSize> streamQueue;
+
+    /**
+     * Starts reading from the socket into the free space of the queue, unless a read is in progress already or the queue is full.
+     * Must be called from the network thread only!
+     */
+    void startRead() {
+        if (readInProgress || !socket.is_open() || streamQueue.space() == 0) return;
+        auto [bytes, space] = streamQueue.push_span();
+        readInProgress = true;
+        socket.async_read_some(boost::asio::buffer(bytes, space), [this, id = connectionId](const boost::system::error_code& ec, size_t byteCount) {
+            if (id != connectionId) return;
+            readInProgress = false;
+            streamQueue.push(byteCount);
+            if (ec) {
+                // the other process closed the connection, or it broke
+                endStream();
+                return;
+            }
+            startRead();
+        });
+    }
+
+    /**
+     * Called when the connection is made (or fails).
+     * Must be called from the network thread only!
+     */
+    void onConnected(uint32_t id, const boost::system::error_code& ec) {
+        if (id != connectionId) return;
+        if (ec) {
+            endStream();
+            return;
+        }
+        startRead();
+    }
+
+    /**
+     * Tells the simulator thread that there will be no more bytes, and closes the socket.
+     * Must be called from the network thread only!
+     */
+    void endStream() noexcept {
+        streamQueue.end();
+        boost::system::error_code ec;
+        socket.close(ec);
+        acceptor.close(ec);
+    }
+
+    /**
+     * Wakes up the network thread so that it reads more bytes.
+     * Must be called from the simulation thread only!
+     */
+    void notifyNetworkThread() {
+        boost::asio::post(ioContext, [this]() {
+            startRead();
+        });
+    }
+
+    /**
+     * Drops the bytes in receiveWord if the UI thread changed the address since they were taken from the queue.
+     * Returns true if it did.
+     * Must be called from the simulation thread only!
+     */
+    bool dropFlushedReceiveWord() noexcept {
+        if (receiveWordCount == 0 || flushCount.load(std::memory_order_acquire) == receiveWordFlushCount) return false;
+        receiveWordCount = 0;
+        return true;
+    }
+
+    /**
+     * Makes sure that receiveWord has a byte, taking as many bytes as will fit in it from the queue if it is empty.
+     * Returns false if there are no bytes available.
+     * Must be called from the simulation thread only!
+     */
+    bool fillReceiveWord() noexcept {
+        if (receiveWordCount != 0) return true;
+        std::byte bytes[sizeof receiveWord];
+        bool producerNeedsSignal;
+        size_t byteCount = streamQueue.pop_before_end(bytes, sizeof receiveWord, producerNeedsSignal);
+        receiveWord = 0;
+        for (size_t i = 0; i != byteCount; ++i) {
+            receiveWord |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+        }
+        receiveWordCount = static_cast<uint8_t>(byteCount);
+        // see FileInputCommunicator::fillReceiveWord()
+        receiveWordFlushCount = flushCount.load(std::memory_order_acquire);
+        if (producerNeedsSignal) {
+            notifyNetworkThread();
+        }
+        return byteCount != 0;
+    }
+
+    /**
+     * Checks if the next byte of the stream is available, without taking it.
+     * Must be called from the simulation thread only!
+     */
+    bool byteAvailable() noexcept {
+        return receiveWordCount != 0 || (!streamQueue.ended() && fillReceiveWord());
+    }
+
+    /**
+     * Checks if there will be no more bytes from the stream.
+     * Must be called from the simulation thread only!
+     */
+    bool streamEnded() const noexcept {
+        return receiveWordCount == 0 && streamQueue.ended();
+    }
+
+    /**
+     * Stops the network thread and closes the connection (if any).
+     */
+    void disconnect() noexcept {
+        if (networkThread.joinable()) {
+            ioContext.stop();
+            networkThread.join();
+            workGuard.reset();
+            boost::system::error_code ec;
+            resolver.cancel();
+            acceptor.close(ec);
+            socket.close(ec);
+            streamQueue.end();
+            // run the handlers of the cancelled operations (and any reads posted by the simulator thread), which do nothing since the connection id changed
+            ++connectionId;
+            readInProgress = false;
+            ioContext.restart();
+            ioContext.poll(ec);
+            ioContext.restart(); // poll() stops the io_context once it runs out of handlers
+        }
+    }
+
+    // must call disconnect() before calling this!
+    // starts connecting to (or listening on) the address, and launches the network thread
+    // returns true if the address is valid and (when listening) the port could be opened, false otherwise.
+    bool connect() {
+        if (address.empty()) return false;
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) return false;
+        std::string host = address.substr(0, colon);
+        std::string port = address.substr(colon + 1);
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2); // IPv6 address in brackets
+        try {
+            if (host.empty()) {
+                // listen for one connection
+                unsigned long portNumber = std::stoul(port);
+                if (portNumber > std::numeric_limits<uint16_t>::max()) return false;
+                boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), static_cast<uint16_t>(portNumber));
+                acceptor.open(endpoint.protocol());
+                acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+                acceptor.bind(endpoint);
+                acceptor.listen(1);
+                acceptor.async_accept(socket, [this, id = connectionId](const boost::system::error_code& ec) {
+                    if (id != connectionId) return;
+                    boost::system::error_code closeEc;
+                    acceptor.close(closeEc); // only one process may connect
+                    onConnected(id, ec);
+                });
+            }
+            else {
+                // connect to the other process
+                resolver.async_resolve(host, port, [this, id = connectionId](const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::results_type results) {
+                    if (id != connectionId) return;
+                    if (ec) {
+                        endStream();
+                        return;
+                    }
+                    boost::asio::async_connect(socket, results, [this, id](const boost::system::error_code& ec, const boost::asio::ip::tcp::endpoint&) {
+                        onConnected(id, ec);
+                    });
+                });
+            }
+        }
+        catch (const std::exception&) {
+            // invalid port number, or the port can't be listened on
+            boost::system::error_code ec;
+            acceptor.close(ec);
+            return false;
+        }
+        workGuard.emplace(ioContext.get_executor());
+        networkThread = std::thread([this]() {
+            ioContext.run();
+        });
+        return true;
+    }
+
+    /**
+     * Flushes the bytes that are still in the buffer.
+     * Must be called from the UI thread only!
+     */
+    void flushQueue() noexcept {
+        streamQueue.flush();
+        flushCount.fetch_add(1, std::memory_order_release);
+    }
+
+public:
+    using element_t = StreamInputCommunicatorElement;
+
+    ~StreamInputCommunicator() {
+        disconnect();
+    }
+
+    /**
+     * Receives the next bit from this communicator.
+     * Must be called from the simulation thread only!
+     */
+    bool receive() noexcept override {
+        if (currentReceiveCount == 0) {
+            if (!transmittedCommands.empty()) {
+                uint8_t command = transmittedCommands.front();
+                bool flushed = dropFlushedReceiveWord();
+                switch (command) {
+                case 0b001:
+                    // byte request
+                    if (!suppressEnded) {
+                        streamQueue.discard();
+                    }
+                    if (fillReceiveWord()) {
+                        currentReceiveChunk = (static_cast<uint16_t>(receiveWord & 0xFF) << 3) | 0b001;
+                        currentReceiveCount = 11;
+                        receiveWord >>= 8;
+                        --receiveWordCount;
+                        transmittedCommands.pop();
+                        suppressEnded = false;
+                    }
+                    break;
+                case 0b101:
+                    // byte available in stream?  (only answered once we know, i.e. when a byte arrives or the stream ends)
+                    if (!suppressEnded && (flushed || streamQueue.discard() || streamEnded())) {
+                        currentReceiveChunk = 0b0101;
+                        currentReceiveCount = 4;
+                        transmittedCommands.pop();
+                        suppressEnded = true;
+                    }
+                    else if (suppressEnded || byteAvailable()) {
+                        currentReceiveChunk = 0b1101;
+                        currentReceiveCount = 4;
+                        transmittedCommands.pop();
+                        suppressEnded = true;
+                    }
+                    break;
+                default:
+                    // unknown command, discard it
+                    transmittedCommands.pop();
+                }
+            }
+        }
+        if (currentReceiveCount != 0) {
+            bool out = currentReceiveChunk & 1;
+            currentReceiveChunk >>= 1;
+            --currentReceiveCount;
+            return out;
+        }
+        return false;
+    }
+
+    /**
+     * Transmits the next bit to this communicator.
+     * Must be called from the simulation thread only!
+     */
+    void transmit(bool value) noexcept override {
+        currentTransmitChunk |= (static_cast<uint8_t>(value) << currentTransmitCount);
+        if (currentTransmitChunk != 0) {
+            ++currentTransmitCount;
+            if (currentTransmitCount >= 3) {
+                transmittedCommands.emplace(currentTransmitChunk);
+                currentTransmitChunk = currentTransmitCount = 0;
+            }
+        }
+    }
+
+    /**
+     * Set the address, and start connecting to it (or listening on it).
+     * Returns false if the address is invalid or can't be listened on.
+     * Must be called from the UI thread only!
+     */
+    bool setAddress(std::string newAddress) {
+        address = std::move(newAddress);
+        disconnect();
+
+        // flush any bytes that are still in the buffer
+        flushQueue();
+
+        return connect();
+    }
+
+    /**
+     * Get the address
+     * Must be called from the UI thread only!
+     */
+    const std::string& getAddress() const noexcept {
+        return address;
+    }
+
+    /**
+     * Clear the address
+     * Must be called from the UI thread only!
+     */
+    void clearAddress() {
+        address.clear();
+        disconnect();
+
+        // flush any bytes that are still in the buffer
+        flushQueue();
+    }
+
+    /**
+     * Reconnect to the address given by a previous setAddress() call.
+     */
+    // the queue to the socket thread is part of the object
+    size_t memoryUsage() const noexcept override {
+        return sizeof(StreamInputCommunicator) + transmittedCommands.bytes();
+    }
+
+    void reset() noexcept override {
+        // stop the current connection if any
+        disconnect();
+
+        while (!transmittedCommands.empty()) transmittedCommands.pop();
+        suppressEnded = true;
+        currentTransmitCount = 0;
+        currentTransmitChunk = 0;
+        currentReceiveCount = 0;
+        currentReceiveChunk = 0;
+        receiveWordCount = 0;
+        streamQueue.clear();
+
+        // connect again
+        try {
+            connect();
+        }
+        catch (...) {
+            // couldn't start the network thread, so the circuit will see an empty stream
+        }
+    }
+
+    /**
+     * Writes the address and the commands and bits that are in flight.
+     * The bytes that were received from the stream but not given to the circuit can't be received again, so they are not part of the checkpoint.
+     */
+    void writeCheckpoint(std::ostream& out) const override {
+        ext::write_binary_string(out, address);
+        ext::write_binary(out, suppressEnded);
+        ext::write_binary(out, currentTransmitChunk);
+        ext::write_binary(out, currentTransmitCount);
+        ext::write_binary(out, currentReceiveChunk);
+        ext::write_binary(out, currentReceiveCount);
+        std::vector<uint8_t> commands;
+        transmittedCommands.for_each([&](uint8_t command) {
+            commands.push_back(command);
+        });
+        ext::write_binary_array(out, commands.data(), commands.size());
+    }
+
+    /**
+     * Reconnects to the address given by the checkpoint.
+     */
+    bool readCheckpoint(std::istream& in) override {
+        std::string newAddress;
+        bool newSuppressEnded;
+        uint8_t transmitChunk, transmitCount, receiveCount;
+        uint16_t receiveChunk;
+        std::vector<uint8_t> commands;
+        if (!ext::read_binary_string(in, newAddress, std::numeric_limits<uint16_t>::max()) || !ext::read_binary(in, newSuppressEnded)) return false;
+        if (!ext::read_binary(in, transmitChunk) || !ext::read_binary(in, transmitCount) || !ext::read_binary(in, receiveChunk) || !ext::read_binary(in, receiveCount)) return false;
+        // the bits in flight are at most one command (3 bits) and one response (11 bits)
+        if (transmitCount >= 3 || receiveCount > 11) return false;
+        if (!ext::read_binary_array(in, commands, std::numeric_limits<uint32_t>::max())) return false;
+
+        disconnect();
+        address = std::move(newAddress);
+        while (!transmittedCommands.empty()) transmittedCommands.pop();
+        for (uint8_t command : commands) transmittedCommands.push(command);
+        suppressEnded = newSuppressEnded;
+        currentTransmitChunk = transmitChunk;
+        currentTransmitCount = transmitCount;
+        currentReceiveChunk = receiveChunk;
+        currentReceiveCount = receiveCount;
+        receiveWordCount = 0;
+        streamQueue.clear();
+
+        connect();
+        return true;
+    }
+};
@@ -0,0 +1,179 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+/**
+ * Cache of rendered text shared by the UI controls, so that the same string (in the same font and colours) is only rasterised and uploaded once.
+ * Entries are kept in least-recently-used order and evicted when there are too many of them or they take too much memory.
+ * Handles to entries stay valid after eviction, so a control may keep the text it is showing without holding it in the cache.
+ */
+
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <functional>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "font.hpp"
+#include "point.hpp"
+#include "sdl_automatic.hpp"
+
+class TextCache {
+public:
+    /**
+     * A rendered string.  The texture is only made when it is first asked for, since some controls only blit the surface into a larger one.
+     */
+    class Text {
+    private:
+        SDL_Surface* surface;
+        mutable UniqueTexture texture;
+    public:
+        explicit Text(SDL_Surface* surface) noexcept : surface(surface) {}
+        Text(const Text&) = delete;
+        Text& operator=(const Text&) = delete;
+        ~Text() {
+            SDL_FreeSurface(surface);
+        }
+
+        SDL_Surface* getSurface() const noexcept {
+            return surface;
+        }
+
+        ext::point size() const noexcept {
+            return { surface->w, surface->h };
+        }
+
+        SDL_Texture* getTexture(SDL_Renderer* renderer) const {
+            if (!texture) texture.reset(SDL_CreateTextureFromSurface(renderer, surface));
+            return texture.get();
+        }
+
+        // approximate memory used by the surface and its texture (counted even before the texture is made, so that the total does not drift)
+        size_t bytes() const noexcept {
+            return static_cast<size_t>(surface->pitch) * surface->h * 2;
+        }
+    };
+    using TextHandle = std::shared_ptr<const Text>;
+
+private:
+    constexpr static size_t maxEntries = 512;
+    constexpr static size_t maxBytes = size_t{ 32 } << 20;
+
+    enum struct Mode : uint8_t {
+        BLENDED,
+        SHADED
+    };
+
+    struct Key {
+        std::string fontPath; // the TTF_Font* might be reopened at the same address with another size, so the path and size are used instead
+        int fontSize;
+        Mode mode;
+        SDL_Color foreground;
+        SDL_Color background;
+        std::string text;
+
+        bool operator==(const Key& other) const noexcept {
+            return fontSize == other.fontSize && mode == other.mode && packColor(foreground) == packColor(other.foreground) && packColor(background) == packColor(other.background) && text == other.text && fontPath == other.fontPath;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const noexcept {
+            size_t ret = std::hash<std::string>{}(key.text);
+            const auto combine = [&ret](size_t value) {
+                ret ^= value + 0x9e3779b97f4a7c15ull + (ret << 6) + (ret >> 2);
+            };
+            combine(std::hash<std::string>{}(key.fontPath));
+            combine(static_cast<size_t>(key.fontSize));
+            combine(static_cast<size_t>(key.mode));
+            combine(packColor(key.foreground));
+            combine(packColor(key.background));
+            return ret;
+        }
+    };
+
+    struct Entry {
+        Key key;
+        TextHandle text;
+    };
+
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    size_t totalBytes = 0;
+
+    static uint32_t packColor(const SDL_Color& color) noexcept {
+        return static_cast<uint32_t>(color.r) | static_cast<uint32_t>(color.g) << 8 | static_cast<uint32_t>(color.b) << 16 | static_cast<uint32_t>(color.a) << 24;
+    }
+
+    void evict() {
+        while (entries.size() > maxEntries || (totalBytes > maxBytes && entries.size() > 1)) {
+            totalBytes -= entries.back().text->bytes();
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    template <typename Render>
+    TextHandle get(Key&& key, Render render) {
+        if (auto it = index.find(key); it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->text;
+        }
+        SDL_Surface* surface = render(key.text.c_str());
+        if (surface == nullptr) return nullptr; // TTF fails on empty text, which is not worth caching
+        TextHandle text = std::make_shared<const Text>(surface);
+        totalBytes += text->bytes();
+        entries.push_front(Entry{ std::move(key), text });
+        index.emplace(entries.front().key, entries.begin());
+        evict();
+        return text;
+    }
+
+public:
+    TextCache() = default;
+    TextCache(const TextCache&) = delete;
+    TextCache& operator=(const TextCache&) = delete;
+
+    /**
+     * Returns the text rendered with TTF_RenderText_Blended(), or nullptr if it could not be rendered (e.g. if it is empty).
+     */
+    TextHandle renderBlended(const Font& font, std::string_view text, SDL_Color foreground) {
+        return get(Key{ font.path(), font.size(), Mode::BLENDED, foreground, SDL_Color{ 0, 0, 0, 0 }, std::string(text) }, [&](const char* str) {
+            return TTF_RenderText_Blended(font, str, foreground);
+        });
+    }
+
+    /**
+     * Returns the text rendered with TTF_RenderText_Shaded(), or nullptr if it could not be rendered (e.g. if it is empty).
+     */
+    TextHandle renderShaded(const Font& font, std::string_view text, SDL_Color foreground, SDL_Color background) {
+        return get(Key{ font.path(), font.size(), Mode::SHADED, foreground, background, std::string(text) }, [&](const char* str) {
+            return TTF_RenderText_Shaded(font, str, foreground, background);
+        });
+    }
+
+    /**
+     * Drops all the entries (the renderer is about to be destroyed).
+     */
+    void clear() noexcept {
+        index.clear();
+        entries.clear();
+        totalBytes = 0;
+    }
+};
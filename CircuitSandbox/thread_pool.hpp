@@ -0,0 +1,290 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * A fork-join pool of persistent worker threads.
+ * parallel_for() hands out task indices to the workers and to the calling thread, and returns when all tasks are done.
+ * Several threads may submit work at the same time; their batches run one at a time, higher priorities first and otherwise in the order they were submitted.
+ * A running batch is never preempted, so a higher priority batch waits for at most one batch.
+ * A callback that calls parallel_for() on a pool whose batch it is part of (directly or through another pool) runs the nested batch on its own thread, since waiting for a turn would deadlock.
+ * Workers spin for a short while after each batch before going to sleep, so that back-to-back batches (e.g. one per simulation step) don't pay for a wakeup.
+ */
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace ext {
+    class thread_pool {
+    private:
+        // number of times a worker polls for the next batch before it goes to sleep
+        constexpr static int spin_count = 4096;
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable startCV;
+        std::condition_variable doneCV;
+        std::condition_variable turnCV;
+
+    public:
+        /**
+         * The order in which the batches of concurrent submitters are run.
+         * Bulk work that nobody is waiting on from frame to frame (loading, merging, compiling) should be submitted as low, so that it only fills the gaps between interactive batches.
+         */
+        enum class priority : uint8_t {
+            low,
+            normal,
+            high,
+        };
+        constexpr static size_t num_priorities = 3;
+
+        /**
+         * Sets the priority of the batches that the current thread submits (to any pool) while it is alive, for code that submits through a pool pointer it does not own (e.g. CanvasState::loadSave()).
+         */
+        class priority_scope {
+        private:
+            priority previous;
+        public:
+            explicit priority_scope(priority p) noexcept : previous(thread_priority()) {
+                thread_priority() = p;
+            }
+            priority_scope(const priority_scope&) = delete;
+            priority_scope& operator=(const priority_scope&) = delete;
+            ~priority_scope() {
+                thread_priority() = previous;
+            }
+        };
+
+    private:
+        static priority& thread_priority() noexcept {
+            thread_local priority p = priority::normal;
+            return p;
+        }
+
+        // the pools whose batches the current thread is running tasks of, innermost first
+        struct running_frame {
+            const thread_pool* pool;
+            const running_frame* outer;
+        };
+        static const running_frame*& running_frames() noexcept {
+            thread_local const running_frame* top = nullptr;
+            return top;
+        }
+        bool running_on_this_thread() const noexcept {
+            for (const running_frame* frame = running_frames(); frame; frame = frame->outer) {
+                if (frame->pool == this) return true;
+            }
+            return false;
+        }
+
+        // the current batch
+        void (*invoker)(const void*, size_t) = nullptr;
+        const void* context = nullptr;
+        size_t numTasks = 0;
+        std::atomic<size_t> nextTask = 0;
+        std::atomic<size_t> busyWorkers = 0;
+
+        // incremented when a new batch is submitted
+        std::atomic<uint64_t> generation = 0;
+        std::atomic<bool> stopping = false;
+
+        // tickets that order the batches of concurrent submitters of each priority (first come, first served), guarded by mutex
+        bool batchRunning = false;
+        uint64_t nextTicket[num_priorities] = {};
+        uint64_t servingTicket[num_priorities] = {};
+
+        void runTasks() noexcept {
+            const running_frame frame{ this, running_frames() };
+            running_frames() = &frame;
+            size_t task;
+            while ((task = nextTask.fetch_add(1, std::memory_order_relaxed)) < numTasks) {
+                invoker(context, task);
+            }
+            running_frames() = frame.outer;
+        }
+
+        // whether no batch is running and the given ticket is the oldest one of the highest priority that is waiting
+        bool isTurn(size_t level, uint64_t ticket) const noexcept {
+            if (batchRunning || servingTicket[level] != ticket) return false;
+            for (size_t higher = level + 1; higher != num_priorities; ++higher) {
+                if (servingTicket[higher] != nextTicket[higher]) return false;
+            }
+            return true;
+        }
+
+        void workerLoop() noexcept {
+            uint64_t seenGeneration = 0;
+            while (true) {
+                // wait for the next batch, spinning at first
+                int spins = 0;
+                while (generation.load(std::memory_order_acquire) == seenGeneration && !stopping.load(std::memory_order_relaxed)) {
+                    if (++spins == spin_count) {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        startCV.wait(lock, [&]() {
+                            return generation.load(std::memory_order_relaxed) != seenGeneration || stopping.load(std::memory_order_relaxed);
+                        });
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+                if (stopping.load(std::memory_order_acquire)) return;
+                seenGeneration = generation.load(std::memory_order_acquire);
+
+                runTasks();
+
+                if (busyWorkers.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    // we are the last worker to finish, so wake the submitting thread if it is sleeping
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                    }
+                    doneCV.notify_one();
+                }
+            }
+        }
+
+    public:
+        /**
+         * Creates a pool with the given number of worker threads (not including the thread that calls parallel_for()).
+         */
+        explicit thread_pool(size_t numWorkers) {
+            threads.reserve(numWorkers);
+            for (size_t i = 0; i != numWorkers; ++i) {
+                threads.emplace_back([this]() {
+                    workerLoop();
+                });
+            }
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping.store(true, std::memory_order_release);
+            }
+            startCV.notify_all();
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+
+        /**
+         * The pool for bulk work that is not latency sensitive (loading and merging canvases, background compilation), with one worker per core besides the calling thread.
+         * The simulators and the renderer have pools of their own, since a step or a frame must not wait behind a bulk batch.
+         */
+        static thread_pool& shared() {
+            static thread_pool pool(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+            return pool;
+        }
+
+        /**
+         * The number of threads that run tasks, including the thread that calls parallel_for().
+         */
+        size_t concurrency() const noexcept {
+            return threads.size() + 1;
+        }
+
+        /**
+         * Calls callback(i) for every i in [0, count), spread over all the threads in the pool (including the current thread).
+         * The batch waits for its turn behind the running batch and the waiting batches of the same or higher priority (by default, the priority of the current thread's priority_scope).
+         * Returns when all the calls have completed.
+         * The callback must not throw.
+         */
+        template <typename Callback>
+        void parallel_for(size_t count, const Callback& callback) {
+            parallel_for(count, callback, thread_priority());
+        }
+
+        template <typename Callback>
+        void parallel_for(size_t count, const Callback& callback, priority p) {
+            if (threads.empty() || count <= 1 || running_on_this_thread()) {
+                for (size_t i = 0; i != count; ++i) {
+                    callback(i);
+                }
+                return;
+            }
+
+            // wait for the running batch and the batches that go before this one
+            const size_t level = static_cast<size_t>(p);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                const uint64_t ticket = nextTicket[level]++;
+                turnCV.wait(lock, [this, level, ticket]() {
+                    return isTurn(level, ticket);
+                });
+                batchRunning = true;
+                ++servingTicket[level];
+            }
+
+            invoker = [](const void* ctx, size_t task) {
+                (*static_cast<const Callback*>(ctx))(task);
+            };
+            context = &callback;
+            numTasks = count;
+            nextTask.store(0, std::memory_order_relaxed);
+            busyWorkers.store(threads.size(), std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                generation.fetch_add(1, std::memory_order_release);
+            }
+            startCV.notify_all();
+
+            // do some of the work on this thread too
+            runTasks();
+
+            // wait for the workers, spinning at first
+            int spins = 0;
+            while (busyWorkers.load(std::memory_order_acquire) != 0) {
+                if (++spins == spin_count) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    doneCV.wait(lock, [this]() {
+                        return busyWorkers.load(std::memory_order_acquire) == 0;
+                    });
+                    break;
+                }
+                std::this_thread::yield();
+            }
+
+            // let the next submitter in
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                batchRunning = false;
+            }
+            turnCV.notify_all();
+        }
+
+        /**
+         * Splits [0, count) into contiguous ranges of at least minRange indices each (unless count itself is smaller), and calls callback(begin, end) for each range, spread over all the threads in the pool.
+         * There are a few ranges per thread, so that the threads stay busy even if some ranges take longer than others.
+         * Returns when all the calls have completed.
+         * The callback must not throw.
+         */
+        template <typename Callback>
+        void parallel_for_ranges(size_t count, size_t minRange, const Callback& callback) {
+            parallel_for_ranges(count, minRange, callback, thread_priority());
+        }
+
+        template <typename Callback>
+        void parallel_for_ranges(size_t count, size_t minRange, const Callback& callback, priority p) {
+            const size_t numRanges = std::max<size_t>(std::min(concurrency() * 4, count / std::max<size_t>(minRange, 1)), 1);
+            parallel_for(numRanges, [&](size_t i) {
+                callback(count * i / numRanges, count * (i + 1) / numRanges);
+            }, p);
+        }
+    };
+}
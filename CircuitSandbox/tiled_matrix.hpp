@@ -0,0 +1,830 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <utility>
+#include <memory>
+#include <vector>
+#include <algorithm> // for std::copy, std::move, std::fill, std::swap_ranges, std::count_if
+#include <type_traits>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "algorithm.hpp"
+#include "point.hpp"
+#include "reduce.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Represents a generic 2D array that is stored as square tiles, where the tiles that have never been written to are not allocated.
+ * Unallocated tiles read as default-constructed elements, so memory scales with the area that was written to instead of the size of the matrix.
+ * Tiles are copy-on-write: copying the matrix shares all its tiles, and a shared tile is only duplicated when one of the matrices writes to it.
+ * A tile may also be shared by several positions of the same matrix (see share_or_for_each()), in which case writing to one of them duplicates it in the same way.
+ * The bounds of the matrix can be moved with resize(), which only moves the tile pointers (the elements stay in their tiles, since the position of the first element within its tile can be anything).
+ * Note: the non-const operator[] allocates (or unshares) the tile of the element, so read-only code (especially code that runs on multiple threads) should access the matrix through a const reference.
+ * Every matrix has a version (see version()) that changes whenever it is accessed for writing, so that callers can tell that a matrix was not modified without reading it.
+ */
+
+namespace ext {
+
+    template <typename T, int32_t TileShift = 6>
+    class tiled_matrix {
+
+    public:
+        constexpr static int32_t tile_size = static_cast<int32_t>(1) << TileShift; // width and height of each tile
+
+    private:
+        constexpr static int32_t tile_mask = tile_size - 1;
+        constexpr static int32_t tile_area = tile_size * tile_size;
+
+        std::vector<std::shared_ptr<T[]>> tiles; // the tiles in row-major order (nullptr if not allocated); each row of a tile is a contiguous range of elements
+        int32_t _width;
+        int32_t _height;
+        int32_t _tilesX; // number of tiles in each row of tiles
+        // the position of the element {0,0} within the first tile (each coordinate is in [0, tile_size)), so the tile of {x,y} is at (origin + {x,y}) / tile_size
+        // elements of allocated tiles that are outside the bounds are always default-constructed, so that they can become part of the matrix when it is resized
+        ext::point _origin{ 0, 0 };
+        // the version of the elements: the id is unique to this matrix (copies get a new one, moves take it along), and the generation is incremented by every writable access
+        uint64_t _id = next_id();
+        uint64_t _generation = 0;
+
+        inline static const T empty_element{}; // the value of every element in an unallocated tile
+
+        static uint64_t next_id() noexcept {
+            static std::atomic<uint64_t> last_id{ 0 };
+            return last_id.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+
+        static int32_t num_tiles(int32_t length) noexcept {
+            return (length + tile_mask) >> TileShift;
+        }
+
+        size_t tile_index(int32_t x, int32_t y) const noexcept {
+            return static_cast<size_t>((y + _origin.y) >> TileShift) * _tilesX + ((x + _origin.x) >> TileShift);
+        }
+
+        size_t offset_in_tile(int32_t x, int32_t y) const noexcept {
+            return static_cast<size_t>((y + _origin.y) & tile_mask) * tile_size + ((x + _origin.x) & tile_mask);
+        }
+
+        int32_t num_tile_rows() const noexcept {
+            return empty() ? 0 : num_tiles(_height + _origin.y);
+        }
+
+        // the bounds of the given tile, in the coordinates of the elements (the tile may extend outside the matrix)
+        ext::point tile_top_left(int32_t tileX, int32_t tileY) const noexcept {
+            return ext::point{ tileX << TileShift, tileY << TileShift } - _origin;
+        }
+
+        static std::shared_ptr<T[]> make_tile() {
+            return std::shared_ptr<T[]>(new T[tile_area]());
+        }
+
+        /**
+         * Makes the given tile owned only by this matrix, by duplicating it if it is shared with another matrix.
+         * @pre the tile is allocated
+         */
+        static T* unshare(std::shared_ptr<T[]>& tile) {
+            if (tile.use_count() != 1) {
+                std::shared_ptr<T[]> copy = make_tile();
+                std::copy(tile.get(), tile.get() + tile_area, copy.get());
+                tile = std::move(copy);
+            }
+            else {
+                // the matrix that shared it may have been on another thread, so synchronize with it releasing its reference, so that its reads happen before our writes
+                std::atomic_thread_fence(std::memory_order_acquire);
+            }
+            return tile.get();
+        }
+
+        /**
+         * Returns a pointer to the element at {x,y}, or nullptr if its tile is not allocated.
+         */
+        const T* find(int32_t x, int32_t y) const noexcept {
+            const std::shared_ptr<T[]>& tile = tiles[tile_index(x, y)];
+            return tile ? tile.get() + offset_in_tile(x, y) : nullptr;
+        }
+
+        /**
+         * Returns a writable pointer to the element at {x,y} (unsharing its tile), or nullptr if its tile is not allocated.
+         */
+        T* find(int32_t x, int32_t y) {
+            ++_generation;
+            std::shared_ptr<T[]>& tile = tiles[tile_index(x, y)];
+            return tile ? unshare(tile) + offset_in_tile(x, y) : nullptr;
+        }
+
+        /**
+         * Returns a writable pointer to the element at {x,y}, allocating or unsharing its tile if necessary.
+         */
+        T* allocate(int32_t x, int32_t y) {
+            ++_generation;
+            std::shared_ptr<T[]>& tile = tiles[tile_index(x, y)];
+            if (!tile) tile = make_tile();
+            return unshare(tile) + offset_in_tile(x, y);
+        }
+
+        /**
+         * Returns the elements of the given tile (unsharing it if the matrix is non-const), or nullptr if it is not allocated.
+         */
+        static const T* tile_data(const tiled_matrix& matrix, size_t index) noexcept {
+            return matrix.tiles[index].get();
+        }
+        static T* tile_data(tiled_matrix& matrix, size_t index) {
+            ++matrix._generation;
+            std::shared_ptr<T[]>& tile = matrix.tiles[index];
+            return tile ? unshare(tile) : nullptr;
+        }
+
+        /**
+         * Calls callback(pt, element) for every element in [topLeft, bottomRight) that is in an allocated tile, one tile at a time.
+         */
+        template <typename Matrix, typename Callback>
+        static void for_each_impl(Matrix& matrix, const ext::point& topLeft, const ext::point& bottomRight, Callback&& callback) {
+            if (topLeft.x >= bottomRight.x || topLeft.y >= bottomRight.y) return;
+            const ext::point& origin = matrix._origin;
+            for (int32_t tileY = (topLeft.y + origin.y) >> TileShift; tileY <= ((bottomRight.y - 1 + origin.y) >> TileShift); ++tileY) {
+                for (int32_t tileX = (topLeft.x + origin.x) >> TileShift; tileX <= ((bottomRight.x - 1 + origin.x) >> TileShift); ++tileX) {
+                    auto* tile = tile_data(matrix, static_cast<size_t>(tileY) * matrix._tilesX + tileX);
+                    if (!tile) continue;
+                    const ext::point tileTopLeft = matrix.tile_top_left(tileX, tileY);
+                    const int32_t yBegin = std::max(topLeft.y, tileTopLeft.y);
+                    const int32_t yEnd = std::min(bottomRight.y, tileTopLeft.y + tile_size);
+                    const int32_t xBegin = std::max(topLeft.x, tileTopLeft.x);
+                    const int32_t xEnd = std::min(bottomRight.x, tileTopLeft.x + tile_size);
+                    for (int32_t y = yBegin; y != yEnd; ++y) {
+                        for (int32_t x = xBegin; x != xEnd; ++x) {
+                            callback(ext::point{ x, y }, tile[matrix.offset_in_tile(x, y)]);
+                        }
+                    }
+                }
+            }
+        }
+
+        /**
+         * Returns the bounding rectangle [topLeft, bottomRight) of the elements of the given tile (within the bounds of the matrix) for which is_empty(element) is false.
+         * The rectangle is empty (i.e. topLeft is not less than bottomRight) if there are none.
+         */
+        template <typename Predicate>
+        std::pair<ext::point, ext::point> tile_occupied_bounds(int32_t tileX, int32_t tileY, Predicate& is_empty) const {
+            ext::point minPt = ext::point::max();
+            ext::point maxPt = ext::point::min();
+            const T* tile = tiles[static_cast<size_t>(tileY) * _tilesX + tileX].get();
+            if (!tile) return { minPt, maxPt };
+            const ext::point tileTopLeft = tile_top_left(tileX, tileY);
+            const ext::point begin = ext::max(tileTopLeft, ext::point{ 0, 0 });
+            const ext::point end = ext::min(tileTopLeft + ext::point{ tile_size, tile_size }, size());
+            for (int32_t y = begin.y; y < end.y; ++y) {
+                const T* row = tile + offset_in_tile(begin.x, y);
+                for (int32_t x = begin.x; x < end.x; ++x, ++row) {
+                    if (is_empty(*row)) continue;
+                    minPt = ext::min(minPt, ext::point{ x, y });
+                    maxPt = ext::max(maxPt, ext::point{ x + 1, y + 1 });
+                }
+            }
+            return { minPt, maxPt };
+        }
+
+        /**
+         * Returns the reduction by op of init and map(i) for every i in [0, count).
+         * If a pool is given, the values are mapped in parallel (map must then be safe to call from several threads at once).
+         */
+        template <typename Map, typename Op>
+        static int32_t reduce_tiles(int32_t count, ext::thread_pool* pool, int32_t init, const Map& map, const Op& op) {
+            // reading a tile takes a few microseconds, so a few tiles are read by each task
+            constexpr size_t tiles_per_task = 4;
+            if (!pool || static_cast<size_t>(count) < 2 * tiles_per_task) {
+                for (int32_t i = 0; i != count; ++i) {
+                    init = op(init, map(i));
+                }
+                return init;
+            }
+            std::vector<int32_t> values(static_cast<size_t>(count));
+            pool->parallel_for_ranges(values.size(), tiles_per_task, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i != end; ++i) {
+                    values[i] = map(static_cast<int32_t>(i));
+                }
+            });
+            return ext::reduce(values.begin(), values.end(), init, op);
+        }
+
+    public:
+
+        friend inline void swap(tiled_matrix& a, tiled_matrix& b) noexcept {
+            using std::swap;
+
+            swap(a.tiles, b.tiles);
+            swap(a._width, b._width);
+            swap(a._height, b._height);
+            swap(a._tilesX, b._tilesX);
+            swap(a._origin, b._origin);
+            swap(a._id, b._id);
+            swap(a._generation, b._generation);
+        }
+
+        tiled_matrix() noexcept : _width(0), _height(0), _tilesX(0) {}
+
+        // the tiles are shared, and are only duplicated when either matrix writes to them
+        tiled_matrix(const tiled_matrix& other) : tiles(other.tiles), _width(other._width), _height(other._height), _tilesX(other._tilesX), _origin(other._origin) {}
+        tiled_matrix& operator=(const tiled_matrix& other) {
+            if (this != &other) {
+                tiled_matrix tmp(other);
+                swap(*this, tmp);
+            }
+            return *this;
+        }
+
+        // noexcept is used to enforce move semantics when tiled_matrix is used with STL containers
+        tiled_matrix(tiled_matrix&& other) noexcept : tiles(std::move(other.tiles)), _width(other._width), _height(other._height), _tilesX(other._tilesX), _origin(other._origin), _id(other._id), _generation(other._generation) {
+            other.tiles.clear();
+            other._width = 0;
+            other._height = 0;
+            other._tilesX = 0;
+            other._origin = { 0, 0 };
+            other._id = next_id();
+            other._generation = 0;
+        }
+        tiled_matrix& operator=(tiled_matrix&& other) noexcept {
+            swap(*this, other);
+            return *this;
+        }
+
+        tiled_matrix(int32_t width, int32_t height) : _width(width), _height(height) {
+            if (_width == 0 || _height == 0) {
+                _width = 0;
+                _height = 0;
+                _tilesX = 0;
+            }
+            else {
+                _tilesX = num_tiles(_width);
+                tiles.resize(static_cast<size_t>(_tilesX) * num_tiles(_height)); // no tiles are allocated yet
+            }
+        }
+
+        tiled_matrix(const ext::point& size) : tiled_matrix(size.x, size.y) {}
+
+        /**
+         * returns true if the matrix is empty (i.e. has no width and height)
+         */
+        bool empty() const noexcept {
+            return tiles.empty();
+        }
+
+        /**
+         * Returns the version of the elements of this matrix.
+         * If a matrix has the same version as before, it has not been written to since (while a matrix with a different version might still hold the same elements).
+         * No two matrices have the same version, except for a matrix and the one it was moved from (or swapped with) before.
+         */
+        std::pair<uint64_t, uint64_t> version() const noexcept {
+            return { _id, _generation };
+        }
+
+        /**
+         * returns the width of the matrix
+         */
+        int32_t width() const noexcept {
+            return _width;
+        }
+
+        /**
+         * returns the height of the matrix
+         */
+        int32_t height() const noexcept {
+            return _height;
+        }
+
+        /**
+         * returns the size of the matrix
+         */
+        ext::point size() const noexcept {
+            return { _width, _height };
+        }
+
+        /**
+         * returns true if the point is within the bounds of the matrix
+         */
+        bool contains(const ext::point& pt) const noexcept {
+            return ext::contains(0, _width, pt.x) && ext::contains(0, _height, pt.y);
+        }
+
+        /**
+         * returns true if rectangle overlaps with the matrix
+         * note that bottomRight is past-the-end
+         * assumes that the rectangle specified has a non-negative size
+         */
+        bool overlaps(const ext::point& topLeft, const ext::point& bottomRight) const noexcept {
+            return ext::overlaps(0, _width, topLeft.x, bottomRight.x) && ext::overlaps(0, _height, topLeft.y, bottomRight.y);
+        }
+
+        /**
+         * indices is a pair of {x,y}
+         * Allocates the tile containing the element if it is not allocated yet.
+         * Note: this changes the version of the matrix, so it must not be called from several threads at once, even for elements of different tiles (see write_tile()).
+         * @pre indices must be within the bounds of width and height
+         */
+        T& operator[](const point& indices) {
+            return *allocate(indices.x, indices.y);
+        }
+
+        /**
+         * Writes to the elements of one tile through a pointer that was looked up (and unshared) once, instead of once per element.
+         */
+        class tile_writer {
+        private:
+            T* elements = nullptr;
+            ext::point topLeft{ 0, 0 }; // the position of the first element of the tile (which may be outside the matrix)
+
+            tile_writer(T* elements, const ext::point& topLeft) noexcept : elements(elements), topLeft(topLeft) {}
+            friend class tiled_matrix;
+
+        public:
+            // a writer that contains no elements
+            tile_writer() noexcept = default;
+
+            /**
+             * returns true if pt is in the tile of this writer
+             */
+            bool contains(const point& pt) const noexcept {
+                return elements && ext::contains(topLeft.x, topLeft.x + tile_size, pt.x) && ext::contains(topLeft.y, topLeft.y + tile_size, pt.y);
+            }
+
+            /**
+             * @pre contains(pt), and pt is within the bounds of the matrix
+             */
+            T& operator[](const point& pt) const noexcept {
+                return elements[static_cast<size_t>(pt.y - topLeft.y) * tile_size + (pt.x - topLeft.x)];
+            }
+        };
+
+        /**
+         * Returns a writer for the tile that contains pt, allocating or unsharing the tile if necessary.
+         * Unlike the non-const operator[], this does not change the version of the matrix, so it may be called from several threads at once as long as they write to different tiles,
+         * and nothing else accesses the matrix meanwhile; once the writes are done, mark_written() must be called on one thread so that the version changes.
+         * The writer is invalidated by any other writable access to the tile.
+         * @pre contains(pt)
+         */
+        tile_writer write_tile(const point& pt) {
+            std::shared_ptr<T[]>& tile = tiles[tile_index(pt.x, pt.y)];
+            if (!tile) tile = make_tile();
+            const ext::point topLeftInTiles{ (pt.x + _origin.x) & ~tile_mask, (pt.y + _origin.y) & ~tile_mask };
+            return tile_writer(unshare(tile), topLeftInTiles - _origin);
+        }
+
+        /**
+         * Changes the version of the matrix, after it was written to with write_tile().
+         */
+        void mark_written() noexcept {
+            ++_generation;
+        }
+
+        /**
+         * indices is a pair of {x,y}
+         * @pre indices must be within the bounds of width and height
+         */
+        const T& operator[](const point& indices) const noexcept {
+            const T* element = find(indices.x, indices.y);
+            return element ? *element : empty_element;
+        }
+
+        /**
+         * Calls callback(pt, element) for every element in [topLeft, bottomRight) (clipped to the matrix) whose tile is allocated, in no particular order.
+         * The elements that are skipped are default-constructed.
+         */
+        template <typename Callback>
+        void for_each(ext::point topLeft, ext::point bottomRight, Callback&& callback) {
+            for_each_impl(*this, ext::max(topLeft, ext::point{ 0, 0 }), ext::min(bottomRight, size()), std::forward<Callback>(callback));
+        }
+
+        template <typename Callback>
+        void for_each(ext::point topLeft, ext::point bottomRight, Callback&& callback) const {
+            for_each_impl(*this, ext::max(topLeft, ext::point{ 0, 0 }), ext::min(bottomRight, size()), std::forward<Callback>(callback));
+        }
+
+        template <typename Callback>
+        void for_each(Callback&& callback) {
+            for_each_impl(*this, ext::point{ 0, 0 }, size(), std::forward<Callback>(callback));
+        }
+
+        template <typename Callback>
+        void for_each(Callback&& callback) const {
+            for_each_impl(*this, ext::point{ 0, 0 }, size(), std::forward<Callback>(callback));
+        }
+
+        /**
+         * Frees every allocated tile that overlaps [topLeft, bottomRight) whose elements all satisfy is_empty(element).
+         * is_empty() should be true for a default-constructed element, since that is what the freed elements will read as.
+         */
+        template <typename Predicate>
+        void release_empty_tiles(ext::point topLeft, ext::point bottomRight, Predicate&& is_empty) {
+            topLeft = ext::max(topLeft, ext::point{ 0, 0 });
+            bottomRight = ext::min(bottomRight, size());
+            if (topLeft.x >= bottomRight.x || topLeft.y >= bottomRight.y) return;
+            ++_generation;
+            for (int32_t tileY = (topLeft.y + _origin.y) >> TileShift; tileY <= ((bottomRight.y - 1 + _origin.y) >> TileShift); ++tileY) {
+                for (int32_t tileX = (topLeft.x + _origin.x) >> TileShift; tileX <= ((bottomRight.x - 1 + _origin.x) >> TileShift); ++tileX) {
+                    std::shared_ptr<T[]>& tile = tiles[static_cast<size_t>(tileY) * _tilesX + tileX];
+                    // the elements outside the bounds are default-constructed, so the whole tile can be checked
+                    if (tile && std::all_of(tile.get(), tile.get() + tile_area, is_empty)) tile.reset();
+                }
+            }
+        }
+
+        template <typename Predicate>
+        void release_empty_tiles(Predicate&& is_empty) {
+            release_empty_tiles(ext::point{ 0, 0 }, size(), std::forward<Predicate>(is_empty));
+        }
+
+        /**
+         * Returns the smallest rectangle [topLeft, bottomRight) that contains every element for which is_empty(element) is false,
+         * or {{0,0},{0,0}} if there are none.
+         * The rows and columns of tiles are read inwards from each edge, stopping at the first one that has such an element,
+         * so only the tiles near the edges are read (instead of all of them) unless the matrix is mostly empty.
+         * If a pool is given, the tiles of each row and column are read in parallel, so is_empty may be called from several threads at once.
+         */
+        template <typename Predicate>
+        std::pair<ext::point, ext::point> occupied_bounds(Predicate&& is_empty, ext::thread_pool* pool = nullptr) const {
+            const int32_t tilesY = num_tile_rows();
+            const auto minOf = [](int32_t a, int32_t b) { return std::min(a, b); };
+            const auto maxOf = [](int32_t a, int32_t b) { return std::max(a, b); };
+            ext::point minPt = ext::point::max();
+            ext::point maxPt = ext::point::min();
+            // the rows of tiles from the top and from the bottom
+            int32_t firstTileY = 0;
+            for (; firstTileY != tilesY && minPt.y == ext::point::max().y; ++firstTileY) {
+                minPt.y = reduce_tiles(_tilesX, pool, minPt.y, [&](int32_t tileX) {
+                    return tile_occupied_bounds(tileX, firstTileY, is_empty).first.y;
+                }, minOf);
+            }
+            if (minPt.y == ext::point::max().y) return { ext::point{ 0, 0 }, ext::point{ 0, 0 } };
+            --firstTileY;
+            int32_t lastTileY = tilesY - 1;
+            for (; maxPt.y == ext::point::min().y; --lastTileY) {
+                maxPt.y = reduce_tiles(_tilesX, pool, maxPt.y, [&](int32_t tileX) {
+                    return tile_occupied_bounds(tileX, lastTileY, is_empty).second.y;
+                }, maxOf);
+            }
+            ++lastTileY;
+            // the columns of tiles from the left and from the right, only within the rows of tiles that have elements
+            const int32_t columnTiles = lastTileY - firstTileY + 1;
+            for (int32_t tileX = 0; minPt.x == ext::point::max().x; ++tileX) {
+                minPt.x = reduce_tiles(columnTiles, pool, minPt.x, [&](int32_t i) {
+                    return tile_occupied_bounds(tileX, firstTileY + i, is_empty).first.x;
+                }, minOf);
+            }
+            for (int32_t tileX = _tilesX - 1; maxPt.x == ext::point::min().x; --tileX) {
+                maxPt.x = reduce_tiles(columnTiles, pool, maxPt.x, [&](int32_t i) {
+                    return tile_occupied_bounds(tileX, firstTileY + i, is_empty).second.x;
+                }, maxOf);
+            }
+            return { minPt, maxPt };
+        }
+
+        /**
+         * Changes the bounds of the matrix to [topLeft, bottomRight) (in the current coordinates), so that the element at topLeft becomes the element at {0,0}.
+         * The elements within both the old and the new bounds keep their values, and the other elements of the new bounds are default-constructed.
+         * The elements stay in their tiles and only the tile pointers are moved, so this takes time proportional to the number of tiles instead of the number of elements.
+         */
+        void resize(const ext::point& topLeft, const ext::point& bottomRight) {
+            const ext::point newSize = bottomRight - topLeft;
+            if (newSize.x <= 0 || newSize.y <= 0) {
+                *this = tiled_matrix();
+                return;
+            }
+            if (empty()) {
+                *this = tiled_matrix(newSize);
+                return;
+            }
+            // the first tile of the new bounds, in the current tile grid (shifting a negative number rounds down)
+            const ext::point topLeftInTiles = topLeft + _origin;
+            const ext::point tileShift{ topLeftInTiles.x >> TileShift, topLeftInTiles.y >> TileShift };
+            const ext::point newOrigin{ topLeftInTiles.x & tile_mask, topLeftInTiles.y & tile_mask };
+            const int32_t newTilesX = num_tiles(newSize.x + newOrigin.x);
+            const int32_t newTilesY = num_tiles(newSize.y + newOrigin.y);
+            const int32_t oldTilesY = num_tile_rows();
+            // the old bounds, in the new coordinates
+            const ext::point oldTopLeft = -topLeft;
+            const ext::point oldBottomRight = size() - topLeft;
+
+            std::vector<std::shared_ptr<T[]>> newTiles(static_cast<size_t>(newTilesX) * newTilesY);
+            for (int32_t tileY = 0; tileY != newTilesY; ++tileY) {
+                const int32_t oldTileY = tileY + tileShift.y;
+                if (oldTileY < 0 || oldTileY >= oldTilesY) continue;
+                for (int32_t tileX = 0; tileX != newTilesX; ++tileX) {
+                    const int32_t oldTileX = tileX + tileShift.x;
+                    if (oldTileX < 0 || oldTileX >= _tilesX) continue;
+                    std::shared_ptr<T[]>& tile = newTiles[static_cast<size_t>(tileY) * newTilesX + tileX] = std::move(tiles[static_cast<size_t>(oldTileY) * _tilesX + oldTileX]);
+                    if (!tile) continue;
+
+                    // the elements of this tile that were within the old bounds but are outside the new bounds have to be cleared, to keep the elements outside the bounds default-constructed
+                    // (this only happens to the tiles at the edges, and only on the sides that shrink)
+                    const ext::point tileTopLeft = ext::point{ tileX << TileShift, tileY << TileShift } - newOrigin;
+                    const ext::point keptTopLeft = ext::max(tileTopLeft, oldTopLeft);
+                    const ext::point keptBottomRight = ext::min(tileTopLeft + ext::point{ tile_size, tile_size }, oldBottomRight);
+                    if (keptTopLeft.x >= 0 && keptTopLeft.y >= 0 && keptBottomRight.x <= newSize.x && keptBottomRight.y <= newSize.y) continue;
+                    T* elements = unshare(tile);
+                    for (int32_t y = keptTopLeft.y; y < keptBottomRight.y; ++y) {
+                        for (int32_t x = keptTopLeft.x; x < keptBottomRight.x; ++x) {
+                            if (x < 0 || y < 0 || x >= newSize.x || y >= newSize.y) {
+                                elements[static_cast<size_t>(y - tileTopLeft.y) * tile_size + (x - tileTopLeft.x)] = T{};
+                            }
+                        }
+                    }
+                }
+            }
+
+            tiles = std::move(newTiles);
+            ++_generation;
+            _width = newSize.x;
+            _height = newSize.y;
+            _tilesX = newTilesX;
+            _origin = newOrigin;
+        }
+
+        /**
+         * Frees the tile that contains pt (if it is allocated), so all its elements read as default-constructed elements again.
+         * @pre contains(pt)
+         */
+        void release_tile(const point& pt) noexcept {
+            ++_generation;
+            tiles[tile_index(pt.x, pt.y)].reset();
+        }
+
+        /**
+         * Returns true if the other matrix has the same size and equal(element, otherElement) is true for every pair of elements at the same position.
+         * Tiles that the matrices share are skipped, so if one matrix is a copy of the other, only the tiles written to since the copy are read.
+         */
+        template <typename Equal>
+        bool equal_elements(const tiled_matrix& other, Equal&& equal) const {
+            if (size() != other.size()) return false;
+            if (_origin != other._origin) {
+                // the tiles don't line up, so nothing is shared
+                for (int32_t y = 0; y != _height; ++y) {
+                    for (int32_t x = 0; x != _width; ++x) {
+                        if (!equal((*this)[{ x, y }], other[{ x, y }])) return false;
+                    }
+                }
+                return true;
+            }
+            for (size_t i = 0; i != tiles.size(); ++i) {
+                if (tiles[i] == other.tiles[i]) continue;
+                // the elements outside the bounds are default-constructed in both matrices, so the whole tile can be compared
+                const T* tile = tiles[i].get();
+                const T* other_tile = other.tiles[i].get();
+                for (size_t j = 0; j != tile_area; ++j) {
+                    if (!equal(tile ? tile[j] : empty_element, other_tile ? other_tile[j] : empty_element)) return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Merges the elements of src into this matrix, where pt + offset is the position in this matrix of the element of src at pt.
+         * For every element of src that is in an allocated tile and for which is_empty(element) is false, merge(element, destElement, result) is called with the element of this matrix that it lands on;
+         * if it returns true, that element is replaced by result (its tile is only allocated or unshared then).
+         * Instead of visiting its elements, a tile of src is shared with this matrix if it lies within the bounds of src, it lands exactly on an unallocated tile of this matrix when translated by offset,
+         * and can_share(elements, tile_area) is true for its elements, so a block that is repeated at tile-aligned offsets is only stored once (until one of the copies is written to).
+         * If a pool is given, the rows of tiles of src are merged in parallel (two passes, so that the rows merged at the same time never land on the same tile of this matrix),
+         * so the callbacks may be called from several threads at once, and must not access this matrix.
+         * @pre the translated src lies within the bounds of this matrix
+         */
+        template <typename SharePredicate, typename EmptyPredicate, typename Merge>
+        void share_or_merge(const tiled_matrix& src, const ext::point& offset, SharePredicate&& can_share, EmptyPredicate&& is_empty, Merge&& merge, ext::thread_pool* pool = nullptr) {
+            // the elements are written without going through allocate(), since the version must not be incremented concurrently
+            ++_generation;
+            const auto mergeTileRow = [&](int32_t tileY) {
+                for (int32_t tileX = 0; tileX != src._tilesX; ++tileX) {
+                    const std::shared_ptr<T[]>& tile = src.tiles[static_cast<size_t>(tileY) * src._tilesX + tileX];
+                    if (!tile) continue;
+                    const ext::point tileTopLeft = src.tile_top_left(tileX, tileY);
+                    const ext::point begin = ext::max(tileTopLeft, ext::point{ 0, 0 });
+                    const ext::point end = ext::min(tileTopLeft + ext::point{ tile_size, tile_size }, src.size());
+                    const ext::point destTopLeft = tileTopLeft + offset + _origin;
+                    if (begin == tileTopLeft && end == tileTopLeft + ext::point{ tile_size, tile_size } && (destTopLeft.x & tile_mask) == 0 && (destTopLeft.y & tile_mask) == 0) {
+                        std::shared_ptr<T[]>& destTile = tiles[tile_index(tileTopLeft.x + offset.x, tileTopLeft.y + offset.y)];
+                        if (!destTile && can_share(static_cast<const T*>(tile.get()), static_cast<size_t>(tile_area))) {
+                            destTile = tile;
+                            continue;
+                        }
+                    }
+                    T result;
+                    for (int32_t y = begin.y; y < end.y; ++y) {
+                        for (int32_t x = begin.x; x < end.x; ++x) {
+                            const T& element = tile[src.offset_in_tile(x, y)];
+                            if (is_empty(element)) continue;
+                            const ext::point pt{ x + offset.x, y + offset.y };
+                            const T* destElement = std::as_const(*this).find(pt.x, pt.y);
+                            if (!merge(element, destElement ? *destElement : empty_element, result)) continue;
+                            std::shared_ptr<T[]>& destTile = tiles[tile_index(pt.x, pt.y)];
+                            if (!destTile) destTile = make_tile();
+                            unshare(destTile)[offset_in_tile(pt.x, pt.y)] = std::move(result);
+                        }
+                    }
+                }
+            };
+            const int32_t srcTilesY = src.num_tile_rows();
+            if (!pool || srcTilesY < 4) {
+                for (int32_t tileY = 0; tileY != srcTilesY; ++tileY) {
+                    mergeTileRow(tileY);
+                }
+                return;
+            }
+            // a row of tiles of src lands on at most two adjacent rows of tiles of this matrix, so the even rows and then the odd rows can each be merged in parallel
+            for (int32_t parity = 0; parity != 2; ++parity) {
+                pool->parallel_for(static_cast<size_t>(srcTilesY - parity + 1) / 2, [&](size_t i) {
+                    mergeTileRow(static_cast<int32_t>(i) * 2 + parity);
+                });
+            }
+        }
+
+        /**
+         * Returns the number of bytes used by this matrix, i.e. its allocated tiles and its table of tiles.
+         * Tiles that are shared with other matrices are counted in full (see unshared_bytes()).
+         */
+        size_t bytes() const noexcept {
+            const size_t num_allocated = static_cast<size_t>(std::count_if(tiles.begin(), tiles.end(), [](const std::shared_ptr<T[]>& tile) {
+                return tile != nullptr;
+            }));
+            return num_allocated * (tile_area * sizeof(T)) + tiles.size() * sizeof(std::shared_ptr<T[]>);
+        }
+
+        /**
+         * Returns the number of bytes used by this matrix that are not shared with the given matrix,
+         * i.e. the memory that would be freed by destroying this matrix while keeping the other one.
+         * Tiles are only shared at the same position, so nothing is shared with a matrix of a different size or origin.
+         */
+        size_t unshared_bytes(const tiled_matrix& other) const noexcept {
+            const bool same_layout = _width == other._width && _height == other._height && _origin == other._origin;
+            size_t num_unshared = 0;
+            for (size_t i = 0; i != tiles.size(); ++i) {
+                if (tiles[i] && !(same_layout && tiles[i] == other.tiles[i])) ++num_unshared;
+            }
+            return num_unshared * (tile_area * sizeof(T)) + tiles.size() * sizeof(std::shared_ptr<T[]>);
+        }
+
+        /**
+         * Flip about a vertical line in the middle of the matrix
+         */
+        void flipHorizontal() {
+            *this = transformed(_width, _height, { _width - 1, 0 }, { -1, 0 }, { 0, 1 });
+        }
+
+        /**
+         * Flip about a horizontal line in the middle of the matrix
+         */
+        void flipVertical() {
+            *this = transformed(_width, _height, { 0, _height - 1 }, { 1, 0 }, { 0, -1 });
+        }
+
+        /**
+         * Rotate by 90 degrees clockwise (the width and height are swapped)
+         */
+        void rotateClockwise() {
+            *this = transformed(_height, _width, { _height - 1, 0 }, { 0, 1 }, { -1, 0 });
+        }
+
+        /**
+         * Rotate by 90 degrees counterclockwise (the width and height are swapped)
+         */
+        void rotateCounterClockwise() {
+            *this = transformed(_height, _width, { 0, _width - 1 }, { 0, -1 }, { 1, 0 });
+        }
+
+        template <typename TSrc, typename TDest, int32_t Shift>
+        friend inline void copy_range(const tiled_matrix<TSrc, Shift>& src, tiled_matrix<TDest, Shift>& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height);
+
+        template <typename TSrc, typename TDest, int32_t Shift>
+        friend inline void move_range(tiled_matrix<TSrc, Shift>& src, tiled_matrix<TDest, Shift>& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height);
+
+        template <typename TSrc, typename TDest, int32_t Shift>
+        friend inline void swap_range(tiled_matrix<TSrc, Shift>& src, tiled_matrix<TDest, Shift>& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height);
+
+    private:
+        // width and height of the blocks that transformed() copies at a time, small enough that the rows of a block in the destination are all still cached after the block is written
+        constexpr static int32_t transform_block_size = 8;
+
+        /**
+         * Returns a new matrix of the given size, where the element at {x,y} of this matrix is written at origin + x * colStep + y * rowStep.
+         * colStep and rowStep are unit vectors along different axes, so this is a flip, a rotation or a transpose.
+         * Each tile is copied in square blocks, so that a rotation (which reads rows and writes columns) doesn't touch a new cache line for every element it writes,
+         * and each row of a block is copied as runs that stay within one tile of the result, so the tile is only looked up once per run.
+         * Unallocated tiles are skipped.
+         */
+        tiled_matrix transformed(int32_t new_width, int32_t new_height, const ext::point& origin, const ext::point& colStep, const ext::point& rowStep) const {
+            tiled_matrix result(new_width, new_height);
+            // the distance between the elements of a run, within a tile of the result
+            const ptrdiff_t destStride = colStep.x + static_cast<ptrdiff_t>(colStep.y) * tile_size;
+            for (int32_t tileY = 0; tileY != num_tile_rows(); ++tileY) {
+                for (int32_t tileX = 0; tileX != _tilesX; ++tileX) {
+                    const T* tile = tiles[static_cast<size_t>(tileY) * _tilesX + tileX].get();
+                    if (!tile) continue;
+                    const ext::point tileTopLeft = tile_top_left(tileX, tileY);
+                    const ext::point begin = ext::max(tileTopLeft, ext::point{ 0, 0 });
+                    const ext::point end = ext::min(tileTopLeft + ext::point{ tile_size, tile_size }, size());
+                    for (int32_t blockY = begin.y; blockY < end.y; blockY += transform_block_size) {
+                        for (int32_t blockX = begin.x; blockX < end.x; blockX += transform_block_size) {
+                            const int32_t yEnd = std::min(end.y, blockY + transform_block_size);
+                            const int32_t xEnd = std::min(end.x, blockX + transform_block_size);
+                            for (int32_t y = blockY; y != yEnd; ++y) {
+                                for (int32_t x = blockX; x != xEnd;) {
+                                    const ext::point dest{ origin.x + colStep.x * x + rowStep.x * y, origin.y + colStep.y * x + rowStep.y * y };
+                                    // the number of elements until the run leaves the tile of the result (the result is new, so its origin is {0,0})
+                                    const int32_t destOffset = colStep.x != 0 ? dest.x & tile_mask : dest.y & tile_mask;
+                                    const int32_t destRemaining = (colStep.x + colStep.y) > 0 ? tile_size - destOffset : destOffset + 1;
+                                    const int32_t length = std::min(xEnd - x, destRemaining);
+                                    // the result is new, so its tiles are never shared
+                                    std::shared_ptr<T[]>& destTile = result.tiles[result.tile_index(dest.x, dest.y)];
+                                    if (!destTile) destTile = make_tile();
+                                    T* destElement = destTile.get() + result.offset_in_tile(dest.x, dest.y);
+                                    const T* srcElement = tile + offset_in_tile(x, y);
+                                    for (int32_t i = 0; i != length; ++i, destElement += destStride) {
+                                        *destElement = srcElement[i];
+                                    }
+                                    x += length;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            return result;
+        }
+
+        /**
+         * Splits a rectangle in the source matrix and a rectangle in the destination matrix into spans of elements that don't cross tile boundaries in either matrix,
+         * and calls callback(src_span, dest_span, length, src_pt, dest_pt) for each of them, where src_span and dest_span are nullptr if their tiles are not allocated.
+         * The tiles of a non-const matrix are unshared, so that its span can be written to.
+         * @pre the rectangles should be within the bounds of their respective matrices
+         */
+        template <typename SrcMatrix, typename DestMatrix, typename Callback>
+        static void for_each_span(SrcMatrix& src, DestMatrix& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height, Callback&& callback) {
+            for (int32_t i = 0; i < height; ++i) {
+                for (int32_t j = 0; j < width;) {
+                    const ext::point src_pt{ src_x + j, src_y + i };
+                    const ext::point dest_pt{ dest_x + j, dest_y + i };
+                    const int32_t length = std::min({ width - j, tile_size - ((src_pt.x + src._origin.x) & tile_mask), tile_size - ((dest_pt.x + dest._origin.x) & tile_mask) });
+                    callback(src.find(src_pt.x, src_pt.y), dest.find(dest_pt.x, dest_pt.y), length, src_pt, dest_pt);
+                    j += length;
+                }
+            }
+        }
+    };
+
+    /**
+     * Copies all the data in a rectangle in the source matrix to a rectangle in the destination matrix
+     * Spans that are unallocated in both matrices are skipped.
+     * @pre the rectangles should be within the bounds of their respective matrices
+     */
+    template <typename TSrc, typename TDest, int32_t Shift>
+    inline void copy_range(const tiled_matrix<TSrc, Shift>& src, tiled_matrix<TDest, Shift>& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height) {
+        tiled_matrix<TSrc, Shift>::for_each_span(src, dest, src_x, src_y, dest_x, dest_y, width, height, [&](const TSrc* src_span, TDest* dest_span, int32_t length, const ext::point&, const ext::point& dest_pt) {
+            if (!src_span) {
+                if (dest_span) std::fill(dest_span, dest_span + length, TDest{});
+                return;
+            }
+            if (!dest_span) dest_span = dest.allocate(dest_pt.x, dest_pt.y);
+            std::copy(src_span, src_span + length, dest_span);
+        });
+    }
+
+    /**
+     * Moves all the data in a rectangle in the source matrix to a rectangle in the destination matrix
+     * Spans that are unallocated in both matrices are skipped.
+     * @pre the rectangles should be within the bounds of their respective matrices
+     */
+    template <typename TSrc, typename TDest, int32_t Shift>
+    inline void move_range(tiled_matrix<TSrc, Shift>& src, tiled_matrix<TDest, Shift>& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height) {
+        if constexpr (std::is_trivially_copyable_v<TSrc>) {
+            // moving is the same as copying, and copying does not have to unshare the source tiles
+            copy_range(std::as_const(src), dest, src_x, src_y, dest_x, dest_y, width, height);
+        }
+        else {
+            tiled_matrix<TSrc, Shift>::for_each_span(src, dest, src_x, src_y, dest_x, dest_y, width, height, [&](TSrc* src_span, TDest* dest_span, int32_t length, const ext::point&, const ext::point& dest_pt) {
+                if (!src_span) {
+                    if (dest_span) std::fill(dest_span, dest_span + length, TDest{});
+                    return;
+                }
+                if (!dest_span) dest_span = dest.allocate(dest_pt.x, dest_pt.y);
+                std::move(src_span, src_span + length, dest_span);
+            });
+        }
+    }
+
+    template <typename TSrc, typename TDest, int32_t Shift>
+    inline void swap_range(tiled_matrix<TSrc, Shift>& src, tiled_matrix<TDest, Shift>& dest, int32_t src_x, int32_t src_y, int32_t dest_x, int32_t dest_y, int32_t width, int32_t height) {
+        tiled_matrix<TSrc, Shift>::for_each_span(src, dest, src_x, src_y, dest_x, dest_y, width, height, [&](TSrc* src_span, TDest* dest_span, int32_t length, const ext::point& src_pt, const ext::point& dest_pt) {
+            if (!src_span && !dest_span) return;
+            if (!src_span) src_span = src.allocate(src_pt.x, src_pt.y);
+            if (!dest_span) dest_span = dest.allocate(dest_pt.x, dest_pt.y);
+            std::swap_ranges(src_span, src_span + length, dest_span);
+        });
+    }
+}
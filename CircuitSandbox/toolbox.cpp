@@ -168,11 +168,11 @@ void Toolbox::ToolRenderable<Tool>::prepareTexture(SDL_Renderer* renderer, Uniqu
 
     // text
     {
-        SDL_Surface* textSurface = TTF_RenderText_Shaded(owner.mainWindow.interfaceFont, Tool::displayName, Tool::displayColor, backColor);
+        const TextCache::TextHandle text = owner.mainWindow.textCache.renderShaded(owner.mainWindow.interfaceFont, Tool::displayName, Tool::displayColor, backColor);
+        SDL_Surface* textSurface = text->getSurface();
         assert(textSurface && (renderArea.h - textSurface->h) / 2 >= 0 && textSurface->h <= renderArea.h);
         SDL_Rect targetRect{ owner.mainWindow.logicalToPhysicalSize(LOGICAL_TEXT_LEFT_PADDING), (renderArea.h - textSurface->h) / 2, textSurface->w, textSurface->h };
         SDL_BlitSurface(textSurface, nullptr, surface, &targetRect);
-        SDL_FreeSurface(textSurface);
     }
 
     SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
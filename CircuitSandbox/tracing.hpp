@@ -0,0 +1,187 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// whether the tracing hooks are compiled in (they cost two clock reads and an uncontended lock per event, so they are off by default)
+// when they are on, the program writes the events as a Chrome trace (viewable in chrome://tracing or https://ui.perfetto.dev) when it exits
+#ifndef CIRCUIT_SANDBOX_TRACING
+#define CIRCUIT_SANDBOX_TRACING 0
+#endif
+
+#if CIRCUIT_SANDBOX_TRACING
+
+// the file that the trace is written to (relative to the working directory)
+#ifndef CIRCUIT_SANDBOX_TRACE_FILE
+#define CIRCUIT_SANDBOX_TRACE_FILE "circuitsandbox-trace.json"
+#endif
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <cstddef>
+
+/**
+ * Collects timed events from all threads, for writing as a Chrome trace.
+ * Each thread appends to its own buffer, so threads only contend for the lock of a buffer while it is being written out.
+ * Each thread keeps at most maxEventsPerThread events, so that a long session doesn't run out of memory (the later events are dropped).
+ */
+class Tracer {
+public:
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * Records the time from its construction to its destruction as an event of the calling thread.
+     */
+    class Scope {
+    private:
+        const char* name;
+        clock::time_point begin;
+    public:
+        explicit Scope(const char* name) noexcept : name(name), begin(clock::now()) {}
+        ~Scope() {
+            Tracer::get().record(name, begin, clock::now());
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+
+private:
+    constexpr static size_t maxEventsPerThread = size_t{ 1 } << 22;
+
+    struct Event {
+        const char* name; // must be a string literal (or otherwise outlive the tracer)
+        clock::time_point begin;
+        clock::time_point end;
+    };
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::string threadName;
+        std::vector<Event> events;
+        size_t droppedEvents = 0;
+    };
+
+    const clock::time_point start = clock::now();
+    std::mutex buffersMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers; // in the order that the threads first recorded something, which is also their thread id in the trace
+
+    Tracer() = default;
+
+    ThreadBuffer& threadBuffer() {
+        // the tracer owns the buffer too, so that it can still be written after the thread exits
+        thread_local const std::shared_ptr<ThreadBuffer> buffer = [this]() {
+            std::shared_ptr<ThreadBuffer> newBuffer = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.push_back(newBuffer);
+            return newBuffer;
+        }();
+        return *buffer;
+    }
+
+    // writes the given string as a JSON string
+    static void writeString(std::ostream& out, const std::string& str) {
+        out << '"';
+        for (char ch : str) {
+            if (ch == '"' || ch == '\\') out << '\\';
+            if (static_cast<unsigned char>(ch) >= 0x20) out << ch;
+        }
+        out << '"';
+    }
+
+public:
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     * Returns the tracer.
+     * It is never destroyed, so that threads that outlive main() (like the file communicator threads) can still record events.
+     */
+    static Tracer& get() {
+        static Tracer* const tracer = new Tracer();
+        return *tracer;
+    }
+
+    void record(const char* name, clock::time_point begin, clock::time_point end) {
+        ThreadBuffer& buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        if (buffer.events.size() == maxEventsPerThread) {
+            ++buffer.droppedEvents;
+            return;
+        }
+        buffer.events.push_back(Event{ name, begin, end });
+    }
+
+    /**
+     * Sets the name that the calling thread is shown with.
+     */
+    void setThreadName(std::string name) {
+        ThreadBuffer& buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.threadName = std::move(name);
+    }
+
+    /**
+     * Writes all the events recorded so far to the given file, in the Chrome trace event format.
+     * Returns false if the file could not be written.
+     */
+    bool writeFile(const char* path) {
+        std::ofstream out(path);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        bool first = true;
+        std::lock_guard<std::mutex> buffersLock(buffersMutex);
+        for (size_t tid = 0; tid != buffers.size(); ++tid) {
+            ThreadBuffer& buffer = *buffers[tid];
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            if (!buffer.threadName.empty()) {
+                out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid << ",\"args\":{\"name\":";
+                writeString(out, buffer.threadName);
+                out << "}}";
+                first = false;
+            }
+            if (buffer.droppedEvents != 0) {
+                out << (first ? "\n" : ",\n") << "{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":1,\"tid\":" << tid << ",\"ts\":0,\"args\":{\"count\":" << buffer.droppedEvents << "}}";
+                first = false;
+            }
+            for (const Event& event : buffer.events) {
+                // the timestamps are in microseconds
+                out << (first ? "\n" : ",\n") << "{\"name\":";
+                writeString(out, event.name);
+                out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                    << ",\"ts\":" << std::chrono::duration<double, std::micro>(event.begin - start).count()
+                    << ",\"dur\":" << std::chrono::duration<double, std::micro>(event.end - event.begin).count() << '}';
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        out.flush();
+        return static_cast<bool>(out);
+    }
+};
+
+#define CIRCUIT_SANDBOX_TRACE_CONCAT_IMPL(a, b) a##b
+#define CIRCUIT_SANDBOX_TRACE_CONCAT(a, b) CIRCUIT_SANDBOX_TRACE_CONCAT_IMPL(a, b)
+
+// records the rest of the enclosing scope as an event with the given name (a string literal)
+#define CIRCUIT_SANDBOX_TRACE_SCOPE(name) const Tracer::Scope CIRCUIT_SANDBOX_TRACE_CONCAT(traceScope, __LINE__)(name)
+// names the calling thread in the trace
+#define CIRCUIT_SANDBOX_TRACE_THREAD(name) Tracer::get().setThreadName(name)
+// writes the events recorded so far to CIRCUIT_SANDBOX_TRACE_FILE
+#define CIRCUIT_SANDBOX_TRACE_WRITE() Tracer::get().writeFile(CIRCUIT_SANDBOX_TRACE_FILE)
+
+#else
+
+#define CIRCUIT_SANDBOX_TRACE_SCOPE(name) ((void)0)
+#define CIRCUIT_SANDBOX_TRACE_THREAD(name) ((void)0)
+#define CIRCUIT_SANDBOX_TRACE_WRITE() ((void)0)
+
+#endif
@@ -0,0 +1,78 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * A single-writer single-reader slot for handing the latest value from one thread to another without locking.
+ * All publish() calls must be synchronized with one another, and all read() calls must be synchronized with one another,
+ * but publish() and read() calls do not need to synchronize with each other.
+ * This is implemented as a triple buffer: the writer and the reader each own one of the three values, and the third one holds the latest published value,
+ * which they swap with their own by exchanging a single atomic index.
+ */
+
+#include <atomic>
+#include <array>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace ext {
+    /**
+     * T = type of the value (default-constructible, so that a slot can be emptied)
+     */
+    template <typename T>
+    class triple_buffer {
+    private:
+        constexpr static size_t cache_line_size = 64;
+        constexpr static uint8_t index_mask = 0b011;
+        constexpr static uint8_t fresh_bit = 0b100; // set if the reader has not taken the middle value yet
+
+        std::array<T, 3> slots;
+        // the writer's index and the reader's index are on separate cache lines, so that publishing doesn't steal the cache line from the reader
+        alignas(cache_line_size) uint8_t backIndex = 0; // only used by the writer
+        alignas(cache_line_size) mutable std::atomic<uint8_t> middleIndex = 1; // mutable because read() swaps the reader's slot into it
+        alignas(cache_line_size) mutable uint8_t frontIndex = 2; // only used by the reader
+
+    public:
+        /**
+         * Makes the given value the latest one.
+         * The slot that the writer gets back is emptied, so that it doesn't keep an old value (e.g. the target of a shared_ptr) alive.
+         * Calling this method must be synchronized with other publish() calls.
+         */
+        void publish(T value) {
+            slots[backIndex] = std::move(value);
+            // std::memory_order_acq_rel so that the reader sees the value we wrote, and we see that the reader is done with the slot that we get back
+            backIndex = middleIndex.exchange(backIndex | fresh_bit, std::memory_order_acq_rel) & index_mask;
+            slots[backIndex] = T{};
+        }
+
+        /**
+         * Gets the latest published value (default-constructed if nothing was published yet).
+         * The returned reference stays valid until the next read() call.
+         * Calling this method must be synchronized with other read() calls.
+         */
+        const T& read() const {
+            if (middleIndex.load(std::memory_order_relaxed) & fresh_bit) {
+                frontIndex = middleIndex.exchange(frontIndex, std::memory_order_acq_rel) & index_mask;
+            }
+            return slots[frontIndex];
+        }
+
+        /**
+         * Empties all the slots.
+         * Calling this method must be synchronized with both publish() and read().
+         */
+        void clear() {
+            for (T& slot : slots) slot = T{};
+            middleIndex.store(middleIndex.load(std::memory_order_relaxed) & index_mask, std::memory_order_relaxed);
+        }
+    };
+}
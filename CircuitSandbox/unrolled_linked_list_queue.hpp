@@ -13,6 +13,7 @@
 #include <type_traits>
 #include <utility>
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cassert>
 
@@ -45,12 +46,17 @@ namespace ext {
         // empty buffers
         node* unused_node;
 
+        // number of nodes allocated (in use or unused), atomic so that bytes() can be read from other threads
+        std::atomic<size_t> num_nodes;
+
         inline node* get_new_or_unused_node() {
             if (unused_node != nullptr) {
                 return std::exchange(unused_node, unused_node->next);
             }
             else {
-                return new node;
+                node* new_node = new node;
+                num_nodes.fetch_add(1, std::memory_order_relaxed);
+                return new_node;
             }
         }
 
@@ -64,6 +70,7 @@ namespace ext {
             back_node = front_node = new node;
             back_index = front_index = 0;
             unused_node = nullptr;
+            num_nodes.store(1, std::memory_order_relaxed);
         }
 
         unrolled_linked_list_queue(const unrolled_linked_list_queue&) = delete;
@@ -130,5 +137,30 @@ namespace ext {
         bool empty() const noexcept {
             return front_index == back_index && front_node == back_node;
         }
+
+        /**
+         * Returns the number of bytes allocated by the queue (nodes are kept for reuse, so this is the most it ever held).
+         * Unlike the rest of the queue, this may be called from any thread.
+         */
+        size_t bytes() const noexcept {
+            return num_nodes.load(std::memory_order_relaxed) * sizeof(node);
+        }
+
+        /**
+         * Invokes callback(element) for every element, from the front to the back.
+         */
+        template <typename Callback>
+        void for_each(Callback callback) const {
+            const node* curr_node = front_node;
+            size_t curr_index = front_index;
+            while (curr_index != back_index || curr_node != back_node) {
+                callback(reinterpret_cast<const T&>(curr_node->data[curr_index]));
+                ++curr_index;
+                if (curr_index == NodeSize) {
+                    curr_node = curr_node->next;
+                    curr_index = 0;
+                }
+            }
+        }
     };
 }
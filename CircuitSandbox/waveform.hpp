@@ -0,0 +1,77 @@
+/*
+ * Circuit Sandbox
+ * Copyright 2018 National University of Singapore <enterprise@nus.edu.sg>
+ *
+ * This file is part of Circuit Sandbox.
+ * Circuit Sandbox is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as published by the Free Software Foundation, version 3.
+ * Circuit Sandbox is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License along with Circuit Sandbox.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+#include "point.hpp"
+
+/**
+ * The recorded levels of the probes (see Simulator::setProbes() and Simulator::readWaveform()), as their levels at startStep followed by their changes up to endStep in order.
+ */
+struct Waveform {
+    // a change of level of one of the probes, in the state after the given step
+    struct Change {
+        uint64_t step; // the step number (see Simulator::getStepNumber()) after the step that made the change
+        uint32_t probe;
+        bool level;
+    };
+
+    std::vector<ext::point> probes; // the canvas position of each probe
+    uint64_t startStep = 0;
+    uint64_t endStep = 0;
+    std::vector<bool> startLevels; // empty if the recording has not started yet
+    std::vector<Change> changes;
+
+    /**
+     * Writes the waveform as a Value Change Dump, with one time unit for each step.
+     */
+    void writeVcd(std::ostream& out) const {
+        // the identifier of each probe, made of the printable characters from '!' to '~'
+        const auto identifier = [](size_t probe) {
+            std::string id;
+            do {
+                id += static_cast<char>('!' + probe % 94);
+                probe /= 94;
+            } while (probe != 0);
+            return id;
+        };
+        const bool started = startLevels.size() == probes.size();
+
+        out << "$comment Circuit Sandbox probes, with one time unit for each simulation step $end\n";
+        out << "$timescale 1 ns $end\n";
+        out << "$scope module circuit $end\n";
+        for (size_t i = 0; i != probes.size(); ++i) {
+            out << "$var wire 1 " << identifier(i) << " probe_" << probes[i].x << '_' << probes[i].y << " $end\n";
+        }
+        out << "$upscope $end\n";
+        out << "$enddefinitions $end\n";
+        out << '#' << startStep << '\n';
+        out << "$dumpvars\n";
+        for (size_t i = 0; i != probes.size(); ++i) {
+            out << (started ? (startLevels[i] ? '1' : '0') : 'x') << identifier(i) << '\n';
+        }
+        out << "$end\n";
+        uint64_t time = startStep;
+        for (const Change& change : changes) {
+            if (change.step != time) {
+                time = change.step;
+                out << '#' << time << '\n';
+            }
+            out << (change.level ? '1' : '0') << identifier(change.probe) << '\n';
+        }
+        if (endStep > time) out << '#' << endStep << '\n';
+    }
+};